@@ -34,6 +34,7 @@ extern "C" {
 #endif
 
 struct fuse;
+struct fuse_async;
 
 typedef int (*fuse_fill_dir_t)(void *buf, const char *name,
     const struct fuse_stat *stbuf, fuse_off_t off);
@@ -87,8 +88,8 @@ struct fuse_operations
         struct fuse_file_info *fi, int cmd, struct fuse_flock *lock);
     /* S */ int (*utimens)(const char *path, const struct fuse_timespec tv[2]);
     /* _ */ int (*bmap)(const char *path, size_t blocksize, uint64_t *idx);
-    /* _ */ unsigned int flag_nullpath_ok:1;
-    /* _ */ unsigned int flag_nopath:1;
+    /* S */ unsigned int flag_nullpath_ok:1;
+    /* S */ unsigned int flag_nopath:1;
     /* _ */ unsigned int flag_utime_omit_ok:1;
     /* _ */ unsigned int flag_reserved:29;
     /* S */ int (*ioctl)(const char *path, int cmd, void *arg, struct fuse_file_info *fi,
@@ -121,8 +122,18 @@ struct fuse_operations
     /* _ */ int (*setattr_x)(const char *path, struct fuse_setattr_x *attr);
     /* _ */ int (*fsetattr_x)(const char *path, struct fuse_setattr_x *attr,
         struct fuse_file_info *fi);
+    /* WinFsp */
+    /* S */ int (*getattr_batch)(const char *path, size_t count, const char *names[],
+        struct fuse_stat *stbufs[], int results[]);
 };
 
+/*
+ * getattr_batch (optional) answers getattr for count entries of directory path after readdir
+ * has listed them without stat data. It fills *stbufs[i] (a struct fuse_stat_ex with
+ * FSP_FUSE_CAP_STAT_EX) and sets results[i] to 0 or -errno for every entry. Returning -errno
+ * makes WinFsp-FUSE fall back to calling getattr for each entry.
+ */
+
 struct fuse_context
 {
     struct fuse *fuse;
@@ -133,6 +144,12 @@ struct fuse_context
     fuse_mode_t umask;
 };
 
+struct fuse_notify_item
+{
+    const char *path;
+    uint32_t action;                    /* FSP_FUSE_NOTIFY_* flags */
+};
+
 #define fuse_main(argc, argv, ops, data)\
     fuse_main_real(argc, argv, ops, sizeof *(ops), data)
 
@@ -156,7 +173,12 @@ FSP_FUSE_API int FSP_FUSE_API_NAME(fsp_fuse_exited)(struct fsp_fuse_env *env,
     struct fuse *f);
 FSP_FUSE_API int FSP_FUSE_API_NAME(fsp_fuse_notify)(struct fsp_fuse_env *env,
     struct fuse *f, const char *path, uint32_t action);
+FSP_FUSE_API int FSP_FUSE_API_NAME(fsp_fuse_notify_batch)(struct fsp_fuse_env *env,
+    struct fuse *f, const struct fuse_notify_item *items, size_t count);
 FSP_FUSE_API struct fuse_context *FSP_FUSE_API_NAME(fsp_fuse_get_context)(struct fsp_fuse_env *env);
+FSP_FUSE_API struct fuse_async *FSP_FUSE_API_NAME(fsp_fuse_async_begin)(struct fsp_fuse_env *env);
+FSP_FUSE_API void FSP_FUSE_API_NAME(fsp_fuse_async_end)(struct fsp_fuse_env *env,
+    struct fuse_async *async, int result);
 
 FSP_FUSE_SYM(
 int fuse_main_real(int argc, char *argv[],
@@ -223,6 +245,22 @@ int fuse_notify(struct fuse *f, const char *path, uint32_t action),
         (fsp_fuse_env(), f, path, action);
 })
 
+/*
+ * Batched change notification.
+ *
+ * fuse_notify_batch is equivalent to calling fuse_notify for every item, but sends all items
+ * to the kernel under a single notification session and in as few requests as possible.
+ * Consecutive duplicate notifications for the same path are coalesced. The function must not
+ * be called from within a file system operation; it returns -EAGAIN if the notification
+ * session cannot be started because of concurrent renames.
+ */
+FSP_FUSE_SYM(
+int fuse_notify_batch(struct fuse *f, const struct fuse_notify_item *items, size_t count),
+{
+    return FSP_FUSE_API_CALL(fsp_fuse_notify_batch)
+        (fsp_fuse_env(), f, items, count);
+})
+
 FSP_FUSE_SYM(
 struct fuse_context *fuse_get_context(void),
 {
@@ -230,6 +268,31 @@ struct fuse_context *fuse_get_context(void),
         (fsp_fuse_env());
 })
 
+/*
+ * Asynchronous completion (FSP_FUSE_CAP_ASYNC).
+ *
+ * A read, write or readdir operation may call fuse_async_begin to complete later from another
+ * thread. The value that the operation returns is then ignored and the operation is finished
+ * by calling fuse_async_end exactly once with the result that the operation would have
+ * returned. The read/write buffer, the readdir buffer and filler and the fuse_file_info::fh
+ * remain valid until fuse_async_end; the path and fuse_file_info pointer do not. The filler
+ * may not be called concurrently for the same operation. fuse_async_begin returns NULL when
+ * the operation cannot be completed asynchronously; the operation must then complete as usual.
+ */
+FSP_FUSE_SYM(
+struct fuse_async *fuse_async_begin(void),
+{
+    return FSP_FUSE_API_CALL(fsp_fuse_async_begin)
+        (fsp_fuse_env());
+})
+
+FSP_FUSE_SYM(
+void fuse_async_end(struct fuse_async *async, int result),
+{
+    FSP_FUSE_API_CALL(fsp_fuse_async_end)
+        (fsp_fuse_env(), async, result);
+})
+
 FSP_FUSE_SYM(
 int fuse_getgroups(int size, fuse_gid_t list[]),
 {
@@ -111,6 +111,10 @@ extern const __declspec(selectany) GUID FspFsvrtDeviceClassGuid =
     CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x800 + 's', METHOD_BUFFERED, FILE_ANY_ACCESS)
 #define FSP_FSCTL_NOTIFY                \
     CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x800 + 'n', METHOD_NEITHER, FILE_ANY_ACCESS)
+#define FSP_FSCTL_QUERY_IOQ             \
+    CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x800 + 'Q', METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define FSP_FSCTL_QUERY_REQUEST_POOL    \
+    CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x800 + 'P', METHOD_BUFFERED, FILE_ANY_ACCESS)
 #define FSP_FSCTL_UNLOAD                \
     CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x800 + 'U', METHOD_NEITHER, FILE_ANY_ACCESS)
 
@@ -190,6 +194,7 @@ enum
     FspFsctlIrpCapacityMinimum = 100,
     FspFsctlIrpCapacityMaximum = 1000,
     FspFsctlIrpCapacityDefault = 1000,
+    FspFsctlMetaCacheSizeMaximum = 256 * 1024,  /* KiB */
 };
 #define FSP_FSCTL_VOLUME_PARAMS_V0_FIELD_DEFN\
     UINT16 Version;                     /* set to 0 or sizeof(FSP_FSCTL_VOLUME_PARAMS) */\
@@ -252,8 +257,11 @@ enum
     UINT32 StreamInfoTimeout;           /* stream info timeout (millis); overrides FileInfoTimeout */\
     UINT32 EaTimeout;                   /* EA timeout (millis); overrides FileInfoTimeout */\
     UINT32 FsextControlCode;\
-    UINT32 Reserved32[1];\
-    UINT64 Reserved64[2];
+    UINT32 NegativeNameTimeout;         /* negative name lookup timeout (millis); 0: disabled */\
+    UINT32 SecurityCacheSize;           /* security meta cache size (KiB); 0: default */\
+    UINT32 DirInfoCacheSize;            /* dir info meta cache size (KiB); 0: default */\
+    UINT32 StreamInfoCacheSize;         /* stream info meta cache size (KiB); 0: default */\
+    UINT32 EaCacheSize;                 /* EA meta cache size (KiB); 0: default */
 typedef struct
 {
     FSP_FSCTL_VOLUME_PARAMS_V0_FIELD_DEFN
@@ -330,6 +338,43 @@ typedef struct
 } FSP_FSCTL_NOTIFY_INFO;
 FSP_FSCTL_STATIC_ASSERT(12 == sizeof(FSP_FSCTL_NOTIFY_INFO),
     "sizeof(FSP_FSCTL_NOTIFY_INFO) must be exactly 12.");
+enum
+{
+    FspFsctlIoqClassMetadata = 0,       /* create, cleanup, information, security, etc. */
+    FspFsctlIoqClassInteractive,        /* non-paging read/write, directory enumeration */
+    FspFsctlIoqClassPaging,             /* paging read/write, flush */
+    FspFsctlIoqClassBackground,         /* close, low I/O priority */
+    FspFsctlIoqClassCount,
+};
+typedef struct
+{
+    UINT32 PendingCount;                /* IRP's currently pending */
+    UINT32 Reserved;
+    UINT64 DispatchCount;               /* IRP's dispatched to the file system */
+    UINT64 WaitTime;                    /* total pending time of dispatched IRP's (micros) */
+    UINT64 WaitTimeMax;                 /* maximum pending time of a dispatched IRP (micros) */
+} FSP_FSCTL_IOQ_CLASS_INFO;
+typedef struct
+{
+    FSP_FSCTL_IOQ_CLASS_INFO Class[FspFsctlIoqClassCount];
+} FSP_FSCTL_IOQ_INFO;
+#define FSP_FSCTL_REQUEST_POOL_CLASS_COUNT 8    /* 128 bytes to 16K */
+typedef struct
+{
+    UINT32 BlockSize;                   /* size of the blocks in this class */
+    UINT32 CachedCount;                 /* blocks currently cached by all processors */
+    UINT64 AllocCount;                  /* allocations */
+    UINT64 AllocHitCount;               /* allocations served from a processor cache */
+    UINT64 FreeCount;                   /* frees */
+    UINT64 FreeHitCount;                /* frees kept in a processor cache */
+} FSP_FSCTL_REQUEST_POOL_CLASS_INFO;
+typedef struct
+{
+    UINT32 ProcessorCount;              /* processors with a cache */
+    UINT32 IrpCapacity;                 /* IRP capacity of all volumes; sizes the caches */
+    FSP_FSCTL_REQUEST_POOL_CLASS_INFO Request[FSP_FSCTL_REQUEST_POOL_CLASS_COUNT];
+    FSP_FSCTL_REQUEST_POOL_CLASS_INFO WorkItem;
+} FSP_FSCTL_REQUEST_POOL_INFO;
 typedef struct
 {
     UINT64 UserContext;
@@ -695,6 +740,10 @@ FSP_API NTSTATUS FspFsctlStop(HANDLE VolumeHandle);
 FSP_API NTSTATUS FspFsctlStop0(HANDLE VolumeHandle);
 FSP_API NTSTATUS FspFsctlNotify(HANDLE VolumeHandle,
     FSP_FSCTL_NOTIFY_INFO *NotifyInfo, SIZE_T Size);
+FSP_API NTSTATUS FspFsctlQueryIoq(HANDLE VolumeHandle,
+    FSP_FSCTL_IOQ_INFO *IoqInfo);
+FSP_API NTSTATUS FspFsctlQueryRequestPool(HANDLE VolumeHandle,
+    FSP_FSCTL_REQUEST_POOL_INFO *RequestPoolInfo);
 FSP_API NTSTATUS FspFsctlGetVolumeList(PWSTR DevicePath,
     PWCHAR VolumeListBuf, PSIZE_T PVolumeListSize);
 FSP_API NTSTATUS FspFsctlPreflight(PWSTR DevicePath);
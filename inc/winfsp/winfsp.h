@@ -139,12 +139,46 @@ typedef NTSTATUS FSP_FILE_SYSTEM_OPERATION(FSP_FILE_SYSTEM *,
  * 2. A coarse-grained concurrency model where all file system accesses are
  * guarded by a mutually exclusive lock.
  *
+ * 3. A sharded concurrency model where file system NAMESPACE accesses are
+ * guarded using a table of exclusive-shared locks that is indexed by the
+ * parent directory of the accessed file. Namespace accesses in different
+ * directories do not block each other. Renames lock both the source and
+ * target directory in a fixed order.
+ *
+ * The sharded concurrency model applies the exclusive-shared locks as
+ * follows:
+ * <ul>
+ * <li>EXCL(volume): SetVolumeLabel, Flush(Volume)</li>
+ * <li>EXCL(directory): Create, Cleanup(Delete), SetInformation(Rename),
+ * SetReparsePoint</li>
+ * <li>SHRD(directory): Open, SetInformation(Disposition), GetReparsePoint,
+ * ReadDirectory (only when PassQueryDirectoryFileName is set; see below)</li>
+ * <li>SHRD(volume): Overwrite, GetVolumeInfo, ReadDirectory</li>
+ * <li>NONE: all other operations</li>
+ * </ul>
+ *
+ * The sharded model is only suitable for file systems whose internal data
+ * structures are safe for concurrent access. ReadDirectory is only serialized
+ * against changes to the same directory when the file system sets the
+ * PassQueryDirectoryFileName volume parameter.
+ *
+ * A rename locks only the parent directories of its source and target; it does
+ * not lock the directory being renamed or any of its descendants. For example,
+ * while a directory D is being renamed, a Create directly in D (which locks D)
+ * or an Open of a file in a subdirectory of D (which locks that subdirectory)
+ * runs concurrently with the rename and may see either the old or the new path
+ * of D. File systems that resolve paths component by component must therefore
+ * tolerate a directory changing its name or parent underneath them; file
+ * systems that need renames to be atomic with respect to their descendants
+ * should use the FINE strategy instead.
+ *
  * @see FspFileSystemSetOperationGuardStrategy
  */
 typedef enum
 {
     FSP_FILE_SYSTEM_OPERATION_GUARD_STRATEGY_FINE = 0,
     FSP_FILE_SYSTEM_OPERATION_GUARD_STRATEGY_COARSE,
+    FSP_FILE_SYSTEM_OPERATION_GUARD_STRATEGY_SHARDED,
 } FSP_FILE_SYSTEM_OPERATION_GUARD_STRATEGY;
 enum
 {
@@ -1817,6 +1851,116 @@ FSP_API VOID FspFileSystemReadDirectoryBuffer(PVOID *PDirBuffer,
     PWSTR Marker,
     PVOID Buffer, ULONG Length, PULONG PBytesTransferred);
 FSP_API VOID FspFileSystemDeleteDirectoryBuffer(PVOID *PDirBuffer);
+/*
+ * Directory buffer cache
+ */
+/**
+ * Create a directory buffer cache.
+ *
+ * A directory buffer cache allows open handles of the same directory to share a single
+ * sorted directory buffer. Use FspFileSystemAcquireCachedDirectoryBuffer and
+ * FspFileSystemReleaseCachedDirectoryBuffer in place of FspFileSystemAcquireDirectoryBuffer
+ * and FspFileSystemReleaseDirectoryBuffer. FspFileSystemReadDirectoryBuffer and
+ * FspFileSystemDeleteDirectoryBuffer are used as usual.
+ *
+ * Cached buffers are immutable snapshots. A handle that reads from a snapshot keeps it alive
+ * even after it has been evicted or replaced in the cache. Snapshots are evicted in least
+ * recently used order when the cache exceeds its memory budget.
+ *
+ * @param MemoryBudget
+ *     The maximum amount of memory in bytes that cached directory buffers may use.
+ * @param PCache [out]
+ *     Pointer that will receive the directory buffer cache.
+ * @return
+ *     STATUS_SUCCESS or error code.
+ * @see
+ *     FspFileSystemDeleteDirectoryBufferCache
+ *     FspFileSystemAcquireCachedDirectoryBuffer
+ */
+FSP_API NTSTATUS FspFileSystemCreateDirectoryBufferCache(ULONG MemoryBudget, PVOID *PCache);
+/**
+ * Delete a directory buffer cache.
+ *
+ * Directory buffers of open handles that currently share a cached snapshot remain valid
+ * until they are deleted with FspFileSystemDeleteDirectoryBuffer.
+ *
+ * @param Cache
+ *     The directory buffer cache. May be NULL.
+ * @see
+ *     FspFileSystemCreateDirectoryBufferCache
+ */
+FSP_API VOID FspFileSystemDeleteDirectoryBufferCache(PVOID Cache);
+/**
+ * Invalidate the cached directory buffer of a directory.
+ *
+ * This is not needed when the file system changes the ChangeVersion of a directory whenever
+ * its contents change; it is useful to release memory early, for example when a directory
+ * is deleted.
+ *
+ * @param Cache
+ *     The directory buffer cache.
+ * @param DirectoryId
+ *     The identity of the directory (e.g. its index number).
+ */
+FSP_API VOID FspFileSystemInvalidateDirectoryBufferCache(PVOID Cache,
+    UINT64 DirectoryId);
+/**
+ * Acquire a directory buffer that may be shared through a directory buffer cache.
+ *
+ * This is the cached counterpart of FspFileSystemAcquireDirectoryBuffer. If the cache
+ * contains a buffer for the same DirectoryId and ChangeVersion, the directory buffer of
+ * the handle is made to share it and this function returns FALSE. If the handle already has
+ * a directory buffer and Reset is FALSE, the buffer is used as is and this function also
+ * returns FALSE. Otherwise the directory buffer is acquired for filling and this function
+ * returns TRUE; the file system must then fill it with FspFileSystemFillDirectoryBuffer
+ * and release it with FspFileSystemReleaseCachedDirectoryBuffer.
+ *
+ * @param Cache
+ *     The directory buffer cache.
+ * @param DirectoryId
+ *     The identity of the directory (e.g. its index number).
+ * @param ChangeVersion
+ *     A version that must change whenever the directory contents change. The file system
+ *     should obtain the ChangeVersion prior to enumerating the directory.
+ * @param PDirBuffer
+ *     Pointer to the directory buffer of the handle.
+ * @param Reset
+ *     TRUE if the directory buffer of the handle should be discarded (e.g. because the
+ *     enumeration is restarted).
+ * @param PResult [out]
+ *     Pointer to a memory location that will receive the operation result.
+ * @return
+ *     TRUE if the directory buffer must be filled, FALSE otherwise. On error this function
+ *     returns FALSE and PResult receives the error code.
+ * @see
+ *     FspFileSystemReleaseCachedDirectoryBuffer
+ *     FspFileSystemAcquireDirectoryBuffer
+ */
+FSP_API BOOLEAN FspFileSystemAcquireCachedDirectoryBuffer(PVOID Cache,
+    UINT64 DirectoryId, UINT64 ChangeVersion,
+    PVOID *PDirBuffer, BOOLEAN Reset, PNTSTATUS PResult);
+/**
+ * Release a directory buffer and add it to a directory buffer cache.
+ *
+ * This must only be called after FspFileSystemAcquireCachedDirectoryBuffer has returned
+ * TRUE, with the same DirectoryId and ChangeVersion. The filled directory buffer replaces
+ * any buffer cached for the same DirectoryId; if it does not fit in the memory budget it
+ * remains private to the handle.
+ *
+ * @param Cache
+ *     The directory buffer cache.
+ * @param DirectoryId
+ *     The identity of the directory (e.g. its index number).
+ * @param ChangeVersion
+ *     The version that was passed to FspFileSystemAcquireCachedDirectoryBuffer.
+ * @param PDirBuffer
+ *     Pointer to the directory buffer of the handle.
+ * @see
+ *     FspFileSystemAcquireCachedDirectoryBuffer
+ */
+FSP_API VOID FspFileSystemReleaseCachedDirectoryBuffer(PVOID Cache,
+    UINT64 DirectoryId, UINT64 ChangeVersion,
+    PVOID *PDirBuffer);
 
 /*
  * Security
@@ -1909,6 +2053,23 @@ FSP_API NTSTATUS FspPosixMapWindowsToPosixPathEx(PWSTR WindowsPath, char **PPosi
     BOOLEAN Translate);
 FSP_API NTSTATUS FspPosixMapPosixToWindowsPathEx(const char *PosixPath, PWSTR *PWindowsPath,
     BOOLEAN Translate);
+/**
+ * Map a path into a caller supplied buffer.
+ *
+ * These functions perform the same conversion as FspPosixMapWindowsToPosixPathEx and
+ * FspPosixMapPosixToWindowsPathEx, but do not allocate memory.
+ *
+ * @param PSize [in,out]
+ *     On input the size of the output buffer in bytes. On output the size of the converted
+ *     path in bytes (including the terminating NUL). If the buffer is too small the functions
+ *     return STATUS_BUFFER_TOO_SMALL and this parameter receives the required size.
+ * @return
+ *     STATUS_SUCCESS or STATUS_BUFFER_TOO_SMALL.
+ */
+FSP_API NTSTATUS FspPosixMapWindowsToPosixPathBuf(PWSTR WindowsPath, char *PosixPath,
+    PULONG PSize, BOOLEAN Translate);
+FSP_API NTSTATUS FspPosixMapPosixToWindowsPathBuf(const char *PosixPath, PWSTR WindowsPath,
+    PULONG PSize, BOOLEAN Translate);
 static inline
 NTSTATUS FspPosixMapWindowsToPosixPath(PWSTR WindowsPath, char **PPosixPath)
 {
@@ -20,11 +20,17 @@
  */
 
 #include <dll/library.h>
+#include <shared/ku/wcsname.h>
 
 #define FspFileSystemDirectoryBufferLoBound     (256)
 #define FspFileSystemDirectoryBufferHiBound     (1024 * 1024)
 #define FspFileSystemDirectoryBufferLoFactor    (4)
 #define FspFileSystemDirectoryBufferHiFactor    (2)
+#define FspFileSystemDirectoryBufferOutOfOrderRatio (8)
+#define FspFileSystemDirectoryBufferBacktrackMax (8)
+#define FspFileSystemDirectoryBufferKeyLoBound  (64)
+#define FspFileSystemDirectoryBufferKeyPrefixLength (4)
+#define FspFileSystemDirectoryBufferCacheBucketCount (256)
 
 #define RETURN(R, B)                    \
     do                                  \
@@ -34,56 +40,88 @@
         return B;                       \
     } while (0,0)
 
+/*
+ * Sort keys
+ *
+ * Every directory buffer entry has a sort key that contains the length and the first
+ * few characters of its normalized file name. The keys are kept in an array separate
+ * from the buffer, so that most comparisons during sorting and searching are decided
+ * without touching the (scattered) FSP_FSCTL_DIR_INFO entries. Only when two keys have
+ * the same prefix do we need to compare the rest of the file names.
+ */
 typedef struct
+{
+    UINT64 Prefix;                      /* first chars of normalized file name */
+    ULONG Length;                       /* file name length (chars) */
+    ULONG Offset;                       /* FSP_FSCTL_DIR_INFO offset in buffer */
+} FSP_FILE_SYSTEM_DIRECTORY_BUFFER_KEY;
+
+typedef struct _FSP_FILE_SYSTEM_DIRECTORY_BUFFER
 {
     SRWLOCK Lock;
     ULONG InitialCapacity, Capacity, LoMark, HiMark;
     PUINT8 Buffer;
+    ULONG KeyCapacity;
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_KEY *Keys;
+    struct _FSP_FILE_SYSTEM_DIRECTORY_BUFFER *Snapshot;
+                                        /* shared immutable buffer from directory buffer cache */
+    LONG RefCount;                      /* snapshots only */
 } FSP_FILE_SYSTEM_DIRECTORY_BUFFER;
 
-static int FspFileSystemDirectoryBufferFileNameCmp(PWSTR a, int alen, PWSTR b, int blen)
-{
-    int len, res;
+#define FspFileSystemDirectoryBufferKeyName(Buffer, Key)\
+    (((FSP_FSCTL_DIR_INFO *)((Buffer) + (Key)->Offset))->FileNameBuf)
 
-    if (-1 == alen)
-        alen = (int)lstrlenW(a);
-    if (-1 == blen)
-        blen = (int)lstrlenW(b);
-
-    len = alen < blen ? alen : blen;
+static inline VOID FspFileSystemDirectoryBufferMakeKey(FSP_FILE_SYSTEM_DIRECTORY_BUFFER_KEY *Key,
+    PWSTR FileName, ULONG Length, ULONG Offset)
+{
+    UINT64 Prefix = 0;
 
     /* order "." and ".." first */
-    switch (alen)
+    switch (Length)
     {
     case 1:
-        if (L'.' == a[0])
-            a = L"\1";
+        if (L'.' == FileName[0])
+            FileName = L"\1";
         break;
     case 2:
-        if (L'.' == a[0] && L'.' == a[1])
-            a = L"\1\1";
+        if (L'.' == FileName[0] && L'.' == FileName[1])
+            FileName = L"\1\1";
         break;
     }
 
-    /* order "." and ".." first */
-    switch (blen)
-    {
-    case 1:
-        if (L'.' == b[0])
-            b = L"\1";
-        break;
-    case 2:
-        if (L'.' == b[0] && L'.' == b[1])
-            b = L"\1\1";
-        break;
-    }
+    /* pack prefix chars so that integer order is the same as invariant_wcsncmp order */
+    for (ULONG I = 0; FspFileSystemDirectoryBufferKeyPrefixLength > I; I++)
+        Prefix = (Prefix << 16) | (Length > I ? (UINT16)FileName[I] : 0);
+
+    Key->Prefix = Prefix;
+    Key->Length = Length;
+    Key->Offset = Offset;
+}
 
-    res = invariant_wcsncmp(a, b, len);
+static __forceinline
+int FspFileSystemDirectoryBufferKeyCmp(
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_KEY *KeyA, PWSTR a,
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_KEY *KeyB, PWSTR b)
+{
+    ULONG Length;
+    int Result;
 
-    if (0 == res)
-        res = alen - blen;
+    if (KeyA->Prefix != KeyB->Prefix)
+        return KeyA->Prefix < KeyB->Prefix ? -1 : +1;
 
-    return res;
+    /* "." and ".." are always decided by the prefix, so no need to normalize here */
+    Length = KeyA->Length < KeyB->Length ? KeyA->Length : KeyB->Length;
+    if (FspFileSystemDirectoryBufferKeyPrefixLength < Length)
+    {
+        Result = FspWcsnCmp(
+            a + FspFileSystemDirectoryBufferKeyPrefixLength,
+            b + FspFileSystemDirectoryBufferKeyPrefixLength,
+            Length - FspFileSystemDirectoryBufferKeyPrefixLength);
+        if (0 != Result)
+            return Result;
+    }
+
+    return (int)KeyA->Length - (int)KeyB->Length;
 }
 
 /*
@@ -93,20 +131,20 @@ static int FspFileSystemDirectoryBufferFileNameCmp(PWSTR a, int alen, PWSTR b, i
 static BOOLEAN FspFileSystemSearchDirectoryBuffer(FSP_FILE_SYSTEM_DIRECTORY_BUFFER *DirBuffer,
     PWSTR Marker, int MarkerLen, PULONG PIndexNum)
 {
-    PULONG Index = (PULONG)(DirBuffer->Buffer + DirBuffer->HiMark);
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_KEY *Keys = DirBuffer->Keys, MarkerKey;
     ULONG Count = (DirBuffer->Capacity - DirBuffer->HiMark) / sizeof(ULONG);
-    FSP_FSCTL_DIR_INFO *DirInfo;
     int Lo = 0, Hi = Count - 1, Mi;
     int CmpResult;
 
+    FspFileSystemDirectoryBufferMakeKey(&MarkerKey, Marker, MarkerLen, 0);
+
     while (Lo <= Hi)
     {
         Mi = (unsigned)(Lo + Hi) >> 1;
 
-        DirInfo = (PVOID)(DirBuffer->Buffer + Index[Mi]);
-        CmpResult = FspFileSystemDirectoryBufferFileNameCmp(
-            DirInfo->FileNameBuf, (DirInfo->Size - sizeof *DirInfo) / sizeof(WCHAR),
-            Marker, MarkerLen);
+        CmpResult = FspFileSystemDirectoryBufferKeyCmp(
+            &Keys[Mi], FspFileSystemDirectoryBufferKeyName(DirBuffer->Buffer, &Keys[Mi]),
+            &MarkerKey, Marker);
 
         if (0 > CmpResult)
             Lo = Mi + 1;
@@ -133,49 +171,50 @@ static BOOLEAN FspFileSystemSearchDirectoryBuffer(FSP_FILE_SYSTEM_DIRECTORY_BUFF
  * and median-of-three partitioning.
  */
 
-#define less(a, b)                      FspFileSystemDirectoryBufferLess(Buffer, a, b)
-#define exch(a, b)                      { ULONG t = a; a = b; b = t; }
+#define less(a, b)                      FspFileSystemDirectoryBufferLess(Buffer, &(a), &(b))
+#define exch(a, b)                      { FSP_FILE_SYSTEM_DIRECTORY_BUFFER_KEY t = a; a = b; b = t; }
 #define compexch(a, b)                  if (less(b, a)) exch(a, b)
 #define push(i)                         (stack[stackpos++] = (i))
 #define pop()                           (stack[--stackpos])
 
 static __forceinline
-int FspFileSystemDirectoryBufferLess(PUINT8 Buffer, int a, int b)
+int FspFileSystemDirectoryBufferLess(PUINT8 Buffer,
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_KEY *a, FSP_FILE_SYSTEM_DIRECTORY_BUFFER_KEY *b)
 {
-    FSP_FSCTL_DIR_INFO *DirInfoA = (FSP_FSCTL_DIR_INFO *)(Buffer + a);
-    FSP_FSCTL_DIR_INFO *DirInfoB = (FSP_FSCTL_DIR_INFO *)(Buffer + b);
-    return 0 > FspFileSystemDirectoryBufferFileNameCmp(
-        DirInfoA->FileNameBuf, (DirInfoA->Size - sizeof *DirInfoA) / sizeof(WCHAR),
-        DirInfoB->FileNameBuf, (DirInfoB->Size - sizeof *DirInfoB) / sizeof(WCHAR));
+    return 0 > FspFileSystemDirectoryBufferKeyCmp(
+        a, FspFileSystemDirectoryBufferKeyName(Buffer, a),
+        b, FspFileSystemDirectoryBufferKeyName(Buffer, b));
 }
 
 static __forceinline
-int FspFileSystemPartitionDirectoryBuffer(PUINT8 Buffer, PULONG Index, int l, int r)
+int FspFileSystemPartitionDirectoryBuffer(PUINT8 Buffer,
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_KEY *Keys, int l, int r)
 {
     int i = l - 1, j = r;
-    ULONG v = Index[r];
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_KEY v = Keys[r];
 
     for (;;)
     {
-        while (less(Index[++i], v))
+        while (less(Keys[++i], v))
             ;
 
-        while (less(v, Index[--j]))
+        while (less(v, Keys[--j]))
             if (j == l)
                 break;
 
         if (i >= j)
             break;
 
-        exch(Index[i], Index[j]);
+        exch(Keys[i], Keys[j]);
     }
 
-    exch(Index[i], Index[r]);
+    exch(Keys[i], Keys[r]);
 
     return i;
 }
 
-static VOID FspFileSystemQSortDirectoryBuffer(PUINT8 Buffer, PULONG Index, int l, int r)
+static VOID FspFileSystemQSortDirectoryBuffer(PUINT8 Buffer,
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_KEY *Keys, int l, int r)
 {
     int stack[64], stackpos = 0;
     int i;
@@ -185,17 +224,17 @@ static VOID FspFileSystemQSortDirectoryBuffer(PUINT8 Buffer, PULONG Index, int l
         while (r > l)
         {
 #if 1
-            exch(Index[(l + r) / 2], Index[r - 1]);
-            compexch(Index[l], Index[r - 1]);
-            compexch(Index[l], Index[r]);
-            compexch(Index[r - 1], Index[r]);
+            exch(Keys[(l + r) / 2], Keys[r - 1]);
+            compexch(Keys[l], Keys[r - 1]);
+            compexch(Keys[l], Keys[r]);
+            compexch(Keys[r - 1], Keys[r]);
 
             if (r - 1 <= l + 1)
                 break;
 
-            i = FspFileSystemPartitionDirectoryBuffer(Buffer, Index, l + 1, r - 1);
+            i = FspFileSystemPartitionDirectoryBuffer(Buffer, Keys, l + 1, r - 1);
 #else
-            i = FspFileSystemPartitionDirectoryBuffer(Buffer, Index, l, r);
+            i = FspFileSystemPartitionDirectoryBuffer(Buffer, Keys, l, r);
 #endif
 
             if (i - l > r - i)
@@ -219,17 +258,104 @@ static VOID FspFileSystemQSortDirectoryBuffer(PUINT8 Buffer, PULONG Index, int l
 
 #undef push
 #undef pop
-#undef less
 #undef compexch
 #undef exch
 
+/*
+ * Adaptive sort
+ *
+ * Many file systems deliver directory entries in sorted or nearly sorted order.
+ * For such input we split the keys in a single pass into an ascending sequence
+ * and a (small) sequence of out-of-order keys. We then quick sort the out-of-order
+ * keys and merge the two sequences. This takes O(n + m log m) time for m
+ * out-of-order keys and O(n) time for presorted input.
+ *
+ * If there are too many out-of-order keys we fall back to quick sorting all keys.
+ */
+
+static BOOLEAN FspFileSystemAdaptiveSortDirectoryBuffer(PUINT8 Buffer,
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_KEY *Keys, ULONG Count)
+{
+    ULONG OutOfOrderMax = Count / FspFileSystemDirectoryBufferOutOfOrderRatio;
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_KEY *OutOfOrder;
+    ULONG I, J, K, M, N;
+
+    OutOfOrder = MemAlloc(
+        (OutOfOrderMax + FspFileSystemDirectoryBufferBacktrackMax + 1) * sizeof *OutOfOrder);
+    if (0 == OutOfOrder)
+        return FALSE;
+
+    /*
+     * Split the keys into an ascending sequence Keys[0, M) and out-of-order keys
+     * OutOfOrder[0, N). If a key is less than the last few ascending keys, those
+     * keys are moved to the out-of-order keys instead; this ensures that a short
+     * burst of "high" keys cannot make all following keys out-of-order.
+     */
+    for (I = 0, M = 0, N = 0; Count > I; I++)
+    {
+        for (J = 0;
+            M > J && FspFileSystemDirectoryBufferBacktrackMax >= J && less(Keys[I], Keys[M - 1 - J]);
+            J++)
+            ;
+
+        if (FspFileSystemDirectoryBufferBacktrackMax >= J)
+        {
+            for (; 0 < J; J--)
+                OutOfOrder[N++] = Keys[--M];
+            Keys[M++] = Keys[I];
+        }
+        else
+            OutOfOrder[N++] = Keys[I];
+
+        if (OutOfOrderMax < N)
+        {
+            /* too many out-of-order keys; restore keys and give up */
+            memcpy(Keys + M, OutOfOrder, N * sizeof *OutOfOrder);
+            MemFree(OutOfOrder);
+            return FALSE;
+        }
+    }
+
+    if (1 < N)
+        FspFileSystemQSortDirectoryBuffer(Buffer, OutOfOrder, 0, N - 1);
+
+    /* merge from the back; Keys[M, Count) is free space */
+    for (I = M, J = N, K = Count; 0 < J;)
+    {
+        if (0 < I && less(OutOfOrder[J - 1], Keys[I - 1]))
+            Keys[--K] = Keys[--I];
+        else
+            Keys[--K] = OutOfOrder[--J];
+    }
+
+    MemFree(OutOfOrder);
+    return TRUE;
+}
+
+#undef less
+
 static inline VOID FspFileSystemSortDirectoryBuffer(FSP_FILE_SYSTEM_DIRECTORY_BUFFER *DirBuffer)
 {
     PUINT8 Buffer = DirBuffer->Buffer;
-    PULONG Index = (PULONG)(DirBuffer->Buffer + DirBuffer->HiMark);
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_KEY *Keys = DirBuffer->Keys;
     ULONG Count = (DirBuffer->Capacity - DirBuffer->HiMark) / sizeof(ULONG);
 
-    FspFileSystemQSortDirectoryBuffer(Buffer, Index, 0, Count - 1);
+    if (2 > Count)
+        return;
+
+    if (!FspFileSystemAdaptiveSortDirectoryBuffer(Buffer, Keys, Count))
+        FspFileSystemQSortDirectoryBuffer(Buffer, Keys, 0, Count - 1);
+}
+
+static VOID FspFileSystemDereferenceDirectoryBufferSnapshot(
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER *Snapshot)
+{
+    if (0 == InterlockedDecrement(&Snapshot->RefCount))
+    {
+        MemFree(Snapshot->Keys);
+        MemFree(Snapshot->Buffer);
+        MemFree(Snapshot);
+    }
 }
 
 FSP_API BOOLEAN FspFileSystemAcquireDirectoryBufferEx(PVOID* PDirBuffer,
@@ -276,6 +402,13 @@ FSP_API BOOLEAN FspFileSystemAcquireDirectoryBufferEx(PVOID* PDirBuffer,
     {
         AcquireSRWLockExclusive(&DirBuffer->Lock);
 
+        /* never modify a shared snapshot; fill our own buffer instead */
+        if (0 != DirBuffer->Snapshot)
+        {
+            FspFileSystemDereferenceDirectoryBufferSnapshot(DirBuffer->Snapshot);
+            DirBuffer->Snapshot = 0;
+        }
+
         DirBuffer->LoMark = 0;
         DirBuffer->HiMark = DirBuffer->Capacity;
 
@@ -303,6 +436,23 @@ FSP_API BOOLEAN FspFileSystemFillDirectoryBuffer(PVOID *PDirBuffer,
     if (0 == DirInfo)
         RETURN(STATUS_INVALID_PARAMETER, FALSE);
 
+    ULONG KeyIndex = (DirBuffer->Capacity - DirBuffer->HiMark) / sizeof(ULONG);
+    if (KeyIndex >= DirBuffer->KeyCapacity)
+    {
+        FSP_FILE_SYSTEM_DIRECTORY_BUFFER_KEY *Keys;
+        ULONG KeyCapacity = 0 != DirBuffer->KeyCapacity ?
+            DirBuffer->KeyCapacity * 2 : FspFileSystemDirectoryBufferKeyLoBound;
+
+        Keys = 0 != DirBuffer->Keys ?
+            MemRealloc(DirBuffer->Keys, KeyCapacity * sizeof *Keys) :
+            MemAlloc(KeyCapacity * sizeof *Keys);
+        if (0 == Keys)
+            RETURN(STATUS_INSUFFICIENT_RESOURCES, FALSE);
+
+        DirBuffer->KeyCapacity = KeyCapacity;
+        DirBuffer->Keys = Keys;
+    }
+
     for (;;)
     {
         LoMark = DirBuffer->LoMark;
@@ -317,6 +467,9 @@ FSP_API BOOLEAN FspFileSystemFillDirectoryBuffer(PVOID *PDirBuffer,
             HiMark -= sizeof(ULONG);
             *(PULONG)(Buffer + HiMark) = DirBuffer->LoMark;
 
+            /* the rest of the key is computed when the buffer is released */
+            DirBuffer->Keys[KeyIndex].Offset = DirBuffer->LoMark;
+
             DirBuffer->LoMark = LoMark;
             DirBuffer->HiMark = HiMark;
 
@@ -353,26 +506,47 @@ FSP_API BOOLEAN FspFileSystemFillDirectoryBuffer(PVOID *PDirBuffer,
     }
 }
 
-FSP_API VOID FspFileSystemReleaseDirectoryBuffer(PVOID *PDirBuffer)
+static VOID FspFileSystemFinishDirectoryBuffer(FSP_FILE_SYSTEM_DIRECTORY_BUFFER *DirBuffer)
 {
-    /* assume that FspFileSystemAcquireDirectoryBuffer has been called */
-
-    FSP_FILE_SYSTEM_DIRECTORY_BUFFER *DirBuffer = FspInterlockedLoadPointer(PDirBuffer);
-
-    /* eliminate invalidated entries from the index */
+    /*
+     * Eliminate invalidated entries. The index grows downward, so Index[Count - 1 - I]
+     * corresponds to Keys[I]. The keys are then sorted and the index is rebuilt from them.
+     *
+     * The keys are computed here rather than in FspFileSystemFillDirectoryBuffer,
+     * because the file names may be modified in place between fill and release
+     * (e.g. the FUSE layer decodes reserved characters after filling the buffer).
+     */
     PULONG Index = (PULONG)(DirBuffer->Buffer + DirBuffer->HiMark);
     ULONG Count = (DirBuffer->Capacity - DirBuffer->HiMark) / sizeof(ULONG);
+    FSP_FSCTL_DIR_INFO *DirInfo;
     ULONG I, J;
-    for (I = Count - 1, J = Count; I < Count; I--)
+    for (I = 0, J = 0; Count > I; I++)
     {
-        if (FspFileSystemDirectoryBufferEntryInvalid == Index[I])
+        if (FspFileSystemDirectoryBufferEntryInvalid == Index[Count - 1 - I])
             continue;
-        Index[--J] = Index[I];
+        DirInfo = (FSP_FSCTL_DIR_INFO *)(DirBuffer->Buffer + DirBuffer->Keys[I].Offset);
+        FspFileSystemDirectoryBufferMakeKey(&DirBuffer->Keys[J++],
+            DirInfo->FileNameBuf,
+            (DirInfo->Size - sizeof(FSP_FSCTL_DIR_INFO)) / sizeof(WCHAR),
+            DirBuffer->Keys[I].Offset);
     }
-    DirBuffer->HiMark = (ULONG)((PUINT8)&Index[J] - DirBuffer->Buffer);
+    DirBuffer->HiMark = DirBuffer->Capacity - J * sizeof(ULONG);
 
     FspFileSystemSortDirectoryBuffer(DirBuffer);
 
+    Index = (PULONG)(DirBuffer->Buffer + DirBuffer->HiMark);
+    for (I = 0; J > I; I++)
+        Index[I] = DirBuffer->Keys[I].Offset;
+}
+
+FSP_API VOID FspFileSystemReleaseDirectoryBuffer(PVOID *PDirBuffer)
+{
+    /* assume that FspFileSystemAcquireDirectoryBuffer has been called */
+
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER *DirBuffer = FspInterlockedLoadPointer(PDirBuffer);
+
+    FspFileSystemFinishDirectoryBuffer(DirBuffer);
+
     ReleaseSRWLockExclusive(&DirBuffer->Lock);
 }
 
@@ -386,8 +560,11 @@ FSP_API VOID FspFileSystemReadDirectoryBuffer(PVOID *PDirBuffer,
     {
         AcquireSRWLockShared(&DirBuffer->Lock);
 
-        PULONG Index = (PULONG)(DirBuffer->Buffer + DirBuffer->HiMark);
-        ULONG Count = (DirBuffer->Capacity - DirBuffer->HiMark) / sizeof(ULONG);
+        /* the snapshot (if any) is immutable and is kept alive by our reference */
+        FSP_FILE_SYSTEM_DIRECTORY_BUFFER *ReadBuffer =
+            0 != DirBuffer->Snapshot ? DirBuffer->Snapshot : DirBuffer;
+        PULONG Index = (PULONG)(ReadBuffer->Buffer + ReadBuffer->HiMark);
+        ULONG Count = (ReadBuffer->Capacity - ReadBuffer->HiMark) / sizeof(ULONG);
         ULONG IndexNum;
         FSP_FSCTL_DIR_INFO *DirInfo;
 
@@ -395,7 +572,7 @@ FSP_API VOID FspFileSystemReadDirectoryBuffer(PVOID *PDirBuffer,
             IndexNum = 0;
         else
         {
-            FspFileSystemSearchDirectoryBuffer(DirBuffer,
+            FspFileSystemSearchDirectoryBuffer(ReadBuffer,
                 Marker, lstrlenW(Marker),
                 &IndexNum);
             IndexNum++;
@@ -403,7 +580,7 @@ FSP_API VOID FspFileSystemReadDirectoryBuffer(PVOID *PDirBuffer,
 
         for (; IndexNum < Count; IndexNum++)
         {
-            DirInfo = (PVOID)(DirBuffer->Buffer + Index[IndexNum]);
+            DirInfo = (PVOID)(ReadBuffer->Buffer + Index[IndexNum]);
             if (!FspFileSystemAddDirInfo(DirInfo, Buffer, Length, PBytesTransferred))
             {
                 ReleaseSRWLockShared(&DirBuffer->Lock);
@@ -423,6 +600,9 @@ FSP_API VOID FspFileSystemDeleteDirectoryBuffer(PVOID *PDirBuffer)
 
     if (0 != DirBuffer)
     {
+        if (0 != DirBuffer->Snapshot)
+            FspFileSystemDereferenceDirectoryBufferSnapshot(DirBuffer->Snapshot);
+        MemFree(DirBuffer->Keys);
         MemFree(DirBuffer->Buffer);
         MemFree(DirBuffer);
         FspInterlockedStorePointer(PDirBuffer, 0);
@@ -440,3 +620,240 @@ VOID FspFileSystemPeekInDirectoryBuffer(PVOID *PDirBuffer,
     *PIndex = (PULONG)(DirBuffer->Buffer + DirBuffer->HiMark);
     *PCount = (DirBuffer->Capacity - DirBuffer->HiMark) / sizeof(ULONG);
 }
+
+/*
+ * Directory buffer cache
+ *
+ * A directory buffer cache allows multiple open handles to share a single sorted directory
+ * buffer. Cache items are keyed by a directory identity (e.g. index number) and a change
+ * version supplied by the file system; the file system must change the version whenever
+ * the directory contents change. A cached buffer is an immutable snapshot that is reference
+ * counted; handles that read from a snapshot keep it alive even after it has been evicted
+ * or replaced in the cache. Items are evicted in LRU order when the cache exceeds its
+ * memory budget.
+ */
+
+typedef struct _FSP_FILE_SYSTEM_DIRECTORY_BUFFER_CACHE_ITEM
+{
+    struct _FSP_FILE_SYSTEM_DIRECTORY_BUFFER_CACHE_ITEM *HashNext;
+    struct _FSP_FILE_SYSTEM_DIRECTORY_BUFFER_CACHE_ITEM *LruPrev, *LruNext;
+    UINT64 DirectoryId, ChangeVersion;
+    ULONG Size;
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER *Snapshot;
+} FSP_FILE_SYSTEM_DIRECTORY_BUFFER_CACHE_ITEM;
+
+typedef struct
+{
+    SRWLOCK Lock;
+    ULONG MemoryBudget, MemorySize;
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_CACHE_ITEM LruHead;
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_CACHE_ITEM *HashBuckets[FspFileSystemDirectoryBufferCacheBucketCount];
+} FSP_FILE_SYSTEM_DIRECTORY_BUFFER_CACHE;
+
+static inline ULONG FspFileSystemDirectoryBufferCacheHash(UINT64 DirectoryId)
+{
+    /* Fibonacci hashing */
+    return (ULONG)((DirectoryId * 0x9E3779B97F4A7C15ULL) >> 56) %
+        FspFileSystemDirectoryBufferCacheBucketCount;
+}
+
+static FSP_FILE_SYSTEM_DIRECTORY_BUFFER_CACHE_ITEM **FspFileSystemDirectoryBufferCacheLookup(
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_CACHE *Cache, UINT64 DirectoryId)
+{
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_CACHE_ITEM **PItem;
+
+    for (PItem = &Cache->HashBuckets[FspFileSystemDirectoryBufferCacheHash(DirectoryId)];
+        0 != *PItem; PItem = &(*PItem)->HashNext)
+        if (DirectoryId == (*PItem)->DirectoryId)
+            break;
+
+    return PItem;
+}
+
+static VOID FspFileSystemDirectoryBufferCacheRemove(
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_CACHE *Cache, FSP_FILE_SYSTEM_DIRECTORY_BUFFER_CACHE_ITEM **PItem)
+{
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_CACHE_ITEM *Item = *PItem;
+
+    *PItem = Item->HashNext;
+    Item->LruPrev->LruNext = Item->LruNext;
+    Item->LruNext->LruPrev = Item->LruPrev;
+    Cache->MemorySize -= Item->Size;
+
+    FspFileSystemDereferenceDirectoryBufferSnapshot(Item->Snapshot);
+    MemFree(Item);
+}
+
+static inline VOID FspFileSystemDirectoryBufferCacheTouch(
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_CACHE *Cache, FSP_FILE_SYSTEM_DIRECTORY_BUFFER_CACHE_ITEM *Item)
+{
+    /* move to MRU end */
+    Item->LruPrev->LruNext = Item->LruNext;
+    Item->LruNext->LruPrev = Item->LruPrev;
+    Item->LruPrev = Cache->LruHead.LruPrev;
+    Item->LruNext = &Cache->LruHead;
+    Item->LruPrev->LruNext = Item;
+    Cache->LruHead.LruPrev = Item;
+}
+
+FSP_API NTSTATUS FspFileSystemCreateDirectoryBufferCache(ULONG MemoryBudget, PVOID *PCache)
+{
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_CACHE *Cache;
+
+    *PCache = 0;
+
+    Cache = MemAlloc(sizeof *Cache);
+    if (0 == Cache)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    memset(Cache, 0, sizeof *Cache);
+    InitializeSRWLock(&Cache->Lock);
+    Cache->MemoryBudget = MemoryBudget;
+    Cache->LruHead.LruPrev = Cache->LruHead.LruNext = &Cache->LruHead;
+
+    *PCache = Cache;
+
+    return STATUS_SUCCESS;
+}
+
+FSP_API VOID FspFileSystemDeleteDirectoryBufferCache(PVOID Cache0)
+{
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_CACHE *Cache = Cache0;
+
+    if (0 == Cache)
+        return;
+
+    for (ULONG I = 0; FspFileSystemDirectoryBufferCacheBucketCount > I; I++)
+        while (0 != Cache->HashBuckets[I])
+            FspFileSystemDirectoryBufferCacheRemove(Cache, &Cache->HashBuckets[I]);
+
+    MemFree(Cache);
+}
+
+FSP_API VOID FspFileSystemInvalidateDirectoryBufferCache(PVOID Cache0,
+    UINT64 DirectoryId)
+{
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_CACHE *Cache = Cache0;
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_CACHE_ITEM **PItem;
+
+    AcquireSRWLockExclusive(&Cache->Lock);
+
+    PItem = FspFileSystemDirectoryBufferCacheLookup(Cache, DirectoryId);
+    if (0 != *PItem)
+        FspFileSystemDirectoryBufferCacheRemove(Cache, PItem);
+
+    ReleaseSRWLockExclusive(&Cache->Lock);
+}
+
+FSP_API BOOLEAN FspFileSystemAcquireCachedDirectoryBuffer(PVOID Cache0,
+    UINT64 DirectoryId, UINT64 ChangeVersion,
+    PVOID *PDirBuffer, BOOLEAN Reset, PNTSTATUS PResult)
+{
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_CACHE *Cache = Cache0;
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER *DirBuffer, *Snapshot = 0;
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_CACHE_ITEM *Item;
+
+    if (!FspFileSystemAcquireDirectoryBufferEx(PDirBuffer, Reset, 0, PResult))
+        return FALSE;
+
+    /* we now hold the buffer exclusively and it has no snapshot */
+    DirBuffer = FspInterlockedLoadPointer(PDirBuffer);
+
+    AcquireSRWLockExclusive(&Cache->Lock);
+
+    Item = *FspFileSystemDirectoryBufferCacheLookup(Cache, DirectoryId);
+    if (0 != Item && ChangeVersion == Item->ChangeVersion)
+    {
+        FspFileSystemDirectoryBufferCacheTouch(Cache, Item);
+        Snapshot = Item->Snapshot;
+        InterlockedIncrement(&Snapshot->RefCount);
+    }
+
+    ReleaseSRWLockExclusive(&Cache->Lock);
+
+    if (0 != Snapshot)
+    {
+        DirBuffer->Snapshot = Snapshot;
+        ReleaseSRWLockExclusive(&DirBuffer->Lock);
+        RETURN(STATUS_SUCCESS, FALSE);
+    }
+
+    RETURN(STATUS_SUCCESS, TRUE);
+}
+
+FSP_API VOID FspFileSystemReleaseCachedDirectoryBuffer(PVOID Cache0,
+    UINT64 DirectoryId, UINT64 ChangeVersion,
+    PVOID *PDirBuffer)
+{
+    /* assume that FspFileSystemAcquireCachedDirectoryBuffer has returned TRUE */
+
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_CACHE *Cache = Cache0;
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER *DirBuffer = FspInterlockedLoadPointer(PDirBuffer);
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER *Snapshot = 0;
+    FSP_FILE_SYSTEM_DIRECTORY_BUFFER_CACHE_ITEM *Item = 0, **PItem;
+    ULONG Size;
+
+    FspFileSystemFinishDirectoryBuffer(DirBuffer);
+
+    Size = sizeof *Item + sizeof *Snapshot +
+        DirBuffer->Capacity + DirBuffer->KeyCapacity * sizeof *DirBuffer->Keys;
+    if (Cache->MemoryBudget >= Size)
+    {
+        Item = MemAlloc(sizeof *Item);
+        Snapshot = MemAlloc(sizeof *Snapshot);
+    }
+    if (0 == Item || 0 == Snapshot)
+    {
+        /* do not cache; the buffer remains private to this handle */
+        MemFree(Snapshot);
+        MemFree(Item);
+        ReleaseSRWLockExclusive(&DirBuffer->Lock);
+        return;
+    }
+
+    /* move the filled buffer into the snapshot; one reference for the handle, one for the cache */
+    memset(Snapshot, 0, sizeof *Snapshot);
+    Snapshot->Capacity = DirBuffer->Capacity;
+    Snapshot->LoMark = DirBuffer->LoMark;
+    Snapshot->HiMark = DirBuffer->HiMark;
+    Snapshot->Buffer = DirBuffer->Buffer;
+    Snapshot->KeyCapacity = DirBuffer->KeyCapacity;
+    Snapshot->Keys = DirBuffer->Keys;
+    Snapshot->RefCount = 2;
+    DirBuffer->Capacity = DirBuffer->LoMark = DirBuffer->HiMark = 0;
+    DirBuffer->Buffer = 0;
+    DirBuffer->KeyCapacity = 0;
+    DirBuffer->Keys = 0;
+    DirBuffer->Snapshot = Snapshot;
+
+    memset(Item, 0, sizeof *Item);
+    Item->DirectoryId = DirectoryId;
+    Item->ChangeVersion = ChangeVersion;
+    Item->Size = Size;
+    Item->Snapshot = Snapshot;
+
+    AcquireSRWLockExclusive(&Cache->Lock);
+
+    PItem = FspFileSystemDirectoryBufferCacheLookup(Cache, DirectoryId);
+    if (0 != *PItem)
+        FspFileSystemDirectoryBufferCacheRemove(Cache, PItem);
+
+    while (Cache->MemoryBudget - Size < Cache->MemorySize)
+    {
+        FSP_FILE_SYSTEM_DIRECTORY_BUFFER_CACHE_ITEM *LruItem = Cache->LruHead.LruNext;
+        FspFileSystemDirectoryBufferCacheRemove(Cache,
+            FspFileSystemDirectoryBufferCacheLookup(Cache, LruItem->DirectoryId));
+    }
+
+    PItem = FspFileSystemDirectoryBufferCacheLookup(Cache, DirectoryId);
+    *PItem = Item;
+    Item->LruPrev = Cache->LruHead.LruPrev;
+    Item->LruNext = &Cache->LruHead;
+    Item->LruPrev->LruNext = Item;
+    Cache->LruHead.LruPrev = Item;
+    Cache->MemorySize += Size;
+
+    ReleaseSRWLockExclusive(&Cache->Lock);
+
+    ReleaseSRWLockExclusive(&DirBuffer->Lock);
+}
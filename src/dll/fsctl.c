@@ -226,6 +226,34 @@ exit:
     return Result;
 }
 
+FSP_API NTSTATUS FspFsctlQueryIoq(HANDLE VolumeHandle,
+    FSP_FSCTL_IOQ_INFO *IoqInfo)
+{
+    DWORD Bytes;
+
+    if (!DeviceIoControl(VolumeHandle,
+        FSP_FSCTL_QUERY_IOQ,
+        0, 0, IoqInfo, sizeof *IoqInfo,
+        &Bytes, 0))
+        return FspNtStatusFromWin32(GetLastError());
+
+    return STATUS_SUCCESS;
+}
+
+FSP_API NTSTATUS FspFsctlQueryRequestPool(HANDLE VolumeHandle,
+    FSP_FSCTL_REQUEST_POOL_INFO *RequestPoolInfo)
+{
+    DWORD Bytes;
+
+    if (!DeviceIoControl(VolumeHandle,
+        FSP_FSCTL_QUERY_REQUEST_POOL,
+        0, 0, RequestPoolInfo, sizeof *RequestPoolInfo,
+        &Bytes, 0))
+        return FspNtStatusFromWin32(GetLastError());
+
+    return STATUS_SUCCESS;
+}
+
 FSP_API NTSTATUS FspFsctlGetVolumeList(PWSTR DevicePath,
     PWCHAR VolumeListBuf, PSIZE_T PVolumeListSize)
 {
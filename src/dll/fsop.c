@@ -44,6 +44,207 @@
             )                           \
     )
 
+/*
+ * Sharded operation guard
+ *
+ * The sharded strategy guards namespace accesses using a table of exclusive-shared
+ * locks that is indexed by a hash of the parent directory of the accessed file.
+ * Namespace accesses in different directories use different locks and can proceed
+ * concurrently. The volume-wide OpGuardLock is acquired shared by all guarded
+ * operations and exclusive only by volume-wide operations.
+ *
+ * Locks are always acquired in the following order: OpGuardLock first and table
+ * locks second in increasing index order. A rename that involves two directories
+ * that hash to different locks therefore cannot deadlock.
+ *
+ * The lock table is shared by all file systems in the process; the file system
+ * pointer is part of the hash so that different file systems use different locks.
+ */
+#define FspFileSystemOpGuardShardCount  256
+
+enum
+{
+    FspFileSystemOpGuardNone            = 0,
+    FspFileSystemOpGuardShared,
+    FspFileSystemOpGuardExclusive,
+};
+
+typedef struct
+{
+    SRWLOCK Lock;
+    UINT8 Padding[64 - sizeof(SRWLOCK)];
+} FSP_FILE_SYSTEM_OP_GUARD_SHARD;
+
+typedef struct
+{
+    UINT8 VolumeMode, ShardMode;
+    ULONG ShardCount;
+    ULONG ShardIndex[2];
+} FSP_FILE_SYSTEM_OP_GUARD_SHARDED;
+
+static FSP_FILE_SYSTEM_OP_GUARD_SHARD FspFileSystemOpGuardShards[FspFileSystemOpGuardShardCount];
+
+static ULONG FspFileSystemOpGuardShardIndex(FSP_FILE_SYSTEM *FileSystem,
+    PWSTR FileName, BOOLEAN Parent)
+{
+    ULONG Length = lstrlenW(FileName);
+    UINT32 Hash;
+    WCHAR C;
+
+    /* compute the length of the directory portion of the file name */
+    if (Parent)
+        while (0 < Length && L'\\' != FileName[Length - 1])
+            Length--;
+    while (0 < Length && L'\\' == FileName[Length - 1])
+        Length--;
+
+    /*
+     * FNV-1a hash. Case is folded for ASCII characters only; all non-ASCII characters
+     * hash to the same value so that names that a case-insensitive file system considers
+     * equal always map to the same lock.
+     */
+    Hash = 2166136261 ^ (UINT32)((UINT_PTR)FileSystem >> 4);
+    for (ULONG I = 0; Length > I; I++)
+    {
+        C = FileName[I];
+        Hash ^= 0x80 > C ? invariant_toupper(C) : 0x80;
+        Hash *= 16777619;
+    }
+    Hash ^= Hash >> 16;
+
+    return Hash & (FspFileSystemOpGuardShardCount - 1);
+}
+
+static VOID FspFileSystemOpGuardShardedClassify(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_REQ *Request, FSP_FILE_SYSTEM_OP_GUARD_SHARDED *Guard)
+{
+    PWSTR FileName = 0 != Request->FileName.Size ? (PWSTR)Request->Buffer : 0;
+    ULONG Index;
+
+    memset(Guard, 0, sizeof *Guard);
+
+    if (FspFsctlTransactSetVolumeInformationKind == Request->Kind ||
+        (FspFsctlTransactFlushBuffersKind == Request->Kind &&
+            0 == Request->Req.FlushBuffers.UserContext &&
+            0 == Request->Req.FlushBuffers.UserContext2))
+    {
+        Guard->VolumeMode = FspFileSystemOpGuardExclusive;
+        return;
+    }
+
+    if ((FspFsctlTransactCreateKind == Request->Kind &&
+            FILE_OPEN != ((Request->Req.Create.CreateOptions >> 24) & 0xff)) ||
+        (FspFsctlTransactCleanupKind == Request->Kind &&
+            Request->Req.Cleanup.Delete) ||
+        (FspFsctlTransactSetInformationKind == Request->Kind &&
+            (10/*FileRenameInformation*/ == Request->Req.SetInformation.FileInformationClass ||
+            65/*FileRenameInformationEx*/ == Request->Req.SetInformation.FileInformationClass)) ||
+        (FspFsctlTransactFileSystemControlKind == Request->Kind &&
+            FSCTL_SET_REPARSE_POINT == Request->Req.FileSystemControl.FsControlCode))
+    {
+        if (0 == FileName)
+        {
+            Guard->VolumeMode = FspFileSystemOpGuardExclusive;
+            return;
+        }
+
+        Guard->VolumeMode = FspFileSystemOpGuardShared;
+        Guard->ShardMode = FspFileSystemOpGuardExclusive;
+        Guard->ShardIndex[Guard->ShardCount++] =
+            FspFileSystemOpGuardShardIndex(FileSystem, FileName, TRUE);
+
+        if (FspFsctlTransactSetInformationKind == Request->Kind)
+        {
+            Index = FspFileSystemOpGuardShardIndex(FileSystem,
+                (PWSTR)(Request->Buffer + Request->Req.SetInformation.Info.Rename.NewFileName.Offset),
+                TRUE);
+            if (Guard->ShardIndex[0] != Index)
+            {
+                /* acquire locks in increasing index order */
+                if (Guard->ShardIndex[0] < Index)
+                    Guard->ShardIndex[Guard->ShardCount++] = Index;
+                else
+                {
+                    Guard->ShardIndex[Guard->ShardCount++] = Guard->ShardIndex[0];
+                    Guard->ShardIndex[0] = Index;
+                }
+            }
+        }
+    }
+    else
+    if (FspFsctlTransactCreateKind == Request->Kind ||
+        (FspFsctlTransactSetInformationKind == Request->Kind &&
+            (13/*FileDispositionInformation*/ == Request->Req.SetInformation.FileInformationClass ||
+            64/*FileDispositionInformationEx*/ == Request->Req.SetInformation.FileInformationClass)) ||
+        (FspFsctlTransactFileSystemControlKind == Request->Kind &&
+            FSCTL_GET_REPARSE_POINT == Request->Req.FileSystemControl.FsControlCode))
+    {
+        Guard->VolumeMode = FspFileSystemOpGuardShared;
+        if (0 != FileName)
+        {
+            Guard->ShardMode = FspFileSystemOpGuardShared;
+            Guard->ShardIndex[Guard->ShardCount++] =
+                FspFileSystemOpGuardShardIndex(FileSystem, FileName, TRUE);
+        }
+    }
+    else
+    if (FspFsctlTransactQueryDirectoryKind == Request->Kind)
+    {
+        /* directory file name is only available with PassQueryDirectoryFileName */
+        Guard->VolumeMode = FspFileSystemOpGuardShared;
+        if (0 != FileName)
+        {
+            Guard->ShardMode = FspFileSystemOpGuardShared;
+            Guard->ShardIndex[Guard->ShardCount++] =
+                FspFileSystemOpGuardShardIndex(FileSystem, FileName, FALSE);
+        }
+    }
+    else
+    if (FspFsctlTransactOverwriteKind == Request->Kind ||
+        FspFsctlTransactQueryVolumeInformationKind == Request->Kind)
+    {
+        Guard->VolumeMode = FspFileSystemOpGuardShared;
+    }
+}
+
+VOID FspFileSystemOpGuardShardedEnter(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_REQ *Request)
+{
+    FSP_FILE_SYSTEM_OP_GUARD_SHARDED Guard;
+
+    FspFileSystemOpGuardShardedClassify(FileSystem, Request, &Guard);
+
+    if (FspFileSystemOpGuardExclusive == Guard.VolumeMode)
+        AcquireSRWLockExclusive(&FileSystem->OpGuardLock);
+    else if (FspFileSystemOpGuardShared == Guard.VolumeMode)
+        AcquireSRWLockShared(&FileSystem->OpGuardLock);
+
+    for (ULONG I = 0; Guard.ShardCount > I; I++)
+        if (FspFileSystemOpGuardExclusive == Guard.ShardMode)
+            AcquireSRWLockExclusive(&FspFileSystemOpGuardShards[Guard.ShardIndex[I]].Lock);
+        else
+            AcquireSRWLockShared(&FspFileSystemOpGuardShards[Guard.ShardIndex[I]].Lock);
+}
+
+VOID FspFileSystemOpGuardShardedLeave(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_REQ *Request)
+{
+    FSP_FILE_SYSTEM_OP_GUARD_SHARDED Guard;
+
+    FspFileSystemOpGuardShardedClassify(FileSystem, Request, &Guard);
+
+    for (ULONG I = Guard.ShardCount - 1; Guard.ShardCount > I; I--)
+        if (FspFileSystemOpGuardExclusive == Guard.ShardMode)
+            ReleaseSRWLockExclusive(&FspFileSystemOpGuardShards[Guard.ShardIndex[I]].Lock);
+        else
+            ReleaseSRWLockShared(&FspFileSystemOpGuardShards[Guard.ShardIndex[I]].Lock);
+
+    if (FspFileSystemOpGuardExclusive == Guard.VolumeMode)
+        ReleaseSRWLockExclusive(&FileSystem->OpGuardLock);
+    else if (FspFileSystemOpGuardShared == Guard.VolumeMode)
+        ReleaseSRWLockShared(&FileSystem->OpGuardLock);
+}
+
 FSP_API NTSTATUS FspFileSystemOpEnter(FSP_FILE_SYSTEM *FileSystem,
     FSP_FSCTL_TRANSACT_REQ *Request, FSP_FSCTL_TRANSACT_RSP *Response)
 {
@@ -80,6 +281,10 @@ FSP_API NTSTATUS FspFileSystemOpEnter(FSP_FILE_SYSTEM *FileSystem,
     case FSP_FILE_SYSTEM_OPERATION_GUARD_STRATEGY_COARSE:
         AcquireSRWLockExclusive(&FileSystem->OpGuardLock);
         break;
+
+    case FSP_FILE_SYSTEM_OPERATION_GUARD_STRATEGY_SHARDED:
+        FspFileSystemOpGuardShardedEnter(FileSystem, Request);
+        break;
     }
 
     return STATUS_SUCCESS;
@@ -121,6 +326,10 @@ FSP_API NTSTATUS FspFileSystemOpLeave(FSP_FILE_SYSTEM *FileSystem,
     case FSP_FILE_SYSTEM_OPERATION_GUARD_STRATEGY_COARSE:
         ReleaseSRWLockExclusive(&FileSystem->OpGuardLock);
         break;
+
+    case FSP_FILE_SYSTEM_OPERATION_GUARD_STRATEGY_SHARDED:
+        FspFileSystemOpGuardShardedLeave(FileSystem, Request);
+        break;
     }
 
     return STATUS_SUCCESS;
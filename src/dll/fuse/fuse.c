@@ -44,7 +44,6 @@ static struct fuse_opt fsp_fuse_core_opts[] =
 
     FUSE_OPT_KEY("DebugLog=", 'D'),
 
-    FUSE_OPT_KEY("hard_remove", FUSE_OPT_KEY_DISCARD),
     FUSE_OPT_KEY("use_ino", FUSE_OPT_KEY_DISCARD),
     FUSE_OPT_KEY("readdir_ino", FUSE_OPT_KEY_DISCARD),
     FUSE_OPT_KEY("direct_io", FUSE_OPT_KEY_DISCARD),
@@ -78,6 +77,7 @@ static struct fuse_opt fsp_fuse_core_opts[] =
 
     FSP_FUSE_CORE_OPT("dothidden", dothidden, 1),
     FSP_FUSE_CORE_OPT("nodothidden", dothidden, 0),
+    FSP_FUSE_CORE_OPT("hard_remove", hard_remove, 1),
 
     FUSE_OPT_KEY("fstypename=", 'F'),
     FUSE_OPT_KEY("volname=", 'v'),
@@ -97,10 +97,15 @@ static struct fuse_opt fsp_fuse_core_opts[] =
     FSP_FUSE_CORE_OPT("EaTimeout=%d", VolumeParams.EaTimeout, 0),
     FSP_FUSE_CORE_OPT("VolumeInfoTimeout=", set_VolumeInfoTimeout, 1),
     FSP_FUSE_CORE_OPT("VolumeInfoTimeout=%d", VolumeParams.VolumeInfoTimeout, 0),
+    FSP_FUSE_CORE_OPT("NegativeNameTimeout=%u", VolumeParams.NegativeNameTimeout, 0),
     FSP_FUSE_CORE_OPT("KeepFileCache=", set_KeepFileCache, 1),
     FSP_FUSE_CORE_OPT("FlushOnCleanup=", set_FlushOnCleanup, 1),
     FSP_FUSE_CORE_OPT("LegacyUnlinkRename=", set_LegacyUnlinkRename, 1),
+    FSP_FUSE_CORE_OPT("ShardedLocks=", set_ShardedLocks, 1),
+    FSP_FUSE_CORE_OPT("GetattrOnWrite=", set_GetattrOnWrite, 1),
     FSP_FUSE_CORE_OPT("ThreadCount=%u", ThreadCount, 0),
+    FSP_FUSE_CORE_OPT("ReaddirGetattrThreads=", set_ReaddirGetattrThreads, 1),
+    FSP_FUSE_CORE_OPT("ReaddirGetattrThreads=%u", ReaddirGetattrThreads, 0),
     FUSE_OPT_KEY("UNC=", 'U'),
     FUSE_OPT_KEY("--UNC=", 'U'),
     FUSE_OPT_KEY("VolumePrefix=", 'U'),
@@ -168,6 +173,7 @@ VOID fsp_fuse_finalize_thread(VOID)
         context = TlsGetValue(fsp_fuse_tlskey);
         if (0 != context)
         {
+            MemFree(FSP_FUSE_HDR_FROM_CONTEXT(context)->ArenaBuf);
             fsp_fuse_obj_free(FSP_FUSE_HDR_FROM_CONTEXT(context));
             TlsSetValue(fsp_fuse_tlskey, 0);
         }
@@ -639,6 +645,7 @@ static int fsp_fuse_core_opt_proc(void *opt_data0, const char *arg, int key,
             "    -o gid=N                   set file group (-1 for mounting user group)\n"
             "    -o rellinks                interpret absolute symlinks as volume relative\n"
             "    -o dothidden               dot files have the Windows hidden file attrib\n"
+            "    -o hard_remove             immediate removal (don't hide files)\n"
             "    -o volname=NAME            set volume label\n"
             "    -o VolumePrefix=UNC        set UNC prefix (/Server/Share)\n"
             "        --VolumePrefix=UNC     set UNC prefix (\\Server\\Share)\n"
@@ -651,9 +658,13 @@ static int fsp_fuse_core_opt_proc(void *opt_data0, const char *arg, int key,
             "    -o DirInfoTimeout=N        directory info timeout (millis)\n"
             "    -o EaTimeout=N             extended attribute timeout (millis)\n"
             "    -o VolumeInfoTimeout=N     volume info timeout (millis)\n"
+            "    -o NegativeNameTimeout=N   negative name lookup timeout (millis)\n"
             "    -o KeepFileCache           do not discard cache when files are closed\n"
             "    -o LegacyUnlinkRename      do not support new POSIX unlink/rename\n"
             "    -o ThreadCount             number of file system dispatcher threads\n"
+            "    -o ShardedLocks            lock namespace per directory (multithreaded)\n"
+            "    -o GetattrOnWrite          query file size before every write\n"
+            "    -o ReaddirGetattrThreads=N concurrent getattr after readdir (multithreaded)\n"
             "    -o uidmap=UID:SID[;...]    explicit UID <-> SID map (max 8 entries)\n"
             );
         opt_data->help = 1;
@@ -785,15 +796,61 @@ int fsp_fuse_core_opt_parse(struct fsp_fuse_env *env,
             fsp_fuse_core_opts + FSP_FUSE_CORE_OPT_NOHELP_IDX, fsp_fuse_core_opt_proc);
 }
 
+static BOOLEAN fsp_fuse_set_mountpoint(struct fsp_fuse_env *env,
+    struct fuse *f, struct fuse_chan *ch, PWSTR *PErrorMessage)
+{
+    ULONG Size;
+    NTSTATUS Result;
+
+    Size = (lstrlenW(ch->MountPoint) + 1) * sizeof(WCHAR);
+    f->MountPoint = fsp_fuse_obj_alloc(env, Size);
+    if (0 == f->MountPoint)
+        return FALSE;
+    memcpy(f->MountPoint, ch->MountPoint, Size);
+
+    Result = FspFileSystemPreflight(
+        f->VolumeParams.Prefix[0] ? L"" FSP_FSCTL_NET_DEVICE_NAME : L"" FSP_FSCTL_DISK_DEVICE_NAME,
+        '*' != f->MountPoint[0] || '\0' != f->MountPoint[1] ? f->MountPoint : 0);
+    if (!NT_SUCCESS(Result))
+    {
+        switch (Result)
+        {
+        case STATUS_ACCESS_DENIED:
+            *PErrorMessage = L": access denied.";
+            break;
+
+        case STATUS_NO_SUCH_DEVICE:
+            *PErrorMessage = L": FSD not found.";
+            break;
+
+        case STATUS_OBJECT_NAME_INVALID:
+            *PErrorMessage = L": invalid mount point.";
+            break;
+
+        case STATUS_OBJECT_NAME_COLLISION:
+            *PErrorMessage = L": mount point in use.";
+            break;
+
+        default:
+            *PErrorMessage = L": unspecified error.";
+            break;
+        }
+
+        fsp_fuse_obj_free(f->MountPoint);
+        f->MountPoint = 0;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 FSP_FUSE_API struct fuse *fsp_fuse_new(struct fsp_fuse_env *env,
     struct fuse_chan *ch, struct fuse_args *args,
     const struct fuse_operations *ops, size_t opsize, void *data)
 {
     struct fuse *f = 0;
     struct fsp_fuse_core_opt_data opt_data;
-    ULONG Size;
     PWSTR ErrorMessage = L".";
-    NTSTATUS Result;
 
     if (opsize > sizeof(struct fuse_operations))
         opsize = sizeof(struct fuse_operations);
@@ -883,7 +940,9 @@ FSP_FUSE_API struct fuse *fsp_fuse_new(struct fsp_fuse_env *env,
     opt_data.VolumeParams.ReparsePointsAccessCheck = FALSE;
     opt_data.VolumeParams.NamedStreams = FALSE;
     opt_data.VolumeParams.ReadOnlyVolume = FALSE;
-    opt_data.VolumeParams.PostCleanupWhenModifiedOnly = !opt_data.set_FlushOnCleanup;
+    /* hidden files are unlinked at the last Cleanup, so it must be posted for every handle */
+    opt_data.VolumeParams.PostCleanupWhenModifiedOnly = !opt_data.set_FlushOnCleanup &&
+        opt_data.hard_remove;
     opt_data.VolumeParams.PassQueryDirectoryFileName = TRUE;
     opt_data.VolumeParams.DeviceControl = TRUE;
 #if defined(FSP_CFG_REJECT_EARLY_IRP)
@@ -909,8 +968,16 @@ FSP_FUSE_API struct fuse *fsp_fuse_new(struct fsp_fuse_env *env,
     f->rellinks = opt_data.rellinks;
     f->dothidden = opt_data.dothidden;
     f->ThreadCount = opt_data.ThreadCount;
+    f->ReaddirGetattrThreads = opt_data.set_ReaddirGetattrThreads ?
+        opt_data.ReaddirGetattrThreads : FSP_FUSE_READDIR_GETATTR_THREADS_DEFAULT;
     f->FlushOnCleanup = !!opt_data.set_FlushOnCleanup;
+    f->ShardedLocks = !!opt_data.set_ShardedLocks;
+    f->FileInfoCache = !opt_data.set_GetattrOnWrite;
     memcpy(&f->ops, ops, opsize);
+    f->hard_remove = opt_data.hard_remove;
+    f->nullpath_ok = f->ops.flag_nullpath_ok;
+    f->nopath = f->ops.flag_nopath;
+    InitializeSRWLock(&f->NodeLock);
     f->data = data;
     f->DebugLog = opt_data.debug ? -1 : 0;
     memcpy(&f->VolumeParams, &opt_data.VolumeParams, sizeof opt_data.VolumeParams);
@@ -922,42 +989,9 @@ FSP_FUSE_API struct fuse *fsp_fuse_new(struct fsp_fuse_env *env,
         f->FileSecurity = f->FileSecurityBuf;
     }
 
-    Size = (lstrlenW(ch->MountPoint) + 1) * sizeof(WCHAR);
-    f->MountPoint = fsp_fuse_obj_alloc(env, Size);
-    if (0 == f->MountPoint)
-        goto fail;
-    memcpy(f->MountPoint, ch->MountPoint, Size);
-
-    Result = FspFileSystemPreflight(
-        f->VolumeParams.Prefix[0] ? L"" FSP_FSCTL_NET_DEVICE_NAME : L"" FSP_FSCTL_DISK_DEVICE_NAME,
-        '*' != f->MountPoint[0] || '\0' != f->MountPoint[1] ? f->MountPoint : 0);
-    if (!NT_SUCCESS(Result))
-    {
-        switch (Result)
-        {
-        case STATUS_ACCESS_DENIED:
-            ErrorMessage = L": access denied.";
-            break;
-
-        case STATUS_NO_SUCH_DEVICE:
-            ErrorMessage = L": FSD not found.";
-            break;
-
-        case STATUS_OBJECT_NAME_INVALID:
-            ErrorMessage = L": invalid mount point.";
-            break;
-
-        case STATUS_OBJECT_NAME_COLLISION:
-            ErrorMessage = L": mount point in use.";
-            break;
-
-        default:
-            ErrorMessage = L": unspecified error.";
-            break;
-        }
-
+    /* lowlevel sessions get their mount point later from fuse_session_add_chan */
+    if (0 != ch && !fsp_fuse_set_mountpoint(env, f, ch, &ErrorMessage))
         goto fail;
-    }
 
     return f;
 
@@ -972,9 +1006,60 @@ fail:
     return 0;
 }
 
+FSP_FUSE_API struct fuse_session *fsp_fuse_lowlevel_new(struct fsp_fuse_env *env,
+    struct fuse_args *args,
+    const struct fuse_lowlevel_ops *op, size_t op_size, void *userdata)
+{
+    static const struct fuse_operations noops;
+    struct fuse *f;
+
+    if (op_size > sizeof(struct fuse_lowlevel_ops))
+        op_size = sizeof(struct fuse_lowlevel_ops);
+
+    f = fsp_fuse_new(env, 0, args, &noops, 0, userdata);
+    if (0 == f)
+        return 0;
+
+    f->lowlevel = 1;
+    memcpy(&f->llops, op, op_size);
+
+    return (struct fuse_session *)f;
+}
+
+FSP_FUSE_API int fsp_fuse_session_add_chan(struct fsp_fuse_env *env,
+    struct fuse_session *se, struct fuse_chan *ch)
+{
+    struct fuse *f = (struct fuse *)se;
+    PWSTR ErrorMessage = L".";
+
+    if (0 != f->MountPoint)
+        return -1;
+
+    if (!fsp_fuse_set_mountpoint(env, f, ch, &ErrorMessage))
+    {
+        FspServiceLog(EVENTLOG_ERROR_TYPE,
+            L"Cannot create " FSP_FUSE_LIBRARY_NAME " file system%s",
+            ErrorMessage);
+        return -1;
+    }
+
+    return 0;
+}
+
 FSP_FUSE_API void fsp_fuse_destroy(struct fsp_fuse_env *env,
     struct fuse *f)
 {
+    struct fsp_fuse_node_path *path, *nextpath;
+
+    /* no operations are running; the retired node paths can be freed */
+    for (int Phase = 0; 2 > Phase; Phase++)
+        for (path = f->RetiredPaths[Phase]; 0 != path; path = nextpath)
+        {
+            nextpath = path->Next;
+            MemFree(path);
+        }
+    MemFree(f->NodeIndex);
+
     fsp_fuse_obj_free(f->MountPoint);
 
     fsp_fuse_obj_free(f);
@@ -994,37 +1079,28 @@ FSP_FUSE_API int FSP_FUSE_API_NAME(fsp_fuse_exited)(struct fsp_fuse_env *env,
     return f->exited;
 }
 
-FSP_FUSE_API int fsp_fuse_notify(struct fsp_fuse_env *env,
-    struct fuse *f, const char *path, uint32_t action)
+/*
+ * Fill in a notify info entry for the FUSE path/action. The NotifyInfo buffer must have room for
+ * sizeof(FSP_FSCTL_NOTIFY_INFO) + FSP_FSCTL_TRANSACT_PATH_SIZEMAX bytes.
+ */
+static int fsp_fuse_notify_info(struct fuse *f, const char *path, uint32_t action,
+    FSP_FSCTL_NOTIFY_INFO *NotifyInfo)
 {
-    PWSTR Path = 0;
+    ULONG Size = FSP_FSCTL_TRANSACT_PATH_SIZEMAX;
     int PathLength;
-    union
-    {
-        FSP_FSCTL_NOTIFY_INFO V;
-        UINT8 B[sizeof(FSP_FSCTL_NOTIFY_INFO) + FSP_FSCTL_TRANSACT_PATH_SIZEMAX];
-    } NotifyInfo;
     NTSTATUS Result;
-    int result;
 
-    Result = FspPosixMapPosixToWindowsPath(path, &Path);
+    Result = FspPosixMapPosixToWindowsPathBuf(path, NotifyInfo->FileNameBuf, &Size, TRUE);
+    if (STATUS_BUFFER_TOO_SMALL == Result)
+        return -ENAMETOOLONG;
     if (!NT_SUCCESS(Result))
-    {
-        result = -ENOMEM;
-        goto exit;
-    }
+        return -ENOMEM;
 
-    PathLength = lstrlenW(Path);
-    if (FSP_FSCTL_TRANSACT_PATH_SIZEMAX / sizeof(WCHAR) <= PathLength)
-    {
-        result = -ENAMETOOLONG;
-        goto exit;
-    }
+    PathLength = (int)(Size / sizeof(WCHAR) - 1);
 
-    NotifyInfo.V.Size = (UINT16)(sizeof(FSP_FSCTL_NOTIFY_INFO) + PathLength * sizeof(WCHAR));
-    NotifyInfo.V.Filter = 0;
-    NotifyInfo.V.Action = 0;
-    memcpy(NotifyInfo.V.FileNameBuf, Path, NotifyInfo.V.Size - sizeof(FSP_FSCTL_NOTIFY_INFO));
+    NotifyInfo->Size = (UINT16)(sizeof(FSP_FSCTL_NOTIFY_INFO) + PathLength * sizeof(WCHAR));
+    NotifyInfo->Filter = 0;
+    NotifyInfo->Action = 0;
 
     if (!f->VolumeParams.CaseSensitiveSearch)
     {
@@ -1035,59 +1111,250 @@ FSP_FUSE_API int fsp_fuse_notify(struct fsp_fuse_env *env,
          * The FspFileSystemNotify API requires normalized names, so upper case the file name
          * here in the case of case-insensitive file systems.
          */
-        CharUpperBuffW(NotifyInfo.V.FileNameBuf, PathLength);
+        CharUpperBuffW(NotifyInfo->FileNameBuf, PathLength);
     }
 
     if (action & FSP_FUSE_NOTIFY_MKDIR)
     {
-        NotifyInfo.V.Filter = FILE_NOTIFY_CHANGE_DIR_NAME;
-        NotifyInfo.V.Action = FILE_ACTION_ADDED;
+        NotifyInfo->Filter = FILE_NOTIFY_CHANGE_DIR_NAME;
+        NotifyInfo->Action = FILE_ACTION_ADDED;
     }
     else if (action & FSP_FUSE_NOTIFY_RMDIR)
     {
-        NotifyInfo.V.Filter = FILE_NOTIFY_CHANGE_DIR_NAME;
-        NotifyInfo.V.Action = FILE_ACTION_REMOVED;
+        NotifyInfo->Filter = FILE_NOTIFY_CHANGE_DIR_NAME;
+        NotifyInfo->Action = FILE_ACTION_REMOVED;
     }
     else if (action & FSP_FUSE_NOTIFY_CREATE)
     {
-        NotifyInfo.V.Filter = FILE_NOTIFY_CHANGE_FILE_NAME;
-        NotifyInfo.V.Action = FILE_ACTION_ADDED;
+        NotifyInfo->Filter = FILE_NOTIFY_CHANGE_FILE_NAME;
+        NotifyInfo->Action = FILE_ACTION_ADDED;
     }
     else if (action & FSP_FUSE_NOTIFY_UNLINK)
     {
-        NotifyInfo.V.Filter = FILE_NOTIFY_CHANGE_FILE_NAME;
-        NotifyInfo.V.Action = FILE_ACTION_REMOVED;
+        NotifyInfo->Filter = FILE_NOTIFY_CHANGE_FILE_NAME;
+        NotifyInfo->Action = FILE_ACTION_REMOVED;
     }
 
     if (action & (FSP_FUSE_NOTIFY_CHMOD | FSP_FUSE_NOTIFY_CHOWN))
     {
-        NotifyInfo.V.Filter |= FILE_NOTIFY_CHANGE_SECURITY;
-        if (0 == NotifyInfo.V.Action)
-            NotifyInfo.V.Action = FILE_ACTION_MODIFIED;
+        NotifyInfo->Filter |= FILE_NOTIFY_CHANGE_SECURITY;
+        if (0 == NotifyInfo->Action)
+            NotifyInfo->Action = FILE_ACTION_MODIFIED;
     }
 
     if (action & FSP_FUSE_NOTIFY_UTIME)
     {
-        NotifyInfo.V.Filter |= FILE_NOTIFY_CHANGE_LAST_ACCESS | FILE_NOTIFY_CHANGE_LAST_WRITE;
-        if (0 == NotifyInfo.V.Action)
-            NotifyInfo.V.Action = FILE_ACTION_MODIFIED;
+        NotifyInfo->Filter |= FILE_NOTIFY_CHANGE_LAST_ACCESS | FILE_NOTIFY_CHANGE_LAST_WRITE;
+        if (0 == NotifyInfo->Action)
+            NotifyInfo->Action = FILE_ACTION_MODIFIED;
     }
 
     if (action & FSP_FUSE_NOTIFY_CHFLAGS)
     {
-        NotifyInfo.V.Filter |= FILE_NOTIFY_CHANGE_ATTRIBUTES;
-        if (0 == NotifyInfo.V.Action)
-            NotifyInfo.V.Action = FILE_ACTION_MODIFIED;
+        NotifyInfo->Filter |= FILE_NOTIFY_CHANGE_ATTRIBUTES;
+        if (0 == NotifyInfo->Action)
+            NotifyInfo->Action = FILE_ACTION_MODIFIED;
     }
 
     if (action & FSP_FUSE_NOTIFY_TRUNCATE)
     {
-        NotifyInfo.V.Filter |= FILE_NOTIFY_CHANGE_SIZE;
-        if (0 == NotifyInfo.V.Action)
-            NotifyInfo.V.Action = FILE_ACTION_MODIFIED;
+        NotifyInfo->Filter |= FILE_NOTIFY_CHANGE_SIZE;
+        if (0 == NotifyInfo->Action)
+            NotifyInfo->Action = FILE_ACTION_MODIFIED;
     }
 
+    return 0;
+}
+
+FSP_FUSE_API int fsp_fuse_notify(struct fsp_fuse_env *env,
+    struct fuse *f, const char *path, uint32_t action)
+{
+    union
+    {
+        FSP_FSCTL_NOTIFY_INFO V;
+        UINT8 B[sizeof(FSP_FSCTL_NOTIFY_INFO) + FSP_FSCTL_TRANSACT_PATH_SIZEMAX];
+    } NotifyInfo;
+    NTSTATUS Result;
+    int result;
+
+    result = fsp_fuse_notify_info(f, path, action, &NotifyInfo.V);
+    if (0 != result)
+        return result;
+
+    /* the file may have changed outside of any open file descriptor */
+    InterlockedIncrement(&f->FileInfoGeneration);
+
     Result = FspFileSystemNotify(f->FileSystem, &NotifyInfo.V, NotifyInfo.V.Size);
+    if (!NT_SUCCESS(Result))
+        return -ENOMEM;
+
+    return 0;
+}
+
+#define FSP_FUSE_NOTIFY_BATCH_SIZEMAX   (1024 * 1024)
+#define FSP_FUSE_NOTIFY_BATCH_INDEXMAX  (64 * 1024)
+#define FSP_FUSE_NOTIFY_BATCH_TIMEOUT   500
+
+static inline ULONG fsp_fuse_notify_batch_hash(FSP_FSCTL_NOTIFY_INFO *NotifyInfo)
+{
+    PUINT8 P = (PUINT8)NotifyInfo->FileNameBuf;
+    PUINT8 EndP = (PUINT8)NotifyInfo + NotifyInfo->Size;
+    ULONG Hash = 2166136261;
+
+    /* FNV-1a */
+    for (; EndP > P; P++)
+        Hash = (Hash ^ *P) * 16777619;
+
+    return Hash;
+}
+
+static NTSTATUS fsp_fuse_notify_batch_flush(struct fuse *f,
+    PUINT8 Buffer, PULONG PLength, PULONG Index, ULONG IndexSize, PULONG PIndexCount)
+{
+    NTSTATUS Result = STATUS_SUCCESS;
+
+    if (0 != *PLength)
+        Result = FspFileSystemNotify(f->FileSystem, (FSP_FSCTL_NOTIFY_INFO *)Buffer, *PLength);
+
+    *PLength = 0;
+    memset(Index, 0, IndexSize * sizeof(ULONG));
+    *PIndexCount = 0;
+
+    return Result;
+}
+
+FSP_FUSE_API int fsp_fuse_notify_batch(struct fsp_fuse_env *env,
+    struct fuse *f, const struct fuse_notify_item *items, size_t count)
+{
+    /*
+     * Notify entries are accumulated in a single FSP_FSCTL_NOTIFY_INFO buffer, which is sent to
+     * the FSD under one FspFileSystemNotifyBegin/End session. The buffer is flushed early only
+     * when it reaches FSP_FUSE_NOTIFY_BATCH_SIZEMAX or when the path index fills up.
+     *
+     * Index maps the hash of a path to (offset + 1) of the most recent entry for that path in
+     * Buffer. A new entry is coalesced into the most recent one for the same path when it is
+     * identical or when both are modifications (in which case the filters are merged). Entries
+     * are never reordered, so a sequence such as create/unlink/create is delivered as is.
+     */
+    PUINT8 Buffer = 0;
+    ULONG Capacity, Length = 0;
+    PULONG Index = 0;
+    ULONG IndexSize, IndexCount = 0;
+    FSP_FSCTL_NOTIFY_INFO *NotifyInfo, *PrevInfo = 0;
+    ULONG Hash, I, Offset;
+    BOOLEAN NotifyBegun = FALSE;
+    NTSTATUS Result;
+    int result;
+
+    if (0 == count)
+        return 0;
+
+    for (IndexSize = 16; IndexSize < count * 2 && IndexSize < FSP_FUSE_NOTIFY_BATCH_INDEXMAX;)
+        IndexSize <<= 1;
+    Index = MemAlloc(IndexSize * sizeof(ULONG));
+    if (0 == Index)
+    {
+        result = -ENOMEM;
+        goto exit;
+    }
+    memset(Index, 0, IndexSize * sizeof(ULONG));
+
+    Capacity = 16 * 1024;
+    Buffer = MemAlloc(Capacity);
+    if (0 == Buffer)
+    {
+        result = -ENOMEM;
+        goto exit;
+    }
+
+    Result = FspFileSystemNotifyBegin(f->FileSystem, FSP_FUSE_NOTIFY_BATCH_TIMEOUT);
+    if (!NT_SUCCESS(Result))
+    {
+        result = STATUS_CANT_WAIT == Result ? -EAGAIN : -ENOMEM;
+        goto exit;
+    }
+    NotifyBegun = TRUE;
+
+    /* the files may have changed outside of any open file descriptor */
+    InterlockedIncrement(&f->FileInfoGeneration);
+
+    for (size_t i = 0; count > i; i++)
+    {
+        if (Capacity - Length <
+            FSP_FSCTL_DEFAULT_ALIGN_UP(sizeof(FSP_FSCTL_NOTIFY_INFO) + FSP_FSCTL_TRANSACT_PATH_SIZEMAX))
+        {
+            if (FSP_FUSE_NOTIFY_BATCH_SIZEMAX > Capacity)
+            {
+                PUINT8 NewBuffer = MemRealloc(Buffer, Capacity * 2);
+                if (0 == NewBuffer)
+                {
+                    result = -ENOMEM;
+                    goto exit;
+                }
+                Buffer = NewBuffer;
+                Capacity *= 2;
+            }
+            else
+            {
+                Result = fsp_fuse_notify_batch_flush(f,
+                    Buffer, &Length, Index, IndexSize, &IndexCount);
+                if (!NT_SUCCESS(Result))
+                {
+                    result = -ENOMEM;
+                    goto exit;
+                }
+            }
+        }
+
+        NotifyInfo = (FSP_FSCTL_NOTIFY_INFO *)(Buffer + Length);
+        result = fsp_fuse_notify_info(f, items[i].path, items[i].action, NotifyInfo);
+        if (0 != result)
+            goto exit;
+
+        Hash = fsp_fuse_notify_batch_hash(NotifyInfo);
+        for (I = Hash & (IndexSize - 1);; I = (I + 1) & (IndexSize - 1))
+        {
+            Offset = Index[I];
+            if (0 == Offset)
+                break;
+
+            PrevInfo = (FSP_FSCTL_NOTIFY_INFO *)(Buffer + Offset - 1);
+            if (PrevInfo->Size == NotifyInfo->Size &&
+                0 == memcmp(PrevInfo->FileNameBuf, NotifyInfo->FileNameBuf,
+                    NotifyInfo->Size - sizeof(FSP_FSCTL_NOTIFY_INFO)))
+                break;
+        }
+
+        if (0 != Offset)
+        {
+            if (PrevInfo->Action == NotifyInfo->Action &&
+                (PrevInfo->Filter == NotifyInfo->Filter ||
+                    0 == NotifyInfo->Action || FILE_ACTION_MODIFIED == NotifyInfo->Action))
+            {
+                PrevInfo->Filter |= NotifyInfo->Filter;
+                continue;
+            }
+        }
+        else
+            IndexCount++;
+
+        Index[I] = Length + 1;
+        Length += FSP_FSCTL_DEFAULT_ALIGN_UP(NotifyInfo->Size);
+
+        if (IndexCount * 2 >= IndexSize)
+        {
+            Result = fsp_fuse_notify_batch_flush(f,
+                Buffer, &Length, Index, IndexSize, &IndexCount);
+            if (!NT_SUCCESS(Result))
+            {
+                result = -ENOMEM;
+                goto exit;
+            }
+        }
+    }
+
+    Result = fsp_fuse_notify_batch_flush(f,
+        Buffer, &Length, Index, IndexSize, &IndexCount);
     if (!NT_SUCCESS(Result))
     {
         result = -ENOMEM;
@@ -1097,8 +1364,11 @@ FSP_FUSE_API int fsp_fuse_notify(struct fsp_fuse_env *env,
     result = 0;
 
 exit:
-    if (0 != Path)
-        FspPosixDeletePath(Path);
+    if (NotifyBegun)
+        FspFileSystemNotifyEnd(f->FileSystem);
+
+    MemFree(Buffer);
+    MemFree(Index);
 
     return result;
 }
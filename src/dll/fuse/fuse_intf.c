@@ -71,6 +71,10 @@ VOID fsp_fuse_op_enter_lock(FSP_FILE_SYSTEM *FileSystem,
     case FSP_FILE_SYSTEM_OPERATION_GUARD_STRATEGY_COARSE:
         AcquireSRWLockExclusive(&FileSystem->OpGuardLock);
         break;
+
+    case FSP_FILE_SYSTEM_OPERATION_GUARD_STRATEGY_SHARDED:
+        FspFileSystemOpGuardShardedEnter(FileSystem, Request);
+        break;
     }
 }
 
@@ -117,6 +121,10 @@ VOID fsp_fuse_op_leave_unlock(FSP_FILE_SYSTEM *FileSystem,
     case FSP_FILE_SYSTEM_OPERATION_GUARD_STRATEGY_COARSE:
         ReleaseSRWLockExclusive(&FileSystem->OpGuardLock);
         break;
+
+    case FSP_FILE_SYSTEM_OPERATION_GUARD_STRATEGY_SHARDED:
+        FspFileSystemOpGuardShardedLeave(FileSystem, Request);
+        break;
     }
 }
 
@@ -133,6 +141,11 @@ NTSTATUS fsp_fuse_op_enter(FSP_FILE_SYSTEM *FileSystem,
     UINT64 AccessToken = 0;
     NTSTATUS Result;
 
+    context = fsp_fuse_get_context(f->env);
+    if (0 == context)
+        return STATUS_INSUFFICIENT_RESOURCES;
+    contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
+
     if (FspFsctlTransactCreateKind == Request->Kind)
     {
         if (Request->Req.Create.OpenTargetDirectory)
@@ -151,7 +164,14 @@ NTSTATUS fsp_fuse_op_enter(FSP_FILE_SYSTEM *FileSystem,
 
     if (0 != FileName)
     {
-        Result = FspPosixMapWindowsToPosixPath(FileName, &PosixPath);
+        /* the path is only needed during the operation; open files keep a copy in their node */
+        ULONG Size = sizeof contexthdr->PosixPathBuf;
+        Result = FspPosixMapWindowsToPosixPathBuf(FileName,
+            contexthdr->PosixPathBuf, &Size, TRUE);
+        if (NT_SUCCESS(Result))
+            PosixPath = contexthdr->PosixPathBuf;
+        else if (STATUS_BUFFER_TOO_SMALL == Result)
+            Result = FspPosixMapWindowsToPosixPath(FileName, &PosixPath);
         if (FspFsctlTransactCreateKind == Request->Kind && Request->Req.Create.OpenTargetDirectory)
             FspPathCombine((PWSTR)Request->Buffer, Suffix);
         if (!NT_SUCCESS(Result))
@@ -170,12 +190,8 @@ NTSTATUS fsp_fuse_op_enter(FSP_FILE_SYSTEM *FileSystem,
         Pid = FSP_FSCTL_TRANSACT_REQ_TOKEN_PID(AccessToken);
     }
 
-    context = fsp_fuse_get_context(f->env);
-    if (0 == context)
-    {
-        Result = STATUS_INSUFFICIENT_RESOURCES;
-        goto exit;
-    }
+    if (0 == contexthdr->ArenaBuf)
+        contexthdr->ArenaBuf = MemAlloc(FSP_FUSE_ARENA_SIZE); /* on failure use the heap */
 
     fsp_fuse_op_enter_lock(FileSystem, Request, Response);
 
@@ -185,18 +201,41 @@ NTSTATUS fsp_fuse_op_enter(FSP_FILE_SYSTEM *FileSystem,
     context->gid = Gid;
     context->pid = 0 != f->env->winpid_to_pid ? f->env->winpid_to_pid(Pid) : Pid;
 
-    contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
     contexthdr->PosixPath = PosixPath;
 
+    /* announce a node path reader; see fsp_fuse_intf_NodePathRetire */
+    contexthdr->PathSlot = &f->PathSlots[GetCurrentProcessorNumber() % FSP_FUSE_PATH_SLOT_COUNT];
+    contexthdr->PathPhase = f->PathRetirePhase & 1;
+    /* full barrier: node paths cannot be read before the announcement */
+    InterlockedIncrement(&contexthdr->PathSlot->ReaderCount[contexthdr->PathPhase]);
+
     Result = STATUS_SUCCESS;
 
 exit:
-    if (!NT_SUCCESS(Result) && 0 != PosixPath)
+    if (!NT_SUCCESS(Result) && 0 != PosixPath && contexthdr->PosixPathBuf != PosixPath)
         FspPosixDeletePath(PosixPath);
 
     return Result;
 }
 
+static inline VOID fsp_fuse_intf_ArenaReset(struct fuse *f,
+    struct fsp_fuse_context_header *contexthdr)
+{
+    LONG HighWater;
+
+    /* publish statistics for sizing the arena; updates are rare after warm up */
+    for (HighWater = f->ArenaHighWater; (ULONG)HighWater < contexthdr->ArenaHighWater;)
+        HighWater = InterlockedCompareExchange(&f->ArenaHighWater,
+            contexthdr->ArenaHighWater, HighWater);
+    if (0 != contexthdr->ArenaOverflowCount)
+    {
+        InterlockedExchangeAdd(&f->ArenaOverflowCount, contexthdr->ArenaOverflowCount);
+        contexthdr->ArenaOverflowCount = 0;
+    }
+
+    contexthdr->ArenaOffset = 0;
+}
+
 NTSTATUS fsp_fuse_op_leave(FSP_FILE_SYSTEM *FileSystem,
     FSP_FSCTL_TRANSACT_REQ *Request, FSP_FSCTL_TRANSACT_RSP *Response)
 {
@@ -207,16 +246,49 @@ NTSTATUS fsp_fuse_op_leave(FSP_FILE_SYSTEM *FileSystem,
     fsp_fuse_op_leave_unlock(FileSystem, Request, Response);
 
     context = fsp_fuse_get_context(f->env);
+    contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
+
+    /* the thread may have migrated to another processor; it still leaves the same slot */
+    InterlockedDecrement(&contexthdr->PathSlot->ReaderCount[contexthdr->PathPhase]);
+    contexthdr->PathSlot = 0;
+
     context->fuse = 0;
     context->private_data = 0;
     context->uid = -1;
     context->gid = -1;
     context->pid = -1;
 
-    contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
-    if (0 != contexthdr->PosixPath)
+    if (0 != contexthdr->PosixPath && contexthdr->PosixPathBuf != contexthdr->PosixPath)
         FspPosixDeletePath(contexthdr->PosixPath);
-    memset(contexthdr, 0, sizeof *contexthdr);
+    contexthdr->PosixPath = 0;
+
+    fsp_fuse_intf_ArenaReset(f, contexthdr);
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fsp_fuse_intf_ArenaPosixPath(PWSTR WindowsPath, char **PPosixPath)
+{
+    char *PosixPath;
+    ULONG Size;
+    NTSTATUS Result;
+
+    *PPosixPath = 0;
+
+    /* UTF-8 needs at most 3 bytes for every UTF-16 character */
+    Size = 3 * lstrlenW(WindowsPath) + 1;
+    PosixPath = fsp_fuse_arena_alloc(Size);
+    if (0 == PosixPath)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    Result = FspPosixMapWindowsToPosixPathBuf(WindowsPath, PosixPath, &Size, TRUE);
+    if (!NT_SUCCESS(Result))
+    {
+        fsp_fuse_arena_free(PosixPath);
+        return Result;
+    }
+
+    *PPosixPath = PosixPath;
 
     return STATUS_SUCCESS;
 }
@@ -301,6 +373,659 @@ exit:
     return Result;
 }
 
+/*
+ * Open files are tracked in a table of nodes; all open files of the same file (same inode
+ * number and path) share a node. The node table is used to:
+ *
+ * - Implement the FUSE hard_remove option. When a file that has other open handles is
+ *   unlinked or replaced by a rename, it is renamed to a hidden name (unless hard_remove
+ *   was specified) and is unlinked when the last of its handles is cleaned up. Handles
+ *   are counted separately from open files, because the file of a handle that has been
+ *   cleaned up may stay open (e.g. by the cache manager) long after.
+ *
+ * - Implement the FUSE nullpath_ok and nopath flags. Handle based operations (read, write,
+ *   flush, fsync, release, ftruncate, fgetattr, readdir, ioctl) receive a NULL path when
+ *   the file system does not need it or when the file no longer has a name.
+ *
+ * - Update the path of all open files when a file or one of its parent directories is
+ *   renamed.
+ *
+ * Nodes are hashed by inode number or by path if the file system does not report inode
+ * numbers. They are also kept in an index sorted by path (compared case insensitively on
+ * case insensitive volumes), where a file and everything below it form one range; a rename
+ * only visits that range.
+ *
+ * Operations read node paths without locking. A path replaced by a rename is retired and
+ * freed once the operations that may still be using it have completed: every operation
+ * announces itself in a reader slot for the current retire phase (see fsp_fuse_op_enter);
+ * paths retired in one phase are freed when the readers of the other phase have drained.
+ */
+static inline ULONG fsp_fuse_intf_NodeHash(UINT64 Ino, const char *PosixPath)
+{
+    ULONG Hash;
+
+    if (0 != Ino)
+        Hash = (ULONG)(Ino ^ (Ino >> 32));
+    else
+        for (Hash = 2166136261; '\0' != *PosixPath; PosixPath++)
+            Hash = (Hash ^ (UINT8)*PosixPath) * 16777619; /* FNV-1a */
+
+    return Hash % FSP_FUSE_NODE_BUCKET_COUNT;
+}
+
+static struct fsp_fuse_node *fsp_fuse_intf_NodeLookup(struct fuse *f,
+    UINT64 Ino, const char *PosixPath)
+{
+    /* NodeLock must be held */
+    struct fsp_fuse_node *node;
+
+    for (node = f->NodeBuckets[fsp_fuse_intf_NodeHash(Ino, PosixPath)];
+        0 != node; node = node->HashNext)
+        if (Ino == node->Ino && !node->IsHidden && !node->IsRemoved &&
+            0 == invariant_strcmp(PosixPath, node->PosixPath))
+            return node;
+
+    return 0;
+}
+
+static VOID fsp_fuse_intf_NodeInsert(struct fuse *f, struct fsp_fuse_node *node)
+{
+    /* NodeLock must be held exclusive */
+    ULONG Index = fsp_fuse_intf_NodeHash(node->Ino, node->PosixPath);
+
+    node->HashNext = f->NodeBuckets[Index];
+    f->NodeBuckets[Index] = node;
+}
+
+static VOID fsp_fuse_intf_NodeRemove(struct fuse *f, struct fsp_fuse_node *node)
+{
+    /* NodeLock must be held exclusive */
+    struct fsp_fuse_node **P = &f->NodeBuckets[fsp_fuse_intf_NodeHash(node->Ino, node->PosixPath)];
+
+    while (node != *P)
+        P = &(*P)->HashNext;
+    *P = node->HashNext;
+}
+
+static inline int fsp_fuse_intf_NodePathCompare(struct fuse *f,
+    const char *PosixPath0, const char *PosixPath1, size_t Length)
+{
+    /* compare whole paths if Length is -1; else compare up to Length characters */
+    if (f->VolumeParams.CaseSensitiveSearch)
+        return (size_t)-1 == Length ?
+            invariant_strcmp(PosixPath0, PosixPath1) :
+            invariant_strncmp(PosixPath0, PosixPath1, Length);
+    else
+        return (size_t)-1 == Length ?
+            invariant_stricmp(PosixPath0, PosixPath1) :
+            invariant_strnicmp(PosixPath0, PosixPath1, Length);
+}
+
+static ULONG fsp_fuse_intf_NodeIndexFind(struct fuse *f, const char *PosixPath)
+{
+    /* NodeLock must be held; returns the first index entry not less than PosixPath */
+    ULONG Lo = 0, Hi = f->NodeCount, Mi;
+
+    while (Lo < Hi)
+    {
+        Mi = Lo + (Hi - Lo) / 2;
+        if (0 > fsp_fuse_intf_NodePathCompare(f, f->NodeIndex[Mi]->PosixPath, PosixPath, -1))
+            Lo = Mi + 1;
+        else
+            Hi = Mi;
+    }
+
+    return Lo;
+}
+
+static BOOLEAN fsp_fuse_intf_NodeIndexReserve(struct fuse *f)
+{
+    /* NodeLock must be held exclusive; makes room for one more index entry */
+    struct fsp_fuse_node **NewIndex;
+    ULONG NewCapacity;
+
+    if (f->NodeIndexCapacity > f->NodeCount)
+        return TRUE;
+
+    NewCapacity = 0 != f->NodeIndexCapacity ? f->NodeIndexCapacity * 2 : 64;
+    NewIndex = MemAlloc(NewCapacity * sizeof *NewIndex);
+    if (0 == NewIndex)
+        return FALSE;
+
+    if (0 != f->NodeCount)
+        memcpy(NewIndex, f->NodeIndex, f->NodeCount * sizeof *NewIndex);
+    MemFree(f->NodeIndex);
+    f->NodeIndex = NewIndex;
+    f->NodeIndexCapacity = NewCapacity;
+
+    return TRUE;
+}
+
+static VOID fsp_fuse_intf_NodeIndexInsert(struct fuse *f, struct fsp_fuse_node *node)
+{
+    /* NodeLock must be held exclusive; room must have been reserved */
+    ULONG Index = fsp_fuse_intf_NodeIndexFind(f, node->PosixPath);
+
+    memmove(f->NodeIndex + Index + 1, f->NodeIndex + Index,
+        (f->NodeCount - Index) * sizeof *f->NodeIndex);
+    f->NodeIndex[Index] = node;
+    f->NodeCount++;
+}
+
+static VOID fsp_fuse_intf_NodeIndexRemove(struct fuse *f, struct fsp_fuse_node *node)
+{
+    /* NodeLock must be held exclusive */
+    ULONG Index = fsp_fuse_intf_NodeIndexFind(f, node->PosixPath);
+
+    /* other nodes may have an equal path (e.g. a removed file and its replacement) */
+    while (node != f->NodeIndex[Index])
+        Index++;
+    f->NodeCount--;
+    memmove(f->NodeIndex + Index, f->NodeIndex + Index + 1,
+        (f->NodeCount - Index) * sizeof *f->NodeIndex);
+}
+
+static inline BOOLEAN fsp_fuse_intf_NodeIsBelow(struct fuse *f, struct fsp_fuse_node *node,
+    const char *PosixPath, size_t Length)
+{
+    /* is the node the file PosixPath or below it */
+    return !node->IsRemoved &&
+        0 == fsp_fuse_intf_NodePathCompare(f, node->PosixPath, PosixPath, Length) &&
+        ('\0' == node->PosixPath[Length] || '/' == node->PosixPath[Length]);
+}
+
+static struct fsp_fuse_node_path *fsp_fuse_intf_NewNodePath(
+    const char *Prefix, size_t PrefixLength, const char *Suffix)
+{
+    struct fsp_fuse_node_path *path;
+    size_t SuffixSize = lstrlenA(Suffix) + 1;
+
+    path = MemAlloc(sizeof *path + PrefixLength + SuffixSize);
+    if (0 == path)
+        return 0;
+
+    path->Next = 0;
+    memcpy(path->PosixPath, Prefix, PrefixLength);
+    memcpy(path->PosixPath + PrefixLength, Suffix, SuffixSize);
+
+    return path;
+}
+
+static VOID fsp_fuse_intf_FreeNodePaths(struct fsp_fuse_node_path *path)
+{
+    struct fsp_fuse_node_path *nextpath;
+
+    for (; 0 != path; path = nextpath)
+    {
+        nextpath = path->Next;
+        MemFree(path);
+    }
+}
+
+static struct fsp_fuse_node_path *fsp_fuse_intf_NodePathRetire(struct fuse *f,
+    struct fsp_fuse_node_path *path)
+{
+    /*
+     * Retire a list of paths that nodes no longer point to. Then attempt reclamation of
+     * the paths retired in the other phase. NodeLock must be held exclusive; the caller
+     * must free the returned paths (after releasing NodeLock).
+     */
+    struct fsp_fuse_node_path *ReclaimedPaths = 0, *nextpath;
+    LONG Phase = f->PathRetirePhase & 1, OldPhase = Phase ^ 1, ReaderCount;
+
+    for (; 0 != path; path = nextpath)
+    {
+        nextpath = path->Next;
+        path->Next = f->RetiredPaths[Phase];
+        f->RetiredPaths[Phase] = path;
+    }
+
+    /* order the path updates before the reader count reads */
+    MemoryBarrier();
+    ReaderCount = 0;
+    for (ULONG Index = 0; FSP_FUSE_PATH_SLOT_COUNT > Index; Index++)
+        ReaderCount += f->PathSlots[Index].ReaderCount[OldPhase];
+    if (0 == ReaderCount)
+    {
+        ReclaimedPaths = f->RetiredPaths[OldPhase];
+        f->RetiredPaths[OldPhase] = 0;
+        InterlockedIncrement(&f->PathRetirePhase);
+    }
+
+    return ReclaimedPaths;
+}
+
+static struct fsp_fuse_node_path *fsp_fuse_intf_NodeSetPath(struct fuse *f,
+    struct fsp_fuse_node *node, struct fsp_fuse_node_path *path)
+{
+    /*
+     * Set the node path; a 0 path restores the original one. NodeLock must be held exclusive.
+     * Returns the replaced path, which the caller must retire (or restore).
+     */
+    struct fsp_fuse_node_path *oldpath = node->Path;
+
+    fsp_fuse_intf_NodeIndexRemove(f, node);
+    if (0 == node->Ino)
+        fsp_fuse_intf_NodeRemove(f, node);
+    node->Path = path;
+    node->PosixPath = 0 != path ? path->PosixPath : node->PosixPathBuf;
+    if (0 == node->Ino)
+        fsp_fuse_intf_NodeInsert(f, node);
+    fsp_fuse_intf_NodeIndexInsert(f, node);
+
+    return oldpath;
+}
+
+static VOID fsp_fuse_intf_NodeRetirePath(struct fuse *f, struct fsp_fuse_node_path *path)
+{
+    struct fsp_fuse_node_path *ReclaimedPaths;
+
+    AcquireSRWLockExclusive(&f->NodeLock);
+    ReclaimedPaths = fsp_fuse_intf_NodePathRetire(f, path);
+    ReleaseSRWLockExclusive(&f->NodeLock);
+
+    fsp_fuse_intf_FreeNodePaths(ReclaimedPaths);
+}
+
+static struct fsp_fuse_node *fsp_fuse_intf_NodeReference(struct fuse *f,
+    UINT64 Ino, const char *PosixPath)
+{
+    struct fsp_fuse_node *node;
+
+    AcquireSRWLockShared(&f->NodeLock);
+    node = fsp_fuse_intf_NodeLookup(f, Ino, PosixPath);
+    if (0 != node)
+        InterlockedIncrement(&node->OpenCount);
+    ReleaseSRWLockShared(&f->NodeLock);
+
+    return node;
+}
+
+static struct fsp_fuse_node *fsp_fuse_intf_NodeOpen(struct fuse *f,
+    UINT64 Ino, const char *PosixPath)
+{
+    struct fsp_fuse_node *node, *newnode;
+    size_t Size;
+
+    node = fsp_fuse_intf_NodeReference(f, Ino, PosixPath);
+    if (0 != node)
+        return node;
+
+    Size = lstrlenA(PosixPath) + 1;
+    newnode = MemAlloc(sizeof *newnode + Size);
+    if (0 == newnode)
+        return 0;
+
+    memset(newnode, 0, sizeof *newnode);
+    newnode->Ino = Ino;
+    newnode->OpenCount = 1;
+    newnode->PosixPath = newnode->PosixPathBuf;
+    memcpy(newnode->PosixPathBuf, PosixPath, Size);
+
+    AcquireSRWLockExclusive(&f->NodeLock);
+    node = fsp_fuse_intf_NodeLookup(f, Ino, PosixPath);
+    if (0 != node)
+        node->OpenCount++;
+    else if (fsp_fuse_intf_NodeIndexReserve(f))
+    {
+        node = newnode;
+        newnode = 0;
+        fsp_fuse_intf_NodeInsert(f, node);
+        fsp_fuse_intf_NodeIndexInsert(f, node);
+    }
+    ReleaseSRWLockExclusive(&f->NodeLock);
+
+    MemFree(newnode);
+
+    return node;
+}
+
+static VOID fsp_fuse_intf_NodeClose(FSP_FILE_SYSTEM *FileSystem,
+    struct fsp_fuse_node *node)
+{
+    struct fuse *f = FileSystem->UserContext;
+    BOOLEAN Last;
+
+    AcquireSRWLockExclusive(&f->NodeLock);
+    Last = 0 == --node->OpenCount;
+    if (Last)
+    {
+        fsp_fuse_intf_NodeRemove(f, node);
+        fsp_fuse_intf_NodeIndexRemove(f, node);
+    }
+    ReleaseSRWLockExclusive(&f->NodeLock);
+
+    if (!Last)
+        return;
+
+    /* no operation can be using the path of a node without open files */
+    MemFree(node->Path);
+    MemFree(node);
+}
+
+static inline BOOLEAN fsp_fuse_intf_NodeClaimHidden(struct fuse *f,
+    struct fsp_fuse_node *node)
+{
+    BOOLEAN Result;
+
+    /* the caller that marks a hidden node without handles as removed must unlink it */
+    AcquireSRWLockExclusive(&f->NodeLock);
+    MemoryBarrier();
+    Result = node->IsHidden && !node->IsRemoved && 0 == node->HandleCount;
+    if (Result)
+        node->IsRemoved = TRUE;
+    ReleaseSRWLockExclusive(&f->NodeLock);
+
+    return Result;
+}
+
+static VOID fsp_fuse_intf_NodeCleanup(FSP_FILE_SYSTEM *FileSystem,
+    struct fsp_fuse_file_desc *filedesc, BOOLEAN Delete)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_node *node = filedesc->Node;
+    BOOLEAN IsHidden, Guard;
+
+    /* called at Cleanup; or at Close if the FSD did not post a Cleanup for the handle */
+    if (!filedesc->IsHandleOpen)
+        return;
+    filedesc->IsHandleOpen = FALSE;
+    if (0 != InterlockedDecrement(&node->HandleCount))
+        return;
+
+    AcquireSRWLockShared(&f->NodeLock);
+    IsHidden = node->IsHidden && !node->IsRemoved;
+    ReleaseSRWLockShared(&f->NodeLock);
+
+    if (!IsHidden)
+        return;
+
+    /*
+     * Unlink the hidden file under the operation guard, so that the unlink cannot race
+     * a create or rename of the same name. With the FINE and SHARDED strategies a Cleanup
+     * without Delete or a Close holds no guard; take the volume guard exclusive instead.
+     */
+    Guard = !Delete &&
+        (FSP_FILE_SYSTEM_OPERATION_GUARD_STRATEGY_FINE == FileSystem->OpGuardStrategy ||
+        FSP_FILE_SYSTEM_OPERATION_GUARD_STRATEGY_SHARDED == FileSystem->OpGuardStrategy);
+    if (Guard)
+        AcquireSRWLockExclusive(&FileSystem->OpGuardLock);
+
+    if (fsp_fuse_intf_NodeClaimHidden(f, node) && 0 != f->ops.unlink)
+        f->ops.unlink(node->PosixPath);
+
+    if (Guard)
+        ReleaseSRWLockExclusive(&FileSystem->OpGuardLock);
+}
+
+static BOOLEAN fsp_fuse_intf_NodeHide(FSP_FILE_SYSTEM *FileSystem,
+    struct fsp_fuse_node *node, struct fsp_fuse_node_path **POldPath)
+{
+    /* if POldPath is not 0, the replaced path is returned to be retired by the caller */
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_node_path *path = 0, *oldpath, *ReclaimedPaths = 0;
+    char *PosixHiddenPath = 0;
+    BOOLEAN Result = FALSE;
+
+    if (0 == f->ops.rename ||
+        !NT_SUCCESS(fsp_fuse_intf_NewHiddenName(FileSystem, node->PosixPath, &PosixHiddenPath)))
+        goto exit;
+
+    path = fsp_fuse_intf_NewNodePath(PosixHiddenPath, lstrlenA(PosixHiddenPath), "");
+    if (0 == path || 0 != f->ops.rename(node->PosixPath, PosixHiddenPath))
+        goto exit;
+
+    AcquireSRWLockExclusive(&f->NodeLock);
+    oldpath = fsp_fuse_intf_NodeSetPath(f, node, path);
+    node->IsHidden = TRUE;
+    if (0 != POldPath)
+        *POldPath = oldpath;
+    else
+        ReclaimedPaths = fsp_fuse_intf_NodePathRetire(f, oldpath);
+    ReleaseSRWLockExclusive(&f->NodeLock);
+    path = 0;
+
+    fsp_fuse_intf_FreeNodePaths(ReclaimedPaths);
+
+    Result = TRUE;
+
+exit:
+    MemFree(path);
+    MemFree(PosixHiddenPath);
+
+    return Result;
+}
+
+static VOID fsp_fuse_intf_NodeUnlink(FSP_FILE_SYSTEM *FileSystem,
+    struct fsp_fuse_file_desc *filedesc)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_node *node = filedesc->Node;
+    BOOLEAN IsOpen;
+    int err;
+
+    /* our own handle has not been cleaned up yet */
+    IsOpen = 1 < node->HandleCount;
+
+    if (filedesc->IsDirectory && !filedesc->IsReparsePoint)
+        err = 0 != f->ops.rmdir ? f->ops.rmdir(node->PosixPath) : -ENOSYS_(f->env);
+    else if (IsOpen && !f->hard_remove && !filedesc->IsReparsePoint &&
+        fsp_fuse_intf_NodeHide(FileSystem, node, 0))
+        return;
+    else
+        err = 0 != f->ops.unlink ? f->ops.unlink(node->PosixPath) : -ENOSYS_(f->env);
+
+    if (0 == err)
+    {
+        AcquireSRWLockExclusive(&f->NodeLock);
+        node->IsRemoved = TRUE;
+        ReleaseSRWLockExclusive(&f->NodeLock);
+    }
+}
+
+struct fsp_fuse_node_rename
+{
+    ULONG Count;
+    size_t Length;
+    char *PosixPath;                    /* renamed file; stored after Entries */
+    struct
+    {
+        struct fsp_fuse_node *Node;
+        char *PosixPath;                /* node path when the rename was prepared */
+        struct fsp_fuse_node_path *NewPath;
+        ULONG Index;
+    } Entries[];
+};
+
+static VOID fsp_fuse_intf_NodeRenameRelease(FSP_FILE_SYSTEM *FileSystem,
+    struct fsp_fuse_node_rename *Rename)
+{
+    if (0 == Rename)
+        return;
+
+    for (ULONG I = 0; Rename->Count > I; I++)
+    {
+        MemFree(Rename->Entries[I].NewPath);
+        fsp_fuse_intf_NodeClose(FileSystem, Rename->Entries[I].Node);
+    }
+    MemFree(Rename);
+}
+
+static NTSTATUS fsp_fuse_intf_NodeRenamePrepare(FSP_FILE_SYSTEM *FileSystem,
+    const char *PosixPath, const char *PosixNewPath, struct fsp_fuse_node_rename **PRename)
+{
+    /*
+     * Reference the nodes of the renamed file and of the files below it and allocate their
+     * new paths, so that updating the nodes after the file system rename cannot fail. Files
+     * below the renamed file that are opened after this point keep their old paths; only
+     * the SHARDED guard strategy lets such opens run concurrently with a rename.
+     */
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_node_rename *Rename = 0;
+    struct fsp_fuse_node *node;
+    size_t Length = lstrlenA(PosixPath), NewLength = lstrlenA(PosixNewPath);
+    ULONG First, Index, Count;
+    NTSTATUS Result;
+
+    *PRename = 0;
+
+    AcquireSRWLockShared(&f->NodeLock);
+
+    /* the nodes whose paths start with PosixPath form a single range of the index */
+    First = fsp_fuse_intf_NodeIndexFind(f, PosixPath);
+    Count = 0;
+    for (Index = First; f->NodeCount > Index &&
+        0 == fsp_fuse_intf_NodePathCompare(f, f->NodeIndex[Index]->PosixPath, PosixPath, Length);
+        Index++)
+        if (fsp_fuse_intf_NodeIsBelow(f, f->NodeIndex[Index], PosixPath, Length))
+            Count++;
+
+    Result = STATUS_SUCCESS;
+    if (0 == Count)
+        goto exit;
+
+    Rename = MemAlloc(sizeof *Rename + Count * sizeof Rename->Entries[0] + Length + 1);
+    if (0 == Rename)
+    {
+        Result = STATUS_INSUFFICIENT_RESOURCES;
+        goto exit;
+    }
+
+    Rename->Count = 0;
+    Rename->Length = Length;
+    Rename->PosixPath = (char *)&Rename->Entries[Count];
+    memcpy(Rename->PosixPath, PosixPath, Length + 1);
+    for (Index = First; Count > Rename->Count; Index++)
+    {
+        node = f->NodeIndex[Index];
+        if (!fsp_fuse_intf_NodeIsBelow(f, node, PosixPath, Length))
+            continue;
+
+        Rename->Entries[Rename->Count].NewPath =
+            fsp_fuse_intf_NewNodePath(PosixNewPath, NewLength, node->PosixPath + Length);
+        if (0 == Rename->Entries[Rename->Count].NewPath)
+        {
+            Result = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        InterlockedIncrement(&node->OpenCount);
+        Rename->Entries[Rename->Count].Node = node;
+        Rename->Entries[Rename->Count].PosixPath = node->PosixPath;
+        Rename->Count++;
+    }
+
+exit:
+    ReleaseSRWLockShared(&f->NodeLock);
+
+    if (NT_SUCCESS(Result))
+        *PRename = Rename;
+    else
+        fsp_fuse_intf_NodeRenameRelease(FileSystem, Rename);
+
+    return Result;
+}
+
+static VOID fsp_fuse_intf_NodeRenameCommit(FSP_FILE_SYSTEM *FileSystem,
+    struct fsp_fuse_node_rename *Rename)
+{
+    /* update the nodes of a prepared rename after the file system rename */
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_node *node;
+    struct fsp_fuse_node_path *RetiredPaths = 0, *ReclaimedPaths, *oldpath;
+    ULONG I, J, End, Count, MoveCount;
+
+    if (0 == Rename)
+        return;
+
+    AcquireSRWLockExclusive(&f->NodeLock);
+
+    /* a node whose path has changed since the rename was prepared keeps its new path */
+    Count = 0;
+    for (I = 0; Rename->Count > I; I++)
+    {
+        node = Rename->Entries[I].Node;
+        if (!node->IsRemoved && node->PosixPath == Rename->Entries[I].PosixPath)
+        {
+            node->IsMoving = TRUE;
+            Count++;
+        }
+    }
+
+    /* take the moving nodes out of the index; they are in the range of the old path */
+    J = fsp_fuse_intf_NodeIndexFind(f, Rename->PosixPath);
+    for (I = J; f->NodeCount > I &&
+        0 == fsp_fuse_intf_NodePathCompare(f,
+            f->NodeIndex[I]->PosixPath, Rename->PosixPath, Rename->Length);
+        I++)
+        if (!f->NodeIndex[I]->IsMoving)
+            f->NodeIndex[J++] = f->NodeIndex[I];
+    memmove(f->NodeIndex + J, f->NodeIndex + I, (f->NodeCount - I) * sizeof *f->NodeIndex);
+    f->NodeCount -= I - J;
+
+    /* set the new paths and find their places in the index */
+    for (I = 0; Rename->Count > I; I++)
+    {
+        node = Rename->Entries[I].Node;
+        if (!node->IsMoving)
+            continue;
+
+        if (0 == node->Ino)
+            fsp_fuse_intf_NodeRemove(f, node);
+        oldpath = node->Path;
+        node->Path = Rename->Entries[I].NewPath;
+        node->PosixPath = node->Path->PosixPath;
+        Rename->Entries[I].NewPath = 0;
+        if (0 == node->Ino)
+            fsp_fuse_intf_NodeInsert(f, node);
+
+        if (0 != oldpath)
+        {
+            oldpath->Next = RetiredPaths;
+            RetiredPaths = oldpath;
+        }
+
+        Rename->Entries[I].Index = fsp_fuse_intf_NodeIndexFind(f, node->PosixPath);
+    }
+
+    /*
+     * Merge the moving nodes back into the index, starting from its end. The new paths
+     * differ from the old ones only in their common prefix, so they are in index order
+     * and their places do not decrease.
+     */
+    End = f->NodeCount;
+    J = f->NodeCount + Count;
+    for (I = Rename->Count; 0 < I--;)
+    {
+        node = Rename->Entries[I].Node;
+        if (!node->IsMoving)
+            continue;
+
+        node->IsMoving = FALSE;
+        MoveCount = End - Rename->Entries[I].Index;
+        J -= MoveCount;
+        memmove(f->NodeIndex + J, f->NodeIndex + Rename->Entries[I].Index,
+            MoveCount * sizeof *f->NodeIndex);
+        End = Rename->Entries[I].Index;
+        f->NodeIndex[--J] = node;
+    }
+    f->NodeCount += Count;
+
+    ReclaimedPaths = fsp_fuse_intf_NodePathRetire(f, RetiredPaths);
+
+    ReleaseSRWLockExclusive(&f->NodeLock);
+
+    fsp_fuse_intf_FreeNodePaths(ReclaimedPaths);
+}
+
+static inline const char *fsp_fuse_intf_HandlePath(struct fuse *f,
+    struct fsp_fuse_file_desc *filedesc)
+{
+    struct fsp_fuse_node *node = filedesc->Node;
+
+    return f->nopath || (f->nullpath_ok && node->IsRemoved) ? 0 : node->PosixPath;
+}
+
 static BOOLEAN fsp_fuse_intf_CheckSymlinkDirectory(FSP_FILE_SYSTEM *FileSystem,
     const char *PosixPath)
 {
@@ -315,7 +1040,7 @@ static BOOLEAN fsp_fuse_intf_CheckSymlinkDirectory(FSP_FILE_SYSTEM *FileSystem,
         BOOLEAN Result = FALSE;
 
         Length = lstrlenA(PosixPath);
-        PosixDotPath = MemAlloc(Length + 3);
+        PosixDotPath = fsp_fuse_arena_alloc(Length + 3);
         if (0 != PosixDotPath)
         {
             memcpy(PosixDotPath, PosixPath, Length);
@@ -329,7 +1054,7 @@ static BOOLEAN fsp_fuse_intf_CheckSymlinkDirectory(FSP_FILE_SYSTEM *FileSystem,
             else
                 err = -ENOSYS_(f->env);
 
-            MemFree(PosixDotPath);
+            fsp_fuse_arena_free(PosixDotPath);
 
             Result = 0 == err && 0040000 == (stbuf.st_mode & 0170000);
         }
@@ -446,9 +1171,13 @@ static inline UINT32 fsp_fuse_intf_MapFlagsToFileAttributes(uint32_t flags)
 
 #define FUSE_FILE_INFO(IsDirectory, fi) ((IsDirectory) ? 0 : (fi))
 #define fsp_fuse_intf_GetFileInfoEx(FileSystem, PosixPath, fi, PUid, PGid, PMode, FileInfo)\
-    fsp_fuse_intf_GetFileInfoFunnel(FileSystem, PosixPath, fi, 0, PUid, PGid, PMode, 0, TRUE, FileInfo)
+    fsp_fuse_intf_GetFileInfoFunnel(FileSystem, PosixPath, PosixPath, fi, 0, PUid, PGid, PMode, 0, TRUE, FileInfo)
+#define fsp_fuse_intf_GetFileInfoByHandle(FileSystem, filedesc, fi, PUid, PGid, PMode, FileInfo)\
+    fsp_fuse_intf_GetFileInfoFunnel(FileSystem, (filedesc)->Node->PosixPath,\
+        fsp_fuse_intf_HandlePath((FileSystem)->UserContext, filedesc),\
+        FUSE_FILE_INFO((filedesc)->IsDirectory, fi), 0, PUid, PGid, PMode, 0, TRUE, FileInfo)
 static NTSTATUS fsp_fuse_intf_GetFileInfoFunnel(FSP_FILE_SYSTEM *FileSystem,
-    const char *PosixPath, struct fuse_file_info *fi, const void *stbufp,
+    const char *PosixPath, const char *HandlePath, struct fuse_file_info *fi, const void *stbufp,
     PUINT32 PUid, PUINT32 PGid, PUINT32 PMode, PUINT32 PDev,
     BOOLEAN CheckSymlinkDirectory,
     FSP_FSCTL_FILE_INFO *FileInfo)
@@ -466,7 +1195,7 @@ static NTSTATUS fsp_fuse_intf_GetFileInfoFunnel(FSP_FILE_SYSTEM *FileSystem,
         int err;
 
         if (0 != f->ops.fgetattr && 0 != fi && -1 != fi->fh)
-            err = f->ops.fgetattr(PosixPath, (void *)&stbuf, fi);
+            err = f->ops.fgetattr(HandlePath, (void *)&stbuf, fi);
         else if (0 != f->ops.getattr)
             err = f->ops.getattr(PosixPath, (void *)&stbuf);
         else
@@ -545,6 +1274,134 @@ static NTSTATUS fsp_fuse_intf_GetFileInfoFunnel(FSP_FILE_SYSTEM *FileSystem,
     return STATUS_SUCCESS;
 }
 
+/*
+ * Write needs the file size (for WriteToEndOfFile and ConstrainedIo) and must return
+ * complete file information. Rather than calling getattr before every write, we remember
+ * the file information returned by the last operation on the same open file and update
+ * it locally after each write.
+ *
+ * Operations that change the file information of a single file (truncate, setattr,
+ * chmod/chown and writes that extend a file) increment the generation number of its node
+ * and of the nodes of its other hard links; this invalidates the cached file information
+ * of the open files of that file only. Operations that change the namespace (rename,
+ * unlink, reparse points) and fuse_notify increment a volume-wide generation number; this
+ * invalidates the cached file information of all open files. File systems whose files
+ * change out of band can opt out with -o GetattrOnWrite.
+ */
+static inline LONG fsp_fuse_intf_NodeFileInfoGeneration(struct fuse *f,
+    struct fsp_fuse_node *node)
+{
+    /* both generations only increase, so their sum changes whenever either does */
+    LONG Generation = fsp_fuse_intf_FileInfoGeneration(f);
+
+    if (0 != node)
+        Generation += InterlockedCompareExchange(&node->FileInfoGeneration, 0, 0);
+
+    return Generation;
+}
+
+static inline LONG fsp_fuse_intf_NodeFileInfoInvalidations(struct fuse *f)
+{
+    return InterlockedCompareExchange(&f->NodeFileInfoInvalidations, 0, 0);
+}
+
+static LONG fsp_fuse_intf_InvalidateNodeFileInfo(struct fuse *f,
+    struct fsp_fuse_node *node)
+{
+    struct fsp_fuse_node *othernode;
+
+    /* lowlevel open files have no node */
+    if (0 == node)
+        return fsp_fuse_intf_InvalidateFileInfo(f);
+
+    /* counted before the node generation changes; see fsp_fuse_intf_SetOpenFileInfo */
+    InterlockedIncrement(&f->NodeFileInfoInvalidations);
+    InterlockedIncrement(&node->FileInfoGeneration);
+
+    /* nodes of the same inode number (hard links) share its bucket */
+    if (0 != node->Ino)
+    {
+        AcquireSRWLockShared(&f->NodeLock);
+        for (othernode = f->NodeBuckets[fsp_fuse_intf_NodeHash(node->Ino, 0)];
+            0 != othernode; othernode = othernode->HashNext)
+            if (node->Ino == othernode->Ino && node != othernode)
+                InterlockedIncrement(&othernode->FileInfoGeneration);
+        ReleaseSRWLockShared(&f->NodeLock);
+    }
+
+    return fsp_fuse_intf_NodeFileInfoGeneration(f, node);
+}
+
+/* !static: used by fuse_lowlevel */
+VOID fsp_fuse_intf_SetCachedFileInfo(struct fuse *f,
+    struct fsp_fuse_file_desc *filedesc, LONG Generation, const FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    if (!f->FileInfoCache)
+        return;
+
+    AcquireSRWLockExclusive(&filedesc->FileInfoLock);
+    filedesc->FileInfoValid = TRUE;
+    filedesc->FileInfoGeneration = Generation;
+    memcpy(&filedesc->FileInfo, FileInfo, sizeof *FileInfo);
+    ReleaseSRWLockExclusive(&filedesc->FileInfoLock);
+}
+
+static VOID fsp_fuse_intf_SetOpenFileInfo(struct fuse *f,
+    struct fsp_fuse_file_desc *filedesc, LONG Generation, LONG Invalidations,
+    const FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    /*
+     * Generation (volume-wide) and Invalidations were read before the file information,
+     * when the node was not known yet. Add the node generation and read Invalidations
+     * again (in that order): if any node was invalidated in between, the file information
+     * may already be stale and is not cached.
+     */
+    Generation += InterlockedCompareExchange(&filedesc->Node->FileInfoGeneration, 0, 0);
+    if (Invalidations != fsp_fuse_intf_NodeFileInfoInvalidations(f))
+        return;
+
+    fsp_fuse_intf_SetCachedFileInfo(f, filedesc, Generation, FileInfo);
+}
+
+/* !static: used by fuse_lowlevel */
+BOOLEAN fsp_fuse_intf_GetCachedFileInfo(struct fuse *f,
+    struct fsp_fuse_file_desc *filedesc, FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    BOOLEAN Result;
+
+    if (!f->FileInfoCache)
+        return FALSE;
+
+    AcquireSRWLockShared(&filedesc->FileInfoLock);
+    Result = filedesc->FileInfoValid &&
+        fsp_fuse_intf_NodeFileInfoGeneration(f, filedesc->Node) == filedesc->FileInfoGeneration;
+    if (Result)
+        memcpy(FileInfo, &filedesc->FileInfo, sizeof *FileInfo);
+    ReleaseSRWLockShared(&filedesc->FileInfoLock);
+
+    return Result;
+}
+
+static NTSTATUS fsp_fuse_intf_GetFileInfoCached(FSP_FILE_SYSTEM *FileSystem,
+    struct fsp_fuse_file_desc *filedesc, struct fuse_file_info *fi,
+    FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    struct fuse *f = FileSystem->UserContext;
+    UINT32 Uid, Gid, Mode;
+    LONG Generation;
+    NTSTATUS Result;
+
+    Generation = fsp_fuse_intf_NodeFileInfoGeneration(f, filedesc->Node);
+    Result = fsp_fuse_intf_GetFileInfoByHandle(FileSystem, filedesc, fi,
+        &Uid, &Gid, &Mode, FileInfo);
+    if (!NT_SUCCESS(Result))
+        return Result;
+
+    fsp_fuse_intf_SetCachedFileInfo(f, filedesc, Generation, FileInfo);
+
+    return STATUS_SUCCESS;
+}
+
 static VOID fsp_fuse_intf_AddWriteEaAccess(
     PSECURITY_DESCRIPTOR SecurityDescriptor)
 {
@@ -709,7 +1566,7 @@ static NTSTATUS fsp_fuse_intf_GetReparsePointEx(FSP_FILE_SYSTEM *FileSystem,
         goto skip_getattr;
     }
 
-    Result = fsp_fuse_intf_GetFileInfoFunnel(FileSystem, PosixPath, fi, 0,
+    Result = fsp_fuse_intf_GetFileInfoFunnel(FileSystem, PosixPath, PosixPath, fi, 0,
         &Uid, &Gid, &Mode, &Dev, FALSE, &FileInfo);
     if (!NT_SUCCESS(Result))
         return Result;
@@ -859,10 +1716,15 @@ static NTSTATUS fsp_fuse_intf_GetSecurityByName(FSP_FILE_SYSTEM *FileSystem,
     PSECURITY_DESCRIPTOR SecurityDescriptorBuf, SIZE_T *PSecurityDescriptorSize)
 {
     struct fuse *f = FileSystem->UserContext;
-    char *PosixPath = 0;
+    char PosixPathBuf[FSP_FUSE_POSIXPATH_SIZEMAX], *PosixPath = 0;
+    ULONG Size = sizeof PosixPathBuf;
     NTSTATUS Result;
 
-    Result = FspPosixMapWindowsToPosixPath(FileName, &PosixPath);
+    Result = FspPosixMapWindowsToPosixPathBuf(FileName, PosixPathBuf, &Size, TRUE);
+    if (NT_SUCCESS(Result))
+        PosixPath = PosixPathBuf;
+    else if (STATUS_BUFFER_TOO_SMALL == Result)
+        Result = FspPosixMapWindowsToPosixPath(FileName, &PosixPath);
     if (!NT_SUCCESS(Result))
         goto exit;
 
@@ -881,7 +1743,7 @@ static NTSTATUS fsp_fuse_intf_GetSecurityByName(FSP_FILE_SYSTEM *FileSystem,
         Result = STATUS_SUCCESS;
 
 exit:
-    if (0 != PosixPath)
+    if (0 != PosixPath && PosixPathBuf != PosixPath)
         FspPosixDeletePath(PosixPath);
 
     return Result;
@@ -921,6 +1783,7 @@ static NTSTATUS fsp_fuse_intf_Create(FSP_FILE_SYSTEM *FileSystem,
     struct fsp_fuse_context_header *contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
     UINT32 Uid, Gid, Mode;
     FSP_FSCTL_FILE_INFO FileInfoBuf;
+    LONG Generation, Invalidations;
     struct fsp_fuse_file_desc *filedesc = 0;
     struct fuse_file_info fi;
     BOOLEAN Opened = FALSE;
@@ -1076,12 +1939,21 @@ static NTSTATUS fsp_fuse_intf_Create(FSP_FILE_SYSTEM *FileSystem,
         }
     }
 
+    Generation = fsp_fuse_intf_FileInfoGeneration(f);
+    Invalidations = fsp_fuse_intf_NodeFileInfoInvalidations(f);
     Result = fsp_fuse_intf_GetFileInfoEx(FileSystem, contexthdr->PosixPath,
         FUSE_FILE_INFO(CreateOptions & FILE_DIRECTORY_FILE, &fi),
         &Uid, &Gid, &Mode, &FileInfoBuf);
     if (!NT_SUCCESS(Result))
         goto exit;
 
+    filedesc->Node = fsp_fuse_intf_NodeOpen(f, FileInfoBuf.IndexNumber, contexthdr->PosixPath);
+    if (0 == filedesc->Node)
+    {
+        Result = STATUS_INSUFFICIENT_RESOURCES;
+        goto exit;
+    }
+
     /*
      * Ignore fuse_file_info::keep_cache.
      * Ignore fuse_file_info::nonseekable.
@@ -1092,18 +1964,23 @@ static NTSTATUS fsp_fuse_intf_Create(FSP_FILE_SYSTEM *FileSystem,
     *PFileDesc = filedesc;
     memcpy(FileInfo, &FileInfoBuf, sizeof FileInfoBuf);
 
-    filedesc->PosixPath = contexthdr->PosixPath;
     filedesc->IsDirectory = !!(FileInfoBuf.FileAttributes & FILE_ATTRIBUTE_DIRECTORY);
     filedesc->IsReparsePoint = FALSE;
     filedesc->OpenFlags = fi.flags;
     filedesc->FileHandle = fi.fh;
     filedesc->DirBuffer = 0;
-    contexthdr->PosixPath = 0;
+    InitializeSRWLock(&filedesc->FileInfoLock);
+    filedesc->FileInfoValid = FALSE;
+    fsp_fuse_intf_SetOpenFileInfo(f, filedesc, Generation, Invalidations, &FileInfoBuf);
 
     if (!f->VolumeParams.CaseSensitiveSearch && 0 != f->ops.getpath)
-        fsp_fuse_intf_GetOpenFileInfoPath(f, filedesc->PosixPath, -1 != fi.fh ? &fi : 0,
+        fsp_fuse_intf_GetOpenFileInfoPath(f, contexthdr->PosixPath, -1 != fi.fh ? &fi : 0,
             FspFileSystemGetOpenFileInfo(FileInfo));
 
+    /* the handle is counted once the open can no longer fail; see fsp_fuse_intf_NodeCleanup */
+    InterlockedIncrement(&filedesc->Node->HandleCount);
+    filedesc->IsHandleOpen = TRUE;
+
     Result = STATUS_SUCCESS;
 
 exit:
@@ -1138,6 +2015,7 @@ static NTSTATUS fsp_fuse_intf_Open(FSP_FILE_SYSTEM *FileSystem,
     struct fsp_fuse_context_header *contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
     UINT32 Uid, Gid, Mode;
     FSP_FSCTL_FILE_INFO FileInfoBuf;
+    LONG Generation, Invalidations;
     struct fsp_fuse_file_desc *filedesc = 0;
     struct fuse_file_info fi;
     int err;
@@ -1156,6 +2034,8 @@ static NTSTATUS fsp_fuse_intf_Open(FSP_FILE_SYSTEM *FileSystem,
         }
     }
 
+    Generation = fsp_fuse_intf_FileInfoGeneration(f);
+    Invalidations = fsp_fuse_intf_NodeFileInfoInvalidations(f);
     Result = fsp_fuse_intf_GetFileInfoEx(FileSystem, contexthdr->PosixPath, 0,
         &Uid, &Gid, &Mode, &FileInfoBuf);
     if (!NT_SUCCESS(Result))
@@ -1168,6 +2048,13 @@ static NTSTATUS fsp_fuse_intf_Open(FSP_FILE_SYSTEM *FileSystem,
         goto exit;
     }
 
+    filedesc->Node = fsp_fuse_intf_NodeOpen(f, FileInfoBuf.IndexNumber, contexthdr->PosixPath);
+    if (0 == filedesc->Node)
+    {
+        Result = STATUS_INSUFFICIENT_RESOURCES;
+        goto exit;
+    }
+
     memset(&fi, 0, sizeof fi);
     switch (GrantedAccess & (FILE_READ_DATA | FILE_WRITE_DATA))
     {
@@ -1236,23 +2123,33 @@ static NTSTATUS fsp_fuse_intf_Open(FSP_FILE_SYSTEM *FileSystem,
     *PFileDesc = filedesc;
     memcpy(FileInfo, &FileInfoBuf, sizeof FileInfoBuf);
 
-    filedesc->PosixPath = contexthdr->PosixPath;
     filedesc->IsDirectory = !!(FileInfoBuf.FileAttributes & FILE_ATTRIBUTE_DIRECTORY);
     filedesc->IsReparsePoint = !!(FileInfoBuf.FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT);
     filedesc->OpenFlags = fi.flags;
     filedesc->FileHandle = fi.fh;
     filedesc->DirBuffer = 0;
-    contexthdr->PosixPath = 0;
+    InitializeSRWLock(&filedesc->FileInfoLock);
+    filedesc->FileInfoValid = FALSE;
+    fsp_fuse_intf_SetOpenFileInfo(f, filedesc, Generation, Invalidations, &FileInfoBuf);
 
     if (!f->VolumeParams.CaseSensitiveSearch && 0 != f->ops.getpath)
-        fsp_fuse_intf_GetOpenFileInfoPath(f, filedesc->PosixPath, -1 != fi.fh ? &fi : 0,
+        fsp_fuse_intf_GetOpenFileInfoPath(f, contexthdr->PosixPath, -1 != fi.fh ? &fi : 0,
             FspFileSystemGetOpenFileInfo(FileInfo));
 
+    /* the handle is counted once the open can no longer fail; see fsp_fuse_intf_NodeCleanup */
+    InterlockedIncrement(&filedesc->Node->HandleCount);
+    filedesc->IsHandleOpen = TRUE;
+
     Result = STATUS_SUCCESS;
 
 exit:
-    if (!NT_SUCCESS(Result))
+    if (!NT_SUCCESS(Result) && 0 != filedesc)
+    {
+        if (0 != filedesc->Node)
+            fsp_fuse_intf_NodeClose(FileSystem, filedesc->Node);
+
         MemFree(filedesc);
+    }
 
     return Result;
 }
@@ -1264,7 +2161,6 @@ static NTSTATUS fsp_fuse_intf_Overwrite(FSP_FILE_SYSTEM *FileSystem,
 {
     struct fuse *f = FileSystem->UserContext;
     struct fsp_fuse_file_desc *filedesc = FileDesc;
-    UINT32 Uid, Gid, Mode;
     struct fuse_file_info fi;
     int err;
     NTSTATUS Result;
@@ -1281,16 +2177,16 @@ static NTSTATUS fsp_fuse_intf_Overwrite(FSP_FILE_SYSTEM *FileSystem,
             0 == f->ops.setxattr || 0 == f->ops.removexattr)
             return STATUS_EAS_NOT_SUPPORTED;
 
-        namesize = f->ops.listxattr(filedesc->PosixPath, names, sizeof names);
+        namesize = f->ops.listxattr(filedesc->Node->PosixPath, names, sizeof names);
         if (0 < namesize)
             for (char *p = names, *endp = p + namesize; endp > p; p += namesize)
             {
                 namesize = lstrlenA(p) + 1;
-                f->ops.removexattr(filedesc->PosixPath, p);
+                f->ops.removexattr(filedesc->Node->PosixPath, p);
             }
 
         Result = FspFileSystemEnumerateEa(FileSystem,
-            fsp_fuse_intf_SetEaEntry, filedesc->PosixPath, Ea, EaLength);
+            fsp_fuse_intf_SetEaEntry, filedesc->Node->PosixPath, Ea, EaLength);
         if (!NT_SUCCESS(Result) && STATUS_INVALID_DEVICE_REQUEST != Result)
             return Result;
     }
@@ -1301,16 +2197,17 @@ static NTSTATUS fsp_fuse_intf_Overwrite(FSP_FILE_SYSTEM *FileSystem,
         fi.flags = filedesc->OpenFlags;
         fi.fh = filedesc->FileHandle;
 
-        err = f->ops.ftruncate(filedesc->PosixPath, 0, &fi);
+        err = f->ops.ftruncate(fsp_fuse_intf_HandlePath(f, filedesc), 0, &fi);
         Result = fsp_fuse_ntstatus_from_errno(f->env, err);
     }
     else if (0 != f->ops.truncate)
     {
-        err = f->ops.truncate(filedesc->PosixPath, 0);
+        err = f->ops.truncate(filedesc->Node->PosixPath, 0);
         Result = fsp_fuse_ntstatus_from_errno(f->env, err);
     }
     else
         Result = STATUS_INVALID_DEVICE_REQUEST;
+    fsp_fuse_intf_InvalidateNodeFileInfo(f, filedesc->Node);
     if (!NT_SUCCESS(Result))
         return Result;
 
@@ -1323,16 +2220,14 @@ static NTSTATUS fsp_fuse_intf_Overwrite(FSP_FILE_SYSTEM *FileSystem,
          * ReplaceFileAttributes is FALSE. I am punting on this detail for now.
          */
 
-        err = f->ops.chflags(filedesc->PosixPath,
+        err = f->ops.chflags(filedesc->Node->PosixPath,
             fsp_fuse_intf_MapFileAttributesToFlags(FileAttributes | FILE_ATTRIBUTE_ARCHIVE));
         Result = fsp_fuse_ntstatus_from_errno(f->env, err);
         if (!NT_SUCCESS(Result) && STATUS_INVALID_DEVICE_REQUEST != Result)
             return Result;
     }
 
-    return fsp_fuse_intf_GetFileInfoEx(FileSystem, filedesc->PosixPath,
-        FUSE_FILE_INFO(filedesc->IsDirectory, &fi),
-        &Uid, &Gid, &Mode, FileInfo);
+    return fsp_fuse_intf_GetFileInfoCached(FileSystem, filedesc, &fi, FileInfo);
 }
 
 static VOID fsp_fuse_intf_Cleanup(FSP_FILE_SYSTEM *FileSystem,
@@ -1361,10 +2256,10 @@ static VOID fsp_fuse_intf_Cleanup(FSP_FILE_SYSTEM *FileSystem,
      *
      * NOTE:
      *
-     * Since WinFsp 2022 Beta4 (v1.10B4) it is possible to handle handles open other than ours
-     * because of the new POSIX unlink semantics. Although we still do not provide the hard_remove
-     * option, file systems that would need the hard_remove option can instead use the
-     * LegacyUnlinkRename option to opt out of the POSIX unlink semantics.
+     * Since WinFsp 2022 Beta4 (v1.10B4) it is possible to have handles open other than ours
+     * because of the new POSIX unlink semantics. In this case we follow FUSE: the file is
+     * renamed to a hidden name and is removed when its last open file is closed, unless the
+     * hard_remove option was specified. See fsp_fuse_intf_NodeUnlink.
      */
 
     if (f->FlushOnCleanup && !filedesc->IsDirectory && !filedesc->IsReparsePoint) {
@@ -1372,20 +2267,16 @@ static VOID fsp_fuse_intf_Cleanup(FSP_FILE_SYSTEM *FileSystem,
         fi.flags = filedesc->OpenFlags;
         fi.fh = filedesc->FileHandle;
         if (0 != f->ops.flush)
-            f->ops.flush(filedesc->PosixPath, &fi);
+            f->ops.flush(fsp_fuse_intf_HandlePath(f, filedesc), &fi);
     }
 
     if (Flags & FspCleanupDelete)
-        if (filedesc->IsDirectory && !filedesc->IsReparsePoint)
-        {
-            if (0 != f->ops.rmdir)
-                f->ops.rmdir(filedesc->PosixPath);
-        }
-        else
-        {
-            if (0 != f->ops.unlink)
-                f->ops.unlink(filedesc->PosixPath);
-        }
+    {
+        fsp_fuse_intf_NodeUnlink(FileSystem, filedesc);
+        fsp_fuse_intf_InvalidateFileInfo(f);
+    }
+
+    fsp_fuse_intf_NodeCleanup(FileSystem, filedesc, !!(Flags & FspCleanupDelete));
 }
 
 static VOID fsp_fuse_intf_Close(FSP_FILE_SYSTEM *FileSystem,
@@ -1406,21 +2297,97 @@ static VOID fsp_fuse_intf_Close(FSP_FILE_SYSTEM *FileSystem,
     else if (filedesc->IsDirectory)
     {
         if (0 != f->ops.releasedir)
-            f->ops.releasedir(filedesc->PosixPath, &fi);
+            f->ops.releasedir(fsp_fuse_intf_HandlePath(f, filedesc), &fi);
     }
     else
     {
         if (!f->FlushOnCleanup && 0 != f->ops.flush)
-            f->ops.flush(filedesc->PosixPath, &fi);
+            f->ops.flush(fsp_fuse_intf_HandlePath(f, filedesc), &fi);
         if (0 != f->ops.release)
-            f->ops.release(filedesc->PosixPath, &fi);
+            f->ops.release(fsp_fuse_intf_HandlePath(f, filedesc), &fi);
     }
 
     FspFileSystemDeleteDirectoryBuffer(&filedesc->DirBuffer);
-    MemFree(filedesc->PosixPath);
+    fsp_fuse_intf_NodeCleanup(FileSystem, filedesc, FALSE);
+    fsp_fuse_intf_NodeClose(FileSystem, filedesc->Node);
     MemFree(filedesc);
 }
 
+/*
+ * With FSP_FUSE_CAP_ASYNC a Read, Write or ReadDirectory operation publishes the state that is
+ * needed to complete it in the context header. If the file system calls fuse_async_begin, the
+ * operation returns STATUS_PENDING and fuse_async_end later sends the response to the FSD.
+ * Read and Write publish a stack copy that fuse_async_begin copies to the heap; ReadDirectory
+ * allocates its state upfront, because the file system receives a pointer to its dirhandle.
+ * The caller's fuse_context is saved as well, because fuse_async_end may run on any thread
+ * and completing a ReadDirectory calls getattr.
+ */
+struct fsp_fuse_async
+{
+    FSP_FILE_SYSTEM *FileSystem;
+    FSP_FSCTL_TRANSACT_KIND Kind;
+    UINT64 Hint;
+    struct fsp_fuse_file_desc *filedesc;
+    struct fuse_context context;
+    /* Write */
+    UINT64 Offset;
+    LONG Generation;
+    FSP_FSCTL_FILE_INFO FileInfo;
+    /* ReadDirectory */
+    PVOID Buffer;
+    ULONG Length;
+    struct fuse_dirhandle dh;
+};
+
+static inline VOID fsp_fuse_intf_AsyncEnter(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_KIND Kind, struct fsp_fuse_file_desc *filedesc,
+    struct fsp_fuse_async *Async)
+{
+    struct fuse_context *context = fsp_fuse_get_context_internal();
+
+    if (0 == context)
+        return;
+
+    Async->FileSystem = FileSystem;
+    Async->Kind = Kind;
+    Async->Hint = FspFileSystemGetOperationContext()->Request->Hint;
+    Async->filedesc = filedesc;
+    memcpy(&Async->context, context, sizeof *context);
+
+    FSP_FUSE_HDR_FROM_CONTEXT(context)->Async = Async;
+}
+
+static inline BOOLEAN fsp_fuse_intf_AsyncLeave(VOID)
+{
+    struct fuse_context *context = fsp_fuse_get_context_internal();
+    struct fsp_fuse_context_header *contexthdr;
+    BOOLEAN Begun;
+
+    if (0 == context)
+        return FALSE;
+
+    contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
+    Begun = contexthdr->AsyncBegun;
+    contexthdr->Async = 0;
+    contexthdr->AsyncBegun = FALSE;
+
+    return Begun;
+}
+
+static NTSTATUS fsp_fuse_intf_ReadResult(struct fuse *f, int bytes,
+    PULONG PBytesTransferred)
+{
+    if (0 < bytes)
+    {
+        *PBytesTransferred = bytes;
+        return STATUS_SUCCESS;
+    }
+    else if (0 == bytes)
+        return STATUS_END_OF_FILE;
+    else
+        return fsp_fuse_ntstatus_from_errno(f->env, bytes);
+}
+
 static NTSTATUS fsp_fuse_intf_Read(FSP_FILE_SYSTEM *FileSystem,
     PVOID FileDesc, PVOID Buffer, UINT64 Offset, ULONG Length,
     PULONG PBytesTransferred)
@@ -1428,8 +2395,8 @@ static NTSTATUS fsp_fuse_intf_Read(FSP_FILE_SYSTEM *FileSystem,
     struct fuse *f = FileSystem->UserContext;
     struct fsp_fuse_file_desc *filedesc = FileDesc;
     struct fuse_file_info fi;
+    struct fsp_fuse_async Async;
     int bytes;
-    NTSTATUS Result;
 
     if (filedesc->IsDirectory || filedesc->IsReparsePoint)
         return STATUS_ACCESS_DENIED;
@@ -1441,18 +2408,53 @@ static NTSTATUS fsp_fuse_intf_Read(FSP_FILE_SYSTEM *FileSystem,
     fi.flags = filedesc->OpenFlags;
     fi.fh = filedesc->FileHandle;
 
-    bytes = f->ops.read(filedesc->PosixPath, Buffer, Length, Offset, &fi);
-    if (0 < bytes)
+    if (0 != (f->conn_want & FSP_FUSE_CAP_ASYNC))
     {
-        *PBytesTransferred = bytes;
-        Result = STATUS_SUCCESS;
+        memset(&Async, 0, sizeof Async);
+        fsp_fuse_intf_AsyncEnter(FileSystem, FspFsctlTransactReadKind, filedesc, &Async);
+        bytes = f->ops.read(fsp_fuse_intf_HandlePath(f, filedesc), Buffer, Length, Offset, &fi);
+        if (fsp_fuse_intf_AsyncLeave())
+            return STATUS_PENDING;
     }
-    else if (0 == bytes)
-        Result = STATUS_END_OF_FILE;
     else
-        Result = fsp_fuse_ntstatus_from_errno(f->env, bytes);
+        bytes = f->ops.read(fsp_fuse_intf_HandlePath(f, filedesc), Buffer, Length, Offset, &fi);
 
-    return Result;
+    return fsp_fuse_intf_ReadResult(f, bytes, PBytesTransferred);
+}
+
+static NTSTATUS fsp_fuse_intf_WriteResult(struct fuse *f,
+    struct fsp_fuse_file_desc *filedesc, UINT64 Offset, LONG Generation,
+    FSP_FSCTL_FILE_INFO *FileInfoBuf, int bytes,
+    PULONG PBytesTransferred, FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    UINT64 AllocationUnit;
+    BOOLEAN Extended;
+
+    if (0 > bytes)
+        return fsp_fuse_ntstatus_from_errno(f->env, bytes);
+
+    *PBytesTransferred = bytes;
+
+    AllocationUnit = (UINT64)f->VolumeParams.SectorSize *
+        (UINT64)f->VolumeParams.SectorsPerAllocationUnit;
+    Extended = Offset + bytes > FileInfoBuf->FileSize;
+    if (Extended)
+        FileInfoBuf->FileSize = Offset + bytes;
+    FileInfoBuf->AllocationSize =
+        (FileInfoBuf->FileSize + AllocationUnit - 1) / AllocationUnit * AllocationUnit;
+
+    /*
+     * An extending write leaves other open files of this file with a stale file size.
+     * If someone else invalidated file information during this write, ours is stale too.
+     */
+    if (!Extended)
+        fsp_fuse_intf_SetCachedFileInfo(f, filedesc, Generation, FileInfoBuf);
+    else if (Generation + 1 == fsp_fuse_intf_InvalidateNodeFileInfo(f, filedesc->Node))
+        fsp_fuse_intf_SetCachedFileInfo(f, filedesc, Generation + 1, FileInfoBuf);
+
+    memcpy(FileInfo, FileInfoBuf, sizeof *FileInfoBuf);
+
+    return STATUS_SUCCESS;
 }
 
 static NTSTATUS fsp_fuse_intf_Write(FSP_FILE_SYSTEM *FileSystem,
@@ -1462,10 +2464,11 @@ static NTSTATUS fsp_fuse_intf_Write(FSP_FILE_SYSTEM *FileSystem,
 {
     struct fuse *f = FileSystem->UserContext;
     struct fsp_fuse_file_desc *filedesc = FileDesc;
-    UINT32 Uid, Gid, Mode;
     struct fuse_file_info fi;
+    struct fsp_fuse_async Async;
     FSP_FSCTL_FILE_INFO FileInfoBuf;
-    UINT64 EndOffset, AllocationUnit;
+    LONG Generation;
+    UINT64 EndOffset;
     int bytes;
     NTSTATUS Result;
 
@@ -1479,16 +2482,21 @@ static NTSTATUS fsp_fuse_intf_Write(FSP_FILE_SYSTEM *FileSystem,
     fi.flags = filedesc->OpenFlags;
     fi.fh = filedesc->FileHandle;
 
-    Result = fsp_fuse_intf_GetFileInfoEx(FileSystem, filedesc->PosixPath,
-        FUSE_FILE_INFO(filedesc->IsDirectory, &fi),
-        &Uid, &Gid, &Mode, &FileInfoBuf);
-    if (!NT_SUCCESS(Result))
-        return Result;
+    Generation = fsp_fuse_intf_NodeFileInfoGeneration(f, filedesc->Node);
+    if (!fsp_fuse_intf_GetCachedFileInfo(f, filedesc, &FileInfoBuf))
+    {
+        Result = fsp_fuse_intf_GetFileInfoCached(FileSystem, filedesc, &fi, &FileInfoBuf);
+        if (!NT_SUCCESS(Result))
+            return Result;
+    }
 
     if (ConstrainedIo)
     {
         if (Offset >= FileInfoBuf.FileSize)
-            goto success;
+        {
+            memcpy(FileInfo, &FileInfoBuf, sizeof FileInfoBuf);
+            return STATUS_SUCCESS;
+        }
         EndOffset = Offset + Length;
         if (EndOffset > FileInfoBuf.FileSize)
             EndOffset = FileInfoBuf.FileSize;
@@ -1500,23 +2508,24 @@ static NTSTATUS fsp_fuse_intf_Write(FSP_FILE_SYSTEM *FileSystem,
         EndOffset = Offset + Length;
     }
 
-    bytes = f->ops.write(filedesc->PosixPath, Buffer, (size_t)(EndOffset - Offset), Offset, &fi);
-    if (0 > bytes)
-        return fsp_fuse_ntstatus_from_errno(f->env, bytes);
-
-    *PBytesTransferred = bytes;
-
-    AllocationUnit = (UINT64)f->VolumeParams.SectorSize *
-        (UINT64)f->VolumeParams.SectorsPerAllocationUnit;
-    if (Offset + bytes > FileInfoBuf.FileSize)
-        FileInfoBuf.FileSize = Offset + bytes;
-    FileInfoBuf.AllocationSize =
-        (FileInfoBuf.FileSize + AllocationUnit - 1) / AllocationUnit * AllocationUnit;
-
-success:
-    memcpy(FileInfo, &FileInfoBuf, sizeof FileInfoBuf);
+    if (0 != (f->conn_want & FSP_FUSE_CAP_ASYNC))
+    {
+        memset(&Async, 0, sizeof Async);
+        Async.Offset = Offset;
+        Async.Generation = Generation;
+        memcpy(&Async.FileInfo, &FileInfoBuf, sizeof FileInfoBuf);
+        fsp_fuse_intf_AsyncEnter(FileSystem, FspFsctlTransactWriteKind, filedesc, &Async);
+        bytes = f->ops.write(fsp_fuse_intf_HandlePath(f, filedesc),
+            Buffer, (size_t)(EndOffset - Offset), Offset, &fi);
+        if (fsp_fuse_intf_AsyncLeave())
+            return STATUS_PENDING;
+    }
+    else
+        bytes = f->ops.write(fsp_fuse_intf_HandlePath(f, filedesc),
+            Buffer, (size_t)(EndOffset - Offset), Offset, &fi);
 
-    return STATUS_SUCCESS;
+    return fsp_fuse_intf_WriteResult(f, filedesc, Offset, Generation, &FileInfoBuf, bytes,
+        PBytesTransferred, FileInfo);
 }
 
 static NTSTATUS fsp_fuse_intf_Flush(FSP_FILE_SYSTEM *FileSystem,
@@ -1545,7 +2554,7 @@ static NTSTATUS fsp_fuse_intf_Flush(FSP_FILE_SYSTEM *FileSystem,
     {
         if (0 != f->ops.fsyncdir)
         {
-            err = f->ops.fsyncdir(filedesc->PosixPath, 0, &fi);
+            err = f->ops.fsyncdir(fsp_fuse_intf_HandlePath(f, filedesc), 0, &fi);
             Result = fsp_fuse_ntstatus_from_errno(f->env, err);
         }
     }
@@ -1553,15 +2562,14 @@ static NTSTATUS fsp_fuse_intf_Flush(FSP_FILE_SYSTEM *FileSystem,
     {
         if (0 != f->ops.fsync)
         {
-            err = f->ops.fsync(filedesc->PosixPath, 0, &fi);
+            err = f->ops.fsync(fsp_fuse_intf_HandlePath(f, filedesc), 0, &fi);
             Result = fsp_fuse_ntstatus_from_errno(f->env, err);
         }
     }
     if (!NT_SUCCESS(Result))
         return Result;
 
-    Result = fsp_fuse_intf_GetFileInfoEx(FileSystem, filedesc->PosixPath,
-        FUSE_FILE_INFO(filedesc->IsDirectory, &fi),
+    Result = fsp_fuse_intf_GetFileInfoByHandle(FileSystem, filedesc, &fi,
         &Uid, &Gid, &Mode, &FileInfoBuf);
     if (!NT_SUCCESS(Result))
         return Result;
@@ -1575,18 +2583,14 @@ static NTSTATUS fsp_fuse_intf_GetFileInfo(FSP_FILE_SYSTEM *FileSystem,
     PVOID FileDesc,
     FSP_FSCTL_FILE_INFO *FileInfo)
 {
-    struct fuse *f = FileSystem->UserContext;
     struct fsp_fuse_file_desc *filedesc = FileDesc;
-    UINT32 Uid, Gid, Mode;
     struct fuse_file_info fi;
 
     memset(&fi, 0, sizeof fi);
     fi.flags = filedesc->OpenFlags;
     fi.fh = filedesc->FileHandle;
 
-    return fsp_fuse_intf_GetFileInfoEx(FileSystem, filedesc->PosixPath,
-        FUSE_FILE_INFO(filedesc->IsDirectory, &fi),
-        &Uid, &Gid, &Mode, FileInfo);
+    return fsp_fuse_intf_GetFileInfoCached(FileSystem, filedesc, &fi, FileInfo);
 }
 
 static NTSTATUS fsp_fuse_intf_SetBasicInfo(FSP_FILE_SYSTEM *FileSystem,
@@ -1611,11 +2615,11 @@ static NTSTATUS fsp_fuse_intf_SetBasicInfo(FSP_FILE_SYSTEM *FileSystem,
     if (INVALID_FILE_ATTRIBUTES != FileAttributes &&
         0 != (f->conn_want & FSP_FUSE_CAP_STAT_EX) && 0 != f->ops.chflags)
     {
-        err = f->ops.chflags(filedesc->PosixPath,
+        err = f->ops.chflags(filedesc->Node->PosixPath,
             fsp_fuse_intf_MapFileAttributesToFlags(FileAttributes));
         Result = fsp_fuse_ntstatus_from_errno(f->env, err);
         if (!NT_SUCCESS(Result))
-            return Result;
+            goto exit;
     }
 
     if ((0 != LastAccessTime || 0 != LastWriteTime) &&
@@ -1623,11 +2627,11 @@ static NTSTATUS fsp_fuse_intf_SetBasicInfo(FSP_FILE_SYSTEM *FileSystem,
     {
         if (0 == LastAccessTime || 0 == LastWriteTime)
         {
-            Result = fsp_fuse_intf_GetFileInfoEx(FileSystem, filedesc->PosixPath,
+            Result = fsp_fuse_intf_GetFileInfoEx(FileSystem, filedesc->Node->PosixPath,
                 FUSE_FILE_INFO(filedesc->IsDirectory, &fi),
                 &Uid, &Gid, &Mode, &FileInfoBuf);
             if (!NT_SUCCESS(Result))
-                return Result;
+                goto exit;
 
             if (0 == LastAccessTime)
                 LastAccessTime = FileInfoBuf.LastAccessTime;
@@ -1639,41 +2643,47 @@ static NTSTATUS fsp_fuse_intf_SetBasicInfo(FSP_FILE_SYSTEM *FileSystem,
         FspPosixFileTimeToUnixTime(LastWriteTime, (void *)&tv[1]);
         if (0 != f->ops.utimens)
         {
-            err = f->ops.utimens(filedesc->PosixPath, tv);
+            err = f->ops.utimens(filedesc->Node->PosixPath, tv);
             Result = fsp_fuse_ntstatus_from_errno(f->env, err);
         }
         else
         {
             timbuf.actime = tv[0].tv_sec;
             timbuf.modtime = tv[1].tv_sec;
-            err = f->ops.utime(filedesc->PosixPath, &timbuf);
+            err = f->ops.utime(filedesc->Node->PosixPath, &timbuf);
             Result = fsp_fuse_ntstatus_from_errno(f->env, err);
         }
         if (!NT_SUCCESS(Result))
-            return Result;
+            goto exit;
     }
 
     if (0 != CreationTime && 0 != f->ops.setcrtime)
     {
         FspPosixFileTimeToUnixTime(CreationTime, (void *)&tv[0]);
-        err = f->ops.setcrtime(filedesc->PosixPath, &tv[0]);
+        err = f->ops.setcrtime(filedesc->Node->PosixPath, &tv[0]);
         Result = fsp_fuse_ntstatus_from_errno(f->env, err);
         if (!NT_SUCCESS(Result))
-            return Result;
+            goto exit;
     }
 
     if (0 != ChangeTime && 0 != f->ops.setchgtime)
     {
         FspPosixFileTimeToUnixTime(ChangeTime, (void *)&tv[0]);
-        err = f->ops.setchgtime(filedesc->PosixPath, &tv[0]);
+        err = f->ops.setchgtime(filedesc->Node->PosixPath, &tv[0]);
         Result = fsp_fuse_ntstatus_from_errno(f->env, err);
         if (!NT_SUCCESS(Result))
-            return Result;
+            goto exit;
     }
 
-    return fsp_fuse_intf_GetFileInfoEx(FileSystem, filedesc->PosixPath,
-        FUSE_FILE_INFO(filedesc->IsDirectory, &fi),
-        &Uid, &Gid, &Mode, FileInfo);
+    Result = STATUS_SUCCESS;
+
+exit:
+    fsp_fuse_intf_InvalidateNodeFileInfo(f, filedesc->Node);
+
+    if (!NT_SUCCESS(Result))
+        return Result;
+
+    return fsp_fuse_intf_GetFileInfoCached(FileSystem, filedesc, &fi, FileInfo);
 }
 
 static NTSTATUS fsp_fuse_intf_SetFileSize(FSP_FILE_SYSTEM *FileSystem,
@@ -1682,9 +2692,9 @@ static NTSTATUS fsp_fuse_intf_SetFileSize(FSP_FILE_SYSTEM *FileSystem,
 {
     struct fuse *f = FileSystem->UserContext;
     struct fsp_fuse_file_desc *filedesc = FileDesc;
-    UINT32 Uid, Gid, Mode;
     struct fuse_file_info fi;
     FSP_FSCTL_FILE_INFO FileInfoBuf;
+    LONG Generation;
     UINT64 AllocationUnit;
     int err;
     NTSTATUS Result;
@@ -1699,11 +2709,12 @@ static NTSTATUS fsp_fuse_intf_SetFileSize(FSP_FILE_SYSTEM *FileSystem,
     fi.flags = filedesc->OpenFlags;
     fi.fh = filedesc->FileHandle;
 
-    Result = fsp_fuse_intf_GetFileInfoEx(FileSystem, filedesc->PosixPath,
-        FUSE_FILE_INFO(filedesc->IsDirectory, &fi),
-        &Uid, &Gid, &Mode, &FileInfoBuf);
-    if (!NT_SUCCESS(Result))
-        return Result;
+    if (!fsp_fuse_intf_GetCachedFileInfo(f, filedesc, &FileInfoBuf))
+    {
+        Result = fsp_fuse_intf_GetFileInfoCached(FileSystem, filedesc, &fi, &FileInfoBuf);
+        if (!NT_SUCCESS(Result))
+            return Result;
+    }
 
     if (!SetAllocationSize || FileInfoBuf.FileSize > NewSize)
     {
@@ -1714,14 +2725,15 @@ static NTSTATUS fsp_fuse_intf_SetFileSize(FSP_FILE_SYSTEM *FileSystem,
          */
         if (0 != f->ops.ftruncate)
         {
-            err = f->ops.ftruncate(filedesc->PosixPath, NewSize, &fi);
+            err = f->ops.ftruncate(fsp_fuse_intf_HandlePath(f, filedesc), NewSize, &fi);
             Result = fsp_fuse_ntstatus_from_errno(f->env, err);
         }
         else
         {
-            err = f->ops.truncate(filedesc->PosixPath, NewSize);
+            err = f->ops.truncate(filedesc->Node->PosixPath, NewSize);
             Result = fsp_fuse_ntstatus_from_errno(f->env, err);
         }
+        Generation = fsp_fuse_intf_InvalidateNodeFileInfo(f, filedesc->Node);
         if (!NT_SUCCESS(Result))
             return Result;
 
@@ -1730,6 +2742,7 @@ static NTSTATUS fsp_fuse_intf_SetFileSize(FSP_FILE_SYSTEM *FileSystem,
         FileInfoBuf.FileSize = NewSize;
         FileInfoBuf.AllocationSize =
             (FileInfoBuf.FileSize + AllocationUnit - 1) / AllocationUnit * AllocationUnit;
+        fsp_fuse_intf_SetCachedFileInfo(f, filedesc, Generation, &FileInfoBuf);
     }
 
     memcpy(FileInfo, &FileInfoBuf, sizeof FileInfoBuf);
@@ -1773,7 +2786,7 @@ static NTSTATUS fsp_fuse_intf_CanDelete(FSP_FILE_SYSTEM *FileSystem,
     if (0 != (f->conn_want & FSP_FUSE_CAP_DELETE_ACCESS) && 0 != f->ops.access)
     {
         NTSTATUS Result;
-        err = f->ops.access(filedesc->PosixPath, FSP_FUSE_DELETE_OK);
+        err = f->ops.access(filedesc->Node->PosixPath, FSP_FUSE_DELETE_OK);
         Result = fsp_fuse_ntstatus_from_errno(f->env, err);
         if (!NT_SUCCESS(Result) && STATUS_INVALID_DEVICE_REQUEST != Result)
         {
@@ -1795,10 +2808,12 @@ static NTSTATUS fsp_fuse_intf_CanDelete(FSP_FILE_SYSTEM *FileSystem,
             fi.flags = filedesc->OpenFlags;
             fi.fh = filedesc->FileHandle;
 
-            err = f->ops.readdir(filedesc->PosixPath, &dh, fsp_fuse_intf_CanDeleteAddDirInfo, 0, &fi);
+            err = f->ops.readdir(fsp_fuse_intf_HandlePath(f, filedesc),
+                &dh, fsp_fuse_intf_CanDeleteAddDirInfo, 0, &fi);
         }
         else if (0 != f->ops.getdir)
-            err = f->ops.getdir(filedesc->PosixPath, &dh, fsp_fuse_intf_CanDeleteAddDirInfoOld);
+            err = f->ops.getdir(filedesc->Node->PosixPath,
+                &dh, fsp_fuse_intf_CanDeleteAddDirInfoOld);
         else
             err = 0;
 
@@ -1823,6 +2838,11 @@ static NTSTATUS fsp_fuse_intf_Rename(FSP_FILE_SYSTEM *FileSystem,
     UINT32 Uid, Gid, Mode;
     FSP_FSCTL_FILE_INFO FileInfoBuf;
     struct fsp_fuse_file_desc *filedesc = FileDesc;
+    struct fsp_fuse_node *target = 0;
+    struct fsp_fuse_node_path *TargetPath = 0;
+    struct fsp_fuse_node_rename *Rename;
+    char *PosixTargetPath = 0;
+    BOOLEAN ReplaceTarget = FALSE, TargetHidden = FALSE;
     int err;
     NTSTATUS Result;
 
@@ -1841,9 +2861,60 @@ static NTSTATUS fsp_fuse_intf_Rename(FSP_FILE_SYSTEM *FileSystem,
 
         if (FileInfoBuf.FileAttributes & FILE_ATTRIBUTE_DIRECTORY)
             return STATUS_ACCESS_DENIED;
+
+        ReplaceTarget = TRUE;
+    }
+
+    /* the open files below the renamed file must get their new paths after the rename */
+    Result = fsp_fuse_intf_NodeRenamePrepare(FileSystem,
+        filedesc->Node->PosixPath, contexthdr->PosixPath, &Rename);
+    if (!NT_SUCCESS(Result))
+        return Result;
+
+    if (ReplaceTarget)
+    {
+        /* if the replaced file is open, hide it like an unlinked file */
+        target = fsp_fuse_intf_NodeReference(f, FileInfoBuf.IndexNumber, contexthdr->PosixPath);
+        if (0 != target && target != filedesc->Node && !f->hard_remove &&
+            0 != target->HandleCount)
+        {
+            /* keep the replaced path until we know whether the rename succeeded */
+            PosixTargetPath = target->PosixPath;
+            TargetHidden = fsp_fuse_intf_NodeHide(FileSystem, target, &TargetPath);
+        }
+    }
+
+    err = f->ops.rename(filedesc->Node->PosixPath, contexthdr->PosixPath);
+    if (0 == err)
+    {
+        if (0 != target && target != filedesc->Node && !TargetHidden)
+        {
+            AcquireSRWLockExclusive(&f->NodeLock);
+            target->IsRemoved = TRUE;
+            ReleaseSRWLockExclusive(&f->NodeLock);
+        }
+
+        fsp_fuse_intf_NodeRenameCommit(FileSystem, Rename);
+
+        /* if the handles of the target were cleaned up while we hid it, unlink it now */
+        if (TargetHidden && fsp_fuse_intf_NodeClaimHidden(f, target) && 0 != f->ops.unlink)
+            f->ops.unlink(target->PosixPath);
+    }
+    else if (TargetHidden && 0 == f->ops.rename(target->PosixPath, PosixTargetPath))
+    {
+        AcquireSRWLockExclusive(&f->NodeLock);
+        TargetPath = fsp_fuse_intf_NodeSetPath(f, target, TargetPath);
+        target->IsHidden = FALSE;
+        ReleaseSRWLockExclusive(&f->NodeLock);
     }
+    if (TargetHidden)
+        fsp_fuse_intf_NodeRetirePath(f, TargetPath);
+    fsp_fuse_intf_NodeRenameRelease(FileSystem, Rename);
+    fsp_fuse_intf_InvalidateFileInfo(f);
+
+    if (0 != target)
+        fsp_fuse_intf_NodeClose(FileSystem, target);
 
-    err = f->ops.rename(filedesc->PosixPath, contexthdr->PosixPath);
     return fsp_fuse_ntstatus_from_errno(f->env, err);
 }
 
@@ -1860,7 +2931,7 @@ static NTSTATUS fsp_fuse_intf_GetSecurity(FSP_FILE_SYSTEM *FileSystem,
     fi.flags = filedesc->OpenFlags;
     fi.fh = filedesc->FileHandle;
 
-    return fsp_fuse_intf_GetSecurityEx(FileSystem, filedesc->PosixPath,
+    return fsp_fuse_intf_GetSecurityEx(FileSystem, filedesc->Node->PosixPath,
         FUSE_FILE_INFO(filedesc->IsDirectory, &fi),
         &FileAttributes, SecurityDescriptorBuf, PSecurityDescriptorSize);
 }
@@ -1885,7 +2956,7 @@ static NTSTATUS fsp_fuse_intf_SetSecurity(FSP_FILE_SYSTEM *FileSystem,
     fi.flags = filedesc->OpenFlags;
     fi.fh = filedesc->FileHandle;
 
-    Result = fsp_fuse_intf_GetFileInfoEx(FileSystem, filedesc->PosixPath,
+    Result = fsp_fuse_intf_GetFileInfoEx(FileSystem, filedesc->Node->PosixPath,
         FUSE_FILE_INFO(filedesc->IsDirectory, &fi),
         &Uid, &Gid, &Mode, &FileInfo);
     if (!NT_SUCCESS(Result))
@@ -1911,7 +2982,7 @@ static NTSTATUS fsp_fuse_intf_SetSecurity(FSP_FILE_SYSTEM *FileSystem,
 
     if (NewMode != Mode)
     {
-        err = f->ops.chmod(filedesc->PosixPath, NewMode);
+        err = f->ops.chmod(filedesc->Node->PosixPath, NewMode);
         if (0 != err)
         {
             Result = fsp_fuse_ntstatus_from_errno(f->env, err);
@@ -1922,7 +2993,7 @@ static NTSTATUS fsp_fuse_intf_SetSecurity(FSP_FILE_SYSTEM *FileSystem,
     if (NewUid != Uid || NewGid != Gid)
         if (0 != f->ops.chown)
         {
-            err = f->ops.chown(filedesc->PosixPath, NewUid, NewGid);
+            err = f->ops.chown(filedesc->Node->PosixPath, NewUid, NewGid);
             if (0 != err)
             {
                 Result = fsp_fuse_ntstatus_from_errno(f->env, err);
@@ -1933,6 +3004,8 @@ static NTSTATUS fsp_fuse_intf_SetSecurity(FSP_FILE_SYSTEM *FileSystem,
     Result = STATUS_SUCCESS;
 
 exit:
+    fsp_fuse_intf_InvalidateNodeFileInfo(f, filedesc->Node);
+
     if (0 != NewSecurityDescriptor)
         FspDeleteSecurityDescriptor(NewSecurityDescriptor,
             FspSetSecurityDescriptor);
@@ -1959,6 +3032,36 @@ static VOID fsp_fuse_intf_LogBadDirInfo(
             PosixPath, PosixName, Message);
 }
 
+static BOOLEAN fsp_fuse_intf_AsyncAddDirInfo(struct fuse_dirhandle *dh,
+    FSP_FSCTL_DIR_INFO *DirInfo)
+{
+    ULONG Size = FSP_FSCTL_DEFAULT_ALIGN_UP(DirInfo->Size);
+    ULONG Capacity;
+    PUINT8 Buffer;
+
+    if (dh->AsyncSize + Size > dh->AsyncCapacity)
+    {
+        Capacity = 0 != dh->AsyncCapacity ? dh->AsyncCapacity * 2 : 4096;
+        while (dh->AsyncSize + Size > Capacity)
+            Capacity *= 2;
+        Buffer = 0 != dh->AsyncBuffer ?
+            MemRealloc(dh->AsyncBuffer, Capacity) :
+            MemAlloc(Capacity);
+        if (0 == Buffer)
+        {
+            dh->Result = STATUS_INSUFFICIENT_RESOURCES;
+            return FALSE;
+        }
+        dh->AsyncBuffer = Buffer;
+        dh->AsyncCapacity = Capacity;
+    }
+
+    memcpy(dh->AsyncBuffer + dh->AsyncSize, DirInfo, DirInfo->Size);
+    dh->AsyncSize += Size;
+
+    return TRUE;
+}
+
 /* !static: used by fuse2to3 */
 int fsp_fuse_intf_AddDirInfo(void *buf, const char *name,
     const struct fuse_stat *stbuf, fuse_off_t off)
@@ -1973,7 +3076,7 @@ int fsp_fuse_intf_AddDirInfo(void *buf, const char *name,
     FSP_FSCTL_DIR_INFO *DirInfo = &DirInfoBuf.V;
     ULONG SizeA, SizeW;
 
-    if ('/' == filedesc->PosixPath[0] && '\0' == filedesc->PosixPath[1])
+    if ('/' == filedesc->Node->PosixPath[0] && '\0' == filedesc->Node->PosixPath[1])
     {
         /* if this is the root directory do not add the dot entries */
 
@@ -1985,7 +3088,7 @@ int fsp_fuse_intf_AddDirInfo(void *buf, const char *name,
     SizeA = lstrlenA(name);
     if (SizeA > 255 * 4)
     {
-        fsp_fuse_intf_LogBadDirInfo(filedesc->PosixPath, name,
+        fsp_fuse_intf_LogBadDirInfo(filedesc->Node->PosixPath, name,
             "too long");
         return 0;
     }
@@ -1995,12 +3098,12 @@ int fsp_fuse_intf_AddDirInfo(void *buf, const char *name,
     {
         if (ERROR_INSUFFICIENT_BUFFER == GetLastError())
         {
-            fsp_fuse_intf_LogBadDirInfo(filedesc->PosixPath, name,
+            fsp_fuse_intf_LogBadDirInfo(filedesc->Node->PosixPath, name,
                 "too long");
             return 0;
         }
 
-        fsp_fuse_intf_LogBadDirInfo(filedesc->PosixPath, name,
+        fsp_fuse_intf_LogBadDirInfo(filedesc->Node->PosixPath, name,
             "MultiByteToWideChar failed");
         return 0;
     }
@@ -2014,12 +3117,15 @@ int fsp_fuse_intf_AddDirInfo(void *buf, const char *name,
         UINT32 Uid, Gid, Mode;
         NTSTATUS Result0;
 
-        Result0 = fsp_fuse_intf_GetFileInfoFunnel(dh->FileSystem, name, 0, stbuf,
+        Result0 = fsp_fuse_intf_GetFileInfoFunnel(dh->FileSystem, name, name, 0, stbuf,
             &Uid, &Gid, &Mode, 0, TRUE, &DirInfo->FileInfo);
         if (NT_SUCCESS(Result0))
             DirInfo->Padding[0] = 1; /* HACK: remember that the FileInfo is valid */
     }
 
+    if (dh->Async)
+        return !fsp_fuse_intf_AsyncAddDirInfo(dh, DirInfo);
+
     return !FspFileSystemFillDirectoryBuffer(&filedesc->DirBuffer, DirInfo, &dh->Result);
 }
 
@@ -2029,11 +3135,303 @@ static int fsp_fuse_intf_AddDirInfoOld(fuse_dirh_t dh, const char *name,
     return fsp_fuse_intf_AddDirInfo(dh, name, 0, 0) ? -ENOMEM : 0;
 }
 
+/*
+ * Directory entries that readdir did not supply stat data for are fixed up with getattr. For
+ * large remote directories this is a round trip per entry, so FixDirInfo first tries to fill
+ * the entries in bulk: with the getattr_batch operation if the file system has one, otherwise
+ * by calling getattr concurrently on a small thread pool (multithreaded file systems only).
+ * Entries that remain unfilled are then fixed up one at a time as before.
+ */
+#define FSP_FUSE_FIXDIRINFO_BATCH       256
+#define FSP_FUSE_FIXDIRINFO_PARALLEL    16      /* min entries per parallel worker */
+
+static char *fsp_fuse_intf_NewDirInfoPath(const char *DirPath, char **PPosixName)
+{
+    char *PosixPath;
+    ULONG SizeA;
+
+    SizeA = lstrlenA(DirPath);
+    PosixPath = fsp_fuse_arena_alloc(SizeA + 1 + 255 * 4 + 1);
+    if (0 == PosixPath)
+        return 0;
+
+    memcpy(PosixPath, DirPath, SizeA);
+    if (1 < SizeA)
+        /* if not root */
+        PosixPath[SizeA++] = '/';
+    PosixPath[SizeA] = '\0';
+    *PPosixName = PosixPath + SizeA;
+
+    return PosixPath;
+}
+
+/*
+ * Compute the POSIX path of DirInfo in PosixPath (as returned by NewDirInfoPath). The dot
+ * entries are computed by temporarily truncating PosixPath; the caller must then restore
+ * *PPosixPathEnd to *PSavedPathChar.
+ */
+static BOOLEAN fsp_fuse_intf_GetDirInfoPath(FSP_FSCTL_DIR_INFO *DirInfo,
+    char *PosixPath, char *PosixName, char **PPosixPathEnd, char *PSavedPathChar)
+{
+    char *PosixPathEnd;
+    ULONG SizeA, SizeW;
+
+    SizeW = (DirInfo->Size - sizeof *DirInfo) / sizeof(WCHAR);
+
+    if (1 == SizeW && L'.' == DirInfo->FileNameBuf[0])
+    {
+        PosixPathEnd = 1 < PosixName - PosixPath ? PosixName - 1 : PosixName;
+        *PSavedPathChar = *PosixPathEnd;
+        *PosixPathEnd = '\0';
+    }
+    else
+    if (2 == SizeW && L'.' == DirInfo->FileNameBuf[0] && L'.' == DirInfo->FileNameBuf[1])
+    {
+        PosixPathEnd = 1 < PosixName - PosixPath ? PosixName - 2 : PosixName;
+        while (PosixPath < PosixPathEnd && '/' != *PosixPathEnd)
+            PosixPathEnd--;
+        if (PosixPath == PosixPathEnd)
+            PosixPathEnd++;
+        *PSavedPathChar = *PosixPathEnd;
+        *PosixPathEnd = '\0';
+    }
+    else
+    {
+        PosixPathEnd = 0;
+        SizeA = WideCharToMultiByte(CP_UTF8, 0, DirInfo->FileNameBuf, SizeW, PosixName, 255 * 4, 0, 0);
+        if (0 == SizeA)
+            /* this should never happen because we just converted using MultiByteToWideChar */
+            return FALSE;
+        PosixName[SizeA] = '\0';
+    }
+
+    *PPosixPathEnd = PosixPathEnd;
+
+    return TRUE;
+}
+
+static VOID fsp_fuse_intf_FixDirInfoBatch(FSP_FILE_SYSTEM *FileSystem,
+    struct fsp_fuse_file_desc *filedesc, PUINT8 Buffer, PULONG Index, ULONG Count)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct
+    {
+        const char *Names[FSP_FUSE_FIXDIRINFO_BATCH];
+        struct fuse_stat *Stbufs[FSP_FUSE_FIXDIRINFO_BATCH];
+        int Results[FSP_FUSE_FIXDIRINFO_BATCH];
+        ULONG Slots[FSP_FUSE_FIXDIRINFO_BATCH];
+        struct fuse_stat_ex StbufBuf[FSP_FUSE_FIXDIRINFO_BATCH];
+        char NameBuf[FSP_FUSE_FIXDIRINFO_BATCH][255 * 4 + 1];
+    } *Batch = 0;
+    char *PosixPath = 0, *PosixName, *PosixPathEnd, SavedPathChar;
+    FSP_FSCTL_DIR_INFO *DirInfo;
+    ULONG I, J, N;
+    UINT32 Uid, Gid, Mode;
+    NTSTATUS Result;
+    int err;
+
+    Batch = MemAlloc(sizeof *Batch);
+    if (0 == Batch)
+        goto exit;
+
+    PosixPath = fsp_fuse_intf_NewDirInfoPath(filedesc->Node->PosixPath, &PosixName);
+    if (0 == PosixPath)
+        goto exit;
+
+    for (I = 0; Count > I;)
+    {
+        for (N = 0; Count > I && FSP_FUSE_FIXDIRINFO_BATCH > N; I++)
+        {
+            if (FspFileSystemDirectoryBufferEntryInvalid == Index[I])
+                continue;
+
+            DirInfo = (FSP_FSCTL_DIR_INFO *)(Buffer + Index[I]);
+            if (DirInfo->Padding[0])
+                continue;
+
+            /* the dot entries are left to the per entry path */
+            if (!fsp_fuse_intf_GetDirInfoPath(DirInfo,
+                PosixPath, PosixName, &PosixPathEnd, &SavedPathChar))
+                continue;
+            if (0 != PosixPathEnd)
+            {
+                *PosixPathEnd = SavedPathChar;
+                continue;
+            }
+
+            memcpy(Batch->NameBuf[N], PosixName, lstrlenA(PosixName) + 1);
+            Batch->Names[N] = Batch->NameBuf[N];
+            Batch->Stbufs[N] = (struct fuse_stat *)&Batch->StbufBuf[N];
+            Batch->Results[N] = 1; /* not answered */
+            Batch->Slots[N] = I;
+            memset(&Batch->StbufBuf[N], 0, sizeof Batch->StbufBuf[N]);
+            N++;
+        }
+
+        if (0 == N)
+            break;
+
+        err = f->ops.getattr_batch(filedesc->Node->PosixPath, N,
+            Batch->Names, Batch->Stbufs, Batch->Results);
+        if (0 != err)
+            /* fall back to getattr for the remaining entries */
+            break;
+
+        /* failed entries are retried (and reported) by the per entry path */
+        for (J = 0; N > J; J++)
+        {
+            if (0 != Batch->Results[J])
+                continue;
+
+            DirInfo = (FSP_FSCTL_DIR_INFO *)(Buffer + Index[Batch->Slots[J]]);
+            memcpy(PosixName, Batch->Names[J], lstrlenA(Batch->Names[J]) + 1);
+            Result = fsp_fuse_intf_GetFileInfoFunnel(FileSystem, PosixPath, PosixPath, 0,
+                Batch->Stbufs[J], &Uid, &Gid, &Mode, 0, TRUE, &DirInfo->FileInfo);
+            if (NT_SUCCESS(Result))
+                DirInfo->Padding[0] = 1;
+        }
+    }
+
+exit:
+    fsp_fuse_arena_free(PosixPath);
+    MemFree(Batch);
+}
+
+struct fsp_fuse_fixdirinfo_work
+{
+    FSP_FILE_SYSTEM *FileSystem;
+    struct fuse_context context;
+    const char *DirPath;
+    PUINT8 Buffer;
+    PULONG Index;
+    ULONG Count;
+    volatile LONG Next;
+    volatile LONG Pending;
+    HANDLE Event;
+};
+
+static VOID fsp_fuse_intf_FixDirInfoWork(struct fsp_fuse_fixdirinfo_work *Work)
+{
+    FSP_FILE_SYSTEM *FileSystem = Work->FileSystem;
+    char *PosixPath, *PosixName, *PosixPathEnd, SavedPathChar;
+    FSP_FSCTL_DIR_INFO *DirInfo;
+    ULONG I;
+    UINT32 Uid, Gid, Mode;
+    NTSTATUS Result;
+
+    PosixPath = fsp_fuse_intf_NewDirInfoPath(Work->DirPath, &PosixName);
+    if (0 == PosixPath)
+        return;
+
+    while (Work->Count > (I = (ULONG)InterlockedIncrement(&Work->Next) - 1))
+    {
+        if (FspFileSystemDirectoryBufferEntryInvalid == Work->Index[I])
+            continue;
+
+        DirInfo = (FSP_FSCTL_DIR_INFO *)(Work->Buffer + Work->Index[I]);
+        if (DirInfo->Padding[0])
+            continue;
+
+        if (!fsp_fuse_intf_GetDirInfoPath(DirInfo,
+            PosixPath, PosixName, &PosixPathEnd, &SavedPathChar))
+            continue;
+
+        /* failed entries are retried (and reported) by the per entry path */
+        Result = fsp_fuse_intf_GetFileInfoEx(FileSystem, PosixPath, 0,
+            &Uid, &Gid, &Mode, &DirInfo->FileInfo);
+        if (NT_SUCCESS(Result))
+            DirInfo->Padding[0] = 1;
+
+        if (0 != PosixPathEnd)
+            *PosixPathEnd = SavedPathChar;
+    }
+
+    fsp_fuse_arena_free(PosixPath);
+}
+
+static VOID CALLBACK fsp_fuse_intf_FixDirInfoCallback(
+    PTP_CALLBACK_INSTANCE Instance, PVOID Context)
+{
+    struct fsp_fuse_fixdirinfo_work *Work = Context;
+    struct fuse *f = Work->FileSystem->UserContext;
+    struct fuse_context *context;
+
+    context = fsp_fuse_get_context(f->env);
+    if (0 != context)
+    {
+        /* getattr runs on behalf of the readdir caller */
+        context->fuse = Work->context.fuse;
+        context->private_data = Work->context.private_data;
+        context->uid = Work->context.uid;
+        context->gid = Work->context.gid;
+        context->pid = Work->context.pid;
+
+        fsp_fuse_intf_FixDirInfoWork(Work);
+
+        context->fuse = 0;
+        context->private_data = 0;
+        context->uid = -1;
+        context->gid = -1;
+        context->pid = -1;
+    }
+
+    if (0 == InterlockedDecrement(&Work->Pending))
+        SetEvent(Work->Event);
+}
+
+static VOID fsp_fuse_intf_FixDirInfoParallel(FSP_FILE_SYSTEM *FileSystem,
+    struct fsp_fuse_file_desc *filedesc, PUINT8 Buffer, PULONG Index, ULONG Count)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fuse_context *context = fsp_fuse_get_context_internal();
+    struct fsp_fuse_fixdirinfo_work Work;
+    ULONG WorkerCount;
+
+    memset(&Work, 0, sizeof Work);
+    Work.FileSystem = FileSystem;
+    if (0 != context && f == context->fuse)
+        memcpy(&Work.context, context, sizeof *context);
+    else
+    {
+        Work.context.fuse = f;
+        Work.context.private_data = f->data;
+        Work.context.uid = -1;
+        Work.context.gid = -1;
+        Work.context.pid = -1;
+    }
+    Work.DirPath = filedesc->Node->PosixPath;
+    Work.Buffer = Buffer;
+    Work.Index = Index;
+    Work.Count = Count;
+    Work.Event = CreateEventW(0, TRUE, FALSE, 0);
+    if (0 == Work.Event)
+        return;
+
+    /* the calling thread is a worker too */
+    WorkerCount = Count / FSP_FUSE_FIXDIRINFO_PARALLEL - 1;
+    if (WorkerCount > f->ReaddirGetattrThreads)
+        WorkerCount = f->ReaddirGetattrThreads;
+
+    Work.Pending = 1 + WorkerCount;
+    for (ULONG I = 0; WorkerCount > I; I++)
+        if (!TrySubmitThreadpoolCallback(fsp_fuse_intf_FixDirInfoCallback, &Work,
+            &f->ReaddirGetattrEnviron))
+            InterlockedDecrement(&Work.Pending);
+
+    fsp_fuse_intf_FixDirInfoWork(&Work);
+
+    if (0 != InterlockedDecrement(&Work.Pending))
+        WaitForSingleObject(Work.Event, INFINITE);
+
+    CloseHandle(Work.Event);
+}
+
 static NTSTATUS fsp_fuse_intf_FixDirInfo(FSP_FILE_SYSTEM *FileSystem,
     struct fsp_fuse_file_desc *filedesc)
 {
+    struct fuse *f = FileSystem->UserContext;
     char *PosixPath = 0, *PosixName, *PosixPathEnd, SavedPathChar;
-    ULONG SizeA, SizeW;
+    ULONG SizeW;
     PUINT8 Buffer;
     PULONG Index, IndexEnd;
     ULONG Count;
@@ -2041,25 +3439,25 @@ static NTSTATUS fsp_fuse_intf_FixDirInfo(FSP_FILE_SYSTEM *FileSystem,
     UINT32 Uid, Gid, Mode;
     NTSTATUS Result;
 
-    SizeA = lstrlenA(filedesc->PosixPath);
-    PosixPath = MemAlloc(SizeA + 1 + 255 * 4 + 1);
+    PosixPath = fsp_fuse_intf_NewDirInfoPath(filedesc->Node->PosixPath, &PosixName);
     if (0 == PosixPath)
     {
         Result = STATUS_INSUFFICIENT_RESOURCES;
         goto exit;
     }
 
-    memcpy(PosixPath, filedesc->PosixPath, SizeA);
-    if (1 < SizeA)
-        /* if not root */
-        PosixPath[SizeA++] = '/';
-    PosixPath[SizeA] = '\0';
-    PosixName = PosixPath + SizeA;
-
     FspFileSystemPeekInDirectoryBuffer(&filedesc->DirBuffer, &Buffer, &Index, &Count);
 
+    if (0 != f->ops.getattr_batch)
+        fsp_fuse_intf_FixDirInfoBatch(FileSystem, filedesc, Buffer, Index, Count);
+    else if (0 != f->ReaddirGetattrPool && 2 * FSP_FUSE_FIXDIRINFO_PARALLEL <= Count)
+        fsp_fuse_intf_FixDirInfoParallel(FileSystem, filedesc, Buffer, Index, Count);
+
     for (IndexEnd = Index + Count; IndexEnd > Index; Index++)
     {
+        if (FspFileSystemDirectoryBufferEntryInvalid == *Index)
+            continue;
+
         DirInfo = (FSP_FSCTL_DIR_INFO *)(Buffer + *Index);
         SizeW = (DirInfo->Size - sizeof *DirInfo) / sizeof(WCHAR);
 
@@ -2071,34 +3469,11 @@ static NTSTATUS fsp_fuse_intf_FixDirInfo(FSP_FILE_SYSTEM *FileSystem,
         }
         else
         {
-            if (1 == SizeW && L'.' == DirInfo->FileNameBuf[0])
-            {
-                PosixPathEnd = 1 < PosixName - PosixPath ? PosixName - 1 : PosixName;
-                SavedPathChar = *PosixPathEnd;
-                *PosixPathEnd = '\0';
-            }
-            else
-            if (2 == SizeW && L'.' == DirInfo->FileNameBuf[0] && L'.' == DirInfo->FileNameBuf[1])
-            {
-                PosixPathEnd = 1 < PosixName - PosixPath ? PosixName - 2 : PosixName;
-                while (PosixPath < PosixPathEnd && '/' != *PosixPathEnd)
-                    PosixPathEnd--;
-                if (PosixPath == PosixPathEnd)
-                    PosixPathEnd++;
-                SavedPathChar = *PosixPathEnd;
-                *PosixPathEnd = '\0';
-            }
-            else
+            if (!fsp_fuse_intf_GetDirInfoPath(DirInfo,
+                PosixPath, PosixName, &PosixPathEnd, &SavedPathChar))
             {
-                PosixPathEnd = 0;
-                SizeA = WideCharToMultiByte(CP_UTF8, 0, DirInfo->FileNameBuf, SizeW, PosixName, 255 * 4, 0, 0);
-                if (0 == SizeA)
-                {
-                    /* this should never happen because we just converted using MultiByteToWideChar */
-                    Result = STATUS_OBJECT_NAME_INVALID;
-                    goto exit;
-                }
-                PosixName[SizeA] = '\0';
+                Result = STATUS_OBJECT_NAME_INVALID;
+                goto exit;
             }
 
             Result = fsp_fuse_intf_GetFileInfoEx(FileSystem, PosixPath, 0,
@@ -2107,7 +3482,7 @@ static NTSTATUS fsp_fuse_intf_FixDirInfo(FSP_FILE_SYSTEM *FileSystem,
             {
                 /* mark the directory buffer entry as invalid */
                 *Index = FspFileSystemDirectoryBufferEntryInvalid;
-                fsp_fuse_intf_LogBadDirInfo(filedesc->PosixPath, PosixName,
+                fsp_fuse_intf_LogBadDirInfo(filedesc->Node->PosixPath, PosixName,
                     "getattr failed");
             }
 
@@ -2121,7 +3496,89 @@ static NTSTATUS fsp_fuse_intf_FixDirInfo(FSP_FILE_SYSTEM *FileSystem,
     Result = STATUS_SUCCESS;
 
 exit:
-    MemFree(PosixPath);
+    fsp_fuse_arena_free(PosixPath);
+
+    return Result;
+}
+
+static NTSTATUS fsp_fuse_intf_ReadDirectoryResult(struct fsp_fuse_async *Async, int err,
+    PULONG PBytesTransferred)
+{
+    FSP_FILE_SYSTEM *FileSystem = Async->FileSystem;
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_file_desc *filedesc = Async->filedesc;
+    struct fuse_dirhandle *dh = &Async->dh;
+    FSP_FSCTL_DIR_INFO *DirInfo;
+    PUINT8 P, EndP;
+    NTSTATUS Result;
+
+    Result = fsp_fuse_ntstatus_from_errno(f->env, err);
+    if (NT_SUCCESS(Result))
+        Result = dh->Result;
+
+    /* fill the directory buffer on this thread; its lock may not cross threads */
+    if (NT_SUCCESS(Result) &&
+        FspFileSystemAcquireDirectoryBuffer(&filedesc->DirBuffer, TRUE, &Result))
+    {
+        for (P = dh->AsyncBuffer, EndP = P + dh->AsyncSize; EndP > P;
+            P += FSP_FSCTL_DEFAULT_ALIGN_UP(DirInfo->Size))
+        {
+            DirInfo = (FSP_FSCTL_DIR_INFO *)P;
+            if (!FspFileSystemFillDirectoryBuffer(&filedesc->DirBuffer, DirInfo, &Result))
+                break;
+        }
+
+        if (NT_SUCCESS(Result))
+            Result = fsp_fuse_intf_FixDirInfo(FileSystem, filedesc);
+
+        FspFileSystemReleaseDirectoryBuffer(&filedesc->DirBuffer);
+    }
+
+    if (NT_SUCCESS(Result))
+        FspFileSystemReadDirectoryBuffer(&filedesc->DirBuffer,
+            0, Async->Buffer, Async->Length, PBytesTransferred);
+
+    MemFree(dh->AsyncBuffer);
+    dh->AsyncBuffer = 0;
+
+    return Result;
+}
+
+static NTSTATUS fsp_fuse_intf_ReadDirectoryAsync(FSP_FILE_SYSTEM *FileSystem,
+    struct fsp_fuse_file_desc *filedesc,
+    PVOID Buffer, ULONG Length, PULONG PBytesTransferred)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_async *Async;
+    struct fuse_file_info fi;
+    int err;
+    NTSTATUS Result;
+
+    Async = MemAlloc(sizeof *Async);
+    if (0 == Async)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    memset(Async, 0, sizeof *Async);
+    Async->Buffer = Buffer;
+    Async->Length = Length;
+    Async->dh.filedesc = filedesc;
+    Async->dh.FileSystem = FileSystem;
+    Async->dh.ReaddirPlus = 0 != (f->conn_want & FSP_FUSE_CAP_READDIR_PLUS);
+    Async->dh.Result = STATUS_SUCCESS;
+    Async->dh.Async = TRUE;
+
+    memset(&fi, 0, sizeof fi);
+    fi.flags = filedesc->OpenFlags;
+    fi.fh = filedesc->FileHandle;
+
+    fsp_fuse_intf_AsyncEnter(FileSystem, FspFsctlTransactQueryDirectoryKind, filedesc, Async);
+    err = f->ops.readdir(fsp_fuse_intf_HandlePath(f, filedesc),
+        &Async->dh, fsp_fuse_intf_AddDirInfo, 0, &fi);
+    if (fsp_fuse_intf_AsyncLeave())
+        return STATUS_PENDING;
+
+    Result = fsp_fuse_intf_ReadDirectoryResult(Async, err, PBytesTransferred);
+    MemFree(Async);
 
     return Result;
 }
@@ -2140,6 +3597,11 @@ static NTSTATUS fsp_fuse_intf_ReadDirectory(FSP_FILE_SYSTEM *FileSystem,
     if (!filedesc->IsDirectory || filedesc->IsReparsePoint)
         return STATUS_ACCESS_DENIED;
 
+    /* only a fresh listing (no Marker) fills the directory buffer; others are served from it */
+    if (0 != (f->conn_want & FSP_FUSE_CAP_ASYNC) && 0 != f->ops.readdir && 0 == Marker)
+        return fsp_fuse_intf_ReadDirectoryAsync(FileSystem, filedesc,
+            Buffer, Length, PBytesTransferred);
+
     if (FspFileSystemAcquireDirectoryBuffer(&filedesc->DirBuffer, 0 == Marker, &Result))
     {
         memset(&dh, 0, sizeof dh);
@@ -2154,12 +3616,13 @@ static NTSTATUS fsp_fuse_intf_ReadDirectory(FSP_FILE_SYSTEM *FileSystem,
             fi.flags = filedesc->OpenFlags;
             fi.fh = filedesc->FileHandle;
 
-            err = f->ops.readdir(filedesc->PosixPath, &dh, fsp_fuse_intf_AddDirInfo, 0, &fi);
+            err = f->ops.readdir(fsp_fuse_intf_HandlePath(f, filedesc),
+                &dh, fsp_fuse_intf_AddDirInfo, 0, &fi);
             Result = fsp_fuse_ntstatus_from_errno(f->env, err);
         }
         else if (0 != f->ops.getdir)
         {
-            err = f->ops.getdir(filedesc->PosixPath, &dh, fsp_fuse_intf_AddDirInfoOld);
+            err = f->ops.getdir(filedesc->Node->PosixPath, &dh, fsp_fuse_intf_AddDirInfoOld);
             Result = fsp_fuse_ntstatus_from_errno(f->env, err);
         }
         else
@@ -2184,6 +3647,81 @@ static NTSTATUS fsp_fuse_intf_ReadDirectory(FSP_FILE_SYSTEM *FileSystem,
     return STATUS_SUCCESS;
 }
 
+FSP_FUSE_API struct fuse_async *fsp_fuse_async_begin(struct fsp_fuse_env *env)
+{
+    struct fuse_context *context = fsp_fuse_get_context_internal();
+    struct fsp_fuse_context_header *contexthdr;
+    struct fsp_fuse_async *Async;
+
+    if (0 == context)
+        return 0;
+
+    contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
+    if (0 == contexthdr->Async || contexthdr->AsyncBegun)
+        return 0;
+
+    Async = contexthdr->Async;
+    if (FspFsctlTransactQueryDirectoryKind != Async->Kind)
+    {
+        /* Read/Write state lives on the dispatcher stack */
+        Async = MemAlloc(sizeof *Async);
+        if (0 == Async)
+            return 0;
+        memcpy(Async, contexthdr->Async, sizeof *Async);
+        contexthdr->Async = Async;
+    }
+    contexthdr->AsyncBegun = TRUE;
+
+    return (struct fuse_async *)Async;
+}
+
+FSP_FUSE_API void fsp_fuse_async_end(struct fsp_fuse_env *env,
+    struct fuse_async *async, int result)
+{
+    struct fsp_fuse_async *Async = (struct fsp_fuse_async *)async;
+    FSP_FILE_SYSTEM *FileSystem = Async->FileSystem;
+    struct fuse *f = FileSystem->UserContext;
+    struct fuse_context *context, SavedContext;
+    FSP_FSCTL_TRANSACT_RSP Response;
+    ULONG BytesTransferred = 0;
+
+    /* complete the operation in the context of the original caller */
+    context = fsp_fuse_get_context(f->env);
+    if (0 != context)
+    {
+        memcpy(&SavedContext, context, sizeof *context);
+        memcpy(context, &Async->context, sizeof *context);
+    }
+
+    memset(&Response, 0, sizeof Response);
+    Response.Size = sizeof Response;
+    Response.Kind = Async->Kind;
+    Response.Hint = Async->Hint;
+    switch (Async->Kind)
+    {
+    case FspFsctlTransactReadKind:
+        Response.IoStatus.Status = fsp_fuse_intf_ReadResult(f, result, &BytesTransferred);
+        break;
+    case FspFsctlTransactWriteKind:
+        Response.IoStatus.Status = fsp_fuse_intf_WriteResult(f, Async->filedesc,
+            Async->Offset, Async->Generation, &Async->FileInfo, result,
+            &BytesTransferred, &Response.Rsp.Write.FileInfo);
+        break;
+    case FspFsctlTransactQueryDirectoryKind:
+        Response.IoStatus.Status = fsp_fuse_intf_ReadDirectoryResult(Async, result,
+            &BytesTransferred);
+        break;
+    }
+    Response.IoStatus.Information = BytesTransferred;
+
+    if (0 != context)
+        memcpy(context, &SavedContext, sizeof *context);
+
+    MemFree(Async);
+
+    FspFileSystemSendResponse(FileSystem, &Response);
+}
+
 static NTSTATUS fsp_fuse_intf_GetDirInfoByName(FSP_FILE_SYSTEM *FileSystem,
     PVOID FileDesc, PWSTR FileName,
     FSP_FSCTL_DIR_INFO *DirInfo)
@@ -2203,14 +3741,14 @@ static NTSTATUS fsp_fuse_intf_GetDirInfoByName(FSP_FILE_SYSTEM *FileSystem,
     if (!filedesc->IsDirectory || filedesc->IsReparsePoint)
         return STATUS_ACCESS_DENIED;
 
-    Result = FspPosixMapWindowsToPosixPath(FileName, &PosixName);
+    Result = fsp_fuse_intf_ArenaPosixPath(FileName, &PosixName);
     if (!NT_SUCCESS(Result))
     {
         Result = STATUS_OBJECT_NAME_NOT_FOUND; //Result?
         goto exit;
     }
 
-    ParentLength = lstrlenA(filedesc->PosixPath);
+    ParentLength = lstrlenA(filedesc->Node->PosixPath);
     FSlashLength = 1 < ParentLength;
     PosixNameLength = lstrlenA(PosixName);
     if (FSP_FSCTL_TRANSACT_PATH_SIZEMAX <= (ParentLength + FSlashLength + PosixNameLength) * sizeof(WCHAR))
@@ -2219,7 +3757,7 @@ static NTSTATUS fsp_fuse_intf_GetDirInfoByName(FSP_FILE_SYSTEM *FileSystem,
         goto exit;
     }
 
-    memcpy(PosixPath, filedesc->PosixPath, ParentLength);
+    memcpy(PosixPath, filedesc->Node->PosixPath, ParentLength);
     memcpy(PosixPath + ParentLength, "/", FSlashLength);
     memcpy(PosixPath + ParentLength + FSlashLength, PosixName, PosixNameLength + 1);
 
@@ -2263,7 +3801,7 @@ static NTSTATUS fsp_fuse_intf_GetDirInfoByName(FSP_FILE_SYSTEM *FileSystem,
 
 exit:
     if (0 != PosixName)
-        FspPosixDeletePath(PosixName);
+        fsp_fuse_arena_free(PosixName);
 
     return Result;
 }
@@ -2285,7 +3823,7 @@ static NTSTATUS fsp_fuse_intf_GetReparsePointByName(
     char *PosixPath = 0;
     NTSTATUS Result;
 
-    Result = FspPosixMapWindowsToPosixPath(FileName, &PosixPath);
+    Result = fsp_fuse_intf_ArenaPosixPath(FileName, &PosixPath);
     if (!NT_SUCCESS(Result))
         goto exit;
 
@@ -2293,7 +3831,7 @@ static NTSTATUS fsp_fuse_intf_GetReparsePointByName(
 
 exit:
     if (0 != PosixPath)
-        FspPosixDeletePath(PosixPath);
+        fsp_fuse_arena_free(PosixPath);
 
     return Result;
 }
@@ -2309,7 +3847,7 @@ static NTSTATUS fsp_fuse_intf_GetReparsePoint(FSP_FILE_SYSTEM *FileSystem,
     fi.flags = filedesc->OpenFlags;
     fi.fh = filedesc->FileHandle;
 
-    return fsp_fuse_intf_GetReparsePointEx(FileSystem, filedesc->PosixPath,
+    return fsp_fuse_intf_GetReparsePointEx(FileSystem, filedesc->Node->PosixPath,
         FUSE_FILE_INFO(filedesc->IsDirectory, &fi),
         Buffer, PSize, 0);
 }
@@ -2380,7 +3918,7 @@ static NTSTATUS fsp_fuse_intf_SetReparsePoint(FSP_FILE_SYSTEM *FileSystem,
     fi.flags = filedesc->OpenFlags;
     fi.fh = filedesc->FileHandle;
 
-    Result = fsp_fuse_intf_GetFileInfoEx(FileSystem, filedesc->PosixPath,
+    Result = fsp_fuse_intf_GetFileInfoEx(FileSystem, filedesc->Node->PosixPath,
         FUSE_FILE_INFO(filedesc->IsDirectory, &fi),
         &Uid, &Gid, &Mode, &FileInfo);
     if (!NT_SUCCESS(Result))
@@ -2427,7 +3965,8 @@ static NTSTATUS fsp_fuse_intf_SetReparsePoint(FSP_FILE_SYSTEM *FileSystem,
         if (!NT_SUCCESS(Result))
             goto exit;
 
-        Result = fsp_fuse_intf_NewHiddenName(FileSystem, filedesc->PosixPath, &PosixHiddenPath);
+        Result = fsp_fuse_intf_NewHiddenName(FileSystem,
+            filedesc->Node->PosixPath, &PosixHiddenPath);
         if (!NT_SUCCESS(Result))
             goto exit;
 
@@ -2472,7 +4011,8 @@ static NTSTATUS fsp_fuse_intf_SetReparsePoint(FSP_FILE_SYSTEM *FileSystem,
          * From this point forward we must jump to the EXIT label on failure.
          */
 
-        Result = fsp_fuse_intf_NewHiddenName(FileSystem, filedesc->PosixPath, &PosixHiddenPath);
+        Result = fsp_fuse_intf_NewHiddenName(FileSystem,
+            filedesc->Node->PosixPath, &PosixHiddenPath);
         if (!NT_SUCCESS(Result))
             goto exit;
 
@@ -2488,12 +4028,12 @@ static NTSTATUS fsp_fuse_intf_SetReparsePoint(FSP_FILE_SYSTEM *FileSystem,
 
     if (filedesc->IsDirectory)
     {
-        err = f->ops.rmdir(filedesc->PosixPath);
+        err = f->ops.rmdir(filedesc->Node->PosixPath);
         if (0 == err)
-            err = f->ops.rename(PosixHiddenPath, filedesc->PosixPath);
+            err = f->ops.rename(PosixHiddenPath, filedesc->Node->PosixPath);
     }
     else
-        err = f->ops.rename(PosixHiddenPath, filedesc->PosixPath);
+        err = f->ops.rename(PosixHiddenPath, filedesc->Node->PosixPath);
     if (0 != err)
     {
         f->ops.unlink(PosixHiddenPath);
@@ -2504,12 +4044,12 @@ static NTSTATUS fsp_fuse_intf_SetReparsePoint(FSP_FILE_SYSTEM *FileSystem,
     if (filedesc->IsDirectory)
     {
         if (0 != f->ops.releasedir)
-            f->ops.releasedir(filedesc->PosixPath, &fi);
+            f->ops.releasedir(fsp_fuse_intf_HandlePath(f, filedesc), &fi);
     }
     else
     {
         if (0 != f->ops.release)
-            f->ops.release(filedesc->PosixPath, &fi);
+            f->ops.release(fsp_fuse_intf_HandlePath(f, filedesc), &fi);
     }
     filedesc->IsReparsePoint = TRUE;
     filedesc->FileHandle = -1;
@@ -2517,6 +4057,8 @@ static NTSTATUS fsp_fuse_intf_SetReparsePoint(FSP_FILE_SYSTEM *FileSystem,
     Result = STATUS_SUCCESS;
 
 exit:
+    fsp_fuse_intf_InvalidateFileInfo(f);
+
     MemFree(PosixHiddenPath);
 
     if (0 != PosixTargetPath)
@@ -2562,13 +4104,13 @@ static NTSTATUS fsp_fuse_intf_Control(FSP_FILE_SYSTEM *FileSystem,
     cmd = FSP_FUSE_IOCTL((ControlCode >> 2) & 0xfff, InputBufferLength, OutputBufferLength);
 
     if (0 == OutputBufferLength)
-        err = f->ops.ioctl(filedesc->PosixPath, cmd, 0, &fi, 0, InputBuffer);
+        err = f->ops.ioctl(fsp_fuse_intf_HandlePath(f, filedesc), cmd, 0, &fi, 0, InputBuffer);
     else
     {
         if (0 != InputBufferLength)
             // OutputBuffer points to Response->Buffer which is FSP_FSCTL_TRANSACT_RSP_BUFFER_SIZEMAX long
             memcpy(OutputBuffer, InputBuffer, InputBufferLength);
-        err = f->ops.ioctl(filedesc->PosixPath, cmd, 0, &fi, 0, OutputBuffer);
+        err = f->ops.ioctl(fsp_fuse_intf_HandlePath(f, filedesc), cmd, 0, &fi, 0, OutputBuffer);
     }
     *PBytesTransferred = OutputBufferLength;
 
@@ -2589,7 +4131,7 @@ static NTSTATUS fsp_fuse_intf_GetEa(FSP_FILE_SYSTEM *FileSystem,
     if (0 == f->ops.listxattr || 0 == f->ops.getxattr)
         return STATUS_INVALID_DEVICE_REQUEST;
 
-    namesize = f->ops.listxattr(filedesc->PosixPath, names, sizeof names);
+    namesize = f->ops.listxattr(filedesc->Node->PosixPath, names, sizeof names);
     if (0 >= namesize)
     {
         *PBytesTransferred = 0;
@@ -2605,7 +4147,7 @@ static NTSTATUS fsp_fuse_intf_GetEa(FSP_FILE_SYSTEM *FileSystem,
             /* if there is no space (at least 1 byte) for a value bail out */
             break;
 
-        valuesize = f->ops.getxattr(filedesc->PosixPath, p, EaValue, EaEnd - EaValue);
+        valuesize = f->ops.getxattr(filedesc->Node->PosixPath, p, EaValue, EaEnd - EaValue);
         if (0 >= valuesize)
             continue;
 
@@ -2666,7 +4208,7 @@ static NTSTATUS fsp_fuse_intf_SetEa(FSP_FILE_SYSTEM *FileSystem,
         return STATUS_INVALID_DEVICE_REQUEST;
 
     Result = FspFileSystemEnumerateEa(FileSystem,
-        fsp_fuse_intf_SetEaEntry, filedesc->PosixPath, Ea, EaLength);
+        fsp_fuse_intf_SetEaEntry, filedesc->Node->PosixPath, Ea, EaLength);
     if (!NT_SUCCESS(Result))
         return Result;
 
@@ -2674,7 +4216,7 @@ static NTSTATUS fsp_fuse_intf_SetEa(FSP_FILE_SYSTEM *FileSystem,
     fi.flags = filedesc->OpenFlags;
     fi.fh = filedesc->FileHandle;
 
-    return fsp_fuse_intf_GetFileInfoEx(FileSystem, filedesc->PosixPath,
+    return fsp_fuse_intf_GetFileInfoEx(FileSystem, filedesc->Node->PosixPath,
         FUSE_FILE_INFO(filedesc->IsDirectory, &fi),
         &Uid, &Gid, &Mode, FileInfo);
 }
@@ -57,6 +57,13 @@ static NTSTATUS fsp_fuse_loop_start(struct fuse *f)
     struct fuse_conn_info conn;
     NTSTATUS Result;
 
+    if (f->lowlevel && 0 == f->MountPoint)
+    {
+        /* fuse_session_add_chan was not called or has failed */
+        Result = STATUS_INVALID_PARAMETER;
+        goto fail;
+    }
+
     f->LoopEvent = CreateEventW(0, TRUE, FALSE, 0);
     if (0 == f->LoopEvent)
         goto fail;
@@ -89,10 +96,14 @@ static NTSTATUS fsp_fuse_loop_start(struct fuse *f)
         FSP_FUSE_CAP_READ_ONLY |
         FSP_FUSE_CAP_STAT_EX |
         FSP_FUSE_CAP_DELETE_ACCESS |
+        FSP_FUSE_CAP_ASYNC |
         FSP_FUSE_CAP_CASE_INSENSITIVE;
-    if (0 != f->ops.init)
+    if (0 != f->ops.init || f->lowlevel)
     {
-        context->private_data = f->data = f->ops.init(&conn);
+        if (!f->lowlevel)
+            context->private_data = f->data = f->ops.init(&conn);
+        else if (0 != f->llops.init)
+            f->llops.init(f->data, &conn);
         f->VolumeParams.ReadOnlyVolume = 0 != (conn.want & FSP_FUSE_CAP_READ_ONLY);
         f->VolumeParams.CaseSensitiveSearch = 0 == (conn.want & FSP_FUSE_CAP_CASE_INSENSITIVE);
         if (!f->VolumeParams.CaseSensitiveSearch && 0 == f->ops.getpath)
@@ -106,6 +117,13 @@ static NTSTATUS fsp_fuse_loop_start(struct fuse *f)
         f->conn_want = conn.want;
     }
     f->fsinit = TRUE;
+    if (f->lowlevel)
+    {
+        /* lowlevel sessions have no path based operations; probe using the root inode */
+        Result = fsp_fuse_ll_probe(f);
+        if (!NT_SUCCESS(Result))
+            goto fail;
+    }
     if (0 != f->ops.statfs)
     {
         struct fuse_statvfs stbuf;
@@ -221,7 +239,7 @@ static NTSTATUS fsp_fuse_loop_start(struct fuse *f)
     Result = FspFileSystemCreate(
         f->VolumeParams.Prefix[0] ?
             L"" FSP_FSCTL_NET_DEVICE_NAME : L"" FSP_FSCTL_DISK_DEVICE_NAME,
-        &f->VolumeParams, &fsp_fuse_intf,
+        &f->VolumeParams, f->lowlevel ? &fsp_fuse_ll_intf : &fsp_fuse_intf,
         &f->FileSystem);
     if (!NT_SUCCESS(Result))
     {
@@ -247,6 +265,19 @@ static NTSTATUS fsp_fuse_loop_start(struct fuse *f)
         }
     }
 
+    if (!f->lowlevel && 0 != f->ReaddirGetattrThreads &&
+        FSP_FILE_SYSTEM_OPERATION_GUARD_STRATEGY_COARSE != f->OpGuardStrategy)
+    {
+        /* on failure FixDirInfo calls getattr sequentially */
+        f->ReaddirGetattrPool = CreateThreadpool(0);
+        if (0 != f->ReaddirGetattrPool)
+        {
+            SetThreadpoolThreadMaximum(f->ReaddirGetattrPool, f->ReaddirGetattrThreads);
+            InitializeThreadpoolEnvironment(&f->ReaddirGetattrEnviron);
+            SetThreadpoolCallbackPool(&f->ReaddirGetattrEnviron, f->ReaddirGetattrPool);
+        }
+    }
+
     Result = FspFileSystemStartDispatcher(f->FileSystem, f->ThreadCount);
     if (!NT_SUCCESS(Result))
     {
@@ -267,6 +298,10 @@ static void fsp_fuse_loop_stop(struct fuse *f)
 {
     FspFileSystemStopDispatcher(f->FileSystem);
 
+    if (f->DebugLog)
+        FspDebugLog("%S: scratch arena: high water %ld of %ld bytes, %ld heap fallbacks\n",
+            FspDiagIdent(), f->ArenaHighWater, (LONG)FSP_FUSE_ARENA_SIZE, f->ArenaOverflowCount);
+
     fsp_fuse_loop_cleanup(f);
 }
 
@@ -278,9 +313,21 @@ static void fsp_fuse_loop_cleanup(struct fuse *f)
         f->FileSystem = 0;
     }
 
+    if (0 != f->ReaddirGetattrPool)
+    {
+        DestroyThreadpoolEnvironment(&f->ReaddirGetattrEnviron);
+        CloseThreadpool(f->ReaddirGetattrPool);
+        f->ReaddirGetattrPool = 0;
+    }
+
     if (f->fsinit)
     {
-        if (f->ops.destroy)
+        if (f->lowlevel)
+        {
+            if (0 != f->llops.destroy)
+                f->llops.destroy(f->data);
+        }
+        else if (f->ops.destroy)
             f->ops.destroy(f->data);
         f->fsinit = FALSE;
     }
@@ -340,7 +387,9 @@ FSP_FUSE_API int fsp_fuse_loop(struct fsp_fuse_env *env,
 FSP_FUSE_API int fsp_fuse_loop_mt(struct fsp_fuse_env *env,
     struct fuse *f)
 {
-    f->OpGuardStrategy = FSP_FILE_SYSTEM_OPERATION_GUARD_STRATEGY_FINE;
+    f->OpGuardStrategy = f->ShardedLocks ?
+        FSP_FILE_SYSTEM_OPERATION_GUARD_STRATEGY_SHARDED :
+        FSP_FILE_SYSTEM_OPERATION_GUARD_STRATEGY_FINE;
     return NT_SUCCESS(fsp_fuse_loop_internal(f)) ? 0 : -1;
 }
 
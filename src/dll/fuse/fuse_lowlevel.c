@@ -0,0 +1,1822 @@
+/**
+ * @file dll/fuse/fuse_lowlevel.c
+ *
+ * @copyright 2015-2026 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this software
+ * in accordance with the commercial license agreement provided in
+ * conjunction with the software.  The terms and conditions of any such
+ * commercial license agreement shall govern, supersede, and render
+ * ineffective any application of the GPLv3 license to this software,
+ * notwithstanding of any reference thereto in the software or
+ * associated repository.
+ */
+
+#include <dll/fuse/library.h>
+
+/*
+ * The FUSE lowlevel API names files by inode number and expects the file system to answer
+ * every request by calling one of the fuse_reply_* functions. The reply may come from any
+ * thread and at any time, even after the operation that issued the request has returned.
+ *
+ * Windows names files by path. We resolve a path by walking it with lookup one component at
+ * a time and forget intermediate inodes as soon as we are done with them. An open file keeps
+ * the lookup reference of its inode; it is forgotten when the file is closed. The root inode
+ * is never looked up and is therefore never forgotten.
+ *
+ * Read and Write are completed asynchronously: if the file system has not replied when the
+ * read or write operation returns, we return STATUS_PENDING and send the response to the FSD
+ * when the reply arrives. All other requests wait for their reply.
+ */
+
+#define FSP_FUSE_LL_REQ_INCALL          0
+#define FSP_FUSE_LL_REQ_WAITING         1
+#define FSP_FUSE_LL_REQ_PENDING         2
+#define FSP_FUSE_LL_REQ_REPLIED         3
+
+#define FSP_FUSE_LL_READDIR_SIZE        (64 * 1024)
+
+struct fuse_req
+{
+    struct fuse *f;
+    struct fuse_ctx ctx;
+    volatile LONG State;
+    HANDLE Event;
+    int err;
+    /* reply */
+    fuse_ino_t Ino;
+    struct fuse_stat_ex Attr;
+    struct fuse_file_info fi;
+    struct fuse_statvfs Statvfs;
+    PVOID Data;                         /* Read: caller buffer; otherwise: reply copy */
+    size_t DataSize, Count;
+    BOOLEAN DataIsBuffer;
+    /* asynchronous completion */
+    FSP_FSCTL_TRANSACT_KIND Kind;
+    UINT64 Hint;
+    struct fsp_fuse_file_desc *filedesc;
+    UINT64 Offset;
+    LONG Generation;
+    FSP_FSCTL_FILE_INFO FileInfo;
+};
+
+/* directory entries created by fuse_add_direntry{,_plus}; entries are 8 byte aligned */
+struct fsp_fuse_ll_dirent
+{
+    UINT32 Size;
+    UINT16 NameSize;
+    UINT16 Plus;
+    fuse_off_t NextOffset;
+    fuse_ino_t Ino;
+    struct fuse_stat_ex Attr;
+    char Name[];
+};
+
+static inline size_t fsp_fuse_ll_StatSize(struct fuse *f)
+{
+    return 0 != (f->conn_want & FSP_FUSE_CAP_STAT_EX) ?
+        sizeof(struct fuse_stat_ex) : sizeof(struct fuse_stat);
+}
+
+static VOID fsp_fuse_ll_InitReq(struct fuse *f, struct fuse_req *req)
+{
+    struct fuse_context *context = fsp_fuse_get_context_internal();
+
+    memset(req, 0, sizeof *req);
+    req->f = f;
+    req->ctx.uid = 0 != context ? context->uid : -1;
+    req->ctx.gid = 0 != context ? context->gid : -1;
+    req->ctx.pid = 0 != context ? context->pid : -1;
+    req->ctx.umask = 0 != context ? context->umask : 0;
+}
+
+static inline VOID fsp_fuse_ll_InitFileInfo(struct fuse_file_info *fi,
+    struct fsp_fuse_file_desc *filedesc)
+{
+    memset(fi, 0, sizeof *fi);
+    fi->flags = filedesc->OpenFlags;
+    fi->fh = filedesc->FileHandle;
+}
+
+static NTSTATUS fsp_fuse_ll_Wait(struct fuse_req *req)
+{
+    if (FSP_FUSE_LL_REQ_REPLIED != InterlockedCompareExchange(&req->State,
+        FSP_FUSE_LL_REQ_INCALL, FSP_FUSE_LL_REQ_INCALL))
+    {
+        /* the file system will reply from another thread */
+        req->Event = CreateEventW(0, TRUE, FALSE, 0);
+        if (0 != req->Event)
+        {
+            if (FSP_FUSE_LL_REQ_INCALL == InterlockedCompareExchange(&req->State,
+                FSP_FUSE_LL_REQ_WAITING, FSP_FUSE_LL_REQ_INCALL))
+                WaitForSingleObject(req->Event, INFINITE);
+            CloseHandle(req->Event);
+        }
+        else
+            while (FSP_FUSE_LL_REQ_REPLIED != InterlockedCompareExchange(&req->State,
+                FSP_FUSE_LL_REQ_INCALL, FSP_FUSE_LL_REQ_INCALL))
+                SwitchToThread();
+    }
+
+    return fsp_fuse_ntstatus_from_errno(req->f->env, req->err);
+}
+
+static NTSTATUS fsp_fuse_ll_ReadResult(struct fuse_req *req,
+    PULONG PBytesTransferred)
+{
+    if (0 != req->err)
+        return fsp_fuse_ntstatus_from_errno(req->f->env, req->err);
+
+    if (0 == req->Count)
+        return STATUS_END_OF_FILE;
+
+    *PBytesTransferred = (ULONG)req->Count;
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fsp_fuse_ll_WriteResult(struct fuse_req *req,
+    PULONG PBytesTransferred, FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    struct fuse *f = req->f;
+    UINT64 AllocationUnit;
+    BOOLEAN Extended;
+
+    if (0 != req->err)
+        return fsp_fuse_ntstatus_from_errno(f->env, req->err);
+
+    AllocationUnit = (UINT64)f->VolumeParams.SectorSize *
+        (UINT64)f->VolumeParams.SectorsPerAllocationUnit;
+    Extended = req->Offset + req->Count > req->FileInfo.FileSize;
+    if (Extended)
+        req->FileInfo.FileSize = req->Offset + req->Count;
+    req->FileInfo.AllocationSize =
+        (req->FileInfo.FileSize + AllocationUnit - 1) / AllocationUnit * AllocationUnit;
+
+    /* see fsp_fuse_intf_Write */
+    if (!Extended)
+        fsp_fuse_intf_SetCachedFileInfo(f, req->filedesc, req->Generation, &req->FileInfo);
+    else if (req->Generation + 1 == fsp_fuse_intf_InvalidateFileInfo(f))
+        fsp_fuse_intf_SetCachedFileInfo(f, req->filedesc, req->Generation + 1, &req->FileInfo);
+
+    *PBytesTransferred = (ULONG)req->Count;
+    memcpy(FileInfo, &req->FileInfo, sizeof req->FileInfo);
+
+    return STATUS_SUCCESS;
+}
+
+static VOID fsp_fuse_ll_SendResponse(struct fuse_req *req)
+{
+    FSP_FSCTL_TRANSACT_RSP Response;
+    ULONG BytesTransferred = 0;
+
+    memset(&Response, 0, sizeof Response);
+    Response.Size = sizeof Response;
+    Response.Kind = req->Kind;
+    Response.Hint = req->Hint;
+    if (FspFsctlTransactReadKind == req->Kind)
+        Response.IoStatus.Status = fsp_fuse_ll_ReadResult(req, &BytesTransferred);
+    else
+        Response.IoStatus.Status = fsp_fuse_ll_WriteResult(req, &BytesTransferred,
+            &Response.Rsp.Write.FileInfo);
+    Response.IoStatus.Information = BytesTransferred;
+    FspFileSystemSendResponse(req->f->FileSystem, &Response);
+
+    MemFree(req);
+}
+
+static NTSTATUS fsp_fuse_ll_Complete(struct fuse_req *req,
+    PULONG PBytesTransferred, FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    NTSTATUS Result;
+
+    if (FSP_FUSE_LL_REQ_INCALL == InterlockedCompareExchange(&req->State,
+        FSP_FUSE_LL_REQ_PENDING, FSP_FUSE_LL_REQ_INCALL))
+        /* the reply will send the response */
+        return STATUS_PENDING;
+
+    if (FspFsctlTransactReadKind == req->Kind)
+        Result = fsp_fuse_ll_ReadResult(req, PBytesTransferred);
+    else
+        Result = fsp_fuse_ll_WriteResult(req, PBytesTransferred, FileInfo);
+
+    MemFree(req);
+
+    return Result;
+}
+
+static int fsp_fuse_ll_Reply(struct fuse_req *req, int err)
+{
+    req->err = err;
+    switch (InterlockedExchange(&req->State, FSP_FUSE_LL_REQ_REPLIED))
+    {
+    case FSP_FUSE_LL_REQ_WAITING:
+        SetEvent(req->Event);
+        break;
+    case FSP_FUSE_LL_REQ_PENDING:
+        fsp_fuse_ll_SendResponse(req);
+        break;
+    }
+
+    return 0;
+}
+
+FSP_FUSE_API int fsp_fuse_reply_err(struct fsp_fuse_env *env,
+    fuse_req_t req, int err)
+{
+    return fsp_fuse_ll_Reply(req, err);
+}
+
+FSP_FUSE_API void fsp_fuse_reply_none(struct fsp_fuse_env *env,
+    fuse_req_t req)
+{
+    fsp_fuse_ll_Reply(req, 0);
+}
+
+FSP_FUSE_API int fsp_fuse_reply_entry(struct fsp_fuse_env *env,
+    fuse_req_t req, const struct fuse_entry_param *e)
+{
+    req->Ino = e->ino;
+    memcpy(&req->Attr, &e->attr, fsp_fuse_ll_StatSize(req->f));
+    return fsp_fuse_ll_Reply(req, 0);
+}
+
+FSP_FUSE_API int fsp_fuse_reply_create(struct fsp_fuse_env *env,
+    fuse_req_t req, const struct fuse_entry_param *e, const struct fuse_file_info *fi)
+{
+    if (&req->fi != fi)
+        memcpy(&req->fi, fi, sizeof *fi);
+    return fsp_fuse_reply_entry(env, req, e);
+}
+
+FSP_FUSE_API int fsp_fuse_reply_attr(struct fsp_fuse_env *env,
+    fuse_req_t req, const struct fuse_stat *attr, double attr_timeout)
+{
+    memcpy(&req->Attr, attr, fsp_fuse_ll_StatSize(req->f));
+    return fsp_fuse_ll_Reply(req, 0);
+}
+
+FSP_FUSE_API int fsp_fuse_reply_readlink(struct fsp_fuse_env *env,
+    fuse_req_t req, const char *link)
+{
+    return fsp_fuse_reply_buf(env, req, link, lstrlenA(link) + 1);
+}
+
+FSP_FUSE_API int fsp_fuse_reply_open(struct fsp_fuse_env *env,
+    fuse_req_t req, const struct fuse_file_info *fi)
+{
+    if (&req->fi != fi)
+        memcpy(&req->fi, fi, sizeof *fi);
+    return fsp_fuse_ll_Reply(req, 0);
+}
+
+FSP_FUSE_API int fsp_fuse_reply_write(struct fsp_fuse_env *env,
+    fuse_req_t req, size_t count)
+{
+    req->Count = req->DataSize >= count ? count : req->DataSize;
+    return fsp_fuse_ll_Reply(req, 0);
+}
+
+FSP_FUSE_API int fsp_fuse_reply_buf(struct fsp_fuse_env *env,
+    fuse_req_t req, const char *buf, size_t size)
+{
+    if (req->DataIsBuffer)
+    {
+        if (size > req->DataSize)
+            size = req->DataSize;
+        memcpy(req->Data, buf, size);
+    }
+    else if (0 != size)
+    {
+        req->Data = MemAlloc(size);
+        if (0 == req->Data)
+            return fsp_fuse_ll_Reply(req, 12/*ENOMEM*/);
+        memcpy(req->Data, buf, size);
+    }
+
+    req->Count = size;
+    return fsp_fuse_ll_Reply(req, 0);
+}
+
+FSP_FUSE_API int fsp_fuse_reply_statfs(struct fsp_fuse_env *env,
+    fuse_req_t req, const struct fuse_statvfs *stbuf)
+{
+    memcpy(&req->Statvfs, stbuf, sizeof *stbuf);
+    return fsp_fuse_ll_Reply(req, 0);
+}
+
+static size_t fsp_fuse_ll_AddDirent(fuse_req_t req, char *buf, size_t bufsize,
+    const char *name, fuse_ino_t ino, const void *attr, BOOLEAN Plus, fuse_off_t off)
+{
+    struct fsp_fuse_ll_dirent *dirent = (PVOID)buf;
+    size_t NameSize, Size;
+
+    NameSize = lstrlenA(name);
+    Size = FSP_FSCTL_ALIGN_UP(sizeof *dirent + NameSize + 1, 8);
+    if (0 == buf || Size > bufsize)
+        return Size;
+
+    memset(dirent, 0, sizeof *dirent);
+    dirent->Size = (UINT32)Size;
+    dirent->NameSize = (UINT16)NameSize;
+    dirent->Plus = Plus;
+    dirent->NextOffset = off;
+    dirent->Ino = ino;
+    if (Plus)
+        memcpy(&dirent->Attr, attr, fsp_fuse_ll_StatSize(req->f));
+    else if (0 != attr)
+    {
+        /* like FUSE only the inode number and file type are used */
+        dirent->Attr.st_ino = ((const struct fuse_stat *)attr)->st_ino;
+        dirent->Attr.st_mode = ((const struct fuse_stat *)attr)->st_mode;
+    }
+    memcpy(dirent->Name, name, NameSize + 1);
+
+    return Size;
+}
+
+FSP_FUSE_API size_t fsp_fuse_add_direntry(struct fsp_fuse_env *env,
+    fuse_req_t req, char *buf, size_t bufsize,
+    const char *name, const struct fuse_stat *stbuf, fuse_off_t off)
+{
+    return fsp_fuse_ll_AddDirent(req, buf, bufsize,
+        name, 0 != stbuf ? stbuf->st_ino : 0, stbuf, FALSE, off);
+}
+
+FSP_FUSE_API size_t fsp_fuse_add_direntry_plus(struct fsp_fuse_env *env,
+    fuse_req_t req, char *buf, size_t bufsize,
+    const char *name, const struct fuse_entry_param *e, fuse_off_t off)
+{
+    return fsp_fuse_ll_AddDirent(req, buf, bufsize,
+        name, e->ino, &e->attr, TRUE, off);
+}
+
+FSP_FUSE_API void *fsp_fuse_req_userdata(struct fsp_fuse_env *env,
+    fuse_req_t req)
+{
+    return req->f->data;
+}
+
+FSP_FUSE_API const struct fuse_ctx *fsp_fuse_req_ctx(struct fsp_fuse_env *env,
+    fuse_req_t req)
+{
+    return &req->ctx;
+}
+
+static VOID fsp_fuse_ll_Forget(struct fuse *f, fuse_ino_t ino)
+{
+    struct fuse_req req;
+    struct fuse_forget_data forget;
+
+    if (0 == ino || FUSE_ROOT_ID == ino)
+        return;
+
+    fsp_fuse_ll_InitReq(f, &req);
+    if (0 != f->llops.forget)
+        f->llops.forget(&req, ino, 1);
+    else if (0 != f->llops.forget_multi)
+    {
+        forget.ino = ino;
+        forget.nlookup = 1;
+        f->llops.forget_multi(&req, 1, &forget);
+    }
+    else
+        return;
+    fsp_fuse_ll_Wait(&req);
+}
+
+static NTSTATUS fsp_fuse_ll_Lookup(struct fuse *f, fuse_ino_t parent, const char *name,
+    fuse_ino_t *PIno, struct fuse_stat_ex *Attr)
+{
+    struct fuse_req req;
+    NTSTATUS Result;
+
+    if (0 == f->llops.lookup)
+        return STATUS_INVALID_DEVICE_REQUEST;
+
+    fsp_fuse_ll_InitReq(f, &req);
+    f->llops.lookup(&req, parent, name);
+    Result = fsp_fuse_ll_Wait(&req);
+    if (NT_SUCCESS(Result) && 0 == req.Ino)
+        Result = STATUS_OBJECT_NAME_NOT_FOUND; /* negative entry */
+    if (!NT_SUCCESS(Result))
+        return Result;
+
+    *PIno = req.Ino;
+    if (0 != Attr)
+        memcpy(Attr, &req.Attr, sizeof req.Attr);
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fsp_fuse_ll_GetAttr(struct fuse *f, fuse_ino_t ino,
+    struct fuse_file_info *fi, struct fuse_stat_ex *Attr)
+{
+    struct fuse_req req;
+    NTSTATUS Result;
+
+    if (0 == f->llops.getattr)
+        return STATUS_INVALID_DEVICE_REQUEST;
+
+    fsp_fuse_ll_InitReq(f, &req);
+    f->llops.getattr(&req, ino, fi);
+    Result = fsp_fuse_ll_Wait(&req);
+    if (!NT_SUCCESS(Result))
+        return Result;
+
+    memcpy(Attr, &req.Attr, sizeof req.Attr);
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fsp_fuse_ll_SetAttr(struct fuse *f, fuse_ino_t ino,
+    struct fuse_stat_ex *Attr, int to_set, struct fuse_file_info *fi)
+{
+    struct fuse_req req;
+    NTSTATUS Result;
+
+    if (0 == f->llops.setattr)
+        return STATUS_INVALID_DEVICE_REQUEST;
+
+    fsp_fuse_ll_InitReq(f, &req);
+    f->llops.setattr(&req, ino, (void *)Attr, to_set, fi);
+    Result = fsp_fuse_ll_Wait(&req);
+    if (!NT_SUCCESS(Result))
+        return Result;
+
+    memcpy(Attr, &req.Attr, sizeof req.Attr);
+
+    return STATUS_SUCCESS;
+}
+
+/*
+ * Resolve a POSIX path to an inode. If Parent is TRUE resolve the parent directory instead
+ * and return the last path component in *PName (0 for the root directory). The returned
+ * inode carries one lookup reference that the caller must forget.
+ */
+static NTSTATUS fsp_fuse_ll_ResolvePath(struct fuse *f, char *PosixPath, BOOLEAN Parent,
+    fuse_ino_t *PIno, char **PName, struct fuse_stat_ex *Attr)
+{
+    fuse_ino_t ino = FUSE_ROOT_ID, next;
+    char *p, *name, *endp, c;
+    NTSTATUS Result;
+
+    if (Parent)
+        *PName = 0;
+
+    for (p = PosixPath; '/' == *p; p++)
+        ;
+    for (;;)
+    {
+        name = p;
+        for (endp = p; '\0' != *endp && '/' != *endp; endp++)
+            ;
+        for (p = endp; '/' == *p; p++)
+            ;
+        if (name == endp)
+            break;
+
+        if (Parent && '\0' == *p)
+        {
+            *endp = '\0';
+            *PName = name;
+            break;
+        }
+
+        c = *endp;
+        *endp = '\0';
+        Result = fsp_fuse_ll_Lookup(f, ino, name, &next, Attr);
+        *endp = c;
+        fsp_fuse_ll_Forget(f, ino);
+        if (!NT_SUCCESS(Result))
+        {
+            if ('\0' != *p && STATUS_OBJECT_NAME_NOT_FOUND == Result)
+                Result = STATUS_OBJECT_PATH_NOT_FOUND;
+            return Result;
+        }
+
+        ino = next;
+    }
+
+    if (!Parent && FUSE_ROOT_ID == ino && 0 != Attr)
+    {
+        Result = fsp_fuse_ll_GetAttr(f, ino, 0, Attr);
+        if (!NT_SUCCESS(Result))
+            return Result;
+    }
+
+    *PIno = ino;
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fsp_fuse_ll_MapPath(PWSTR FileName,
+    char *PosixPathBuf, ULONG PosixPathBufSize, char **PPosixPath)
+{
+    NTSTATUS Result;
+
+    *PPosixPath = 0;
+    Result = FspPosixMapWindowsToPosixPathBuf(FileName, PosixPathBuf, &PosixPathBufSize, TRUE);
+    if (NT_SUCCESS(Result))
+        *PPosixPath = PosixPathBuf;
+    else if (STATUS_BUFFER_TOO_SMALL == Result)
+        Result = FspPosixMapWindowsToPosixPath(FileName, PPosixPath);
+
+    return Result;
+}
+
+static VOID fsp_fuse_ll_FileInfoFromAttr(struct fuse *f,
+    fuse_ino_t ino, struct fuse_stat_ex *Attr,
+    PUINT32 PUid, PUINT32 PGid, PUINT32 PMode,
+    FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    UINT64 AllocationUnit;
+
+    if (f->set_umask)
+        Attr->st_mode = (Attr->st_mode & 0170000) | (0777 & ~f->umask);
+    if (f->set_uid)
+        Attr->st_uid = f->uid;
+    if (f->set_gid)
+        Attr->st_gid = f->gid;
+
+    *PUid = Attr->st_uid;
+    *PGid = Attr->st_gid;
+    *PMode = Attr->st_mode;
+
+    AllocationUnit = (UINT64)f->VolumeParams.SectorSize *
+        (UINT64)f->VolumeParams.SectorsPerAllocationUnit;
+    FileInfo->FileAttributes = 0040000 == (Attr->st_mode & 0170000) ?
+        FILE_ATTRIBUTE_DIRECTORY : 0;
+    FileInfo->ReparseTag = 0;
+    FileInfo->FileSize = Attr->st_size;
+    FileInfo->AllocationSize =
+        (FileInfo->FileSize + AllocationUnit - 1) / AllocationUnit * AllocationUnit;
+    FspPosixUnixTimeToFileTime((void *)&Attr->st_birthtim, &FileInfo->CreationTime);
+    FspPosixUnixTimeToFileTime((void *)&Attr->st_atim, &FileInfo->LastAccessTime);
+    FspPosixUnixTimeToFileTime((void *)&Attr->st_mtim, &FileInfo->LastWriteTime);
+    FspPosixUnixTimeToFileTime((void *)&Attr->st_ctim, &FileInfo->ChangeTime);
+    FileInfo->IndexNumber = ino;
+    FileInfo->HardLinks = 0;
+    FileInfo->EaSize = 0;
+}
+
+static NTSTATUS fsp_fuse_ll_GetSecurityEx(struct fuse *f,
+    UINT32 Uid, UINT32 Gid, UINT32 Mode,
+    PSECURITY_DESCRIPTOR SecurityDescriptorBuf, SIZE_T *PSecurityDescriptorSize)
+{
+    PSECURITY_DESCRIPTOR SecurityDescriptor;
+    SIZE_T SecurityDescriptorSize;
+    NTSTATUS Result;
+
+    Result = FspPosixMergePermissionsToSecurityDescriptor(Uid, Gid, Mode, f->FileSecurity,
+        &SecurityDescriptor);
+    if (!NT_SUCCESS(Result))
+        return Result;
+
+    SecurityDescriptorSize = GetSecurityDescriptorLength(SecurityDescriptor);
+    if (SecurityDescriptorSize > *PSecurityDescriptorSize)
+        Result = STATUS_BUFFER_OVERFLOW;
+    else
+    {
+        if (0 != SecurityDescriptorBuf)
+            memcpy(SecurityDescriptorBuf, SecurityDescriptor, SecurityDescriptorSize);
+        Result = STATUS_SUCCESS;
+    }
+    *PSecurityDescriptorSize = SecurityDescriptorSize;
+
+    FspDeleteSecurityDescriptor(SecurityDescriptor,
+        FspPosixMergePermissionsToSecurityDescriptor);
+
+    return Result;
+}
+
+static NTSTATUS fsp_fuse_ll_OpenIno(struct fuse *f, fuse_ino_t ino, BOOLEAN IsDirectory,
+    struct fuse_file_info *fi)
+{
+    struct fuse_req req;
+    NTSTATUS Result;
+
+    /* like FUSE a missing open or opendir succeeds */
+    if (0 == (IsDirectory ? f->llops.opendir : f->llops.open))
+        return STATUS_SUCCESS;
+
+    fsp_fuse_ll_InitReq(f, &req);
+    memcpy(&req.fi, fi, sizeof *fi);
+    if (IsDirectory)
+        f->llops.opendir(&req, ino, &req.fi);
+    else
+        f->llops.open(&req, ino, &req.fi);
+    Result = fsp_fuse_ll_Wait(&req);
+    if (!NT_SUCCESS(Result))
+        return Result;
+
+    memcpy(fi, &req.fi, sizeof *fi);
+
+    return STATUS_SUCCESS;
+}
+
+static VOID fsp_fuse_ll_ReleaseIno(struct fuse *f, fuse_ino_t ino, BOOLEAN IsDirectory,
+    struct fuse_file_info *fi)
+{
+    struct fuse_req req;
+
+    if (0 == (IsDirectory ? f->llops.releasedir : f->llops.release))
+        return;
+
+    fsp_fuse_ll_InitReq(f, &req);
+    if (IsDirectory)
+        f->llops.releasedir(&req, ino, fi);
+    else
+        f->llops.release(&req, ino, fi);
+    fsp_fuse_ll_Wait(&req);
+}
+
+static NTSTATUS fsp_fuse_ll_FlushIno(struct fuse *f, struct fsp_fuse_file_desc *filedesc)
+{
+    struct fuse_req req;
+
+    if (0 == f->llops.flush)
+        return STATUS_SUCCESS;
+
+    fsp_fuse_ll_InitReq(f, &req);
+    fsp_fuse_ll_InitFileInfo(&req.fi, filedesc);
+    f->llops.flush(&req, filedesc->Ino, &req.fi);
+    return fsp_fuse_ll_Wait(&req);
+}
+
+static NTSTATUS fsp_fuse_ll_Access(struct fuse *f, fuse_ino_t ino, int mask)
+{
+    struct fuse_req req;
+
+    if (0 == f->llops.access)
+        return STATUS_INVALID_DEVICE_REQUEST;
+
+    fsp_fuse_ll_InitReq(f, &req);
+    f->llops.access(&req, ino, mask);
+    return fsp_fuse_ll_Wait(&req);
+}
+
+static NTSTATUS fsp_fuse_ll_ReadDir(struct fuse *f, struct fsp_fuse_file_desc *filedesc,
+    BOOLEAN Plus, fuse_off_t off, struct fuse_req *req)
+{
+    fsp_fuse_ll_InitReq(f, req);
+    fsp_fuse_ll_InitFileInfo(&req->fi, filedesc);
+    if (Plus)
+        f->llops.readdirplus(req, filedesc->Ino, FSP_FUSE_LL_READDIR_SIZE, off, &req->fi);
+    else
+        f->llops.readdir(req, filedesc->Ino, FSP_FUSE_LL_READDIR_SIZE, off, &req->fi);
+    return fsp_fuse_ll_Wait(req);
+}
+
+static inline struct fsp_fuse_ll_dirent *fsp_fuse_ll_NextDirent(struct fuse_req *req,
+    size_t *POffset)
+{
+    struct fsp_fuse_ll_dirent *dirent = (PVOID)((PUINT8)req->Data + *POffset);
+    size_t Remain = req->Count - *POffset;
+
+    if (sizeof *dirent > Remain || sizeof *dirent > dirent->Size || dirent->Size > Remain)
+        return 0;
+
+    *POffset += dirent->Size;
+    return dirent;
+}
+
+static inline BOOLEAN fsp_fuse_ll_IsDotName(const char *name)
+{
+    return '.' == name[0] && ('\0' == name[1] || ('.' == name[1] && '\0' == name[2]));
+}
+
+NTSTATUS fsp_fuse_ll_probe(struct fuse *f)
+{
+    struct fuse_req req;
+    struct fuse_stat_ex Attr;
+    NTSTATUS Result;
+
+    if (0 != f->llops.statfs)
+    {
+        fsp_fuse_ll_InitReq(f, &req);
+        f->llops.statfs(&req, FUSE_ROOT_ID);
+        Result = fsp_fuse_ll_Wait(&req);
+        if (!NT_SUCCESS(Result))
+            return Result;
+
+        if (0 == f->VolumeParams.SectorSize && 0 != req.Statvfs.f_frsize)
+            f->VolumeParams.SectorSize = (UINT16)req.Statvfs.f_frsize;
+        if (0 == f->VolumeParams.MaxComponentLength)
+            f->VolumeParams.MaxComponentLength = (UINT16)req.Statvfs.f_namemax;
+    }
+
+    if (0 != f->llops.getattr)
+    {
+        Result = fsp_fuse_ll_GetAttr(f, FUSE_ROOT_ID, 0, &Attr);
+        if (!NT_SUCCESS(Result))
+            return Result;
+
+        if (0 == f->VolumeParams.VolumeCreationTime)
+        {
+            if (0 != Attr.st_birthtim.tv_sec)
+                FspPosixUnixTimeToFileTime((void *)&Attr.st_birthtim,
+                    &f->VolumeParams.VolumeCreationTime);
+            else
+            if (0 != Attr.st_ctim.tv_sec)
+                FspPosixUnixTimeToFileTime((void *)&Attr.st_ctim,
+                    &f->VolumeParams.VolumeCreationTime);
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fsp_fuse_ll_GetVolumeInfo(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_VOLUME_INFO *VolumeInfo)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fuse_req req;
+    NTSTATUS Result;
+
+    fsp_fuse_ll_InitReq(f, &req);
+    if (0 != f->llops.statfs)
+    {
+        f->llops.statfs(&req, FUSE_ROOT_ID);
+        Result = fsp_fuse_ll_Wait(&req);
+        if (!NT_SUCCESS(Result))
+            return Result;
+    }
+
+    VolumeInfo->TotalSize = (UINT64)req.Statvfs.f_blocks * (UINT64)req.Statvfs.f_frsize;
+    VolumeInfo->FreeSize = (UINT64)req.Statvfs.f_bfree * (UINT64)req.Statvfs.f_frsize;
+    VolumeInfo->VolumeLabelLength = f->VolumeLabelLength;
+    memcpy(&VolumeInfo->VolumeLabel, &f->VolumeLabel, f->VolumeLabelLength);
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fsp_fuse_ll_SetVolumeLabel(FSP_FILE_SYSTEM *FileSystem,
+    PWSTR VolumeLabel,
+    FSP_FSCTL_VOLUME_INFO *VolumeInfo)
+{
+    /* see fsp_fuse_intf_SetVolumeLabel */
+    return STATUS_INVALID_PARAMETER;
+}
+
+static NTSTATUS fsp_fuse_ll_GetSecurityByName(FSP_FILE_SYSTEM *FileSystem,
+    PWSTR FileName, PUINT32 PFileAttributes,
+    PSECURITY_DESCRIPTOR SecurityDescriptorBuf, SIZE_T *PSecurityDescriptorSize)
+{
+    struct fuse *f = FileSystem->UserContext;
+    char PosixPathBuf[FSP_FUSE_POSIXPATH_SIZEMAX], *PosixPath = 0;
+    fuse_ino_t ino = 0;
+    struct fuse_stat_ex Attr;
+    UINT32 Uid, Gid, Mode;
+    FSP_FSCTL_FILE_INFO FileInfo;
+    NTSTATUS Result;
+
+    Result = fsp_fuse_ll_MapPath(FileName, PosixPathBuf, sizeof PosixPathBuf, &PosixPath);
+    if (!NT_SUCCESS(Result))
+        goto exit;
+
+    Result = fsp_fuse_ll_ResolvePath(f, PosixPath, FALSE, &ino, 0, &Attr);
+    if (!NT_SUCCESS(Result))
+        goto exit;
+
+    fsp_fuse_ll_FileInfoFromAttr(f, ino, &Attr, &Uid, &Gid, &Mode, &FileInfo);
+
+    if (0 != PSecurityDescriptorSize)
+    {
+        Result = fsp_fuse_ll_GetSecurityEx(f, Uid, Gid, Mode,
+            SecurityDescriptorBuf, PSecurityDescriptorSize);
+        if (!NT_SUCCESS(Result))
+            goto exit;
+    }
+
+    if (0 != PFileAttributes)
+        *PFileAttributes = FileInfo.FileAttributes;
+
+    Result = STATUS_SUCCESS;
+
+exit:
+    fsp_fuse_ll_Forget(f, ino);
+
+    if (0 != PosixPath && PosixPathBuf != PosixPath)
+        FspPosixDeletePath(PosixPath);
+
+    return Result;
+}
+
+static NTSTATUS fsp_fuse_ll_Create(FSP_FILE_SYSTEM *FileSystem,
+    PWSTR FileName, UINT32 CreateOptions, UINT32 GrantedAccess,
+    UINT32 FileAttributes, PSECURITY_DESCRIPTOR SecurityDescriptor, UINT64 AllocationSize,
+    PVOID *PFileDesc, FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fuse_context *context = fsp_fuse_get_context(f->env);
+    struct fsp_fuse_context_header *contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
+    BOOLEAN IsDirectory = !!(CreateOptions & FILE_DIRECTORY_FILE);
+    struct fsp_fuse_file_desc *filedesc = 0;
+    struct fuse_req req;
+    struct fuse_file_info fi;
+    struct fuse_stat_ex Attr;
+    fuse_ino_t parent = 0, ino = 0;
+    char *name;
+    UINT32 Uid, Gid, Mode;
+    LONG Generation;
+    BOOLEAN Opened = FALSE;
+    NTSTATUS Result;
+
+    filedesc = MemAlloc(sizeof *filedesc);
+    if (0 == filedesc)
+    {
+        Result = STATUS_INSUFFICIENT_RESOURCES;
+        goto exit;
+    }
+
+    Uid = context->uid;
+    Gid = context->gid;
+    Mode = 0777;
+    if (0 != SecurityDescriptor)
+    {
+        Result = FspPosixMapSecurityDescriptorToPermissions(SecurityDescriptor,
+            &Uid, &Gid, &Mode);
+        if (!NT_SUCCESS(Result))
+            goto exit;
+    }
+    Mode &= ~context->umask;
+    if (IsDirectory)
+    {
+        if (f->set_create_dir_umask)
+            Mode = 0777 & ~f->create_dir_umask;
+        else
+        if (f->set_create_umask)
+            Mode = 0777 & ~f->create_umask;
+    }
+    else
+    {
+        if (f->set_create_file_umask)
+            Mode = 0777 & ~f->create_file_umask;
+        else
+        if (f->set_create_umask)
+            Mode = 0777 & ~f->create_umask;
+    }
+
+    Result = fsp_fuse_ll_ResolvePath(f, contexthdr->PosixPath, TRUE, &parent, &name, 0);
+    if (!NT_SUCCESS(Result))
+        goto exit;
+    if (0 == name)
+    {
+        Result = STATUS_OBJECT_NAME_COLLISION;
+        goto exit;
+    }
+
+    memset(&fi, 0, sizeof fi);
+    if ('C' == f->env->environment) /* Cygwin */
+        fi.flags = 0x0200 | 0x0800 | 2 /*O_CREAT|O_EXCL|O_RDWR*/;
+    else
+        fi.flags = 0x0100 | 0x0400 | 2 /*O_CREAT|O_EXCL|O_RDWR*/;
+
+    Generation = fsp_fuse_intf_FileInfoGeneration(f);
+    fsp_fuse_ll_InitReq(f, &req);
+    if (IsDirectory && 0 != f->llops.mkdir)
+    {
+        f->llops.mkdir(&req, parent, name, Mode);
+        Result = fsp_fuse_ll_Wait(&req);
+    }
+    else if (!IsDirectory && 0 != f->llops.create)
+    {
+        memcpy(&req.fi, &fi, sizeof fi);
+        f->llops.create(&req, parent, name, 0100000/* S_IFREG */ | Mode, &req.fi);
+        Result = fsp_fuse_ll_Wait(&req);
+        if (NT_SUCCESS(Result))
+        {
+            memcpy(&fi, &req.fi, sizeof fi);
+            Opened = TRUE;
+        }
+    }
+    else if (!IsDirectory && 0 != f->llops.mknod)
+    {
+        f->llops.mknod(&req, parent, name, 0100000/* S_IFREG */ | Mode, 0);
+        Result = fsp_fuse_ll_Wait(&req);
+    }
+    else
+        Result = STATUS_INVALID_DEVICE_REQUEST;
+    if (!NT_SUCCESS(Result))
+        goto exit;
+
+    ino = req.Ino;
+    memcpy(&Attr, &req.Attr, sizeof Attr);
+
+    if (!Opened)
+    {
+        Result = fsp_fuse_ll_OpenIno(f, ino, IsDirectory, &fi);
+        if (!NT_SUCCESS(Result))
+            goto exit;
+        Opened = TRUE;
+    }
+
+    if ((Uid != context->uid || Gid != context->gid) &&
+        0 != f->llops.setattr)
+    {
+        struct fuse_stat_ex NewAttr;
+
+        memset(&NewAttr, 0, sizeof NewAttr);
+        NewAttr.st_uid = Uid;
+        NewAttr.st_gid = Gid;
+        Result = fsp_fuse_ll_SetAttr(f, ino,
+            &NewAttr, FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID, IsDirectory ? 0 : &fi);
+        if (NT_SUCCESS(Result))
+            memcpy(&Attr, &NewAttr, sizeof Attr);
+        else if (STATUS_INVALID_DEVICE_REQUEST != Result)
+            goto exit;
+    }
+
+    /*
+     * Ignore fuse_file_info::keep_cache.
+     * Ignore fuse_file_info::nonseekable.
+     */
+
+    FspFileSystemGetOperationContext()->Response->Rsp.Create.Opened.DisableCache = fi.direct_io;
+
+    fsp_fuse_ll_FileInfoFromAttr(f, ino, &Attr, &Uid, &Gid, &Mode, FileInfo);
+
+    memset(filedesc, 0, sizeof *filedesc);
+    filedesc->Ino = ino;
+    filedesc->IsDirectory = IsDirectory;
+    filedesc->OpenFlags = fi.flags;
+    filedesc->FileHandle = fi.fh;
+    InitializeSRWLock(&filedesc->FileInfoLock);
+    fsp_fuse_intf_SetCachedFileInfo(f, filedesc, Generation, FileInfo);
+
+    *PFileDesc = filedesc;
+
+    Result = STATUS_SUCCESS;
+
+exit:
+    if (!NT_SUCCESS(Result))
+    {
+        if (Opened)
+            fsp_fuse_ll_ReleaseIno(f, ino, IsDirectory, &fi);
+        fsp_fuse_ll_Forget(f, ino);
+
+        MemFree(filedesc);
+    }
+
+    fsp_fuse_ll_Forget(f, parent);
+
+    return Result;
+}
+
+static NTSTATUS fsp_fuse_ll_Open(FSP_FILE_SYSTEM *FileSystem,
+    PWSTR FileName, UINT32 CreateOptions, UINT32 GrantedAccess,
+    PVOID *PFileDesc, FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fuse_context *context = fsp_fuse_get_context(f->env);
+    struct fsp_fuse_context_header *contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
+    struct fsp_fuse_file_desc *filedesc = 0;
+    struct fuse_file_info fi;
+    struct fuse_stat_ex Attr;
+    fuse_ino_t ino = 0;
+    UINT32 Uid, Gid, Mode;
+    LONG Generation;
+    BOOLEAN IsDirectory;
+    NTSTATUS Result;
+
+    Generation = fsp_fuse_intf_FileInfoGeneration(f);
+    Result = fsp_fuse_ll_ResolvePath(f, contexthdr->PosixPath, FALSE, &ino, 0, &Attr);
+    if (!NT_SUCCESS(Result))
+        goto exit;
+    IsDirectory = 0040000 == (Attr.st_mode & 0170000);
+
+    if (0 != (CreateOptions & FILE_DELETE_ON_CLOSE) &&
+        0 != (f->conn_want & FSP_FUSE_CAP_DELETE_ACCESS))
+    {
+        Result = fsp_fuse_ll_Access(f, ino, FSP_FUSE_DELETE_OK);
+        if (!NT_SUCCESS(Result) && STATUS_INVALID_DEVICE_REQUEST != Result)
+        {
+            if (STATUS_ACCESS_DENIED == Result)
+                Result = STATUS_CANNOT_DELETE;
+            goto exit;
+        }
+    }
+
+    filedesc = MemAlloc(sizeof *filedesc);
+    if (0 == filedesc)
+    {
+        Result = STATUS_INSUFFICIENT_RESOURCES;
+        goto exit;
+    }
+
+    memset(&fi, 0, sizeof fi);
+    switch (GrantedAccess & (FILE_READ_DATA | FILE_WRITE_DATA))
+    {
+    default:
+    case FILE_READ_DATA:
+        fi.flags = 0/*O_RDONLY*/;
+        break;
+    case FILE_WRITE_DATA:
+        fi.flags = 1/*O_WRONLY*/;
+        break;
+    case FILE_READ_DATA | FILE_WRITE_DATA:
+        fi.flags = 2/*O_RDWR*/;
+        break;
+    }
+    /* see fsp_fuse_intf_Open */
+    if (!IsDirectory && (GrantedAccess & FILE_APPEND_DATA) && 0 == fi.flags)
+        fi.flags = 1/*O_WRONLY*/;
+
+    Result = fsp_fuse_ll_OpenIno(f, ino, IsDirectory, &fi);
+    if (!NT_SUCCESS(Result))
+        goto exit;
+
+    FspFileSystemGetOperationContext()->Response->Rsp.Create.Opened.DisableCache = fi.direct_io;
+
+    fsp_fuse_ll_FileInfoFromAttr(f, ino, &Attr, &Uid, &Gid, &Mode, FileInfo);
+
+    memset(filedesc, 0, sizeof *filedesc);
+    filedesc->Ino = ino;
+    filedesc->IsDirectory = IsDirectory;
+    filedesc->OpenFlags = fi.flags;
+    filedesc->FileHandle = fi.fh;
+    InitializeSRWLock(&filedesc->FileInfoLock);
+    fsp_fuse_intf_SetCachedFileInfo(f, filedesc, Generation, FileInfo);
+
+    *PFileDesc = filedesc;
+
+    Result = STATUS_SUCCESS;
+
+exit:
+    if (!NT_SUCCESS(Result))
+    {
+        fsp_fuse_ll_Forget(f, ino);
+
+        MemFree(filedesc);
+    }
+
+    return Result;
+}
+
+static NTSTATUS fsp_fuse_ll_Overwrite(FSP_FILE_SYSTEM *FileSystem,
+    PVOID FileDesc, UINT32 FileAttributes, BOOLEAN ReplaceFileAttributes, UINT64 AllocationSize,
+    FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_file_desc *filedesc = FileDesc;
+    struct fuse_file_info fi;
+    struct fuse_stat_ex Attr;
+    UINT32 Uid, Gid, Mode;
+    LONG Generation;
+    NTSTATUS Result;
+
+    if (filedesc->IsDirectory)
+        return STATUS_ACCESS_DENIED;
+
+    fsp_fuse_ll_InitFileInfo(&fi, filedesc);
+    memset(&Attr, 0, sizeof Attr);
+    Result = fsp_fuse_ll_SetAttr(f, filedesc->Ino, &Attr, FUSE_SET_ATTR_SIZE, &fi);
+    Generation = fsp_fuse_intf_InvalidateFileInfo(f);
+    if (!NT_SUCCESS(Result))
+        return Result;
+
+    fsp_fuse_ll_FileInfoFromAttr(f, filedesc->Ino, &Attr, &Uid, &Gid, &Mode, FileInfo);
+    fsp_fuse_intf_SetCachedFileInfo(f, filedesc, Generation, FileInfo);
+
+    return STATUS_SUCCESS;
+}
+
+static VOID fsp_fuse_ll_Cleanup(FSP_FILE_SYSTEM *FileSystem,
+    PVOID FileDesc, PWSTR FileName, ULONG Flags)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_file_desc *filedesc = FileDesc;
+    char PosixPathBuf[FSP_FUSE_POSIXPATH_SIZEMAX], *PosixPath = 0;
+    struct fuse_req req;
+    fuse_ino_t parent = 0;
+    char *name;
+
+    if (f->FlushOnCleanup && !filedesc->IsDirectory)
+        fsp_fuse_ll_FlushIno(f, filedesc);
+
+    /*
+     * See fsp_fuse_intf_Cleanup. Unlike the path based API there is no need to hide files
+     * that are still open: open files are named by inode and remain accessible until they
+     * are released.
+     */
+    if ((Flags & FspCleanupDelete) && 0 != FileName &&
+        NT_SUCCESS(fsp_fuse_ll_MapPath(FileName, PosixPathBuf, sizeof PosixPathBuf, &PosixPath)) &&
+        NT_SUCCESS(fsp_fuse_ll_ResolvePath(f, PosixPath, TRUE, &parent, &name, 0)) &&
+        0 != name)
+    {
+        fsp_fuse_ll_InitReq(f, &req);
+        if (filedesc->IsDirectory && 0 != f->llops.rmdir)
+        {
+            f->llops.rmdir(&req, parent, name);
+            fsp_fuse_ll_Wait(&req);
+        }
+        else if (!filedesc->IsDirectory && 0 != f->llops.unlink)
+        {
+            f->llops.unlink(&req, parent, name);
+            fsp_fuse_ll_Wait(&req);
+        }
+        fsp_fuse_intf_InvalidateFileInfo(f);
+    }
+
+    fsp_fuse_ll_Forget(f, parent);
+
+    if (0 != PosixPath && PosixPathBuf != PosixPath)
+        FspPosixDeletePath(PosixPath);
+}
+
+static VOID fsp_fuse_ll_Close(FSP_FILE_SYSTEM *FileSystem,
+    PVOID FileDesc)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_file_desc *filedesc = FileDesc;
+    struct fuse_file_info fi;
+
+    if (!filedesc->IsDirectory && !f->FlushOnCleanup)
+        fsp_fuse_ll_FlushIno(f, filedesc);
+
+    fsp_fuse_ll_InitFileInfo(&fi, filedesc);
+    fsp_fuse_ll_ReleaseIno(f, filedesc->Ino, filedesc->IsDirectory, &fi);
+
+    FspFileSystemDeleteDirectoryBuffer(&filedesc->DirBuffer);
+    fsp_fuse_ll_Forget(f, filedesc->Ino);
+    MemFree(filedesc);
+}
+
+static NTSTATUS fsp_fuse_ll_Read(FSP_FILE_SYSTEM *FileSystem,
+    PVOID FileDesc, PVOID Buffer, UINT64 Offset, ULONG Length,
+    PULONG PBytesTransferred)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_file_desc *filedesc = FileDesc;
+    struct fuse_req *req;
+
+    if (filedesc->IsDirectory)
+        return STATUS_ACCESS_DENIED;
+
+    if (0 == f->llops.read)
+        return STATUS_INVALID_DEVICE_REQUEST;
+
+    req = MemAlloc(sizeof *req);
+    if (0 == req)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    fsp_fuse_ll_InitReq(f, req);
+    fsp_fuse_ll_InitFileInfo(&req->fi, filedesc);
+    req->Data = Buffer;
+    req->DataSize = Length;
+    req->DataIsBuffer = TRUE;
+    req->Kind = FspFsctlTransactReadKind;
+    req->Hint = FspFileSystemGetOperationContext()->Request->Hint;
+    req->filedesc = filedesc;
+
+    f->llops.read(req, filedesc->Ino, Length, Offset, &req->fi);
+
+    return fsp_fuse_ll_Complete(req, PBytesTransferred, 0);
+}
+
+static NTSTATUS fsp_fuse_ll_GetFileInfo(FSP_FILE_SYSTEM *FileSystem,
+    PVOID FileDesc,
+    FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_file_desc *filedesc = FileDesc;
+    struct fuse_file_info fi;
+    struct fuse_stat_ex Attr;
+    UINT32 Uid, Gid, Mode;
+    LONG Generation;
+    NTSTATUS Result;
+
+    fsp_fuse_ll_InitFileInfo(&fi, filedesc);
+    Generation = fsp_fuse_intf_FileInfoGeneration(f);
+    Result = fsp_fuse_ll_GetAttr(f, filedesc->Ino, &fi, &Attr);
+    if (!NT_SUCCESS(Result))
+        return Result;
+
+    fsp_fuse_ll_FileInfoFromAttr(f, filedesc->Ino, &Attr, &Uid, &Gid, &Mode, FileInfo);
+    fsp_fuse_intf_SetCachedFileInfo(f, filedesc, Generation, FileInfo);
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fsp_fuse_ll_Write(FSP_FILE_SYSTEM *FileSystem,
+    PVOID FileDesc, PVOID Buffer, UINT64 Offset, ULONG Length,
+    BOOLEAN WriteToEndOfFile, BOOLEAN ConstrainedIo,
+    PULONG PBytesTransferred, FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_file_desc *filedesc = FileDesc;
+    struct fuse_req *req;
+    FSP_FSCTL_FILE_INFO FileInfoBuf;
+    LONG Generation;
+    UINT64 EndOffset;
+    NTSTATUS Result;
+
+    if (filedesc->IsDirectory)
+        return STATUS_ACCESS_DENIED;
+
+    if (0 == f->llops.write)
+        return STATUS_INVALID_DEVICE_REQUEST;
+
+    Generation = fsp_fuse_intf_FileInfoGeneration(f);
+    if (!fsp_fuse_intf_GetCachedFileInfo(f, filedesc, &FileInfoBuf))
+    {
+        Result = fsp_fuse_ll_GetFileInfo(FileSystem, filedesc, &FileInfoBuf);
+        if (!NT_SUCCESS(Result))
+            return Result;
+    }
+
+    if (ConstrainedIo)
+    {
+        if (Offset >= FileInfoBuf.FileSize)
+        {
+            memcpy(FileInfo, &FileInfoBuf, sizeof FileInfoBuf);
+            return STATUS_SUCCESS;
+        }
+        EndOffset = Offset + Length;
+        if (EndOffset > FileInfoBuf.FileSize)
+            EndOffset = FileInfoBuf.FileSize;
+    }
+    else
+    {
+        if (WriteToEndOfFile)
+            Offset = FileInfoBuf.FileSize;
+        EndOffset = Offset + Length;
+    }
+
+    req = MemAlloc(sizeof *req);
+    if (0 == req)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    fsp_fuse_ll_InitReq(f, req);
+    fsp_fuse_ll_InitFileInfo(&req->fi, filedesc);
+    req->DataSize = (size_t)(EndOffset - Offset);
+    req->Kind = FspFsctlTransactWriteKind;
+    req->Hint = FspFileSystemGetOperationContext()->Request->Hint;
+    req->filedesc = filedesc;
+    req->Offset = Offset;
+    req->Generation = Generation;
+    memcpy(&req->FileInfo, &FileInfoBuf, sizeof FileInfoBuf);
+
+    f->llops.write(req, filedesc->Ino, Buffer, (size_t)(EndOffset - Offset), Offset, &req->fi);
+
+    return fsp_fuse_ll_Complete(req, PBytesTransferred, FileInfo);
+}
+
+static NTSTATUS fsp_fuse_ll_Flush(FSP_FILE_SYSTEM *FileSystem,
+    PVOID FileDesc,
+    FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_file_desc *filedesc = FileDesc;
+    struct fuse_req req;
+    NTSTATUS Result;
+
+    if (0 == filedesc)
+        return STATUS_SUCCESS; /* FUSE cannot flush volumes */
+
+    fsp_fuse_ll_InitReq(f, &req);
+    fsp_fuse_ll_InitFileInfo(&req.fi, filedesc);
+    Result = STATUS_SUCCESS; /* just say success, if fs does not support fsync */
+    if (filedesc->IsDirectory && 0 != f->llops.fsyncdir)
+    {
+        f->llops.fsyncdir(&req, filedesc->Ino, 0, &req.fi);
+        Result = fsp_fuse_ll_Wait(&req);
+    }
+    else if (!filedesc->IsDirectory && 0 != f->llops.fsync)
+    {
+        f->llops.fsync(&req, filedesc->Ino, 0, &req.fi);
+        Result = fsp_fuse_ll_Wait(&req);
+    }
+    if (!NT_SUCCESS(Result))
+        return Result;
+
+    return fsp_fuse_ll_GetFileInfo(FileSystem, filedesc, FileInfo);
+}
+
+static NTSTATUS fsp_fuse_ll_SetBasicInfo(FSP_FILE_SYSTEM *FileSystem,
+    PVOID FileDesc, UINT32 FileAttributes,
+    UINT64 CreationTime, UINT64 LastAccessTime, UINT64 LastWriteTime, UINT64 ChangeTime,
+    FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_file_desc *filedesc = FileDesc;
+    struct fuse_file_info fi;
+    struct fuse_stat_ex Attr;
+    UINT32 Uid, Gid, Mode;
+    LONG Generation;
+    int to_set = 0;
+    NTSTATUS Result;
+
+    /* FUSE has no equivalent for file attributes, creation time or change time */
+    memset(&Attr, 0, sizeof Attr);
+    if (0 != LastAccessTime)
+    {
+        FspPosixFileTimeToUnixTime(LastAccessTime, (void *)&Attr.st_atim);
+        to_set |= FUSE_SET_ATTR_ATIME;
+    }
+    if (0 != LastWriteTime)
+    {
+        FspPosixFileTimeToUnixTime(LastWriteTime, (void *)&Attr.st_mtim);
+        to_set |= FUSE_SET_ATTR_MTIME;
+    }
+    if (0 == to_set || 0 == f->llops.setattr)
+        return fsp_fuse_ll_GetFileInfo(FileSystem, filedesc, FileInfo);
+
+    fsp_fuse_ll_InitFileInfo(&fi, filedesc);
+    Result = fsp_fuse_ll_SetAttr(f, filedesc->Ino, &Attr, to_set, filedesc->IsDirectory ? 0 : &fi);
+    Generation = fsp_fuse_intf_InvalidateFileInfo(f);
+    if (!NT_SUCCESS(Result))
+        return Result;
+
+    fsp_fuse_ll_FileInfoFromAttr(f, filedesc->Ino, &Attr, &Uid, &Gid, &Mode, FileInfo);
+    fsp_fuse_intf_SetCachedFileInfo(f, filedesc, Generation, FileInfo);
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fsp_fuse_ll_SetFileSize(FSP_FILE_SYSTEM *FileSystem,
+    PVOID FileDesc, UINT64 NewSize, BOOLEAN SetAllocationSize,
+    FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_file_desc *filedesc = FileDesc;
+    struct fuse_file_info fi;
+    struct fuse_stat_ex Attr;
+    FSP_FSCTL_FILE_INFO FileInfoBuf;
+    UINT32 Uid, Gid, Mode;
+    LONG Generation;
+    NTSTATUS Result;
+
+    if (filedesc->IsDirectory)
+        return STATUS_ACCESS_DENIED;
+
+    if (0 == f->llops.setattr)
+        return STATUS_INVALID_DEVICE_REQUEST;
+
+    if (!fsp_fuse_intf_GetCachedFileInfo(f, filedesc, &FileInfoBuf))
+    {
+        Result = fsp_fuse_ll_GetFileInfo(FileSystem, filedesc, &FileInfoBuf);
+        if (!NT_SUCCESS(Result))
+            return Result;
+    }
+
+    /* see fsp_fuse_intf_SetFileSize */
+    if (!SetAllocationSize || FileInfoBuf.FileSize > NewSize)
+    {
+        fsp_fuse_ll_InitFileInfo(&fi, filedesc);
+        memset(&Attr, 0, sizeof Attr);
+        Attr.st_size = NewSize;
+        Result = fsp_fuse_ll_SetAttr(f, filedesc->Ino, &Attr, FUSE_SET_ATTR_SIZE, &fi);
+        Generation = fsp_fuse_intf_InvalidateFileInfo(f);
+        if (!NT_SUCCESS(Result))
+            return Result;
+
+        fsp_fuse_ll_FileInfoFromAttr(f, filedesc->Ino, &Attr, &Uid, &Gid, &Mode, &FileInfoBuf);
+        fsp_fuse_intf_SetCachedFileInfo(f, filedesc, Generation, &FileInfoBuf);
+    }
+
+    memcpy(FileInfo, &FileInfoBuf, sizeof FileInfoBuf);
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fsp_fuse_ll_CanDelete(FSP_FILE_SYSTEM *FileSystem,
+    PVOID FileDesc, PWSTR FileName)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_file_desc *filedesc = FileDesc;
+    struct fsp_fuse_ll_dirent *dirent;
+    struct fuse_req req;
+    BOOLEAN Plus, HasChild = FALSE;
+    fuse_off_t off = 0, prevoff;
+    size_t ReqOffset;
+    NTSTATUS Result;
+
+    if (0 != (f->conn_want & FSP_FUSE_CAP_DELETE_ACCESS))
+    {
+        Result = fsp_fuse_ll_Access(f, filedesc->Ino, FSP_FUSE_DELETE_OK);
+        if (!NT_SUCCESS(Result) && STATUS_INVALID_DEVICE_REQUEST != Result)
+        {
+            if (STATUS_ACCESS_DENIED == Result)
+                Result = STATUS_CANNOT_DELETE;
+            return Result;
+        }
+    }
+
+    if (!filedesc->IsDirectory)
+        return STATUS_SUCCESS;
+
+    /* check that directory is empty! prefer readdir: readdirplus entries must be forgotten */
+    Plus = 0 == f->llops.readdir;
+    if (Plus && 0 == f->llops.readdirplus)
+        return STATUS_SUCCESS;
+
+    for (;;)
+    {
+        prevoff = off;
+        Result = fsp_fuse_ll_ReadDir(f, filedesc, Plus, off, &req);
+        if (!NT_SUCCESS(Result) || 0 == req.Count)
+            break;
+
+        for (ReqOffset = 0; 0 != (dirent = fsp_fuse_ll_NextDirent(&req, &ReqOffset));)
+        {
+            off = dirent->NextOffset;
+            if (fsp_fuse_ll_IsDotName(dirent->Name))
+                continue;
+            HasChild = TRUE;
+            if (Plus)
+                fsp_fuse_ll_Forget(f, dirent->Ino);
+        }
+        MemFree(req.Data);
+
+        if (HasChild || 0 == ReqOffset || prevoff == off)
+            break;
+    }
+
+    if (HasChild)
+        return STATUS_DIRECTORY_NOT_EMPTY;
+
+    return Result;
+}
+
+static NTSTATUS fsp_fuse_ll_Rename(FSP_FILE_SYSTEM *FileSystem,
+    PVOID FileDesc,
+    PWSTR FileName, PWSTR NewFileName, BOOLEAN ReplaceIfExists)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fuse_context *context = fsp_fuse_get_context(f->env);
+    struct fsp_fuse_context_header *contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
+    char PosixPathBuf[FSP_FUSE_POSIXPATH_SIZEMAX], *PosixPath = 0;
+    struct fuse_req req;
+    struct fuse_stat_ex Attr;
+    fuse_ino_t parent = 0, newparent = 0, ino = 0;
+    char *name, *newname;
+    NTSTATUS Result;
+
+    if (0 == f->llops.rename)
+        return STATUS_INVALID_DEVICE_REQUEST;
+
+    Result = fsp_fuse_ll_MapPath(FileName, PosixPathBuf, sizeof PosixPathBuf, &PosixPath);
+    if (!NT_SUCCESS(Result))
+        goto exit;
+
+    Result = fsp_fuse_ll_ResolvePath(f, PosixPath, TRUE, &parent, &name, 0);
+    if (!NT_SUCCESS(Result))
+        goto exit;
+    Result = fsp_fuse_ll_ResolvePath(f, contexthdr->PosixPath, TRUE, &newparent, &newname, 0);
+    if (!NT_SUCCESS(Result))
+        goto exit;
+    if (0 == name || 0 == newname)
+    {
+        Result = STATUS_ACCESS_DENIED;
+        goto exit;
+    }
+
+    Result = fsp_fuse_ll_Lookup(f, newparent, newname, &ino, &Attr);
+    if (!NT_SUCCESS(Result) &&
+        STATUS_OBJECT_NAME_NOT_FOUND != Result &&
+        STATUS_OBJECT_PATH_NOT_FOUND != Result)
+        goto exit;
+
+    if (NT_SUCCESS(Result) &&
+        (f->VolumeParams.CaseSensitiveSearch || 0 != invariant_wcsicmp(FileName, NewFileName)))
+    {
+        if (!ReplaceIfExists)
+        {
+            Result = STATUS_OBJECT_NAME_COLLISION;
+            goto exit;
+        }
+
+        if (0040000 == (Attr.st_mode & 0170000))
+        {
+            Result = STATUS_ACCESS_DENIED;
+            goto exit;
+        }
+    }
+
+    fsp_fuse_ll_InitReq(f, &req);
+    f->llops.rename(&req, parent, name, newparent, newname);
+    Result = fsp_fuse_ll_Wait(&req);
+    fsp_fuse_intf_InvalidateFileInfo(f);
+
+exit:
+    fsp_fuse_ll_Forget(f, ino);
+    fsp_fuse_ll_Forget(f, newparent);
+    fsp_fuse_ll_Forget(f, parent);
+
+    if (0 != PosixPath && PosixPathBuf != PosixPath)
+        FspPosixDeletePath(PosixPath);
+
+    return Result;
+}
+
+static NTSTATUS fsp_fuse_ll_GetSecurity(FSP_FILE_SYSTEM *FileSystem,
+    PVOID FileDesc,
+    PSECURITY_DESCRIPTOR SecurityDescriptorBuf, SIZE_T *PSecurityDescriptorSize)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_file_desc *filedesc = FileDesc;
+    struct fuse_file_info fi;
+    struct fuse_stat_ex Attr;
+    UINT32 Uid, Gid, Mode;
+    FSP_FSCTL_FILE_INFO FileInfo;
+    NTSTATUS Result;
+
+    fsp_fuse_ll_InitFileInfo(&fi, filedesc);
+    Result = fsp_fuse_ll_GetAttr(f, filedesc->Ino, &fi, &Attr);
+    if (!NT_SUCCESS(Result))
+        return Result;
+
+    fsp_fuse_ll_FileInfoFromAttr(f, filedesc->Ino, &Attr, &Uid, &Gid, &Mode, &FileInfo);
+
+    return fsp_fuse_ll_GetSecurityEx(f, Uid, Gid, Mode,
+        SecurityDescriptorBuf, PSecurityDescriptorSize);
+}
+
+static NTSTATUS fsp_fuse_ll_SetSecurity(FSP_FILE_SYSTEM *FileSystem,
+    PVOID FileDesc,
+    SECURITY_INFORMATION SecurityInformation, PSECURITY_DESCRIPTOR ModificationDescriptor)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_file_desc *filedesc = FileDesc;
+    struct fuse_file_info fi;
+    struct fuse_stat_ex Attr;
+    UINT32 Uid, Gid, Mode, NewUid, NewGid, NewMode;
+    FSP_FSCTL_FILE_INFO FileInfo;
+    PSECURITY_DESCRIPTOR SecurityDescriptor = 0, NewSecurityDescriptor = 0;
+    int to_set = 0;
+    NTSTATUS Result;
+
+    if (0 == f->llops.setattr)
+        return STATUS_INVALID_DEVICE_REQUEST;
+
+    fsp_fuse_ll_InitFileInfo(&fi, filedesc);
+    Result = fsp_fuse_ll_GetAttr(f, filedesc->Ino, &fi, &Attr);
+    if (!NT_SUCCESS(Result))
+        goto exit;
+
+    fsp_fuse_ll_FileInfoFromAttr(f, filedesc->Ino, &Attr, &Uid, &Gid, &Mode, &FileInfo);
+
+    Result = FspPosixMergePermissionsToSecurityDescriptor(Uid, Gid, Mode, f->FileSecurity,
+        &SecurityDescriptor);
+    if (!NT_SUCCESS(Result))
+        goto exit;
+
+    Result = FspSetSecurityDescriptor(
+        SecurityDescriptor,
+        SecurityInformation,
+        ModificationDescriptor,
+        &NewSecurityDescriptor);
+    if (!NT_SUCCESS(Result))
+        goto exit;
+
+    Result = FspPosixMapSecurityDescriptorToPermissions(NewSecurityDescriptor,
+        &NewUid, &NewGid, &NewMode);
+    if (!NT_SUCCESS(Result))
+        goto exit;
+
+    memset(&Attr, 0, sizeof Attr);
+    if (NewMode != Mode)
+    {
+        Attr.st_mode = NewMode;
+        to_set |= FUSE_SET_ATTR_MODE;
+    }
+    if (NewUid != Uid)
+    {
+        Attr.st_uid = NewUid;
+        to_set |= FUSE_SET_ATTR_UID;
+    }
+    if (NewGid != Gid)
+    {
+        Attr.st_gid = NewGid;
+        to_set |= FUSE_SET_ATTR_GID;
+    }
+    if (0 != to_set)
+        Result = fsp_fuse_ll_SetAttr(f, filedesc->Ino, &Attr, to_set,
+            filedesc->IsDirectory ? 0 : &fi);
+
+exit:
+    fsp_fuse_intf_InvalidateFileInfo(f);
+
+    if (0 != NewSecurityDescriptor)
+        FspDeleteSecurityDescriptor(NewSecurityDescriptor,
+            FspSetSecurityDescriptor);
+
+    if (0 != SecurityDescriptor)
+        FspDeleteSecurityDescriptor(SecurityDescriptor,
+            FspPosixMergePermissionsToSecurityDescriptor);
+
+    return Result;
+}
+
+static BOOLEAN fsp_fuse_ll_AddDirInfo(FSP_FILE_SYSTEM *FileSystem,
+    struct fsp_fuse_file_desc *filedesc, struct fsp_fuse_ll_dirent *dirent,
+    FSP_FSCTL_FILE_INFO *DirFileInfo, NTSTATUS *PResult)
+{
+    struct fuse *f = FileSystem->UserContext;
+    union
+    {
+        FSP_FSCTL_DIR_INFO V;
+        UINT8 B[sizeof(FSP_FSCTL_DIR_INFO) + 255 * sizeof(WCHAR)];
+    } DirInfoBuf;
+    FSP_FSCTL_DIR_INFO *DirInfo = &DirInfoBuf.V;
+    struct fuse_stat_ex Attr;
+    fuse_ino_t ino;
+    UINT32 Uid, Gid, Mode;
+    ULONG SizeW;
+
+    memset(DirInfo, 0, sizeof *DirInfo);
+
+    if (fsp_fuse_ll_IsDotName(dirent->Name))
+    {
+        /* if this is the root directory do not add the dot entries */
+        if (FUSE_ROOT_ID == filedesc->Ino)
+            return TRUE;
+
+        /* dot entries do not carry a lookup reference */
+        memcpy(&DirInfo->FileInfo, DirFileInfo, sizeof *DirFileInfo);
+    }
+    else if (dirent->Plus && 0 != dirent->Ino)
+    {
+        fsp_fuse_ll_FileInfoFromAttr(f, dirent->Ino, &dirent->Attr, &Uid, &Gid, &Mode,
+            &DirInfo->FileInfo);
+        fsp_fuse_ll_Forget(f, dirent->Ino);
+    }
+    else
+    {
+        if (!NT_SUCCESS(fsp_fuse_ll_Lookup(f, filedesc->Ino, dirent->Name, &ino, &Attr)))
+            return TRUE;
+        fsp_fuse_ll_FileInfoFromAttr(f, ino, &Attr, &Uid, &Gid, &Mode, &DirInfo->FileInfo);
+        fsp_fuse_ll_Forget(f, ino);
+    }
+
+    SizeW = MultiByteToWideChar(CP_UTF8, 0,
+        dirent->Name, dirent->NameSize, DirInfo->FileNameBuf, 255);
+    if (0 == SizeW)
+        return TRUE;
+    FspPosixDecodeWindowsPath(DirInfo->FileNameBuf, SizeW);
+    DirInfo->Size = (UINT16)(sizeof(FSP_FSCTL_DIR_INFO) + SizeW * sizeof(WCHAR));
+
+    return FspFileSystemFillDirectoryBuffer(&filedesc->DirBuffer, DirInfo, PResult);
+}
+
+static NTSTATUS fsp_fuse_ll_ReadDirectory(FSP_FILE_SYSTEM *FileSystem,
+    PVOID FileDesc, PWSTR Pattern, PWSTR Marker,
+    PVOID Buffer, ULONG Length, PULONG PBytesTransferred)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_file_desc *filedesc = FileDesc;
+    struct fsp_fuse_ll_dirent *dirent;
+    struct fuse_req req;
+    FSP_FSCTL_FILE_INFO DirFileInfo;
+    BOOLEAN Plus, More;
+    fuse_off_t off, prevoff;
+    size_t ReqOffset;
+    NTSTATUS Result;
+
+    if (!filedesc->IsDirectory)
+        return STATUS_ACCESS_DENIED;
+
+    Plus = 0 != f->llops.readdirplus;
+    if (!Plus && 0 == f->llops.readdir)
+        return STATUS_INVALID_DEVICE_REQUEST;
+
+    if (FspFileSystemAcquireDirectoryBuffer(&filedesc->DirBuffer, 0 == Marker, &Result))
+    {
+        Result = fsp_fuse_ll_GetFileInfo(FileSystem, filedesc, &DirFileInfo);
+
+        for (off = 0, More = NT_SUCCESS(Result); More;)
+        {
+            prevoff = off;
+            Result = fsp_fuse_ll_ReadDir(f, filedesc, Plus, off, &req);
+            if (!NT_SUCCESS(Result) || 0 == req.Count)
+                break;
+
+            for (ReqOffset = 0; 0 != (dirent = fsp_fuse_ll_NextDirent(&req, &ReqOffset));)
+            {
+                off = dirent->NextOffset;
+                if (More)
+                    More = fsp_fuse_ll_AddDirInfo(FileSystem, filedesc, dirent,
+                        &DirFileInfo, &Result);
+                else if (dirent->Plus && !fsp_fuse_ll_IsDotName(dirent->Name))
+                    /* directory buffer is full; drop the lookup references of the rest */
+                    fsp_fuse_ll_Forget(f, dirent->Ino);
+            }
+            MemFree(req.Data);
+
+            /* stop if the file system does not advance the directory offset */
+            if (0 == ReqOffset || prevoff == off)
+                break;
+        }
+
+        FspFileSystemReleaseDirectoryBuffer(&filedesc->DirBuffer);
+    }
+
+    if (!NT_SUCCESS(Result))
+        return Result;
+
+    FspFileSystemReadDirectoryBuffer(&filedesc->DirBuffer,
+        Marker, Buffer, Length, PBytesTransferred);
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fsp_fuse_ll_GetDirInfoByName(FSP_FILE_SYSTEM *FileSystem,
+    PVOID FileDesc, PWSTR FileName,
+    FSP_FSCTL_DIR_INFO *DirInfo)
+{
+    struct fuse *f = FileSystem->UserContext;
+    struct fsp_fuse_file_desc *filedesc = FileDesc;
+    char *PosixName = 0;
+    struct fuse_stat_ex Attr;
+    fuse_ino_t ino;
+    UINT32 Uid, Gid, Mode;
+    NTSTATUS Result;
+
+    if (!filedesc->IsDirectory)
+        return STATUS_ACCESS_DENIED;
+
+    Result = FspPosixMapWindowsToPosixPath(FileName, &PosixName);
+    if (!NT_SUCCESS(Result))
+    {
+        Result = STATUS_OBJECT_NAME_NOT_FOUND;
+        goto exit;
+    }
+
+    Result = fsp_fuse_ll_Lookup(f, filedesc->Ino, PosixName, &ino, &Attr);
+    if (!NT_SUCCESS(Result))
+    {
+        Result = STATUS_OBJECT_NAME_NOT_FOUND;
+        goto exit;
+    }
+
+    fsp_fuse_ll_FileInfoFromAttr(f, ino, &Attr, &Uid, &Gid, &Mode, &DirInfo->FileInfo);
+    fsp_fuse_ll_Forget(f, ino);
+
+    DirInfo->Size = (UINT16)(sizeof(FSP_FSCTL_DIR_INFO) + lstrlenW(FileName) * sizeof(WCHAR));
+    memcpy(DirInfo->FileNameBuf, FileName, DirInfo->Size - sizeof(FSP_FSCTL_DIR_INFO));
+
+    Result = STATUS_SUCCESS;
+
+exit:
+    if (0 != PosixName)
+        FspPosixDeletePath(PosixName);
+
+    return Result;
+}
+
+static VOID fsp_fuse_ll_DispatcherStopped(FSP_FILE_SYSTEM *FileSystem,
+    BOOLEAN Normally)
+{
+    if (Normally)
+        return;
+
+    struct fuse *f = FileSystem->UserContext;
+
+    fsp_fuse_exit(f->env, f);
+}
+
+FSP_FILE_SYSTEM_INTERFACE fsp_fuse_ll_intf =
+{
+    fsp_fuse_ll_GetVolumeInfo,
+    fsp_fuse_ll_SetVolumeLabel,
+    fsp_fuse_ll_GetSecurityByName,
+    fsp_fuse_ll_Create,
+    fsp_fuse_ll_Open,
+    fsp_fuse_ll_Overwrite,
+    fsp_fuse_ll_Cleanup,
+    fsp_fuse_ll_Close,
+    fsp_fuse_ll_Read,
+    fsp_fuse_ll_Write,
+    fsp_fuse_ll_Flush,
+    fsp_fuse_ll_GetFileInfo,
+    fsp_fuse_ll_SetBasicInfo,
+    fsp_fuse_ll_SetFileSize,
+    fsp_fuse_ll_CanDelete,
+    fsp_fuse_ll_Rename,
+    fsp_fuse_ll_GetSecurity,
+    fsp_fuse_ll_SetSecurity,
+    fsp_fuse_ll_ReadDirectory,
+    0,
+    0,
+    0,
+    0,
+    0,
+    fsp_fuse_ll_GetDirInfoByName,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    fsp_fuse_ll_DispatcherStopped,
+};
@@ -24,6 +24,7 @@
 
 #include <dll/library.h>
 #include <fuse/fuse.h>
+#include <fuse/fuse_lowlevel.h>
 #include <fuse/fuse_opt.h>
 
 #define FSP_FUSE_LIBRARY_NAME           LIBRARY_NAME "-FUSE"
@@ -45,7 +46,17 @@
 #define NFS_SPECFILE_LNK                0x00000000014b4e4c
 #define NFS_SPECFILE_SOCK               0x000000004B434F53
 
+#define FSP_FUSE_NODE_BUCKET_COUNT      1024
+#define FSP_FUSE_PATH_SLOT_COUNT        16
+#define FSP_FUSE_CACHE_LINE_SIZE        64
+#define FSP_FUSE_READDIR_GETATTR_THREADS_DEFAULT 4
+
 /* FUSE internal struct's */
+struct fsp_fuse_path_slot
+{
+    volatile LONG ReaderCount[2];       /* indexed by path retire phase */
+    UINT8 Padding[FSP_FUSE_CACHE_LINE_SIZE - 2 * sizeof(LONG)];
+};
 struct fuse
 {
     struct fsp_fuse_env *env;
@@ -58,13 +69,32 @@ struct fuse
     int add_write_ea_access;
     int rellinks;
     int dothidden;
+    int hard_remove, nullpath_ok, nopath;
     unsigned ThreadCount;
+    unsigned ReaddirGetattrThreads;
+    PTP_POOL ReaddirGetattrPool;        /* see fsp_fuse_intf_FixDirInfoParallel */
+    TP_CALLBACK_ENVIRON ReaddirGetattrEnviron;
     struct fuse_operations ops;
+    int lowlevel;
+    struct fuse_lowlevel_ops llops;
     void *data;
     unsigned conn_want;
     BOOLEAN fsinit;
     BOOLEAN has_symlinks, has_slashdot;
     BOOLEAN FlushOnCleanup;
+    BOOLEAN ShardedLocks;
+    BOOLEAN FileInfoCache;
+    volatile LONG FileInfoGeneration;
+    volatile LONG NodeFileInfoInvalidations;
+    volatile LONG ArenaHighWater, ArenaOverflowCount;
+    SRWLOCK NodeLock;
+    ULONG NodeCount;
+    struct fsp_fuse_node *NodeBuckets[FSP_FUSE_NODE_BUCKET_COUNT];
+    struct fsp_fuse_node **NodeIndex;   /* sorted by path; see fsp_fuse_intf_NodeIndexFind */
+    ULONG NodeIndexCapacity;
+    volatile LONG PathRetirePhase;
+    struct fsp_fuse_node_path *RetiredPaths[2];
+    struct fsp_fuse_path_slot PathSlots[FSP_FUSE_PATH_SLOT_COUNT];
     UINT32 DebugLog;
     FSP_FILE_SYSTEM_OPERATION_GUARD_STRATEGY OpGuardStrategy;
     FSP_FSCTL_VOLUME_PARAMS VolumeParams;
@@ -78,18 +108,51 @@ struct fuse
     PSECURITY_DESCRIPTOR FileSecurity;
     FSP_FSCTL_DECLSPEC_ALIGN UINT8 FileSecurityBuf[];
 };
+#define FSP_FUSE_ARENA_SIZE             (16 * 1024)
+/* UTF-8 needs at most 3 bytes for every UTF-16 character */
+#define FSP_FUSE_POSIXPATH_SIZEMAX      (3 * FSP_FSCTL_TRANSACT_PATH_SIZEMAX / sizeof(WCHAR) + 1)
 struct fsp_fuse_context_header
 {
     char *PosixPath;
+    struct fsp_fuse_async *Async;       /* Read/Write/ReadDirectory with FSP_FUSE_CAP_ASYNC */
+    BOOLEAN AsyncBegun;
+    PUINT8 ArenaBuf;                    /* dispatcher threads only; see fsp_fuse_arena_alloc */
+    ULONG ArenaOffset, ArenaHighWater, ArenaOverflowCount;
+    struct fsp_fuse_path_slot *PathSlot; /* see fsp_fuse_intf_NodePathRetire */
+    LONG PathPhase;
+    char PosixPathBuf[FSP_FUSE_POSIXPATH_SIZEMAX];
     __declspec(align(MEMORY_ALLOCATION_ALIGNMENT)) UINT8 ContextBuf[];
 };
+struct fsp_fuse_node_path
+{
+    struct fsp_fuse_node_path *Next;
+    char PosixPath[];
+};
+struct fsp_fuse_node
+{
+    struct fsp_fuse_node *HashNext;
+    UINT64 Ino;
+    LONG OpenCount;
+    volatile LONG HandleCount;          /* open handles; unlike OpenCount drops at Cleanup */
+    volatile LONG FileInfoGeneration;   /* see fsp_fuse_intf_NodeFileInfoGeneration */
+    BOOLEAN IsHidden, IsRemoved, IsMoving;
+    char *PosixPath;                    /* PosixPathBuf or Path->PosixPath */
+    struct fsp_fuse_node_path *Path;    /* current path after a rename; 0 before */
+    char PosixPathBuf[];
+};
 struct fsp_fuse_file_desc
 {
-    char *PosixPath;
+    struct fsp_fuse_node *Node;
+    fuse_ino_t Ino;                     /* lowlevel only; Node is 0 */
     BOOLEAN IsDirectory, IsReparsePoint;
+    BOOLEAN IsHandleOpen;               /* counted in Node->HandleCount */
     int OpenFlags;
     UINT64 FileHandle;
     PVOID DirBuffer;
+    SRWLOCK FileInfoLock;
+    BOOLEAN FileInfoValid;
+    LONG FileInfoGeneration;
+    FSP_FSCTL_FILE_INFO FileInfo;
 };
 struct fuse_dirhandle
 {
@@ -98,10 +161,28 @@ struct fuse_dirhandle
     FSP_FILE_SYSTEM *FileSystem;
     BOOLEAN ReaddirPlus;
     NTSTATUS Result;
+    /* ReadDirectory with FSP_FUSE_CAP_ASYNC: entries are collected here */
+    BOOLEAN Async;
+    PUINT8 AsyncBuffer;
+    ULONG AsyncSize, AsyncCapacity;
     /* CanDelete */
     BOOLEAN DotFiles, HasChild;
 };
 
+/* FUSE file info cache */
+static inline LONG fsp_fuse_intf_FileInfoGeneration(struct fuse *f)
+{
+    return InterlockedCompareExchange(&f->FileInfoGeneration, 0, 0);
+}
+static inline LONG fsp_fuse_intf_InvalidateFileInfo(struct fuse *f)
+{
+    return InterlockedIncrement(&f->FileInfoGeneration);
+}
+VOID fsp_fuse_intf_SetCachedFileInfo(struct fuse *f,
+    struct fsp_fuse_file_desc *filedesc, LONG Generation, const FSP_FSCTL_FILE_INFO *FileInfo);
+BOOLEAN fsp_fuse_intf_GetCachedFileInfo(struct fuse *f,
+    struct fsp_fuse_file_desc *filedesc, FSP_FSCTL_FILE_INFO *FileInfo);
+
 /* FUSE obj alloc/free */
 struct fsp_fuse_obj_hdr
 {
@@ -137,6 +218,54 @@ static inline struct fuse_context *fsp_fuse_get_context_internal(void)
     return TlsGetValue(fsp_fuse_tlskey);
 }
 
+/*
+ * Per thread scratch arena for memory that is only needed during an operation.
+ * Dispatcher threads get an arena in fsp_fuse_op_enter; it is reset in fsp_fuse_op_leave,
+ * so freeing arena memory is a no-op. Other threads and oversized requests use the heap.
+ */
+static inline PVOID fsp_fuse_arena_alloc(size_t Size)
+{
+    struct fuse_context *context = fsp_fuse_get_context_internal();
+    struct fsp_fuse_context_header *contexthdr;
+    PVOID Pointer;
+
+    if (0 != context)
+    {
+        contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
+        if (0 != contexthdr->ArenaBuf)
+        {
+            Size = FSP_FSCTL_DEFAULT_ALIGN_UP(Size);
+            if (FSP_FUSE_ARENA_SIZE - contexthdr->ArenaOffset >= Size)
+            {
+                Pointer = contexthdr->ArenaBuf + contexthdr->ArenaOffset;
+                contexthdr->ArenaOffset += (ULONG)Size;
+                if (contexthdr->ArenaHighWater < contexthdr->ArenaOffset)
+                    contexthdr->ArenaHighWater = contexthdr->ArenaOffset;
+                return Pointer;
+            }
+            contexthdr->ArenaOverflowCount++;
+        }
+    }
+
+    return MemAlloc(Size);
+}
+static inline VOID fsp_fuse_arena_free(PVOID Pointer)
+{
+    struct fuse_context *context = fsp_fuse_get_context_internal();
+    struct fsp_fuse_context_header *contexthdr;
+
+    if (0 != context)
+    {
+        contexthdr = FSP_FUSE_HDR_FROM_CONTEXT(context);
+        if (0 != contexthdr->ArenaBuf &&
+            contexthdr->ArenaBuf <= (PUINT8)Pointer &&
+            contexthdr->ArenaBuf + FSP_FUSE_ARENA_SIZE > (PUINT8)Pointer)
+            return;
+    }
+
+    MemFree(Pointer);
+}
+
 /* fsp_fuse_core_opt_parse */
 struct fsp_fuse_core_opt_data
 {
@@ -153,15 +282,20 @@ struct fsp_fuse_core_opt_data
         set_uidmap,
         set_attr_timeout, attr_timeout,
         rellinks,
-        dothidden;
+        dothidden,
+        hard_remove;
     int set_FileInfoTimeout,
         set_DirInfoTimeout,
         set_EaTimeout,
         set_VolumeInfoTimeout,
         set_KeepFileCache,
         set_FlushOnCleanup,
-        set_LegacyUnlinkRename;
-    unsigned ThreadCount;
+        set_LegacyUnlinkRename,
+        set_ShardedLocks,
+        set_GetattrOnWrite,
+        set_ReaddirGetattrThreads;
+    unsigned ThreadCount,
+        ReaddirGetattrThreads;
     FSP_FSCTL_VOLUME_PARAMS VolumeParams;
     UINT16 VolumeLabelLength;
     WCHAR VolumeLabel[sizeof ((FSP_FSCTL_VOLUME_INFO *)0)->VolumeLabel / sizeof(WCHAR)];
@@ -189,5 +323,7 @@ NTSTATUS fsp_fuse_get_token_uidgid(
     TOKEN_INFORMATION_CLASS UserOrOwnerClass, /* TokenUser|TokenOwner */
     PUINT32 PUid, PUINT32 PGid);
 extern FSP_FILE_SYSTEM_INTERFACE fsp_fuse_intf;
+NTSTATUS fsp_fuse_ll_probe(struct fuse *f);
+extern FSP_FILE_SYSTEM_INTERFACE fsp_fuse_ll_intf;
 
 #endif
@@ -314,6 +314,8 @@ static void *fuse2to3_init(struct fuse_conn_info *conn)
     conf3.uid = f->uid;
     conf3.set_mode = f->set_umask;
     conf3.umask = f->umask;
+    conf3.hard_remove = f->hard_remove;
+    conf3.nullpath_ok = f->nopath;
 #if 0
     /*
      * Cannot set timeouts because of lack of floating point support.
@@ -336,6 +338,10 @@ static void *fuse2to3_init(struct fuse_conn_info *conn)
 
     void *res = f3->ops.init(&conn3, &conf3);
 
+    /* FUSE3 nullpath_ok is FUSE2 flag_nopath (which implies flag_nullpath_ok) */
+    f->hard_remove = conf3.hard_remove;
+    f->nullpath_ok = f->nopath = conf3.nullpath_ok;
+
     conn->max_write = conn3.max_write;
     conn->max_readahead = conn3.max_readahead;
     conn->want = 0 != (conn3.want & FUSE_CAP_READDIRPLUS) ? FSP_FUSE_CAP_READDIR_PLUS : 0;
@@ -76,6 +76,8 @@ PWSTR FspSxsAppendSuffix(PWCHAR Buffer, SIZE_T Size, PWSTR Ident);
 PSID FspWksidNew(WELL_KNOWN_SID_TYPE WellKnownSidType, PNTSTATUS PResult);
 PSID FspWksidGet(WELL_KNOWN_SID_TYPE WellKnownSidType);
 
+BOOLEAN FspPosixReleaseSecurityDescriptor(PSECURITY_DESCRIPTOR SecurityDescriptor);
+
 NTSTATUS FspMountmgrCreateDrive(
     PUNICODE_STRING VolumeName, GUID *UniqueId, PUNICODE_STRING MountPoint);
 NTSTATUS FspMountmgrDeleteDrive(
@@ -121,6 +123,11 @@ VOID FspAdaptiveLockAcquire(
 VOID FspAdaptiveLockRelease(
     FSP_ADAPTIVE_LOCK *Lock);
 
+VOID FspFileSystemOpGuardShardedEnter(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_REQ *Request);
+VOID FspFileSystemOpGuardShardedLeave(FSP_FILE_SYSTEM *FileSystem,
+    FSP_FSCTL_TRANSACT_REQ *Request);
+
 #define FspFileSystemDirectoryBufferEntryInvalid ((ULONG)-1)
 VOID FspFileSystemPeekInDirectoryBuffer(PVOID *PDirBuffer,
     PUINT8 *PBuffer, PULONG *PIndex, PULONG PCount);
@@ -497,11 +497,17 @@ FSP_API VOID FspDeleteSecurityDescriptor(PSECURITY_DESCRIPTOR SecurityDescriptor
     if (0 == SecurityDescriptor)
         return;
 
-    if ((NTSTATUS (*)())FspAccessCheckEx == CreateFunc ||
-        (NTSTATUS (*)())FspPosixMapPermissionsToSecurityDescriptor == CreateFunc ||
-        (NTSTATUS (*)())FspPosixMergePermissionsToSecurityDescriptor == CreateFunc)
+    if ((NTSTATUS (*)())FspAccessCheckEx == CreateFunc)
         MemFree(SecurityDescriptor);
     else
+    if ((NTSTATUS (*)())FspPosixMapPermissionsToSecurityDescriptor == CreateFunc ||
+        (NTSTATUS (*)())FspPosixMergePermissionsToSecurityDescriptor == CreateFunc)
+    {
+        /* descriptors interned by the POSIX mapping are reference counted */
+        if (!FspPosixReleaseSecurityDescriptor(SecurityDescriptor))
+            MemFree(SecurityDescriptor);
+    }
+    else
     if ((NTSTATUS (*)())FspCreateSecurityDescriptor == CreateFunc ||
         (NTSTATUS (*)())FspSetSecurityDescriptor == CreateFunc)
         DestroyPrivateObjectSecurity(&SecurityDescriptor);
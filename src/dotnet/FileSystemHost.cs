@@ -207,6 +207,46 @@ namespace Fsp
             }
         }
         /// <summary>
+        /// Gets or sets the negative name lookup timeout (0 disables the negative name cache).
+        /// </summary>
+        public UInt32 NegativeNameTimeout
+        {
+            get { return _VolumeParams.NegativeNameTimeout; }
+            set { _VolumeParams.NegativeNameTimeout = value; }
+        }
+        /// <summary>
+        /// Gets or sets the size of the security cache in KiB (0 selects the default size).
+        /// </summary>
+        public UInt32 SecurityCacheSize
+        {
+            get { return _VolumeParams.SecurityCacheSize; }
+            set { _VolumeParams.SecurityCacheSize = value; }
+        }
+        /// <summary>
+        /// Gets or sets the size of the directory information cache in KiB (0 selects the default size).
+        /// </summary>
+        public UInt32 DirInfoCacheSize
+        {
+            get { return _VolumeParams.DirInfoCacheSize; }
+            set { _VolumeParams.DirInfoCacheSize = value; }
+        }
+        /// <summary>
+        /// Gets or sets the size of the stream information cache in KiB (0 selects the default size).
+        /// </summary>
+        public UInt32 StreamInfoCacheSize
+        {
+            get { return _VolumeParams.StreamInfoCacheSize; }
+            set { _VolumeParams.StreamInfoCacheSize = value; }
+        }
+        /// <summary>
+        /// Gets or sets the size of the EA cache in KiB (0 selects the default size).
+        /// </summary>
+        public UInt32 EaCacheSize
+        {
+            get { return _VolumeParams.EaCacheSize; }
+            set { _VolumeParams.EaCacheSize = value; }
+        }
+        /// <summary>
         /// Gets or sets a value that determines whether the file system is case sensitive.
         /// </summary>
         public Boolean CaseSensitiveSearch
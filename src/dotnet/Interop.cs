@@ -86,8 +86,11 @@ namespace Fsp.Interop
         internal UInt32 StreamInfoTimeout;
         internal UInt32 EaTimeout;
         internal UInt32 FsextControlCode;
-        internal unsafe fixed UInt32 Reserved32[1];
-        internal unsafe fixed UInt64 Reserved64[2];
+        internal UInt32 NegativeNameTimeout;
+        internal UInt32 SecurityCacheSize;
+        internal UInt32 DirInfoCacheSize;
+        internal UInt32 StreamInfoCacheSize;
+        internal UInt32 EaCacheSize;
 
         internal unsafe String GetPrefix()
         {
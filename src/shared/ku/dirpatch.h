@@ -0,0 +1,241 @@
+/**
+ * @file shared/ku/dirpatch.h
+ *
+ * Incremental maintenance of cached directory listings.
+ *
+ * @copyright 2015-2026 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this software
+ * in accordance with the commercial license agreement provided in
+ * conjunction with the software.  The terms and conditions of any such
+ * commercial license agreement shall govern, supersede, and render
+ * ineffective any application of the GPLv3 license to this software,
+ * notwithstanding of any reference thereto in the software or
+ * associated repository.
+ */
+
+#ifndef WINFSP_SHARED_KU_DIRPATCH_H_INCLUDED
+#define WINFSP_SHARED_KU_DIRPATCH_H_INCLUDED
+
+/*
+ * A DirInfo buffer is a sequence of FSP_FSCTL_DIR_INFO entries (each aligned to
+ * FSP_FSCTL_DEFAULT_ALIGNMENT) exactly as the user mode file system returned it
+ * to a query without a pattern or marker. If the listing is complete it ends in
+ * an entry with a zero Size; otherwise the FSD resumes the enumeration in user
+ * mode after the name of the last entry.
+ *
+ * A DirInfo patch removes up to two entries from such a buffer and inserts at
+ * most one, so that a single create, delete or rename can be applied to a cached
+ * listing instead of discarding it:
+ *
+ * - The entries (other than "." and "..", which are left alone) must be strictly
+ *   ascending under the volume collation: ordinal on names folded through Upcase
+ *   on case-insensitive file systems, plain ordinal otherwise. File systems that
+ *   return their listings in any other order are not patched; neither are
+ *   malformed buffers. FspDirInfoPatchPrepare fails and the caller discards the
+ *   buffer as before.
+ * - The removed name is looked up by (folded) name; if it is not there nothing is
+ *   removed. An inserted name that is already there replaces that entry.
+ * - An inserted name that sorts after the last entry of an incomplete listing is
+ *   not inserted: the enumeration that resumes in user mode will report it.
+ *
+ * Cached buffers are shared and immutable, so a patch is applied by copying: the
+ * caller prepares the patch, allocates Patch->NewSize bytes and applies the patch
+ * into the new buffer. The patch functions do not allocate memory or take locks.
+ * They only depend on the VOID, BOOLEAN, UINT8, UINT16, UINT32 and WCHAR types,
+ * memcpy/memset and the FSP_FSCTL_DIR_INFO definitions so that they can be built
+ * and exercised outside the kernel (see tst/dirpatch).
+ */
+
+typedef struct
+{
+    UINT32 RemoveOffset[2], RemoveSize[2];  /* RemoveSize == 0: nothing to remove */
+    UINT32 InsertOffset, InsertSize;        /* InsertSize == 0: nothing to insert */
+    UINT32 NewSize;
+} FSP_DIRINFO_PATCH;
+
+static inline int FspDirInfoPatchCompare(
+    const WCHAR *Name0, UINT32 Length0, const WCHAR *Name1, UINT32 Length1,
+    WCHAR (*Upcase)(WCHAR))
+{
+    UINT32 Length = Length0 < Length1 ? Length0 : Length1;
+    WCHAR C0, C1;
+
+    for (UINT32 I = 0; Length > I; I++)
+    {
+        C0 = 0 != Upcase ? Upcase(Name0[I]) : Name0[I];
+        C1 = 0 != Upcase ? Upcase(Name1[I]) : Name1[I];
+        if (C0 != C1)
+            return C0 < C1 ? -1 : +1;
+    }
+
+    return Length0 == Length1 ? 0 : (Length0 < Length1 ? -1 : +1);
+}
+
+static inline BOOLEAN FspDirInfoPatchIsDots(const WCHAR *Name, UINT32 Length)
+{
+    return (1 == Length && '.' == Name[0]) ||
+        (2 == Length && '.' == Name[0] && '.' == Name[1]);
+}
+
+static inline UINT32 FspDirInfoPatchEntrySize(UINT32 Length)
+{
+    return (UINT32)FSP_FSCTL_DEFAULT_ALIGN_UP(sizeof(FSP_FSCTL_DIR_INFO) + Length * sizeof(WCHAR));
+}
+
+static inline BOOLEAN FspDirInfoPatchPrepare(
+    const VOID *Buffer, UINT32 Size,
+    const WCHAR *RemoveName, UINT32 RemoveLength,
+    const WCHAR *InsertName, UINT32 InsertLength,
+    WCHAR (*Upcase)(WCHAR),
+    FSP_DIRINFO_PATCH *Patch)
+{
+    /* RemoveName == 0: nothing to remove; InsertName == 0: nothing to insert */
+    const FSP_FSCTL_DIR_INFO *DirInfo;
+    const WCHAR *Name, *PrevName = 0;
+    UINT32 Offset, EntrySize, AlignedSize, Length, PrevLength = 0;
+    BOOLEAN Complete = 0, Inserting = 0 != InsertName;
+    int Comparison;
+
+    memset(Patch, 0, sizeof *Patch);
+
+    if (0 != InsertName &&
+        (0 == InsertLength || 0xffff < sizeof(FSP_FSCTL_DIR_INFO) + InsertLength * sizeof(WCHAR)))
+        return 0;
+
+    for (Offset = 0; Size >= Offset + sizeof(UINT16); Offset += AlignedSize)
+    {
+        DirInfo = (const FSP_FSCTL_DIR_INFO *)((const UINT8 *)Buffer + Offset);
+        EntrySize = DirInfo->Size;
+        if (sizeof(FSP_FSCTL_DIR_INFO) > EntrySize)
+        {
+            if (0 != EntrySize)
+                return 0;
+            Complete = 1;
+            break;
+        }
+        if (Size - Offset < EntrySize || 0 != (EntrySize - sizeof(FSP_FSCTL_DIR_INFO)) % sizeof(WCHAR))
+            return 0;
+
+        /* the last entry of an incomplete listing may lack its padding */
+        AlignedSize = (UINT32)FSP_FSCTL_DEFAULT_ALIGN_UP(EntrySize);
+        if (Size - Offset < AlignedSize)
+            AlignedSize = Size - Offset;
+
+        Name = DirInfo->FileNameBuf;
+        Length = (EntrySize - sizeof(FSP_FSCTL_DIR_INFO)) / sizeof(WCHAR);
+        if (FspDirInfoPatchIsDots(Name, Length))
+            continue;
+
+        if (0 != PrevName && 0 <= FspDirInfoPatchCompare(PrevName, PrevLength, Name, Length, Upcase))
+            return 0;
+        PrevName = Name;
+        PrevLength = Length;
+
+        if (0 != RemoveName && 0 == Patch->RemoveSize[0] &&
+            0 == FspDirInfoPatchCompare(Name, Length, RemoveName, RemoveLength, Upcase))
+        {
+            Patch->RemoveOffset[0] = Offset;
+            Patch->RemoveSize[0] = AlignedSize;
+        }
+
+        if (Inserting)
+        {
+            Comparison = FspDirInfoPatchCompare(InsertName, InsertLength, Name, Length, Upcase);
+            if (0 >= Comparison)
+            {
+                Patch->InsertOffset = Offset;
+                Patch->InsertSize = FspDirInfoPatchEntrySize(InsertLength);
+                Inserting = 0;
+            }
+            if (0 == Comparison && (0 == Patch->RemoveSize[0] || Patch->RemoveOffset[0] != Offset))
+            {
+                /* replace the existing entry (unless it is also the removed one) */
+                Patch->RemoveOffset[1] = Offset;
+                Patch->RemoveSize[1] = AlignedSize;
+            }
+        }
+    }
+
+    if (Inserting && Complete)
+    {
+        Patch->InsertOffset = Offset;
+        Patch->InsertSize = FspDirInfoPatchEntrySize(InsertLength);
+    }
+
+    Patch->NewSize = Size -
+        Patch->RemoveSize[0] - Patch->RemoveSize[1] + Patch->InsertSize;
+
+    return 1;
+}
+
+static inline BOOLEAN FspDirInfoPatchIsEmpty(FSP_DIRINFO_PATCH *Patch)
+{
+    return 0 == Patch->RemoveSize[0] && 0 == Patch->RemoveSize[1] && 0 == Patch->InsertSize;
+}
+
+static inline VOID FspDirInfoPatchApply(
+    const VOID *Buffer, UINT32 Size,
+    const WCHAR *InsertName, UINT32 InsertLength, const FSP_FSCTL_FILE_INFO *InsertFileInfo,
+    FSP_DIRINFO_PATCH *Patch,
+    VOID *NewBuffer)
+{
+    /* edits in buffer order; an insert goes before an entry that it replaces */
+    struct { UINT32 Offset, RemoveSize; } Edits[3], Edit;
+    UINT32 EditCount = 0, Src = 0, Dst = 0;
+    FSP_FSCTL_DIR_INFO *DirInfo;
+
+    if (0 != Patch->InsertSize)
+    {
+        Edits[EditCount].Offset = Patch->InsertOffset;
+        Edits[EditCount].RemoveSize = 0;
+        EditCount++;
+    }
+    for (UINT32 I = 0; 2 > I; I++)
+        if (0 != Patch->RemoveSize[I])
+        {
+            Edits[EditCount].Offset = Patch->RemoveOffset[I];
+            Edits[EditCount].RemoveSize = Patch->RemoveSize[I];
+            EditCount++;
+        }
+    for (UINT32 I = 1; EditCount > I; I++)
+        for (UINT32 J = I; 0 < J &&
+            (Edits[J - 1].Offset > Edits[J].Offset ||
+                (Edits[J - 1].Offset == Edits[J].Offset && 0 != Edits[J - 1].RemoveSize));
+            J--)
+        {
+            Edit = Edits[J - 1];
+            Edits[J - 1] = Edits[J];
+            Edits[J] = Edit;
+        }
+
+    for (UINT32 I = 0; EditCount > I; I++)
+    {
+        memcpy((UINT8 *)NewBuffer + Dst, (const UINT8 *)Buffer + Src, Edits[I].Offset - Src);
+        Dst += Edits[I].Offset - Src;
+        Src = Edits[I].Offset;
+
+        if (0 == Edits[I].RemoveSize)
+        {
+            DirInfo = (FSP_FSCTL_DIR_INFO *)((UINT8 *)NewBuffer + Dst);
+            memset(DirInfo, 0, Patch->InsertSize);
+            DirInfo->Size = (UINT16)(sizeof(FSP_FSCTL_DIR_INFO) + InsertLength * sizeof(WCHAR));
+            DirInfo->FileInfo = *InsertFileInfo;
+            memcpy(DirInfo->FileNameBuf, InsertName, InsertLength * sizeof(WCHAR));
+            Dst += Patch->InsertSize;
+        }
+        else
+            Src += Edits[I].RemoveSize;
+    }
+
+    memcpy((UINT8 *)NewBuffer + Dst, (const UINT8 *)Buffer + Src, Size - Src);
+}
+
+#endif
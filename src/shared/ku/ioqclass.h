@@ -0,0 +1,137 @@
+/**
+ * @file shared/ku/ioqclass.h
+ *
+ * Priority classes of the FSP_IOQ pending queue.
+ *
+ * @copyright 2015-2026 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this software
+ * in accordance with the commercial license agreement provided in
+ * conjunction with the software.  The terms and conditions of any such
+ * commercial license agreement shall govern, supersede, and render
+ * ineffective any application of the GPLv3 license to this software,
+ * notwithstanding of any reference thereto in the software or
+ * associated repository.
+ */
+
+#ifndef WINFSP_SHARED_KU_IOQCLASS_H_INCLUDED
+#define WINFSP_SHARED_KU_IOQCLASS_H_INCLUDED
+
+/*
+ * Every pending IRP belongs to one of FspFsctlIoqClassCount priority classes
+ * (see FspFsctlIoqClass* in winfsp/fsctl.h) and each class is a FIFO of its own:
+ *
+ * - Metadata: create, cleanup, information, EA, security, volume and other
+ *   control requests; the requests that a user is most likely waiting for.
+ * - Interactive: non-paging read/write and directory enumeration.
+ * - Paging: paging read/write and flushes.
+ * - Background: close requests (which nobody waits for) and any request issued
+ *   with an I/O priority hint below normal.
+ *
+ * The classes are served by weighted round robin. Every round grants each class
+ * FspIoqClassWeight credits; a pick takes the lowest numbered ready class that
+ * still has credit and charges it one credit. When no ready class has credit
+ * left a new round begins. So when every class is backlogged they are served in
+ * the proportion of their weights (8:4:2:1), an idle class does not accumulate
+ * credit and no class waits longer than one round (the sum of the weights) once
+ * it is ready.
+ *
+ * A pending IRP also carries a stamp: the time that it was posted (microseconds,
+ * modulo 2^30, i.e. about 17 minutes) and its class in the two low bits. The
+ * stamp gives the pending wait time without a separate allocation.
+ *
+ * These functions do not take locks; the caller serializes access to the
+ * scheduler state. They only depend on the BOOLEAN, UINT8 and UINT32 types and
+ * the winfsp/fsctl.h definitions so that they can be built and exercised outside
+ * the kernel (see tst/ioqclass).
+ */
+
+typedef struct
+{
+    UINT8 Credit[FspFsctlIoqClassCount];
+} FSP_IOQ_CLASS_SCHED;
+FSP_FSCTL_STATIC_ASSERT(4 >= FspFsctlIoqClassCount,
+    "FspFsctlIoqClassCount must fit in the two low bits of a stamp.");
+
+static inline UINT32 FspIoqClassWeight(UINT32 Class)
+{
+    static const UINT8 Weights[FspFsctlIoqClassCount] =
+    {
+        8,                              /* FspFsctlIoqClassMetadata */
+        4,                              /* FspFsctlIoqClassInteractive */
+        2,                              /* FspFsctlIoqClassPaging */
+        1,                              /* FspFsctlIoqClassBackground */
+    };
+    return Weights[Class];
+}
+
+static inline UINT32 FspIoqClassFromKind(UINT32 Kind, BOOLEAN PagingIo, BOOLEAN LowPriority)
+{
+    if (LowPriority)
+        return FspFsctlIoqClassBackground;
+    switch (Kind)
+    {
+    case FspFsctlTransactReadKind:
+    case FspFsctlTransactWriteKind:
+        return PagingIo ? FspFsctlIoqClassPaging : FspFsctlIoqClassInteractive;
+    case FspFsctlTransactQueryDirectoryKind:
+        return FspFsctlIoqClassInteractive;
+    case FspFsctlTransactFlushBuffersKind:
+        return FspFsctlIoqClassPaging;
+    case FspFsctlTransactCloseKind:
+        return FspFsctlIoqClassBackground;
+    default:
+        return FspFsctlIoqClassMetadata;
+    }
+}
+
+static inline UINT32 FspIoqClassPick(FSP_IOQ_CLASS_SCHED *Sched, UINT32 ReadyMask)
+{
+    /*
+     * ReadyMask has bit (1 << Class) set for every class that has an IRP that may
+     * be removed. Returns FspFsctlIoqClassCount if there is none.
+     */
+    UINT32 Class;
+
+    if (0 == ReadyMask)
+        return FspFsctlIoqClassCount;
+
+    for (Class = 0; FspFsctlIoqClassCount > Class; Class++)
+        if (0 != (ReadyMask & (1 << Class)) && 0 != Sched->Credit[Class])
+            goto charge;
+
+    /* every ready class has used up its credit: begin a new round */
+    for (Class = 0; FspFsctlIoqClassCount > Class; Class++)
+        Sched->Credit[Class] = (UINT8)FspIoqClassWeight(Class);
+    for (Class = 0; 0 == (ReadyMask & (1 << Class)); Class++)
+        ;
+
+charge:
+    Sched->Credit[Class]--;
+    return Class;
+}
+
+static inline UINT32 FspIoqClassStamp(UINT32 TimeUs, UINT32 Class)
+{
+    return (TimeUs << 2) | Class;
+}
+
+static inline UINT32 FspIoqClassOfStamp(UINT32 Stamp)
+{
+    return Stamp & 3;
+}
+
+static inline UINT32 FspIoqClassWaitTime(UINT32 Stamp, UINT32 TimeUs)
+{
+    /* microseconds between the stamp and TimeUs; correct for waits under 2^30 us */
+    return ((TimeUs << 2) - (Stamp & ~3U)) >> 2;
+}
+
+#endif
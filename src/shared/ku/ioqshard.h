@@ -0,0 +1,89 @@
+/**
+ * @file shared/ku/ioqshard.h
+ *
+ * Sharding of the FSP_IOQ pending queue.
+ *
+ * @copyright 2015-2026 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this software
+ * in accordance with the commercial license agreement provided in
+ * conjunction with the software.  The terms and conditions of any such
+ * commercial license agreement shall govern, supersede, and render
+ * ineffective any application of the GPLv3 license to this software,
+ * notwithstanding of any reference thereto in the software or
+ * associated repository.
+ */
+
+#ifndef WINFSP_SHARED_KU_IOQSHARD_H_INCLUDED
+#define WINFSP_SHARED_KU_IOQSHARD_H_INCLUDED
+
+/*
+ * The pending queue of an FSP_IOQ is split into shards, one per processor (up to
+ * FSP_IOQ_SHARD_COUNT_MAX), each with its own lock, list and count:
+ *
+ * - An IRP is posted to the shard of the processor that posts it (its "home"
+ *   shard). Cancelation and expiration operate on the shard that holds the IRP
+ *   (or on every shard) and are otherwise unchanged.
+ * - A shard sets its bit in the non-empty mask when its count goes from 0 to 1
+ *   and clears it when its count goes back to 0; both under the shard lock, so
+ *   the bit agrees with the count whenever the lock is free.
+ * - A transacting thread looks for work in its home shard first and then steals
+ *   from the other shards in cyclic order, but only locks shards whose bit it
+ *   finds set. An idle thread therefore does not touch the locks (or the cache
+ *   lines) of empty shards.
+ * - A single queue-wide count and wake-up event remain: the count is maintained
+ *   with interlocked operations (it is the capacity and watermark measure); the
+ *   event is set on every insert and by every remove that leaves the count
+ *   non-zero, so a wake-up that finds its IRP taken by a stealer is passed on.
+ *
+ * The functions here only compute shard indexes; the caller owns the shards and
+ * the mask. They only depend on the UINT8, UINT32 and UINT64 types so that they
+ * can be built and exercised outside the kernel (see tst/ioqshard).
+ */
+
+#define FSP_IOQ_SHARD_COUNT_MAX         64      /* one bit per shard in a UINT64 mask */
+
+static inline UINT32 FspIoqShardCount(UINT32 ProcessorCount)
+{
+    return 0 == ProcessorCount ? 1 :
+        (FSP_IOQ_SHARD_COUNT_MAX < ProcessorCount ? FSP_IOQ_SHARD_COUNT_MAX : ProcessorCount);
+}
+
+static inline UINT32 FspIoqShardHome(UINT32 ProcessorNumber, UINT32 ShardCount)
+{
+    return ProcessorNumber % ShardCount;
+}
+
+static inline UINT64 FspIoqShardBit(UINT32 Index)
+{
+    return (UINT64)1 << Index;
+}
+
+static inline UINT32 FspIoqShardLowestBit(UINT64 Mask)
+{
+    /* index of the lowest set bit; Mask must not be 0 */
+    static const UINT8 DeBruijnIndex[64] =
+    {
+         0,  1, 48,  2, 57, 49, 28,  3, 61, 58, 50, 42, 38, 29, 17,  4,
+        62, 55, 59, 36, 53, 51, 43, 22, 45, 39, 33, 30, 24, 18, 12,  5,
+        63, 47, 56, 27, 60, 41, 37, 16, 54, 35, 52, 21, 44, 32, 23, 11,
+        46, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19,  9, 13,  8,  7,  6,
+    };
+    return DeBruijnIndex[((Mask & (0 - Mask)) * 0x03f79d71b4cb0a89ULL) >> 58];
+}
+
+static inline UINT32 FspIoqShardNext(UINT64 Mask, UINT32 Home)
+{
+    /* first shard at or after Home (cyclically) that is set in Mask; Mask must not be 0 */
+    UINT64 Above = Mask & (~(UINT64)0 << Home);
+    return FspIoqShardLowestBit(0 != Above ? Above : Mask);
+}
+
+#endif
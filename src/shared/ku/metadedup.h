@@ -0,0 +1,129 @@
+/**
+ * @file shared/ku/metadedup.h
+ *
+ * Meta cache content deduplication table.
+ *
+ * @copyright 2015-2026 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this software
+ * in accordance with the commercial license agreement provided in
+ * conjunction with the software.  The terms and conditions of any such
+ * commercial license agreement shall govern, supersede, and render
+ * ineffective any application of the GPLv3 license to this software,
+ * notwithstanding of any reference thereto in the software or
+ * associated repository.
+ */
+
+#ifndef WINFSP_SHARED_KU_METADEDUP_H_INCLUDED
+#define WINFSP_SHARED_KU_METADEDUP_H_INCLUDED
+
+/*
+ * A dedup table interns immutable byte buffers by content, so that many users
+ * of identical content (e.g. thousands of files that share a few security
+ * descriptors) can share a single copy.
+ *
+ * The caller embeds an FSP_META_DEDUP_ENTRY in each buffer header; the content
+ * is found DataOffset bytes after the entry. The table does not allocate memory,
+ * take locks or keep reference counts: the caller supplies the bucket array,
+ * serializes all calls and decides when an entry is dead. Because an entry may
+ * be dying (its last reference dropped, but not yet removed), lookups can be
+ * continued past an entry that the caller cannot use.
+ *
+ * It only depends on the VOID, BOOLEAN, UINT8, UINT32 and UINT64 types so that
+ * it can be built and exercised outside the kernel (see tst/metadedup).
+ */
+
+typedef struct _FSP_META_DEDUP_ENTRY
+{
+    struct _FSP_META_DEDUP_ENTRY *Next;
+    UINT32 Size;
+} FSP_META_DEDUP_ENTRY;
+typedef struct
+{
+    FSP_META_DEDUP_ENTRY **Buckets;
+    UINT32 BucketCount;                 /* power of 2 */
+    UINT32 DataOffset;                  /* from entry to content */
+    UINT64 EntryCount, EntryBytes;
+} FSP_META_DEDUP_TABLE;
+
+static inline UINT32 FspMetaDedupHash(const VOID *Data, UINT32 Size)
+{
+    /* FNV-1a */
+    const UINT8 *P = (const UINT8 *)Data, *EndP = P + Size;
+    UINT32 Hash = 2166136261;
+    for (; EndP > P; P++)
+        Hash = (Hash ^ *P) * 16777619;
+    return Hash;
+}
+
+static inline const UINT8 *FspMetaDedupData(FSP_META_DEDUP_TABLE *Table, FSP_META_DEDUP_ENTRY *Entry)
+{
+    return (const UINT8 *)Entry + Table->DataOffset;
+}
+
+static inline BOOLEAN FspMetaDedupEqual(const VOID *Data0, const VOID *Data1, UINT32 Size)
+{
+    const UINT8 *P0 = (const UINT8 *)Data0, *P1 = (const UINT8 *)Data1;
+    for (UINT32 I = 0; Size > I; I++)
+        if (P0[I] != P1[I])
+            return 0;
+    return 1;
+}
+
+static inline VOID FspMetaDedupInitialize(FSP_META_DEDUP_TABLE *Table,
+    FSP_META_DEDUP_ENTRY **Buckets, UINT32 BucketCount, UINT32 DataOffset)
+{
+    for (UINT32 I = 0; BucketCount > I; I++)
+        Buckets[I] = 0;
+    Table->Buckets = Buckets;
+    Table->BucketCount = BucketCount;
+    Table->DataOffset = DataOffset;
+    Table->EntryCount = Table->EntryBytes = 0;
+}
+
+static inline FSP_META_DEDUP_ENTRY *FspMetaDedupLookup(FSP_META_DEDUP_TABLE *Table,
+    UINT32 Hash, const VOID *Data, UINT32 Size, FSP_META_DEDUP_ENTRY *After)
+{
+    /* return the first entry with matching content (after the After entry if not 0) */
+    FSP_META_DEDUP_ENTRY *Entry = 0 != After ?
+        After->Next : Table->Buckets[Hash & (Table->BucketCount - 1)];
+    for (; 0 != Entry; Entry = Entry->Next)
+        if (Entry->Size == Size && FspMetaDedupEqual(FspMetaDedupData(Table, Entry), Data, Size))
+            return Entry;
+    return 0;
+}
+
+static inline VOID FspMetaDedupInsert(FSP_META_DEDUP_TABLE *Table,
+    UINT32 Hash, FSP_META_DEDUP_ENTRY *Entry, UINT32 Size)
+{
+    FSP_META_DEDUP_ENTRY **Bucket = &Table->Buckets[Hash & (Table->BucketCount - 1)];
+    Entry->Size = Size;
+    Entry->Next = *Bucket;
+    *Bucket = Entry;
+    Table->EntryCount++;
+    Table->EntryBytes += Size;
+}
+
+static inline VOID FspMetaDedupRemove(FSP_META_DEDUP_TABLE *Table, FSP_META_DEDUP_ENTRY *Entry)
+{
+    /* the hash is not stored; recompute it from the (immutable) content */
+    UINT32 Hash = FspMetaDedupHash(FspMetaDedupData(Table, Entry), Entry->Size);
+    for (FSP_META_DEDUP_ENTRY **P = &Table->Buckets[Hash & (Table->BucketCount - 1)]; *P; P = &(*P)->Next)
+        if (*P == Entry)
+        {
+            *P = Entry->Next;
+            Entry->Next = 0;
+            Table->EntryCount--;
+            Table->EntryBytes -= Entry->Size;
+            break;
+        }
+}
+
+#endif
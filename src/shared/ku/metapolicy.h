@@ -0,0 +1,226 @@
+/**
+ * @file shared/ku/metapolicy.h
+ *
+ * Meta cache replacement policy.
+ *
+ * @copyright 2015-2026 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this software
+ * in accordance with the commercial license agreement provided in
+ * conjunction with the software.  The terms and conditions of any such
+ * commercial license agreement shall govern, supersede, and render
+ * ineffective any application of the GPLv3 license to this software,
+ * notwithstanding of any reference thereto in the software or
+ * associated repository.
+ */
+
+#ifndef WINFSP_SHARED_KU_METAPOLICY_H_INCLUDED
+#define WINFSP_SHARED_KU_METAPOLICY_H_INCLUDED
+
+/*
+ * The meta cache replacement policy is a byte-budgeted segmented CLOCK with two
+ * segments in the spirit of ARC and CLOCK-Pro:
+ *
+ * - New items enter the probationary segment.
+ * - An item is marked as referenced when it is referenced again after at least
+ *   one other item has been inserted since it was last referenced. This is a
+ *   crude measure of reuse distance: the back-to-back references that a single
+ *   directory enumeration makes to its own DirInfo buffer do not count, whereas
+ *   a later re-reference does.
+ * - Referenced items found at the old end of the probationary segment while
+ *   looking for a victim are promoted to the protected segment instead.
+ * - The protected segment is limited to a fraction of the budget; when it
+ *   overflows, its oldest unreferenced items are demoted to the probationary
+ *   segment (referenced ones get a second chance).
+ * - Victims are taken from the old end of the probationary segment first. A
+ *   sweep such as "dir /s" therefore only cycles through the probationary
+ *   segment and leaves the protected (hot) items alone.
+ *
+ * Unlike ARC and CLOCK-Pro there are no ghost (non-resident) entries: meta cache
+ * items are identified by an index that is never reused, so an item that comes
+ * back after eviction cannot be recognized as such.
+ *
+ * The policy does not allocate memory or take locks; the caller embeds an
+ * FSP_META_POLICY_ENTRY in each of its items and serializes all calls except
+ * for FspMetaPolicyReference, which only marks the entry and may be called
+ * concurrently with anything (it races benignly with the sweep). It only
+ * depends on the VOID, BOOLEAN, UINT32 and UINT64 types so that it can be built
+ * and exercised outside the kernel (see tst/metasim).
+ */
+
+#define FSP_META_POLICY_PROTECTED_PERCENT   75
+
+typedef struct _FSP_META_POLICY_ENTRY
+{
+    struct _FSP_META_POLICY_ENTRY *Prev, *Next;
+    volatile UINT32 AccessClock;
+    volatile UINT32 Referenced;
+    UINT32 Size;
+    UINT32 Protected;
+} FSP_META_POLICY_ENTRY;
+typedef struct
+{
+    FSP_META_POLICY_ENTRY Probation, Protected;     /* list heads (oldest at Next) */
+    UINT64 Budget, ProtectedBudget;
+    UINT64 ProbationSize, ProtectedSize;
+    volatile UINT32 InsertClock;
+    UINT64 EvictionCount, PromotionCount;
+} FSP_META_POLICY;
+
+static inline VOID FspMetaPolicyListInitialize(FSP_META_POLICY_ENTRY *Head)
+{
+    Head->Prev = Head->Next = Head;
+}
+
+static inline BOOLEAN FspMetaPolicyListIsEmpty(FSP_META_POLICY_ENTRY *Head)
+{
+    return Head->Next == Head;
+}
+
+static inline VOID FspMetaPolicyListRemove(FSP_META_POLICY_ENTRY *Entry)
+{
+    Entry->Prev->Next = Entry->Next;
+    Entry->Next->Prev = Entry->Prev;
+    Entry->Prev = Entry->Next = Entry;
+}
+
+static inline VOID FspMetaPolicyListInsertTail(FSP_META_POLICY_ENTRY *Head, FSP_META_POLICY_ENTRY *Entry)
+{
+    Entry->Prev = Head->Prev;
+    Entry->Next = Head;
+    Head->Prev->Next = Entry;
+    Head->Prev = Entry;
+}
+
+static inline VOID FspMetaPolicyInitialize(FSP_META_POLICY *Policy, UINT64 Budget)
+{
+    FspMetaPolicyListInitialize(&Policy->Probation);
+    FspMetaPolicyListInitialize(&Policy->Protected);
+    Policy->Budget = Budget;
+    Policy->ProtectedBudget = Budget / 100 * FSP_META_POLICY_PROTECTED_PERCENT;
+    Policy->ProbationSize = Policy->ProtectedSize = 0;
+    Policy->InsertClock = 0;
+    Policy->EvictionCount = Policy->PromotionCount = 0;
+}
+
+static inline UINT64 FspMetaPolicySize(FSP_META_POLICY *Policy)
+{
+    return Policy->ProbationSize + Policy->ProtectedSize;
+}
+
+static inline BOOLEAN FspMetaPolicyMustEvict(FSP_META_POLICY *Policy, UINT32 Size)
+{
+    /* must evict before an item of Size can be inserted? */
+    return FspMetaPolicySize(Policy) + Size > Policy->Budget &&
+        0 != FspMetaPolicySize(Policy);
+}
+
+static inline VOID FspMetaPolicyInsert(FSP_META_POLICY *Policy, FSP_META_POLICY_ENTRY *Entry,
+    UINT32 Size)
+{
+    Policy->InsertClock++;
+    Entry->AccessClock = Policy->InsertClock;
+    Entry->Referenced = 0;
+    Entry->Size = Size;
+    Entry->Protected = 0;
+    FspMetaPolicyListInsertTail(&Policy->Probation, Entry);
+    Policy->ProbationSize += Size;
+}
+
+static inline VOID FspMetaPolicyRemove(FSP_META_POLICY *Policy, FSP_META_POLICY_ENTRY *Entry)
+{
+    FspMetaPolicyListRemove(Entry);
+    if (Entry->Protected)
+        Policy->ProtectedSize -= Entry->Size;
+    else
+        Policy->ProbationSize -= Entry->Size;
+}
+
+static inline VOID FspMetaPolicyEvict(FSP_META_POLICY *Policy, FSP_META_POLICY_ENTRY *Entry)
+{
+    FspMetaPolicyRemove(Policy, Entry);
+    Policy->EvictionCount++;
+}
+
+static inline VOID FspMetaPolicyReference(FSP_META_POLICY *Policy, FSP_META_POLICY_ENTRY *Entry)
+{
+    /* may be called without serialization; only writes to Entry and only when needed */
+    UINT32 InsertClock = Policy->InsertClock;
+
+    if (Entry->AccessClock != InsertClock)
+    {
+        Entry->AccessClock = InsertClock;
+        Entry->Referenced = 1;
+    }
+}
+
+static inline VOID FspMetaPolicyRotate(FSP_META_POLICY_ENTRY *Head, FSP_META_POLICY_ENTRY *Entry)
+{
+    /* second chance: move to the new end of its segment */
+    Entry->Referenced = 0;
+    FspMetaPolicyListRemove(Entry);
+    FspMetaPolicyListInsertTail(Head, Entry);
+}
+
+static inline VOID FspMetaPolicyPromote(FSP_META_POLICY *Policy, FSP_META_POLICY_ENTRY *Entry)
+{
+    FSP_META_POLICY_ENTRY *Demoted;
+
+    FspMetaPolicyListRemove(Entry);
+    Policy->ProbationSize -= Entry->Size;
+    Entry->Referenced = 0;
+    Entry->Protected = 1;
+    FspMetaPolicyListInsertTail(&Policy->Protected, Entry);
+    Policy->ProtectedSize += Entry->Size;
+    Policy->PromotionCount++;
+
+    while (Policy->ProtectedSize > Policy->ProtectedBudget &&
+        Policy->Protected.Next != Entry)
+    {
+        Demoted = Policy->Protected.Next;
+        if (Demoted->Referenced)
+        {
+            FspMetaPolicyRotate(&Policy->Protected, Demoted);
+            continue;
+        }
+        FspMetaPolicyListRemove(Demoted);
+        Policy->ProtectedSize -= Demoted->Size;
+        Demoted->Protected = 0;
+        Demoted->AccessClock = Policy->InsertClock;
+        FspMetaPolicyListInsertTail(&Policy->Probation, Demoted);
+        Policy->ProbationSize += Demoted->Size;
+    }
+}
+
+static inline FSP_META_POLICY_ENTRY *FspMetaPolicyVictim(FSP_META_POLICY *Policy)
+{
+    /* the caller removes the victim with FspMetaPolicyEvict */
+    FSP_META_POLICY_ENTRY *Entry;
+
+    while (!FspMetaPolicyListIsEmpty(&Policy->Probation))
+    {
+        Entry = Policy->Probation.Next;
+        if (!Entry->Referenced)
+            return Entry;
+        FspMetaPolicyPromote(Policy, Entry);
+    }
+
+    while (!FspMetaPolicyListIsEmpty(&Policy->Protected))
+    {
+        Entry = Policy->Protected.Next;
+        if (!Entry->Referenced)
+            return Entry;
+        FspMetaPolicyRotate(&Policy->Protected, Entry);
+    }
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,310 @@
+/**
+ * @file shared/ku/negname.h
+ *
+ * Negative name lookup table.
+ *
+ * @copyright 2015-2026 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this software
+ * in accordance with the commercial license agreement provided in
+ * conjunction with the software.  The terms and conditions of any such
+ * commercial license agreement shall govern, supersede, and render
+ * ineffective any application of the GPLv3 license to this software,
+ * notwithstanding of any reference thereto in the software or
+ * associated repository.
+ */
+
+#ifndef WINFSP_SHARED_KU_NEGNAME_H_INCLUDED
+#define WINFSP_SHARED_KU_NEGNAME_H_INCLUDED
+
+/*
+ * A negative name table remembers file names that the user mode file system has
+ * recently reported as non-existent, so that repeated probes for them (PATH
+ * searches, DLL probing, .git lookups) can be failed without a round trip.
+ *
+ * An entry is keyed by the normalized path of its parent directory followed by
+ * its name, i.e. by its full path (without a stream part or trailing backslash).
+ * Names are stored folded through the Upcase function on case-insensitive file
+ * systems. The rules for keeping the table coherent are:
+ *
+ * - A name that comes into existence (created) invalidates exactly that name.
+ * - A name that appears by other means (renamed into place, or reported by the
+ *   user mode file system) invalidates the name and everything below it, i.e.
+ *   Name, Name\* and Name:*. A directory that is renamed into place may bring
+ *   any number of children with it.
+ * - Every invalidation increments the table generation. The caller records the
+ *   generation before it asks the user mode file system about a name and passes
+ *   it back when it inserts the negative answer; an insert with a stale generation
+ *   is rejected, because the answer may predate a concurrent creation.
+ * - Entries expire a fixed time after insertion. Because the timeout is the same
+ *   for all entries, the insertion order is also the expiration order: expired
+ *   entries are found at the old end of the age list, and evicting the oldest
+ *   entry when the table is full evicts the one with the least remaining life.
+ *
+ * The table does not allocate memory or take locks; the caller allocates entries
+ * of FspNegNameEntrySize bytes, supplies the bucket array and serializes all calls.
+ * Functions that remove entries return them as a chain (linked through HashNext)
+ * so that the caller can free them after dropping its lock. It only depends on the
+ * VOID, BOOLEAN, UINT16, UINT32, UINT64 and WCHAR types so that it can be built and
+ * exercised outside the kernel (see tst/negname).
+ */
+
+#define FSP_NEGNAME_LENGTH_MAX          512     /* WCHAR's; longer names are not remembered */
+
+typedef struct _FSP_NEGNAME_LINK
+{
+    struct _FSP_NEGNAME_LINK *Prev, *Next;
+} FSP_NEGNAME_LINK;
+typedef struct _FSP_NEGNAME_ENTRY
+{
+    FSP_NEGNAME_LINK AgeLink;           /* must be first */
+    struct _FSP_NEGNAME_ENTRY *HashNext;
+    UINT64 ExpirationTime;
+    UINT32 Hash;
+    UINT16 Length;                      /* WCHAR's */
+    WCHAR Name[];
+} FSP_NEGNAME_ENTRY;
+typedef struct
+{
+    FSP_NEGNAME_ENTRY **Buckets;
+    UINT32 BucketCount;                 /* power of 2 */
+    UINT32 EntryCount, EntryCountMax;
+    WCHAR (*Upcase)(WCHAR);             /* 0: case-sensitive */
+    FSP_NEGNAME_LINK AgeList;           /* oldest at Next */
+    UINT32 Generation;
+    UINT64 HitCount, MissCount, InsertCount, StaleCount, EvictionCount, InvalidationCount;
+} FSP_NEGNAME_TABLE;
+
+static inline UINT32 FspNegNameEntrySize(UINT32 Length)
+{
+    return (UINT32)(sizeof(FSP_NEGNAME_ENTRY) + Length * sizeof(WCHAR));
+}
+
+static inline WCHAR FspNegNameFold(FSP_NEGNAME_TABLE *Table, WCHAR C)
+{
+    return 0 != Table->Upcase ? Table->Upcase(C) : C;
+}
+
+static inline UINT32 FspNegNameHash(FSP_NEGNAME_TABLE *Table, const WCHAR *Name, UINT32 Length)
+{
+    /* FNV-1a over the folded name */
+    UINT32 Hash = 2166136261;
+    for (UINT32 I = 0; Length > I; I++)
+    {
+        WCHAR C = FspNegNameFold(Table, Name[I]);
+        Hash = (Hash ^ (C & 0xff)) * 16777619;
+        Hash = (Hash ^ (C >> 8)) * 16777619;
+    }
+    return Hash;
+}
+
+static inline BOOLEAN FspNegNameEqual(FSP_NEGNAME_TABLE *Table,
+    FSP_NEGNAME_ENTRY *Entry, const WCHAR *Name, UINT32 Length)
+{
+    /* does the entry name start with Name? (Entry->Name is already folded) */
+    if (Entry->Length < Length)
+        return 0;
+    for (UINT32 I = 0; Length > I; I++)
+        if (Entry->Name[I] != FspNegNameFold(Table, Name[I]))
+            return 0;
+    return 1;
+}
+
+static inline VOID FspNegNameInitialize(FSP_NEGNAME_TABLE *Table,
+    FSP_NEGNAME_ENTRY **Buckets, UINT32 BucketCount, UINT32 EntryCountMax,
+    WCHAR (*Upcase)(WCHAR))
+{
+    for (UINT32 I = 0; BucketCount > I; I++)
+        Buckets[I] = 0;
+    Table->Buckets = Buckets;
+    Table->BucketCount = BucketCount;
+    Table->EntryCount = 0;
+    Table->EntryCountMax = EntryCountMax;
+    Table->Upcase = Upcase;
+    Table->AgeList.Prev = Table->AgeList.Next = &Table->AgeList;
+    Table->Generation = 0;
+    Table->HitCount = Table->MissCount = Table->InsertCount = 0;
+    Table->StaleCount = Table->EvictionCount = Table->InvalidationCount = 0;
+}
+
+static inline UINT32 FspNegNameGeneration(FSP_NEGNAME_TABLE *Table)
+{
+    return Table->Generation;
+}
+
+static inline FSP_NEGNAME_ENTRY *FspNegNameUnlink(FSP_NEGNAME_TABLE *Table,
+    FSP_NEGNAME_ENTRY *Entry, FSP_NEGNAME_ENTRY *Removed)
+{
+    /* unlink Entry and push it onto the Removed chain; returns the new chain */
+    FSP_NEGNAME_ENTRY **P;
+    for (P = &Table->Buckets[Entry->Hash & (Table->BucketCount - 1)]; Entry != *P; P = &(*P)->HashNext)
+        ;
+    *P = Entry->HashNext;
+    Entry->AgeLink.Prev->Next = Entry->AgeLink.Next;
+    Entry->AgeLink.Next->Prev = Entry->AgeLink.Prev;
+    Table->EntryCount--;
+    Entry->HashNext = Removed;
+    return Entry;
+}
+
+static inline FSP_NEGNAME_ENTRY *FspNegNameFind(FSP_NEGNAME_TABLE *Table,
+    UINT32 Hash, const WCHAR *Name, UINT32 Length)
+{
+    for (FSP_NEGNAME_ENTRY *Entry = Table->Buckets[Hash & (Table->BucketCount - 1)];
+        0 != Entry; Entry = Entry->HashNext)
+        if (Hash == Entry->Hash && Length == Entry->Length &&
+            FspNegNameEqual(Table, Entry, Name, Length))
+            return Entry;
+    return 0;
+}
+
+static inline BOOLEAN FspNegNameLookup(FSP_NEGNAME_TABLE *Table,
+    const WCHAR *Name, UINT32 Length, UINT64 CurrentTime, FSP_NEGNAME_ENTRY **PRemoved)
+{
+    /* is Name known not to exist? an expired entry is removed onto *PRemoved */
+    FSP_NEGNAME_ENTRY *Entry = 0;
+    if (0 != Table->EntryCount && FSP_NEGNAME_LENGTH_MAX >= Length)
+        Entry = FspNegNameFind(Table, FspNegNameHash(Table, Name, Length), Name, Length);
+    if (0 != Entry && CurrentTime >= Entry->ExpirationTime)
+    {
+        *PRemoved = FspNegNameUnlink(Table, Entry, *PRemoved);
+        Entry = 0;
+    }
+    if (0 != Entry)
+        Table->HitCount++;
+    else
+        Table->MissCount++;
+    return 0 != Entry;
+}
+
+static inline BOOLEAN FspNegNameInsert(FSP_NEGNAME_TABLE *Table, UINT32 Generation,
+    FSP_NEGNAME_ENTRY *Entry, const WCHAR *Name, UINT32 Length, UINT64 ExpirationTime,
+    FSP_NEGNAME_ENTRY **PRemoved)
+{
+    /*
+     * Entry must be FspNegNameEntrySize(Length) bytes. If the insert is rejected
+     * (stale generation, name too long, zero capacity) the caller still owns Entry.
+     * Replaced and evicted entries are removed onto *PRemoved.
+     */
+    FSP_NEGNAME_ENTRY *Existing;
+    UINT32 Hash;
+
+    if (Generation != Table->Generation)
+    {
+        Table->StaleCount++;
+        return 0;
+    }
+    if (0 == Length || FSP_NEGNAME_LENGTH_MAX < Length || 0 == Table->EntryCountMax)
+        return 0;
+
+    Hash = FspNegNameHash(Table, Name, Length);
+    Existing = FspNegNameFind(Table, Hash, Name, Length);
+    if (0 != Existing)
+        *PRemoved = FspNegNameUnlink(Table, Existing, *PRemoved);
+
+    while (Table->EntryCount >= Table->EntryCountMax)
+    {
+        *PRemoved = FspNegNameUnlink(Table, (FSP_NEGNAME_ENTRY *)Table->AgeList.Next, *PRemoved);
+        Table->EvictionCount++;
+    }
+
+    for (UINT32 I = 0; Length > I; I++)
+        Entry->Name[I] = FspNegNameFold(Table, Name[I]);
+    Entry->Length = (UINT16)Length;
+    Entry->Hash = Hash;
+    Entry->ExpirationTime = ExpirationTime;
+    Entry->HashNext = Table->Buckets[Hash & (Table->BucketCount - 1)];
+    Table->Buckets[Hash & (Table->BucketCount - 1)] = Entry;
+    Entry->AgeLink.Prev = Table->AgeList.Prev;
+    Entry->AgeLink.Next = &Table->AgeList;
+    Table->AgeList.Prev->Next = &Entry->AgeLink;
+    Table->AgeList.Prev = &Entry->AgeLink;
+    Table->EntryCount++;
+    Table->InsertCount++;
+
+    return 1;
+}
+
+static inline FSP_NEGNAME_ENTRY *FspNegNameInvalidateAll(FSP_NEGNAME_TABLE *Table)
+{
+    FSP_NEGNAME_ENTRY *Removed = 0;
+    Table->Generation++;
+    while (&Table->AgeList != Table->AgeList.Next)
+    {
+        Removed = FspNegNameUnlink(Table, (FSP_NEGNAME_ENTRY *)Table->AgeList.Next, Removed);
+        Table->InvalidationCount++;
+    }
+    return Removed;
+}
+
+static inline FSP_NEGNAME_ENTRY *FspNegNameInvalidateName(FSP_NEGNAME_TABLE *Table,
+    const WCHAR *Name, UINT32 Length)
+{
+    /* invalidate exactly Name */
+    FSP_NEGNAME_ENTRY *Entry, *Removed = 0;
+    Table->Generation++;
+    if (0 != Table->EntryCount && FSP_NEGNAME_LENGTH_MAX >= Length)
+    {
+        Entry = FspNegNameFind(Table, FspNegNameHash(Table, Name, Length), Name, Length);
+        if (0 != Entry)
+        {
+            Removed = FspNegNameUnlink(Table, Entry, Removed);
+            Table->InvalidationCount++;
+        }
+    }
+    return Removed;
+}
+
+static inline FSP_NEGNAME_ENTRY *FspNegNameInvalidatePrefix(FSP_NEGNAME_TABLE *Table,
+    const WCHAR *Name, UINT32 Length)
+{
+    /* invalidate Name, Name\* and Name:* */
+    FSP_NEGNAME_LINK *Link, *NextLink;
+    FSP_NEGNAME_ENTRY *Entry, *Removed = 0;
+
+    /* the root (or the empty name) is a prefix of everything */
+    while (0 < Length && L'\\' == Name[Length - 1])
+        Length--;
+    if (0 == Length)
+        return FspNegNameInvalidateAll(Table);
+
+    Table->Generation++;
+    if (FSP_NEGNAME_LENGTH_MAX < Length)
+        return 0;       /* no entry can be as long */
+    for (Link = Table->AgeList.Next; &Table->AgeList != Link; Link = NextLink)
+    {
+        NextLink = Link->Next;
+        Entry = (FSP_NEGNAME_ENTRY *)Link;
+        if (FspNegNameEqual(Table, Entry, Name, Length) &&
+            (Length == Entry->Length || L'\\' == Entry->Name[Length] || L':' == Entry->Name[Length]))
+        {
+            Removed = FspNegNameUnlink(Table, Entry, Removed);
+            Table->InvalidationCount++;
+        }
+    }
+    return Removed;
+}
+
+static inline FSP_NEGNAME_ENTRY *FspNegNameInvalidateExpired(FSP_NEGNAME_TABLE *Table,
+    UINT64 CurrentTime)
+{
+    /* expiration is not a change to the namespace: the generation stays the same */
+    FSP_NEGNAME_ENTRY *Entry, *Removed = 0;
+    while (&Table->AgeList != Table->AgeList.Next)
+    {
+        Entry = (FSP_NEGNAME_ENTRY *)Table->AgeList.Next;
+        if (CurrentTime < Entry->ExpirationTime)
+            break;
+        Removed = FspNegNameUnlink(Table, Entry, Removed);
+    }
+    return Removed;
+}
+
+#endif
@@ -33,6 +33,7 @@
  */
 
 #include <shared/ku/library.h>
+#include <shared/ku/posixpath.h>
 
 FSP_API NTSTATUS FspPosixSetUidMap(UINT32 Uid[], PSID Sid[], ULONG Count);
 FSP_API NTSTATUS FspPosixMapUidToSid(UINT32 Uid, PSID *PSid);
@@ -53,6 +54,10 @@ FSP_API NTSTATUS FspPosixMapWindowsToPosixPathEx(PWSTR WindowsPath, char **PPosi
     BOOLEAN Translate);
 FSP_API NTSTATUS FspPosixMapPosixToWindowsPathEx(const char *PosixPath, PWSTR *PWindowsPath,
     BOOLEAN Translate);
+FSP_API NTSTATUS FspPosixMapWindowsToPosixPathBuf(PWSTR WindowsPath, char *PosixPath,
+    PULONG PSize, BOOLEAN Translate);
+FSP_API NTSTATUS FspPosixMapPosixToWindowsPathBuf(const char *PosixPath, PWSTR WindowsPath,
+    PULONG PSize, BOOLEAN Translate);
 FSP_API VOID FspPosixDeletePath(void *Path);
 FSP_API VOID FspPosixEncodeWindowsPath(PWSTR WindowsPath, ULONG Size);
 FSP_API VOID FspPosixDecodeWindowsPath(PWSTR WindowsPath, ULONG Size);
@@ -69,6 +74,8 @@ FSP_API VOID FspPosixDecodeWindowsPath(PWSTR WindowsPath, ULONG Size);
 #pragma alloc_text(PAGE, FspPosixMapSecurityDescriptorToPermissions)
 #pragma alloc_text(PAGE, FspPosixMapWindowsToPosixPathEx)
 #pragma alloc_text(PAGE, FspPosixMapPosixToWindowsPathEx)
+#pragma alloc_text(PAGE, FspPosixMapWindowsToPosixPathBuf)
+#pragma alloc_text(PAGE, FspPosixMapPosixToWindowsPathBuf)
 #pragma alloc_text(PAGE, FspPosixDeletePath)
 #pragma alloc_text(PAGE, FspPosixEncodeWindowsPath)
 #pragma alloc_text(PAGE, FspPosixDecodeWindowsPath)
@@ -338,6 +345,8 @@ exit:
     return TRUE;
 }
 
+static VOID FspPosixSdCacheFinalize(VOID);
+
 VOID FspPosixFinalize(BOOLEAN Dynamic)
 {
     /*
@@ -348,6 +357,7 @@ VOID FspPosixFinalize(BOOLEAN Dynamic)
     if (Dynamic)
     {
         FspPosixSetUidMap(0, 0, 0);
+        FspPosixSdCacheFinalize();
 
         MemFree(FspTrustedDomains);
         MemFree(FspAccountDomainSid);
@@ -433,6 +443,499 @@ static UINT32 FspPosixUidMap_Uid[8];
 static PSID FspPosixUidMap_Sid[8];
 static ULONG FspPosixUidMap_Cnt = 0;
 
+#if !defined(_KERNEL_MODE)
+/*
+ * SID <-> UID cache (user mode only).
+ *
+ * Translations are memoized in two fixed size open addressed hash tables, one per direction.
+ * Entries are carved from a static pool and are immutable once published. Readers need no
+ * locks: they load a bucket pointer, compare and copy out what they need. Writers serialize on
+ * a lock, which they only try to acquire; on contention, when the entry's buckets are full or
+ * when the pool is exhausted they simply give up and the translation is computed as before.
+ * A writer first finds a free bucket and only then carves the entry, so all pool space is used
+ * by published entries.
+ *
+ * FspPosixSetUidMap changes the mapping; it bumps a generation number and under the writer lock
+ * empties both tables and reclaims the whole pool. Readers capture the generation when they start
+ * and discard what they read if it has changed by the time they are done, because the memory of
+ * an entry of an older generation may have been reused. For the same reason FspPosixMapUidToSid
+ * returns a copy of the cached SID. A translation is cached under the generation that was current
+ * when it started, so a translation that races with FspPosixSetUidMap is never cached under the
+ * new generation.
+ */
+#define FspPosixSidCacheBucketCount     512
+#define FspPosixSidCacheProbeCount      8
+#define FspPosixSidCachePoolSize        (128 * 1024)
+typedef struct
+{
+    UINT32 Uid;
+    LONG Generation;
+    ULONG Hash;
+    ULONG Reserved;
+    SID Sid;                            /* variable size; must be last */
+} FSP_POSIX_SID_CACHE_ENTRY;
+static FSP_POSIX_SID_CACHE_ENTRY *volatile FspPosixUidToSidCache[FspPosixSidCacheBucketCount];
+static FSP_POSIX_SID_CACHE_ENTRY *volatile FspPosixSidToUidCache[FspPosixSidCacheBucketCount];
+/* slack so that a reader racing with reuse never reads past the pool */
+static FSP_FSCTL_DECLSPEC_ALIGN UINT8 FspPosixSidCachePool[
+    FspPosixSidCachePoolSize + FIELD_OFFSET(FSP_POSIX_SID_CACHE_ENTRY, Sid) + SECURITY_MAX_SID_SIZE];
+static ULONG FspPosixSidCachePoolOffset;
+static volatile LONG FspPosixSidCacheGeneration;
+static SRWLOCK FspPosixSidCacheLock = SRWLOCK_INIT;
+
+static inline ULONG FspPosixSidCacheHashUid(UINT32 Uid)
+{
+    return Uid * 0x9e3779b1;
+}
+
+static inline ULONG FspPosixSidCacheHashSid(PSID Sid, ULONG Length)
+{
+    ULONG Hash = 2166136261;
+
+    /* FNV-1a */
+    for (PUINT8 P = Sid, EndP = P + Length; EndP > P; P++)
+        Hash = (Hash ^ *P) * 16777619;
+
+    return Hash;
+}
+
+static inline BOOLEAN FspPosixSidCacheValidate(LONG Generation)
+{
+    /* order the reads of a looked up entry before the generation check */
+    MemoryBarrier();
+    return Generation == FspPosixSidCacheGeneration;
+}
+
+static FSP_POSIX_SID_CACHE_ENTRY *FspPosixSidCacheLookup(
+    FSP_POSIX_SID_CACHE_ENTRY *volatile *Cache, LONG Generation,
+    ULONG Hash, UINT32 Uid, PSID Sid, ULONG Length)
+{
+    FSP_POSIX_SID_CACHE_ENTRY *Entry;
+
+    for (ULONG I = 0; FspPosixSidCacheProbeCount > I; I++)
+    {
+        Entry = Cache[(Hash + I) & (FspPosixSidCacheBucketCount - 1)];
+        if (0 == Entry)
+            break;
+        if (Generation != Entry->Generation || Hash != Entry->Hash)
+            continue;
+        if (0 == Sid ?
+            Uid == Entry->Uid :
+            Length == GetLengthSid(&Entry->Sid) && 0 == memcmp(&Entry->Sid, Sid, Length))
+            return Entry;
+    }
+
+    return 0;
+}
+
+static VOID FspPosixSidCacheInsert(
+    FSP_POSIX_SID_CACHE_ENTRY *volatile *Cache, LONG Generation,
+    ULONG Hash, UINT32 Uid, PSID Sid, ULONG Length)
+{
+    FSP_POSIX_SID_CACHE_ENTRY *Entry;
+    ULONG Size, I, J;
+
+    if (SECURITY_MAX_SID_SIZE < Length || !TryAcquireSRWLockExclusive(&FspPosixSidCacheLock))
+        return;
+
+    if (Generation != FspPosixSidCacheGeneration)
+        goto exit;
+
+    /* find a free bucket before using any pool space */
+    for (I = 0; FspPosixSidCacheProbeCount > I; I++)
+    {
+        J = (Hash + I) & (FspPosixSidCacheBucketCount - 1);
+        Entry = Cache[J];
+        if (0 == Entry)
+            break;
+        if (Hash == Entry->Hash && (0 == Sid ?
+            Uid == Entry->Uid :
+            Length == GetLengthSid(&Entry->Sid) && 0 == memcmp(&Entry->Sid, Sid, Length)))
+            goto exit; /* inserted by another thread */
+    }
+    if (FspPosixSidCacheProbeCount == I)
+        goto exit;
+
+    Size = FSP_FSCTL_DEFAULT_ALIGN_UP(FIELD_OFFSET(FSP_POSIX_SID_CACHE_ENTRY, Sid) + Length);
+    if (FspPosixSidCachePoolSize - FspPosixSidCachePoolOffset < Size)
+        goto exit;
+
+    Entry = (FSP_POSIX_SID_CACHE_ENTRY *)(FspPosixSidCachePool + FspPosixSidCachePoolOffset);
+    FspPosixSidCachePoolOffset += Size;
+    Entry->Uid = Uid;
+    Entry->Generation = Generation;
+    Entry->Hash = Hash;
+    memcpy(&Entry->Sid, Sid, Length);
+
+    /* the interlocked operation also orders the entry initialization before publication */
+    InterlockedExchangePointer((PVOID volatile *)&Cache[J], Entry);
+
+exit:
+    ReleaseSRWLockExclusive(&FspPosixSidCacheLock);
+}
+
+static VOID FspPosixSidCacheReset(VOID)
+{
+    AcquireSRWLockExclusive(&FspPosixSidCacheLock);
+
+    /* readers that started under the old generation discard what they read from now on */
+    InterlockedIncrement(&FspPosixSidCacheGeneration);
+
+    for (ULONG I = 0; FspPosixSidCacheBucketCount > I; I++)
+    {
+        FspPosixUidToSidCache[I] = 0;
+        FspPosixSidToUidCache[I] = 0;
+    }
+    FspPosixSidCachePoolOffset = 0;
+
+    ReleaseSRWLockExclusive(&FspPosixSidCacheLock);
+}
+#endif
+
+#if !defined(_KERNEL_MODE)
+/*
+ * Permissions <-> security descriptor caches (user mode only).
+ *
+ * Real file systems use only a handful of distinct (uid, gid, mode) triples, so
+ * FspPosixMapPermissionsToSecurityDescriptor interns its results. Interned descriptors are
+ * immutable and reference counted: the cache holds one reference and every caller holds another,
+ * which it releases with FspDeleteSecurityDescriptor. Entries are indexed twice: by key for
+ * lookups and by address so that FspDeleteSecurityDescriptor can tell an interned descriptor
+ * from one that was allocated outside the cache (e.g. because the cache was full). When the
+ * SID <-> UID generation changes, FspPosixSdCacheReset drops all entries of the older generation
+ * from the key index; they are freed when their last reference is released.
+ *
+ * FspPosixMapSecurityDescriptorToPermissions has a matching cache keyed by the contents of
+ * self-relative descriptors, which remembers the resulting (uid, gid, mode).
+ */
+#define FspPosixSdCacheBucketCount      64
+#define FspPosixSdCacheEntryCountMax    256
+#define FspPosixSdCacheLengthMax        1024
+typedef struct _FSP_POSIX_SD_CACHE_ENTRY
+{
+    struct _FSP_POSIX_SD_CACHE_ENTRY *KeyNext, *AddrNext;
+    LONG RefCount;
+    LONG Generation;
+    UINT32 Uid, Gid, Mode, Flags;
+    FSP_FSCTL_DECLSPEC_ALIGN UINT8 SecurityDescriptor[];
+} FSP_POSIX_SD_CACHE_ENTRY;
+typedef struct _FSP_POSIX_PERM_CACHE_ENTRY
+{
+    struct _FSP_POSIX_PERM_CACHE_ENTRY *HashNext;
+    LONG Generation;
+    ULONG Hash, Length;
+    UINT32 OrigUid, OrigGid, Flags;
+    UINT32 Uid, Gid, Mode;
+    FSP_FSCTL_DECLSPEC_ALIGN UINT8 SecurityDescriptor[];
+} FSP_POSIX_PERM_CACHE_ENTRY;
+static SRWLOCK FspPosixSdCacheLock = SRWLOCK_INIT;
+static FSP_POSIX_SD_CACHE_ENTRY *FspPosixSdCacheKeyIndex[FspPosixSdCacheBucketCount];
+static FSP_POSIX_SD_CACHE_ENTRY *FspPosixSdCacheAddrIndex[FspPosixSdCacheBucketCount];
+static ULONG FspPosixSdCacheCount;
+static SRWLOCK FspPosixPermCacheLock = SRWLOCK_INIT;
+static FSP_POSIX_PERM_CACHE_ENTRY *FspPosixPermCacheIndex[FspPosixSdCacheBucketCount];
+static ULONG FspPosixPermCacheCount;
+
+static inline ULONG FspPosixSdCacheHashKey(UINT32 Uid, UINT32 Gid, UINT32 Mode, UINT32 Flags)
+{
+    ULONG Hash = (Uid * 0x9e3779b1) ^ (Gid * 0x85ebca6b) ^ (Mode * 0xc2b2ae35) ^ Flags;
+    return (Hash ^ (Hash >> 16)) & (FspPosixSdCacheBucketCount - 1);
+}
+
+static inline ULONG FspPosixSdCacheHashAddr(PVOID Pointer)
+{
+    UINT_PTR Value = (UINT_PTR)Pointer;
+    return (ULONG)((Value >> 4) ^ (Value >> 12)) & (FspPosixSdCacheBucketCount - 1);
+}
+
+static PSECURITY_DESCRIPTOR FspPosixSdCacheLookup(
+    LONG Generation, UINT32 Uid, UINT32 Gid, UINT32 Mode, UINT32 Flags)
+{
+    FSP_POSIX_SD_CACHE_ENTRY *Entry;
+    PSECURITY_DESCRIPTOR SecurityDescriptor = 0;
+
+    AcquireSRWLockShared(&FspPosixSdCacheLock);
+
+    for (Entry = FspPosixSdCacheKeyIndex[FspPosixSdCacheHashKey(Uid, Gid, Mode, Flags)];
+        0 != Entry; Entry = Entry->KeyNext)
+        if (Generation == Entry->Generation &&
+            Uid == Entry->Uid && Gid == Entry->Gid && Mode == Entry->Mode && Flags == Entry->Flags)
+        {
+            InterlockedIncrement(&Entry->RefCount);
+            SecurityDescriptor = Entry->SecurityDescriptor;
+            break;
+        }
+
+    ReleaseSRWLockShared(&FspPosixSdCacheLock);
+
+    return SecurityDescriptor;
+}
+
+static VOID FspPosixSdCacheRemoveAddr(FSP_POSIX_SD_CACHE_ENTRY *Entry)
+{
+    /* must be called under the exclusive lock */
+    FSP_POSIX_SD_CACHE_ENTRY **P;
+
+    for (P = &FspPosixSdCacheAddrIndex[FspPosixSdCacheHashAddr(Entry->SecurityDescriptor)];
+        Entry != *P; P = &(*P)->AddrNext)
+        ;
+    *P = Entry->AddrNext;
+}
+
+static PSECURITY_DESCRIPTOR FspPosixSdCacheInsert(
+    LONG Generation, UINT32 Uid, UINT32 Gid, UINT32 Mode, UINT32 Flags,
+    PSECURITY_DESCRIPTOR SecurityDescriptor)
+{
+    /*
+     * Returns the interned descriptor and frees SecurityDescriptor; or returns SecurityDescriptor
+     * unchanged if it could not be interned.
+     */
+    FSP_POSIX_SD_CACHE_ENTRY *Entry, *NewEntry;
+    ULONG Length, Index;
+
+    Length = GetSecurityDescriptorLength(SecurityDescriptor);
+    if (FspPosixSdCacheLengthMax < Length)
+        return SecurityDescriptor;
+
+    NewEntry = MemAlloc(FIELD_OFFSET(FSP_POSIX_SD_CACHE_ENTRY, SecurityDescriptor) + Length);
+    if (0 == NewEntry)
+        return SecurityDescriptor;
+
+    NewEntry->RefCount = 2; /* cache + caller */
+    NewEntry->Generation = Generation;
+    NewEntry->Uid = Uid;
+    NewEntry->Gid = Gid;
+    NewEntry->Mode = Mode;
+    NewEntry->Flags = Flags;
+    memcpy(NewEntry->SecurityDescriptor, SecurityDescriptor, Length);
+
+    Index = FspPosixSdCacheHashKey(Uid, Gid, Mode, Flags);
+    Entry = 0;
+
+    AcquireSRWLockExclusive(&FspPosixSdCacheLock);
+
+    if (Generation == FspPosixSidCacheGeneration)
+    {
+        /* entries of the older generation may linger until FspPosixSdCacheReset runs */
+        for (Entry = FspPosixSdCacheKeyIndex[Index]; 0 != Entry; Entry = Entry->KeyNext)
+            if (Generation == Entry->Generation &&
+                Uid == Entry->Uid && Gid == Entry->Gid && Mode == Entry->Mode && Flags == Entry->Flags)
+            {
+                /* lost the race against another thread that interned the same descriptor */
+                InterlockedIncrement(&Entry->RefCount);
+                break;
+            }
+
+        if (0 == Entry && FspPosixSdCacheEntryCountMax > FspPosixSdCacheCount)
+        {
+            Entry = NewEntry;
+            NewEntry = 0;
+
+            Entry->KeyNext = FspPosixSdCacheKeyIndex[Index];
+            FspPosixSdCacheKeyIndex[Index] = Entry;
+            Index = FspPosixSdCacheHashAddr(Entry->SecurityDescriptor);
+            Entry->AddrNext = FspPosixSdCacheAddrIndex[Index];
+            FspPosixSdCacheAddrIndex[Index] = Entry;
+            FspPosixSdCacheCount++;
+        }
+    }
+
+    ReleaseSRWLockExclusive(&FspPosixSdCacheLock);
+
+    MemFree(NewEntry);
+
+    if (0 == Entry)
+        return SecurityDescriptor;
+
+    MemFree(SecurityDescriptor);
+    return Entry->SecurityDescriptor;
+}
+
+BOOLEAN FspPosixReleaseSecurityDescriptor(PSECURITY_DESCRIPTOR SecurityDescriptor)
+{
+    /*
+     * Releases a reference to an interned descriptor. Returns FALSE if SecurityDescriptor
+     * was not interned, in which case the caller must free it.
+     */
+    FSP_POSIX_SD_CACHE_ENTRY *Entry;
+    LONG RefCount = 1;
+
+    AcquireSRWLockShared(&FspPosixSdCacheLock);
+
+    for (Entry = FspPosixSdCacheAddrIndex[FspPosixSdCacheHashAddr(SecurityDescriptor)];
+        0 != Entry; Entry = Entry->AddrNext)
+        if (SecurityDescriptor == Entry->SecurityDescriptor)
+        {
+            RefCount = InterlockedDecrement(&Entry->RefCount);
+            break;
+        }
+
+    ReleaseSRWLockShared(&FspPosixSdCacheLock);
+
+    if (0 == Entry)
+        return FALSE;
+
+    if (0 == RefCount)
+    {
+        /* no longer in the key index, so nobody else can find this entry */
+        AcquireSRWLockExclusive(&FspPosixSdCacheLock);
+        FspPosixSdCacheRemoveAddr(Entry);
+        ReleaseSRWLockExclusive(&FspPosixSdCacheLock);
+
+        MemFree(Entry);
+    }
+
+    return TRUE;
+}
+
+static BOOLEAN FspPosixPermCacheLookup(
+    LONG Generation, ULONG Hash, PSECURITY_DESCRIPTOR SecurityDescriptor, ULONG Length,
+    UINT32 OrigUid, UINT32 OrigGid, UINT32 Flags,
+    PUINT32 PUid, PUINT32 PGid, PUINT32 PMode)
+{
+    FSP_POSIX_PERM_CACHE_ENTRY *Entry;
+
+    AcquireSRWLockShared(&FspPosixPermCacheLock);
+
+    for (Entry = FspPosixPermCacheIndex[Hash & (FspPosixSdCacheBucketCount - 1)];
+        0 != Entry; Entry = Entry->HashNext)
+        if (Generation == Entry->Generation && Hash == Entry->Hash && Length == Entry->Length &&
+            OrigUid == Entry->OrigUid && OrigGid == Entry->OrigGid && Flags == Entry->Flags &&
+            0 == memcmp(SecurityDescriptor, Entry->SecurityDescriptor, Length))
+        {
+            *PUid = Entry->Uid;
+            *PGid = Entry->Gid;
+            *PMode = Entry->Mode;
+            break;
+        }
+
+    ReleaseSRWLockShared(&FspPosixPermCacheLock);
+
+    return 0 != Entry;
+}
+
+static VOID FspPosixPermCacheInsert(
+    LONG Generation, ULONG Hash, PSECURITY_DESCRIPTOR SecurityDescriptor, ULONG Length,
+    UINT32 OrigUid, UINT32 OrigGid, UINT32 Flags,
+    UINT32 Uid, UINT32 Gid, UINT32 Mode)
+{
+    FSP_POSIX_PERM_CACHE_ENTRY *Entry, *NewEntry;
+
+    NewEntry = MemAlloc(FIELD_OFFSET(FSP_POSIX_PERM_CACHE_ENTRY, SecurityDescriptor) + Length);
+    if (0 == NewEntry)
+        return;
+
+    NewEntry->Generation = Generation;
+    NewEntry->Hash = Hash;
+    NewEntry->Length = Length;
+    NewEntry->OrigUid = OrigUid;
+    NewEntry->OrigGid = OrigGid;
+    NewEntry->Flags = Flags;
+    NewEntry->Uid = Uid;
+    NewEntry->Gid = Gid;
+    NewEntry->Mode = Mode;
+    memcpy(NewEntry->SecurityDescriptor, SecurityDescriptor, Length);
+
+    AcquireSRWLockExclusive(&FspPosixPermCacheLock);
+
+    if (Generation == FspPosixSidCacheGeneration)
+    {
+        for (Entry = FspPosixPermCacheIndex[Hash & (FspPosixSdCacheBucketCount - 1)];
+            0 != Entry; Entry = Entry->HashNext)
+            if (Generation == Entry->Generation && Hash == Entry->Hash && Length == Entry->Length &&
+                OrigUid == Entry->OrigUid && OrigGid == Entry->OrigGid && Flags == Entry->Flags &&
+                0 == memcmp(SecurityDescriptor, Entry->SecurityDescriptor, Length))
+                break;
+
+        if (0 == Entry && FspPosixSdCacheEntryCountMax > FspPosixPermCacheCount)
+        {
+            NewEntry->HashNext = FspPosixPermCacheIndex[Hash & (FspPosixSdCacheBucketCount - 1)];
+            FspPosixPermCacheIndex[Hash & (FspPosixSdCacheBucketCount - 1)] = NewEntry;
+            FspPosixPermCacheCount++;
+            NewEntry = 0;
+        }
+    }
+
+    ReleaseSRWLockExclusive(&FspPosixPermCacheLock);
+
+    MemFree(NewEntry);
+}
+
+static VOID FspPosixSdCacheReset(VOID)
+{
+    /*
+     * Called after the SID <-> UID generation has changed. Inserts of the older generation
+     * are refused from then on, so that only the entries already cached have to be dropped.
+     */
+    FSP_POSIX_SD_CACHE_ENTRY *SdEntry, **SdP;
+    FSP_POSIX_PERM_CACHE_ENTRY *PermEntry, **PermP;
+
+    AcquireSRWLockExclusive(&FspPosixSdCacheLock);
+    for (ULONG I = 0; FspPosixSdCacheBucketCount > I; I++)
+        for (SdP = &FspPosixSdCacheKeyIndex[I]; 0 != (SdEntry = *SdP);)
+        {
+            if (FspPosixSidCacheGeneration == SdEntry->Generation)
+            {
+                SdP = &SdEntry->KeyNext;
+                continue;
+            }
+
+            /* drop the cache reference */
+            *SdP = SdEntry->KeyNext;
+            FspPosixSdCacheCount--;
+            if (0 == InterlockedDecrement(&SdEntry->RefCount))
+            {
+                FspPosixSdCacheRemoveAddr(SdEntry);
+                MemFree(SdEntry);
+            }
+        }
+    ReleaseSRWLockExclusive(&FspPosixSdCacheLock);
+
+    AcquireSRWLockExclusive(&FspPosixPermCacheLock);
+    for (ULONG I = 0; FspPosixSdCacheBucketCount > I; I++)
+        for (PermP = &FspPosixPermCacheIndex[I]; 0 != (PermEntry = *PermP);)
+        {
+            if (FspPosixSidCacheGeneration == PermEntry->Generation)
+            {
+                PermP = &PermEntry->HashNext;
+                continue;
+            }
+
+            *PermP = PermEntry->HashNext;
+            FspPosixPermCacheCount--;
+            MemFree(PermEntry);
+        }
+    ReleaseSRWLockExclusive(&FspPosixPermCacheLock);
+}
+
+static VOID FspPosixSdCacheFinalize(VOID)
+{
+    FSP_POSIX_SD_CACHE_ENTRY *SdEntry, *NextSdEntry;
+    FSP_POSIX_PERM_CACHE_ENTRY *PermEntry, *NextPermEntry;
+
+    for (ULONG I = 0; FspPosixSdCacheBucketCount > I; I++)
+    {
+        for (SdEntry = FspPosixSdCacheAddrIndex[I]; 0 != SdEntry; SdEntry = NextSdEntry)
+        {
+            NextSdEntry = SdEntry->AddrNext;
+            MemFree(SdEntry);
+        }
+        FspPosixSdCacheAddrIndex[I] = 0;
+        FspPosixSdCacheKeyIndex[I] = 0;
+
+        for (PermEntry = FspPosixPermCacheIndex[I]; 0 != PermEntry; PermEntry = NextPermEntry)
+        {
+            NextPermEntry = PermEntry->HashNext;
+            MemFree(PermEntry);
+        }
+        FspPosixPermCacheIndex[I] = 0;
+    }
+
+    FspPosixSdCacheCount = 0;
+    FspPosixPermCacheCount = 0;
+}
+#endif
+
 FSP_API NTSTATUS FspPosixSetUidMap(UINT32 Uid[], PSID Sid[], ULONG Count)
 {
     FSP_KU_CODE;
@@ -466,6 +969,11 @@ FSP_API NTSTATUS FspPosixSetUidMap(UINT32 Uid[], PSID Sid[], ULONG Count)
         FspPosixUidMap_Cnt = I + 1;
     }
 
+#if !defined(_KERNEL_MODE)
+    FspPosixSidCacheReset();
+    FspPosixSdCacheReset();
+#endif
+
     Result = STATUS_SUCCESS;
 
 exit:
@@ -481,6 +989,24 @@ FSP_API NTSTATUS FspPosixMapUidToSid(UINT32 Uid, PSID *PSid)
 
     InitOnceExecuteOnce(&FspPosixInitOnce, FspPosixInitialize, 0, 0);
 
+#if !defined(_KERNEL_MODE)
+    LONG Generation = FspPosixSidCacheGeneration;
+    FSP_POSIX_SID_CACHE_ENTRY *Entry;
+    ULONG Length;
+
+    Entry = FspPosixSidCacheLookup(FspPosixUidToSidCache, Generation,
+        FspPosixSidCacheHashUid(Uid), Uid, 0, 0);
+    if (0 != Entry &&
+        SECURITY_MAX_SID_SIZE >= (Length = GetLengthSid(&Entry->Sid)) &&
+        0 != (*PSid = MemAlloc(Length)))
+    {
+        memcpy(*PSid, &Entry->Sid, Length);
+        if (FspPosixSidCacheValidate(Generation))
+            return STATUS_SUCCESS;
+        MemFree(*PSid);
+    }
+#endif
+
     *PSid = 0;
 
     /*
@@ -623,6 +1149,11 @@ FSP_API NTSTATUS FspPosixMapUidToSid(UINT32 Uid, PSID *PSid)
 exit:
     if (0 == *PSid)
         *PSid = FspUnmappedSid;
+#if !defined(_KERNEL_MODE)
+    else
+        FspPosixSidCacheInsert(FspPosixUidToSidCache, Generation,
+            FspPosixSidCacheHashUid(Uid), Uid, *PSid, GetLengthSid(*PSid));
+#endif
 
     return STATUS_SUCCESS;
 }
@@ -642,6 +1173,23 @@ FSP_API NTSTATUS FspPosixMapSidToUid(PSID Sid, PUINT32 PUid)
     if (!IsValidSid(Sid) || 0 == (Count = *GetSidSubAuthorityCount(Sid)))
         return STATUS_INVALID_SID;
 
+#if !defined(_KERNEL_MODE)
+    LONG Generation = FspPosixSidCacheGeneration;
+    FSP_POSIX_SID_CACHE_ENTRY *Entry;
+    ULONG Length, Hash;
+
+    Length = GetLengthSid(Sid);
+    Hash = FspPosixSidCacheHashSid(Sid, Length);
+    Entry = FspPosixSidCacheLookup(FspPosixSidToUidCache, Generation, Hash, 0, Sid, Length);
+    if (0 != Entry)
+    {
+        *PUid = Entry->Uid;
+        if (FspPosixSidCacheValidate(Generation))
+            return STATUS_SUCCESS;
+        *PUid = (UINT32)-1;
+    }
+#endif
+
     /*
      * UidMap overrides default UID <-> SID mapping.
      */
@@ -750,6 +1298,10 @@ exit:
     if (-1 == *PUid)
         *PUid = FspUnmappedUid;
 
+#if !defined(_KERNEL_MODE)
+    FspPosixSidCacheInsert(FspPosixSidToUidCache, Generation, Hash, *PUid, Sid, Length);
+#endif
+
     return STATUS_SUCCESS;
 }
 
@@ -862,6 +1414,17 @@ FSP_API NTSTATUS FspPosixMapPermissionsToSecurityDescriptor(
 
     *PSecurityDescriptor = 0;
 
+#if !defined(_KERNEL_MODE)
+    InitOnceExecuteOnce(&FspPosixInitOnce, FspPosixInitialize, 0, 0);
+
+    LONG Generation = FspPosixSidCacheGeneration;
+    UINT32 Flags = FspDistinctPermsForSameOwnerGroup;
+
+    *PSecurityDescriptor = FspPosixSdCacheLookup(Generation, Uid, Gid, Mode, Flags);
+    if (0 != *PSecurityDescriptor)
+        return STATUS_SUCCESS;
+#endif
+
     Result = FspPosixMapUidToSid(Uid, &OwnerSid);
     if (!NT_SUCCESS(Result))
         goto exit;
@@ -982,6 +1545,11 @@ FSP_API NTSTATUS FspPosixMapPermissionsToSecurityDescriptor(
     if (!MakeSelfRelativeSD(&SecurityDescriptor, RelativeSecurityDescriptor, &Size))
         goto lasterror;
 
+#if !defined(_KERNEL_MODE)
+    RelativeSecurityDescriptor = FspPosixSdCacheInsert(Generation, Uid, Gid, Mode, Flags,
+        RelativeSecurityDescriptor);
+#endif
+
     *PSecurityDescriptor = RelativeSecurityDescriptor;
 
     Result = STATUS_SUCCESS;
@@ -1157,6 +1725,13 @@ FSP_API NTSTATUS FspPosixMapSecurityDescriptorToPermissions(
     UINT32 AceUid = 0;
     UINT32 Uid, Gid, Mode;
     NTSTATUS Result;
+#if !defined(_KERNEL_MODE)
+    LONG Generation = FspPosixSidCacheGeneration;
+    SECURITY_DESCRIPTOR_CONTROL Control;
+    DWORD Revision;
+    UINT32 KeyUid = 0, KeyGid = 0, KeyFlags = OwnerOptional | (GroupOptional << 1);
+    ULONG Hash = 0, Length = 0;
+#endif
 
     *PUid = 0;
     *PGid = 0;
@@ -1169,6 +1744,32 @@ FSP_API NTSTATUS FspPosixMapSecurityDescriptorToPermissions(
     if (!GetSecurityDescriptorDacl(SecurityDescriptor, &DaclPresent, &Acl, &Defaulted))
         goto lasterror;
 
+#if !defined(_KERNEL_MODE)
+    /* only self-relative descriptors are contiguous and can be hashed */
+    if (GetSecurityDescriptorControl(SecurityDescriptor, &Control, &Revision) &&
+        0 != (Control & SE_SELF_RELATIVE))
+    {
+        Length = GetSecurityDescriptorLength(SecurityDescriptor);
+        if (FspPosixSdCacheLengthMax < Length)
+            Length = 0;
+    }
+    if (0 != Length)
+    {
+        if (0 == OwnerSid)
+            KeyUid = OrigUid;
+        if (0 == GroupSid)
+            KeyGid = OrigGid;
+        Hash = FspPosixSidCacheHashSid(SecurityDescriptor, Length);
+
+        if (FspPosixPermCacheLookup(Generation, Hash, SecurityDescriptor, Length,
+            KeyUid, KeyGid, KeyFlags, PUid, PGid, PMode))
+        {
+            Result = STATUS_SUCCESS;
+            goto exit;
+        }
+    }
+#endif
+
     if (0 == OwnerSid && OwnerOptional)
         Uid = OrigUid;
     else
@@ -1301,6 +1902,12 @@ FSP_API NTSTATUS FspPosixMapSecurityDescriptorToPermissions(
     else
         Mode = 0777;
 
+#if !defined(_KERNEL_MODE)
+    if (0 != Length)
+        FspPosixPermCacheInsert(Generation, Hash, SecurityDescriptor, Length,
+            KeyUid, KeyGid, KeyFlags, Uid, Gid, Mode);
+#endif
+
     *PUid = Uid;
     *PGid = Gid;
     *PMode = Mode;
@@ -1316,88 +1923,42 @@ lasterror:
 }
 
 /*
- * Services for Macintosh and Cygwin compatible filename transformation:
- * Transform characters invalid for Windows filenames to the Unicode
- * private use area in the U+F0XX range.
- *
- * The invalid maps are produced by the following Python script:
- *     reserved = ['<', '>', ':', '"', '\\', '|', '?', '*']
- *     l = [str(int(0 < i < 32 or chr(i) in reserved)) for i in xrange(0, 128)]
- *     print "0x%08x" % int("".join(l[0:32]), 2)
- *     print "0x%08x" % int("".join(l[32:64]), 2)
- *     print "0x%08x" % int("".join(l[64:96]), 2)
- *     print "0x%08x" % int("".join(l[96:128]), 2)
+ * The path conversions are done in a single pass by the kernels in shared/ku/posixpath.h.
+ * The allocating versions first try a buffer sized for the common case of a path that
+ * converts one-to-one and only retry with an exact size if the path needs more room.
  */
-static UINT32 FspPosixInvalidPathChars[4] =
-{
-    0x7fffffff,
-    0x2020002b,
-    0x00000008,
-    0x00000008,
-};
 
 FSP_API NTSTATUS FspPosixMapWindowsToPosixPathEx(PWSTR WindowsPath, char **PPosixPath,
     BOOLEAN Translate)
 {
     FSP_KU_CODE;
 
-    NTSTATUS Result;
-    ULONG Size;
-    char *PosixPath = 0, *p, *q;
+    ULONG Size, RequiredSize;
+    char *PosixPath;
 
     *PPosixPath = 0;
 
-    Size = WideCharToMultiByte(CP_UTF8, 0, WindowsPath, -1, 0, 0, 0, 0);
-    if (0 == Size)
-        goto lasterror;
-
+    Size = (ULONG)wcslen(WindowsPath) + 1;
     PosixPath = MemAlloc(Size);
     if (0 == PosixPath)
-    {
-        Result = STATUS_INSUFFICIENT_RESOURCES;
-        goto exit;
-    }
+        return STATUS_INSUFFICIENT_RESOURCES;
 
-    Size = WideCharToMultiByte(CP_UTF8, 0, WindowsPath, -1, PosixPath, Size, 0, 0);
-    if (0 == Size)
-        goto lasterror;
-
-    if (Translate)
+    RequiredSize = FspPosixPathFromWindows(WindowsPath, PosixPath, Size, Translate);
+    if (RequiredSize > Size)
     {
-        for (p = PosixPath, q = p; *p; p++)
-        {
-            unsigned char c = *p;
+        MemFree(PosixPath);
 
-            if ('\\' == c)
-                *q++ = '/';
-            /* encode characters in the Unicode private use area: U+F0XX -> XX */
-            else if (0xef == c && 0x80 == (0xfc & p[1]) && 0x80 == (0xc0 & p[2]))
-            {
-                c = ((p[1] & 0x3) << 6) | (p[2] & 0x3f);
-                if (128 > c && (FspPosixInvalidPathChars[c >> 5] & (0x80000000 >> (c & 0x1f))))
-                    *q++ = c, p += 2;
-                else
-                    *q++ = *p++, *q++ = *p++, *q++ = *p;
-            }
-            else
-                *q++ = c;
-        }
-        *q = '\0';
+        Size = RequiredSize;
+        PosixPath = MemAlloc(Size);
+        if (0 == PosixPath)
+            return STATUS_INSUFFICIENT_RESOURCES;
+
+        FspPosixPathFromWindows(WindowsPath, PosixPath, Size, Translate);
     }
 
     *PPosixPath = PosixPath;
 
-    Result = STATUS_SUCCESS;
-
-exit:
-    if (!NT_SUCCESS(Result))
-        MemFree(PosixPath);
-
-    return Result;
-
-lasterror:
-    Result = FspNtStatusFromWin32(GetLastError());
-    goto exit;
+    return STATUS_SUCCESS;
 }
 
 FSP_API NTSTATUS FspPosixMapPosixToWindowsPathEx(const char *PosixPath, PWSTR *PWindowsPath,
@@ -1405,53 +1966,72 @@ FSP_API NTSTATUS FspPosixMapPosixToWindowsPathEx(const char *PosixPath, PWSTR *P
 {
     FSP_KU_CODE;
 
-    NTSTATUS Result;
-    ULONG Size;
-    PWSTR WindowsPath = 0, p;
+    ULONG Count, RequiredCount;
+    PWSTR WindowsPath;
 
     *PWindowsPath = 0;
 
-    Size = MultiByteToWideChar(CP_UTF8, 0, PosixPath, -1, 0, 0);
-    if (0 == Size)
-        goto lasterror;
-
-    WindowsPath = MemAlloc(Size * sizeof(WCHAR));
+    Count = (ULONG)strlen(PosixPath) + 1;
+    WindowsPath = MemAlloc(Count * sizeof(WCHAR));
     if (0 == WindowsPath)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    RequiredCount = FspPosixPathToWindows(PosixPath, WindowsPath, Count, Translate);
+    if (RequiredCount > Count)
     {
-        Result = STATUS_INSUFFICIENT_RESOURCES;
-        goto exit;
+        /* cannot happen: UTF-8 never needs fewer bytes than UTF-16 needs WCHAR's */
+        MemFree(WindowsPath);
+
+        Count = RequiredCount;
+        WindowsPath = MemAlloc(Count * sizeof(WCHAR));
+        if (0 == WindowsPath)
+            return STATUS_INSUFFICIENT_RESOURCES;
+
+        FspPosixPathToWindows(PosixPath, WindowsPath, Count, Translate);
     }
 
-    Size = MultiByteToWideChar(CP_UTF8, 0, PosixPath, -1, WindowsPath, Size);
-    if (0 == Size)
-        goto lasterror;
+    *PWindowsPath = WindowsPath;
 
-    if (Translate)
-    {
-        for (p = WindowsPath; *p; p++)
-        {
-            WCHAR c = *p;
+    return STATUS_SUCCESS;
+}
 
-            if (L'/' == c)
-                *p = L'\\';
-            else if (128 > c && (FspPosixInvalidPathChars[c >> 5] & (0x80000000 >> (c & 0x1f))))
-                *p |= 0xf000;
-        }
+FSP_API NTSTATUS FspPosixMapWindowsToPosixPathBuf(PWSTR WindowsPath, char *PosixPath,
+    PULONG PSize, BOOLEAN Translate)
+{
+    FSP_KU_CODE;
+
+    ULONG RequiredSize;
+
+    RequiredSize = FspPosixPathFromWindows(WindowsPath, PosixPath, *PSize, Translate);
+    if (RequiredSize > *PSize)
+    {
+        *PSize = RequiredSize;
+        return STATUS_BUFFER_TOO_SMALL;
     }
 
-    *PWindowsPath = WindowsPath;
+    *PSize = RequiredSize;
 
-    Result = STATUS_SUCCESS;
+    return STATUS_SUCCESS;
+}
 
-exit:
-    if (!NT_SUCCESS(Result))
-        MemFree(WindowsPath);
+FSP_API NTSTATUS FspPosixMapPosixToWindowsPathBuf(const char *PosixPath, PWSTR WindowsPath,
+    PULONG PSize, BOOLEAN Translate)
+{
+    FSP_KU_CODE;
 
-    return Result;
+    ULONG RequiredCount;
 
-lasterror:
-    Result = FspNtStatusFromWin32(GetLastError());
-    goto exit;
+    RequiredCount = FspPosixPathToWindows(PosixPath, WindowsPath,
+        *PSize / sizeof(WCHAR), Translate);
+    if (RequiredCount * sizeof(WCHAR) > *PSize)
+    {
+        *PSize = RequiredCount * sizeof(WCHAR);
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    *PSize = RequiredCount * sizeof(WCHAR);
+
+    return STATUS_SUCCESS;
 }
 
 FSP_API VOID FspPosixDeletePath(void *Path)
@@ -1487,7 +2067,7 @@ FSP_API VOID FspPosixDecodeWindowsPath(PWSTR WindowsPath, ULONG Size)
 
         if (L'/' == c)
             *p = L'\\';
-        else if (128 > c && (FspPosixInvalidPathChars[c >> 5] & (0x80000000 >> (c & 0x1f))))
+        else if (FspPosixIsInvalidPathChar(c))
             *p |= 0xf000;
     }
 }
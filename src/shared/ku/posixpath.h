@@ -0,0 +1,325 @@
+/**
+ * @file shared/ku/posixpath.h
+ *
+ * Shared kernel/user Windows (UTF-16) <-> POSIX (UTF-8) path conversion.
+ *
+ * @copyright 2015-2026 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this software
+ * in accordance with the commercial license agreement provided in
+ * conjunction with the software.  The terms and conditions of any such
+ * commercial license agreement shall govern, supersede, and render
+ * ineffective any application of the GPLv3 license to this software,
+ * notwithstanding of any reference thereto in the software or
+ * associated repository.
+ */
+
+#ifndef WINFSP_SHARED_KU_POSIXPATH_H_INCLUDED
+#define WINFSP_SHARED_KU_POSIXPATH_H_INCLUDED
+
+/*
+ * The path conversion functions in this file convert between UTF-16 and UTF-8
+ * and (optionally) translate path separators and characters that are invalid
+ * in Windows file names in a single pass. The output is written to a caller
+ * supplied buffer; the functions return the size required for the complete
+ * output (including the terminating NUL) and only write as much as fits.
+ *
+ * The conversion is equivalent to WideCharToMultiByte/MultiByteToWideChar
+ * with CP_UTF8 followed by the translation pass that we used to do: unpaired
+ * surrogates and invalid UTF-8 sequences (each maximal subpart) are replaced
+ * by U+FFFD.
+ *
+ * Runs of ASCII characters that need no translation are converted 16 bytes
+ * at a time using SSE2 or NEON. Vector loads are always aligned so that they
+ * never cross into a page that the string does not occupy.
+ */
+
+#if !defined(FSP_POSIXPATH_NO_SIMD)
+#if defined(_M_X64) || (defined(_M_IX86) && !defined(_KERNEL_MODE)) || defined(__SSE2__)
+#define FSP_POSIXPATH_SSE2
+#include <emmintrin.h>
+#elif defined(_M_ARM64) && !defined(_KERNEL_MODE)
+#define FSP_POSIXPATH_NEON
+#include <arm64_neon.h>
+#elif defined(__aarch64__)
+#define FSP_POSIXPATH_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+/*
+ * Services for Macintosh and Cygwin compatible filename transformation:
+ * Transform characters invalid for Windows filenames to the Unicode
+ * private use area in the U+F0XX range.
+ *
+ * The invalid maps are produced by the following Python script:
+ *     reserved = ['<', '>', ':', '"', '\\', '|', '?', '*']
+ *     l = [str(int(0 < i < 32 or chr(i) in reserved)) for i in xrange(0, 128)]
+ *     print "0x%08x" % int("".join(l[0:32]), 2)
+ *     print "0x%08x" % int("".join(l[32:64]), 2)
+ *     print "0x%08x" % int("".join(l[64:96]), 2)
+ *     print "0x%08x" % int("".join(l[96:128]), 2)
+ */
+static const UINT32 FspPosixInvalidPathChars[4] =
+{
+    0x7fffffff,
+    0x2020002b,
+    0x00000008,
+    0x00000008,
+};
+
+#define FspPosixIsInvalidPathChar(c)    \
+    (128 > (c) && (FspPosixInvalidPathChars[(c) >> 5] & (0x80000000 >> ((c) & 0x1f))))
+
+#define FspPosixPathEmit(Buffer, Size, N, Value)\
+    do                                  \
+    {                                   \
+        if ((Size) > (N))               \
+            (Buffer)[(N)] = (Value);    \
+        (N)++;                          \
+    } while (0,0)
+
+static inline
+ULONG FspPosixPathFromWindows(const WCHAR *WindowsPath, char *PosixPath, ULONG PosixSize,
+    BOOLEAN Translate)
+{
+    const WCHAR *p = WindowsPath;
+    ULONG N = 0;
+    ULONG c;
+
+    for (;;)
+    {
+#if defined(FSP_POSIXPATH_SSE2) || defined(FSP_POSIXPATH_NEON)
+        /* fast path: 8 ASCII chars (no NUL) at a time from 16-byte aligned addresses */
+        if (0 == ((UINT_PTR)p & 15))
+        {
+            while (PosixSize >= N + 8)
+            {
+#if defined(FSP_POSIXPATH_SSE2)
+                __m128i v = _mm_load_si128((const __m128i *)p);
+                __m128i ascii = _mm_cmpeq_epi16(
+                    _mm_and_si128(v, _mm_set1_epi16((short)0xff80)), _mm_setzero_si128());
+                __m128i nul = _mm_cmpeq_epi16(v, _mm_setzero_si128());
+                if (0xffff != _mm_movemask_epi8(_mm_andnot_si128(nul, ascii)))
+                    break;
+                if (Translate)
+                    v = _mm_xor_si128(v,
+                        _mm_and_si128(
+                            _mm_cmpeq_epi16(v, _mm_set1_epi16('\\')),
+                            _mm_set1_epi16('\\' ^ '/')));
+                _mm_storel_epi64((__m128i *)(PosixPath + N), _mm_packus_epi16(v, v));
+#else
+                uint16x8_t v = vld1q_u16((const UINT16 *)p);
+                uint16x8_t bad = vorrq_u16(
+                    vceqq_u16(v, vdupq_n_u16(0)),
+                    vtstq_u16(v, vdupq_n_u16(0xff80)));
+                if (0 != vmaxvq_u16(bad))
+                    break;
+                if (Translate)
+                    v = veorq_u16(v,
+                        vandq_u16(
+                            vceqq_u16(v, vdupq_n_u16('\\')),
+                            vdupq_n_u16('\\' ^ '/')));
+                vst1_u8((UINT8 *)(PosixPath + N), vmovn_u16(v));
+#endif
+                p += 8;
+                N += 8;
+            }
+        }
+#endif
+
+        c = *p++;
+        if (0 == c)
+            break;
+
+        if (0x80 > c)
+        {
+            if (Translate && '\\' == c)
+                c = '/';
+            FspPosixPathEmit(PosixPath, PosixSize, N, (char)c);
+        }
+        else if (0x800 > c)
+        {
+            FspPosixPathEmit(PosixPath, PosixSize, N, (char)(0xc0 | (c >> 6)));
+            FspPosixPathEmit(PosixPath, PosixSize, N, (char)(0x80 | (c & 0x3f)));
+        }
+        else if (0xd800 <= c && c <= 0xdbff && 0xdc00 <= *p && *p <= 0xdfff)
+        {
+            c = 0x10000 + ((c - 0xd800) << 10) + (*p++ - 0xdc00);
+            FspPosixPathEmit(PosixPath, PosixSize, N, (char)(0xf0 | (c >> 18)));
+            FspPosixPathEmit(PosixPath, PosixSize, N, (char)(0x80 | ((c >> 12) & 0x3f)));
+            FspPosixPathEmit(PosixPath, PosixSize, N, (char)(0x80 | ((c >> 6) & 0x3f)));
+            FspPosixPathEmit(PosixPath, PosixSize, N, (char)(0x80 | (c & 0x3f)));
+        }
+        else
+        {
+            /* unpaired surrogate */
+            if (0xd800 <= c && c <= 0xdfff)
+                c = 0xfffd;
+
+            /* encode characters in the Unicode private use area: U+F0XX -> XX */
+            if (Translate && 0xf000 <= c && c <= 0xf07f && FspPosixIsInvalidPathChar(c & 0x7f))
+                FspPosixPathEmit(PosixPath, PosixSize, N, (char)(c & 0x7f));
+            else
+            {
+                FspPosixPathEmit(PosixPath, PosixSize, N, (char)(0xe0 | (c >> 12)));
+                FspPosixPathEmit(PosixPath, PosixSize, N, (char)(0x80 | ((c >> 6) & 0x3f)));
+                FspPosixPathEmit(PosixPath, PosixSize, N, (char)(0x80 | (c & 0x3f)));
+            }
+        }
+    }
+
+    FspPosixPathEmit(PosixPath, PosixSize, N, '\0');
+
+    return N;
+}
+
+static inline
+ULONG FspPosixPathToWindows(const char *PosixPath, WCHAR *WindowsPath, ULONG WindowsCount,
+    BOOLEAN Translate)
+{
+    const UINT8 *p = (const UINT8 *)PosixPath;
+    ULONG N = 0;
+    ULONG c, d, Need;
+    UINT8 Lo, Hi;
+
+    for (;;)
+    {
+#if defined(FSP_POSIXPATH_SSE2) || defined(FSP_POSIXPATH_NEON)
+        /* fast path: 16 printable ASCII chars that are valid in Windows file names */
+        if (0 == ((UINT_PTR)p & 15))
+        {
+            while (WindowsCount >= N + 16)
+            {
+#if defined(FSP_POSIXPATH_SSE2)
+                __m128i v = _mm_load_si128((const __m128i *)p);
+                __m128i bad = _mm_cmplt_epi8(v, _mm_set1_epi8(0x20));
+                if (Translate)
+                {
+                    bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+                    bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8('*')));
+                    bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8(':')));
+                    bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8('<')));
+                    bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8('>')));
+                    bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8('?')));
+                    bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+                    bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8('|')));
+                }
+                if (0 != _mm_movemask_epi8(bad))
+                    break;
+                if (Translate)
+                    v = _mm_xor_si128(v,
+                        _mm_and_si128(
+                            _mm_cmpeq_epi8(v, _mm_set1_epi8('/')),
+                            _mm_set1_epi8('\\' ^ '/')));
+                _mm_storeu_si128((__m128i *)(WindowsPath + N),
+                    _mm_unpacklo_epi8(v, _mm_setzero_si128()));
+                _mm_storeu_si128((__m128i *)(WindowsPath + N + 8),
+                    _mm_unpackhi_epi8(v, _mm_setzero_si128()));
+#else
+                uint8x16_t v = vld1q_u8(p);
+                uint8x16_t bad = vcgeq_u8(vsubq_u8(v, vdupq_n_u8(0x20)), vdupq_n_u8(0x60));
+                if (Translate)
+                {
+                    bad = vorrq_u8(bad, vceqq_u8(v, vdupq_n_u8('"')));
+                    bad = vorrq_u8(bad, vceqq_u8(v, vdupq_n_u8('*')));
+                    bad = vorrq_u8(bad, vceqq_u8(v, vdupq_n_u8(':')));
+                    bad = vorrq_u8(bad, vceqq_u8(v, vdupq_n_u8('<')));
+                    bad = vorrq_u8(bad, vceqq_u8(v, vdupq_n_u8('>')));
+                    bad = vorrq_u8(bad, vceqq_u8(v, vdupq_n_u8('?')));
+                    bad = vorrq_u8(bad, vceqq_u8(v, vdupq_n_u8('\\')));
+                    bad = vorrq_u8(bad, vceqq_u8(v, vdupq_n_u8('|')));
+                }
+                if (0 != vmaxvq_u8(bad))
+                    break;
+                if (Translate)
+                    v = veorq_u8(v,
+                        vandq_u8(
+                            vceqq_u8(v, vdupq_n_u8('/')),
+                            vdupq_n_u8('\\' ^ '/')));
+                vst1q_u16((UINT16 *)(WindowsPath + N), vmovl_u8(vget_low_u8(v)));
+                vst1q_u16((UINT16 *)(WindowsPath + N + 8), vmovl_u8(vget_high_u8(v)));
+#endif
+                p += 16;
+                N += 16;
+            }
+        }
+#endif
+
+        c = *p++;
+        if (0 == c)
+            break;
+
+        if (0x80 > c)
+        {
+            if (Translate)
+            {
+                if ('/' == c)
+                    c = '\\';
+                else if (FspPosixIsInvalidPathChar(c))
+                    c |= 0xf000;
+            }
+            FspPosixPathEmit(WindowsPath, WindowsCount, N, (WCHAR)c);
+            continue;
+        }
+
+        Lo = 0x80, Hi = 0xbf;
+        if (0xc2 <= c && c <= 0xdf)
+            Need = 1, c &= 0x1f;
+        else if (0xe0 <= c && c <= 0xef)
+        {
+            if (0xe0 == c)
+                Lo = 0xa0;          /* overlong */
+            else if (0xed == c)
+                Hi = 0x9f;          /* surrogates */
+            Need = 2, c &= 0x0f;
+        }
+        else if (0xf0 <= c && c <= 0xf4)
+        {
+            if (0xf0 == c)
+                Lo = 0x90;          /* overlong */
+            else if (0xf4 == c)
+                Hi = 0x8f;          /* > U+10FFFF */
+            Need = 3, c &= 0x07;
+        }
+        else
+            Need = 0, c = 0xfffd;
+
+        for (; 0 < Need; Need--, Lo = 0x80, Hi = 0xbf)
+        {
+            d = *p;
+            if (Lo > d || d > Hi)
+            {
+                /* do not consume the offending byte; it may start a new sequence */
+                c = 0xfffd;
+                break;
+            }
+            c = (c << 6) | (d & 0x3f);
+            p++;
+        }
+
+        if (0x10000 <= c)
+        {
+            c -= 0x10000;
+            FspPosixPathEmit(WindowsPath, WindowsCount, N, (WCHAR)(0xd800 + (c >> 10)));
+            FspPosixPathEmit(WindowsPath, WindowsCount, N, (WCHAR)(0xdc00 + (c & 0x3ff)));
+        }
+        else
+            FspPosixPathEmit(WindowsPath, WindowsCount, N, (WCHAR)c);
+    }
+
+    FspPosixPathEmit(WindowsPath, WindowsCount, N, L'\0');
+
+    return N;
+}
+
+#undef FspPosixPathEmit
+
+#endif
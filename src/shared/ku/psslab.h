@@ -0,0 +1,155 @@
+/**
+ * @file shared/ku/psslab.h
+ *
+ * Per-process slabs of user mode buffers.
+ *
+ * @copyright 2015-2026 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this software
+ * in accordance with the commercial license agreement provided in
+ * conjunction with the software.  The terms and conditions of any such
+ * commercial license agreement shall govern, supersede, and render
+ * ineffective any application of the GPLv3 license to this software,
+ * notwithstanding of any reference thereto in the software or
+ * associated repository.
+ */
+
+#ifndef WINFSP_SHARED_KU_PSSLAB_H_INCLUDED
+#define WINFSP_SHARED_KU_PSSLAB_H_INCLUDED
+
+/*
+ * A slab is a single reservation of SlotCount * SlotSize bytes of address space
+ * in a (file system) process, carved into SlotCount fixed size slots. Each slot
+ * is committed the first time that it is used and stays committed for the life
+ * of the slab, so a process pays for one reservation (one VAD) instead of one
+ * allocation per buffer and only commits the slots that it actually needs.
+ *
+ * The free slots are kept in a 32-bit mask, so SlotCount is at most
+ * FSP_PSSLAB_SLOT_COUNT_MAX:
+ *
+ * - FspPsSlabPop takes the lowest free slot with a compare-exchange loop.
+ * - FspPsSlabPush returns a slot with an atomic OR.
+ *
+ * Both are lock-free. Because a slot is identified by its bit rather than by a
+ * pointer that is reused, the mask has no ABA problem. A slot is owned by exactly
+ * one thread between pop and push, so that thread alone commits it; the committed
+ * mask is only updated with an atomic OR and only read as a hint.
+ *
+ * The caller owns the slab's memory and its lifetime; these functions never
+ * allocate. They only depend on the VOID, BOOLEAN, UINT8, UINT32 and UINT_PTR
+ * types and the compiler's atomic operations so that they can be built and
+ * exercised outside the kernel (see tst/psslab).
+ */
+
+#define FSP_PSSLAB_SLOT_COUNT_MAX       32
+#define FSP_PSSLAB_NO_SLOT              ((UINT32)-1)
+
+#if defined(_MSC_VER)
+#define FspPsSlabLoad(P)                (*(volatile UINT32 *)(P))
+#define FspPsSlabCompareExchange(P, V, C)\
+    ((UINT32)InterlockedCompareExchange((volatile LONG *)(P), (LONG)(V), (LONG)(C)))
+#define FspPsSlabFetchOr(P, V)          ((UINT32)InterlockedOr((volatile LONG *)(P), (LONG)(V)))
+#else
+#define FspPsSlabLoad(P)                __atomic_load_n(P, __ATOMIC_RELAXED)
+#define FspPsSlabCompareExchange(P, V, C)\
+    __extension__ ({ UINT32 Comparand_ = (C); \
+        __atomic_compare_exchange_n(P, &Comparand_, V, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED); \
+        Comparand_; })
+#define FspPsSlabFetchOr(P, V)          __atomic_fetch_or(P, V, __ATOMIC_RELEASE)
+#endif
+
+typedef struct
+{
+    UINT8 *Base;                        /* start of the reservation */
+    UINT32 SlotSize, SlotCount;
+    volatile UINT32 FreeMask;           /* bit set: slot is free */
+    volatile UINT32 CommitMask;         /* bit set: slot is committed */
+} FSP_PSSLAB;
+
+static inline UINT32 FspPsSlabAllMask(UINT32 SlotCount)
+{
+    return FSP_PSSLAB_SLOT_COUNT_MAX <= SlotCount ? ~(UINT32)0 : ((UINT32)1 << SlotCount) - 1;
+}
+
+static inline VOID FspPsSlabInitialize(FSP_PSSLAB *Slab, VOID *Base, UINT32 SlotSize,
+    UINT32 SlotCount)
+{
+    Slab->Base = (UINT8 *)Base;
+    Slab->SlotSize = SlotSize;
+    Slab->SlotCount = SlotCount;
+    Slab->FreeMask = FspPsSlabAllMask(SlotCount);
+    Slab->CommitMask = 0;
+}
+
+static inline UINT32 FspPsSlabLowestBit(UINT32 Mask)
+{
+    /* index of the lowest set bit; Mask must not be 0 */
+    UINT32 Index = 0;
+    while (0 == (Mask & 1))
+    {
+        Mask >>= 1;
+        Index++;
+    }
+    return Index;
+}
+
+static inline UINT32 FspPsSlabPop(FSP_PSSLAB *Slab)
+{
+    /* take a free slot; FSP_PSSLAB_NO_SLOT if there is none */
+    UINT32 Mask, Prev, Slot;
+
+    Mask = FspPsSlabLoad(&Slab->FreeMask);
+    for (;;)
+    {
+        if (0 == Mask)
+            return FSP_PSSLAB_NO_SLOT;
+        Slot = FspPsSlabLowestBit(Mask);
+        Prev = FspPsSlabCompareExchange(&Slab->FreeMask, Mask & ~((UINT32)1 << Slot), Mask);
+        if (Prev == Mask)
+            return Slot;
+        Mask = Prev;
+    }
+}
+
+static inline VOID FspPsSlabPush(FSP_PSSLAB *Slab, UINT32 Slot)
+{
+    FspPsSlabFetchOr(&Slab->FreeMask, (UINT32)1 << Slot);
+}
+
+static inline BOOLEAN FspPsSlabIsCommitted(FSP_PSSLAB *Slab, UINT32 Slot)
+{
+    /* only meaningful for a slot that the caller owns */
+    return 0 != (FspPsSlabLoad(&Slab->CommitMask) & ((UINT32)1 << Slot));
+}
+
+static inline VOID FspPsSlabSetCommitted(FSP_PSSLAB *Slab, UINT32 Slot)
+{
+    FspPsSlabFetchOr(&Slab->CommitMask, (UINT32)1 << Slot);
+}
+
+static inline VOID *FspPsSlabSlotAddress(FSP_PSSLAB *Slab, UINT32 Slot)
+{
+    return Slab->Base + (UINT_PTR)Slot * Slab->SlotSize;
+}
+
+static inline UINT32 FspPsSlabSlotOfAddress(FSP_PSSLAB *Slab, VOID *Address)
+{
+    /* slot that starts at Address; FSP_PSSLAB_NO_SLOT if Address is not a slot */
+    UINT_PTR Offset = (UINT_PTR)Address - (UINT_PTR)Slab->Base;
+
+    if ((UINT_PTR)Address < (UINT_PTR)Slab->Base ||
+        (UINT_PTR)Slab->SlotCount * Slab->SlotSize <= Offset ||
+        0 != Offset % Slab->SlotSize)
+        return FSP_PSSLAB_NO_SLOT;
+
+    return (UINT32)(Offset / Slab->SlotSize);
+}
+
+#endif
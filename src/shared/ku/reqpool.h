@@ -0,0 +1,145 @@
+/**
+ * @file shared/ku/reqpool.h
+ *
+ * Size class caches for transact request allocations.
+ *
+ * @copyright 2015-2026 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this software
+ * in accordance with the commercial license agreement provided in
+ * conjunction with the software.  The terms and conditions of any such
+ * commercial license agreement shall govern, supersede, and render
+ * ineffective any application of the GPLv3 license to this software,
+ * notwithstanding of any reference thereto in the software or
+ * associated repository.
+ */
+
+#ifndef WINFSP_SHARED_KU_REQPOOL_H_INCLUDED
+#define WINFSP_SHARED_KU_REQPOOL_H_INCLUDED
+
+/*
+ * Every FSP_FSCTL_TRANSACT_REQ (with its internal header) is allocated in one of
+ * FSP_FSCTL_REQUEST_POOL_CLASS_COUNT size classes: powers of two from 128 bytes
+ * up to 16K, which covers FSP_FSCTL_TRANSACT_REQ_SIZEMAX plus the header. A block
+ * is always allocated with the full size of its class, so that a freed block can
+ * serve any later request of the same class.
+ *
+ * Every processor has a "magazine" per size class: a small stack of free blocks.
+ * An allocation pops a block from the magazine of the current processor and only
+ * goes to the system allocator when the magazine is empty; a free pushes the block
+ * back unless the magazine is at its depth, in which case the block is returned to
+ * the system allocator. The magazine holds block pointers only and never touches
+ * the blocks, so it may cache pageable blocks even though it is itself accessed
+ * with preemption disabled.
+ *
+ * The depth of a class is derived from the IRP capacity of the mounted volumes
+ * (FSP_FSCTL_VOLUME_PARAMS::IrpCapacity): their sum spread over the processors,
+ * but never more than FSP_REQPOOL_DEPTH_MAX blocks or FSP_REQPOOL_CLASS_BYTES_MAX
+ * bytes per processor and class. So the caches grow when volumes are mounted and
+ * without volumes the magazines only empty. A magazine above its depth (after a
+ * volume is unmounted) is not trimmed eagerly: it drains through allocations.
+ *
+ * Each magazine also counts allocations and frees and how many of them it served.
+ *
+ * These functions do not take locks; the caller guarantees that only one thread
+ * at a time accesses a magazine (in the kernel: by raising IRQL to DISPATCH_LEVEL
+ * and using the magazine of the current processor). They only depend on the VOID,
+ * BOOLEAN, UINT32 and UINT64 types and the winfsp/fsctl.h definitions so that they
+ * can be built and exercised outside the kernel (see tst/reqpool).
+ */
+
+#define FSP_REQPOOL_CLASS_SHIFT_MIN     7       /* 128 bytes */
+#define FSP_REQPOOL_CLASS_COUNT         FSP_FSCTL_REQUEST_POOL_CLASS_COUNT
+#define FSP_REQPOOL_DEPTH_MAX           32
+#define FSP_REQPOOL_CLASS_BYTES_MAX     (16 * 1024)
+
+typedef struct
+{
+    UINT32 Count;
+    UINT32 Reserved;
+    UINT64 AllocCount, AllocHitCount, FreeCount, FreeHitCount;
+    VOID *Blocks[FSP_REQPOOL_DEPTH_MAX];
+} FSP_REQPOOL_MAGAZINE;
+
+static inline UINT32 FspReqPoolClass(UINT32 Size)
+{
+    /* size class of an allocation; FSP_REQPOOL_CLASS_COUNT if Size is too large */
+    UINT32 Class = 0;
+
+    Size = (Size - 1) >> FSP_REQPOOL_CLASS_SHIFT_MIN;
+    while (0 != Size && FSP_REQPOOL_CLASS_COUNT > Class)
+    {
+        Size >>= 1;
+        Class++;
+    }
+
+    return 0 == Size ? Class : FSP_REQPOOL_CLASS_COUNT;
+}
+
+static inline UINT32 FspReqPoolClassSize(UINT32 Class)
+{
+    return 1U << (FSP_REQPOOL_CLASS_SHIFT_MIN + Class);
+}
+
+static inline UINT32 FspReqPoolDepth(UINT32 BlockSize, UINT32 IrpCapacity, UINT32 ProcessorCount)
+{
+    /* magazine depth for blocks of BlockSize given the IRP capacity of all volumes */
+    UINT32 Depth = IrpCapacity / (0 != ProcessorCount ? ProcessorCount : 1);
+    UINT32 DepthMax = FSP_REQPOOL_CLASS_BYTES_MAX / BlockSize;
+
+    if (FSP_REQPOOL_DEPTH_MAX < DepthMax)
+        DepthMax = FSP_REQPOOL_DEPTH_MAX;
+    if (0 != IrpCapacity && 0 == Depth)
+        Depth = 1;
+    if (0 == DepthMax)
+        DepthMax = 1;
+
+    return DepthMax < Depth ? DepthMax : Depth;
+}
+
+static inline VOID *FspReqPoolGet(FSP_REQPOOL_MAGAZINE *Magazine)
+{
+    /* a cached block or 0; on 0 the caller allocates a block of the class size */
+    Magazine->AllocCount++;
+    if (0 == Magazine->Count)
+        return 0;
+    Magazine->AllocHitCount++;
+    return Magazine->Blocks[--Magazine->Count];
+}
+
+static inline BOOLEAN FspReqPoolPut(FSP_REQPOOL_MAGAZINE *Magazine, UINT32 Depth, VOID *Block)
+{
+    /* returns TRUE if the block was cached; on FALSE the caller frees it */
+    Magazine->FreeCount++;
+    if (Depth <= Magazine->Count || FSP_REQPOOL_DEPTH_MAX <= Magazine->Count)
+        return 0;
+    Magazine->FreeHitCount++;
+    Magazine->Blocks[Magazine->Count++] = Block;
+    return 1;
+}
+
+static inline VOID *FspReqPoolDrain(FSP_REQPOOL_MAGAZINE *Magazine)
+{
+    /* remove a cached block without counting it; 0 when empty */
+    return 0 != Magazine->Count ? Magazine->Blocks[--Magazine->Count] : 0;
+}
+
+static inline VOID FspReqPoolAddInfo(FSP_FSCTL_REQUEST_POOL_CLASS_INFO *Info,
+    const FSP_REQPOOL_MAGAZINE *Magazine)
+{
+    /* unsynchronized: the counters of a busy magazine may be slightly stale */
+    Info->CachedCount += Magazine->Count;
+    Info->AllocCount += Magazine->AllocCount;
+    Info->AllocHitCount += Magazine->AllocHitCount;
+    Info->FreeCount += Magazine->FreeCount;
+    Info->FreeHitCount += Magazine->FreeHitCount;
+}
+
+#endif
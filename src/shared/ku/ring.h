@@ -0,0 +1,389 @@
+/**
+ * @file shared/ku/ring.h
+ *
+ * Shared memory request/response rings.
+ *
+ * @copyright 2015-2026 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this software
+ * in accordance with the commercial license agreement provided in
+ * conjunction with the software.  The terms and conditions of any such
+ * commercial license agreement shall govern, supersede, and render
+ * ineffective any application of the GPLv3 license to this software,
+ * notwithstanding of any reference thereto in the software or
+ * associated repository.
+ */
+
+#ifndef WINFSP_SHARED_KU_RING_H_INCLUDED
+#define WINFSP_SHARED_KU_RING_H_INCLUDED
+
+/*
+ * A ring area is a block of memory shared by the FSD and a file system process.
+ * It starts with an FSP_RING_AREA header and contains two rings: a request ring
+ * that the FSD produces into and the file system dispatcher consumes from, and a
+ * response ring in the opposite direction. All positions in the area are offsets,
+ * so each side may map it at a different address.
+ *
+ * Layout
+ *
+ * A ring is an FSP_RING_SHARED header followed by a data area whose size is a
+ * power of two. The header keeps the producer position (Tail), the consumer
+ * position (Head) and the wait flags on separate cache lines. Positions are byte
+ * counts that run freely and wrap modulo 2^32; Tail - Head is the number of bytes
+ * in use. The data area holds records: an FSP_RING_RECORD header followed by the
+ * payload, padded to FSP_RING_RECORD_ALIGNMENT. A record never wraps around the
+ * end of the data area; when it does not fit the producer first fills the rest
+ * of the data area with a padding record, which the consumer skips. A record may
+ * take at most half of the data area, so that an empty ring always has room.
+ *
+ * Protocol
+ *
+ * Each ring has a single producer and a single consumer; a side with several
+ * threads serializes them itself. The producer writes a record and then
+ * publishes it by advancing Tail with release semantics; the consumer reads Tail
+ * with acquire semantics, so it sees every record below Tail in full. It then
+ * releases the space by advancing Head with release semantics. Each side keeps
+ * its own position in its private FSP_RING view and never reads it back from
+ * shared memory, and it validates everything that it reads from the peer: a
+ * position that is more than a data area away or a malformed record makes the
+ * ring "broken" and the caller must stop using it. The consumer must also copy
+ * or validate the payload before it trusts it, because the peer can still write
+ * to it.
+ *
+ * Wake-up rules
+ *
+ * Neither side makes a system call while the other side keeps up. A consumer that
+ * finds the ring empty calls FspRingConsumerPrepareWait, which sets the
+ * FspRingConsumerWaiting flag, issues a full barrier and checks the ring again;
+ * if the ring is still empty it may sleep until woken. A producer issues a full
+ * barrier after it publishes a record and clears the flag; if the flag was set
+ * it must wake the consumer. The barriers on both sides guarantee that either the
+ * consumer sees the new record or the producer sees the flag, so a wake-up is
+ * never lost; and a producer makes the (expensive) wake-up call at most once per
+ * sleep. A producer that finds the ring full follows the same rules with the
+ * FspRingProducerWaiting flag, and the consumer wakes it when it releases space.
+ * How a side sleeps and is woken (an event, a futex, a transact call) is up to
+ * the caller; the flags live in a single 32-bit word so that it can also serve
+ * as a futex.
+ *
+ * These functions do not allocate memory or take locks. They only depend on the
+ * VOID, BOOLEAN, UINT8, UINT32 and UINT64 types and the compiler's atomic
+ * operations so that they can be built and exercised outside the kernel (see
+ * tst/ring).
+ */
+
+#define FSP_RING_VERSION                1
+#define FSP_RING_CACHE_LINE_SIZE        64
+#define FSP_RING_RECORD_ALIGNMENT       8
+#define FSP_RING_ALIGN_UP(x)            \
+    (((x) + (FSP_RING_RECORD_ALIGNMENT - 1)) & ~(FSP_RING_RECORD_ALIGNMENT - 1))
+#define FSP_RING_DATA_SIZE_MIN          4096
+#define FSP_RING_DATA_SIZE_MAX          0x40000000
+
+#if defined(_MSC_VER)
+#define FspRingLoadAcquire(P)           ((UINT32)ReadAcquire((volatile LONG *)(P)))
+#define FspRingStoreRelease(P, V)       WriteRelease((volatile LONG *)(P), (LONG)(V))
+#define FspRingFetchOr(P, V)            ((UINT32)InterlockedOr((volatile LONG *)(P), (LONG)(V)))
+#define FspRingFetchAnd(P, V)           ((UINT32)InterlockedAnd((volatile LONG *)(P), (LONG)(V)))
+#define FspRingFullBarrier()            MemoryBarrier()
+#else
+#define FspRingLoadAcquire(P)           __atomic_load_n(P, __ATOMIC_ACQUIRE)
+#define FspRingStoreRelease(P, V)       __atomic_store_n(P, V, __ATOMIC_RELEASE)
+#define FspRingFetchOr(P, V)            __atomic_fetch_or(P, V, __ATOMIC_SEQ_CST)
+#define FspRingFetchAnd(P, V)           __atomic_fetch_and(P, V, __ATOMIC_SEQ_CST)
+#define FspRingFullBarrier()            __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
+enum
+{
+    FspRingConsumerWaiting              = 0x01,
+    FspRingProducerWaiting              = 0x02,
+};
+
+enum
+{
+    FspRingRecordData                   = 0,
+    FspRingRecordPadding                = 1,
+};
+
+typedef struct
+{
+    UINT32 Version;                     /* FSP_RING_VERSION */
+    UINT32 Size;                        /* size of the area in bytes */
+    UINT32 RequestRingOffset;           /* FSD -> file system */
+    UINT32 RequestDataSize;
+    UINT32 ResponseRingOffset;          /* file system -> FSD */
+    UINT32 ResponseDataSize;
+    UINT8 Reserved[FSP_RING_CACHE_LINE_SIZE - 6 * sizeof(UINT32)];
+} FSP_RING_AREA;
+
+typedef struct
+{
+    volatile UINT32 Tail;               /* written by the producer */
+    UINT8 TailPadding[FSP_RING_CACHE_LINE_SIZE - sizeof(UINT32)];
+    volatile UINT32 Head;               /* written by the consumer */
+    UINT8 HeadPadding[FSP_RING_CACHE_LINE_SIZE - sizeof(UINT32)];
+    volatile UINT32 Flags;              /* FspRing*Waiting; written by both */
+    UINT8 FlagsPadding[FSP_RING_CACHE_LINE_SIZE - sizeof(UINT32)];
+    UINT8 Data[];
+} FSP_RING_SHARED;
+
+typedef struct
+{
+    UINT32 Size;                        /* header and payload; not aligned */
+    UINT32 Kind;                        /* FspRingRecord* */
+} FSP_RING_RECORD;
+
+typedef struct
+{
+    /* private view of a ring; never placed in shared memory */
+    FSP_RING_SHARED *Shared;
+    UINT32 DataSize;
+    UINT32 Position;                    /* our Tail (producer) or Head (consumer) */
+    BOOLEAN Broken;
+} FSP_RING;
+
+static inline BOOLEAN FspRingIsValidDataSize(UINT32 DataSize)
+{
+    return FSP_RING_DATA_SIZE_MIN <= DataSize && FSP_RING_DATA_SIZE_MAX >= DataSize &&
+        0 == (DataSize & (DataSize - 1));
+}
+
+static inline UINT32 FspRingAreaSize(UINT32 RequestDataSize, UINT32 ResponseDataSize)
+{
+    /* 0 if the sizes are invalid */
+    if (!FspRingIsValidDataSize(RequestDataSize) || !FspRingIsValidDataSize(ResponseDataSize) ||
+        FSP_RING_DATA_SIZE_MAX < RequestDataSize + ResponseDataSize)
+        return 0;
+    return (UINT32)(sizeof(FSP_RING_AREA) +
+        2 * sizeof(FSP_RING_SHARED) + RequestDataSize + ResponseDataSize);
+}
+
+static inline BOOLEAN FspRingAreaInitialize(VOID *Area, UINT32 Size,
+    UINT32 RequestDataSize, UINT32 ResponseDataSize)
+{
+    FSP_RING_AREA *Header = (FSP_RING_AREA *)Area;
+    UINT32 AreaSize = FspRingAreaSize(RequestDataSize, ResponseDataSize);
+
+    if (0 == AreaSize || Size < AreaSize)
+        return 0;
+
+    memset(Area, 0, AreaSize);
+    Header->Version = FSP_RING_VERSION;
+    Header->Size = AreaSize;
+    Header->RequestRingOffset = sizeof(FSP_RING_AREA);
+    Header->RequestDataSize = RequestDataSize;
+    Header->ResponseRingOffset = sizeof(FSP_RING_AREA) + sizeof(FSP_RING_SHARED) + RequestDataSize;
+    Header->ResponseDataSize = ResponseDataSize;
+
+    return 1;
+}
+
+static inline BOOLEAN FspRingOpen(FSP_RING *Ring, VOID *Area, UINT32 Size, BOOLEAN Response,
+    BOOLEAN Producer)
+{
+    /*
+     * Validate the area header (which the peer may have written) once and keep
+     * what we need in the private view. The positions start where the shared
+     * header says, but are only trusted within the data area from then on.
+     */
+    FSP_RING_AREA Header = *(volatile FSP_RING_AREA *)Area;
+    UINT32 Offset, DataSize;
+
+    memset(Ring, 0, sizeof *Ring);
+
+    if (sizeof(FSP_RING_AREA) > Size ||
+        FSP_RING_VERSION != Header.Version || Size < Header.Size ||
+        Header.Size != FspRingAreaSize(Header.RequestDataSize, Header.ResponseDataSize) ||
+        sizeof(FSP_RING_AREA) != Header.RequestRingOffset ||
+        sizeof(FSP_RING_AREA) + sizeof(FSP_RING_SHARED) + Header.RequestDataSize !=
+            Header.ResponseRingOffset)
+        return 0;
+
+    Offset = Response ? Header.ResponseRingOffset : Header.RequestRingOffset;
+    DataSize = Response ? Header.ResponseDataSize : Header.RequestDataSize;
+
+    Ring->Shared = (FSP_RING_SHARED *)((UINT8 *)Area + Offset);
+    Ring->DataSize = DataSize;
+    Ring->Position = Producer ? Ring->Shared->Tail : Ring->Shared->Head;
+
+    return 1;
+}
+
+static inline UINT32 FspRingRecordSizeMax(FSP_RING *Ring)
+{
+    /* largest payload that a record may have */
+    return Ring->DataSize / 2 - (UINT32)sizeof(FSP_RING_RECORD);
+}
+
+static inline UINT32 FspRingProduceSpace(FSP_RING *Ring, UINT32 PayloadSize, UINT32 *PPadding)
+{
+    /* bytes that a record with PayloadSize takes, including any padding record */
+    UINT32 Offset = Ring->Position & (Ring->DataSize - 1);
+    UINT32 Space = FSP_RING_ALIGN_UP((UINT32)sizeof(FSP_RING_RECORD) + PayloadSize);
+    *PPadding = Ring->DataSize - Offset < Space ? Ring->DataSize - Offset : 0;
+    return *PPadding + Space;
+}
+
+static inline VOID *FspRingProduceBegin(FSP_RING *Ring, UINT32 PayloadSize)
+{
+    /*
+     * Reserve room for a record and return a pointer to its payload; 0 if the ring
+     * is full (or broken). The record is not visible to the consumer until
+     * FspRingProduceEnd is called with the same PayloadSize.
+     */
+    FSP_RING_RECORD *Record;
+    UINT32 Head, Used, Space, Padding;
+
+    if (Ring->Broken || FspRingRecordSizeMax(Ring) < PayloadSize)
+        return 0;
+
+    Head = FspRingLoadAcquire(&Ring->Shared->Head);
+    Used = Ring->Position - Head;
+    if (Ring->DataSize < Used)
+    {
+        Ring->Broken = 1;
+        return 0;
+    }
+
+    Space = FspRingProduceSpace(Ring, PayloadSize, &Padding);
+    if (Ring->DataSize - Used < Space)
+        return 0;
+
+    if (0 != Padding)
+    {
+        Record = (FSP_RING_RECORD *)(Ring->Shared->Data + (Ring->Position & (Ring->DataSize - 1)));
+        Record->Size = Padding;
+        Record->Kind = FspRingRecordPadding;
+        Record = (FSP_RING_RECORD *)Ring->Shared->Data;
+    }
+    else
+        Record = (FSP_RING_RECORD *)(Ring->Shared->Data + (Ring->Position & (Ring->DataSize - 1)));
+    Record->Size = (UINT32)sizeof(FSP_RING_RECORD) + PayloadSize;
+    Record->Kind = FspRingRecordData;
+
+    return Record + 1;
+}
+
+static inline BOOLEAN FspRingProduceEnd(FSP_RING *Ring, UINT32 PayloadSize)
+{
+    /* publish the record; returns TRUE if the caller must wake the consumer */
+    UINT32 Padding;
+
+    Ring->Position += FspRingProduceSpace(Ring, PayloadSize, &Padding);
+    FspRingStoreRelease(&Ring->Shared->Tail, Ring->Position);
+    FspRingFullBarrier();
+
+    if (0 == (Ring->Shared->Flags & FspRingConsumerWaiting))
+        return 0;
+    return 0 != (FspRingFetchAnd(&Ring->Shared->Flags, ~FspRingConsumerWaiting) &
+        FspRingConsumerWaiting);
+}
+
+static inline VOID *FspRingConsumeBegin(FSP_RING *Ring, UINT32 *PPayloadSize)
+{
+    /*
+     * Return a pointer to the payload of the next record and its size; 0 if the
+     * ring is empty or broken (check Ring->Broken). The record stays in the ring
+     * until FspRingConsumeEnd is called.
+     */
+    FSP_RING_RECORD Record;
+    UINT32 Tail, Avail, Offset;
+
+    *PPayloadSize = 0;
+
+    if (Ring->Broken)
+        return 0;
+
+    Tail = FspRingLoadAcquire(&Ring->Shared->Tail);
+    for (;;)
+    {
+        Avail = Tail - Ring->Position;
+        if (0 == Avail)
+            return 0;
+        Offset = Ring->Position & (Ring->DataSize - 1);
+        if (Ring->DataSize < Avail || sizeof(FSP_RING_RECORD) > Avail)
+            goto broken;
+
+        Record = *(volatile FSP_RING_RECORD *)(Ring->Shared->Data + Offset);
+        if (sizeof(FSP_RING_RECORD) > Record.Size ||
+            Ring->DataSize - Offset < Record.Size ||
+            Avail < FSP_RING_ALIGN_UP(Record.Size))
+            goto broken;
+
+        if (FspRingRecordPadding == Record.Kind)
+        {
+            /* padding only ever fills the rest of the data area */
+            if (Ring->DataSize - Offset != Record.Size)
+                goto broken;
+            Ring->Position += Record.Size;
+            FspRingStoreRelease(&Ring->Shared->Head, Ring->Position);
+            continue;
+        }
+        if (FspRingRecordData != Record.Kind ||
+            (UINT32)sizeof(FSP_RING_RECORD) + FspRingRecordSizeMax(Ring) < Record.Size)
+            goto broken;
+
+        *PPayloadSize = Record.Size - (UINT32)sizeof(FSP_RING_RECORD);
+        return Ring->Shared->Data + Offset + sizeof(FSP_RING_RECORD);
+    }
+
+broken:
+    Ring->Broken = 1;
+    return 0;
+}
+
+static inline BOOLEAN FspRingConsumeEnd(FSP_RING *Ring, UINT32 PayloadSize)
+{
+    /* release the record; returns TRUE if the caller must wake the producer */
+    Ring->Position += FSP_RING_ALIGN_UP((UINT32)sizeof(FSP_RING_RECORD) + PayloadSize);
+    FspRingStoreRelease(&Ring->Shared->Head, Ring->Position);
+    FspRingFullBarrier();
+
+    if (0 == (Ring->Shared->Flags & FspRingProducerWaiting))
+        return 0;
+    return 0 != (FspRingFetchAnd(&Ring->Shared->Flags, ~FspRingProducerWaiting) &
+        FspRingProducerWaiting);
+}
+
+static inline BOOLEAN FspRingConsumerPrepareWait(FSP_RING *Ring)
+{
+    /*
+     * Returns TRUE if the consumer may sleep: the ring is empty and the producer
+     * will wake it. Returns FALSE if a record arrived in the meantime.
+     */
+    FspRingFetchOr(&Ring->Shared->Flags, FspRingConsumerWaiting);
+    FspRingFullBarrier();
+    if (FspRingLoadAcquire(&Ring->Shared->Tail) == Ring->Position)
+        return 1;
+    FspRingFetchAnd(&Ring->Shared->Flags, ~FspRingConsumerWaiting);
+    return 0;
+}
+
+static inline BOOLEAN FspRingProducerPrepareWait(FSP_RING *Ring, UINT32 PayloadSize)
+{
+    /*
+     * Returns TRUE if the producer may sleep: there is no room for a record with
+     * PayloadSize and the consumer will wake it. Returns FALSE if room was made
+     * in the meantime.
+     */
+    UINT32 Used, Space, Padding;
+
+    FspRingFetchOr(&Ring->Shared->Flags, FspRingProducerWaiting);
+    FspRingFullBarrier();
+    Used = Ring->Position - FspRingLoadAcquire(&Ring->Shared->Head);
+    Space = FspRingProduceSpace(Ring, PayloadSize, &Padding);
+    if (Ring->DataSize >= Used && Ring->DataSize - Used < Space)
+        return 1;
+    FspRingFetchAnd(&Ring->Shared->Flags, ~FspRingProducerWaiting);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,211 @@
+/**
+ * @file shared/ku/wcsname.h
+ *
+ * Shared kernel/user UTF-16 file name comparison kernels.
+ *
+ * @copyright 2015-2026 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this software
+ * in accordance with the commercial license agreement provided in
+ * conjunction with the software.  The terms and conditions of any such
+ * commercial license agreement shall govern, supersede, and render
+ * ineffective any application of the GPLv3 license to this software,
+ * notwithstanding of any reference thereto in the software or
+ * associated repository.
+ */
+
+#ifndef WINFSP_SHARED_KU_WCSNAME_H_INCLUDED
+#define WINFSP_SHARED_KU_WCSNAME_H_INCLUDED
+
+/*
+ * File name comparisons are done one character at a time by most of our code.
+ * The kernels in this file compare 8 characters at a time using SSE2 or NEON:
+ *
+ * - FspWcsnCmpSpan returns the length of the common prefix of two strings.
+ * - FspWcsnAsciiIcmpSpan returns the length of the common prefix of two strings
+ *   when compared case-insensitively, but stops at the first non-ASCII character
+ *   (of either string). The caller must use its own (locale aware) comparison
+ *   for the remainder of the strings in this case.
+ *
+ * Both kernels compare exactly N characters; the NUL character is not special.
+ * Scalar versions are always available and are used for the tails of the strings
+ * and when SIMD is not available. SSE2 is not used in 32-bit kernel mode and NEON
+ * is not used in kernel mode as they would require saving the extended processor
+ * state. AVX2 is not used: file names are short and 8 characters per iteration
+ * already cover a typical name component in one or two iterations.
+ */
+
+#if !defined(FSP_WCSNAME_NO_SIMD)
+#if defined(_M_X64) || (defined(_M_IX86) && !defined(_KERNEL_MODE)) || defined(__SSE2__)
+#define FSP_WCSNAME_SSE2
+#include <emmintrin.h>
+#elif defined(_M_ARM64) && !defined(_KERNEL_MODE)
+#define FSP_WCSNAME_NEON
+#include <arm64_neon.h>
+#elif defined(__aarch64__)
+#define FSP_WCSNAME_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+static inline
+WCHAR FspWcsAsciiUpcase(WCHAR c)
+{
+    return (WCHAR)(((unsigned)c - 'a' <= 'z' - 'a') ? c - ('a' - 'A') : c);
+}
+
+static inline
+SIZE_T FspWcsnCmpSpanScalar(const WCHAR *s, const WCHAR *t, SIZE_T n)
+{
+    SIZE_T i;
+    for (i = 0; n > i && s[i] == t[i]; i++)
+        ;
+    return i;
+}
+
+static inline
+SIZE_T FspWcsnAsciiIcmpSpanScalar(const WCHAR *s, const WCHAR *t, SIZE_T n)
+{
+    SIZE_T i;
+    for (i = 0; n > i; i++)
+    {
+        WCHAR c = s[i], d = t[i];
+        if (0xff80 & (c | d))
+            break;
+        if (FspWcsAsciiUpcase(c) != FspWcsAsciiUpcase(d))
+            break;
+    }
+    return i;
+}
+
+#if defined(FSP_WCSNAME_SSE2)
+static inline
+unsigned FspWcsnSpanCtz(unsigned m)
+{
+#if defined(_MSC_VER)
+    unsigned long i;
+    _BitScanForward(&i, m);
+    return i;
+#else
+    return __builtin_ctz(m);
+#endif
+}
+
+static inline
+SIZE_T FspWcsnCmpSpan(const WCHAR *s, const WCHAR *t, SIZE_T n)
+{
+    SIZE_T i;
+    for (i = 0; n - i >= 8; i += 8)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(t + i));
+        unsigned m = 0xffff & ~_mm_movemask_epi8(_mm_cmpeq_epi16(a, b));
+        if (0 != m)
+            return i + FspWcsnSpanCtz(m) / 2;
+    }
+    return i + FspWcsnCmpSpanScalar(s + i, t + i, n - i);
+}
+
+static inline
+__m128i FspWcsnAsciiUpcase128(__m128i a)
+{
+    /* bias so that 'a'..'z' become the 26 smallest signed 16-bit values */
+    __m128i x = _mm_add_epi16(a, _mm_set1_epi16((short)(0x8000 - 'a')));
+    __m128i l = _mm_cmplt_epi16(x, _mm_set1_epi16((short)(0x8000 + 26)));
+    return _mm_sub_epi16(a, _mm_and_si128(l, _mm_set1_epi16('a' - 'A')));
+}
+
+static inline
+SIZE_T FspWcsnAsciiIcmpSpan(const WCHAR *s, const WCHAR *t, SIZE_T n)
+{
+    SIZE_T i;
+    for (i = 0; n - i >= 8; i += 8)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(t + i));
+        __m128i ascii = _mm_cmpeq_epi16(
+            _mm_and_si128(_mm_or_si128(a, b), _mm_set1_epi16((short)0xff80)),
+            _mm_setzero_si128());
+        __m128i eq = _mm_cmpeq_epi16(FspWcsnAsciiUpcase128(a), FspWcsnAsciiUpcase128(b));
+        unsigned m = 0xffff & ~_mm_movemask_epi8(_mm_and_si128(eq, ascii));
+        if (0 != m)
+            return i + FspWcsnSpanCtz(m) / 2;
+    }
+    return i + FspWcsnAsciiIcmpSpanScalar(s + i, t + i, n - i);
+}
+#elif defined(FSP_WCSNAME_NEON)
+static inline
+SIZE_T FspWcsnNeonFirstLane(uint16x8_t ne)
+{
+    /* narrow each 16-bit lane to 8 bits; the first non-zero byte is the first non-zero lane */
+    UINT64 m = vget_lane_u64(vreinterpret_u64_u8(vmovn_u16(ne)), 0);
+#if defined(_MSC_VER)
+    unsigned long i;
+    _BitScanForward64(&i, m);
+    return i / 8;
+#else
+    return __builtin_ctzll(m) / 8;
+#endif
+}
+
+static inline
+SIZE_T FspWcsnCmpSpan(const WCHAR *s, const WCHAR *t, SIZE_T n)
+{
+    SIZE_T i;
+    for (i = 0; n - i >= 8; i += 8)
+    {
+        uint16x8_t a = vld1q_u16((const UINT16 *)(s + i));
+        uint16x8_t b = vld1q_u16((const UINT16 *)(t + i));
+        uint16x8_t ne = vmvnq_u16(vceqq_u16(a, b));
+        if (0 != vmaxvq_u16(ne))
+            return i + FspWcsnNeonFirstLane(ne);
+    }
+    return i + FspWcsnCmpSpanScalar(s + i, t + i, n - i);
+}
+
+static inline
+uint16x8_t FspWcsnAsciiUpcase128(uint16x8_t a)
+{
+    uint16x8_t l = vcleq_u16(vsubq_u16(a, vdupq_n_u16('a')), vdupq_n_u16('z' - 'a'));
+    return vsubq_u16(a, vandq_u16(l, vdupq_n_u16('a' - 'A')));
+}
+
+static inline
+SIZE_T FspWcsnAsciiIcmpSpan(const WCHAR *s, const WCHAR *t, SIZE_T n)
+{
+    SIZE_T i;
+    for (i = 0; n - i >= 8; i += 8)
+    {
+        uint16x8_t a = vld1q_u16((const UINT16 *)(s + i));
+        uint16x8_t b = vld1q_u16((const UINT16 *)(t + i));
+        uint16x8_t nonascii = vtstq_u16(vorrq_u16(a, b), vdupq_n_u16(0xff80));
+        uint16x8_t ne = vorrq_u16(nonascii,
+            vmvnq_u16(vceqq_u16(FspWcsnAsciiUpcase128(a), FspWcsnAsciiUpcase128(b))));
+        if (0 != vmaxvq_u16(ne))
+            return i + FspWcsnNeonFirstLane(ne);
+    }
+    return i + FspWcsnAsciiIcmpSpanScalar(s + i, t + i, n - i);
+}
+#else
+#define FspWcsnCmpSpan                  FspWcsnCmpSpanScalar
+#define FspWcsnAsciiIcmpSpan            FspWcsnAsciiIcmpSpanScalar
+#endif
+
+/*
+ * Ordinal comparison of exactly N characters.
+ */
+static inline
+int FspWcsnCmp(const WCHAR *s, const WCHAR *t, SIZE_T n)
+{
+    SIZE_T i = FspWcsnCmpSpan(s, t, n);
+    return n > i ? (int)s[i] - (int)t[i] : 0;
+}
+
+#endif
@@ -324,6 +324,8 @@ static NTSTATUS FspFsvolCreateNoLock(
         BooleanFlagOn(AccessState->Flags, TOKEN_HAS_RESTORE_PRIVILEGE);
     BOOLEAN HasTrailingBackslash = FALSE;
     BOOLEAN EaIsReparsePoint = FALSE;
+    BOOLEAN NegNameCacheable;
+    ULONG NegNameGeneration = 0;
     FSP_FILE_NODE *FileNode, *RelatedFileNode;
     FSP_FILE_DESC *FileDesc;
     UNICODE_STRING MainFileName = { 0 }, StreamPart = { 0 };
@@ -565,6 +567,27 @@ static NTSTATUS FspFsvolCreateNoLock(
         return STATUS_CANNOT_DELETE;
     }
 
+    /*
+     * Is the file known not to exist? Only opens of existing files can be answered
+     * from the negative name cache. Callers without traverse privilege are excluded,
+     * because the user mode file system may fail them differently (access denied).
+     */
+    NegNameCacheable = 0 != FsvolDeviceExtension->NegNameCache &&
+        (FILE_OPEN == CreateDisposition || FILE_OVERWRITE == CreateDisposition) &&
+        !FlagOn(Flags, SL_OPEN_TARGET_DIRECTORY) &&
+        0 == StreamPart.Buffer &&
+        HasTraversePrivilege;
+    if (NegNameCacheable)
+    {
+        /* the generation must be taken before the request is sent to user mode */
+        NegNameGeneration = FspNegNameCacheGeneration(FsvolDeviceExtension->NegNameCache);
+        if (FspNegNameCacheLookup(FsvolDeviceExtension->NegNameCache, &FileNode->FileName))
+        {
+            FspFileNodeDereference(FileNode);
+            return STATUS_OBJECT_NAME_NOT_FOUND;
+        }
+    }
+
     Result = FspFileDescCreate(&FileDesc);
     if (!NT_SUCCESS(Result))
     {
@@ -663,6 +686,8 @@ static NTSTATUS FspFsvolCreateNoLock(
     FileDesc->FileNode = FileNode;
     FileDesc->CaseSensitive = CaseSensitive;
     FileDesc->HasTraversePrivilege = HasTraversePrivilege;
+    FileDesc->NegNameCacheable = NegNameCacheable;
+    FileDesc->NegNameGeneration = NegNameGeneration;
 
     if (!MainFileOpen)
     {
@@ -875,6 +900,12 @@ NTSTATUS FspFsvolCreateComplete(
         /* did the user-mode file system sent us a failure code? */
         if (!NT_SUCCESS(Response->IoStatus.Status))
         {
+            /* remember that the file does not exist (unless its namespace changed meanwhile) */
+            if (STATUS_OBJECT_NAME_NOT_FOUND == Response->IoStatus.Status &&
+                FileDesc->NegNameCacheable)
+                FspNegNameCacheInsert(FsvolDeviceExtension->NegNameCache,
+                    &FileNode->FileName, FileDesc->NegNameGeneration);
+
             Irp->IoStatus.Information = STATUS_SHARING_VIOLATION == Response->IoStatus.Status ?
                 Response->IoStatus.Information : 0;
             Result = Response->IoStatus.Status;
@@ -315,7 +315,8 @@ static NTSTATUS FspFsvolDeviceInit(PDEVICE_OBJECT DeviceObject)
     NTSTATUS Result;
     FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(DeviceObject);
     LARGE_INTEGER IrpTimeout;
-    LARGE_INTEGER SecurityTimeout, DirInfoTimeout, StreamInfoTimeout, EaTimeout;
+    LARGE_INTEGER SecurityTimeout, DirInfoTimeout, StreamInfoTimeout, EaTimeout,
+        NegNameTimeout;
 
     /*
      * Volume device initialization is a mess, because of the different ways of
@@ -362,13 +363,15 @@ static NTSTATUS FspFsvolDeviceInit(PDEVICE_OBJECT DeviceObject)
         &FsvolDeviceExtension->Ioq);
     if (!NT_SUCCESS(Result))
         return Result;
+    FspIopRequestPoolReserve(FsvolDeviceExtension->VolumeParams.IrpCapacity);
     FsvolDeviceExtension->InitDoneIoq = 1;
 
     /* create our security meta cache */
     SecurityTimeout.QuadPart = FspTimeoutFromMillis(FsvolDeviceExtension->VolumeParams.SecurityTimeout);
         /* convert millis to nanos */
     Result = FspMetaCacheCreate(
-        FspFsvolDeviceSecurityCacheCapacity, FspFsvolDeviceSecurityCacheItemSizeMax, &SecurityTimeout,
+        FsvolDeviceExtension->VolumeParams.SecurityCacheSize * 1024,
+        FspFsvolDeviceSecurityCacheItemSizeMax, FspMetaCacheDedup, &SecurityTimeout,
         &FsvolDeviceExtension->SecurityCache);
     if (!NT_SUCCESS(Result))
         return Result;
@@ -378,7 +381,8 @@ static NTSTATUS FspFsvolDeviceInit(PDEVICE_OBJECT DeviceObject)
     DirInfoTimeout.QuadPart = FspTimeoutFromMillis(FsvolDeviceExtension->VolumeParams.DirInfoTimeout);
         /* convert millis to nanos */
     Result = FspMetaCacheCreate(
-        FspFsvolDeviceDirInfoCacheCapacity, FspFsvolDeviceDirInfoCacheItemSizeMax, &DirInfoTimeout,
+        FsvolDeviceExtension->VolumeParams.DirInfoCacheSize * 1024,
+        FspFsvolDeviceDirInfoCacheItemSizeMax, 0, &DirInfoTimeout,
         &FsvolDeviceExtension->DirInfoCache);
     if (!NT_SUCCESS(Result))
         return Result;
@@ -388,7 +392,8 @@ static NTSTATUS FspFsvolDeviceInit(PDEVICE_OBJECT DeviceObject)
     StreamInfoTimeout.QuadPart = FspTimeoutFromMillis(FsvolDeviceExtension->VolumeParams.StreamInfoTimeout);
         /* convert millis to nanos */
     Result = FspMetaCacheCreate(
-        FspFsvolDeviceStreamInfoCacheCapacity, FspFsvolDeviceStreamInfoCacheItemSizeMax, &StreamInfoTimeout,
+        FsvolDeviceExtension->VolumeParams.StreamInfoCacheSize * 1024,
+        FspFsvolDeviceStreamInfoCacheItemSizeMax, 0, &StreamInfoTimeout,
         &FsvolDeviceExtension->StreamInfoCache);
     if (!NT_SUCCESS(Result))
         return Result;
@@ -398,12 +403,24 @@ static NTSTATUS FspFsvolDeviceInit(PDEVICE_OBJECT DeviceObject)
     EaTimeout.QuadPart = FspTimeoutFromMillis(FsvolDeviceExtension->VolumeParams.EaTimeout);
         /* convert millis to nanos */
     Result = FspMetaCacheCreate(
-        FspFsvolDeviceEaCacheCapacity, FspFsvolDeviceEaCacheItemSizeMax, &EaTimeout,
+        FsvolDeviceExtension->VolumeParams.EaCacheSize * 1024,
+        FspFsvolDeviceEaCacheItemSizeMax, 0, &EaTimeout,
         &FsvolDeviceExtension->EaCache);
     if (!NT_SUCCESS(Result))
         return Result;
     FsvolDeviceExtension->InitDoneEa = 1;
 
+    /* create our negative name cache */
+    NegNameTimeout.QuadPart = FspTimeoutFromMillis(FsvolDeviceExtension->VolumeParams.NegativeNameTimeout);
+        /* convert millis to nanos */
+    Result = FspNegNameCacheCreate(
+        FspFsvolDeviceNegNameCacheEntryCountMax,
+        !FsvolDeviceExtension->VolumeParams.CaseSensitiveSearch, &NegNameTimeout,
+        &FsvolDeviceExtension->NegNameCache);
+    if (!NT_SUCCESS(Result))
+        return Result;
+    FsvolDeviceExtension->InitDoneNegName = 1;
+
     /* initialize the Volume Notify and FSRTL Notify mechanisms */
     Result = FspNotifyInitializeSync(&FsvolDeviceExtension->NotifySync);
     if (!NT_SUCCESS(Result))
@@ -476,6 +493,10 @@ static VOID FspFsvolDeviceFini(PDEVICE_OBJECT DeviceObject)
         FspNotifyUninitializeSync(&FsvolDeviceExtension->NotifySync);
     }
 
+    /* delete the negative name cache */
+    if (FsvolDeviceExtension->InitDoneNegName)
+        FspNegNameCacheDelete(FsvolDeviceExtension->NegNameCache);
+
     /* delete the EA meta cache */
     if (FsvolDeviceExtension->InitDoneEa)
         FspMetaCacheDelete(FsvolDeviceExtension->EaCache);
@@ -494,7 +515,10 @@ static VOID FspFsvolDeviceFini(PDEVICE_OBJECT DeviceObject)
 
     /* delete the Ioq */
     if (FsvolDeviceExtension->InitDoneIoq)
+    {
+        FspIopRequestPoolRelease(FsvolDeviceExtension->VolumeParams.IrpCapacity);
         FspIoqDelete(FsvolDeviceExtension->Ioq);
+    }
 
     if (FsvolDeviceExtension->InitDoneCtxTab)
     {
@@ -570,6 +594,7 @@ static VOID FspFsvolDeviceExpirationRoutine(PVOID Context)
     FspMetaCacheInvalidateExpired(FsvolDeviceExtension->SecurityCache, InterruptTime);
     FspMetaCacheInvalidateExpired(FsvolDeviceExtension->DirInfoCache, InterruptTime);
     FspMetaCacheInvalidateExpired(FsvolDeviceExtension->StreamInfoCache, InterruptTime);
+    FspNegNameCacheInvalidateExpired(FsvolDeviceExtension->NegNameCache, InterruptTime);
     /* run any fsext provider expiration routine */
     if (0 != FsvolDeviceExtension->Provider)
         FsvolDeviceExtension->Provider->DeviceExpirationRoutine(DeviceObject, InterruptTime);
@@ -134,7 +134,7 @@ NTSTATUS DriverEntry(
 #pragma prefast(suppress:28175, "We are a filesystem: ok to access FastIoDispatch")
     DriverObject->FastIoDispatch = &FspFastIoDispatch;
 
-    BOOLEAN InitDoneSilo = FALSE, InitDonePsBuf = FALSE,
+    BOOLEAN InitDoneSilo = FALSE, InitDonePsBuf = FALSE, InitDoneReqPool = FALSE,
         InitDoneTimers = FALSE, InitDoneDevices = FALSE;
 
     FspDriverObject = DriverObject;
@@ -153,6 +153,11 @@ NTSTATUS DriverEntry(
         goto exit;
     InitDonePsBuf = TRUE;
 
+    Result = FspIopRequestPoolInitialize();
+    if (!NT_SUCCESS(Result))
+        goto exit;
+    InitDoneReqPool = TRUE;
+
     Result = FspDeviceInitializeAllTimers();
     if (!NT_SUCCESS(Result))
         goto exit;
@@ -176,6 +181,8 @@ exit:
             FspDriverFinalizeDevices();
         if (InitDoneTimers)
             FspDeviceFinalizeAllTimers();
+        if (InitDoneReqPool)
+            FspIopRequestPoolFinalize();
         if (InitDonePsBuf)
             FspProcessBufferFinalize();
         if (InitDoneSilo)
@@ -198,6 +205,8 @@ VOID DriverUnload(
 
     FspDeviceFinalizeAllTimers();
 
+    FspIopRequestPoolFinalize();
+
     FspProcessBufferFinalize();
 
     FspSiloFinalize();
@@ -975,16 +975,20 @@ retry:
 typedef struct
 {
     KSPIN_LOCK SpinLock;
-    BOOLEAN Stopped;
+    volatile BOOLEAN Stopped;
 #if defined(FSP_IOQ_USE_QEVENT)
     FSP_QEVENT PendingIrpEvent;
 #else
     KEVENT PendingIrpEvent;
 #endif
-    LIST_ENTRY PendingIrpList, ProcessIrpList, RetriedIrpList;
-    IO_CSQ PendingIoCsq, ProcessIoCsq, RetriedIoCsq;
+    LIST_ENTRY ProcessIrpList, RetriedIrpList;
+    IO_CSQ ProcessIoCsq, RetriedIoCsq;
     ULONG IrpTimeout;
-    ULONG PendingIrpCapacity, PendingIrpCount, ProcessIrpCount, RetriedIrpCount;
+    ULONG PendingIrpCapacity, ProcessIrpCount, RetriedIrpCount;
+    volatile LONG PendingIrpCount;      /* all pending shards */
+    volatile LONG64 PendingShardMask;   /* pending shards that are not empty */
+    ULONG PendingShardCount;
+    struct _FSP_IOQ_PENDING_SHARD *PendingShards;
     VOID (*CompleteCanceledIrp)(PIRP Irp);
     ULONG ProcessIrpBucketCount;
     PVOID ProcessIrpBuckets[];
@@ -1001,6 +1005,7 @@ PIRP FspIoqNextPendingIrp(FSP_IOQ *Ioq, PIRP BoundaryIrp, PLARGE_INTEGER Timeout
     PIRP CancellableIrp);
 ULONG FspIoqPendingIrpCount(FSP_IOQ *Ioq);
 BOOLEAN FspIoqPendingAboveWatermark(FSP_IOQ *Ioq, ULONG Watermark);
+VOID FspIoqPendingQuery(FSP_IOQ *Ioq, FSP_FSCTL_IOQ_INFO *IoqInfo);
 BOOLEAN FspIoqStartProcessingIrp(FSP_IOQ *Ioq, PIRP Irp);
 PIRP FspIoqEndProcessingIrp(FSP_IOQ *Ioq, UINT_PTR IrpHint);
 ULONG FspIoqProcessIrpCount(FSP_IOQ *Ioq);
@@ -1011,21 +1016,12 @@ ULONG FspIoqRetriedIrpCount(FSP_IOQ *Ioq);
 /* meta cache */
 enum
 {
-    FspMetaCacheItemHeaderSize = MEMORY_ALLOCATION_ALIGNMENT,
+    FspMetaCacheItemHeaderSize = 3 * MEMORY_ALLOCATION_ALIGNMENT,
+    FspMetaCacheDedup = 0x00000001,     /* intern item buffers by content */
 };
-typedef struct
-{
-    KSPIN_LOCK SpinLock;
-    UINT64 MetaTimeout;
-    ULONG MetaCapacity, ItemCount;
-    ULONG ItemSizeMax;
-    UINT64 ItemIndex;
-    LIST_ENTRY ItemList;
-    ULONG ItemBucketCount;
-    PVOID ItemBuckets[];
-} FSP_META_CACHE;
+typedef struct _FSP_META_CACHE FSP_META_CACHE;
 NTSTATUS FspMetaCacheCreate(
-    ULONG MetaCapacity, ULONG ItemSizeMax, PLARGE_INTEGER MetaTimeout,
+    ULONG MetaBudget, ULONG ItemSizeMax, ULONG Flags, PLARGE_INTEGER MetaTimeout,
     FSP_META_CACHE **PMetaCache);
 VOID FspMetaCacheDelete(FSP_META_CACHE *MetaCache);
 VOID FspMetaCacheInvalidateExpired(FSP_META_CACHE *MetaCache, UINT64 ExpirationTime);
@@ -1035,6 +1031,20 @@ VOID FspMetaCacheDereferenceItemBuffer(PCVOID Buffer);
 UINT64 FspMetaCacheAddItem(FSP_META_CACHE *MetaCache, PCVOID Buffer, ULONG Size);
 VOID FspMetaCacheInvalidateItem(FSP_META_CACHE *MetaCache, UINT64 ItemIndex);
 
+/* negative name cache */
+typedef struct _FSP_NEGNAME_CACHE FSP_NEGNAME_CACHE;
+NTSTATUS FspNegNameCacheCreate(
+    ULONG EntryCountMax, BOOLEAN CaseInsensitive, PLARGE_INTEGER Timeout,
+    FSP_NEGNAME_CACHE **PCache);
+VOID FspNegNameCacheDelete(FSP_NEGNAME_CACHE *Cache);
+BOOLEAN FspNegNameCacheLookup(FSP_NEGNAME_CACHE *Cache, PUNICODE_STRING FileName);
+ULONG FspNegNameCacheGeneration(FSP_NEGNAME_CACHE *Cache);
+VOID FspNegNameCacheInsert(FSP_NEGNAME_CACHE *Cache, PUNICODE_STRING FileName,
+    ULONG Generation);
+VOID FspNegNameCacheInvalidate(FSP_NEGNAME_CACHE *Cache, PUNICODE_STRING FileName,
+    BOOLEAN Prefix);
+VOID FspNegNameCacheInvalidateExpired(FSP_NEGNAME_CACHE *Cache, UINT64 ExpirationTime);
+
 /* I/O processing */
 #define FSP_FSCTL_WORK                  \
     CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0x800 + 'W', METHOD_NEITHER, FILE_ANY_ACCESS)
@@ -1088,6 +1098,11 @@ NTSTATUS FspIopCreateRequestFunnel(
     ULONG Flags, FSP_FSCTL_TRANSACT_REQ **PRequest);
 NTSTATUS FspIopCreateRequestWorkItem(FSP_FSCTL_TRANSACT_REQ *Request);
 VOID FspIopDeleteRequest(FSP_FSCTL_TRANSACT_REQ *Request);
+NTSTATUS FspIopRequestPoolInitialize(VOID);
+VOID FspIopRequestPoolFinalize(VOID);
+VOID FspIopRequestPoolReserve(ULONG IrpCapacity);
+VOID FspIopRequestPoolRelease(ULONG IrpCapacity);
+VOID FspIopRequestPoolQuery(FSP_FSCTL_REQUEST_POOL_INFO *RequestPoolInfo);
 VOID FspIopResetRequest(FSP_FSCTL_TRANSACT_REQ *Request, FSP_IOP_REQUEST_FINI *RequestFini);
 NTSTATUS FspIopPostWorkRequestFunnel(PDEVICE_OBJECT DeviceObject,
     FSP_FSCTL_TRANSACT_REQ *Request, BOOLEAN BestEffort);
@@ -1154,14 +1169,15 @@ NTSTATUS FspStatisticsCopy(FSP_STATISTICS *Statistics, PVOID Buffer, PULONG PLen
 /* device management */
 enum
 {
-    FspFsvolDeviceSecurityCacheCapacity = 100,
+    FspFsvolDeviceSecurityCacheSizeDefault = 256,   /* KiB */
     FspFsvolDeviceSecurityCacheItemSizeMax = 4096,
-    FspFsvolDeviceDirInfoCacheCapacity = 100,
+    FspFsvolDeviceDirInfoCacheSizeDefault = 4096,   /* KiB */
     FspFsvolDeviceDirInfoCacheItemSizeMax = FSP_FSCTL_ALIGN_UP(FspProcessBufferSizeMax, PAGE_SIZE),
-    FspFsvolDeviceStreamInfoCacheCapacity = 100,
+    FspFsvolDeviceStreamInfoCacheSizeDefault = 256, /* KiB */
     FspFsvolDeviceStreamInfoCacheItemSizeMax = FSP_FSCTL_ALIGN_UP(16384, PAGE_SIZE),
-    FspFsvolDeviceEaCacheCapacity = 100,
+    FspFsvolDeviceEaCacheSizeDefault = 256,         /* KiB */
     FspFsvolDeviceEaCacheItemSizeMax = FSP_FSCTL_ALIGN_UP(16384, PAGE_SIZE),
+    FspFsvolDeviceNegNameCacheEntryCountMax = 1024,
 };
 typedef struct
 {
@@ -1204,7 +1220,7 @@ typedef struct
 {
     FSP_DEVICE_EXTENSION Base;
     UINT32 InitDoneFsvrt:1, InitDoneIoq:1, InitDoneSec:1, InitDoneDir:1, InitDoneStrm:1, InitDoneEa:1,
-        InitDoneCtxTab:1, InitDoneTimer:1, InitDoneInfo:1, InitDoneNotify:1, InitDoneStat:1,
+        InitDoneNegName:1, InitDoneCtxTab:1, InitDoneTimer:1, InitDoneInfo:1, InitDoneNotify:1, InitDoneStat:1,
         InitDoneFsext;
     PDEVICE_OBJECT FsctlDeviceObject;
     PDEVICE_OBJECT FsvrtDeviceObject;
@@ -1223,6 +1239,7 @@ typedef struct
     FSP_META_CACHE *DirInfoCache;
     FSP_META_CACHE *StreamInfoCache;
     FSP_META_CACHE *EaCache;
+    FSP_NEGNAME_CACHE *NegNameCache;
     KSPIN_LOCK ExpirationLock;
     WORK_QUEUE_ITEM ExpirationWorkItem;
     BOOLEAN ExpirationInProgress;
@@ -1626,6 +1643,10 @@ NTSTATUS FspVolumeStop(
     PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp);
 NTSTATUS FspVolumeNotify(
     PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp);
+NTSTATUS FspVolumeQueryIoq(
+    PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp);
+NTSTATUS FspVolumeQueryRequestPool(
+    PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp);
 NTSTATUS FspVolumeWork(
     PDEVICE_OBJECT FsvolDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp);
 
@@ -1732,7 +1753,7 @@ typedef struct
         DidSetMetadata:1,
         DidSetFileAttributes:1, DidSetReparsePoint:1, DidSetSecurity:1,
         DidSetCreationTime:1, DidSetLastAccessTime:1, DidSetLastWriteTime:1, DidSetChangeTime:1,
-        DirectoryHasSuchFile:1;
+        DirectoryHasSuchFile:1, NegNameCacheable:1;
     NTSTATUS DispositionStatus;
     UNICODE_STRING DirectoryPattern;
     UNICODE_STRING DirectoryMarker;
@@ -1740,6 +1761,7 @@ typedef struct
     ULONG DirInfoCacheHint;
     ULONG EaIndex;
     ULONG EaChangeCount;
+    ULONG NegNameGeneration;
     /* stream support */
     HANDLE MainFileHandle;
     PFILE_OBJECT MainFileObject;
@@ -20,6 +20,7 @@
  */
 
 #include <sys/driver.h>
+#include <shared/ku/dirpatch.h>
 
 NTSTATUS FspFileNodeCopyActiveList(PDEVICE_OBJECT DeviceObject,
     FSP_FILE_NODE ***PFileNodes, PULONG PFileNodeCount);
@@ -85,6 +86,10 @@ BOOLEAN FspFileNodeTrySetDirInfo(FSP_FILE_NODE *FileNode, PCVOID Buffer, ULONG S
 static VOID FspFileNodeInvalidateDirInfo(FSP_FILE_NODE *FileNode);
 static VOID FspFileNodeInvalidateDirInfoByName(PDEVICE_OBJECT FsvolDeviceObject,
     PUNICODE_STRING FileName);
+static WCHAR FspFileNodeDirInfoUpcase(WCHAR C);
+static VOID FspFileNodeUpdateDirInfoByName(PDEVICE_OBJECT FsvolDeviceObject,
+    PUNICODE_STRING FileName, PUNICODE_STRING RemoveName,
+    PUNICODE_STRING InsertName, const FSP_FSCTL_FILE_INFO *InsertFileInfo);
 VOID FspFileNodeInvalidateParentDirInfo(FSP_FILE_NODE *FileNode);
 BOOLEAN FspFileNodeReferenceStreamInfo(FSP_FILE_NODE *FileNode, PCVOID *PBuffer, PULONG PSize);
 VOID FspFileNodeSetStreamInfo(FSP_FILE_NODE *FileNode, PCVOID Buffer, ULONG Size);
@@ -164,6 +169,8 @@ VOID FspFileNodeOplockComplete(PVOID Context, PIRP Irp);
 // !#pragma alloc_text(PAGE, FspFileNodeTrySetDirInfo)
 // !#pragma alloc_text(PAGE, FspFileNodeInvalidateDirInfo)
 #pragma alloc_text(PAGE, FspFileNodeInvalidateDirInfoByName)
+#pragma alloc_text(PAGE, FspFileNodeDirInfoUpcase)
+#pragma alloc_text(PAGE, FspFileNodeUpdateDirInfoByName)
 #pragma alloc_text(PAGE, FspFileNodeInvalidateParentDirInfo)
 // !#pragma alloc_text(PAGE, FspFileNodeReferenceStreamInfo)
 // !#pragma alloc_text(PAGE, FspFileNodeSetStreamInfo)
@@ -2135,6 +2142,117 @@ static VOID FspFileNodeInvalidateDirInfoByName(PDEVICE_OBJECT FsvolDeviceObject,
     }
 }
 
+static WCHAR FspFileNodeDirInfoUpcase(WCHAR C)
+{
+    PAGED_CODE();
+
+    return RtlUpcaseUnicodeChar(C);
+}
+
+static VOID FspFileNodeUpdateDirInfoByName(PDEVICE_OBJECT FsvolDeviceObject,
+    PUNICODE_STRING FileName, PUNICODE_STRING RemoveName,
+    PUNICODE_STRING InsertName, const FSP_FSCTL_FILE_INFO *InsertFileInfo)
+{
+    /*
+     * Patch the cached DirInfo of the directory FileName so that it reflects the removal
+     * of RemoveName and/or the insertion of InsertName (see shared/ku/dirpatch.h). If the
+     * DirInfo cannot be patched it is invalidated instead.
+     */
+
+    PAGED_CODE();
+
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(FsvolDeviceObject);
+    FSP_FILE_NODE *FileNode;
+    FSP_DIRINFO_PATCH Patch;
+    PCVOID Buffer;
+    ULONG Size;
+    PVOID NewBuffer;
+    BOOLEAN Acquired, Patched = FALSE;
+
+    FspFsvolDeviceLockContextTable(FsvolDeviceObject);
+    FileNode = FspFsvolDeviceLookupContextByName(FsvolDeviceObject, FileName);
+    if (0 != FileNode)
+        FspFileNodeReference(FileNode);
+    FspFsvolDeviceUnlockContextTable(FsvolDeviceObject);
+
+    if (0 == FileNode)
+        return;
+
+    /* the patched DirInfo must not be resumed by NextOffset: only patch name-marker volumes */
+    if (FsvolDeviceExtension->VolumeParams.DirectoryMarkerAsNextOffset)
+    {
+        FspFileNodeInvalidateDirInfo(FileNode);
+        FspFileNodeDereference(FileNode);
+        return;
+    }
+
+    /*
+     * The caller owns the FileNode of the changed file, so we must not block on the directory.
+     * We also acquire the directory resources directly, because the acquisition flags in the
+     * top-level IRP track the changed file and not its directory.
+     */
+    Acquired = ExAcquireResourceExclusiveLite(FileNode->Header.Resource, FALSE);
+#if !defined(FSP_FILE_NODE_NO_PGIO)
+    if (Acquired && !ExAcquireResourceExclusiveLite(FileNode->Header.PagingIoResource, FALSE))
+    {
+        ExReleaseResourceLite(FileNode->Header.Resource);
+        Acquired = FALSE;
+    }
+#endif
+
+    if (!Acquired)
+    {
+        FspFileNodeInvalidateDirInfo(FileNode);
+        FspFileNodeDereference(FileNode);
+        return;
+    }
+
+    if (FspFileNodeReferenceDirInfo(FileNode, &Buffer, &Size))
+    {
+        if (FspDirInfoPatchPrepare(Buffer, Size,
+            0 != RemoveName ? RemoveName->Buffer : 0,
+            0 != RemoveName ? RemoveName->Length / sizeof(WCHAR) : 0,
+            0 != InsertName ? InsertName->Buffer : 0,
+            0 != InsertName ? InsertName->Length / sizeof(WCHAR) : 0,
+            FsvolDeviceExtension->VolumeParams.CaseSensitiveSearch ? 0 : FspFileNodeDirInfoUpcase,
+            &Patch))
+        {
+            if (FspDirInfoPatchIsEmpty(&Patch))
+                Patched = TRUE;
+            else
+            {
+                NewBuffer = FspAlloc(Patch.NewSize);
+                if (0 != NewBuffer)
+                {
+                    FspDirInfoPatchApply(Buffer, Size,
+                        0 != InsertName ? InsertName->Buffer : 0,
+                        0 != InsertName ? InsertName->Length / sizeof(WCHAR) : 0,
+                        InsertFileInfo,
+                        &Patch, NewBuffer);
+
+                    /* replaces the shared DirInfo and fails any concurrent FspFileNodeTrySetDirInfo */
+                    FspFileNodeSetDirInfo(FileNode, NewBuffer, Patch.NewSize);
+                    Patched = TRUE;
+
+                    FspFree(NewBuffer);
+                }
+            }
+        }
+
+        FspFileNodeDereferenceDirInfo(Buffer);
+
+        if (!Patched)
+            FspFileNodeSetDirInfo(FileNode, 0, 0);
+    }
+
+#if !defined(FSP_FILE_NODE_NO_PGIO)
+    ExReleaseResourceLite(FileNode->Header.PagingIoResource);
+#endif
+    ExReleaseResourceLite(FileNode->Header.Resource);
+
+    FspFileNodeDereference(FileNode);
+}
+
 VOID FspFileNodeInvalidateParentDirInfo(FSP_FILE_NODE *FileNode)
 {
     PAGED_CODE();
@@ -2317,6 +2435,15 @@ VOID FspFileNodeNotifyChange(FSP_FILE_NODE *FileNode, ULONG Filter, ULONG Action
     PDEVICE_OBJECT FsvolDeviceObject = FileNode->FsvolDeviceObject;
     FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(FsvolDeviceObject);
     UNICODE_STRING Parent, Suffix;
+    FSP_FSCTL_FILE_INFO FileInfo;
+
+    /*
+     * A created file invalidates its negative name; a renamed file may be a directory
+     * that brings its children along, so it invalidates everything below it as well.
+     */
+    if (FILE_ACTION_ADDED == Action || FILE_ACTION_RENAMED_NEW_NAME == Action)
+        FspNegNameCacheInvalidate(FsvolDeviceExtension->NegNameCache, &FileNode->FileName,
+            FILE_ACTION_RENAMED_NEW_NAME == Action);
 
     if (0 != FileNode->MainFileNode)
     {
@@ -2352,8 +2479,17 @@ VOID FspFileNodeNotifyChange(FSP_FILE_NODE *FileNode, ULONG Filter, ULONG Action
             FspFsvolDeviceInvalidateVolumeInfo(FsvolDeviceObject);
             if (0 == FileNode->MainFileNode)
             {
+                /*
+                 * Names that come and go are patched into or out of the parent DirInfo;
+                 * other changes (and names without valid FileInfo) invalidate it.
+                 */
                 if (sizeof(WCHAR) == FileNode->FileName.Length && L'\\' == FileNode->FileName.Buffer[0])
                     ; /* root does not have a parent */
+                else if (FILE_ACTION_REMOVED == Action || FILE_ACTION_RENAMED_OLD_NAME == Action)
+                    FspFileNodeUpdateDirInfoByName(FsvolDeviceObject, &Parent, &Suffix, 0, 0);
+                else if ((FILE_ACTION_ADDED == Action || FILE_ACTION_RENAMED_NEW_NAME == Action) &&
+                    FspFileNodeTryGetFileInfo(FileNode, &FileInfo))
+                    FspFileNodeUpdateDirInfoByName(FsvolDeviceObject, &Parent, 0, &Suffix, &FileInfo);
                 else
                     FspFileNodeInvalidateDirInfoByName(FsvolDeviceObject, &Parent);
             }
@@ -2377,6 +2513,10 @@ VOID FspFileNodeInvalidateCachesAndNotifyChangeByName(PDEVICE_OBJECT FsvolDevice
 
     FSP_FILE_NODE *FileNode;
 
+    /* the user-mode file system may have created anything at or below FileName */
+    FspNegNameCacheInvalidate(FspFsvolDeviceExtension(FsvolDeviceObject)->NegNameCache,
+        FileName, TRUE);
+
     FspFsvolDeviceLockContextTable(FsvolDeviceObject);
     FileNode = FspFsvolDeviceLookupContextByName(FsvolDeviceObject, FileName);
     if (0 != FileNode)
@@ -2457,6 +2597,8 @@ VOID FspFileNodeInvalidateCachesAndNotifyChangeByName(PDEVICE_OBJECT FsvolDevice
                 {
                     if (sizeof(WCHAR) == FileName->Length && L'\\' == FileName->Buffer[0])
                         ; /* root does not have a parent */
+                    else if (FILE_ACTION_REMOVED == Action || FILE_ACTION_RENAMED_OLD_NAME == Action)
+                        FspFileNodeUpdateDirInfoByName(FsvolDeviceObject, &Parent, &Suffix, 0, 0);
                     else
                         FspFileNodeInvalidateDirInfoByName(FsvolDeviceObject, &Parent);
                 }
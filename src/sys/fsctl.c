@@ -128,6 +128,14 @@ static NTSTATUS FspFsctlFileSystemControl(
             if (0 != IrpSp->FileObject->FsContext2)
                 Result = FspVolumeNotify(FsctlDeviceObject, Irp, IrpSp);
             break;
+        case FSP_FSCTL_QUERY_IOQ:
+            if (0 != IrpSp->FileObject->FsContext2)
+                Result = FspVolumeQueryIoq(FsctlDeviceObject, Irp, IrpSp);
+            break;
+        case FSP_FSCTL_QUERY_REQUEST_POOL:
+            if (0 != IrpSp->FileObject->FsContext2)
+                Result = FspVolumeQueryRequestPool(FsctlDeviceObject, Irp, IrpSp);
+            break;
         case FSP_FSCTL_UNLOAD:
             Result = FspDriverUnload(FsctlDeviceObject, Irp, IrpSp);
             break;
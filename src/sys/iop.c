@@ -20,12 +20,21 @@
  */
 
 #include <sys/driver.h>
+#include <shared/ku/reqpool.h>
 
 NTSTATUS FspIopCreateRequestFunnel(
     PIRP Irp, PUNICODE_STRING FileName, ULONG ExtraSize, FSP_IOP_REQUEST_FINI *RequestFini,
     ULONG Flags, FSP_FSCTL_TRANSACT_REQ **PRequest);
 NTSTATUS FspIopCreateRequestWorkItem(FSP_FSCTL_TRANSACT_REQ *Request);
 VOID FspIopDeleteRequest(FSP_FSCTL_TRANSACT_REQ *Request);
+NTSTATUS FspIopRequestPoolInitialize(VOID);
+VOID FspIopRequestPoolFinalize(VOID);
+VOID FspIopRequestPoolReserve(ULONG IrpCapacity);
+VOID FspIopRequestPoolRelease(ULONG IrpCapacity);
+static VOID FspIopRequestPoolResize(VOID);
+static PVOID FspIopRequestPoolGet(ULONG Class);
+static BOOLEAN FspIopRequestPoolPut(ULONG Class, PVOID Block);
+VOID FspIopRequestPoolQuery(FSP_FSCTL_REQUEST_POOL_INFO *RequestPoolInfo);
 VOID FspIopResetRequest(FSP_FSCTL_TRANSACT_REQ *Request, FSP_IOP_REQUEST_FINI *RequestFini);
 NTSTATUS FspIopPostWorkRequestFunnel(PDEVICE_OBJECT DeviceObject,
     FSP_FSCTL_TRANSACT_REQ *Request, BOOLEAN AllocateIrpMustSucceed);
@@ -43,6 +52,12 @@ NTSTATUS FspIopDispatchComplete(PIRP Irp, FSP_FSCTL_TRANSACT_RSP *Response);
 #pragma alloc_text(PAGE, FspIopCreateRequestFunnel)
 #pragma alloc_text(PAGE, FspIopCreateRequestWorkItem)
 #pragma alloc_text(PAGE, FspIopDeleteRequest)
+#pragma alloc_text(PAGE, FspIopRequestPoolInitialize)
+#pragma alloc_text(PAGE, FspIopRequestPoolFinalize)
+#pragma alloc_text(PAGE, FspIopRequestPoolReserve)
+#pragma alloc_text(PAGE, FspIopRequestPoolRelease)
+#pragma alloc_text(PAGE, FspIopRequestPoolResize)
+#pragma alloc_text(PAGE, FspIopRequestPoolQuery)
 #pragma alloc_text(PAGE, FspIopResetRequest)
 #pragma alloc_text(PAGE, FspIopPostWorkRequestFunnel)
 #pragma alloc_text(PAGE, FspIopCompleteIrpEx)
@@ -82,36 +97,59 @@ NTSTATUS FspIopCreateRequestFunnel(
     if (FSP_FSCTL_TRANSACT_REQ_SIZEMAX < sizeof *Request + ExtraSize)
         return STATUS_INVALID_PARAMETER;
 
+    /*
+     * Allocate the full size of the request's size class, so that the block can be
+     * cached when the request is deleted. The caches only hold blocks that may be
+     * paged, so nonpaged requests always go to the pool.
+     */
+    ULONG Class = FspReqPoolClass(
+        sizeof *RequestHeader + sizeof *Request + ExtraSize + REQ_HEADER_ALIGN_OVERHEAD);
+    ASSERT(FSP_REQPOOL_CLASS_COUNT > Class);
+
+    RequestHeader = FlagOn(Flags, FspIopCreateRequestNonPagedFlag) ?
+        0 : FspIopRequestPoolGet(Class);
+    RequestWorkItem = FlagOn(Flags, FspIopCreateRequestWorkItemFlag) ?
+        FspIopRequestPoolGet(FSP_REQPOOL_CLASS_COUNT) : 0;
+
     if (FlagOn(Flags, FspIopCreateRequestMustSucceedFlag))
     {
-        RequestHeader = FspAllocatePoolMustSucceed(
-            FlagOn(Flags, FspIopCreateRequestNonPagedFlag) ? NonPagedPool : PagedPool,
-            sizeof *RequestHeader + sizeof *Request + ExtraSize + REQ_HEADER_ALIGN_OVERHEAD,
-            FSP_ALLOC_INTERNAL_TAG);
+        if (0 == RequestHeader)
+            RequestHeader = FspAllocatePoolMustSucceed(
+                FlagOn(Flags, FspIopCreateRequestNonPagedFlag) ? NonPagedPool : PagedPool,
+                FspReqPoolClassSize(Class),
+                FSP_ALLOC_INTERNAL_TAG);
 
         if (FlagOn(Flags, FspIopCreateRequestWorkItemFlag))
         {
-            RequestWorkItem = FspAllocatePoolMustSucceed(
-                NonPagedPool, sizeof *RequestWorkItem, FSP_ALLOC_INTERNAL_TAG);
+            if (0 == RequestWorkItem)
+                RequestWorkItem = FspAllocatePoolMustSucceed(
+                    NonPagedPool, sizeof *RequestWorkItem, FSP_ALLOC_INTERNAL_TAG);
 
             RtlZeroMemory(RequestWorkItem, sizeof *RequestWorkItem);
         }
     }
     else
     {
-        RequestHeader = ExAllocatePoolWithTag(
-            FlagOn(Flags, FspIopCreateRequestNonPagedFlag) ? NonPagedPool : PagedPool,
-            sizeof *RequestHeader + sizeof *Request + ExtraSize + REQ_HEADER_ALIGN_OVERHEAD,
-            FSP_ALLOC_INTERNAL_TAG);
         if (0 == RequestHeader)
+            RequestHeader = ExAllocatePoolWithTag(
+                FlagOn(Flags, FspIopCreateRequestNonPagedFlag) ? NonPagedPool : PagedPool,
+                FspReqPoolClassSize(Class),
+                FSP_ALLOC_INTERNAL_TAG);
+        if (0 == RequestHeader)
+        {
+            if (0 != RequestWorkItem && !FspIopRequestPoolPut(FSP_REQPOOL_CLASS_COUNT, RequestWorkItem))
+                FspFree(RequestWorkItem);
             return STATUS_INSUFFICIENT_RESOURCES;
+        }
 
         if (FlagOn(Flags, FspIopCreateRequestWorkItemFlag))
         {
-            RequestWorkItem = FspAllocNonPaged(sizeof *RequestWorkItem);
+            if (0 == RequestWorkItem)
+                RequestWorkItem = FspAllocNonPaged(sizeof *RequestWorkItem);
             if (0 == RequestWorkItem)
             {
-                FspFree(RequestHeader);
+                if (!FspIopRequestPoolPut(Class, RequestHeader))
+                    FspFree(RequestHeader);
                 return STATUS_INSUFFICIENT_RESOURCES;
             }
 
@@ -163,7 +201,9 @@ NTSTATUS FspIopCreateRequestWorkItem(FSP_FSCTL_TRANSACT_REQ *Request)
 
     if (0 == RequestHeader->WorkItem)
     {
-        RequestWorkItem = FspAllocNonPaged(sizeof *RequestWorkItem);
+        RequestWorkItem = FspIopRequestPoolGet(FSP_REQPOOL_CLASS_COUNT);
+        if (0 == RequestWorkItem)
+            RequestWorkItem = FspAllocNonPaged(sizeof *RequestWorkItem);
         if (0 == RequestWorkItem)
             return STATUS_INSUFFICIENT_RESOURCES;
 
@@ -179,6 +219,8 @@ VOID FspIopDeleteRequest(FSP_FSCTL_TRANSACT_REQ *Request)
     PAGED_CODE();
 
     FSP_FSCTL_TRANSACT_REQ_HEADER *RequestHeader = (PVOID)((PUINT8)Request - sizeof *RequestHeader);
+    ULONG Class = FspReqPoolClass(
+        sizeof *RequestHeader + Request->Size + REQ_HEADER_ALIGN_OVERHEAD);
 
     if (0 != RequestHeader->RequestFini)
         RequestHeader->RequestFini(Request, RequestHeader->Context);
@@ -186,14 +228,175 @@ VOID FspIopDeleteRequest(FSP_FSCTL_TRANSACT_REQ *Request)
     if (0 != RequestHeader->Response)
         FspFree(RequestHeader->Response);
 
-    if (0 != RequestHeader->WorkItem)
+    if (0 != RequestHeader->WorkItem &&
+        !FspIopRequestPoolPut(FSP_REQPOOL_CLASS_COUNT, RequestHeader->WorkItem))
         FspFree(RequestHeader->WorkItem);
 
 #if 0 != REQ_HEADER_ALIGN_MASK
     RequestHeader = ((PVOID *)RequestHeader)[-1];
 #endif
 
-    FspFree(RequestHeader);
+    if (!FspIopRequestPoolPut(Class, RequestHeader))
+        FspFree(RequestHeader);
+}
+
+/*
+ * Request pool
+ *
+ * Per-processor caches of request (and work item) blocks; see shared/ku/reqpool.h.
+ * A cache is only accessed by its own processor at DISPATCH_LEVEL, so it needs no
+ * lock. The caches are sized by the IRP capacity of the mounted volumes.
+ */
+
+typedef struct
+{
+    FSP_REQPOOL_MAGAZINE Request[FSP_REQPOOL_CLASS_COUNT];
+    FSP_REQPOOL_MAGAZINE WorkItem;
+} FSP_IOP_REQUEST_POOL_CPU;
+static FSP_IOP_REQUEST_POOL_CPU *FspIopRequestPoolCpus;
+static ULONG FspIopRequestPoolCpuCount;
+static ULONG FspIopRequestPoolIrpCapacity;
+static volatile ULONG FspIopRequestPoolDepth[FSP_REQPOOL_CLASS_COUNT + 1];
+static FAST_MUTEX FspIopRequestPoolMutex;
+
+NTSTATUS FspIopRequestPoolInitialize(VOID)
+{
+    PAGED_CODE();
+
+    ULONG CpuCount = KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+
+    FspIopRequestPoolCpus = FspAllocNonPaged(sizeof *FspIopRequestPoolCpus * CpuCount);
+    if (0 == FspIopRequestPoolCpus)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    RtlZeroMemory(FspIopRequestPoolCpus, sizeof *FspIopRequestPoolCpus * CpuCount);
+    FspIopRequestPoolCpuCount = CpuCount;
+    FspIopRequestPoolIrpCapacity = 0;
+    for (ULONG Class = 0; FSP_REQPOOL_CLASS_COUNT >= Class; Class++)
+        FspIopRequestPoolDepth[Class] = 0;
+    ExInitializeFastMutex(&FspIopRequestPoolMutex);
+
+    return STATUS_SUCCESS;
+}
+
+VOID FspIopRequestPoolFinalize(VOID)
+{
+    PAGED_CODE();
+
+    FSP_IOP_REQUEST_POOL_CPU *Cpu;
+    PVOID Block;
+
+    for (ULONG Index = 0; FspIopRequestPoolCpuCount > Index; Index++)
+    {
+        Cpu = FspIopRequestPoolCpus + Index;
+        for (ULONG Class = 0; FSP_REQPOOL_CLASS_COUNT > Class; Class++)
+            while (0 != (Block = FspReqPoolDrain(&Cpu->Request[Class])))
+                FspFree(Block);
+        while (0 != (Block = FspReqPoolDrain(&Cpu->WorkItem)))
+            FspFree(Block);
+    }
+
+    FspFree(FspIopRequestPoolCpus);
+    FspIopRequestPoolCpus = 0;
+    FspIopRequestPoolCpuCount = 0;
+}
+
+VOID FspIopRequestPoolReserve(ULONG IrpCapacity)
+{
+    PAGED_CODE();
+
+    ExAcquireFastMutex(&FspIopRequestPoolMutex);
+    FspIopRequestPoolIrpCapacity += IrpCapacity;
+    FspIopRequestPoolResize();
+    ExReleaseFastMutex(&FspIopRequestPoolMutex);
+}
+
+VOID FspIopRequestPoolRelease(ULONG IrpCapacity)
+{
+    PAGED_CODE();
+
+    ExAcquireFastMutex(&FspIopRequestPoolMutex);
+    ASSERT(FspIopRequestPoolIrpCapacity >= IrpCapacity);
+    FspIopRequestPoolIrpCapacity -= IrpCapacity;
+    FspIopRequestPoolResize();
+    ExReleaseFastMutex(&FspIopRequestPoolMutex);
+}
+
+static VOID FspIopRequestPoolResize(VOID)
+{
+    PAGED_CODE();
+
+    /* the depths are read without the mutex; a stale depth only misplaces a block */
+    for (ULONG Class = 0; FSP_REQPOOL_CLASS_COUNT > Class; Class++)
+        FspIopRequestPoolDepth[Class] = FspReqPoolDepth(FspReqPoolClassSize(Class),
+            FspIopRequestPoolIrpCapacity, FspIopRequestPoolCpuCount);
+    FspIopRequestPoolDepth[FSP_REQPOOL_CLASS_COUNT] = FspReqPoolDepth(
+        sizeof(FSP_FSCTL_TRANSACT_REQ_WORK_ITEM),
+        FspIopRequestPoolIrpCapacity, FspIopRequestPoolCpuCount);
+}
+
+static PVOID FspIopRequestPoolGet(ULONG Class)
+{
+    /* Class FSP_REQPOOL_CLASS_COUNT is the work item cache */
+    FSP_IOP_REQUEST_POOL_CPU *Cpu;
+    PVOID Block = 0;
+    KIRQL Irql;
+    ULONG Index;
+
+    KeRaiseIrql(DISPATCH_LEVEL, &Irql);
+    Index = KeGetCurrentProcessorNumberEx(0);
+    if (FspIopRequestPoolCpuCount > Index)
+    {
+        Cpu = FspIopRequestPoolCpus + Index;
+        Block = FspReqPoolGet(FSP_REQPOOL_CLASS_COUNT > Class ?
+            &Cpu->Request[Class] : &Cpu->WorkItem);
+    }
+    KeLowerIrql(Irql);
+
+    return Block;
+}
+
+static BOOLEAN FspIopRequestPoolPut(ULONG Class, PVOID Block)
+{
+    FSP_IOP_REQUEST_POOL_CPU *Cpu;
+    BOOLEAN Result = FALSE;
+    KIRQL Irql;
+    ULONG Index;
+
+    KeRaiseIrql(DISPATCH_LEVEL, &Irql);
+    Index = KeGetCurrentProcessorNumberEx(0);
+    if (FspIopRequestPoolCpuCount > Index)
+    {
+        Cpu = FspIopRequestPoolCpus + Index;
+        Result = FspReqPoolPut(FSP_REQPOOL_CLASS_COUNT > Class ?
+                &Cpu->Request[Class] : &Cpu->WorkItem,
+            FspIopRequestPoolDepth[Class], Block);
+    }
+    KeLowerIrql(Irql);
+
+    return Result;
+}
+
+VOID FspIopRequestPoolQuery(FSP_FSCTL_REQUEST_POOL_INFO *RequestPoolInfo)
+{
+    PAGED_CODE();
+
+    FSP_IOP_REQUEST_POOL_CPU *Cpu;
+
+    RtlZeroMemory(RequestPoolInfo, sizeof *RequestPoolInfo);
+    RequestPoolInfo->ProcessorCount = FspIopRequestPoolCpuCount;
+    RequestPoolInfo->IrpCapacity = FspIopRequestPoolIrpCapacity;
+    for (ULONG Class = 0; FSP_REQPOOL_CLASS_COUNT > Class; Class++)
+        RequestPoolInfo->Request[Class].BlockSize = FspReqPoolClassSize(Class);
+    RequestPoolInfo->WorkItem.BlockSize = sizeof(FSP_FSCTL_TRANSACT_REQ_WORK_ITEM);
+
+    for (ULONG Index = 0; FspIopRequestPoolCpuCount > Index; Index++)
+    {
+        Cpu = FspIopRequestPoolCpus + Index;
+        for (ULONG Class = 0; FSP_REQPOOL_CLASS_COUNT > Class; Class++)
+            FspReqPoolAddInfo(&RequestPoolInfo->Request[Class], &Cpu->Request[Class]);
+        FspReqPoolAddInfo(&RequestPoolInfo->WorkItem, &Cpu->WorkItem);
+    }
 }
 
 VOID FspIopResetRequest(FSP_FSCTL_TRANSACT_REQ *Request, FSP_IOP_REQUEST_FINI *RequestFini)
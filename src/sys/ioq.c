@@ -20,6 +20,8 @@
  */
 
 #include <sys/driver.h>
+#include <shared/ku/ioqclass.h>
+#include <shared/ku/ioqshard.h>
 
 /*
  * Overview
@@ -133,6 +135,18 @@
  * UPDATE: We can now use a Queued Event which behaves like a SynchronizationEvent,
  * but has better performance. Unfortunately Queued Events cannot cleanly implement
  * an EventClear operation. However the EventClear operation is not strictly needed.
+ *
+ * UPDATE: The pending queue is now split into per-processor shards, each with its
+ * own lock and IO_CSQ, so that posting threads on different processors do not
+ * contend on a single lock (see shared/ku/ioqshard.h). The condition "pending IRP
+ * queue not empty or stopped" is still a single one: the pending IRP count is kept
+ * across all shards with interlocked operations and there is a single event. The
+ * event is now set concurrently from different shard locks, so the Queued Event is
+ * set under its own lock.
+ *
+ * UPDATE: Within a shard pending IRP's are now kept in one list per priority class
+ * and the class of the next IRP to dispatch is chosen by weighted round robin (see
+ * shared/ku/ioqclass.h). Cancelation, expiration and stopping still see every IRP.
  */
 
 /*
@@ -143,9 +157,15 @@
 #if defined(FSP_IOQ_USE_QEVENT)
 #define FspIoqEventInitialize(E)        FspQeventInitialize(E, 0)
 #define FspIoqEventFinalize(E)          FspQeventFinalize(E)
-#define FspIoqEventSet(E)               FspQeventSetNoLock(E)
+#define FspIoqEventSet(E)               FspIoqQeventSet(E)
 #define FspIoqEventCancellableWait(E,T,I)   FspQeventCancellableWait(E,T,I)
 #define FspIoqEventClear(E)             ((VOID)0)
+static inline VOID FspIoqQeventSet(FSP_QEVENT *Qevent)
+{
+    /* an unlocked read can only tell us that the event is already set */
+    if (0 == KeReadStateQueue(&Qevent->Queue))
+        FspQeventSet(Qevent);
+}
 #else
 #define FspIoqEventInitialize(E)        KeInitializeEvent(E, SynchronizationEvent, FALSE)
 #define FspIoqEventFinalize(E)          ((VOID)0)
@@ -212,6 +232,14 @@ static PIRP FspCsqRemoveNextIrp(PIO_CSQ Csq, PVOID PeekContext)
 #define InterruptTimeToSecFactor        10000000ULL
 #define ConvertInterruptTimeToSec(Time) ((ULONG)((Time) / InterruptTimeToSecFactor))
 #define QueryInterruptTimeInSec()       ConvertInterruptTimeToSec(KeQueryInterruptTime())
+#define QueryInterruptTimeInMicros()    ((ULONG)(KeQueryInterruptTime() / 10))
+
+/*
+ * While an IRP is pending its DriverContext[1] (FspIrpDictNext) is not in use;
+ * it holds the class stamp (see shared/ku/ioqclass.h) and is reset on removal.
+ */
+#define FspIrpPendingStamp(Irp)         \
+    (*(ULONG *)&(Irp)->Tail.Overlay.DriverContext[1])
 
 typedef struct
 {
@@ -219,11 +247,33 @@ typedef struct
     ULONG ExpirationTime;
 } FSP_IOQ_PEEK_CONTEXT;
 
+enum
+{
+    FspIoqCacheLineSize = 64,
+};
+
+typedef struct _FSP_IOQ_PENDING_SHARD
+{
+    KSPIN_LOCK SpinLock;
+    LIST_ENTRY IrpList[FspFsctlIoqClassCount];
+    IO_CSQ IoCsq;
+    FSP_IOQ *Ioq;
+    ULONG Index;
+    ULONG IrpCount;
+    FSP_IOQ_CLASS_SCHED ClassSched;
+    FSP_FSCTL_IOQ_CLASS_INFO ClassInfo[FspFsctlIoqClassCount];
+    UINT8 Padding[FspIoqCacheLineSize];
+        /* keep shards used by different processors on different cache lines */
+} FSP_IOQ_PENDING_SHARD;
+
 static inline VOID FspIoqPendingResetSynch(FSP_IOQ *Ioq)
 {
     /*
      * Examine the actual condition of the pending queue and
      * set the PendingIrpEvent accordingly.
+     *
+     * The pending IRP count is maintained across all shards with interlocked
+     * operations, so this no longer needs to be called under a lock.
      */
     if (0 != Ioq->PendingIrpCount || Ioq->Stopped)
         /* list is not empty or is stopped; wake up a waiter */
@@ -236,13 +286,21 @@ static inline VOID FspIoqPendingResetSynch(FSP_IOQ *Ioq)
 
 static NTSTATUS FspIoqPendingInsertIrpEx(PIO_CSQ IoCsq, PIRP Irp, PVOID InsertContext)
 {
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, PendingIoCsq);
+    FSP_IOQ_PENDING_SHARD *Shard = CONTAINING_RECORD(IoCsq, FSP_IOQ_PENDING_SHARD, IoCsq);
+    FSP_IOQ *Ioq = Shard->Ioq;
     if (Ioq->Stopped)
         return STATUS_CANCELLED;
-    if (!InsertContext && Ioq->PendingIrpCapacity <= Ioq->PendingIrpCount)
+    if (Ioq->PendingIrpCapacity < (ULONG)InterlockedIncrement(&Ioq->PendingIrpCount) &&
+        !InsertContext)
+    {
+        InterlockedDecrement(&Ioq->PendingIrpCount);
         return STATUS_INSUFFICIENT_RESOURCES;
-    Ioq->PendingIrpCount++;
-    InsertTailList(&Ioq->PendingIrpList, &Irp->Tail.Overlay.ListEntry);
+    }
+    ULONG Class = FspIoqClassOfStamp(FspIrpPendingStamp(Irp));
+    InsertTailList(&Shard->IrpList[Class], &Irp->Tail.Overlay.ListEntry);
+    Shard->ClassInfo[Class].PendingCount++;
+    if (1 == ++Shard->IrpCount)
+        InterlockedOr64(&Ioq->PendingShardMask, (LONG64)FspIoqShardBit(Shard->Index));
     FspIoqEventSet(&Ioq->PendingIrpEvent);
         /* equivalent to FspIoqPendingResetSynch(Ioq) */
     return STATUS_SUCCESS;
@@ -250,42 +308,90 @@ static NTSTATUS FspIoqPendingInsertIrpEx(PIO_CSQ IoCsq, PIRP Irp, PVOID InsertCo
 
 static VOID FspIoqPendingRemoveIrp(PIO_CSQ IoCsq, PIRP Irp)
 {
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, PendingIoCsq);
-    Ioq->PendingIrpCount--;
+    FSP_IOQ_PENDING_SHARD *Shard = CONTAINING_RECORD(IoCsq, FSP_IOQ_PENDING_SHARD, IoCsq);
+    FSP_IOQ *Ioq = Shard->Ioq;
     RemoveEntryList(&Irp->Tail.Overlay.ListEntry);
+    Shard->ClassInfo[FspIoqClassOfStamp(FspIrpPendingStamp(Irp))].PendingCount--;
+    Irp->Tail.Overlay.DriverContext[1] = 0;
+    if (0 == --Shard->IrpCount)
+        InterlockedAnd64(&Ioq->PendingShardMask, ~(LONG64)FspIoqShardBit(Shard->Index));
+    InterlockedDecrement(&Ioq->PendingIrpCount);
     FspIoqPendingResetSynch(Ioq);
+        /* if IRP's remain (possibly in other shards) pass the wake-up on */
+}
+
+static PIRP FspIoqPendingShardNextIrp(FSP_IOQ_PENDING_SHARD *Shard, PIRP Irp)
+{
+    /* the IRP after Irp (or the first IRP if Irp is 0), visiting the classes in order */
+    ULONG Class = 0;
+    PLIST_ENTRY Entry = Shard->IrpList[0].Flink;
+    if (0 != Irp)
+    {
+        Class = FspIoqClassOfStamp(FspIrpPendingStamp(Irp));
+        Entry = Irp->Tail.Overlay.ListEntry.Flink;
+    }
+    for (;;)
+    {
+        if (&Shard->IrpList[Class] != Entry)
+            return CONTAINING_RECORD(Entry, IRP, Tail.Overlay.ListEntry);
+        if (FspFsctlIoqClassCount <= ++Class)
+            return 0;
+        Entry = Shard->IrpList[Class].Flink;
+    }
 }
 
 static PIRP FspIoqPendingPeekNextIrp(PIO_CSQ IoCsq, PIRP Irp, PVOID PeekContext)
 {
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, PendingIoCsq);
+    FSP_IOQ_PENDING_SHARD *Shard = CONTAINING_RECORD(IoCsq, FSP_IOQ_PENDING_SHARD, IoCsq);
+    FSP_IOQ *Ioq = Shard->Ioq;
     if (PeekContext && Ioq->Stopped)
         return 0;
-    PLIST_ENTRY Head = &Ioq->PendingIrpList;
-    PLIST_ENTRY Entry = 0 == Irp ? Head->Flink : Irp->Tail.Overlay.ListEntry.Flink;
-    if (Head == Entry)
-        return 0;
-    Irp = CONTAINING_RECORD(Entry, IRP, Tail.Overlay.ListEntry);
     if (!PeekContext)
-        return Irp;
+        return FspIoqPendingShardNextIrp(Shard, Irp);
     PVOID IrpHint = ((FSP_IOQ_PEEK_CONTEXT *)PeekContext)->IrpHint;
+    ULONG Class;
     if (0 == IrpHint)
     {
         ULONG ExpirationTime = ((FSP_IOQ_PEEK_CONTEXT *)PeekContext)->ExpirationTime;
-        for (;;)
+        for (Irp = FspIoqPendingShardNextIrp(Shard, Irp); 0 != Irp;
+            Irp = FspIoqPendingShardNextIrp(Shard, Irp))
         {
-            if (FspIrpTimestampInfinity != FspIrpTimestamp(Irp))
-                return FspIrpTimestamp(Irp) <= ExpirationTime ? Irp : 0;
-            Entry = Entry->Flink;
-            if (Head == Entry)
-                return 0;
-            Irp = CONTAINING_RECORD(Entry, IRP, Tail.Overlay.ListEntry);
+            if (FspIrpTimestampInfinity == FspIrpTimestamp(Irp))
+                continue;
+            if (FspIrpTimestamp(Irp) <= ExpirationTime)
+                return Irp;
+            /* the IRP's that follow in this class expire later; skip to the next class */
+            Class = FspIoqClassOfStamp(FspIrpPendingStamp(Irp));
+            Irp = CONTAINING_RECORD(Shard->IrpList[Class].Blink, IRP, Tail.Overlay.ListEntry);
         }
+        return 0;
     }
     else
     {
-        if (Irp == IrpHint)
+        /*
+         * Choose the class to dispatch from. A class whose next IRP is the boundary
+         * IRP is not ready; the IRP that we return is removed under the same lock,
+         * so this is where we charge the class and account for the IRP's wait time.
+         */
+        ASSERT(0 == Irp);
+        ULONG ReadyMask = 0;
+        for (Class = 0; FspFsctlIoqClassCount > Class; Class++)
+        {
+            PLIST_ENTRY Entry = Shard->IrpList[Class].Flink;
+            if (&Shard->IrpList[Class] != Entry &&
+                IrpHint != CONTAINING_RECORD(Entry, IRP, Tail.Overlay.ListEntry))
+                ReadyMask |= 1 << Class;
+        }
+        Class = FspIoqClassPick(&Shard->ClassSched, ReadyMask);
+        if (FspFsctlIoqClassCount == Class)
             return 0;
+        Irp = CONTAINING_RECORD(Shard->IrpList[Class].Flink, IRP, Tail.Overlay.ListEntry);
+        FSP_FSCTL_IOQ_CLASS_INFO *ClassInfo = &Shard->ClassInfo[Class];
+        ULONG WaitTime = FspIoqClassWaitTime(FspIrpPendingStamp(Irp), QueryInterruptTimeInMicros());
+        ClassInfo->DispatchCount++;
+        ClassInfo->WaitTime += WaitTime;
+        if (ClassInfo->WaitTimeMax < WaitTime)
+            ClassInfo->WaitTimeMax = WaitTime;
         return Irp;
     }
 }
@@ -293,21 +399,45 @@ static PIRP FspIoqPendingPeekNextIrp(PIO_CSQ IoCsq, PIRP Irp, PVOID PeekContext)
 _IRQL_raises_(DISPATCH_LEVEL)
 static VOID FspIoqPendingAcquireLock(PIO_CSQ IoCsq, _At_(*PIrql, _IRQL_saves_) PKIRQL PIrql)
 {
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, PendingIoCsq);
-    KeAcquireSpinLock(&Ioq->SpinLock, PIrql);
+    FSP_IOQ_PENDING_SHARD *Shard = CONTAINING_RECORD(IoCsq, FSP_IOQ_PENDING_SHARD, IoCsq);
+    KeAcquireSpinLock(&Shard->SpinLock, PIrql);
 }
 
 _IRQL_requires_(DISPATCH_LEVEL)
 static VOID FspIoqPendingReleaseLock(PIO_CSQ IoCsq, _IRQL_restores_ KIRQL Irql)
 {
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, PendingIoCsq);
-    KeReleaseSpinLock(&Ioq->SpinLock, Irql);
+    FSP_IOQ_PENDING_SHARD *Shard = CONTAINING_RECORD(IoCsq, FSP_IOQ_PENDING_SHARD, IoCsq);
+    KeReleaseSpinLock(&Shard->SpinLock, Irql);
 }
 
 static VOID FspIoqPendingCompleteCanceledIrp(PIO_CSQ IoCsq, PIRP Irp)
 {
-    FSP_IOQ *Ioq = CONTAINING_RECORD(IoCsq, FSP_IOQ, PendingIoCsq);
-    Ioq->CompleteCanceledIrp(Irp);
+    FSP_IOQ_PENDING_SHARD *Shard = CONTAINING_RECORD(IoCsq, FSP_IOQ_PENDING_SHARD, IoCsq);
+    Shard->Ioq->CompleteCanceledIrp(Irp);
+}
+
+static PIRP FspIoqPendingRemoveNextIrp(FSP_IOQ *Ioq, PVOID PeekContext)
+{
+    /*
+     * Look in the shard of the current processor first and then steal from the
+     * other shards in cyclic order; only visit shards that are not empty.
+     *
+     * A boundary IRP (PeekContext->IrpHint) stops the removal only in the shard
+     * where it is found; it is still possible to remove IRP's from other shards.
+     */
+    UINT64 Mask = (UINT64)Ioq->PendingShardMask;
+    ULONG Home = FspIoqShardHome(KeGetCurrentProcessorNumber(), Ioq->PendingShardCount);
+    ULONG Index;
+    PIRP Irp;
+    while (0 != Mask)
+    {
+        Index = FspIoqShardNext(Mask, Home);
+        Irp = IoCsqRemoveNextIrp(&Ioq->PendingShards[Index].IoCsq, PeekContext);
+        if (0 != Irp)
+            return Irp;
+        Mask &= ~FspIoqShardBit(Index);
+    }
+    return 0;
 }
 
 static NTSTATUS FspIoqProcessInsertIrpEx(PIO_CSQ IoCsq, PIRP Irp, PVOID InsertContext)
@@ -482,24 +612,41 @@ NTSTATUS FspIoqCreate(
     *PIoq = 0;
 
     FSP_IOQ *Ioq;
+    FSP_IOQ_PENDING_SHARD *PendingShards;
     ULONG BucketCount = (PAGE_SIZE - sizeof *Ioq) / sizeof Ioq->ProcessIrpBuckets[0];
+    ULONG ShardCount = FspIoqShardCount(FspProcessorCount);
     Ioq = FspAllocNonPaged(PAGE_SIZE);
     if (0 == Ioq)
         return STATUS_INSUFFICIENT_RESOURCES;
+    PendingShards = FspAllocNonPaged(ShardCount * sizeof PendingShards[0]);
+    if (0 == PendingShards)
+    {
+        FspFree(Ioq);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
     RtlZeroMemory(Ioq, PAGE_SIZE);
+    RtlZeroMemory(PendingShards, ShardCount * sizeof PendingShards[0]);
 
     KeInitializeSpinLock(&Ioq->SpinLock);
     FspIoqEventInitialize(&Ioq->PendingIrpEvent);
-    InitializeListHead(&Ioq->PendingIrpList);
+    for (ULONG Index = 0; ShardCount > Index; Index++)
+    {
+        FSP_IOQ_PENDING_SHARD *Shard = &PendingShards[Index];
+        KeInitializeSpinLock(&Shard->SpinLock);
+        for (ULONG Class = 0; FspFsctlIoqClassCount > Class; Class++)
+            InitializeListHead(&Shard->IrpList[Class]);
+        IoCsqInitializeEx(&Shard->IoCsq,
+            FspIoqPendingInsertIrpEx,
+            FspIoqPendingRemoveIrp,
+            FspIoqPendingPeekNextIrp,
+            FspIoqPendingAcquireLock,
+            FspIoqPendingReleaseLock,
+            FspIoqPendingCompleteCanceledIrp);
+        Shard->Ioq = Ioq;
+        Shard->Index = Index;
+    }
     InitializeListHead(&Ioq->ProcessIrpList);
     InitializeListHead(&Ioq->RetriedIrpList);
-    IoCsqInitializeEx(&Ioq->PendingIoCsq,
-        FspIoqPendingInsertIrpEx,
-        FspIoqPendingRemoveIrp,
-        FspIoqPendingPeekNextIrp,
-        FspIoqPendingAcquireLock,
-        FspIoqPendingReleaseLock,
-        FspIoqPendingCompleteCanceledIrp);
     IoCsqInitializeEx(&Ioq->ProcessIoCsq,
         FspIoqProcessInsertIrpEx,
         FspIoqProcessRemoveIrp,
@@ -517,6 +664,8 @@ NTSTATUS FspIoqCreate(
     Ioq->IrpTimeout = ConvertInterruptTimeToSec(IrpTimeout->QuadPart + InterruptTimeToSecFactor - 1);
         /* convert to seconds (and round up) */
     Ioq->PendingIrpCapacity = IrpCapacity;
+    Ioq->PendingShardCount = ShardCount;
+    Ioq->PendingShards = PendingShards;
     Ioq->CompleteCanceledIrp = CompleteCanceledIrp;
     Ioq->ProcessIrpBucketCount = BucketCount;
 
@@ -529,6 +678,7 @@ VOID FspIoqDelete(FSP_IOQ *Ioq)
 {
     FspIoqStop(Ioq, TRUE);
     FspIoqEventFinalize(&Ioq->PendingIrpEvent);
+    FspFree(Ioq->PendingShards);
     FspFree(Ioq);
 }
 
@@ -543,9 +693,15 @@ VOID FspIoqStop(FSP_IOQ *Ioq, BOOLEAN CancelIrps)
     KeReleaseSpinLock(&Ioq->SpinLock, Irql);
     if (CancelIrps)
     {
+        /*
+         * An insert that acquires a shard lock after we have released it below
+         * is ordered after our write of Stopped and fails. So every shard that we
+         * drain stays drained.
+         */
         PIRP Irp;
-        while (0 != (Irp = IoCsqRemoveNextIrp(&Ioq->PendingIoCsq, 0)))
-            Ioq->CompleteCanceledIrp(Irp);
+        for (ULONG Index = 0; Ioq->PendingShardCount > Index; Index++)
+            while (0 != (Irp = IoCsqRemoveNextIrp(&Ioq->PendingShards[Index].IoCsq, 0)))
+                Ioq->CompleteCanceledIrp(Irp);
         while (0 != (Irp = FspCsqRemoveNextIrp(&Ioq->ProcessIoCsq, 0)))
             Ioq->CompleteCanceledIrp(Irp);
         while (0 != (Irp = FspCsqRemoveNextIrp(&Ioq->RetriedIoCsq, 0)))
@@ -569,8 +725,9 @@ VOID FspIoqRemoveExpired(FSP_IOQ *Ioq, UINT64 InterruptTime)
     PeekContext.IrpHint = 0;
     PeekContext.ExpirationTime = ConvertInterruptTimeToSec(InterruptTime);
     PIRP Irp;
-    while (0 != (Irp = IoCsqRemoveNextIrp(&Ioq->PendingIoCsq, &PeekContext)))
-        Ioq->CompleteCanceledIrp(Irp);
+    for (ULONG Index = 0; Ioq->PendingShardCount > Index; Index++)
+        while (0 != (Irp = IoCsqRemoveNextIrp(&Ioq->PendingShards[Index].IoCsq, &PeekContext)))
+            Ioq->CompleteCanceledIrp(Irp);
 #if !defined(FSP_IOQ_PROCESS_NO_CANCEL)
     while (0 != (Irp = FspCsqRemoveNextIrp(&Ioq->ProcessIoCsq, &PeekContext)))
         Ioq->CompleteCanceledIrp(Irp);
@@ -582,9 +739,17 @@ VOID FspIoqRemoveExpired(FSP_IOQ *Ioq, UINT64 InterruptTime)
 BOOLEAN FspIoqPostIrpEx(FSP_IOQ *Ioq, PIRP Irp, BOOLEAN BestEffort, NTSTATUS *PResult)
 {
     NTSTATUS Result;
+    FSP_IOQ_PENDING_SHARD *Shard = &Ioq->PendingShards[
+        FspIoqShardHome(KeGetCurrentProcessorNumber(), Ioq->PendingShardCount)];
+    FSP_FSCTL_TRANSACT_REQ *Request = FspIrpRequest(Irp);
     FspIrpTimestamp(Irp) = BestEffort ? FspIrpTimestampInfinity :
         QueryInterruptTimeInSec() + Ioq->IrpTimeout;
-    Result = IoCsqInsertIrpEx(&Ioq->PendingIoCsq, Irp, 0, (PVOID)BestEffort);
+    FspIrpPendingStamp(Irp) = FspIoqClassStamp(QueryInterruptTimeInMicros(),
+        FspIoqClassFromKind(
+            0 != Request ? Request->Kind : FspFsctlTransactReservedKind,
+            BooleanFlagOn(Irp->Flags, IRP_PAGING_IO),
+            IoPriorityNormal > IoGetIoPriorityHint(Irp)));
+    Result = IoCsqInsertIrpEx(&Shard->IoCsq, Irp, 0, (PVOID)BestEffort);
     if (NT_SUCCESS(Result))
     {
         if (0 != PResult)
@@ -593,6 +758,7 @@ BOOLEAN FspIoqPostIrpEx(FSP_IOQ *Ioq, PIRP Irp, BOOLEAN BestEffort, NTSTATUS *PR
     }
     else
     {
+        Irp->Tail.Overlay.DriverContext[1] = 0;
         if (0 != PResult)
             *PResult = Result;
         return FALSE;
@@ -617,7 +783,7 @@ PIRP FspIoqNextPendingIrp(FSP_IOQ *Ioq, PIRP BoundaryIrp, PLARGE_INTEGER Timeout
         if (STATUS_CANCELLED == Result || STATUS_THREAD_IS_TERMINATING == Result)
             return FspIoqCancelled;
         ASSERT(STATUS_SUCCESS == Result);
-        PendingIrp = IoCsqRemoveNextIrp(&Ioq->PendingIoCsq, &PeekContext);
+        PendingIrp = FspIoqPendingRemoveNextIrp(Ioq, &PeekContext);
         if (0 == PendingIrp)
         {
             /*
@@ -626,35 +792,46 @@ PIRP FspIoqNextPendingIrp(FSP_IOQ *Ioq, PIRP BoundaryIrp, PLARGE_INTEGER Timeout
              * our synchronization based on the actual condition of the pending
              * queue.
              */
-            KIRQL Irql;
-            KeAcquireSpinLock(&Ioq->SpinLock, &Irql);
             FspIoqPendingResetSynch(Ioq);
-            KeReleaseSpinLock(&Ioq->SpinLock, Irql);
         }
     }
     else
-        PendingIrp = IoCsqRemoveNextIrp(&Ioq->PendingIoCsq, &PeekContext);
+        PendingIrp = FspIoqPendingRemoveNextIrp(Ioq, &PeekContext);
     return PendingIrp;
 }
 
 ULONG FspIoqPendingIrpCount(FSP_IOQ *Ioq)
 {
-    ULONG Result;
-    KIRQL Irql;
-    KeAcquireSpinLock(&Ioq->SpinLock, &Irql);
-    Result = Ioq->PendingIrpCount;
-    KeReleaseSpinLock(&Ioq->SpinLock, Irql);
-    return Result;
+    /* the count spans all shards; there is no single lock to take */
+    LONG Result = Ioq->PendingIrpCount;
+    return 0 < Result ? (ULONG)Result : 0;
 }
 
 BOOLEAN FspIoqPendingAboveWatermark(FSP_IOQ *Ioq, ULONG Watermark)
 {
-    BOOLEAN Result;
-    KIRQL Irql;
-    KeAcquireSpinLock(&Ioq->SpinLock, &Irql);
-    Result = Watermark < 100 * Ioq->PendingIrpCount / Ioq->PendingIrpCapacity;
-    KeReleaseSpinLock(&Ioq->SpinLock, Irql);
-    return Result;
+    return Watermark < 100 * FspIoqPendingIrpCount(Ioq) / Ioq->PendingIrpCapacity;
+}
+
+VOID FspIoqPendingQuery(FSP_IOQ *Ioq, FSP_FSCTL_IOQ_INFO *IoqInfo)
+{
+    RtlZeroMemory(IoqInfo, sizeof *IoqInfo);
+    for (ULONG Index = 0; Ioq->PendingShardCount > Index; Index++)
+    {
+        FSP_IOQ_PENDING_SHARD *Shard = &Ioq->PendingShards[Index];
+        KIRQL Irql;
+        KeAcquireSpinLock(&Shard->SpinLock, &Irql);
+        for (ULONG Class = 0; FspFsctlIoqClassCount > Class; Class++)
+        {
+            FSP_FSCTL_IOQ_CLASS_INFO *ClassInfo = &IoqInfo->Class[Class];
+            FSP_FSCTL_IOQ_CLASS_INFO *ShardClassInfo = &Shard->ClassInfo[Class];
+            ClassInfo->PendingCount += ShardClassInfo->PendingCount;
+            ClassInfo->DispatchCount += ShardClassInfo->DispatchCount;
+            ClassInfo->WaitTime += ShardClassInfo->WaitTime;
+            if (ClassInfo->WaitTimeMax < ShardClassInfo->WaitTimeMax)
+                ClassInfo->WaitTimeMax = ShardClassInfo->WaitTimeMax;
+        }
+        KeReleaseSpinLock(&Shard->SpinLock, Irql);
+    }
 }
 
 BOOLEAN FspIoqStartProcessingIrp(FSP_IOQ *Ioq, PIRP Irp)
@@ -20,122 +20,505 @@
  */
 
 #include <sys/driver.h>
+#include <shared/ku/metadedup.h>
+#include <shared/ku/metapolicy.h>
+
+/*
+ * A meta cache is split into shards, each with its own spin lock, expiration list,
+ * replacement policy and resizable bucket array. New items are added to the shard
+ * of the current processor; the shard number is kept in the low bits of the item
+ * index, so that lookups and invalidations find their shard without searching.
+ *
+ * Lookups take no locks. Writers modify bucket chains under the shard lock in a
+ * way that keeps every chain acyclic and publish new items and bucket arrays only
+ * after they are fully initialized. A lookup that races with a resize may miss an
+ * item that is present, which only costs a trip to the user mode file system.
+ *
+ * Items and bucket arrays that have been unlinked are retired rather than freed.
+ * Readers announce themselves in one of two counters (per processor slot) that
+ * is selected by the current retire phase. The retirees of the previous phase are
+ * reclaimed once all readers of that phase have left, at which point the phase
+ * flips. This is SRCU with two phases; the reference that a retired item holds on
+ * its buffer is only dropped when the item is reclaimed.
+ *
+ * Item buffers are reference counted separately from items. A cache created with
+ * FspMetaCacheDedup interns buffers by content (see shared/ku/metadedup.h), so
+ * that the items of many file nodes with identical content (e.g. inherited security
+ * descriptors) share one buffer. Items of such a cache are charged for their
+ * overhead only. The content of an interned buffer is charged to the shard that
+ * interned it for as long as any item in the cache refers to the buffer, so the
+ * content stays on the budget after the item that brought it in is evicted.
+ */
+
+enum
+{
+    FspMetaCacheShardCountMax = 16,
+    FspMetaCacheShardItemCountMin = 4,      /* maximum size items that a shard must fit */
+    FspMetaCacheSlotCountMax = 64,
+    FspMetaCacheBucketCountMin = 64,
+    FspMetaCacheBucketCountMax = 16 * 1024,
+    FspMetaCacheRetireCountMax = 32,        /* retirees before reclamation is attempted */
+    FspMetaCacheCacheLineSize = 64,
+    FspMetaCacheDedupBucketCount = 256,
+};
 
 typedef struct _FSP_META_CACHE_ITEM
 {
     LIST_ENTRY ListEntry;
-    struct _FSP_META_CACHE_ITEM *DictNext;
+    FSP_META_POLICY_ENTRY PolicyEntry;
+    struct _FSP_META_CACHE_ITEM *volatile DictNext;
+    struct _FSP_META_CACHE_ITEM *RetireNext;
     PVOID ItemBuffer;
     UINT64 ItemIndex;
     UINT64 ExpirationTime;
-    LONG RefCount;
 } FSP_META_CACHE_ITEM;
 
 typedef struct
 {
-    PVOID Item;
-    ULONG Size;
+    FSP_META_DEDUP_ENTRY DedupEntry;        /* DedupEntry.Size is the buffer size */
+    FSP_META_CACHE *MetaCache;              /* non-0 if interned */
+    LONG RefCount;
+    LONG ItemCount;                         /* cached items; content is charged while non-0 */
+    ULONG ShardIndex;                       /* shard charged for the content */
     __declspec(align(MEMORY_ALLOCATION_ALIGNMENT)) UINT8 Buffer[];
 } FSP_META_CACHE_ITEM_BUFFER;
 FSP_FSCTL_STATIC_ASSERT(FIELD_OFFSET(FSP_META_CACHE_ITEM_BUFFER, Buffer) == FspMetaCacheItemHeaderSize,
     "FspMetaCacheItemHeaderSize must match offset of FSP_META_CACHE_ITEM_BUFFER::Buffer");
 
-static inline VOID FspMetaCacheDereferenceItem(FSP_META_CACHE_ITEM *Item)
+typedef struct _FSP_META_CACHE_BUCKETS
+{
+    struct _FSP_META_CACHE_BUCKETS *RetireNext;
+    ULONG BucketCount;                      /* power of 2 */
+    FSP_META_CACHE_ITEM *volatile Buckets[];
+} FSP_META_CACHE_BUCKETS;
+
+typedef struct
+{
+    KSPIN_LOCK SpinLock;
+    ULONG ItemCount;
+    UINT64 ItemIndex;                       /* shard local part of last item index */
+    LIST_ENTRY ItemList;                    /* expiration order */
+    FSP_META_POLICY Policy;                 /* replacement order; see shared/ku/metapolicy.h */
+    volatile LONG BufferCharge;             /* content of interned buffers; see above */
+    FSP_META_CACHE_BUCKETS *volatile Buckets;
+    UINT8 Padding[FspMetaCacheCacheLineSize];
+} FSP_META_CACHE_SHARD;
+
+typedef struct
+{
+    volatile LONG ReaderCount[2];           /* indexed by retire phase */
+    ULONG HitCount, MissCount;              /* unsynchronized; for diagnostics only */
+    UINT8 Padding[FspMetaCacheCacheLineSize - 4 * sizeof(ULONG)];
+} FSP_META_CACHE_SLOT;
+
+struct _FSP_META_CACHE
+{
+    UINT64 MetaTimeout;
+    ULONG ItemSizeMax;
+    ULONG Flags;
+    ULONG ShardCount, ShardShift;           /* ShardCount == 1 << ShardShift */
+    ULONG SlotCount;
+    FSP_META_CACHE_SHARD *Shards;
+    FSP_META_CACHE_SLOT *Slots;
+    KSPIN_LOCK RetireSpinLock;
+    volatile LONG RetirePhase;
+    ULONG RetireCount;
+    FSP_META_CACHE_ITEM *RetiredItems[2];
+    FSP_META_CACHE_BUCKETS *RetiredBuckets[2];
+    FAST_MUTEX DedupMutex;
+    FSP_META_DEDUP_TABLE Dedup;
+    UINT64 DedupHitCount, DedupMissCount;
+};
+
+static inline ULONG FspMetaCacheItemCharge(ULONG Size)
 {
-    LONG RefCount = InterlockedDecrement(&Item->RefCount);
+    /* bytes charged against the cache budget */
+    return sizeof(FSP_META_CACHE_ITEM) + sizeof(FSP_META_CACHE_ITEM_BUFFER) + Size;
+}
+
+static inline VOID FspMetaCacheDereferenceBuffer(FSP_META_CACHE_ITEM_BUFFER *ItemBuffer)
+{
+    LONG RefCount = InterlockedDecrement(&ItemBuffer->RefCount);
     if (0 == RefCount)
     {
-        /* if we ever need to add a finalizer for meta items it should go here */
-        FspFree(Item->ItemBuffer);
-        FspFree(Item);
+        FSP_META_CACHE *MetaCache = ItemBuffer->MetaCache;
+        if (0 != MetaCache)
+        {
+            /* lookups skip dead buffers, so this cannot race with resurrection */
+            ExAcquireFastMutex(&MetaCache->DedupMutex);
+            FspMetaDedupRemove(&MetaCache->Dedup, &ItemBuffer->DedupEntry);
+            ExReleaseFastMutex(&MetaCache->DedupMutex);
+        }
+        FspFree(ItemBuffer);
     }
 }
 
-static inline FSP_META_CACHE_ITEM *FspMetaCacheLookupIndexedItemAtDpcLevel(FSP_META_CACHE *MetaCache,
-    UINT64 ItemIndex)
+static inline VOID FspMetaCacheFreeItem(FSP_META_CACHE_ITEM *Item)
 {
-    FSP_META_CACHE_ITEM *Item = 0;
-    ULONG HashIndex = ItemIndex % MetaCache->ItemBucketCount;
-    for (FSP_META_CACHE_ITEM *ItemX = MetaCache->ItemBuckets[HashIndex]; ItemX; ItemX = ItemX->DictNext)
-        if (ItemX->ItemIndex == ItemIndex)
+    /* if we ever need to add a finalizer for meta items it should go here */
+    FspMetaCacheDereferenceBuffer(Item->ItemBuffer);
+    FspFree(Item);
+}
+
+static FSP_META_CACHE_ITEM_BUFFER *FspMetaCacheInternBuffer(FSP_META_CACHE *MetaCache,
+    FSP_META_CACHE_ITEM_BUFFER *ItemBuffer, ULONG ShardIndex)
+{
+    /*
+     * Return a referenced buffer with the same content as ItemBuffer, freeing
+     * ItemBuffer if one is already interned. Otherwise intern ItemBuffer.
+     */
+    FSP_META_DEDUP_ENTRY *Entry = 0;
+    FSP_META_CACHE_ITEM_BUFFER *SharedBuffer;
+    ULONG Size = ItemBuffer->DedupEntry.Size;
+    UINT32 Hash = FspMetaDedupHash(ItemBuffer->Buffer, Size);
+    LONG RefCount;
+
+    ExAcquireFastMutex(&MetaCache->DedupMutex);
+    while (0 != (Entry = FspMetaDedupLookup(&MetaCache->Dedup, Hash, ItemBuffer->Buffer, Size, Entry)))
+    {
+        SharedBuffer = CONTAINING_RECORD(Entry, FSP_META_CACHE_ITEM_BUFFER, DedupEntry);
+        /* reference unless dying */
+        for (RefCount = SharedBuffer->RefCount; 0 != RefCount; RefCount = SharedBuffer->RefCount)
+            if (RefCount == InterlockedCompareExchange(&SharedBuffer->RefCount, RefCount + 1, RefCount))
+            {
+                MetaCache->DedupHitCount++;
+                ExReleaseFastMutex(&MetaCache->DedupMutex);
+                FspFree(ItemBuffer);
+                return SharedBuffer;
+            }
+    }
+    ItemBuffer->MetaCache = MetaCache;
+    ItemBuffer->ShardIndex = ShardIndex;
+    FspMetaDedupInsert(&MetaCache->Dedup, Hash, &ItemBuffer->DedupEntry, Size);
+    MetaCache->DedupMissCount++;
+    ExReleaseFastMutex(&MetaCache->DedupMutex);
+
+    return ItemBuffer;
+}
+
+static inline FSP_META_CACHE_SHARD *FspMetaCacheShard(FSP_META_CACHE *MetaCache, UINT64 ItemIndex)
+{
+    return &MetaCache->Shards[ItemIndex & (MetaCache->ShardCount - 1)];
+}
+
+static inline VOID FspMetaCacheChargeBuffer(FSP_META_CACHE_ITEM_BUFFER *ItemBuffer, BOOLEAN Charge)
+{
+    /* charge the content of an interned buffer when its first item enters the cache */
+    FSP_META_CACHE *MetaCache = ItemBuffer->MetaCache;
+    if (0 == MetaCache)
+        return;
+    FSP_META_CACHE_SHARD *Shard = &MetaCache->Shards[ItemBuffer->ShardIndex];
+    LONG Size = (LONG)ItemBuffer->DedupEntry.Size;
+    if (Charge)
+    {
+        if (1 == InterlockedIncrement(&ItemBuffer->ItemCount))
+            InterlockedExchangeAdd(&Shard->BufferCharge, Size);
+    }
+    else
+    {
+        if (0 == InterlockedDecrement(&ItemBuffer->ItemCount))
+            InterlockedExchangeAdd(&Shard->BufferCharge, -Size);
+    }
+}
+
+static inline ULONG FspMetaCacheBucketIndex(FSP_META_CACHE *MetaCache,
+    FSP_META_CACHE_BUCKETS *Buckets, UINT64 ItemIndex)
+{
+    return (ULONG)(ItemIndex >> MetaCache->ShardShift) & (Buckets->BucketCount - 1);
+}
+
+static inline VOID FspMetaCachePublishPointer(PVOID volatile *P, PVOID Value)
+{
+    /* full barrier: everything written before is visible to whoever sees Value */
+    InterlockedExchangePointer(P, Value);
+}
+
+static FSP_META_CACHE_BUCKETS *FspMetaCacheAllocBuckets(ULONG BucketCount)
+{
+    FSP_META_CACHE_BUCKETS *Buckets;
+    ULONG Size = FIELD_OFFSET(FSP_META_CACHE_BUCKETS, Buckets) + BucketCount * sizeof(PVOID);
+    Buckets = FspAllocNonPaged(Size);
+    if (0 == Buckets)
+        return 0;
+    RtlZeroMemory(Buckets, Size);
+    Buckets->BucketCount = BucketCount;
+    return Buckets;
+}
+
+static inline FSP_META_CACHE_SLOT *FspMetaCacheEnterReader(FSP_META_CACHE *MetaCache, PLONG PPhase)
+{
+    FSP_META_CACHE_SLOT *Slot = &MetaCache->Slots[KeGetCurrentProcessorNumber() % MetaCache->SlotCount];
+    LONG Phase = MetaCache->RetirePhase & 1;
+    /* full barrier: the reads that follow cannot be performed before the announcement */
+    InterlockedIncrement(&Slot->ReaderCount[Phase]);
+    *PPhase = Phase;
+    return Slot;
+}
+
+static inline VOID FspMetaCacheLeaveReader(FSP_META_CACHE_SLOT *Slot, LONG Phase)
+{
+    /* the reader may have migrated to another processor; it still leaves the same slot */
+    InterlockedDecrement(&Slot->ReaderCount[Phase]);
+}
+
+static inline LONG FspMetaCacheReaderCount(FSP_META_CACHE *MetaCache, LONG Phase)
+{
+    LONG ReaderCount = 0;
+    for (ULONG Index = 0; MetaCache->SlotCount > Index; Index++)
+        ReaderCount += MetaCache->Slots[Index].ReaderCount[Phase];
+    return ReaderCount;
+}
+
+static FSP_META_CACHE_ITEM *FspMetaCacheRetire(FSP_META_CACHE *MetaCache,
+    FSP_META_CACHE_ITEM *RetiredItems, FSP_META_CACHE_BUCKETS *RetiredBuckets, BOOLEAN Reclaim)
+{
+    /*
+     * Retire the passed items and bucket arrays, which must already be unlinked. Then
+     * (if requested or if enough has been retired) attempt reclamation. The caller must
+     * dereference the returned items at IRQL < DISPATCH_LEVEL.
+     */
+    FSP_META_CACHE_ITEM *ReclaimedItems = 0, *Item;
+    FSP_META_CACHE_BUCKETS *ReclaimedBuckets = 0, *Buckets;
+    LONG Phase, OldPhase;
+    KIRQL Irql;
+
+    KeAcquireSpinLock(&MetaCache->RetireSpinLock, &Irql);
+    Phase = MetaCache->RetirePhase & 1;
+    OldPhase = Phase ^ 1;
+    while (0 != RetiredItems)
+    {
+        Item = RetiredItems;
+        RetiredItems = Item->RetireNext;
+        Item->RetireNext = MetaCache->RetiredItems[Phase];
+        MetaCache->RetiredItems[Phase] = Item;
+        MetaCache->RetireCount++;
+    }
+    while (0 != RetiredBuckets)
+    {
+        Buckets = RetiredBuckets;
+        RetiredBuckets = Buckets->RetireNext;
+        Buckets->RetireNext = MetaCache->RetiredBuckets[Phase];
+        MetaCache->RetiredBuckets[Phase] = Buckets;
+        MetaCache->RetireCount++;
+    }
+    if ((Reclaim || FspMetaCacheRetireCountMax <= MetaCache->RetireCount) &&
+        0 != MetaCache->RetireCount)
+    {
+        /* order the unlinks (and the retire list reads) before the reader count reads */
+        KeMemoryBarrier();
+        if (0 == FspMetaCacheReaderCount(MetaCache, OldPhase))
         {
-            Item = ItemX;
-            break;
+            ReclaimedItems = MetaCache->RetiredItems[OldPhase];
+            ReclaimedBuckets = MetaCache->RetiredBuckets[OldPhase];
+            MetaCache->RetiredItems[OldPhase] = 0;
+            MetaCache->RetiredBuckets[OldPhase] = 0;
+            MetaCache->RetireCount = 0;
+            for (Item = MetaCache->RetiredItems[Phase]; 0 != Item; Item = Item->RetireNext)
+                MetaCache->RetireCount++;
+            for (Buckets = MetaCache->RetiredBuckets[Phase]; 0 != Buckets; Buckets = Buckets->RetireNext)
+                MetaCache->RetireCount++;
+            InterlockedIncrement(&MetaCache->RetirePhase);
         }
-    return Item;
+    }
+    KeReleaseSpinLock(&MetaCache->RetireSpinLock, Irql);
+
+    while (0 != ReclaimedBuckets)
+    {
+        Buckets = ReclaimedBuckets;
+        ReclaimedBuckets = Buckets->RetireNext;
+        FspFree(Buckets);
+    }
+
+    return ReclaimedItems;
+}
+
+static inline VOID FspMetaCacheDereferenceRetiredItems(FSP_META_CACHE_ITEM *Items)
+{
+    FSP_META_CACHE_ITEM *Item;
+    while (0 != Items)
+    {
+        Item = Items;
+        Items = Item->RetireNext;
+        FspMetaCacheFreeItem(Item);
+    }
 }
 
-static inline VOID FspMetaCacheAddItemAtDpcLevel(FSP_META_CACHE *MetaCache, FSP_META_CACHE_ITEM *Item)
+static inline VOID FspMetaCacheAddItemAtDpcLevel(FSP_META_CACHE *MetaCache, FSP_META_CACHE_SHARD *Shard,
+    FSP_META_CACHE_ITEM *Item, ULONG Charge)
 {
-    ULONG HashIndex = Item->ItemIndex % MetaCache->ItemBucketCount;
+    FSP_META_CACHE_BUCKETS *Buckets = Shard->Buckets;
+    ULONG HashIndex = FspMetaCacheBucketIndex(MetaCache, Buckets, Item->ItemIndex);
 #if DBG
-    for (FSP_META_CACHE_ITEM *ItemX = MetaCache->ItemBuckets[HashIndex]; ItemX; ItemX = ItemX->DictNext)
+    for (FSP_META_CACHE_ITEM *ItemX = Buckets->Buckets[HashIndex]; ItemX; ItemX = ItemX->DictNext)
         ASSERT(ItemX->ItemIndex != Item->ItemIndex);
 #endif
-    Item->DictNext = MetaCache->ItemBuckets[HashIndex];
-    MetaCache->ItemBuckets[HashIndex] = Item;
-    InsertTailList(&MetaCache->ItemList, &Item->ListEntry);
-    MetaCache->ItemCount++;
+    InsertTailList(&Shard->ItemList, &Item->ListEntry);
+    FspMetaPolicyInsert(&Shard->Policy, &Item->PolicyEntry, Charge);
+    Shard->ItemCount++;
+    Item->DictNext = Buckets->Buckets[HashIndex];
+    FspMetaCachePublishPointer((PVOID volatile *)&Buckets->Buckets[HashIndex], Item);
 }
 
-static inline FSP_META_CACHE_ITEM *FspMetaCacheRemoveIndexedItemAtDpcLevel(FSP_META_CACHE *MetaCache,
-    UINT64 ItemIndex)
+static inline VOID FspMetaCacheRemoveItemAtDpcLevel(FSP_META_CACHE *MetaCache, FSP_META_CACHE_SHARD *Shard,
+    FSP_META_CACHE_ITEM *Item)
 {
-    FSP_META_CACHE_ITEM *Item = 0;
-    ULONG HashIndex = ItemIndex % MetaCache->ItemBucketCount;
-    for (FSP_META_CACHE_ITEM **P = (PVOID)&MetaCache->ItemBuckets[HashIndex]; *P; P = &(*P)->DictNext)
-        if ((*P)->ItemIndex == ItemIndex)
+    /* Item->DictNext is left intact for the benefit of concurrent readers */
+    FSP_META_CACHE_BUCKETS *Buckets = Shard->Buckets;
+    ULONG HashIndex = FspMetaCacheBucketIndex(MetaCache, Buckets, Item->ItemIndex);
+    for (FSP_META_CACHE_ITEM *volatile *P = &Buckets->Buckets[HashIndex]; *P; P = &(*P)->DictNext)
+        if (*P == Item)
         {
-            Item = *P;
-            *P = (*P)->DictNext;
-            RemoveEntryList(&Item->ListEntry);
-            MetaCache->ItemCount--;
+            *P = Item->DictNext;
             break;
         }
-    return Item;
+    RemoveEntryList(&Item->ListEntry);
+    FspMetaPolicyRemove(&Shard->Policy, &Item->PolicyEntry);
+    Shard->ItemCount--;
+    /* the item still references its buffer until reclaimed, but no longer pays for it */
+    FspMetaCacheChargeBuffer(Item->ItemBuffer, FALSE);
+}
+
+static inline FSP_META_CACHE_ITEM *FspMetaCacheRemoveIndexedItemAtDpcLevel(FSP_META_CACHE *MetaCache,
+    FSP_META_CACHE_SHARD *Shard, UINT64 ItemIndex)
+{
+    FSP_META_CACHE_BUCKETS *Buckets = Shard->Buckets;
+    ULONG HashIndex = FspMetaCacheBucketIndex(MetaCache, Buckets, ItemIndex);
+    for (FSP_META_CACHE_ITEM *ItemX = Buckets->Buckets[HashIndex]; ItemX; ItemX = ItemX->DictNext)
+        if (ItemX->ItemIndex == ItemIndex)
+        {
+            FspMetaCacheRemoveItemAtDpcLevel(MetaCache, Shard, ItemX);
+            return ItemX;
+        }
+    return 0;
 }
 
 static inline FSP_META_CACHE_ITEM *FspMetaCacheRemoveExpiredItemAtDpcLevel(FSP_META_CACHE *MetaCache,
-    UINT64 ExpirationTime)
+    FSP_META_CACHE_SHARD *Shard, UINT64 ExpirationTime)
 {
-    PLIST_ENTRY Head = &MetaCache->ItemList;
+    PLIST_ENTRY Head = &Shard->ItemList;
     PLIST_ENTRY Entry = Head->Flink;
     if (Head == Entry)
         return 0;
     FSP_META_CACHE_ITEM *Item = CONTAINING_RECORD(Entry, FSP_META_CACHE_ITEM, ListEntry);
     if (FspExpirationTimeValid2(Item->ExpirationTime, ExpirationTime))
         return 0;
-    ULONG HashIndex = Item->ItemIndex % MetaCache->ItemBucketCount;
-    for (FSP_META_CACHE_ITEM **P = (PVOID)&MetaCache->ItemBuckets[HashIndex]; *P; P = &(*P)->DictNext)
-        if (*P == Item)
+    FspMetaCacheRemoveItemAtDpcLevel(MetaCache, Shard, Item);
+    return Item;
+}
+
+static inline FSP_META_CACHE_ITEM *FspMetaCacheRemoveVictimItemAtDpcLevel(FSP_META_CACHE *MetaCache,
+    FSP_META_CACHE_SHARD *Shard, ULONG Charge)
+{
+    /* BufferCharge may be briefly negative while other shards charge and credit it */
+    LONG BufferCharge = Shard->BufferCharge;
+    if (!FspMetaPolicyMustEvict(&Shard->Policy, Charge + (0 < BufferCharge ? BufferCharge : 0)))
+        return 0;
+    FSP_META_POLICY_ENTRY *Entry = FspMetaPolicyVictim(&Shard->Policy);
+    if (0 == Entry)
+        return 0;
+    FSP_META_CACHE_ITEM *Item = CONTAINING_RECORD(Entry, FSP_META_CACHE_ITEM, PolicyEntry);
+    FspMetaCacheRemoveItemAtDpcLevel(MetaCache, Shard, Item);
+    Shard->Policy.EvictionCount++;
+    return Item;
+}
+
+static FSP_META_CACHE_BUCKETS *FspMetaCacheGrowBucketsAtDpcLevel(FSP_META_CACHE *MetaCache,
+    FSP_META_CACHE_SHARD *Shard)
+{
+    /*
+     * Move all items to a bucket array of 4 times the size and return the old array
+     * for retirement. An item's DictNext is only ever pointed to items that have been
+     * moved before it, so concurrent readers never see a cycle; they may however miss
+     * items that have been moved ahead of them.
+     */
+    FSP_META_CACHE_BUCKETS *OldBuckets = Shard->Buckets, *NewBuckets;
+    FSP_META_CACHE_ITEM *Item, *NextItem;
+    ULONG HashIndex;
+
+    if (Shard->ItemCount <= 2 * OldBuckets->BucketCount ||
+        FspMetaCacheBucketCountMax <= OldBuckets->BucketCount)
+        return 0;
+
+    NewBuckets = FspMetaCacheAllocBuckets(4 * OldBuckets->BucketCount);
+    if (0 == NewBuckets)
+        return 0; /* not an error; we just live with longer chains */
+
+    for (ULONG Index = 0; OldBuckets->BucketCount > Index; Index++)
+        for (Item = OldBuckets->Buckets[Index]; 0 != Item; Item = NextItem)
         {
-            *P = (*P)->DictNext;
-            break;
+            NextItem = Item->DictNext;
+            HashIndex = FspMetaCacheBucketIndex(MetaCache, NewBuckets, Item->ItemIndex);
+            FspMetaCachePublishPointer((PVOID volatile *)&Item->DictNext, NewBuckets->Buckets[HashIndex]);
+            NewBuckets->Buckets[HashIndex] = Item;
         }
-    RemoveEntryList(&Item->ListEntry);
-    MetaCache->ItemCount--;
-    return Item;
+
+    FspMetaCachePublishPointer((PVOID volatile *)&Shard->Buckets, NewBuckets);
+
+    OldBuckets->RetireNext = 0;
+    return OldBuckets;
 }
 
 NTSTATUS FspMetaCacheCreate(
-    ULONG MetaCapacity, ULONG ItemSizeMax, PLARGE_INTEGER MetaTimeout,
+    ULONG MetaBudget, ULONG ItemSizeMax, ULONG Flags, PLARGE_INTEGER MetaTimeout,
     FSP_META_CACHE **PMetaCache)
 {
     *PMetaCache = 0;
-    if (0 == MetaCapacity || 0 == ItemSizeMax || 0 == MetaTimeout->QuadPart)
+    if (0 == MetaBudget || 0 == ItemSizeMax || 0 == MetaTimeout->QuadPart)
         return STATUS_SUCCESS;
+    /* the budget must at least accommodate an item of maximum size */
+    if (MetaBudget < FspMetaCacheItemCharge(ItemSizeMax))
+        MetaBudget = FspMetaCacheItemCharge(ItemSizeMax);
     FSP_META_CACHE *MetaCache;
-    ULONG BucketCount = (PAGE_SIZE - sizeof *MetaCache) / sizeof MetaCache->ItemBuckets[0];
-    MetaCache = FspAllocNonPaged(PAGE_SIZE);
+    ULONG ShardCount, ShardShift, SlotCount, ShardOffset, SlotOffset, DedupOffset, Size;
+    /* one shard per processor, but do not split the budget too finely */
+    for (ShardShift = 0;
+        FspMetaCacheShardCountMax > (1UL << ShardShift) &&
+        FspProcessorCount > (1UL << ShardShift) &&
+        MetaBudget / (2UL << ShardShift) >=
+            FspMetaCacheShardItemCountMin * FspMetaCacheItemCharge(ItemSizeMax);
+        ShardShift++)
+        ;
+    ShardCount = 1UL << ShardShift;
+    SlotCount = FspMetaCacheSlotCountMax < FspProcessorCount ?
+        FspMetaCacheSlotCountMax : FspProcessorCount;
+    ShardOffset = FSP_FSCTL_ALIGN_UP(sizeof *MetaCache, FspMetaCacheCacheLineSize);
+    SlotOffset = ShardOffset + ShardCount * sizeof(FSP_META_CACHE_SHARD);
+    DedupOffset = SlotOffset + SlotCount * sizeof(FSP_META_CACHE_SLOT);
+    Size = DedupOffset + (FlagOn(Flags, FspMetaCacheDedup) ?
+        FspMetaCacheDedupBucketCount * sizeof(PVOID) : 0);
+    MetaCache = FspAllocNonPaged(Size);
     if (0 == MetaCache)
         return STATUS_INSUFFICIENT_RESOURCES;
-    RtlZeroMemory(MetaCache, PAGE_SIZE);
-    KeInitializeSpinLock(&MetaCache->SpinLock);
-    InitializeListHead(&MetaCache->ItemList);
-    MetaCache->MetaCapacity = MetaCapacity;
-    MetaCache->ItemSizeMax = ItemSizeMax;
+    RtlZeroMemory(MetaCache, Size);
     MetaCache->MetaTimeout = MetaTimeout->QuadPart;
-    MetaCache->ItemBucketCount = BucketCount;
+    MetaCache->ItemSizeMax = ItemSizeMax;
+    MetaCache->Flags = Flags;
+    MetaCache->ShardCount = ShardCount;
+    MetaCache->ShardShift = ShardShift;
+    MetaCache->SlotCount = SlotCount;
+    MetaCache->Shards = (PVOID)((PUINT8)MetaCache + ShardOffset);
+    MetaCache->Slots = (PVOID)((PUINT8)MetaCache + SlotOffset);
+    KeInitializeSpinLock(&MetaCache->RetireSpinLock);
+    ExInitializeFastMutex(&MetaCache->DedupMutex);
+    if (FlagOn(Flags, FspMetaCacheDedup))
+        FspMetaDedupInitialize(&MetaCache->Dedup,
+            (PVOID)((PUINT8)MetaCache + DedupOffset), FspMetaCacheDedupBucketCount,
+            FIELD_OFFSET(FSP_META_CACHE_ITEM_BUFFER, Buffer));
+    for (ULONG Index = 0; ShardCount > Index; Index++)
+    {
+        FSP_META_CACHE_SHARD *Shard = &MetaCache->Shards[Index];
+        KeInitializeSpinLock(&Shard->SpinLock);
+        InitializeListHead(&Shard->ItemList);
+        FspMetaPolicyInitialize(&Shard->Policy, MetaBudget / ShardCount);
+        Shard->Buckets = FspMetaCacheAllocBuckets(FspMetaCacheBucketCountMin);
+        if (0 == Shard->Buckets)
+        {
+            while (0 < Index)
+                FspFree(MetaCache->Shards[--Index].Buckets);
+            FspFree(MetaCache);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
     *PMetaCache = MetaCache;
     return STATUS_SUCCESS;
 }
@@ -144,7 +527,33 @@ VOID FspMetaCacheDelete(FSP_META_CACHE *MetaCache)
 {
     if (0 == MetaCache)
         return;
+    UINT64 HitCount = 0, MissCount = 0, EvictionCount = 0, PromotionCount = 0;
+    for (ULONG Index = 0; MetaCache->SlotCount > Index; Index++)
+    {
+        HitCount += MetaCache->Slots[Index].HitCount;
+        MissCount += MetaCache->Slots[Index].MissCount;
+    }
+    for (ULONG Index = 0; MetaCache->ShardCount > Index; Index++)
+    {
+        EvictionCount += MetaCache->Shards[Index].Policy.EvictionCount;
+        PromotionCount += MetaCache->Shards[Index].Policy.PromotionCount;
+    }
+    DEBUGLOG("shards=%lu hits=%llu misses=%llu evictions=%llu promotions=%llu "
+        "dedup-hits=%llu dedup-misses=%llu",
+        MetaCache->ShardCount, HitCount, MissCount, EvictionCount, PromotionCount,
+        MetaCache->DedupHitCount, MetaCache->DedupMissCount);
     FspMetaCacheInvalidateExpired(MetaCache, (UINT64)-1LL);
+    /* there are no readers left; two reclamations empty both retire phases */
+    FspMetaCacheDereferenceRetiredItems(FspMetaCacheRetire(MetaCache, 0, 0, TRUE));
+    FspMetaCacheDereferenceRetiredItems(FspMetaCacheRetire(MetaCache, 0, 0, TRUE));
+    ASSERT(0 == MetaCache->RetireCount);
+    /* buffers are only referenced by file nodes transiently; none must survive the cache */
+    ASSERT(0 == MetaCache->Dedup.EntryCount);
+    for (ULONG Index = 0; MetaCache->ShardCount > Index; Index++)
+    {
+        ASSERT(0 == MetaCache->Shards[Index].BufferCharge);
+        FspFree(MetaCache->Shards[Index].Buckets);
+    }
     FspFree(MetaCache);
 }
 
@@ -152,17 +561,22 @@ VOID FspMetaCacheInvalidateExpired(FSP_META_CACHE *MetaCache, UINT64 ExpirationT
 {
     if (0 == MetaCache)
         return;
-    FSP_META_CACHE_ITEM *Item;
+    FSP_META_CACHE_SHARD *Shard;
+    FSP_META_CACHE_ITEM *Item, *RetiredItems = 0;
     KIRQL Irql;
-    for (;;)
+    for (ULONG Index = 0; MetaCache->ShardCount > Index; Index++)
     {
-        KeAcquireSpinLock(&MetaCache->SpinLock, &Irql);
-        Item = FspMetaCacheRemoveExpiredItemAtDpcLevel(MetaCache, ExpirationTime);
-        KeReleaseSpinLock(&MetaCache->SpinLock, Irql);
-        if (0 == Item)
-            break;
-        FspMetaCacheDereferenceItem(Item);
+        Shard = &MetaCache->Shards[Index];
+        KeAcquireSpinLock(&Shard->SpinLock, &Irql);
+        while (0 != (Item = FspMetaCacheRemoveExpiredItemAtDpcLevel(MetaCache, Shard, ExpirationTime)))
+        {
+            Item->RetireNext = RetiredItems;
+            RetiredItems = Item;
+        }
+        KeReleaseSpinLock(&Shard->SpinLock, Irql);
     }
+    /* this runs periodically, so it is also where lingering retirees get reclaimed */
+    FspMetaCacheDereferenceRetiredItems(FspMetaCacheRetire(MetaCache, RetiredItems, 0, TRUE));
 }
 
 BOOLEAN FspMetaCacheReferenceItemBuffer(FSP_META_CACHE *MetaCache, UINT64 ItemIndex,
@@ -173,41 +587,59 @@ BOOLEAN FspMetaCacheReferenceItemBuffer(FSP_META_CACHE *MetaCache, UINT64 ItemIn
         *PSize = 0;
     if (0 == MetaCache || 0 == ItemIndex)
         return FALSE;
+    FSP_META_CACHE_SHARD *Shard = FspMetaCacheShard(MetaCache, ItemIndex);
+    FSP_META_CACHE_SLOT *Slot;
+    FSP_META_CACHE_BUCKETS *Buckets;
     FSP_META_CACHE_ITEM *Item = 0;
     FSP_META_CACHE_ITEM_BUFFER *ItemBuffer;
-    KIRQL Irql;
-    KeAcquireSpinLock(&MetaCache->SpinLock, &Irql);
-    Item = FspMetaCacheLookupIndexedItemAtDpcLevel(MetaCache, ItemIndex);
+    LONG Phase;
+    Slot = FspMetaCacheEnterReader(MetaCache, &Phase);
+    Buckets = Shard->Buckets;
+    for (FSP_META_CACHE_ITEM *ItemX = Buckets->Buckets[FspMetaCacheBucketIndex(MetaCache, Buckets, ItemIndex)];
+        ItemX; ItemX = ItemX->DictNext)
+        if (ItemX->ItemIndex == ItemIndex)
+        {
+            Item = ItemX;
+            break;
+        }
     if (0 == Item)
     {
-        KeReleaseSpinLock(&MetaCache->SpinLock, Irql);
+        Slot->MissCount++;
+        FspMetaCacheLeaveReader(Slot, Phase);
         return FALSE;
     }
-    InterlockedIncrement(&Item->RefCount);
-    KeReleaseSpinLock(&MetaCache->SpinLock, Irql);
+    /* the item's buffer reference cannot go away while we are a reader */
     ItemBuffer = Item->ItemBuffer;
+    InterlockedIncrement(&ItemBuffer->RefCount);
+    FspMetaPolicyReference(&Shard->Policy, &Item->PolicyEntry);
+    Slot->HitCount++;
+    FspMetaCacheLeaveReader(Slot, Phase);
     *PBuffer = ItemBuffer->Buffer;
     if (0 != PSize)
-        *PSize = ItemBuffer->Size;
+        *PSize = ItemBuffer->DedupEntry.Size;
     return TRUE;
 }
 
 VOID FspMetaCacheDereferenceItemBuffer(PCVOID Buffer)
 {
     FSP_META_CACHE_ITEM_BUFFER *ItemBuffer = (PVOID)((PUINT8)Buffer - sizeof *ItemBuffer);
-    FspMetaCacheDereferenceItem(ItemBuffer->Item);
+    FspMetaCacheDereferenceBuffer(ItemBuffer);
 }
 
 UINT64 FspMetaCacheAddItem(FSP_META_CACHE *MetaCache, PCVOID Buffer, ULONG Size)
 {
     if (0 == MetaCache)
         return 0;
-    FSP_META_CACHE_ITEM *Item, *ExpiredItem = 0;
+    FSP_META_CACHE_SHARD *Shard;
+    FSP_META_CACHE_ITEM *Item, *VictimItem, *RetiredItems = 0;
+    FSP_META_CACHE_BUCKETS *RetiredBuckets;
     FSP_META_CACHE_ITEM_BUFFER *ItemBuffer;
     UINT64 ItemIndex = 0;
+    ULONG ShardIndex, Charge;
     KIRQL Irql;
     if (sizeof *ItemBuffer + Size > MetaCache->ItemSizeMax)
         return 0;
+    Charge = FspMetaCacheItemCharge(Size);
     Item = FspAllocNonPaged(sizeof *Item);
     if (0 == Item)
         return 0;
@@ -219,11 +651,8 @@ UINT64 FspMetaCacheAddItem(FSP_META_CACHE *MetaCache, PCVOID Buffer, ULONG Size)
     }
     RtlZeroMemory(Item, sizeof *Item);
     RtlZeroMemory(ItemBuffer, sizeof *ItemBuffer);
-    Item->ItemBuffer = ItemBuffer;
-    Item->ExpirationTime = FspExpirationTimeFromTimeout(MetaCache->MetaTimeout);
-    Item->RefCount = 1;
-    ItemBuffer->Item = Item;
-    ItemBuffer->Size = Size;
+    ItemBuffer->DedupEntry.Size = Size;
+    ItemBuffer->RefCount = 1;
     try
     {
         RtlCopyMemory(ItemBuffer->Buffer, Buffer, Size);
@@ -234,16 +663,35 @@ UINT64 FspMetaCacheAddItem(FSP_META_CACHE *MetaCache, PCVOID Buffer, ULONG Size)
         FspFree(Item);
         return 0;
     }
-    KeAcquireSpinLock(&MetaCache->SpinLock, &Irql);
-    if (MetaCache->ItemCount >= MetaCache->MetaCapacity)
-        ExpiredItem = FspMetaCacheRemoveExpiredItemAtDpcLevel(MetaCache, (UINT64)-1LL);
-    ItemIndex = MetaCache->ItemIndex;
-    ItemIndex = (UINT64)-1LL == ItemIndex ? 1 : ItemIndex + 1;
-    MetaCache->ItemIndex = Item->ItemIndex = ItemIndex;
-    FspMetaCacheAddItemAtDpcLevel(MetaCache, Item);
-    KeReleaseSpinLock(&MetaCache->SpinLock, Irql);
-    if (0 != ExpiredItem)
-        FspMetaCacheDereferenceItem(ExpiredItem);
+    /* add to the shard of the current processor; migrating meanwhile is harmless */
+    ShardIndex = KeGetCurrentProcessorNumber() & (MetaCache->ShardCount - 1);
+    Shard = &MetaCache->Shards[ShardIndex];
+    if (FlagOn(MetaCache->Flags, FspMetaCacheDedup))
+    {
+        /* the content is charged to the shard that interned the buffer instead */
+        ItemBuffer = FspMetaCacheInternBuffer(MetaCache, ItemBuffer, ShardIndex);
+        FspMetaCacheChargeBuffer(ItemBuffer, TRUE);
+        Charge = FspMetaCacheItemCharge(0);
+    }
+    Item->ItemBuffer = ItemBuffer;
+    Item->ExpirationTime = FspExpirationTimeFromTimeout(MetaCache->MetaTimeout);
+    KeAcquireSpinLock(&Shard->SpinLock, &Irql);
+    while (0 != (VictimItem = FspMetaCacheRemoveVictimItemAtDpcLevel(MetaCache, Shard, Charge)))
+    {
+        VictimItem->RetireNext = RetiredItems;
+        RetiredItems = VictimItem;
+    }
+    ItemIndex = Shard->ItemIndex;
+    ItemIndex = ((UINT64)-1LL >> MetaCache->ShardShift) == ItemIndex ? 1 : ItemIndex + 1;
+    Shard->ItemIndex = ItemIndex;
+    ItemIndex = (ItemIndex << MetaCache->ShardShift) | ShardIndex;
+    Item->ItemIndex = ItemIndex;
+    RetiredBuckets = FspMetaCacheGrowBucketsAtDpcLevel(MetaCache, Shard);
+    FspMetaCacheAddItemAtDpcLevel(MetaCache, Shard, Item, Charge);
+    KeReleaseSpinLock(&Shard->SpinLock, Irql);
+    if (0 != RetiredItems || 0 != RetiredBuckets)
+        FspMetaCacheDereferenceRetiredItems(
+            FspMetaCacheRetire(MetaCache, RetiredItems, RetiredBuckets, FALSE));
     return ItemIndex;
 }
 
@@ -251,11 +699,15 @@ VOID FspMetaCacheInvalidateItem(FSP_META_CACHE *MetaCache, UINT64 ItemIndex)
 {
     if (0 == MetaCache || 0 == ItemIndex)
         return;
+    FSP_META_CACHE_SHARD *Shard = FspMetaCacheShard(MetaCache, ItemIndex);
     FSP_META_CACHE_ITEM *Item;
     KIRQL Irql;
-    KeAcquireSpinLock(&MetaCache->SpinLock, &Irql);
-    Item = FspMetaCacheRemoveIndexedItemAtDpcLevel(MetaCache, ItemIndex);
-    KeReleaseSpinLock(&MetaCache->SpinLock, Irql);
+    KeAcquireSpinLock(&Shard->SpinLock, &Irql);
+    Item = FspMetaCacheRemoveIndexedItemAtDpcLevel(MetaCache, Shard, ItemIndex);
+    KeReleaseSpinLock(&Shard->SpinLock, Irql);
     if (0 != Item)
-        FspMetaCacheDereferenceItem(Item);
+    {
+        Item->RetireNext = 0;
+        FspMetaCacheDereferenceRetiredItems(FspMetaCacheRetire(MetaCache, Item, 0, FALSE));
+    }
 }
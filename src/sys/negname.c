@@ -0,0 +1,202 @@
+/**
+ * @file sys/negname.c
+ *
+ * @copyright 2015-2026 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this software
+ * in accordance with the commercial license agreement provided in
+ * conjunction with the software.  The terms and conditions of any such
+ * commercial license agreement shall govern, supersede, and render
+ * ineffective any application of the GPLv3 license to this software,
+ * notwithstanding of any reference thereto in the software or
+ * associated repository.
+ */
+
+#include <sys/driver.h>
+#include <shared/ku/negname.h>
+
+/*
+ * The negative name cache of a volume wraps a negative name table (see
+ * shared/ku/negname.h) with a fast mutex. Entries are allocated from paged pool
+ * and freed after the mutex is released. All functions accept a 0 cache (the
+ * cache is disabled) and do nothing.
+ */
+
+NTSTATUS FspNegNameCacheCreate(
+    ULONG EntryCountMax, BOOLEAN CaseInsensitive, PLARGE_INTEGER Timeout,
+    FSP_NEGNAME_CACHE **PCache);
+VOID FspNegNameCacheDelete(FSP_NEGNAME_CACHE *Cache);
+BOOLEAN FspNegNameCacheLookup(FSP_NEGNAME_CACHE *Cache, PUNICODE_STRING FileName);
+ULONG FspNegNameCacheGeneration(FSP_NEGNAME_CACHE *Cache);
+VOID FspNegNameCacheInsert(FSP_NEGNAME_CACHE *Cache, PUNICODE_STRING FileName,
+    ULONG Generation);
+VOID FspNegNameCacheInvalidate(FSP_NEGNAME_CACHE *Cache, PUNICODE_STRING FileName,
+    BOOLEAN Prefix);
+VOID FspNegNameCacheInvalidateExpired(FSP_NEGNAME_CACHE *Cache, UINT64 ExpirationTime);
+static WCHAR FspNegNameCacheUpcase(WCHAR C);
+static VOID FspNegNameCacheFreeEntries(FSP_NEGNAME_ENTRY *Entries);
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, FspNegNameCacheCreate)
+#pragma alloc_text(PAGE, FspNegNameCacheDelete)
+#pragma alloc_text(PAGE, FspNegNameCacheLookup)
+#pragma alloc_text(PAGE, FspNegNameCacheInsert)
+#pragma alloc_text(PAGE, FspNegNameCacheInvalidate)
+#pragma alloc_text(PAGE, FspNegNameCacheInvalidateExpired)
+#pragma alloc_text(PAGE, FspNegNameCacheUpcase)
+#pragma alloc_text(PAGE, FspNegNameCacheFreeEntries)
+#endif
+
+enum
+{
+    FspNegNameCacheBucketCount = 256,
+};
+
+struct _FSP_NEGNAME_CACHE
+{
+    FAST_MUTEX Mutex;
+    UINT64 Timeout;
+    FSP_NEGNAME_TABLE Table;
+    FSP_NEGNAME_ENTRY *Buckets[FspNegNameCacheBucketCount];
+};
+
+static WCHAR FspNegNameCacheUpcase(WCHAR C)
+{
+    PAGED_CODE();
+
+    return RtlUpcaseUnicodeChar(C);
+}
+
+static VOID FspNegNameCacheFreeEntries(FSP_NEGNAME_ENTRY *Entries)
+{
+    PAGED_CODE();
+
+    FSP_NEGNAME_ENTRY *Entry;
+    while (0 != Entries)
+    {
+        Entry = Entries;
+        Entries = Entries->HashNext;
+        FspFree(Entry);
+    }
+}
+
+NTSTATUS FspNegNameCacheCreate(
+    ULONG EntryCountMax, BOOLEAN CaseInsensitive, PLARGE_INTEGER Timeout,
+    FSP_NEGNAME_CACHE **PCache)
+{
+    PAGED_CODE();
+
+    *PCache = 0;
+    if (0 == EntryCountMax || 0 == Timeout->QuadPart)
+        return STATUS_SUCCESS;
+    FSP_NEGNAME_CACHE *Cache;
+    Cache = FspAllocNonPaged(sizeof *Cache);
+    if (0 == Cache)
+        return STATUS_INSUFFICIENT_RESOURCES;
+    RtlZeroMemory(Cache, sizeof *Cache);
+    ExInitializeFastMutex(&Cache->Mutex);
+    Cache->Timeout = Timeout->QuadPart;
+    FspNegNameInitialize(&Cache->Table,
+        Cache->Buckets, FspNegNameCacheBucketCount, EntryCountMax,
+        CaseInsensitive ? FspNegNameCacheUpcase : 0);
+    *PCache = Cache;
+    return STATUS_SUCCESS;
+}
+
+VOID FspNegNameCacheDelete(FSP_NEGNAME_CACHE *Cache)
+{
+    PAGED_CODE();
+
+    if (0 == Cache)
+        return;
+    DEBUGLOG("hits=%llu misses=%llu inserts=%llu stale=%llu evictions=%llu invalidations=%llu",
+        Cache->Table.HitCount, Cache->Table.MissCount, Cache->Table.InsertCount,
+        Cache->Table.StaleCount, Cache->Table.EvictionCount, Cache->Table.InvalidationCount);
+    FspNegNameCacheFreeEntries(FspNegNameInvalidateAll(&Cache->Table));
+    FspFree(Cache);
+}
+
+BOOLEAN FspNegNameCacheLookup(FSP_NEGNAME_CACHE *Cache, PUNICODE_STRING FileName)
+{
+    PAGED_CODE();
+
+    if (0 == Cache)
+        return FALSE;
+    FSP_NEGNAME_ENTRY *Removed = 0;
+    BOOLEAN Result;
+    ExAcquireFastMutex(&Cache->Mutex);
+    Result = FspNegNameLookup(&Cache->Table,
+        FileName->Buffer, FileName->Length / sizeof(WCHAR), KeQueryInterruptTime(), &Removed);
+    ExReleaseFastMutex(&Cache->Mutex);
+    FspNegNameCacheFreeEntries(Removed);
+    return Result;
+}
+
+ULONG FspNegNameCacheGeneration(FSP_NEGNAME_CACHE *Cache)
+{
+    /* a stale generation only causes a later insert to be rejected */
+    if (0 == Cache)
+        return 0;
+    return *(volatile UINT32 *)&Cache->Table.Generation;
+}
+
+VOID FspNegNameCacheInsert(FSP_NEGNAME_CACHE *Cache, PUNICODE_STRING FileName,
+    ULONG Generation)
+{
+    PAGED_CODE();
+
+    if (0 == Cache)
+        return;
+    ULONG Length = FileName->Length / sizeof(WCHAR);
+    if (FSP_NEGNAME_LENGTH_MAX < Length)
+        return;
+    FSP_NEGNAME_ENTRY *Entry, *Removed = 0;
+    Entry = FspAlloc(FspNegNameEntrySize(Length));
+    if (0 == Entry)
+        return;
+    ExAcquireFastMutex(&Cache->Mutex);
+    if (!FspNegNameInsert(&Cache->Table, Generation, Entry, FileName->Buffer, Length,
+        FspExpirationTimeFromTimeout(Cache->Timeout), &Removed))
+    {
+        Entry->HashNext = Removed;
+        Removed = Entry;
+    }
+    ExReleaseFastMutex(&Cache->Mutex);
+    FspNegNameCacheFreeEntries(Removed);
+}
+
+VOID FspNegNameCacheInvalidate(FSP_NEGNAME_CACHE *Cache, PUNICODE_STRING FileName,
+    BOOLEAN Prefix)
+{
+    PAGED_CODE();
+
+    if (0 == Cache)
+        return;
+    FSP_NEGNAME_ENTRY *Removed;
+    ExAcquireFastMutex(&Cache->Mutex);
+    Removed = Prefix ?
+        FspNegNameInvalidatePrefix(&Cache->Table, FileName->Buffer, FileName->Length / sizeof(WCHAR)) :
+        FspNegNameInvalidateName(&Cache->Table, FileName->Buffer, FileName->Length / sizeof(WCHAR));
+    ExReleaseFastMutex(&Cache->Mutex);
+    FspNegNameCacheFreeEntries(Removed);
+}
+
+VOID FspNegNameCacheInvalidateExpired(FSP_NEGNAME_CACHE *Cache, UINT64 ExpirationTime)
+{
+    PAGED_CODE();
+
+    if (0 == Cache)
+        return;
+    FSP_NEGNAME_ENTRY *Removed;
+    ExAcquireFastMutex(&Cache->Mutex);
+    Removed = FspNegNameInvalidateExpired(&Cache->Table, ExpirationTime);
+    ExReleaseFastMutex(&Cache->Mutex);
+    FspNegNameCacheFreeEntries(Removed);
+}
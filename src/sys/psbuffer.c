@@ -20,6 +20,21 @@
  */
 
 #include <sys/driver.h>
+#include <shared/ku/psslab.h>
+
+/*
+ * Every process that acquires buffers gets an item with a slab: a single address
+ * space reservation of FspProcessBufferCountMax slots of FspProcessBufferSizeMax
+ * bytes each (see shared/ku/psslab.h). Slots are committed on first use and taken
+ * and returned lock-free.
+ *
+ * Items are kept in a hash table with a spin lock per bucket; the lock protects
+ * the bucket's chain and the lifetime of its items, never the slabs themselves.
+ * An item is only collected when its process goes away. FspProcessBufferAcquire
+ * runs in the process and can use its item after dropping the bucket lock;
+ * FspProcessBufferRelease may run attached to a process that is exiting, so it
+ * returns the slot while holding the bucket lock.
+ */
 
 #define SafeGetCurrentProcessId()       (PsGetProcessId(PsGetCurrentProcess()))
 
@@ -29,27 +44,30 @@
 typedef struct _FSP_PROCESS_BUFFER_ITEM
 {
     struct _FSP_PROCESS_BUFFER_ITEM *DictNext;
-    struct _FSP_PROCESS_BUFFER_LIST_ENTRY *BufferList;
-    ULONG BufferCount;
     HANDLE ProcessId;
+    FSP_PSSLAB Slab;
 } FSP_PROCESS_BUFFER_ITEM;
 
-typedef struct _FSP_PROCESS_BUFFER_LIST_ENTRY
+typedef struct
 {
-    struct _FSP_PROCESS_BUFFER_LIST_ENTRY *Next;
-    PVOID Buffer;
-} FSP_PROCESS_BUFFER_LIST_ENTRY;
+    KSPIN_LOCK Lock;
+    FSP_PROCESS_BUFFER_ITEM *Items;
+} FSP_PROCESS_BUFFER_BUCKET;
 
-static KSPIN_LOCK ProcessBufferLock;
-static FSP_PROCESS_BUFFER_ITEM *ProcessBufferBuckets[ProcessBufferBucketCount];
+static FSP_PROCESS_BUFFER_BUCKET ProcessBufferBuckets[ProcessBufferBucketCount];
 
 static VOID FspProcessBufferNotifyRoutine(HANDLE ParentId, HANDLE ProcessId, BOOLEAN Create);
 
-static inline FSP_PROCESS_BUFFER_ITEM *FspProcessBufferLookupItemAtDpcLevel(HANDLE ProcessId)
+static inline FSP_PROCESS_BUFFER_BUCKET *FspProcessBufferBucket(HANDLE ProcessId)
+{
+    return &ProcessBufferBuckets[FspHashMixPointer(ProcessId) % ProcessBufferBucketCount];
+}
+
+static inline FSP_PROCESS_BUFFER_ITEM *FspProcessBufferLookupItemAtDpcLevel(
+    FSP_PROCESS_BUFFER_BUCKET *Bucket, HANDLE ProcessId)
 {
     FSP_PROCESS_BUFFER_ITEM *Item = 0;
-    ULONG HashIndex = FspHashMixPointer(ProcessId) % ProcessBufferBucketCount;
-    for (FSP_PROCESS_BUFFER_ITEM *ItemX = ProcessBufferBuckets[HashIndex]; ItemX; ItemX = ItemX->DictNext)
+    for (FSP_PROCESS_BUFFER_ITEM *ItemX = Bucket->Items; ItemX; ItemX = ItemX->DictNext)
         if (ItemX->ProcessId == ProcessId)
         {
             Item = ItemX;
@@ -58,22 +76,22 @@ static inline FSP_PROCESS_BUFFER_ITEM *FspProcessBufferLookupItemAtDpcLevel(HAND
     return Item;
 }
 
-static inline VOID FspProcessBufferAddItemAtDpcLevel(FSP_PROCESS_BUFFER_ITEM *Item)
+static inline VOID FspProcessBufferAddItemAtDpcLevel(
+    FSP_PROCESS_BUFFER_BUCKET *Bucket, FSP_PROCESS_BUFFER_ITEM *Item)
 {
-    ULONG HashIndex = FspHashMixPointer(Item->ProcessId) % ProcessBufferBucketCount;
 #if DBG
-    for (FSP_PROCESS_BUFFER_ITEM *ItemX = ProcessBufferBuckets[HashIndex]; ItemX; ItemX = ItemX->DictNext)
+    for (FSP_PROCESS_BUFFER_ITEM *ItemX = Bucket->Items; ItemX; ItemX = ItemX->DictNext)
         ASSERT(ItemX->ProcessId != Item->ProcessId);
 #endif
-    Item->DictNext = ProcessBufferBuckets[HashIndex];
-    ProcessBufferBuckets[HashIndex] = Item;
+    Item->DictNext = Bucket->Items;
+    Bucket->Items = Item;
 }
 
-static inline FSP_PROCESS_BUFFER_ITEM *FspProcessBufferRemoveItemAtDpcLevel(HANDLE ProcessId)
+static inline FSP_PROCESS_BUFFER_ITEM *FspProcessBufferRemoveItemAtDpcLevel(
+    FSP_PROCESS_BUFFER_BUCKET *Bucket, HANDLE ProcessId)
 {
     FSP_PROCESS_BUFFER_ITEM *Item = 0;
-    ULONG HashIndex = FspHashMixPointer(ProcessId) % ProcessBufferBucketCount;
-    for (FSP_PROCESS_BUFFER_ITEM **P = &ProcessBufferBuckets[HashIndex]; *P; P = &(*P)->DictNext)
+    for (FSP_PROCESS_BUFFER_ITEM **P = &Bucket->Items; *P; P = &(*P)->DictNext)
         if ((*P)->ProcessId == ProcessId)
         {
             Item = *P;
@@ -83,39 +101,56 @@ static inline FSP_PROCESS_BUFFER_ITEM *FspProcessBufferRemoveItemAtDpcLevel(HAND
     return Item;
 }
 
-static inline VOID FspProcessBufferReuseEntry(HANDLE ProcessId,
-    FSP_PROCESS_BUFFER_LIST_ENTRY *BufferEntry)
+static NTSTATUS FspProcessBufferCreateItem(HANDLE ProcessId, FSP_PROCESS_BUFFER_ITEM **PItem)
 {
-    KIRQL Irql;
     FSP_PROCESS_BUFFER_ITEM *Item;
+    PVOID Base = 0;
+    SIZE_T Size = (SIZE_T)FspProcessBufferCountMax * FspProcessBufferSizeMax;
+    NTSTATUS Result;
 
-    KeAcquireSpinLock(&ProcessBufferLock, &Irql);
+    *PItem = 0;
 
-    Item = FspProcessBufferLookupItemAtDpcLevel(ProcessId);
+    Item = FspAllocNonPaged(sizeof *Item);
+    if (0 == Item)
+        return STATUS_INSUFFICIENT_RESOURCES;
+    RtlZeroMemory(Item, sizeof *Item);
 
-    if (0 != Item)
+    Result = ZwAllocateVirtualMemory(ZwCurrentProcess(),
+        &Base, 0, &Size, MEM_RESERVE, PAGE_READWRITE);
+    if (!NT_SUCCESS(Result))
     {
-        BufferEntry->Next = Item->BufferList;
-        Item->BufferList = BufferEntry;
+        FspFree(Item);
+        return Result;
     }
 
-    KeReleaseSpinLock(&ProcessBufferLock, Irql);
+    Item->ProcessId = ProcessId;
+    FspPsSlabInitialize(&Item->Slab, Base, FspProcessBufferSizeMax, FspProcessBufferCountMax);
 
-    if (0 == Item)
-    {
-        if (0 != BufferEntry->Buffer)
-        {
-            SIZE_T BufferSize = 0;
-            ZwFreeVirtualMemory(ZwCurrentProcess(), &BufferEntry->Buffer, &BufferSize, MEM_RELEASE);
-        }
+    *PItem = Item;
+
+    return STATUS_SUCCESS;
+}
 
-        FspFree(BufferEntry);
+static VOID FspProcessBufferDeleteItem(FSP_PROCESS_BUFFER_ITEM *Item, BOOLEAN ReleaseSlab)
+{
+    /* ReleaseSlab only in the context of the item's process while it is alive */
+    if (ReleaseSlab)
+    {
+        PVOID Base = Item->Slab.Base;
+        SIZE_T Size = 0;
+        ZwFreeVirtualMemory(ZwCurrentProcess(), &Base, &Size, MEM_RELEASE);
     }
+
+    FspFree(Item);
 }
 
 NTSTATUS FspProcessBufferInitialize(VOID)
 {
-    KeInitializeSpinLock(&ProcessBufferLock);
+    for (ULONG HashIndex = 0; ProcessBufferBucketCount > HashIndex; HashIndex++)
+    {
+        KeInitializeSpinLock(&ProcessBufferBuckets[HashIndex].Lock);
+        ProcessBufferBuckets[HashIndex].Items = 0;
+    }
 
     return PsSetCreateProcessNotifyRoutine(FspProcessBufferNotifyRoutine, FALSE);
 }
@@ -130,19 +165,14 @@ VOID FspProcessBufferFinalize(VOID)
      */
     for (ULONG HashIndex = 0; ProcessBufferBucketCount > HashIndex; HashIndex++)
     {
-        for (FSP_PROCESS_BUFFER_ITEM *Item = ProcessBufferBuckets[HashIndex], *DictNext; Item; Item = DictNext)
+        for (FSP_PROCESS_BUFFER_ITEM *Item = ProcessBufferBuckets[HashIndex].Items, *DictNext;
+            Item; Item = DictNext)
         {
-            for (FSP_PROCESS_BUFFER_LIST_ENTRY *P = Item->BufferList, *Next; P; P = Next)
-            {
-                Next = P->Next;
-                FspFree(P);
-            }
-
             DictNext = Item->DictNext;
-            FspFree(Item);
+            FspProcessBufferDeleteItem(Item, FALSE);
         }
 
-        ProcessBufferBuckets[HashIndex] = 0;
+        ProcessBufferBuckets[HashIndex].Items = 0;
     }
 }
 
@@ -154,26 +184,22 @@ static VOID FspProcessBufferNotifyRoutine(HANDLE ParentId, HANDLE ProcessId, BOO
 
 VOID FspProcessBufferCollect(HANDLE ProcessId)
 {
+    FSP_PROCESS_BUFFER_BUCKET *Bucket = FspProcessBufferBucket(ProcessId);
     KIRQL Irql;
     FSP_PROCESS_BUFFER_ITEM *Item = 0;
 
-    KeAcquireSpinLock(&ProcessBufferLock, &Irql);
+    KeAcquireSpinLock(&Bucket->Lock, &Irql);
 
-    Item = FspProcessBufferRemoveItemAtDpcLevel(ProcessId);
+    Item = FspProcessBufferRemoveItemAtDpcLevel(Bucket, ProcessId);
 
-    KeReleaseSpinLock(&ProcessBufferLock, Irql);
+    KeReleaseSpinLock(&Bucket->Lock, Irql);
 
     if (0 != Item)
     {
         DEBUGLOG("pid=%ld", (ULONG)(UINT_PTR)ProcessId);
 
-        for (FSP_PROCESS_BUFFER_LIST_ENTRY *P = Item->BufferList, *Next; P; P = Next)
-        {
-            Next = P->Next;
-            FspFree(P);
-        }
-
-        FspFree(Item);
+        /* the slab goes away with the process address space */
+        FspProcessBufferDeleteItem(Item, FALSE);
     }
 }
 
@@ -182,94 +208,68 @@ NTSTATUS FspProcessBufferAcquire(SIZE_T BufferSize, PVOID *PBufferCookie, PVOID
     if (FspProcessBufferSizeMax >= BufferSize)
     {
         HANDLE ProcessId = SafeGetCurrentProcessId();
+        FSP_PROCESS_BUFFER_BUCKET *Bucket = FspProcessBufferBucket(ProcessId);
         KIRQL Irql;
         FSP_PROCESS_BUFFER_ITEM *Item, *NewItem;
-        FSP_PROCESS_BUFFER_LIST_ENTRY *BufferEntry = 0;
-        BOOLEAN AllocNoReuse;
+        PVOID Buffer;
+        ULONG Slot;
         NTSTATUS Result;
 
-        KeAcquireSpinLock(&ProcessBufferLock, &Irql);
-
-        Item = FspProcessBufferLookupItemAtDpcLevel(ProcessId);
-
-        if (0 != Item)
-        {
-            BufferEntry = Item->BufferList;
-            if (0 != BufferEntry)
-                Item->BufferList = BufferEntry->Next;
-        }
+        *PBufferCookie = 0;
+        *PBuffer = 0;
 
-        AllocNoReuse = 0 == BufferEntry &&
-            (0 != Item && FspProcessBufferCountMax <= Item->BufferCount);
+        KeAcquireSpinLock(&Bucket->Lock, &Irql);
 
-        KeReleaseSpinLock(&ProcessBufferLock, Irql);
+        Item = FspProcessBufferLookupItemAtDpcLevel(Bucket, ProcessId);
 
-        if (AllocNoReuse)
-            goto alloc_no_reuse;
+        KeReleaseSpinLock(&Bucket->Lock, Irql);
 
-        if (0 == BufferEntry)
+        if (0 == Item)
         {
-            *PBufferCookie = 0;
-            *PBuffer = 0;
-
-            BufferEntry = FspAllocNonPaged(sizeof *BufferEntry);
-            if (0 == BufferEntry)
-                return STATUS_INSUFFICIENT_RESOURCES;
-            RtlZeroMemory(BufferEntry, sizeof *BufferEntry);
-
-            NewItem = FspAllocNonPaged(sizeof *NewItem);
-            if (0 == NewItem)
-            {
-                FspFree(BufferEntry);
-                return STATUS_INSUFFICIENT_RESOURCES;
-            }
-            RtlZeroMemory(NewItem, sizeof *NewItem);
+            Result = FspProcessBufferCreateItem(ProcessId, &NewItem);
+            if (!NT_SUCCESS(Result))
+                return Result;
 
-            KeAcquireSpinLock(&ProcessBufferLock, &Irql);
+            KeAcquireSpinLock(&Bucket->Lock, &Irql);
 
-            Item = FspProcessBufferLookupItemAtDpcLevel(ProcessId);
+            Item = FspProcessBufferLookupItemAtDpcLevel(Bucket, ProcessId);
 
             if (0 == Item)
             {
                 Item = NewItem;
                 NewItem = 0;
-                Item->BufferCount = 1;
-                Item->ProcessId = ProcessId;
-                FspProcessBufferAddItemAtDpcLevel(Item);
+                FspProcessBufferAddItemAtDpcLevel(Bucket, Item);
             }
-            else if (FspProcessBufferCountMax > Item->BufferCount)
-                Item->BufferCount++;
-            else
-                AllocNoReuse = TRUE;
 
-            KeReleaseSpinLock(&ProcessBufferLock, Irql);
+            KeReleaseSpinLock(&Bucket->Lock, Irql);
 
             if (0 != NewItem)
-                FspFree(NewItem);
-
-            if (AllocNoReuse)
-            {
-                FspFree(BufferEntry);
-                goto alloc_no_reuse;
-            }
+                FspProcessBufferDeleteItem(NewItem, TRUE);
         }
 
-        if (0 == BufferEntry->Buffer)
+        Slot = FspPsSlabPop(&Item->Slab);
+        if (FSP_PSSLAB_NO_SLOT == Slot)
+            goto alloc_no_reuse;
+
+        Buffer = FspPsSlabSlotAddress(&Item->Slab, Slot);
+        if (!FspPsSlabIsCommitted(&Item->Slab, Slot))
         {
             BufferSize = FspProcessBufferSizeMax;
             Result = ZwAllocateVirtualMemory(ZwCurrentProcess(),
-                &BufferEntry->Buffer, 0, &BufferSize, MEM_COMMIT, PAGE_READWRITE);
+                &Buffer, 0, &BufferSize, MEM_COMMIT, PAGE_READWRITE);
             if (!NT_SUCCESS(Result))
             {
-                /* failed to allocate actual buffer; reuse BufferEntry */
-                FspProcessBufferReuseEntry(ProcessId, BufferEntry);
+                /* failed to commit the slot; return it */
+                FspPsSlabPush(&Item->Slab, Slot);
 
                 return Result;
             }
+
+            FspPsSlabSetCommitted(&Item->Slab, Slot);
         }
 
-        *PBufferCookie = BufferEntry;
-        *PBuffer = BufferEntry->Buffer;
+        *PBufferCookie = Item;
+        *PBuffer = Buffer;
 
         return STATUS_SUCCESS;
     }
@@ -288,11 +288,29 @@ VOID FspProcessBufferRelease(PVOID BufferCookie, PVOID Buffer)
     if (0 != BufferCookie)
     {
         HANDLE ProcessId = SafeGetCurrentProcessId();
-        FSP_PROCESS_BUFFER_LIST_ENTRY *BufferEntry = BufferCookie;
+        FSP_PROCESS_BUFFER_BUCKET *Bucket = FspProcessBufferBucket(ProcessId);
+        KIRQL Irql;
+        FSP_PROCESS_BUFFER_ITEM *Item;
+        ULONG Slot;
+
+        KeAcquireSpinLock(&Bucket->Lock, &Irql);
 
-        ASSERT(Buffer == BufferEntry->Buffer);
+        /*
+         * If the process has already been collected, the slab went away with it and
+         * there is nothing to return. (The caller holds a reference to the process,
+         * so its id, and therefore its item, cannot have been reused.)
+         */
+        Item = FspProcessBufferLookupItemAtDpcLevel(Bucket, ProcessId);
+        if (0 != Item)
+        {
+            ASSERT(BufferCookie == Item);
+            Slot = FspPsSlabSlotOfAddress(&Item->Slab, Buffer);
+            ASSERT(FSP_PSSLAB_NO_SLOT != Slot);
+            if (FSP_PSSLAB_NO_SLOT != Slot)
+                FspPsSlabPush(&Item->Slab, Slot);
+        }
 
-        FspProcessBufferReuseEntry(ProcessId, BufferEntry);
+        KeReleaseSpinLock(&Bucket->Lock, Irql);
     }
     else
     {
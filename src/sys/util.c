@@ -20,6 +20,7 @@
  */
 
 #include <sys/driver.h>
+#include <shared/ku/wcsname.h>
 
 BOOLEAN FspIsNtDdiVersionAvailable(ULONG Version);
 NTSTATUS FspCreateGuid(GUID *Guid);
@@ -1538,29 +1539,25 @@ LONG FspCompareUnicodeString(
     LONG LResult = S1->Length - S2->Length;
     PWCH P1 = S1->Buffer;
     PWCH P2 = S2->Buffer;
-    PWCH EndP1 = P1 + (0 >= LResult ? S1->Length : S2->Length) / sizeof(WCHAR);
+    SIZE_T Length = (0 >= LResult ? S1->Length : S2->Length) / sizeof(WCHAR);
+    SIZE_T Index;
 
     if (CaseInsensitive)
     {
-        for (; EndP1 != P1; ++P1, ++P2)
+        Index = FspWcsnAsciiIcmpSpan(P1, P2, Length);
+        if (Length != Index)
         {
-            USHORT C1 = *P1, C2 = *P2;
+            USHORT C1 = P1[Index], C2 = P2[Index];
             if (0xff80 & (C1 | C2))
                 return RtlCompareUnicodeString(S1, S2, TRUE);
-            C1 = FspUpcaseAscii(C1);
-            C2 = FspUpcaseAscii(C2);
-            if (C1 != C2)
-                return C1 - C2;
+            return FspUpcaseAscii(C1) - FspUpcaseAscii(C2);
         }
     }
     else
     {
-        for (; EndP1 != P1; ++P1, ++P2)
-        {
-            USHORT C1 = *P1, C2 = *P2;
-            if (C1 != C2)
-                return C1 - C2;
-        }
+        Index = FspWcsnCmpSpan(P1, P2, Length);
+        if (Length != Index)
+            return P1[Index] - P2[Index];
     }
 
     return LResult;
@@ -66,6 +66,10 @@ NTSTATUS FspVolumeNotify(
 static NTSTATUS FspVolumeNotifyLock(
     PDEVICE_OBJECT FsvolDeviceObject);
 static WORKER_THREAD_ROUTINE FspVolumeNotifyWork;
+NTSTATUS FspVolumeQueryIoq(
+    PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp);
+NTSTATUS FspVolumeQueryRequestPool(
+    PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp);
 NTSTATUS FspVolumeWork(
     PDEVICE_OBJECT FsvolDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp);
 
@@ -89,6 +93,8 @@ NTSTATUS FspVolumeWork(
 #pragma alloc_text(PAGE, FspVolumeNotify)
 #pragma alloc_text(PAGE, FspVolumeNotifyLock)
 #pragma alloc_text(PAGE, FspVolumeNotifyWork)
+#pragma alloc_text(PAGE, FspVolumeQueryIoq)
+#pragma alloc_text(PAGE, FspVolumeQueryRequestPool)
 #pragma alloc_text(PAGE, FspVolumeWork)
 #endif
 
@@ -264,6 +270,30 @@ static NTSTATUS FspVolumeCreateNoLock(
     VolumeParams.SecurityTimeoutValid = 1;
     VolumeParams.StreamInfoTimeoutValid = 1;
     VolumeParams.EaTimeoutValid = 1;
+    if (sizeof(FSP_FSCTL_VOLUME_PARAMS_V0) >= VolumeParams.Version)
+    {
+        VolumeParams.SecurityCacheSize = 0;
+        VolumeParams.DirInfoCacheSize = 0;
+        VolumeParams.StreamInfoCacheSize = 0;
+        VolumeParams.EaCacheSize = 0;
+        VolumeParams.NegativeNameTimeout = 0;
+    }
+    if (0 == VolumeParams.SecurityCacheSize)
+        VolumeParams.SecurityCacheSize = FspFsvolDeviceSecurityCacheSizeDefault;
+    else if (VolumeParams.SecurityCacheSize > FspFsctlMetaCacheSizeMaximum)
+        VolumeParams.SecurityCacheSize = FspFsctlMetaCacheSizeMaximum;
+    if (0 == VolumeParams.DirInfoCacheSize)
+        VolumeParams.DirInfoCacheSize = FspFsvolDeviceDirInfoCacheSizeDefault;
+    else if (VolumeParams.DirInfoCacheSize > FspFsctlMetaCacheSizeMaximum)
+        VolumeParams.DirInfoCacheSize = FspFsctlMetaCacheSizeMaximum;
+    if (0 == VolumeParams.StreamInfoCacheSize)
+        VolumeParams.StreamInfoCacheSize = FspFsvolDeviceStreamInfoCacheSizeDefault;
+    else if (VolumeParams.StreamInfoCacheSize > FspFsctlMetaCacheSizeMaximum)
+        VolumeParams.StreamInfoCacheSize = FspFsctlMetaCacheSizeMaximum;
+    if (0 == VolumeParams.EaCacheSize)
+        VolumeParams.EaCacheSize = FspFsvolDeviceEaCacheSizeDefault;
+    else if (VolumeParams.EaCacheSize > FspFsctlMetaCacheSizeMaximum)
+        VolumeParams.EaCacheSize = FspFsctlMetaCacheSizeMaximum;
     if (FILE_DEVICE_NETWORK_FILE_SYSTEM == FsctlDeviceObject->DeviceType)
     {
         VolumeParams.Prefix[sizeof VolumeParams.Prefix / sizeof(WCHAR) - 1] = L'\0';
@@ -1350,6 +1380,54 @@ NTSTATUS FspVolumeStop(
     return STATUS_SUCCESS;
 }
 
+NTSTATUS FspVolumeQueryIoq(
+    PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp)
+{
+    PAGED_CODE();
+
+    ASSERT(IRP_MJ_FILE_SYSTEM_CONTROL == IrpSp->MajorFunction);
+    ASSERT(IRP_MN_USER_FS_REQUEST == IrpSp->MinorFunction);
+    ASSERT(FSP_FSCTL_QUERY_IOQ == IrpSp->Parameters.FileSystemControl.FsControlCode);
+    ASSERT(0 != IrpSp->FileObject->FsContext2);
+
+    /* check parameters */
+    ULONG OutputBufferLength = IrpSp->Parameters.FileSystemControl.OutputBufferLength;
+    PVOID SystemBuffer = Irp->AssociatedIrp.SystemBuffer;
+    if (sizeof(FSP_FSCTL_IOQ_INFO) > OutputBufferLength)
+        return STATUS_BUFFER_TOO_SMALL;
+
+    PDEVICE_OBJECT FsvolDeviceObject = IrpSp->FileObject->FsContext2;
+    FSP_FSVOL_DEVICE_EXTENSION *FsvolDeviceExtension = FspFsvolDeviceExtension(FsvolDeviceObject);
+
+    FspIoqPendingQuery(FsvolDeviceExtension->Ioq, SystemBuffer);
+
+    Irp->IoStatus.Information = sizeof(FSP_FSCTL_IOQ_INFO);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS FspVolumeQueryRequestPool(
+    PDEVICE_OBJECT FsctlDeviceObject, PIRP Irp, PIO_STACK_LOCATION IrpSp)
+{
+    PAGED_CODE();
+
+    ASSERT(IRP_MJ_FILE_SYSTEM_CONTROL == IrpSp->MajorFunction);
+    ASSERT(IRP_MN_USER_FS_REQUEST == IrpSp->MinorFunction);
+    ASSERT(FSP_FSCTL_QUERY_REQUEST_POOL == IrpSp->Parameters.FileSystemControl.FsControlCode);
+    ASSERT(0 != IrpSp->FileObject->FsContext2);
+
+    /* check parameters */
+    ULONG OutputBufferLength = IrpSp->Parameters.FileSystemControl.OutputBufferLength;
+    PVOID SystemBuffer = Irp->AssociatedIrp.SystemBuffer;
+    if (sizeof(FSP_FSCTL_REQUEST_POOL_INFO) > OutputBufferLength)
+        return STATUS_BUFFER_TOO_SMALL;
+
+    /* the request pool is shared by all volumes */
+    FspIopRequestPoolQuery(SystemBuffer);
+
+    Irp->IoStatus.Information = sizeof(FSP_FSCTL_REQUEST_POOL_INFO);
+    return STATUS_SUCCESS;
+}
+
 typedef struct
 {
     WORK_QUEUE_ITEM WorkItem;
@@ -0,0 +1,530 @@
+/**
+ * @file dirpatch.c
+ *
+ * DirInfo patch tests.
+ *
+ * @copyright 2015-2026 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this software
+ * in accordance with the commercial license agreement provided in
+ * conjunction with the software.  The terms and conditions of any such
+ * commercial license agreement shall govern, supersede, and render
+ * ineffective any application of the GPLv3 license to this software,
+ * notwithstanding of any reference thereto in the software or
+ * associated repository.
+ */
+
+/*
+ * Unit tests for shared/ku/dirpatch.h followed by randomized tests: a directory
+ * is modeled as a set of names, a (complete or incomplete) listing of it is built
+ * the way a user mode file system builds one and then kept up to date by patches
+ * while random creates, deletes and renames are applied to the directory. After
+ * every change the patched listing must match a full re-enumeration. Builds on
+ * any platform with a C99 compiler (see the Makefile).
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef void VOID;
+typedef unsigned char BOOLEAN;
+typedef uint8_t UINT8;
+typedef uint16_t UINT16;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+typedef uint16_t WCHAR;
+
+/* layout compatible with inc/winfsp/fsctl.h */
+#define FSP_FSCTL_ALIGN_UP(x, s)        (((x) + ((s) - 1L)) & ~((s) - 1L))
+#define FSP_FSCTL_DEFAULT_ALIGNMENT     8
+#define FSP_FSCTL_DEFAULT_ALIGN_UP(x)   FSP_FSCTL_ALIGN_UP(x, FSP_FSCTL_DEFAULT_ALIGNMENT)
+typedef struct
+{
+    UINT32 FileAttributes;
+    UINT32 ReparseTag;
+    UINT64 AllocationSize;
+    UINT64 FileSize;
+    UINT64 CreationTime;
+    UINT64 LastAccessTime;
+    UINT64 LastWriteTime;
+    UINT64 ChangeTime;
+    UINT64 IndexNumber;
+    UINT32 HardLinks;
+    UINT32 EaSize;
+} FSP_FSCTL_FILE_INFO;
+typedef struct
+{
+    UINT16 Size;
+    FSP_FSCTL_FILE_INFO FileInfo;
+    union
+    {
+        UINT64 NextOffset;
+        UINT8 Padding[24];
+    };
+    WCHAR FileNameBuf[];
+} FSP_FSCTL_DIR_INFO;
+_Static_assert(104 == sizeof(FSP_FSCTL_DIR_INFO), "sizeof(FSP_FSCTL_DIR_INFO) must be exactly 104.");
+
+#include <shared/ku/dirpatch.h>
+
+#define ASSERT(e)                       \
+    ((e) ? (void)0 : (fprintf(stderr, "%s:%d: ASSERT(%s) failed\n", __FILE__, __LINE__, #e), abort()))
+
+#define NAME_MAX                        16
+#define ENTRY_MAX                       64
+#define BUFFER_SIZE                     (ENTRY_MAX * 256)
+
+typedef struct
+{
+    WCHAR Name[NAME_MAX];
+    UINT32 Length;
+    FSP_FSCTL_FILE_INFO FileInfo;
+} ENTRY;
+
+typedef struct
+{
+    WCHAR (*Upcase)(WCHAR);
+    ENTRY Entries[ENTRY_MAX];
+    UINT32 Count;
+    UINT64 IndexNumber;
+} DIRECTORY;
+
+static UINT64 Random = 42;
+
+static UINT32 rnd(UINT32 N)
+{
+    Random = Random * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (UINT32)(Random >> 33) % N;
+}
+
+static WCHAR upcase(WCHAR C)
+{
+    return 'a' <= C && C <= 'z' ? C - 'a' + 'A' : C;
+}
+
+static UINT32 wname(WCHAR *Buffer, const char *Name)
+{
+    UINT32 Length = (UINT32)strlen(Name);
+    for (UINT32 I = 0; Length > I; I++)
+        Buffer[I] = Name[I];
+    return Length;
+}
+
+static WCHAR (*SortUpcase)(WCHAR);
+static int entry_compare(const void *P0, const void *P1)
+{
+    const ENTRY *E0 = P0, *E1 = P1;
+    return FspDirInfoPatchCompare(E0->Name, E0->Length, E1->Name, E1->Length, SortUpcase);
+}
+
+static UINT32 add_entry(UINT8 *Buffer, UINT32 Offset,
+    const WCHAR *Name, UINT32 Length, const FSP_FSCTL_FILE_INFO *FileInfo)
+{
+    /* like FspFileSystemAddDirInfo: entries are padded to the default alignment */
+    FSP_FSCTL_DIR_INFO *DirInfo = (FSP_FSCTL_DIR_INFO *)(Buffer + Offset);
+    UINT32 Size = (UINT32)(sizeof(FSP_FSCTL_DIR_INFO) + Length * sizeof(WCHAR));
+    memset(DirInfo, 0, FSP_FSCTL_DEFAULT_ALIGN_UP(Size));
+    DirInfo->Size = (UINT16)Size;
+    DirInfo->FileInfo = *FileInfo;
+    memcpy(DirInfo->FileNameBuf, Name, Length * sizeof(WCHAR));
+    return Offset + (UINT32)FSP_FSCTL_DEFAULT_ALIGN_UP(Size);
+}
+
+static UINT32 enumerate(DIRECTORY *Directory, BOOLEAN Dots,
+    const WCHAR *LastName, UINT32 LastLength, BOOLEAN Complete, UINT8 *Buffer)
+{
+    /* full enumeration: all names (up to LastName if not 0) in sorted order */
+    static const FSP_FSCTL_FILE_INFO DotsFileInfo = { .FileAttributes = 0x10 };
+    static const WCHAR DotDot[2] = { '.', '.' };
+    UINT32 Offset = 0;
+
+    SortUpcase = Directory->Upcase;
+    qsort(Directory->Entries, Directory->Count, sizeof(ENTRY), entry_compare);
+
+    if (Dots)
+    {
+        Offset = add_entry(Buffer, Offset, DotDot, 1, &DotsFileInfo);
+        Offset = add_entry(Buffer, Offset, DotDot, 2, &DotsFileInfo);
+    }
+    for (UINT32 I = 0; Directory->Count > I; I++)
+    {
+        ENTRY *Entry = &Directory->Entries[I];
+        if (0 != LastName && 0 < FspDirInfoPatchCompare(Entry->Name, Entry->Length,
+            LastName, LastLength, Directory->Upcase))
+            break;
+        Offset = add_entry(Buffer, Offset, Entry->Name, Entry->Length, &Entry->FileInfo);
+    }
+    if (Complete)
+    {
+        memset(Buffer + Offset, 0, sizeof(UINT16));
+        Offset += sizeof(UINT16);
+    }
+    return Offset;
+}
+
+static const FSP_FSCTL_DIR_INFO *last_entry(const UINT8 *Buffer, UINT32 Size, BOOLEAN *PComplete)
+{
+    const FSP_FSCTL_DIR_INFO *DirInfo, *Last = 0;
+    UINT32 Offset;
+
+    *PComplete = 0;
+    for (Offset = 0; Size >= Offset + sizeof(UINT16);
+        Offset += (UINT32)FSP_FSCTL_DEFAULT_ALIGN_UP(DirInfo->Size))
+    {
+        DirInfo = (const FSP_FSCTL_DIR_INFO *)(Buffer + Offset);
+        if (0 == DirInfo->Size)
+        {
+            *PComplete = 1;
+            break;
+        }
+        if (!FspDirInfoPatchIsDots(DirInfo->FileNameBuf,
+            (DirInfo->Size - sizeof(FSP_FSCTL_DIR_INFO)) / sizeof(WCHAR)))
+            Last = DirInfo;
+    }
+    return Last;
+}
+
+static int find_entry(DIRECTORY *Directory, const WCHAR *Name, UINT32 Length)
+{
+    for (UINT32 I = 0; Directory->Count > I; I++)
+        if (0 == FspDirInfoPatchCompare(Directory->Entries[I].Name, Directory->Entries[I].Length,
+            Name, Length, Directory->Upcase))
+            return (int)I;
+    return -1;
+}
+
+static UINT32 patch(const UINT8 *Buffer, UINT32 Size,
+    const WCHAR *RemoveName, UINT32 RemoveLength,
+    const WCHAR *InsertName, UINT32 InsertLength, const FSP_FSCTL_FILE_INFO *InsertFileInfo,
+    WCHAR (*Upcase)(WCHAR),
+    UINT8 *NewBuffer)
+{
+    FSP_DIRINFO_PATCH Patch;
+
+    ASSERT(FspDirInfoPatchPrepare(Buffer, Size,
+        RemoveName, RemoveLength, InsertName, InsertLength, Upcase, &Patch));
+    ASSERT(BUFFER_SIZE >= Patch.NewSize);
+    if (FspDirInfoPatchIsEmpty(&Patch))
+    {
+        ASSERT(Size == Patch.NewSize);
+        memcpy(NewBuffer, Buffer, Size);
+    }
+    else
+        FspDirInfoPatchApply(Buffer, Size, InsertName, InsertLength, InsertFileInfo,
+            &Patch, NewBuffer);
+    return Patch.NewSize;
+}
+
+static void patch_insert_remove_test(void)
+{
+    static UINT8 Buffer[BUFFER_SIZE], NewBuffer[BUFFER_SIZE], Expected[BUFFER_SIZE];
+    DIRECTORY Directory;
+    FSP_FSCTL_FILE_INFO FileInfo;
+    WCHAR Name[NAME_MAX];
+    UINT32 Size, NewSize, ExpectedSize, Length;
+    static const char *Names[] = { "b", "d", "f" };
+
+    memset(&Directory, 0, sizeof Directory);
+    for (UINT32 I = 0; 3 > I; I++)
+    {
+        Directory.Entries[I].Length = wname(Directory.Entries[I].Name, Names[I]);
+        Directory.Entries[I].FileInfo.IndexNumber = I + 1;
+    }
+    Directory.Count = 3;
+    Size = enumerate(&Directory, 1, 0, 0, 1, Buffer);
+
+    /* insert at the front (after the dots), in the middle and at the end */
+    memset(&FileInfo, 0, sizeof FileInfo);
+    FileInfo.IndexNumber = 10;
+    Length = wname(Name, "a");
+    NewSize = patch(Buffer, Size, 0, 0, Name, Length, &FileInfo, 0, NewBuffer);
+    Directory.Entries[Directory.Count].Length = wname(Directory.Entries[Directory.Count].Name, "a");
+    Directory.Entries[Directory.Count++].FileInfo = FileInfo;
+    ExpectedSize = enumerate(&Directory, 1, 0, 0, 1, Expected);
+    ASSERT(ExpectedSize == NewSize && 0 == memcmp(Expected, NewBuffer, NewSize));
+
+    memcpy(Buffer, NewBuffer, Size = NewSize);
+    FileInfo.IndexNumber = 11;
+    Length = wname(Name, "e");
+    NewSize = patch(Buffer, Size, 0, 0, Name, Length, &FileInfo, 0, NewBuffer);
+    Directory.Entries[Directory.Count].Length = wname(Directory.Entries[Directory.Count].Name, "e");
+    Directory.Entries[Directory.Count++].FileInfo = FileInfo;
+    ExpectedSize = enumerate(&Directory, 1, 0, 0, 1, Expected);
+    ASSERT(ExpectedSize == NewSize && 0 == memcmp(Expected, NewBuffer, NewSize));
+
+    memcpy(Buffer, NewBuffer, Size = NewSize);
+    FileInfo.IndexNumber = 12;
+    Length = wname(Name, "zzzzzzzzz");
+    NewSize = patch(Buffer, Size, 0, 0, Name, Length, &FileInfo, 0, NewBuffer);
+    Directory.Entries[Directory.Count].Length = wname(Directory.Entries[Directory.Count].Name, "zzzzzzzzz");
+    Directory.Entries[Directory.Count++].FileInfo = FileInfo;
+    ExpectedSize = enumerate(&Directory, 1, 0, 0, 1, Expected);
+    ASSERT(ExpectedSize == NewSize && 0 == memcmp(Expected, NewBuffer, NewSize));
+
+    /* remove a missing name: empty patch */
+    memcpy(Buffer, NewBuffer, Size = NewSize);
+    FSP_DIRINFO_PATCH Patch;
+    Length = wname(Name, "c");
+    ASSERT(FspDirInfoPatchPrepare(Buffer, Size, Name, Length, 0, 0, 0, &Patch));
+    ASSERT(FspDirInfoPatchIsEmpty(&Patch) && Size == Patch.NewSize);
+
+    /* rename d -> c: one remove, one insert at the same place */
+    WCHAR NewName[NAME_MAX];
+    UINT32 NewLength = wname(NewName, "c");
+    Length = wname(Name, "d");
+    int Index = find_entry(&Directory, Name, Length);
+    ASSERT(0 <= Index);
+    FileInfo = Directory.Entries[Index].FileInfo;
+    NewSize = patch(Buffer, Size, Name, Length, NewName, NewLength, &FileInfo, 0, NewBuffer);
+    Directory.Entries[Index].Length = wname(Directory.Entries[Index].Name, "c");
+    ExpectedSize = enumerate(&Directory, 1, 0, 0, 1, Expected);
+    ASSERT(ExpectedSize == NewSize && 0 == memcmp(Expected, NewBuffer, NewSize));
+
+    /* rename c -> f (replace existing f): two removes, one insert */
+    memcpy(Buffer, NewBuffer, Size = NewSize);
+    Length = wname(Name, "c");
+    NewLength = wname(NewName, "f");
+    Index = find_entry(&Directory, Name, Length);
+    FileInfo = Directory.Entries[Index].FileInfo;
+    NewSize = patch(Buffer, Size, Name, Length, NewName, NewLength, &FileInfo, 0, NewBuffer);
+    Directory.Entries[find_entry(&Directory, NewName, NewLength)].FileInfo = FileInfo;
+    Directory.Entries[Index] = Directory.Entries[--Directory.Count];
+    ExpectedSize = enumerate(&Directory, 1, 0, 0, 1, Expected);
+    ASSERT(ExpectedSize == NewSize && 0 == memcmp(Expected, NewBuffer, NewSize));
+
+    /* remove everything */
+    while (0 < Directory.Count)
+    {
+        memcpy(Buffer, NewBuffer, Size = NewSize);
+        ENTRY *Entry = &Directory.Entries[rnd(Directory.Count)];
+        NewSize = patch(Buffer, Size, Entry->Name, Entry->Length, 0, 0, 0, 0, NewBuffer);
+        *Entry = Directory.Entries[--Directory.Count];
+        ExpectedSize = enumerate(&Directory, 1, 0, 0, 1, Expected);
+        ASSERT(ExpectedSize == NewSize && 0 == memcmp(Expected, NewBuffer, NewSize));
+    }
+}
+
+static void patch_reject_test(void)
+{
+    static UINT8 Buffer[BUFFER_SIZE];
+    DIRECTORY Directory;
+    FSP_DIRINFO_PATCH Patch;
+    WCHAR Name[NAME_MAX];
+    UINT32 Size, Length;
+    static const char *Names[] = { "a", "B", "c" };
+
+    memset(&Directory, 0, sizeof Directory);
+    for (UINT32 I = 0; 3 > I; I++)
+        Directory.Entries[I].Length = wname(Directory.Entries[I].Name, Names[I]);
+    Directory.Count = 3;
+    Length = wname(Name, "x");
+
+    /* sorted case-insensitively: not sorted ordinally */
+    Directory.Upcase = upcase;
+    Size = enumerate(&Directory, 0, 0, 0, 1, Buffer);
+    ASSERT(FspDirInfoPatchPrepare(Buffer, Size, Name, Length, 0, 0, upcase, &Patch));
+    ASSERT(!FspDirInfoPatchPrepare(Buffer, Size, Name, Length, 0, 0, 0, &Patch));
+
+    /* duplicate names are not strictly ascending */
+    Directory.Entries[1].Length = wname(Directory.Entries[1].Name, "A");
+    Size = enumerate(&Directory, 0, 0, 0, 1, Buffer);
+    ASSERT(!FspDirInfoPatchPrepare(Buffer, Size, Name, Length, 0, 0, upcase, &Patch));
+    Directory.Entries[1].Length = wname(Directory.Entries[1].Name, "b");
+    Size = enumerate(&Directory, 0, 0, 0, 1, Buffer);
+    ASSERT(FspDirInfoPatchPrepare(Buffer, Size, Name, Length, 0, 0, upcase, &Patch));
+
+    /* malformed: bad entry size; entry that overruns the buffer */
+    ((FSP_FSCTL_DIR_INFO *)Buffer)->Size = 50;
+    ASSERT(!FspDirInfoPatchPrepare(Buffer, Size, Name, Length, 0, 0, upcase, &Patch));
+    ((FSP_FSCTL_DIR_INFO *)Buffer)->Size = sizeof(FSP_FSCTL_DIR_INFO) + 1;
+    ASSERT(!FspDirInfoPatchPrepare(Buffer, Size, Name, Length, 0, 0, upcase, &Patch));
+    ((FSP_FSCTL_DIR_INFO *)Buffer)->Size = sizeof(FSP_FSCTL_DIR_INFO) + 2;
+    ASSERT(FspDirInfoPatchPrepare(Buffer, Size, Name, Length, 0, 0, upcase, &Patch));
+    ASSERT(!FspDirInfoPatchPrepare(Buffer, sizeof(FSP_FSCTL_DIR_INFO) + 1,
+        Name, Length, 0, 0, upcase, &Patch));
+
+    /* empty name */
+    ASSERT(!FspDirInfoPatchPrepare(Buffer, Size, 0, 0, Name, 0, upcase, &Patch));
+
+    /* empty complete listing: insert; empty incomplete listing: nothing to do */
+    memset(Buffer, 0, sizeof(UINT16));
+    ASSERT(FspDirInfoPatchPrepare(Buffer, sizeof(UINT16), 0, 0, Name, Length, upcase, &Patch));
+    ASSERT(0 != Patch.InsertSize && 0 == Patch.InsertOffset);
+    ASSERT(FspDirInfoPatchPrepare(Buffer, 0, 0, 0, Name, Length, upcase, &Patch));
+    ASSERT(FspDirInfoPatchIsEmpty(&Patch));
+}
+
+static void random_name(ENTRY *Entry)
+{
+    static const char Chars[] = "abcABC.-_0~ \xe9";
+    for (;;)
+    {
+        Entry->Length = 1 + rnd(4);
+        for (UINT32 I = 0; Entry->Length > I; I++)
+            Entry->Name[I] = (unsigned char)Chars[rnd(sizeof Chars - 1)];
+        if (!FspDirInfoPatchIsDots(Entry->Name, Entry->Length))
+            break;
+    }
+}
+
+static void verify(DIRECTORY *Directory, BOOLEAN Dots, const UINT8 *Buffer, UINT32 Size)
+{
+    static UINT8 Expected[BUFFER_SIZE];
+    const FSP_FSCTL_DIR_INFO *Last;
+    BOOLEAN Complete;
+    UINT32 ExpectedSize;
+
+    Last = last_entry(Buffer, Size, &Complete);
+    if (Complete)
+        ExpectedSize = enumerate(Directory, Dots, 0, 0, 1, Expected);
+    else if (0 != Last)
+        ExpectedSize = enumerate(Directory, Dots,
+            Last->FileNameBuf, (Last->Size - sizeof(FSP_FSCTL_DIR_INFO)) / sizeof(WCHAR), 0,
+            Expected);
+    else
+    {
+        /* an incomplete listing that has lost all of its entries */
+        static DIRECTORY Empty;
+        ExpectedSize = enumerate(&Empty, Dots, 0, 0, 0, Expected);
+    }
+
+    ASSERT(ExpectedSize == Size);
+    ASSERT(0 == memcmp(Expected, Buffer, Size));
+}
+
+static void random_test(UINT32 Iterations)
+{
+    static UINT8 Buffer[BUFFER_SIZE], NewBuffer[BUFFER_SIZE];
+    DIRECTORY Directory;
+    ENTRY Entry;
+    UINT32 Size, Count, Limit;
+    BOOLEAN Dots, Complete;
+    UINT64 Creates = 0, Deletes = 0, Renames = 0, Inserted = 0, Removed = 0;
+
+    for (UINT32 Iteration = 0; Iterations > Iteration; Iteration++)
+    {
+        memset(&Directory, 0, sizeof Directory);
+        Directory.Upcase = rnd(2) ? upcase : 0;
+        Dots = rnd(2);
+        Complete = 0 != rnd(3);
+
+        Count = rnd(ENTRY_MAX / 2);
+        while (Directory.Count < Count)
+        {
+            random_name(&Entry);
+            if (0 <= find_entry(&Directory, Entry.Name, Entry.Length))
+                continue;
+            Entry.FileInfo.IndexNumber = ++Directory.IndexNumber;
+            Directory.Entries[Directory.Count++] = Entry;
+        }
+
+        /* the cached listing: complete, or the first Limit entries */
+        Size = enumerate(&Directory, Dots, 0, 0, 1, Buffer);
+        if (!Complete)
+        {
+            Limit = 0 < Directory.Count ? rnd(Directory.Count) : 0;
+            if (0 < Limit)
+                Size = enumerate(&Directory, Dots,
+                    Directory.Entries[Limit - 1].Name, Directory.Entries[Limit - 1].Length, 0,
+                    Buffer);
+            else
+                Complete = 1;
+        }
+        verify(&Directory, Dots, Buffer, Size);
+
+        for (UINT32 Op = 0, OpCount = 1 + rnd(32); OpCount > Op; Op++)
+        {
+            UINT32 NewSize, OldSize = Size;
+            int Index;
+
+            switch (rnd(3))
+            {
+            case 0:
+                /* create */
+                if (ENTRY_MAX <= Directory.Count)
+                    continue;
+                random_name(&Entry);
+                if (0 <= find_entry(&Directory, Entry.Name, Entry.Length))
+                    continue;
+                Entry.FileInfo.IndexNumber = ++Directory.IndexNumber;
+                NewSize = patch(Buffer, Size, 0, 0,
+                    Entry.Name, Entry.Length, &Entry.FileInfo, Directory.Upcase, NewBuffer);
+                Directory.Entries[Directory.Count++] = Entry;
+                Creates++;
+                break;
+            case 1:
+                /* delete (possibly by a differently cased name, possibly a missing name) */
+                if (0 < Directory.Count && 0 != rnd(4))
+                {
+                    Entry = Directory.Entries[rnd(Directory.Count)];
+                    if (0 != Directory.Upcase)
+                        for (UINT32 I = 0; Entry.Length > I; I++)
+                            Entry.Name[I] = rnd(2) ? upcase(Entry.Name[I]) : Entry.Name[I];
+                }
+                else
+                    random_name(&Entry);
+                NewSize = patch(Buffer, Size, Entry.Name, Entry.Length,
+                    0, 0, 0, Directory.Upcase, NewBuffer);
+                Index = find_entry(&Directory, Entry.Name, Entry.Length);
+                if (0 <= Index)
+                    Directory.Entries[Index] = Directory.Entries[--Directory.Count];
+                Deletes++;
+                break;
+            default:
+                /* rename (possibly replacing an existing name, possibly to itself) */
+                if (0 == Directory.Count)
+                    continue;
+                Index = (int)rnd(Directory.Count);
+                if (0 != rnd(4))
+                    random_name(&Entry);
+                else
+                    Entry = Directory.Entries[rnd(Directory.Count)];
+                Entry.FileInfo = Directory.Entries[Index].FileInfo;
+                NewSize = patch(Buffer, Size,
+                    Directory.Entries[Index].Name, Directory.Entries[Index].Length,
+                    Entry.Name, Entry.Length, &Entry.FileInfo, Directory.Upcase, NewBuffer);
+                Directory.Entries[Index] = Directory.Entries[--Directory.Count];
+                Index = find_entry(&Directory, Entry.Name, Entry.Length);
+                if (0 <= Index)
+                    Directory.Entries[Index] = Directory.Entries[--Directory.Count];
+                Directory.Entries[Directory.Count++] = Entry;
+                Renames++;
+                break;
+            }
+
+            memcpy(Buffer, NewBuffer, Size = NewSize);
+            if (NewSize > OldSize)
+                Inserted++;
+            else if (NewSize < OldSize)
+                Removed++;
+            verify(&Directory, Dots, Buffer, Size);
+        }
+    }
+
+    printf("random: iterations=%lu creates=%llu deletes=%llu renames=%llu grown=%llu shrunk=%llu\n",
+        (unsigned long)Iterations,
+        (unsigned long long)Creates, (unsigned long long)Deletes, (unsigned long long)Renames,
+        (unsigned long long)Inserted, (unsigned long long)Removed);
+}
+
+int main(int argc, char *argv[])
+{
+    UINT32 Iterations = 1 < argc ? (UINT32)strtoul(argv[1], 0, 0) : 20000;
+
+    patch_insert_remove_test();
+    patch_reject_test();
+    random_test(Iterations);
+
+    printf("dirpatch: all tests passed\n");
+    return 0;
+}
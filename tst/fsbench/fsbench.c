@@ -33,6 +33,7 @@ static ULONG OptRdwrCcCount = 100;
 static ULONG OptRdwrNcCount = 100;
 static ULONG OptMmapFileSize = 4096 * 1024;
 static ULONG OptMmapCount = 100;
+static ULONG OptThreadCount = 8;
 
 static void file_create_dotest(ULONG CreateDisposition, ULONG OpenCount)
 {
@@ -167,6 +168,83 @@ static void file_rmdir_test(void)
         ASSERT(Success);
     }
 }
+static DWORD WINAPI file_mt_create_open_thread(PVOID Context)
+{
+    ULONG ThreadIndex = (ULONG)(UINT_PTR)Context;
+    HANDLE Handle;
+    BOOL Success;
+    WCHAR DirName[MAX_PATH], FileName[MAX_PATH];
+
+    StringCbPrintfW(DirName, sizeof DirName, L"fsbench-mtdir%lu", ThreadIndex);
+    Success = CreateDirectoryW(DirName, 0);
+    ASSERT(Success);
+
+    /* mixed workload: every file is created once and opened OptOpenCount times */
+    for (ULONG Index = 0; OptFileCount > Index; Index++)
+    {
+        StringCbPrintfW(FileName, sizeof FileName, L"%s\\fsbench-file%lu", DirName, Index);
+        Handle = CreateFileW(FileName,
+            GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+            0,
+            CREATE_NEW, FILE_ATTRIBUTE_NORMAL,
+            0);
+        ASSERT(INVALID_HANDLE_VALUE != Handle);
+        Success = CloseHandle(Handle);
+        ASSERT(Success);
+
+        for (ULONG OpenIndex = 0; OptOpenCount > OpenIndex; OpenIndex++)
+        {
+            Handle = CreateFileW(FileName,
+                GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                0,
+                OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                0);
+            ASSERT(INVALID_HANDLE_VALUE != Handle);
+            Success = CloseHandle(Handle);
+            ASSERT(Success);
+        }
+    }
+
+    for (ULONG Index = 0; OptFileCount > Index; Index++)
+    {
+        StringCbPrintfW(FileName, sizeof FileName, L"%s\\fsbench-file%lu", DirName, Index);
+        Success = DeleteFileW(FileName);
+        ASSERT(Success);
+    }
+
+    Success = RemoveDirectoryW(DirName);
+    ASSERT(Success);
+
+    return 0;
+}
+static void file_mt_create_open_test(void)
+{
+    /*
+     * Each thread works in its own directory. Namespace operations in independent
+     * directories only contend on the file system's operation guard.
+     */
+    HANDLE Threads[MAXIMUM_WAIT_OBJECTS];
+    ULONG ThreadCount = MAXIMUM_WAIT_OBJECTS < OptThreadCount ?
+        MAXIMUM_WAIT_OBJECTS : OptThreadCount;
+    DWORD WaitResult;
+    BOOL Success;
+
+    for (ULONG ThreadIndex = 0; ThreadCount > ThreadIndex; ThreadIndex++)
+    {
+        Threads[ThreadIndex] = CreateThread(0, 0,
+            file_mt_create_open_thread, (PVOID)(UINT_PTR)ThreadIndex, 0, 0);
+        ASSERT(0 != Threads[ThreadIndex]);
+    }
+
+    WaitResult = WaitForMultipleObjects(ThreadCount, Threads, TRUE, INFINITE);
+    ASSERT(WAIT_OBJECT_0 <= WaitResult && WaitResult < WAIT_OBJECT_0 + ThreadCount);
+
+    for (ULONG ThreadIndex = 0; ThreadCount > ThreadIndex; ThreadIndex++)
+    {
+        Success = CloseHandle(Threads[ThreadIndex]);
+        ASSERT(Success);
+    }
+}
 static void file_tests(void)
 {
     TEST(file_create_test);
@@ -179,6 +257,7 @@ static void file_tests(void)
     TEST(file_delete_test);
     TEST(file_mkdir_test);
     TEST(file_rmdir_test);
+    TEST(file_mt_create_open_test);
 }
 
 static void rdwr_dotest(ULONG CreateDisposition, ULONG CreateFlags,
@@ -528,6 +607,11 @@ int main(int argc, char *argv[])
                 OptMmapCount = strtoul(a + sizeof "--mmap=" - 1, 0, 10);
                 rmarg(argv, argc, argi);
             }
+            else if (0 == strncmp("--threads=", a, sizeof "--threads=" - 1))
+            {
+                OptThreadCount = strtoul(a + sizeof "--threads=" - 1, 0, 10);
+                rmarg(argv, argc, argi);
+            }
         }
     }
 
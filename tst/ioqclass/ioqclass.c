@@ -0,0 +1,354 @@
+/**
+ * @file ioqclass.c
+ *
+ * Pending queue priority class tests and simulation.
+ *
+ * @copyright 2015-2026 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this software
+ * in accordance with the commercial license agreement provided in
+ * conjunction with the software.  The terms and conditions of any such
+ * commercial license agreement shall govern, supersede, and render
+ * ineffective any application of the GPLv3 license to this software,
+ * notwithstanding of any reference thereto in the software or
+ * associated repository.
+ */
+
+/*
+ * Unit tests for shared/ku/ioqclass.h followed by a simulation of the pending
+ * queue of a single shard: a file system dispatcher removes one request per tick
+ * while a background burst (a large directory scan followed by paging writes)
+ * and a steady stream of interactive requests and opens arrive. The simulation
+ * runs once with a single FIFO (the queue as it was) and once with the priority
+ * classes and reports the wait times of each class. Opens must no longer wait
+ * behind the burst and the burst must still complete. Builds on any platform
+ * with a C99 compiler (see the Makefile).
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef unsigned char BOOLEAN;
+typedef uint8_t UINT8;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+
+/* compatible with inc/winfsp/fsctl.h */
+#define FSP_FSCTL_STATIC_ASSERT(e,m)    _Static_assert(e,m)
+enum
+{
+    FspFsctlTransactReservedKind = 0,
+    FspFsctlTransactCreateKind,
+    FspFsctlTransactOverwriteKind,
+    FspFsctlTransactCleanupKind,
+    FspFsctlTransactCloseKind,
+    FspFsctlTransactReadKind,
+    FspFsctlTransactWriteKind,
+    FspFsctlTransactQueryInformationKind,
+    FspFsctlTransactSetInformationKind,
+    FspFsctlTransactQueryEaKind,
+    FspFsctlTransactSetEaKind,
+    FspFsctlTransactFlushBuffersKind,
+    FspFsctlTransactQueryVolumeInformationKind,
+    FspFsctlTransactSetVolumeInformationKind,
+    FspFsctlTransactQueryDirectoryKind,
+    FspFsctlTransactFileSystemControlKind,
+    FspFsctlTransactDeviceControlKind,
+    FspFsctlTransactShutdownKind,
+    FspFsctlTransactLockControlKind,
+    FspFsctlTransactQuerySecurityKind,
+    FspFsctlTransactSetSecurityKind,
+    FspFsctlTransactQueryStreamInformationKind,
+    FspFsctlTransactKindCount,
+};
+enum
+{
+    FspFsctlIoqClassMetadata = 0,
+    FspFsctlIoqClassInteractive,
+    FspFsctlIoqClassPaging,
+    FspFsctlIoqClassBackground,
+    FspFsctlIoqClassCount,
+};
+
+#include <shared/ku/ioqclass.h>
+
+#define ASSERT(e)                       \
+    ((e) ? (void)0 : (fprintf(stderr, "%s:%d: ASSERT(%s) failed\n", __FILE__, __LINE__, #e), abort()))
+
+static const char *ClassNames[FspFsctlIoqClassCount] =
+{
+    "metadata", "interactive", "paging", "background",
+};
+
+static void classify_test(void)
+{
+    ASSERT(FspFsctlIoqClassMetadata == FspIoqClassFromKind(FspFsctlTransactCreateKind, 0, 0));
+    ASSERT(FspFsctlIoqClassMetadata == FspIoqClassFromKind(FspFsctlTransactCleanupKind, 0, 0));
+    ASSERT(FspFsctlIoqClassMetadata == FspIoqClassFromKind(FspFsctlTransactQueryInformationKind, 0, 0));
+    ASSERT(FspFsctlIoqClassMetadata == FspIoqClassFromKind(FspFsctlTransactSetSecurityKind, 0, 0));
+    ASSERT(FspFsctlIoqClassMetadata == FspIoqClassFromKind(FspFsctlTransactReservedKind, 0, 0));
+    ASSERT(FspFsctlIoqClassInteractive == FspIoqClassFromKind(FspFsctlTransactReadKind, 0, 0));
+    ASSERT(FspFsctlIoqClassInteractive == FspIoqClassFromKind(FspFsctlTransactWriteKind, 0, 0));
+    ASSERT(FspFsctlIoqClassInteractive == FspIoqClassFromKind(FspFsctlTransactQueryDirectoryKind, 0, 0));
+    ASSERT(FspFsctlIoqClassPaging == FspIoqClassFromKind(FspFsctlTransactReadKind, 1, 0));
+    ASSERT(FspFsctlIoqClassPaging == FspIoqClassFromKind(FspFsctlTransactWriteKind, 1, 0));
+    ASSERT(FspFsctlIoqClassPaging == FspIoqClassFromKind(FspFsctlTransactFlushBuffersKind, 0, 0));
+    ASSERT(FspFsctlIoqClassBackground == FspIoqClassFromKind(FspFsctlTransactCloseKind, 0, 0));
+    for (UINT32 Kind = 0; FspFsctlTransactKindCount > Kind; Kind++)
+    {
+        ASSERT(FspFsctlIoqClassBackground == FspIoqClassFromKind(Kind, 0, 1));
+        ASSERT(FspFsctlIoqClassBackground == FspIoqClassFromKind(Kind, 1, 1));
+    }
+}
+
+static void stamp_test(void)
+{
+    UINT32 Stamp;
+
+    for (UINT32 Class = 0; FspFsctlIoqClassCount > Class; Class++)
+    {
+        Stamp = FspIoqClassStamp(123456, Class);
+        ASSERT(Class == FspIoqClassOfStamp(Stamp));
+        ASSERT(0 == FspIoqClassWaitTime(Stamp, 123456));
+        ASSERT(1000 == FspIoqClassWaitTime(Stamp, 124456));
+
+        /* the microsecond clock wraps in the stamp (2^30) and in a ULONG (2^32) */
+        Stamp = FspIoqClassStamp((1U << 30) - 5, Class);
+        ASSERT(15 == FspIoqClassWaitTime(Stamp, 10));
+        Stamp = FspIoqClassStamp(0xfffffff0U, Class);
+        ASSERT(0x20 == FspIoqClassWaitTime(Stamp, 0x10));
+        Stamp = FspIoqClassStamp(7, Class);
+        ASSERT((1U << 30) - 1 == FspIoqClassWaitTime(Stamp, 6));
+    }
+}
+
+static void pick_test(void)
+{
+    FSP_IOQ_CLASS_SCHED Sched;
+    UINT32 AllMask = (1 << FspFsctlIoqClassCount) - 1;
+    UINT32 Round = 0, Counts[FspFsctlIoqClassCount];
+    UINT32 LastServed[FspFsctlIoqClassCount], Class, Mask;
+
+    for (Class = 0; FspFsctlIoqClassCount > Class; Class++)
+        Round += FspIoqClassWeight(Class);
+
+    memset(&Sched, 0, sizeof Sched);
+    ASSERT(FspFsctlIoqClassCount == FspIoqClassPick(&Sched, 0));
+
+    /* every class backlogged: each round serves each class exactly its weight */
+    memset(&Sched, 0, sizeof Sched);
+    for (UINT32 R = 0; 100 > R; R++)
+    {
+        memset(Counts, 0, sizeof Counts);
+        for (UINT32 I = 0; Round > I; I++)
+            Counts[FspIoqClassPick(&Sched, AllMask)]++;
+        for (Class = 0; FspFsctlIoqClassCount > Class; Class++)
+            ASSERT(FspIoqClassWeight(Class) == Counts[Class]);
+    }
+
+    /* a single ready class is always served */
+    for (Class = 0; FspFsctlIoqClassCount > Class; Class++)
+    {
+        memset(&Sched, 0, sizeof Sched);
+        for (UINT32 I = 0; 100 > I; I++)
+            ASSERT(Class == FspIoqClassPick(&Sched, 1 << Class));
+    }
+
+    /*
+     * Random ready sets: the pick is always ready and a class that stays ready is
+     * served within two rounds (the rest of the current round plus the classes
+     * ahead of it in the next).
+     */
+    srand(1);
+    memset(&Sched, 0, sizeof Sched);
+    for (Class = 0; FspFsctlIoqClassCount > Class; Class++)
+        LastServed[Class] = 0;
+    for (UINT32 I = 1; 1000000 >= I; I++)
+    {
+        Mask = rand() & AllMask;
+        Class = FspIoqClassPick(&Sched, Mask);
+        if (0 == Mask)
+        {
+            ASSERT(FspFsctlIoqClassCount == Class);
+            continue;
+        }
+        ASSERT(0 != (Mask & (1 << Class)));
+        LastServed[Class] = I;
+    }
+
+    memset(&Sched, 0, sizeof Sched);
+    for (Class = 0; FspFsctlIoqClassCount > Class; Class++)
+        LastServed[Class] = 0;
+    for (UINT32 I = 1; 1000000 >= I; I++)
+    {
+        /* class 3 always ready; the others come and go */
+        Mask = (rand() & AllMask) | (1 << (FspFsctlIoqClassCount - 1));
+        Class = FspIoqClassPick(&Sched, Mask);
+        ASSERT(0 != (Mask & (1 << Class)));
+        if (FspFsctlIoqClassCount - 1 == Class)
+        {
+            ASSERT(I - LastServed[Class] <= 2 * Round);
+            LastServed[Class] = I;
+        }
+    }
+}
+
+typedef struct
+{
+    UINT32 Class;
+    UINT64 Arrival;
+} REQUEST;
+
+typedef struct
+{
+    REQUEST *Items;
+    size_t Head, Tail, Capacity;
+} FIFO;
+
+static void fifo_push(FIFO *Fifo, REQUEST Request)
+{
+    if (Fifo->Tail == Fifo->Capacity)
+    {
+        Fifo->Capacity = 0 == Fifo->Capacity ? 1024 : 2 * Fifo->Capacity;
+        Fifo->Items = realloc(Fifo->Items, Fifo->Capacity * sizeof Fifo->Items[0]);
+        ASSERT(0 != Fifo->Items);
+    }
+    Fifo->Items[Fifo->Tail++] = Request;
+}
+
+static int fifo_empty(FIFO *Fifo)
+{
+    return Fifo->Head == Fifo->Tail;
+}
+
+static REQUEST fifo_pop(FIFO *Fifo)
+{
+    return Fifo->Items[Fifo->Head++];
+}
+
+typedef struct
+{
+    UINT64 Count, WaitTime, WaitTimeMax;
+    UINT64 LastDone;
+} CLASS_STATS;
+
+static void simulate(int Classes, UINT32 BurstCount, UINT32 Ticks, CLASS_STATS Stats[])
+{
+    /*
+     * One request is served per tick. At tick 0 a directory scan posts BurstCount
+     * query directory requests at once and the lazy writer follows with BurstCount
+     * paging writes; closes trickle in. Every 4 ticks a user opens a file and every
+     * 3 ticks an application reads. So the offered load is below one per tick and
+     * the burst is eventually drained.
+     */
+    FIFO Fifos[FspFsctlIoqClassCount];
+    FSP_IOQ_CLASS_SCHED Sched;
+    UINT32 ReadyMask, Class;
+    REQUEST Request;
+
+    memset(Fifos, 0, sizeof Fifos);
+    memset(&Sched, 0, sizeof Sched);
+    memset(Stats, 0, FspFsctlIoqClassCount * sizeof Stats[0]);
+
+#define POST(K, P)                      \
+    do                                  \
+    {                                   \
+        Request.Class = FspIoqClassFromKind(K, P, 0);\
+        Request.Arrival = Tick;         \
+        fifo_push(&Fifos[Classes ? Request.Class : 0], Request);\
+    } while (0)
+
+    for (UINT64 Tick = 0; Ticks > Tick; Tick++)
+    {
+        if (0 == Tick)
+            for (UINT32 I = 0; BurstCount > I; I++)
+            {
+                POST(FspFsctlTransactQueryDirectoryKind, 0);
+                POST(FspFsctlTransactWriteKind, 1);
+            }
+        if (0 == Tick % 4)
+            POST(FspFsctlTransactCreateKind, 0);
+        if (0 == Tick % 3)
+            POST(FspFsctlTransactReadKind, 0);
+        if (0 == Tick % 16)
+            POST(FspFsctlTransactCloseKind, 0);
+
+        ReadyMask = 0;
+        for (Class = 0; FspFsctlIoqClassCount > Class; Class++)
+            if (!fifo_empty(&Fifos[Class]))
+                ReadyMask |= 1 << Class;
+        Class = Classes ? FspIoqClassPick(&Sched, ReadyMask) :
+            (0 != ReadyMask ? 0 : FspFsctlIoqClassCount);
+        if (FspFsctlIoqClassCount == Class)
+            continue;
+
+        Request = fifo_pop(&Fifos[Class]);
+        Stats[Request.Class].Count++;
+        Stats[Request.Class].WaitTime += Tick - Request.Arrival;
+        if (Stats[Request.Class].WaitTimeMax < Tick - Request.Arrival)
+            Stats[Request.Class].WaitTimeMax = Tick - Request.Arrival;
+        Stats[Request.Class].LastDone = Tick;
+    }
+
+#undef POST
+
+    for (Class = 0; FspFsctlIoqClassCount > Class; Class++)
+    {
+        ASSERT(fifo_empty(&Fifos[Class]));
+        free(Fifos[Class].Items);
+    }
+}
+
+static void simulate_test(UINT32 BurstCount)
+{
+    CLASS_STATS Fifo[FspFsctlIoqClassCount], Wrr[FspFsctlIoqClassCount];
+    UINT32 Ticks = 16 * BurstCount + 1024;
+
+    simulate(0, BurstCount, Ticks, Fifo);
+    simulate(1, BurstCount, Ticks, Wrr);
+
+    printf("burst of %u directory requests and %u paging writes, %u ticks\n",
+        BurstCount, BurstCount, Ticks);
+    printf("%-12s %10s %12s %12s %12s %12s\n",
+        "class", "count", "fifo mean", "fifo max", "class mean", "class max");
+    for (UINT32 Class = 0; FspFsctlIoqClassCount > Class; Class++)
+    {
+        ASSERT(Fifo[Class].Count == Wrr[Class].Count);
+        printf("%-12s %10llu %12.1f %12llu %12.1f %12llu\n",
+            ClassNames[Class],
+            (unsigned long long)Wrr[Class].Count,
+            (double)Fifo[Class].WaitTime / Fifo[Class].Count,
+            (unsigned long long)Fifo[Class].WaitTimeMax,
+            (double)Wrr[Class].WaitTime / Wrr[Class].Count,
+            (unsigned long long)Wrr[Class].WaitTimeMax);
+    }
+
+    /* opens no longer wait for the burst; they wait at most a couple of rounds */
+    ASSERT(Fifo[FspFsctlIoqClassMetadata].WaitTimeMax >= BurstCount);
+    ASSERT(Wrr[FspFsctlIoqClassMetadata].WaitTimeMax <= 32);
+    /* the burst still completes */
+    ASSERT(Wrr[FspFsctlIoqClassPaging].LastDone < Ticks - 1024);
+}
+
+int main(int argc, char **argv)
+{
+    UINT32 BurstCount = 1 < argc ? (UINT32)strtoul(argv[1], 0, 0) : 50000;
+
+    classify_test();
+    stamp_test();
+    pick_test();
+    simulate_test(BurstCount);
+
+    printf("ok\n");
+    return 0;
+}
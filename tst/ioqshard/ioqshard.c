@@ -0,0 +1,632 @@
+/**
+ * @file ioqshard.c
+ *
+ * Sharded pending queue stress test and benchmark.
+ *
+ * @copyright 2015-2026 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this software
+ * in accordance with the commercial license agreement provided in
+ * conjunction with the software.  The terms and conditions of any such
+ * commercial license agreement shall govern, supersede, and render
+ * ineffective any application of the GPLv3 license to this software,
+ * notwithstanding of any reference thereto in the software or
+ * associated repository.
+ */
+
+/*
+ * Models the FSP_IOQ pending queue (see sys/ioq.c and shared/ku/ioqshard.h) with
+ * user mode threads and locks and runs it once with a single shard (the queue
+ * as it was) and once with one shard per processor (see the Makefile):
+ *
+ * - Poster threads play the MJ dispatch routines: each runs on a (virtual)
+ *   processor and posts items to the queue.
+ * - Transact threads play the user mode file system dispatcher threads: each
+ *   removes items from its home shard first and steals from the others, and
+ *   waits on a single auto-reset event (the FSP_QEVENT) when there is no work.
+ * - A canceler thread cancels random queued items, an expirer thread removes
+ *   items that have been queued for too long, like the IRP cancel routine and
+ *   FspIoqRemoveExpired do.
+ *
+ * At the end the queue is stopped and drained and every item that was posted
+ * must have been removed exactly once (by a transact thread, the canceler, the
+ * expirer or the final drain); the shard counts and the non-empty mask must be
+ * back to zero. The report lists throughput, the share of stolen items and the
+ * post-to-remove latency of items removed by transact threads.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef uint8_t UINT8;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+
+#include <shared/ku/ioqshard.h>
+
+#define ASSERT(e)                       \
+    ((e) ? (void)0 : (fprintf(stderr, "%s:%d: ASSERT(%s) failed\n", __FILE__, __LINE__, #e), abort()))
+
+#define CACHE_LINE_SIZE                 64
+#define LATENCY_BUCKET_COUNT            40      /* log2 buckets of nanoseconds */
+
+enum
+{
+    ItemFree = 0,
+    ItemQueued,
+    ItemRemoved,
+};
+
+typedef struct _ITEM
+{
+    struct _ITEM *Prev, *Next;
+    UINT64 PostTime;
+    _Atomic UINT32 Shard;
+    _Atomic int State;
+} ITEM;
+
+typedef struct
+{
+    _Alignas(CACHE_LINE_SIZE) pthread_spinlock_t Lock;
+    ITEM Head;
+    UINT32 Count;
+} SHARD;
+
+typedef struct
+{
+    pthread_mutex_t Mutex;
+    pthread_cond_t Cond;
+    atomic_int Signaled;
+} EVENT;
+
+typedef struct
+{
+    SHARD *Shards;
+    UINT32 ShardCount;
+    _Atomic UINT64 Mask;
+    UINT8 Padding0[CACHE_LINE_SIZE];
+    atomic_long Count;
+    long Capacity;
+    atomic_int Stopped;
+    UINT8 Padding1[CACHE_LINE_SIZE];
+    EVENT Event;
+} QUEUE;
+
+static struct
+{
+    unsigned Processors;
+    unsigned Posters;
+    unsigned Transacters;
+    unsigned Seconds;
+    unsigned ItemsPerPoster;
+    unsigned CancelPerMille;
+    UINT64 Timeout;                     /* nanoseconds */
+    long Capacity;
+} Config =
+{
+    .Processors = 0,
+    .Posters = 0,
+    .Transacters = 0,
+    .Seconds = 3,
+    .ItemsPerPoster = 64,
+    .CancelPerMille = 10,
+    .Timeout = 50 * 1000 * 1000,
+    .Capacity = 1000,
+};
+
+static QUEUE Queue;
+static ITEM *Items;
+static atomic_int Stop;
+static atomic_ullong Posted, Rejected, Transacted, Stolen, Canceled, Expired, Drained;
+static atomic_ullong Latency[LATENCY_BUCKET_COUNT];
+
+static inline UINT64 now(void)
+{
+    struct timespec Time;
+    clock_gettime(CLOCK_MONOTONIC, &Time);
+    return (UINT64)Time.tv_sec * 1000000000ULL + (UINT64)Time.tv_nsec;
+}
+
+static inline UINT64 next_random(UINT64 *State)
+{
+    UINT64 X = *State;
+    X ^= X << 13;
+    X ^= X >> 7;
+    X ^= X << 17;
+    return *State = X;
+}
+
+static void event_set(EVENT *Event)
+{
+    /* like FspQeventSet preceded by a KeReadStateQueue check */
+    if (atomic_load(&Event->Signaled))
+        return;
+    pthread_mutex_lock(&Event->Mutex);
+    if (!atomic_load(&Event->Signaled))
+    {
+        atomic_store(&Event->Signaled, 1);
+        pthread_cond_signal(&Event->Cond);
+    }
+    pthread_mutex_unlock(&Event->Mutex);
+}
+
+static int event_wait(EVENT *Event, UINT64 Timeout)
+{
+    /* auto-reset: a successful wait consumes the signal */
+    struct timespec Deadline;
+    int Result;
+
+    clock_gettime(CLOCK_REALTIME, &Deadline);
+    Deadline.tv_nsec += (long)Timeout;
+    Deadline.tv_sec += Deadline.tv_nsec / 1000000000;
+    Deadline.tv_nsec %= 1000000000;
+
+    pthread_mutex_lock(&Event->Mutex);
+    while (!atomic_load(&Event->Signaled))
+        if (0 != pthread_cond_timedwait(&Event->Cond, &Event->Mutex, &Deadline))
+            break;
+    Result = atomic_load(&Event->Signaled);
+    atomic_store(&Event->Signaled, 0);
+    pthread_mutex_unlock(&Event->Mutex);
+
+    return Result;
+}
+
+static void queue_init(QUEUE *Queue, UINT32 ShardCount, long Capacity)
+{
+    memset(Queue, 0, sizeof *Queue);
+    Queue->Shards = aligned_alloc(CACHE_LINE_SIZE, ShardCount * sizeof(SHARD));
+    if (0 == Queue->Shards)
+        abort();
+    memset(Queue->Shards, 0, ShardCount * sizeof(SHARD));
+    for (UINT32 I = 0; ShardCount > I; I++)
+    {
+        pthread_spin_init(&Queue->Shards[I].Lock, PTHREAD_PROCESS_PRIVATE);
+        Queue->Shards[I].Head.Prev = Queue->Shards[I].Head.Next = &Queue->Shards[I].Head;
+    }
+    Queue->ShardCount = ShardCount;
+    Queue->Capacity = Capacity;
+    pthread_mutex_init(&Queue->Event.Mutex, 0);
+    pthread_cond_init(&Queue->Event.Cond, 0);
+}
+
+static void queue_fini(QUEUE *Queue)
+{
+    for (UINT32 I = 0; Queue->ShardCount > I; I++)
+        pthread_spin_destroy(&Queue->Shards[I].Lock);
+    pthread_mutex_destroy(&Queue->Event.Mutex);
+    pthread_cond_destroy(&Queue->Event.Cond);
+    free(Queue->Shards);
+}
+
+static void queue_remove_locked(QUEUE *Queue, UINT32 Index, ITEM *Item)
+{
+    /* FspIoqPendingRemoveIrp */
+    SHARD *Shard = &Queue->Shards[Index];
+    Item->Prev->Next = Item->Next;
+    Item->Next->Prev = Item->Prev;
+    atomic_store(&Item->State, ItemRemoved);
+    if (0 == --Shard->Count)
+        atomic_fetch_and(&Queue->Mask, ~FspIoqShardBit(Index));
+    if (1 != atomic_fetch_sub(&Queue->Count, 1) || atomic_load(&Queue->Stopped))
+        event_set(&Queue->Event);
+}
+
+static int queue_post(QUEUE *Queue, ITEM *Item, UINT32 Processor)
+{
+    /* FspIoqPostIrpEx and FspIoqPendingInsertIrpEx */
+    UINT32 Index = FspIoqShardHome(Processor, Queue->ShardCount);
+    SHARD *Shard = &Queue->Shards[Index];
+    int Result = 0;
+
+    pthread_spin_lock(&Shard->Lock);
+    if (atomic_load(&Queue->Stopped))
+        goto exit;
+    if (Queue->Capacity < atomic_fetch_add(&Queue->Count, 1) + 1)
+    {
+        atomic_fetch_sub(&Queue->Count, 1);
+        goto exit;
+    }
+    Item->PostTime = now();
+    atomic_store(&Item->Shard, Index);
+    atomic_store(&Item->State, ItemQueued);
+    Item->Prev = Shard->Head.Prev;
+    Item->Next = &Shard->Head;
+    Shard->Head.Prev->Next = Item;
+    Shard->Head.Prev = Item;
+    if (1 == ++Shard->Count)
+        atomic_fetch_or(&Queue->Mask, FspIoqShardBit(Index));
+    Result = 1;
+exit:
+    pthread_spin_unlock(&Shard->Lock);
+
+    if (Result)
+        event_set(&Queue->Event);
+    return Result;
+}
+
+static ITEM *queue_next(QUEUE *Queue, UINT32 Home, int *PStolen)
+{
+    /* FspIoqPendingRemoveNextIrp: home shard first, then steal; skip empty shards */
+    UINT64 Mask = atomic_load(&Queue->Mask);
+    UINT32 Index;
+    ITEM *Item;
+
+    while (0 != Mask)
+    {
+        Index = FspIoqShardNext(Mask, Home);
+        SHARD *Shard = &Queue->Shards[Index];
+        pthread_spin_lock(&Shard->Lock);
+        Item = Shard->Head.Next;
+        if (&Shard->Head != Item && !atomic_load(&Queue->Stopped))
+        {
+            queue_remove_locked(Queue, Index, Item);
+            pthread_spin_unlock(&Shard->Lock);
+            *PStolen = Home != Index;
+            return Item;
+        }
+        pthread_spin_unlock(&Shard->Lock);
+        Mask &= ~FspIoqShardBit(Index);
+    }
+
+    return 0;
+}
+
+static int queue_cancel(QUEUE *Queue, ITEM *Item)
+{
+    /* the IRP cancel routine: the item may move or go away while we get the lock */
+    UINT32 Index = atomic_load(&Item->Shard);
+    SHARD *Shard = &Queue->Shards[Index];
+    int Result = 0;
+
+    pthread_spin_lock(&Shard->Lock);
+    if (ItemQueued == atomic_load(&Item->State) && Index == atomic_load(&Item->Shard))
+    {
+        queue_remove_locked(Queue, Index, Item);
+        Result = 1;
+    }
+    pthread_spin_unlock(&Shard->Lock);
+
+    return Result;
+}
+
+static UINT64 queue_remove_expired(QUEUE *Queue, UINT64 Time, ITEM **PRemoved)
+{
+    /* FspIoqRemoveExpired: items expire in post order within a shard */
+    UINT64 Count = 0;
+    ITEM *Item;
+
+    for (UINT32 Index = 0; Queue->ShardCount > Index; Index++)
+    {
+        SHARD *Shard = &Queue->Shards[Index];
+        pthread_spin_lock(&Shard->Lock);
+        while (&Shard->Head != (Item = Shard->Head.Next) &&
+            (0 == Time || Item->PostTime + Config.Timeout <= Time))
+        {
+            queue_remove_locked(Queue, Index, Item);
+            Item->Prev = *PRemoved;
+            *PRemoved = Item;
+            Count++;
+        }
+        pthread_spin_unlock(&Shard->Lock);
+    }
+
+    return Count;
+}
+
+static void queue_stop(QUEUE *Queue)
+{
+    /* FspIoqStop: posts that hold a shard lock finish; later ones see Stopped */
+    atomic_store(&Queue->Stopped, 1);
+    for (UINT32 Index = 0; Queue->ShardCount > Index; Index++)
+    {
+        pthread_spin_lock(&Queue->Shards[Index].Lock);
+        pthread_spin_unlock(&Queue->Shards[Index].Lock);
+    }
+    event_set(&Queue->Event);
+}
+
+static void release_chain(ITEM *Removed)
+{
+    while (0 != Removed)
+    {
+        ITEM *Prev = Removed->Prev;
+        atomic_store(&Removed->State, ItemFree);
+        Removed = Prev;
+    }
+}
+
+static void *poster(void *Data)
+{
+    unsigned Id = (unsigned)(uintptr_t)Data;
+    UINT32 Processor = Id % Config.Processors;
+    ITEM *Pool = Items + (size_t)Id * Config.ItemsPerPoster;
+    UINT64 LocalPosted = 0, LocalRejected = 0;
+    unsigned Next = 0;
+
+    while (!atomic_load_explicit(&Stop, memory_order_relaxed))
+    {
+        ITEM *Item = &Pool[Next];
+        Next = (Next + 1) % Config.ItemsPerPoster;
+        if (ItemFree != atomic_load(&Item->State))
+        {
+            if (0 == Next)
+                sched_yield();
+            continue;
+        }
+        if (queue_post(&Queue, Item, Processor))
+            LocalPosted++;
+        else
+        {
+            LocalRejected++;
+            sched_yield();
+        }
+    }
+
+    atomic_fetch_add(&Posted, LocalPosted);
+    atomic_fetch_add(&Rejected, LocalRejected);
+    return 0;
+}
+
+static void *transacter(void *Data)
+{
+    unsigned Id = (unsigned)(uintptr_t)Data;
+    UINT32 Home = FspIoqShardHome(Id % Config.Processors, Queue.ShardCount);
+    UINT64 LocalTransacted = 0, LocalStolen = 0, LocalLatency[LATENCY_BUCKET_COUNT] = { 0 };
+    ITEM *Item;
+    int IsStolen;
+
+    while (!atomic_load_explicit(&Stop, memory_order_relaxed))
+    {
+        Item = queue_next(&Queue, Home, &IsStolen);
+        if (0 == Item)
+        {
+            if (event_wait(&Queue.Event, 1000000))
+            {
+                Item = queue_next(&Queue, Home, &IsStolen);
+                /* the wait consumed the signal without an item: pass it on if there is work */
+                if (0 == Item && 0 != atomic_load(&Queue.Count))
+                    event_set(&Queue.Event);
+            }
+            if (0 == Item)
+                continue;
+        }
+
+        UINT64 Delta = now() - Item->PostTime;
+        unsigned Bucket = 0;
+        while (LATENCY_BUCKET_COUNT - 1 > Bucket && (1ULL << (Bucket + 1)) <= Delta)
+            Bucket++;
+        LocalLatency[Bucket]++;
+        LocalTransacted++;
+        LocalStolen += IsStolen;
+        atomic_store(&Item->State, ItemFree);
+    }
+
+    atomic_fetch_add(&Transacted, LocalTransacted);
+    atomic_fetch_add(&Stolen, LocalStolen);
+    for (unsigned I = 0; LATENCY_BUCKET_COUNT > I; I++)
+        atomic_fetch_add(&Latency[I], LocalLatency[I]);
+    return 0;
+}
+
+static void *canceler(void *Data)
+{
+    UINT64 Random = 0x9E3779B97F4A7C15ULL;
+    UINT64 ItemCount = (UINT64)Config.Posters * Config.ItemsPerPoster;
+    UINT64 LocalCanceled = 0;
+    struct timespec Delay = { 0, 100 * 1000 };
+
+    while (!atomic_load_explicit(&Stop, memory_order_relaxed))
+    {
+        ITEM *Item = &Items[next_random(&Random) % ItemCount];
+        if (next_random(&Random) % 1000 < Config.CancelPerMille && queue_cancel(&Queue, Item))
+        {
+            LocalCanceled++;
+            atomic_store(&Item->State, ItemFree);
+        }
+        else
+            nanosleep(&Delay, 0);
+    }
+
+    atomic_fetch_add(&Canceled, LocalCanceled);
+    return 0;
+}
+
+static void *expirer(void *Data)
+{
+    struct timespec Delay = { 0, 10 * 1000 * 1000 };
+    ITEM *Removed;
+
+    while (!atomic_load_explicit(&Stop, memory_order_relaxed))
+    {
+        Removed = 0;
+        atomic_fetch_add(&Expired, queue_remove_expired(&Queue, now(), &Removed));
+        release_chain(Removed);
+        nanosleep(&Delay, 0);
+    }
+    return 0;
+}
+
+static UINT64 percentile(UINT64 Total, double Fraction)
+{
+    UINT64 Sum = 0;
+    for (unsigned I = 0; LATENCY_BUCKET_COUNT > I; I++)
+    {
+        Sum += Latency[I];
+        if (Sum >= Total * Fraction)
+            return 1ULL << (I + 1);
+    }
+    return 1ULL << LATENCY_BUCKET_COUNT;
+}
+
+static void shard_test(void)
+{
+    UINT64 Random = 42;
+
+    ASSERT(1 == FspIoqShardCount(0));
+    ASSERT(3 == FspIoqShardCount(3));
+    ASSERT(FSP_IOQ_SHARD_COUNT_MAX == FspIoqShardCount(1000));
+
+    for (UINT32 I = 0; 64 > I; I++)
+        ASSERT(I == FspIoqShardLowestBit(FspIoqShardBit(I)));
+
+    for (int N = 0; 100000 > N; N++)
+    {
+        UINT64 Mask = next_random(&Random) & next_random(&Random);
+        UINT32 Home = (UINT32)(next_random(&Random) % 64), Expected;
+        if (0 == Mask)
+            continue;
+        ASSERT(0 != (Mask & FspIoqShardBit(FspIoqShardLowestBit(Mask))));
+        ASSERT(0 == (Mask & (FspIoqShardBit(FspIoqShardLowestBit(Mask)) - 1)));
+        for (Expected = Home; 0 == (Mask & FspIoqShardBit(Expected)); Expected = (Expected + 1) % 64)
+            ;
+        ASSERT(Expected == FspIoqShardNext(Mask, Home));
+    }
+}
+
+static int run(UINT32 ShardCount)
+{
+    pthread_t *Threads, Canceler, Expirer;
+    struct timespec Duration;
+    UINT64 Start, Total, ItemCount;
+    double Elapsed;
+    ITEM *Removed = 0;
+    int Result;
+
+    ItemCount = (UINT64)Config.Posters * Config.ItemsPerPoster;
+    Items = calloc(ItemCount, sizeof *Items);
+    Threads = calloc(Config.Posters + Config.Transacters, sizeof *Threads);
+    if (0 == Items || 0 == Threads)
+        abort();
+    queue_init(&Queue, ShardCount, Config.Capacity);
+    atomic_store(&Stop, 0);
+    atomic_store(&Posted, 0); atomic_store(&Rejected, 0);
+    atomic_store(&Transacted, 0); atomic_store(&Stolen, 0);
+    atomic_store(&Canceled, 0); atomic_store(&Expired, 0); atomic_store(&Drained, 0);
+    for (unsigned I = 0; LATENCY_BUCKET_COUNT > I; I++)
+        atomic_store(&Latency[I], 0);
+
+    Start = now();
+    for (unsigned I = 0; Config.Transacters > I; I++)
+        if (0 != pthread_create(&Threads[I], 0, transacter, (void *)(uintptr_t)I))
+            abort();
+    for (unsigned I = 0; Config.Posters > I; I++)
+        if (0 != pthread_create(&Threads[Config.Transacters + I], 0, poster, (void *)(uintptr_t)I))
+            abort();
+    if (0 != pthread_create(&Canceler, 0, canceler, 0) ||
+        0 != pthread_create(&Expirer, 0, expirer, 0))
+        abort();
+
+    Duration.tv_sec = Config.Seconds;
+    Duration.tv_nsec = 0;
+    nanosleep(&Duration, 0);
+    atomic_store(&Stop, 1);
+
+    for (unsigned I = 0; Config.Posters + Config.Transacters > I; I++)
+        pthread_join(Threads[I], 0);
+    pthread_join(Canceler, 0);
+    pthread_join(Expirer, 0);
+    Elapsed = (now() - Start) / 1e9;
+
+    /* FspIoqStop(CancelIrps = TRUE) */
+    queue_stop(&Queue);
+    ASSERT(0 == queue_post(&Queue, &(ITEM){ 0 }, 0));
+    atomic_store(&Drained, queue_remove_expired(&Queue, 0, &Removed));
+    release_chain(Removed);
+
+    Result = Posted == Transacted + Canceled + Expired + Drained;
+    for (UINT32 I = 0; ShardCount > I; I++)
+        Result = Result && 0 == Queue.Shards[I].Count;
+    Result = Result && 0 == atomic_load(&Queue.Count) && 0 == atomic_load(&Queue.Mask);
+    for (UINT64 I = 0; ItemCount > I; I++)
+        Result = Result && ItemFree == atomic_load(&Items[I].State);
+
+    Total = Transacted;
+    printf("shards=%-3u posters=%u transacters=%u ops/s=%.0f stolen=%.1f%% "
+        "canceled=%llu expired=%llu rejected=%llu "
+        "latency(ns) p50<%llu p99<%llu p99.9<%llu %s\n",
+        ShardCount, Config.Posters, Config.Transacters,
+        Transacted / Elapsed,
+        0 != Total ? 100.0 * Stolen / Total : 0.0,
+        (unsigned long long)Canceled, (unsigned long long)Expired,
+        (unsigned long long)Rejected,
+        (unsigned long long)percentile(Total, 0.50),
+        (unsigned long long)percentile(Total, 0.99),
+        (unsigned long long)percentile(Total, 0.999),
+        Result ? "ok" : "FAILED");
+
+    queue_fini(&Queue);
+    free(Threads);
+    free(Items);
+
+    return Result;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: ioqshard [-p processors] [-t posters] [-x transacters] [-s seconds]\n"
+        "                [-c cancelpermille] [-q capacity] [-n itemsperposter]\n"
+        "    -p processors   pretend to have this many processors (default: real ones)\n"
+        "    -t posters      posting threads (default: number of processors)\n"
+        "    -x transacters  transacting threads (default: number of processors)\n"
+        "    -s seconds      duration of each run (default: 3)\n"
+        "    -c permille     cancelation attempts per thousand canceler steps (default: 10)\n"
+        "    -q capacity     pending queue capacity (default: 1000)\n"
+        "    -n items        items per poster (default: 64)\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    int Result;
+
+    Config.Processors = (unsigned)sysconf(_SC_NPROCESSORS_ONLN);
+    if (0 == Config.Processors)
+        Config.Processors = 1;
+
+    for (int I = 1; argc > I; I++)
+    {
+        if (argc <= I + 1 || '-' != argv[I][0] || 0 != argv[I][2])
+            usage();
+        unsigned long Value = strtoul(argv[++I], 0, 0);
+        switch (argv[I - 1][1])
+        {
+        case 'p': Config.Processors = (unsigned)Value; break;
+        case 't': Config.Posters = (unsigned)Value; break;
+        case 'x': Config.Transacters = (unsigned)Value; break;
+        case 's': Config.Seconds = (unsigned)Value; break;
+        case 'c': Config.CancelPerMille = (unsigned)Value; break;
+        case 'q': Config.Capacity = (long)Value; break;
+        case 'n': Config.ItemsPerPoster = (unsigned)Value; break;
+        default: usage();
+        }
+    }
+    if (0 == Config.Posters)
+        Config.Posters = Config.Processors;
+    if (0 == Config.Transacters)
+        Config.Transacters = Config.Processors;
+    if (0 == Config.Processors || 0 == Config.ItemsPerPoster || 0 == Config.Capacity)
+        usage();
+
+    shard_test();
+
+    Result = run(1);
+    Result = run(FspIoqShardCount(Config.Processors)) && Result;
+
+    return Result ? 0 : 1;
+}
@@ -0,0 +1,429 @@
+/**
+ * @file metadedup.c
+ *
+ * Meta cache content deduplication tests and report.
+ *
+ * @copyright 2015-2026 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this software
+ * in accordance with the commercial license agreement provided in
+ * conjunction with the software.  The terms and conditions of any such
+ * commercial license agreement shall govern, supersede, and render
+ * ineffective any application of the GPLv3 license to this software,
+ * notwithstanding of any reference thereto in the software or
+ * associated repository.
+ */
+
+/*
+ * Unit tests for shared/ku/metadedup.h followed by a report of security cache
+ * memory use and hit ratio on a synthetic 1M file workload, with and without
+ * deduplication. Builds on any platform with a C99 compiler (see the Makefile).
+ *
+ * The workload models a volume where most files inherit one of a few security
+ * descriptors from their directory tree, some belong to per-user trees and a few
+ * have explicit descriptors. The cache model mirrors sys/meta.c: each cached file
+ * is an item that is charged its overhead plus, unless the content is already
+ * interned, the descriptor size.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef void VOID;
+typedef unsigned char BOOLEAN;
+typedef uint8_t UINT8;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+
+#include <shared/ku/metadedup.h>
+#include <shared/ku/metapolicy.h>
+
+#define CONTAINING_RECORD(P, T, F)      ((T *)((char *)(P) - offsetof(T, F)))
+
+#define ASSERT(e)                       \
+    ((e) ? (void)0 : (fprintf(stderr, "%s:%d: ASSERT(%s) failed\n", __FILE__, __LINE__, #e), abort()))
+
+typedef struct
+{
+    FSP_META_DEDUP_ENTRY DedupEntry;
+    UINT32 RefCount;
+    UINT8 Data[];
+} BUFFER;
+
+static BUFFER *buffer_new(const void *Data, UINT32 Size)
+{
+    BUFFER *Buffer = malloc(sizeof *Buffer + Size);
+    if (0 == Buffer)
+        abort();
+    memset(Buffer, 0, sizeof *Buffer);
+    Buffer->RefCount = 1;
+    memcpy(Buffer->Data, Data, Size);
+    return Buffer;
+}
+
+static void dedup_hash_test(void)
+{
+    /* FNV-1a test vectors */
+    ASSERT(0x811c9dc5 == FspMetaDedupHash("", 0));
+    ASSERT(0xe40c292c == FspMetaDedupHash("a", 1));
+    ASSERT(0xbf9cf968 == FspMetaDedupHash("foobar", 6));
+}
+
+static void dedup_insert_lookup_test(void)
+{
+    FSP_META_DEDUP_ENTRY *Buckets[8];
+    FSP_META_DEDUP_TABLE Table;
+    BUFFER *B0, *B1, *B2;
+    UINT32 H0, H1, H2;
+
+    FspMetaDedupInitialize(&Table, Buckets, 8, offsetof(BUFFER, Data));
+    ASSERT(0 == Table.EntryCount && 0 == Table.EntryBytes);
+
+    B0 = buffer_new("hello", 5);
+    B1 = buffer_new("world", 5);
+    B2 = buffer_new("hello!", 6);
+    H0 = FspMetaDedupHash(B0->Data, 5);
+    H1 = FspMetaDedupHash(B1->Data, 5);
+    H2 = FspMetaDedupHash(B2->Data, 6);
+
+    ASSERT(0 == FspMetaDedupLookup(&Table, H0, "hello", 5, 0));
+
+    FspMetaDedupInsert(&Table, H0, &B0->DedupEntry, 5);
+    FspMetaDedupInsert(&Table, H1, &B1->DedupEntry, 5);
+    FspMetaDedupInsert(&Table, H2, &B2->DedupEntry, 6);
+    ASSERT(3 == Table.EntryCount && 16 == Table.EntryBytes);
+
+    ASSERT(&B0->DedupEntry == FspMetaDedupLookup(&Table, H0, "hello", 5, 0));
+    ASSERT(&B1->DedupEntry == FspMetaDedupLookup(&Table, H1, "world", 5, 0));
+    ASSERT(&B2->DedupEntry == FspMetaDedupLookup(&Table, H2, "hello!", 6, 0));
+    /* same prefix, different size */
+    ASSERT(0 == FspMetaDedupLookup(&Table, FspMetaDedupHash("hell", 4), "hell", 4, 0));
+    /* same size, different content */
+    ASSERT(0 == FspMetaDedupLookup(&Table, FspMetaDedupHash("hellp", 5), "hellp", 5, 0));
+
+    FspMetaDedupRemove(&Table, &B1->DedupEntry);
+    ASSERT(2 == Table.EntryCount && 11 == Table.EntryBytes);
+    ASSERT(0 == FspMetaDedupLookup(&Table, H1, "world", 5, 0));
+    ASSERT(&B0->DedupEntry == FspMetaDedupLookup(&Table, H0, "hello", 5, 0));
+
+    /* removing an entry that is not in the table is harmless */
+    FspMetaDedupRemove(&Table, &B1->DedupEntry);
+    ASSERT(2 == Table.EntryCount);
+
+    FspMetaDedupRemove(&Table, &B0->DedupEntry);
+    FspMetaDedupRemove(&Table, &B2->DedupEntry);
+    ASSERT(0 == Table.EntryCount && 0 == Table.EntryBytes);
+    for (int I = 0; 8 > I; I++)
+        ASSERT(0 == Buckets[I]);
+
+    free(B0);
+    free(B1);
+    free(B2);
+}
+
+static void dedup_collision_test(void)
+{
+    /* a single bucket: everything collides */
+    FSP_META_DEDUP_ENTRY *Buckets[1];
+    FSP_META_DEDUP_TABLE Table;
+    BUFFER *Buffers[100];
+    char Data[32];
+
+    FspMetaDedupInitialize(&Table, Buckets, 1, offsetof(BUFFER, Data));
+    for (int I = 0; 100 > I; I++)
+    {
+        UINT32 Size = (UINT32)snprintf(Data, sizeof Data, "content-%d", I);
+        Buffers[I] = buffer_new(Data, Size);
+        FspMetaDedupInsert(&Table, FspMetaDedupHash(Data, Size), &Buffers[I]->DedupEntry, Size);
+    }
+    for (int I = 0; 100 > I; I++)
+    {
+        UINT32 Size = (UINT32)snprintf(Data, sizeof Data, "content-%d", I);
+        ASSERT(&Buffers[I]->DedupEntry ==
+            FspMetaDedupLookup(&Table, FspMetaDedupHash(Data, Size), Data, Size, 0));
+    }
+    for (int I = 0; 100 > I; I += 2)
+        FspMetaDedupRemove(&Table, &Buffers[I]->DedupEntry);
+    for (int I = 0; 100 > I; I++)
+    {
+        UINT32 Size = (UINT32)snprintf(Data, sizeof Data, "content-%d", I);
+        ASSERT((I & 1 ? &Buffers[I]->DedupEntry : 0) ==
+            FspMetaDedupLookup(&Table, FspMetaDedupHash(Data, Size), Data, Size, 0));
+    }
+    ASSERT(50 == Table.EntryCount);
+    for (int I = 0; 100 > I; I++)
+    {
+        if (I & 1)
+            FspMetaDedupRemove(&Table, &Buffers[I]->DedupEntry);
+        free(Buffers[I]);
+    }
+    ASSERT(0 == Table.EntryCount && 0 == Buckets[0]);
+}
+
+static void dedup_dying_test(void)
+{
+    /* a dying entry (RefCount 0) is skipped by continuing the lookup after it */
+    FSP_META_DEDUP_ENTRY *Buckets[4], *Entry;
+    FSP_META_DEDUP_TABLE Table;
+    BUFFER *Dying, *Live;
+    UINT32 Hash = FspMetaDedupHash("same", 4);
+
+    FspMetaDedupInitialize(&Table, Buckets, 4, offsetof(BUFFER, Data));
+    Live = buffer_new("same", 4);
+    Dying = buffer_new("same", 4);
+    FspMetaDedupInsert(&Table, Hash, &Live->DedupEntry, 4);
+    FspMetaDedupInsert(&Table, Hash, &Dying->DedupEntry, 4);
+    Dying->RefCount = 0;
+
+    for (Entry = 0; 0 != (Entry = FspMetaDedupLookup(&Table, Hash, "same", 4, Entry));)
+        if (0 != CONTAINING_RECORD(Entry, BUFFER, DedupEntry)->RefCount)
+            break;
+    ASSERT(&Live->DedupEntry == Entry);
+    ASSERT(0 == FspMetaDedupLookup(&Table, Hash, "same", 4, Entry));
+
+    FspMetaDedupRemove(&Table, &Dying->DedupEntry);
+    ASSERT(&Live->DedupEntry == FspMetaDedupLookup(&Table, Hash, "same", 4, 0));
+    FspMetaDedupRemove(&Table, &Live->DedupEntry);
+    free(Dying);
+    free(Live);
+}
+
+/*
+ * Report
+ */
+
+#define FILE_COUNT                      1000000
+#define ITEM_OVERHEAD                   136     /* FspMetaCacheItemCharge(0) on x64 */
+
+typedef struct
+{
+    FSP_META_POLICY_ENTRY PolicyEntry;
+    BUFFER *Buffer;                     /* 0 if not cached */
+} FILE_NODE;
+
+typedef struct
+{
+    const char *Name;
+    BOOLEAN Dedup;
+    FSP_META_POLICY Policy;
+    FSP_META_DEDUP_TABLE Table;
+    FSP_META_DEDUP_ENTRY *Buckets[256];
+    FILE_NODE *FileNodes;
+    UINT64 HitCount, MissCount;
+    UINT64 ItemCount, BufferCount, BufferBytes, PeakBytes;
+} CACHE;
+
+static UINT32 SdCount;
+static UINT8 (*SdData)[512];
+static UINT32 *SdSize;
+
+static UINT64 next_random(UINT64 *State)
+{
+    UINT64 X = *State;
+    X ^= X << 13;
+    X ^= X >> 7;
+    X ^= X << 17;
+    return *State = X;
+}
+
+static UINT32 file_sd(UINT32 File)
+{
+    /*
+     * 90% of files inherit one of 20 common descriptors, 9% one of 1000 per-user
+     * descriptors and 1% have their own.
+     */
+    UINT32 Bucket = (File * 2654435761u) % 100;
+    if (90 > Bucket)
+        return File % 20;
+    if (99 > Bucket)
+        return 20 + File % 1000;
+    return 1020 + File / 100;
+}
+
+static void sd_init(void)
+{
+    UINT64 Random = 1;
+    SdCount = 1020 + FILE_COUNT / 100 + 1;
+    SdData = calloc(SdCount, sizeof *SdData);
+    SdSize = calloc(SdCount, sizeof *SdSize);
+    if (0 == SdData || 0 == SdSize)
+        abort();
+    for (UINT32 I = 0; SdCount > I; I++)
+    {
+        /* sizes of typical self-relative descriptors (owner, group, a few ACEs) */
+        SdSize[I] = 100 + (UINT32)(next_random(&Random) % 300);
+        for (UINT32 J = 0; SdSize[I] > J; J++)
+            SdData[I][J] = (UINT8)next_random(&Random);
+        memcpy(SdData[I], &I, sizeof I);
+    }
+}
+
+static void cache_init(CACHE *Cache, const char *Name, BOOLEAN Dedup, UINT64 Budget)
+{
+    memset(Cache, 0, sizeof *Cache);
+    Cache->Name = Name;
+    Cache->Dedup = Dedup;
+    FspMetaPolicyInitialize(&Cache->Policy, Budget);
+    FspMetaDedupInitialize(&Cache->Table, Cache->Buckets, 256, offsetof(BUFFER, Data));
+    Cache->FileNodes = calloc(FILE_COUNT, sizeof *Cache->FileNodes);
+    if (0 == Cache->FileNodes)
+        abort();
+}
+
+static void cache_release(CACHE *Cache, BUFFER *Buffer)
+{
+    if (0 == --Buffer->RefCount)
+    {
+        if (Cache->Dedup)
+            FspMetaDedupRemove(&Cache->Table, &Buffer->DedupEntry);
+        Cache->BufferCount--;
+        Cache->BufferBytes -= Buffer->DedupEntry.Size;
+        free(Buffer);
+    }
+}
+
+static void cache_access(CACHE *Cache, UINT32 File)
+{
+    FILE_NODE *FileNode = &Cache->FileNodes[File];
+    UINT32 Sd = file_sd(File), Size = SdSize[Sd], Charge = ITEM_OVERHEAD + Size;
+    FSP_META_DEDUP_ENTRY *Entry = 0;
+    BUFFER *Buffer = 0;
+
+    if (0 != FileNode->Buffer)
+    {
+        FspMetaPolicyReference(&Cache->Policy, &FileNode->PolicyEntry);
+        Cache->HitCount++;
+        return;
+    }
+    Cache->MissCount++;
+
+    if (Cache->Dedup)
+    {
+        UINT32 Hash = FspMetaDedupHash(SdData[Sd], Size);
+        Entry = FspMetaDedupLookup(&Cache->Table, Hash, SdData[Sd], Size, 0);
+        if (0 != Entry)
+        {
+            Buffer = CONTAINING_RECORD(Entry, BUFFER, DedupEntry);
+            Buffer->RefCount++;
+        }
+        else
+        {
+            Buffer = buffer_new(SdData[Sd], Size);
+            FspMetaDedupInsert(&Cache->Table, Hash, &Buffer->DedupEntry, Size);
+        }
+        /* as in meta.c the content is charged while any item refers to the buffer */
+        Charge = ITEM_OVERHEAD;
+    }
+    else
+    {
+        Buffer = buffer_new(SdData[Sd], Size);
+        Buffer->DedupEntry.Size = Size;
+    }
+    if (Buffer->RefCount == 1)
+    {
+        Cache->BufferCount++;
+        Cache->BufferBytes += Size;
+    }
+
+    while (FspMetaPolicyMustEvict(&Cache->Policy,
+        Charge + (UINT32)(Cache->Dedup ? Cache->BufferBytes : 0)))
+    {
+        FSP_META_POLICY_ENTRY *Victim = FspMetaPolicyVictim(&Cache->Policy);
+        FILE_NODE *VictimNode = CONTAINING_RECORD(Victim, FILE_NODE, PolicyEntry);
+        FspMetaPolicyEvict(&Cache->Policy, Victim);
+        cache_release(Cache, VictimNode->Buffer);
+        VictimNode->Buffer = 0;
+        Cache->ItemCount--;
+    }
+
+    FileNode->Buffer = Buffer;
+    FspMetaPolicyInsert(&Cache->Policy, &FileNode->PolicyEntry, Charge);
+    Cache->ItemCount++;
+
+    UINT64 Bytes = Cache->ItemCount * ITEM_OVERHEAD + Cache->BufferBytes;
+    if (Cache->PeakBytes < Bytes)
+        Cache->PeakBytes = Bytes;
+    ASSERT(Bytes <= Cache->Policy.Budget);
+}
+
+static void cache_report(CACHE *Cache)
+{
+    UINT64 Total = Cache->HitCount + Cache->MissCount;
+    printf("%-8s items=%llu buffers=%llu bytes=%llu peak-bytes=%llu hit-ratio=%.2f%%\n",
+        Cache->Name,
+        (unsigned long long)Cache->ItemCount,
+        (unsigned long long)Cache->BufferCount,
+        (unsigned long long)(Cache->ItemCount * ITEM_OVERHEAD + Cache->BufferBytes),
+        (unsigned long long)Cache->PeakBytes,
+        0 != Total ? 100.0 * Cache->HitCount / Total : 0.0);
+}
+
+static void report(UINT64 Budget, unsigned long AccessCount)
+{
+    CACHE Caches[2];
+    UINT64 Random = 42;
+
+    cache_init(&Caches[0], "copy", 0, Budget);
+    cache_init(&Caches[1], "dedup", 1, Budget);
+
+    printf("files=%u descriptors=%lu budget=%llu accesses=%lu\n",
+        FILE_COUNT, (unsigned long)SdCount, (unsigned long long)Budget, AccessCount);
+    for (unsigned long I = 0; AccessCount > I; I++)
+    {
+        /* skewed: a tenth of the files gets half of the accesses */
+        UINT64 R = next_random(&Random);
+        UINT32 File = (R & 1) ? (UINT32)((R >> 1) % (FILE_COUNT / 10)) : (UINT32)((R >> 1) % FILE_COUNT);
+        cache_access(&Caches[0], File);
+        cache_access(&Caches[1], File);
+    }
+    for (int I = 0; 2 > I; I++)
+    {
+        cache_report(&Caches[I]);
+        for (UINT32 File = 0; FILE_COUNT > File; File++)
+            if (0 != Caches[I].FileNodes[File].Buffer)
+                cache_release(&Caches[I], Caches[I].FileNodes[File].Buffer);
+        ASSERT(0 == Caches[I].BufferCount && 0 == Caches[I].Table.EntryCount);
+        free(Caches[I].FileNodes);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    UINT64 Budget = 256 * 1024;
+    unsigned long AccessCount = 4000000;
+
+    for (int I = 1; argc > I; I++)
+    {
+        if (0 == strcmp("-b", argv[I]) && argc > I + 1)
+            Budget = strtoull(argv[++I], 0, 0);
+        else if (0 == strcmp("-n", argv[I]) && argc > I + 1)
+            AccessCount = strtoul(argv[++I], 0, 0);
+        else
+        {
+            fprintf(stderr, "usage: metadedup [-b budget] [-n accesses]\n");
+            return 2;
+        }
+    }
+
+    dedup_hash_test();
+    dedup_insert_lookup_test();
+    dedup_collision_test();
+    dedup_dying_test();
+    printf("tests passed\n");
+
+    sd_init();
+    report(Budget, AccessCount);
+
+    return 0;
+}
@@ -0,0 +1,413 @@
+/**
+ * @file metasim.c
+ *
+ * Meta cache replacement policy simulator.
+ *
+ * @copyright 2015-2026 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this software
+ * in accordance with the commercial license agreement provided in
+ * conjunction with the software.  The terms and conditions of any such
+ * commercial license agreement shall govern, supersede, and render
+ * ineffective any application of the GPLv3 license to this software,
+ * notwithstanding of any reference thereto in the software or
+ * associated repository.
+ */
+
+/*
+ * Replays meta cache access traces against the replacement policy in
+ * shared/ku/metapolicy.h and against the FIFO policy that it replaced.
+ * Builds on any platform with a C99 compiler (see the Makefile).
+ *
+ * Trace format (one access per line; # starts a comment):
+ *     L key size       lookup key; on a miss add an item of size bytes
+ *     I key            invalidate key (e.g. the file was modified)
+ *
+ * This mirrors how the FSD uses its meta caches: a file node remembers the
+ * index of its cached item; a lookup that misses is followed by a request to
+ * the user mode file system and an add of the result.
+ *
+ * Without a trace file a synthetic workload is generated:
+ *
+ * - mixed (default): a hot set that is accessed with a skewed distribution,
+ *   interrupted by periodic sequential sweeps over cold keys (think "dir /s").
+ * - scan: a "dir /s" over a large tree that runs alongside an application that
+ *   keeps using a hot set which fits in the cache; every hot access is followed
+ *   by a few cold keys of the sweep. FIFO evicts the hot set long before it is
+ *   reused, whereas the protected segment of the policy keeps it resident.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef void VOID;
+typedef unsigned char BOOLEAN;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+
+#include <shared/ku/metapolicy.h>
+
+#define CONTAINING_RECORD(P, T, F)      ((T *)((char *)(P) - offsetof(T, F)))
+
+typedef struct _SIM_ITEM
+{
+    FSP_META_POLICY_ENTRY PolicyEntry;
+    struct _SIM_ITEM *FifoNext;
+    char *Key;
+    UINT32 Size;
+    BOOLEAN Resident;
+} SIM_ITEM;
+
+typedef struct
+{
+    const char *Name;
+    BOOLEAN Fifo;
+    FSP_META_POLICY Policy;         /* for Fifo only Budget and the counters are used */
+    UINT64 HitCount, MissCount;
+    UINT64 FirstCount;                      /* lookups of keys never seen before */
+    UINT64 RepeatCount, RepeatHitCount;     /* back-to-back lookups of the same key */
+    SIM_ITEM *LastItem;
+    SIM_ITEM *FifoHead, *FifoTail;
+    UINT64 FifoSize;
+    SIM_ITEM **Buckets;
+    size_t BucketCount;
+} SIM_CACHE;
+
+static size_t hash(const char *Key)
+{
+    size_t Hash = 2166136261;
+    for (; *Key; Key++)
+        Hash = (Hash ^ (unsigned char)*Key) * 16777619;
+    return Hash;
+}
+
+static SIM_ITEM **lookup(SIM_CACHE *Cache, const char *Key)
+{
+    /* open addressing; items are never deleted from the table, only marked non-resident */
+    size_t Index = hash(Key) & (Cache->BucketCount - 1);
+    for (;;)
+    {
+        SIM_ITEM **P = &Cache->Buckets[Index];
+        if (0 == *P || 0 == strcmp((*P)->Key, Key))
+            return P;
+        Index = (Index + 1) & (Cache->BucketCount - 1);
+    }
+}
+
+static void cache_init(SIM_CACHE *Cache, const char *Name, BOOLEAN Fifo, UINT64 Budget)
+{
+    memset(Cache, 0, sizeof *Cache);
+    Cache->Name = Name;
+    Cache->Fifo = Fifo;
+    FspMetaPolicyInitialize(&Cache->Policy, Budget);
+    Cache->BucketCount = 1 << 20;
+    Cache->Buckets = calloc(Cache->BucketCount, sizeof *Cache->Buckets);
+    if (0 == Cache->Buckets)
+        abort();
+}
+
+static void cache_remove(SIM_CACHE *Cache, SIM_ITEM *Item)
+{
+    if (Cache->Fifo)
+    {
+        SIM_ITEM **P;
+        for (P = &Cache->FifoHead; Item != *P; P = &(*P)->FifoNext)
+            ;
+        *P = Item->FifoNext;
+        if (Cache->FifoTail == Item)
+            Cache->FifoTail = P == &Cache->FifoHead ? 0 :
+                CONTAINING_RECORD(P, SIM_ITEM, FifoNext);
+        Cache->FifoSize -= Item->Size;
+    }
+    else
+        FspMetaPolicyRemove(&Cache->Policy, &Item->PolicyEntry);
+    Item->Resident = 0;
+}
+
+static void cache_evict(SIM_CACHE *Cache, UINT32 Size)
+{
+    if (Cache->Fifo)
+    {
+        while (0 != Cache->FifoHead && Cache->FifoSize + Size > Cache->Policy.Budget)
+        {
+            SIM_ITEM *Item = Cache->FifoHead;
+            Cache->FifoHead = Item->FifoNext;
+            if (0 == Cache->FifoHead)
+                Cache->FifoTail = 0;
+            Cache->FifoSize -= Item->Size;
+            Item->Resident = 0;
+            Cache->Policy.EvictionCount++;
+        }
+    }
+    else
+    {
+        while (FspMetaPolicyMustEvict(&Cache->Policy, Size))
+        {
+            FSP_META_POLICY_ENTRY *Entry = FspMetaPolicyVictim(&Cache->Policy);
+            FspMetaPolicyEvict(&Cache->Policy, Entry);
+            CONTAINING_RECORD(Entry, SIM_ITEM, PolicyEntry)->Resident = 0;
+        }
+    }
+}
+
+static void cache_lookup(SIM_CACHE *Cache, const char *Key, UINT32 Size)
+{
+    SIM_ITEM **P = lookup(Cache, Key), *Item = *P;
+    BOOLEAN Repeat = 0 != Item && Cache->LastItem == Item;
+
+    Cache->FirstCount += 0 == Item;
+    Cache->RepeatCount += Repeat;
+    if (0 != Item && Item->Resident)
+    {
+        if (!Cache->Fifo)
+            FspMetaPolicyReference(&Cache->Policy, &Item->PolicyEntry);
+        Cache->HitCount++;
+        Cache->RepeatHitCount += Repeat;
+        Cache->LastItem = Item;
+        return;
+    }
+
+    Cache->MissCount++;
+
+    if (Size > Cache->Policy.Budget)
+        return;
+
+    if (0 == Item)
+    {
+        Item = calloc(1, sizeof *Item);
+        if (0 == Item || 0 == (Item->Key = strdup(Key)))
+            abort();
+        *P = Item;
+    }
+    Cache->LastItem = Item;
+
+    cache_evict(Cache, Size);
+
+    Item->Size = Size;
+    Item->Resident = 1;
+    if (Cache->Fifo)
+    {
+        Item->FifoNext = 0;
+        if (0 != Cache->FifoTail)
+            Cache->FifoTail->FifoNext = Item;
+        else
+            Cache->FifoHead = Item;
+        Cache->FifoTail = Item;
+        Cache->FifoSize += Size;
+    }
+    else
+        FspMetaPolicyInsert(&Cache->Policy, &Item->PolicyEntry, Size);
+}
+
+static void cache_invalidate(SIM_CACHE *Cache, const char *Key)
+{
+    SIM_ITEM *Item = *lookup(Cache, Key);
+    if (0 != Item && Item->Resident)
+        cache_remove(Cache, Item);
+}
+
+static void cache_report(SIM_CACHE *Cache)
+{
+    UINT64 Total = Cache->HitCount + Cache->MissCount;
+    /* reuse: lookups of keys seen before, except for back-to-back ones */
+    UINT64 ReuseTotal = Total - Cache->FirstCount - Cache->RepeatCount;
+    UINT64 ReuseHitCount = Cache->HitCount - Cache->RepeatHitCount;
+    printf("%-8s hits=%llu misses=%llu evictions=%llu promotions=%llu hit-ratio=%.2f%% "
+        "reuse-hit-ratio=%.2f%%\n",
+        Cache->Name,
+        (unsigned long long)Cache->HitCount,
+        (unsigned long long)Cache->MissCount,
+        (unsigned long long)Cache->Policy.EvictionCount,
+        (unsigned long long)Cache->Policy.PromotionCount,
+        0 != Total ? 100.0 * Cache->HitCount / Total : 0.0,
+        0 != ReuseTotal ? 100.0 * ReuseHitCount / ReuseTotal : 0.0);
+}
+
+static void sim_access(SIM_CACHE *Caches, size_t CacheCount, FILE *Output,
+    char Op, const char *Key, UINT32 Size)
+{
+    if (0 != Output)
+    {
+        if ('L' == Op)
+            fprintf(Output, "L %s %lu\n", Key, (unsigned long)Size);
+        else
+            fprintf(Output, "I %s\n", Key);
+        return;
+    }
+
+    for (size_t I = 0; CacheCount > I; I++)
+        if ('L' == Op)
+            cache_lookup(&Caches[I], Key, Size);
+        else
+            cache_invalidate(&Caches[I], Key);
+}
+
+static int replay(SIM_CACHE *Caches, size_t CacheCount, FILE *Input)
+{
+    char Line[4096], Key[4096];
+    unsigned long Size;
+    unsigned long LineNumber = 0;
+
+    while (0 != fgets(Line, sizeof Line, Input))
+    {
+        LineNumber++;
+        if ('#' == Line[0] || '\n' == Line[0] || '\r' == Line[0])
+            continue;
+        if ('L' == Line[0] && 2 == sscanf(Line + 1, "%4095s %lu", Key, &Size))
+            sim_access(Caches, CacheCount, 0, 'L', Key, (UINT32)Size);
+        else if ('I' == Line[0] && 1 == sscanf(Line + 1, "%4095s", Key))
+            sim_access(Caches, CacheCount, 0, 'I', Key, 0);
+        else
+        {
+            fprintf(stderr, "metasim: bad trace line %lu\n", LineNumber);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void synthesize(SIM_CACHE *Caches, size_t CacheCount, FILE *Output,
+    unsigned long Count, unsigned long HotCount, unsigned long SweepCount, UINT32 Size)
+{
+    char Key[64];
+    unsigned long Sweep = 0;
+    UINT64 Random = 42;
+
+    for (unsigned long I = 0; Count > I; I++)
+    {
+        if (0 == I % (Count / 10 + 1) && 0 != I)
+        {
+            /* a sweep over cold keys that are never seen again */
+            for (unsigned long J = 0; SweepCount > J; J++)
+            {
+                snprintf(Key, sizeof Key, "/cold/%lu/%lu", Sweep, J);
+                /* a directory enumeration references its DirInfo back-to-back */
+                sim_access(Caches, CacheCount, Output, 'L', Key, Size);
+                sim_access(Caches, CacheCount, Output, 'L', Key, Size);
+            }
+            Sweep++;
+        }
+
+        /* skewed: half of the accesses go to the first eighth of the hot set */
+        Random = Random * 6364136223846793005ULL + 1442695040888963407ULL;
+        unsigned long K = (unsigned long)(Random >> 33);
+        K = (K & 1) ? K % (HotCount / 8 + 1) : K % HotCount;
+        snprintf(Key, sizeof Key, "/hot/%lu", K);
+        sim_access(Caches, CacheCount, Output, 'L', Key, Size);
+
+        /* occasionally a hot file changes */
+        if (0 == (Random >> 40) % 100)
+            sim_access(Caches, CacheCount, Output, 'I', Key, 0);
+    }
+}
+
+static void synthesize_scan(SIM_CACHE *Caches, size_t CacheCount, FILE *Output,
+    unsigned long Count, unsigned long HotCount, unsigned long ScanRatio, UINT32 Size)
+{
+    char Key[64];
+    unsigned long Cold = 0;
+    UINT64 Random = 42;
+
+    for (unsigned long I = 0; Count > I; I++)
+    {
+        Random = Random * 6364136223846793005ULL + 1442695040888963407ULL;
+        snprintf(Key, sizeof Key, "/hot/%lu", (unsigned long)(Random >> 33) % HotCount);
+        sim_access(Caches, CacheCount, Output, 'L', Key, Size);
+
+        /* the sweep never comes back to a key */
+        for (unsigned long J = 0; ScanRatio > J; J++, Cold++)
+        {
+            snprintf(Key, sizeof Key, "/scan/%lu/%lu", Cold / 1000, Cold % 1000);
+            sim_access(Caches, CacheCount, Output, 'L', Key, Size);
+            sim_access(Caches, CacheCount, Output, 'L', Key, Size);
+        }
+    }
+}
+
+static void synthesize_workload(SIM_CACHE *Caches, size_t CacheCount, FILE *Output,
+    int Scan)
+{
+    if (Scan)
+        synthesize_scan(Caches, CacheCount, Output, 250000, 600, 2, 4096);
+    else
+        synthesize(Caches, CacheCount, Output, 1000000, 700, 2000, 4096);
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: metasim [-b budget] [-t tracefile|-] [-w mixed|scan] [-g]\n"
+        "    -b budget       cache budget in bytes (default: 4194304)\n"
+        "    -t tracefile    replay trace (- for stdin); default: synthetic workload\n"
+        "    -w workload     synthetic workload (default: mixed)\n"
+        "    -g              write the synthetic workload as a trace to stdout\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    SIM_CACHE Caches[2];
+    UINT64 Budget = 4 * 1024 * 1024;
+    const char *TracePath = 0;
+    int Generate = 0, Scan = 0, Result = 0;
+
+    for (int I = 1; argc > I; I++)
+    {
+        if (0 == strcmp("-b", argv[I]) && argc > I + 1)
+            Budget = strtoull(argv[++I], 0, 0);
+        else if (0 == strcmp("-t", argv[I]) && argc > I + 1)
+            TracePath = argv[++I];
+        else if (0 == strcmp("-w", argv[I]) && argc > I + 1)
+        {
+            I++;
+            if (0 == strcmp("scan", argv[I]))
+                Scan = 1;
+            else if (0 != strcmp("mixed", argv[I]))
+                usage();
+        }
+        else if (0 == strcmp("-g", argv[I]))
+            Generate = 1;
+        else
+            usage();
+    }
+
+    if (Generate)
+    {
+        synthesize_workload(0, 0, stdout, Scan);
+        return 0;
+    }
+
+    cache_init(&Caches[0], "fifo", 1, Budget);
+    cache_init(&Caches[1], "slru", 0, Budget);
+
+    if (0 != TracePath)
+    {
+        FILE *Input = 0 == strcmp("-", TracePath) ? stdin : fopen(TracePath, "r");
+        if (0 == Input)
+        {
+            perror(TracePath);
+            return 1;
+        }
+        Result = replay(Caches, 2, Input);
+        if (stdin != Input)
+            fclose(Input);
+    }
+    else
+        synthesize_workload(Caches, 2, 0, Scan);
+
+    for (size_t I = 0; 2 > I; I++)
+        cache_report(&Caches[I]);
+
+    return Result;
+}
@@ -0,0 +1,303 @@
+/**
+ * @file metastress.c
+ *
+ * Meta cache concurrency stress test and benchmark.
+ *
+ * @copyright 2015-2026 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this software
+ * in accordance with the commercial license agreement provided in
+ * conjunction with the software.  The terms and conditions of any such
+ * commercial license agreement shall govern, supersede, and render
+ * ineffective any application of the GPLv3 license to this software,
+ * notwithstanding of any reference thereto in the software or
+ * associated repository.
+ */
+
+/*
+ * Builds the FSD's sys/meta.c unchanged against the user mode stand-in in
+ * sys/driver.h and hammers it from multiple threads (see the Makefile).
+ *
+ * The threads share a table of keys, each of which remembers the index of its
+ * cached item, the way a file node remembers its security or DirInfo index:
+ * a lookup that misses adds a new item and publishes its index; a write
+ * invalidates the item. With -d the cache interns buffers by content and keys
+ * share a small number of distinct contents, the way files share security
+ * descriptors. The contents of every item that is found are verified,
+ * so that a reader that sees an item after it has been reclaimed is likely to
+ * be caught (more so when built with -fsanitize=address). At the end all memory
+ * allocated by the cache must have been freed.
+ */
+
+#include <sys/driver.h>
+#include <stdatomic.h>
+
+ULONG FspProcessorCount;
+__thread int FspVirtualProcessorNumber = -1;
+volatile LONG FspAllocCount;
+
+typedef struct
+{
+    UINT64 Variant;
+    UINT64 Stamp;
+    UINT32 Size;
+} ITEM_HEADER;
+
+static struct
+{
+    unsigned Processors;
+    unsigned Threads;
+    unsigned Seconds;
+    unsigned KeyCount;
+    unsigned ReadPercent;
+    unsigned Dedup;
+    ULONG Budget;
+    ULONG ItemSizeMax;
+    UINT64 Timeout;
+} Config =
+{
+    .Processors = 0,
+    .Threads = 0,
+    .Seconds = 5,
+    .KeyCount = 4096,
+    .ReadPercent = 95,
+    .Dedup = 0,
+    .Budget = 4 * 1024 * 1024,
+    .ItemSizeMax = 4096,
+    .Timeout = 1000000,                 /* 100ms in 100ns units */
+};
+
+static FSP_META_CACHE *MetaCache;
+static _Atomic UINT64 *KeyIndexes;
+static atomic_int Stop;
+static atomic_ullong Lookups, Hits, Adds, Invalidates, Errors;
+
+static inline UINT64 next_random(UINT64 *State)
+{
+    UINT64 X = *State;
+    X ^= X << 13;
+    X ^= X >> 7;
+    X ^= X << 17;
+    return *State = X;
+}
+
+static UINT8 pattern(const ITEM_HEADER *Header)
+{
+    return (UINT8)(Header->Variant * 31 + Header->Stamp);
+}
+
+static UINT64 variant(UINT64 Key)
+{
+    /* with -d keys share one of Config.Dedup contents */
+    return 0 != Config.Dedup ? Key % Config.Dedup : Key;
+}
+
+static BOOLEAN verify(UINT64 Key, PCVOID Buffer, ULONG Size)
+{
+    const ITEM_HEADER *Header = Buffer;
+    const UINT8 *Bytes = Buffer;
+    UINT8 Pattern;
+
+    if (sizeof *Header > Size || Header->Variant != variant(Key) || Header->Size != Size)
+        return FALSE;
+    Pattern = pattern(Header);
+    for (ULONG I = sizeof *Header; Size > I; I++)
+        if (Pattern != Bytes[I])
+            return FALSE;
+    return TRUE;
+}
+
+static UINT64 add(UINT64 Key, UINT64 *Random)
+{
+    UINT8 Buffer[65536];
+    ITEM_HEADER *Header = (PVOID)Buffer;
+    UINT64 Variant = variant(Key);
+    UINT64 Stamp = 0 != Config.Dedup ? Variant * 0x9E3779B97F4A7C15ULL : next_random(Random);
+    ULONG Size = sizeof *Header +
+        (ULONG)(Stamp % (Config.ItemSizeMax - FspMetaCacheItemHeaderSize - sizeof *Header));
+
+    Header->Variant = Variant;
+    Header->Stamp = Stamp;
+    Header->Size = Size;
+    memset(Buffer + sizeof *Header, pattern(Header), Size - sizeof *Header);
+
+    return FspMetaCacheAddItem(MetaCache, Buffer, Size);
+}
+
+static void *worker(void *Data)
+{
+    UINT64 Random = 0x9E3779B97F4A7C15ULL * ((uintptr_t)Data + 1);
+    UINT64 LocalLookups = 0, LocalHits = 0, LocalAdds = 0, LocalInvalidates = 0, LocalErrors = 0;
+    UINT64 Key, ItemIndex, NewIndex, Expected;
+    PCVOID Buffer;
+    ULONG Size;
+
+    if (0 != Config.Processors)
+        FspVirtualProcessorNumber = (int)((uintptr_t)Data % Config.Processors);
+
+    while (!atomic_load_explicit(&Stop, memory_order_relaxed))
+    {
+        /* skewed: half of the accesses go to the first sixteenth of the keys */
+        Key = next_random(&Random);
+        Key = (Key & 1) ? (Key >> 1) % (Config.KeyCount / 16 + 1) : (Key >> 1) % Config.KeyCount;
+
+        if (next_random(&Random) % 100 < Config.ReadPercent)
+        {
+            LocalLookups++;
+            ItemIndex = atomic_load(&KeyIndexes[Key]);
+            if (FspMetaCacheReferenceItemBuffer(MetaCache, ItemIndex, &Buffer, &Size))
+            {
+                LocalHits++;
+                if (!verify(Key, Buffer, Size))
+                    LocalErrors++;
+                FspMetaCacheDereferenceItemBuffer(Buffer);
+                continue;
+            }
+
+            /* miss: go to the "file system" and cache the result */
+            NewIndex = add(Key, &Random);
+            LocalAdds++;
+            Expected = ItemIndex;
+            if (0 != NewIndex &&
+                !atomic_compare_exchange_strong(&KeyIndexes[Key], &Expected, NewIndex))
+                FspMetaCacheInvalidateItem(MetaCache, NewIndex);
+        }
+        else
+        {
+            /* the "file" changed */
+            ItemIndex = atomic_exchange(&KeyIndexes[Key], 0);
+            FspMetaCacheInvalidateItem(MetaCache, ItemIndex);
+            LocalInvalidates++;
+        }
+    }
+
+    atomic_fetch_add(&Lookups, LocalLookups);
+    atomic_fetch_add(&Hits, LocalHits);
+    atomic_fetch_add(&Adds, LocalAdds);
+    atomic_fetch_add(&Invalidates, LocalInvalidates);
+    atomic_fetch_add(&Errors, LocalErrors);
+    return 0;
+}
+
+static void *expirer(void *Data)
+{
+    struct timespec Delay = { 0, 10 * 1000 * 1000 };
+    while (!atomic_load_explicit(&Stop, memory_order_relaxed))
+    {
+        /* the FSD calls this from its expiration timer */
+        FspMetaCacheInvalidateExpired(MetaCache, KeQueryInterruptTime());
+        nanosleep(&Delay, 0);
+    }
+    return 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: metastress [-p processors] [-t threads] [-s seconds] [-k keys]\n"
+        "                  [-r readpercent] [-d contents] [-b budget] [-m itemsizemax]\n"
+        "    -p processors   pretend to have this many processors; threads are\n"
+        "                    spread over them round robin (default: real ones)\n"
+        "    -t threads      worker threads (default: number of processors)\n"
+        "    -s seconds      duration (default: 5)\n"
+        "    -k keys         number of keys (default: 4096)\n"
+        "    -r readpercent  lookups vs invalidations (default: 95)\n"
+        "    -d contents     dedup cache; keys share this many contents (default: off)\n"
+        "    -b budget       cache budget in bytes (default: 4194304)\n"
+        "    -m itemsizemax  maximum item size (default: 4096)\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    pthread_t *Threads, Expirer;
+    LARGE_INTEGER Timeout;
+    struct timespec Duration;
+    UINT64 Start;
+    double Elapsed;
+    NTSTATUS Result;
+
+    FspProcessorCount = (ULONG)sysconf(_SC_NPROCESSORS_ONLN);
+    if (0 == FspProcessorCount)
+        FspProcessorCount = 1;
+    Config.Threads = FspProcessorCount;
+
+    for (int I = 1; argc > I; I++)
+    {
+        if (argc <= I + 1 || '-' != argv[I][0] || 0 != argv[I][2])
+            usage();
+        unsigned long Value = strtoul(argv[++I], 0, 0);
+        switch (argv[I - 1][1])
+        {
+        case 'p': Config.Processors = (unsigned)Value; break;
+        case 't': Config.Threads = (unsigned)Value; break;
+        case 's': Config.Seconds = (unsigned)Value; break;
+        case 'k': Config.KeyCount = (unsigned)Value; break;
+        case 'r': Config.ReadPercent = (unsigned)Value; break;
+        case 'd': Config.Dedup = (unsigned)Value; break;
+        case 'b': Config.Budget = (ULONG)Value; break;
+        case 'm': Config.ItemSizeMax = (ULONG)Value; break;
+        default: usage();
+        }
+    }
+    if (0 != Config.Processors)
+        FspProcessorCount = Config.Processors;
+    if (0 == Config.Threads || 0 == Config.KeyCount || 100 < Config.ReadPercent ||
+        FspMetaCacheItemHeaderSize + sizeof(ITEM_HEADER) + 1 > Config.ItemSizeMax ||
+        65536 < Config.ItemSizeMax)
+        usage();
+
+    Timeout.QuadPart = (int64_t)Config.Timeout;
+    Result = FspMetaCacheCreate(Config.Budget, Config.ItemSizeMax,
+        0 != Config.Dedup ? FspMetaCacheDedup : 0, &Timeout, &MetaCache);
+    if (STATUS_SUCCESS != Result || 0 == MetaCache)
+    {
+        fprintf(stderr, "metastress: cannot create meta cache\n");
+        return 1;
+    }
+
+    KeyIndexes = calloc(Config.KeyCount, sizeof *KeyIndexes);
+    Threads = calloc(Config.Threads, sizeof *Threads);
+    if (0 == KeyIndexes || 0 == Threads)
+        abort();
+
+    Start = KeQueryInterruptTime();
+    for (unsigned I = 0; Config.Threads > I; I++)
+        if (0 != pthread_create(&Threads[I], 0, worker, (void *)(uintptr_t)I))
+            abort();
+    if (0 != pthread_create(&Expirer, 0, expirer, 0))
+        abort();
+
+    Duration.tv_sec = Config.Seconds;
+    Duration.tv_nsec = 0;
+    nanosleep(&Duration, 0);
+    atomic_store(&Stop, 1);
+
+    for (unsigned I = 0; Config.Threads > I; I++)
+        pthread_join(Threads[I], 0);
+    pthread_join(Expirer, 0);
+    Elapsed = (KeQueryInterruptTime() - Start) / 1e7;
+
+    FspMetaCacheDelete(MetaCache);
+
+    printf("processors=%lu threads=%u lookups=%llu hits=%llu adds=%llu invalidates=%llu "
+        "hit-ratio=%.2f%% ops/s=%.0f errors=%llu leaks=%ld\n",
+        FspProcessorCount, Config.Threads,
+        (unsigned long long)Lookups, (unsigned long long)Hits,
+        (unsigned long long)Adds, (unsigned long long)Invalidates,
+        0 != Lookups ? 100.0 * Hits / Lookups : 0.0,
+        (Lookups + Invalidates) / Elapsed,
+        (unsigned long long)Errors, (long)FspAllocCount);
+
+    free(Threads);
+    free(KeyIndexes);
+
+    return 0 == Errors && 0 == FspAllocCount ? 0 : 1;
+}
@@ -0,0 +1,182 @@
+/**
+ * @file sys/driver.h
+ *
+ * Minimal stand-in for the FSD's sys/driver.h that allows sys/meta.c to be
+ * built and stressed in user mode on POSIX systems (see metastress.c).
+ *
+ * @copyright 2015-2026 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this software
+ * in accordance with the commercial license agreement provided in
+ * conjunction with the software.  The terms and conditions of any such
+ * commercial license agreement shall govern, supersede, and render
+ * ineffective any application of the GPLv3 license to this software,
+ * notwithstanding of any reference thereto in the software or
+ * associated repository.
+ */
+
+#ifndef WINFSP_SYS_DRIVER_H_INCLUDED
+#define WINFSP_SYS_DRIVER_H_INCLUDED
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* types */
+typedef void VOID;
+typedef unsigned char BOOLEAN;
+typedef uint8_t UINT8, *PUINT8;
+typedef uint32_t UINT32;
+typedef unsigned long long UINT64;
+typedef int32_t LONG, *PLONG, NTSTATUS;
+typedef unsigned long ULONG, *PULONG;      /* wider than on Windows, but printf friendly */
+typedef void *PVOID;
+typedef const void *PCVOID;
+typedef unsigned char KIRQL;
+typedef pthread_spinlock_t KSPIN_LOCK;
+typedef pthread_mutex_t FAST_MUTEX;
+typedef union { int64_t QuadPart; } LARGE_INTEGER, *PLARGE_INTEGER;
+typedef struct _LIST_ENTRY { struct _LIST_ENTRY *Flink, *Blink; } LIST_ENTRY, *PLIST_ENTRY;
+#define TRUE                            1
+#define FALSE                           0
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000L)
+#define STATUS_INSUFFICIENT_RESOURCES   ((NTSTATUS)0xC000009AL)
+#define MEMORY_ALLOCATION_ALIGNMENT     16
+
+/* compiler */
+#define __declspec(x)                   __declspec_ ## x
+#define __declspec_align(n)             __attribute__((aligned(n)))
+#define FIELD_OFFSET(T, F)              ((LONG)offsetof(T, F))
+#define CONTAINING_RECORD(P, T, F)      ((T *)((char *)(P) - offsetof(T, F)))
+#define FlagOn(F, SF)                   ((F) & (SF))
+#define FSP_FSCTL_STATIC_ASSERT(e, m)   _Static_assert(e, m)
+#define FSP_FSCTL_ALIGN_UP(x, s)        (((x) + ((s) - 1L)) & ~((s) - 1L))
+#define try                             if (1)
+#define except(f)                       else if (0)
+#define ASSERT(e)                       assert(e)
+#define DEBUGLOG(fmt, ...)              \
+    (getenv("METASTRESS_DEBUGLOG") ? (void)fprintf(stderr, "%s: " fmt "\n", __func__, __VA_ARGS__) : (void)0)
+#ifndef DBG
+#define DBG                             0
+#endif
+
+/* interlocked and barriers */
+#define InterlockedIncrement(P)         __atomic_add_fetch(P, 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement(P)         __atomic_sub_fetch(P, 1, __ATOMIC_SEQ_CST)
+#define InterlockedExchangeAdd(P, V)    __atomic_fetch_add(P, V, __ATOMIC_SEQ_CST)
+static inline LONG InterlockedCompareExchange(volatile LONG *P, LONG V, LONG C)
+{
+    __atomic_compare_exchange_n(P, &C, V, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return C;
+}
+static inline PVOID InterlockedExchangePointer(PVOID volatile *P, PVOID V)
+{
+    return __atomic_exchange_n(P, V, __ATOMIC_SEQ_CST);
+}
+#define KeMemoryBarrier()               __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+/* spin locks */
+#define KeInitializeSpinLock(L)         pthread_spin_init(L, PTHREAD_PROCESS_PRIVATE)
+#define KeAcquireSpinLock(L, PIrql)     (*(PIrql) = 0, pthread_spin_lock(L))
+#define KeReleaseSpinLock(L, Irql)      ((void)(Irql), pthread_spin_unlock(L))
+
+/* fast mutexes */
+#define ExInitializeFastMutex(M)        pthread_mutex_init(M, 0)
+#define ExAcquireFastMutex(M)           pthread_mutex_lock(M)
+#define ExReleaseFastMutex(M)           pthread_mutex_unlock(M)
+
+/* processors and time */
+extern ULONG FspProcessorCount;
+extern __thread int FspVirtualProcessorNumber;      /* -1: use the real one */
+static inline ULONG KeGetCurrentProcessorNumber(void)
+{
+    int Cpu = -1 != FspVirtualProcessorNumber ? FspVirtualProcessorNumber : sched_getcpu();
+    return 0 <= Cpu ? (ULONG)Cpu : 0;
+}
+static inline UINT64 KeQueryInterruptTime(void)
+{
+    struct timespec Ts;
+    clock_gettime(CLOCK_MONOTONIC, &Ts);
+    return (UINT64)Ts.tv_sec * 10000000 + (UINT64)Ts.tv_nsec / 100;
+}
+static inline UINT64 FspExpirationTimeFromTimeout(UINT64 Timeout)
+{
+    return 1 >= Timeout + 1 ? Timeout : KeQueryInterruptTime() + Timeout;
+}
+static inline BOOLEAN FspExpirationTimeValid2(UINT64 ExpirationTime, UINT64 CurrentTime)
+{
+    return CurrentTime < ExpirationTime;
+}
+
+/* memory; the counter lets the harness check for leaks */
+extern volatile LONG FspAllocCount;
+static inline PVOID FspAlloc(size_t Size)
+{
+    PVOID Pointer = malloc(Size);
+    if (0 != Pointer)
+        InterlockedIncrement(&FspAllocCount);
+    return Pointer;
+}
+#define FspAllocNonPaged(Size)          FspAlloc(Size)
+static inline VOID FspFree(PVOID Pointer)
+{
+    InterlockedDecrement(&FspAllocCount);
+    free(Pointer);
+}
+#define RtlZeroMemory(P, S)             memset(P, 0, S)
+#define RtlCopyMemory(D, S, N)          memcpy(D, S, N)
+
+/* lists */
+static inline VOID InitializeListHead(PLIST_ENTRY Head)
+{
+    Head->Flink = Head->Blink = Head;
+}
+static inline VOID InsertTailList(PLIST_ENTRY Head, PLIST_ENTRY Entry)
+{
+    Entry->Flink = Head;
+    Entry->Blink = Head->Blink;
+    Head->Blink->Flink = Entry;
+    Head->Blink = Entry;
+}
+static inline BOOLEAN RemoveEntryList(PLIST_ENTRY Entry)
+{
+    PLIST_ENTRY Flink = Entry->Flink, Blink = Entry->Blink;
+    Blink->Flink = Flink;
+    Flink->Blink = Blink;
+    return Flink == Blink;
+}
+
+/* meta cache; keep in sync with the real sys/driver.h */
+enum
+{
+    FspMetaCacheItemHeaderSize = 3 * MEMORY_ALLOCATION_ALIGNMENT,
+    FspMetaCacheDedup = 0x00000001,     /* intern item buffers by content */
+};
+typedef struct _FSP_META_CACHE FSP_META_CACHE;
+NTSTATUS FspMetaCacheCreate(
+    ULONG MetaBudget, ULONG ItemSizeMax, ULONG Flags, PLARGE_INTEGER MetaTimeout,
+    FSP_META_CACHE **PMetaCache);
+VOID FspMetaCacheDelete(FSP_META_CACHE *MetaCache);
+VOID FspMetaCacheInvalidateExpired(FSP_META_CACHE *MetaCache, UINT64 ExpirationTime);
+BOOLEAN FspMetaCacheReferenceItemBuffer(FSP_META_CACHE *MetaCache, UINT64 ItemIndex,
+    PCVOID *PBuffer, PULONG PSize);
+VOID FspMetaCacheDereferenceItemBuffer(PCVOID Buffer);
+UINT64 FspMetaCacheAddItem(FSP_META_CACHE *MetaCache, PCVOID Buffer, ULONG Size);
+VOID FspMetaCacheInvalidateItem(FSP_META_CACHE *MetaCache, UINT64 ItemIndex);
+
+#endif
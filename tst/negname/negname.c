@@ -0,0 +1,383 @@
+/**
+ * @file negname.c
+ *
+ * Negative name lookup table tests and report.
+ *
+ * @copyright 2015-2026 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this software
+ * in accordance with the commercial license agreement provided in
+ * conjunction with the software.  The terms and conditions of any such
+ * commercial license agreement shall govern, supersede, and render
+ * ineffective any application of the GPLv3 license to this software,
+ * notwithstanding of any reference thereto in the software or
+ * associated repository.
+ */
+
+/*
+ * Unit tests for shared/ku/negname.h followed by a report of the user mode round
+ * trips that a negative name table saves on a synthetic probing workload. Builds
+ * on any platform with a C99 compiler (see the Makefile).
+ *
+ * The workload models processes that are started repeatedly and search a PATH of
+ * several directories for a handful of DLL's, most of which only exist in the
+ * last directory, while copies of those DLL's are briefly created (and deleted
+ * again) in the other directories.
+ * The model mirrors sys/create.c: a probe that misses in the table is sent to the
+ * user mode file system and a "not found" answer is inserted with the generation
+ * that was current when the probe was sent.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef void VOID;
+typedef unsigned char BOOLEAN;
+typedef uint16_t UINT16;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+typedef uint16_t WCHAR;
+
+#include <shared/ku/negname.h>
+
+#define ASSERT(e)                       \
+    ((e) ? (void)0 : (fprintf(stderr, "%s:%d: ASSERT(%s) failed\n", __FILE__, __LINE__, #e), abort()))
+
+#define BUCKET_COUNT                    64
+
+static WCHAR upcase(WCHAR C)
+{
+    return 'a' <= C && C <= 'z' ? C - 'a' + 'A' : C;
+}
+
+static UINT32 wname(WCHAR *Buffer, const char *Name)
+{
+    UINT32 Length = (UINT32)strlen(Name);
+    for (UINT32 I = 0; Length > I; I++)
+        Buffer[I] = Name[I];
+    return Length;
+}
+
+static UINT32 free_chain(FSP_NEGNAME_ENTRY *Removed)
+{
+    UINT32 Count = 0;
+    while (0 != Removed)
+    {
+        FSP_NEGNAME_ENTRY *Next = Removed->HashNext;
+        free(Removed);
+        Removed = Next;
+        Count++;
+    }
+    return Count;
+}
+
+static BOOLEAN lookup(FSP_NEGNAME_TABLE *Table, const char *Name, UINT64 Time)
+{
+    WCHAR Buffer[1024];
+    FSP_NEGNAME_ENTRY *Removed = 0;
+    BOOLEAN Result = FspNegNameLookup(Table, Buffer, wname(Buffer, Name), Time, &Removed);
+    free_chain(Removed);
+    return Result;
+}
+
+static BOOLEAN insert_gen(FSP_NEGNAME_TABLE *Table, UINT32 Generation,
+    const char *Name, UINT64 ExpirationTime, UINT32 *PRemovedCount)
+{
+    WCHAR Buffer[1024];
+    UINT32 Length = wname(Buffer, Name);
+    FSP_NEGNAME_ENTRY *Entry = malloc(FspNegNameEntrySize(Length)), *Removed = 0;
+    BOOLEAN Result;
+    if (0 == Entry)
+        abort();
+    Result = FspNegNameInsert(Table, Generation, Entry, Buffer, Length, ExpirationTime, &Removed);
+    if (!Result)
+        free(Entry);
+    UINT32 RemovedCount = free_chain(Removed);
+    if (0 != PRemovedCount)
+        *PRemovedCount = RemovedCount;
+    return Result;
+}
+
+static BOOLEAN insert(FSP_NEGNAME_TABLE *Table, const char *Name, UINT64 ExpirationTime)
+{
+    return insert_gen(Table, FspNegNameGeneration(Table), Name, ExpirationTime, 0);
+}
+
+static UINT32 invalidate(FSP_NEGNAME_TABLE *Table, const char *Name, BOOLEAN Prefix)
+{
+    WCHAR Buffer[1024];
+    UINT32 Length = wname(Buffer, Name);
+    return free_chain(Prefix ?
+        FspNegNameInvalidatePrefix(Table, Buffer, Length) :
+        FspNegNameInvalidateName(Table, Buffer, Length));
+}
+
+static void negname_lookup_test(void)
+{
+    FSP_NEGNAME_ENTRY *Buckets[BUCKET_COUNT];
+    FSP_NEGNAME_TABLE Table;
+
+    /* case-sensitive */
+    FspNegNameInitialize(&Table, Buckets, BUCKET_COUNT, 16, 0);
+    ASSERT(!lookup(&Table, "\\foo", 0));
+    ASSERT(insert(&Table, "\\foo", 100));
+    ASSERT(insert(&Table, "\\dir\\bar", 100));
+    ASSERT(2 == Table.EntryCount);
+    ASSERT(lookup(&Table, "\\foo", 0));
+    ASSERT(lookup(&Table, "\\dir\\bar", 99));
+    ASSERT(!lookup(&Table, "\\FOO", 0));
+    ASSERT(!lookup(&Table, "\\fo", 0));
+    ASSERT(!lookup(&Table, "\\foo\\", 0));
+    ASSERT(!lookup(&Table, "\\dir", 0));
+    ASSERT(!lookup(&Table, "\\bar", 0));
+    ASSERT(2 == Table.HitCount && 6 == Table.MissCount);
+
+    /* re-inserting a name replaces its entry */
+    ASSERT(insert(&Table, "\\foo", 200));
+    ASSERT(2 == Table.EntryCount);
+    ASSERT(lookup(&Table, "\\foo", 150));
+    free_chain(FspNegNameInvalidateAll(&Table));
+    ASSERT(0 == Table.EntryCount);
+
+    /* case-insensitive: names are folded */
+    FspNegNameInitialize(&Table, Buckets, BUCKET_COUNT, 16, upcase);
+    ASSERT(insert(&Table, "\\Dir\\Foo.dll", 100));
+    ASSERT(lookup(&Table, "\\dir\\foo.DLL", 0));
+    ASSERT(lookup(&Table, "\\DIR\\FOO.DLL", 0));
+    ASSERT(!lookup(&Table, "\\dir\\foo.dl", 0));
+    ASSERT(1 == invalidate(&Table, "\\DIR\\foo.dll", 0));
+    ASSERT(!lookup(&Table, "\\Dir\\Foo.dll", 0));
+
+    /* names that are too long are not remembered */
+    {
+        char Name[FSP_NEGNAME_LENGTH_MAX + 2];
+        memset(Name, 'x', sizeof Name - 1);
+        Name[0] = '\\';
+        Name[sizeof Name - 1] = '\0';
+        ASSERT(!insert(&Table, Name, 100));
+        ASSERT(!lookup(&Table, Name, 0));
+        Name[FSP_NEGNAME_LENGTH_MAX] = '\0';
+        ASSERT(insert(&Table, Name, 100));
+        ASSERT(lookup(&Table, Name, 0));
+    }
+    free_chain(FspNegNameInvalidateAll(&Table));
+}
+
+static void negname_expiration_test(void)
+{
+    FSP_NEGNAME_ENTRY *Buckets[BUCKET_COUNT];
+    FSP_NEGNAME_TABLE Table;
+    UINT32 Generation;
+
+    FspNegNameInitialize(&Table, Buckets, BUCKET_COUNT, 16, upcase);
+    ASSERT(insert(&Table, "\\a", 10));
+    ASSERT(insert(&Table, "\\b", 20));
+    ASSERT(insert(&Table, "\\c", 30));
+    ASSERT(insert(&Table, "\\d", (UINT64)-1));
+
+    /* an expired entry is a miss and is removed by the lookup */
+    ASSERT(lookup(&Table, "\\a", 9));
+    ASSERT(!lookup(&Table, "\\a", 10));
+    ASSERT(3 == Table.EntryCount);
+
+    /* expiration sweeps from the old end and does not change the generation */
+    Generation = FspNegNameGeneration(&Table);
+    ASSERT(0 == free_chain(FspNegNameInvalidateExpired(&Table, 19)));
+    ASSERT(2 == free_chain(FspNegNameInvalidateExpired(&Table, 30)));
+    ASSERT(1 == Table.EntryCount);
+    ASSERT(Generation == FspNegNameGeneration(&Table));
+
+    /* -1 never expires */
+    ASSERT(0 == free_chain(FspNegNameInvalidateExpired(&Table, (UINT64)-2)));
+    ASSERT(lookup(&Table, "\\d", (UINT64)-2));
+    free_chain(FspNegNameInvalidateAll(&Table));
+}
+
+static void negname_eviction_test(void)
+{
+    FSP_NEGNAME_ENTRY *Buckets[BUCKET_COUNT];
+    FSP_NEGNAME_TABLE Table;
+    UINT32 RemovedCount;
+    char Name[32];
+
+    FspNegNameInitialize(&Table, Buckets, BUCKET_COUNT, 4, 0);
+    for (int I = 0; 4 > I; I++)
+    {
+        snprintf(Name, sizeof Name, "\\f%d", I);
+        ASSERT(insert(&Table, Name, 100 + I));
+    }
+    ASSERT(4 == Table.EntryCount);
+
+    /* the oldest entry is evicted */
+    ASSERT(insert_gen(&Table, FspNegNameGeneration(&Table), "\\f4", 104, &RemovedCount));
+    ASSERT(1 == RemovedCount);
+    ASSERT(4 == Table.EntryCount && 1 == Table.EvictionCount);
+    ASSERT(!lookup(&Table, "\\f0", 0));
+    ASSERT(lookup(&Table, "\\f1", 0));
+    ASSERT(lookup(&Table, "\\f4", 0));
+
+    /* replacing an entry does not evict another */
+    ASSERT(insert_gen(&Table, FspNegNameGeneration(&Table), "\\f2", 105, &RemovedCount));
+    ASSERT(1 == RemovedCount);
+    ASSERT(4 == Table.EntryCount && 1 == Table.EvictionCount);
+    ASSERT(lookup(&Table, "\\f1", 0));
+    free_chain(FspNegNameInvalidateAll(&Table));
+
+    /* zero capacity remembers nothing */
+    FspNegNameInitialize(&Table, Buckets, BUCKET_COUNT, 0, 0);
+    ASSERT(!insert(&Table, "\\f0", 100));
+    ASSERT(0 == Table.EntryCount);
+}
+
+static void negname_invalidation_test(void)
+{
+    FSP_NEGNAME_ENTRY *Buckets[BUCKET_COUNT];
+    FSP_NEGNAME_TABLE Table;
+
+    FspNegNameInitialize(&Table, Buckets, BUCKET_COUNT, 64, upcase);
+    ASSERT(insert(&Table, "\\dir", 100));
+    ASSERT(insert(&Table, "\\dir\\a", 100));
+    ASSERT(insert(&Table, "\\dir\\sub\\b", 100));
+    ASSERT(insert(&Table, "\\dir:stream", 100));
+    ASSERT(insert(&Table, "\\dir2", 100));
+    ASSERT(insert(&Table, "\\dir2\\a", 100));
+    ASSERT(insert(&Table, "\\di", 100));
+    ASSERT(insert(&Table, "\\other\\dir", 100));
+    ASSERT(8 == Table.EntryCount);
+
+    /* a create invalidates exactly its name */
+    ASSERT(1 == invalidate(&Table, "\\DIR", 0));
+    ASSERT(!lookup(&Table, "\\dir", 0));
+    ASSERT(lookup(&Table, "\\dir\\a", 0));
+    ASSERT(0 == invalidate(&Table, "\\nonexistent", 0));
+
+    /* a rename into place invalidates the name and everything below it */
+    ASSERT(3 == invalidate(&Table, "\\Dir", 1));
+    ASSERT(!lookup(&Table, "\\dir\\a", 0));
+    ASSERT(!lookup(&Table, "\\dir\\sub\\b", 0));
+    ASSERT(!lookup(&Table, "\\dir:stream", 0));
+    /* but not siblings that share a prefix of characters */
+    ASSERT(lookup(&Table, "\\dir2", 0));
+    ASSERT(lookup(&Table, "\\dir2\\a", 0));
+    ASSERT(lookup(&Table, "\\di", 0));
+    ASSERT(lookup(&Table, "\\other\\dir", 0));
+
+    /* a trailing backslash is ignored */
+    ASSERT(2 == invalidate(&Table, "\\dir2\\", 1));
+    ASSERT(2 == Table.EntryCount);
+
+    /* the root is a prefix of everything */
+    ASSERT(2 == invalidate(&Table, "\\", 1));
+    ASSERT(0 == Table.EntryCount);
+    ASSERT(8 == Table.InvalidationCount);
+}
+
+static void negname_generation_test(void)
+{
+    FSP_NEGNAME_ENTRY *Buckets[BUCKET_COUNT];
+    FSP_NEGNAME_TABLE Table;
+    UINT32 Generation;
+
+    FspNegNameInitialize(&Table, Buckets, BUCKET_COUNT, 16, upcase);
+
+    /*
+     * A probe for \x is sent to user mode (which answers "not found"), then \x is
+     * created and the create completes before the probe: the late "not found" must
+     * not be remembered.
+     */
+    Generation = FspNegNameGeneration(&Table);
+    ASSERT(0 == invalidate(&Table, "\\x", 0));
+    ASSERT(!insert_gen(&Table, Generation, "\\x", 100, 0));
+    ASSERT(!lookup(&Table, "\\x", 0));
+    ASSERT(1 == Table.StaleCount);
+
+    /* every kind of invalidation counts, even when nothing is removed */
+    Generation = FspNegNameGeneration(&Table);
+    invalidate(&Table, "\\y", 1);
+    ASSERT(Generation != FspNegNameGeneration(&Table));
+    Generation = FspNegNameGeneration(&Table);
+    free_chain(FspNegNameInvalidateAll(&Table));
+    ASSERT(Generation != FspNegNameGeneration(&Table));
+
+    /* an undisturbed probe is remembered */
+    Generation = FspNegNameGeneration(&Table);
+    ASSERT(insert_gen(&Table, Generation, "\\x", 100, 0));
+    ASSERT(lookup(&Table, "\\x", 0));
+    free_chain(FspNegNameInvalidateAll(&Table));
+}
+
+static void negname_report(UINT32 EntryCountMax, UINT64 Timeout)
+{
+    /*
+     * PATH of 8 directories; 100 process starts, each probing 12 DLL's through
+     * the PATH (found in the last directory) at 1 tick per probe; every 50 ticks
+     * a copy of one of the DLL's is created (and immediately deleted) in one of the
+     * other PATH directories.
+     */
+    enum { DirCount = 8, DllCount = 12, StartCount = 100, CreateInterval = 50 };
+    FSP_NEGNAME_ENTRY *Buckets[BUCKET_COUNT];
+    FSP_NEGNAME_TABLE Table;
+    UINT64 Time = 0, ProbeCount = 0, RoundTripCount = 0;
+    UINT32 Created = 0;
+    char Name[64];
+
+    FspNegNameInitialize(&Table, Buckets, BUCKET_COUNT, EntryCountMax, upcase);
+
+    for (int S = 0; StartCount > S; S++)
+        for (int L = 0; DllCount > L; L++)
+            for (int D = 0; DirCount > D; D++)
+            {
+                Time++;
+                ProbeCount++;
+                if (0 == Time % CreateInterval)
+                {
+                    snprintf(Name, sizeof Name, "\\path%d\\lib%d.dll",
+                        (int)(Time % (DirCount - 1)), (int)(Created++ % DllCount));
+                    invalidate(&Table, Name, 0);
+                }
+                snprintf(Name, sizeof Name, "\\path%d\\lib%d.dll", D, L);
+                if (lookup(&Table, Name, Time))
+                    continue;
+                RoundTripCount++;
+                if (DirCount - 1 != D)
+                    /* not found; the generation cannot change between send and reply here */
+                    insert(&Table, Name, Time + Timeout);
+                if (DirCount - 1 == D)
+                    break;
+            }
+
+    printf("capacity=%-5u timeout=%-6llu probes=%llu round-trips=%llu saved=%.1f%% "
+        "evictions=%llu invalidations=%llu\n",
+        (unsigned)EntryCountMax, (unsigned long long)Timeout,
+        (unsigned long long)ProbeCount, (unsigned long long)RoundTripCount,
+        100.0 * (ProbeCount - RoundTripCount) / ProbeCount,
+        (unsigned long long)Table.EvictionCount, (unsigned long long)Table.InvalidationCount);
+    free_chain(FspNegNameInvalidateAll(&Table));
+}
+
+int main(int argc, char *argv[])
+{
+    negname_lookup_test();
+    negname_expiration_test();
+    negname_eviction_test();
+    negname_invalidation_test();
+    negname_generation_test();
+    printf("negname: tests passed\n");
+
+    negname_report(0, 1000);
+    negname_report(1024, 1000);
+    negname_report(32, 1000);
+    negname_report(1024, 100);
+
+    return 0;
+}
@@ -0,0 +1,410 @@
+/**
+ * @file posixpath.c
+ *
+ * Windows/POSIX path conversion fuzz tests.
+ *
+ * @copyright 2015-2026 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this software
+ * in accordance with the commercial license agreement provided in
+ * conjunction with the software.  The terms and conditions of any such
+ * commercial license agreement shall govern, supersede, and render
+ * ineffective any application of the GPLv3 license to this software,
+ * notwithstanding of any reference thereto in the software or
+ * associated repository.
+ */
+
+/*
+ * Compares the single pass conversion kernels of shared/ku/posixpath.h (with SSE2
+ * or NEON if the compiler targets them) with the previous two pass conversion:
+ * a UTF-16 <-> UTF-8 conversion that replaces unpaired surrogates and each maximal
+ * subpart of an invalid UTF-8 sequence with U+FFFD (as WideCharToMultiByte and
+ * MultiByteToWideChar do), followed by the old translation of separators and
+ * reserved characters. The reference conversion is written independently of the
+ * kernels and follows the Unicode standard (Table 3-7) directly.
+ *
+ * Random strings are converted with and without translation, at aligned and
+ * unaligned addresses, ending right before an inaccessible page, and into
+ * buffers of every size up to the required one.
+ *
+ * Usage: posixpath [seed]. Builds on any platform with a C11 compiler and mmap
+ * (see the Makefile).
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef unsigned char BOOLEAN;
+typedef uint8_t UINT8;
+typedef uint16_t UINT16;
+typedef uint32_t UINT32;
+typedef uint32_t ULONG;
+typedef uint16_t WCHAR;
+typedef uintptr_t UINT_PTR;
+
+#include <shared/ku/posixpath.h>
+
+#define ASSERT(e)                       \
+    ((e) ? (void)0 : (fprintf(stderr, "%s:%d: ASSERT(%s) failed\n", __FILE__, __LINE__, #e), abort()))
+
+#define MAXLEN                          300
+
+static const UINT32 InvalidPathChars[4] = { 0x7fffffff, 0x2020002b, 0x00000008, 0x00000008 };
+
+static int ref_invalid(unsigned c)
+{
+    return 128 > c && (InvalidPathChars[c >> 5] & (0x80000000 >> (c & 0x1f)));
+}
+
+static ULONG ref_w2p(const WCHAR *W, char *P, BOOLEAN Translate)
+{
+    /* UTF-16 to UTF-8; unpaired surrogates become U+FFFD */
+    UINT8 *q = (UINT8 *)P, *p;
+    unsigned c;
+
+    for (; 0 != *W; W++)
+    {
+        c = *W;
+        if (0xd800 <= c && c <= 0xdbff && 0xdc00 <= W[1] && W[1] <= 0xdfff)
+            c = 0x10000 + ((c - 0xd800) << 10) + (*++W - 0xdc00);
+        else if (0xd800 <= c && c <= 0xdfff)
+            c = 0xfffd;
+
+        if (0x80 > c)
+            *q++ = c;
+        else if (0x800 > c)
+            *q++ = 0xc0 | c >> 6, *q++ = 0x80 | (c & 0x3f);
+        else if (0x10000 > c)
+            *q++ = 0xe0 | c >> 12, *q++ = 0x80 | (c >> 6 & 0x3f), *q++ = 0x80 | (c & 0x3f);
+        else
+            *q++ = 0xf0 | c >> 18, *q++ = 0x80 | (c >> 12 & 0x3f),
+            *q++ = 0x80 | (c >> 6 & 0x3f), *q++ = 0x80 | (c & 0x3f);
+    }
+    *q = '\0';
+
+    if (!Translate)
+        return (ULONG)(q - (UINT8 *)P) + 1;
+
+    /* the old translation pass over the UTF-8 */
+    for (p = (UINT8 *)P, q = p; *p; p++)
+    {
+        c = *p;
+        if ('\\' == c)
+            *q++ = '/';
+        else if (0xef == c && 0x80 == (0xfc & p[1]) && 0x80 == (0xc0 & p[2]))
+        {
+            c = ((p[1] & 0x3) << 6) | (p[2] & 0x3f);
+            if (ref_invalid(c))
+                *q++ = c, p += 2;
+            else
+                *q++ = *p++, *q++ = *p++, *q++ = *p;
+        }
+        else
+            *q++ = c;
+    }
+    *q = '\0';
+
+    return (ULONG)(q - (UINT8 *)P) + 1;
+}
+
+static unsigned ref_utf8_decode(const UINT8 *p, unsigned *PLength)
+{
+    /*
+     * Decode one character. On an ill-formed sequence return U+FFFD and consume the
+     * maximal subpart: the longest prefix of a well-formed sequence (at least one byte).
+     */
+    static const struct { UINT8 Lead0, Lead1, Lo, Hi; unsigned Length; } Table[] =
+    {
+        /* Unicode Table 3-7: Well-Formed UTF-8 Byte Sequences */
+        { 0xc2, 0xdf, 0x80, 0xbf, 2 },
+        { 0xe0, 0xe0, 0xa0, 0xbf, 3 },
+        { 0xe1, 0xec, 0x80, 0xbf, 3 },
+        { 0xed, 0xed, 0x80, 0x9f, 3 },
+        { 0xee, 0xef, 0x80, 0xbf, 3 },
+        { 0xf0, 0xf0, 0x90, 0xbf, 4 },
+        { 0xf1, 0xf3, 0x80, 0xbf, 4 },
+        { 0xf4, 0xf4, 0x80, 0x8f, 4 },
+    };
+    unsigned I, K, c;
+
+    if (0x80 > p[0])
+    {
+        *PLength = 1;
+        return p[0];
+    }
+
+    for (I = 0; sizeof Table / sizeof Table[0] > I; I++)
+        if (Table[I].Lead0 <= p[0] && p[0] <= Table[I].Lead1)
+            break;
+    if (sizeof Table / sizeof Table[0] == I)
+    {
+        *PLength = 1;
+        return 0xfffd;
+    }
+
+    if (Table[I].Lo > p[1] || p[1] > Table[I].Hi)
+    {
+        *PLength = 1;
+        return 0xfffd;
+    }
+    for (K = 2; Table[I].Length > K; K++)
+        if (0x80 > p[K] || p[K] > 0xbf)
+        {
+            *PLength = K;
+            return 0xfffd;
+        }
+
+    c = p[0] & (0xff >> (Table[I].Length + 1));
+    for (K = 1; Table[I].Length > K; K++)
+        c = c << 6 | (p[K] & 0x3f);
+    *PLength = Table[I].Length;
+    return c;
+}
+
+static ULONG ref_p2w(const char *P, WCHAR *W, BOOLEAN Translate)
+{
+    const UINT8 *p = (const UINT8 *)P;
+    WCHAR *q = W;
+    unsigned c, Length;
+
+    while (0 != *p)
+    {
+        c = ref_utf8_decode(p, &Length);
+        p += Length;
+        if (0x10000 <= c)
+        {
+            *q++ = 0xd800 + ((c - 0x10000) >> 10);
+            *q++ = 0xdc00 + ((c - 0x10000) & 0x3ff);
+        }
+        else
+            *q++ = c;
+    }
+    *q = 0;
+
+    /* the old translation pass over the UTF-16 */
+    if (Translate)
+    {
+        for (q = W; *q; q++)
+            if ('/' == *q)
+                *q = '\\';
+            else if (ref_invalid(*q))
+                *q |= 0xf000;
+    }
+
+    return (ULONG)(q - W) + 1;
+}
+
+static size_t wlen(const WCHAR *W)
+{
+    size_t N = 0;
+    while (0 != W[N])
+        N++;
+    return N;
+}
+
+static unsigned long check_count;
+
+static void check_w2p(const WCHAR *W, BOOLEAN Translate)
+{
+    char Ref[4 * MAXLEN + 1], Out[4 * MAXLEN + 1 + 16];
+    ULONG RefSize, Size, PartSize;
+
+    RefSize = ref_w2p(W, Ref, Translate);
+    ASSERT(strlen(Ref) + 1 == RefSize);
+
+    /* size query */
+    ASSERT(RefSize == FspPosixPathFromWindows(W, 0, 0, Translate));
+
+    /* large enough buffer; nothing is written past the output */
+    memset(Out, 0x5a, sizeof Out);
+    Size = FspPosixPathFromWindows(W, Out, sizeof Out - 16, Translate);
+    ASSERT(RefSize == Size);
+    ASSERT(0 == memcmp(Ref, Out, RefSize));
+    for (ULONG I = RefSize; sizeof Out > I; I++)
+        ASSERT(0x5a == (UINT8)Out[I]);
+
+    /* short buffers: the output is truncated but the size is still reported */
+    for (PartSize = RefSize > 8 ? RefSize - 8 : 0; RefSize > PartSize; PartSize++)
+    {
+        memset(Out, 0x5a, sizeof Out);
+        ASSERT(RefSize == FspPosixPathFromWindows(W, Out, PartSize, Translate));
+        ASSERT(0 == memcmp(Ref, Out, PartSize));
+        ASSERT(0x5a == (UINT8)Out[PartSize]);
+    }
+
+    check_count++;
+}
+
+static void check_p2w(const char *P, BOOLEAN Translate)
+{
+    WCHAR Ref[MAXLEN + 1], Out[MAXLEN + 1 + 16];
+    ULONG RefSize, Size, PartSize;
+
+    RefSize = ref_p2w(P, Ref, Translate);
+    ASSERT(wlen(Ref) + 1 == RefSize);
+
+    ASSERT(RefSize == FspPosixPathToWindows(P, 0, 0, Translate));
+
+    for (ULONG I = 0; sizeof Out / sizeof Out[0] > I; I++)
+        Out[I] = 0x5a5a;
+    Size = FspPosixPathToWindows(P, Out, sizeof Out / sizeof Out[0] - 16, Translate);
+    ASSERT(RefSize == Size);
+    ASSERT(0 == memcmp(Ref, Out, RefSize * sizeof(WCHAR)));
+    for (ULONG I = RefSize; sizeof Out / sizeof Out[0] > I; I++)
+        ASSERT(0x5a5a == Out[I]);
+
+    for (PartSize = RefSize > 20 ? RefSize - 20 : 0; RefSize > PartSize; PartSize++)
+    {
+        for (ULONG I = 0; sizeof Out / sizeof Out[0] > I; I++)
+            Out[I] = 0x5a5a;
+        ASSERT(RefSize == FspPosixPathToWindows(P, Out, PartSize, Translate));
+        ASSERT(0 == memcmp(Ref, Out, PartSize * sizeof(WCHAR)));
+        ASSERT(0x5a5a == Out[PartSize]);
+    }
+
+    check_count++;
+}
+
+static void known_test(void)
+{
+    static const WCHAR W0[] = { '\\', 'a', 0xf03a, 'b', 0xf05c, 0xf02f, 0xf080, 0xd800, 'c', 0 };
+    static const char P0[] = "/a:b\\\xef\x80\xaf\xef\x82\x80\xef\xbf\xbd" "c";
+    static const char P1[] = "/a:\xc0\xaf\xe0\x80\xaf\xf0\x9f\x98\x80\xed\xa0\x80\xf4\x90\x80\x80";
+    static const WCHAR W1[] =
+    {
+        '\\', 'a', 0xf03a, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xd83d, 0xde00,
+        0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0xfffd, 0
+    };
+    char P[64];
+    WCHAR W[64];
+
+    /* check the references themselves against hand converted strings */
+    ASSERT(sizeof P0 == ref_w2p(W0, P, 1));
+    ASSERT(0 == strcmp(P0, P));
+    ASSERT(sizeof W1 / sizeof W1[0] == ref_p2w(P1, W, 1));
+    ASSERT(0 == memcmp(W1, W, sizeof W1));
+
+    check_w2p(W0, 0);
+    check_w2p(W0, 1);
+    check_p2w(P0, 0);
+    check_p2w(P0, 1);
+    check_p2w(P1, 0);
+    check_p2w(P1, 1);
+}
+
+static void random_wstr(WCHAR *W, unsigned N)
+{
+    static const WCHAR Alphabet[] =
+    {
+        'a', 'Z', '0', '.', ' ', '\\', '/', ':', '*', '?', '"', '<', '>', '|',
+        0x01, 0x1f, 0x7f, 0x80, 0xe9, 0x7ff, 0x800, 0x3b1, 0x4e2d,
+        0xd800, 0xdbff, 0xdc00, 0xdfff, 0xf000, 0xf03a, 0xf05c, 0xf02f, 0xf07f, 0xf080, 0xfffd,
+        0xffff,
+    };
+    unsigned K, Mode = rand() % 4;
+
+    /* long ASCII runs (vector path) in some strings, dense special characters in others */
+    for (K = 0; N > K; K++)
+        W[K] = 0 == rand() % (0 == Mode ? 64 : 4) ?
+            Alphabet[rand() % (sizeof Alphabet / sizeof Alphabet[0])] :
+            (WCHAR)('a' + rand() % 26);
+    W[N] = 0;
+}
+
+static void random_str(char *P, unsigned N)
+{
+    static const UINT8 Alphabet[] =
+    {
+        'a', 'Z', '0', '.', ' ', '\\', '/', ':', '*', '?', '"', '<', '>', '|',
+        0x01, 0x1f, 0x7f, 0x80, 0xbf, 0xc0, 0xc1, 0xc2, 0xdf, 0xe0, 0xed, 0xef, 0xf0, 0xf4,
+        0xf5, 0xff, 0x9f, 0xa0, 0x8f, 0x90,
+    };
+    unsigned K, Mode = rand() % 4;
+
+    for (K = 0; N > K; K++)
+        P[K] = 0 == rand() % (0 == Mode ? 64 : 4) ?
+            (char)Alphabet[rand() % (sizeof Alphabet / sizeof Alphabet[0])] :
+            (char)('a' + rand() % 26);
+    P[N] = '\0';
+}
+
+static void random_test(unsigned Count)
+{
+    _Alignas(16) WCHAR WBuf[16 + MAXLEN + 1];
+    _Alignas(16) char Buf[16 + MAXLEN + 1];
+
+    for (unsigned I = 0; Count > I; I++)
+    {
+        WCHAR *W = WBuf + rand() % 8;
+        char *P = Buf + rand() % 16;
+
+        random_wstr(W, rand() % MAXLEN);
+        check_w2p(W, 0);
+        check_w2p(W, 1);
+
+        random_str(P, rand() % MAXLEN);
+        check_p2w(P, 0);
+        check_p2w(P, 1);
+    }
+}
+
+static void boundary_test(unsigned Count)
+{
+    /* strings whose NUL is the last character before an inaccessible page */
+    long PageSize = sysconf(_SC_PAGESIZE);
+    UINT8 *Pages;
+
+    Pages = mmap(0, 2 * PageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT(MAP_FAILED != Pages);
+    ASSERT(0 == mprotect(Pages + PageSize, PageSize, PROT_NONE));
+
+    for (unsigned I = 0; Count > I; I++)
+    {
+        unsigned N = rand() % 64;
+        WCHAR *W = (WCHAR *)(Pages + PageSize) - (N + 1);
+        char *P = (char *)(Pages + PageSize) - (N + 1);
+
+        random_wstr(W, N);
+        check_w2p(W, 0);
+        check_w2p(W, 1);
+
+        random_str(P, N);
+        check_p2w(P, 0);
+        check_p2w(P, 1);
+    }
+
+    ASSERT(0 == munmap(Pages, 2 * PageSize));
+}
+
+int main(int argc, char **argv)
+{
+    unsigned seed = 1 < argc ? (unsigned)strtoul(argv[1], 0, 0) : (unsigned)time(0);
+
+#if defined(FSP_POSIXPATH_SSE2)
+    printf("kernels: SSE2, seed %u\n", seed);
+#elif defined(FSP_POSIXPATH_NEON)
+    printf("kernels: NEON, seed %u\n", seed);
+#else
+    printf("kernels: scalar, seed %u\n", seed);
+#endif
+    srand(seed);
+
+    known_test();
+    random_test(20000);
+    boundary_test(20000);
+
+    printf("ok (%lu checks)\n", check_count);
+    return 0;
+}
@@ -0,0 +1,254 @@
+/**
+ * @file psslab.c
+ *
+ * Per-process buffer slab tests.
+ *
+ * @copyright 2015-2026 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this software
+ * in accordance with the commercial license agreement provided in
+ * conjunction with the software.  The terms and conditions of any such
+ * commercial license agreement shall govern, supersede, and render
+ * ineffective any application of the GPLv3 license to this software,
+ * notwithstanding of any reference thereto in the software or
+ * associated repository.
+ */
+
+/*
+ * Unit tests for shared/ku/psslab.h followed by a stress test: a number of
+ * threads acquire and release buffers from one slab the way FspProcessBufferAcquire
+ * and FspProcessBufferRelease do. The slab is an mmap(PROT_NONE) reservation that
+ * stands in for MEM_RESERVE; a slot is "committed" with mprotect, which stands in
+ * for MEM_COMMIT, so touching a slot that was never committed faults. Every thread
+ * fills its buffer with its own pattern and verifies it before releasing it, and
+ * every slot has an owner count that must never exceed one. When no slot is free
+ * the thread falls back to malloc, as the kernel falls back to a one-off
+ * allocation. Builds on any platform with a C11 compiler, pthreads and mmap (see
+ * the Makefile).
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+typedef void VOID;
+typedef unsigned char BOOLEAN;
+typedef uint8_t UINT8;
+typedef uint32_t UINT32;
+typedef uintptr_t UINT_PTR;
+
+#include <shared/ku/psslab.h>
+
+#define ASSERT(e)                       \
+    ((e) ? (void)0 : (fprintf(stderr, "%s:%d: ASSERT(%s) failed\n", __FILE__, __LINE__, #e), abort()))
+
+#define SLOT_SIZE                       (64 * 1024)
+#define BUFFER_SIZE                     (4 * 1024)  /* bytes that are filled and verified */
+
+static void pop_push_test(void)
+{
+    static UINT8 Memory[8 * 16];
+    FSP_PSSLAB Slab;
+
+    FspPsSlabInitialize(&Slab, Memory, 16, 8);
+    ASSERT(0xff == Slab.FreeMask);
+    ASSERT(0 == Slab.CommitMask);
+
+    /* lowest slot first, until exhausted */
+    for (UINT32 I = 0; 8 > I; I++)
+        ASSERT(I == FspPsSlabPop(&Slab));
+    ASSERT(FSP_PSSLAB_NO_SLOT == FspPsSlabPop(&Slab));
+    ASSERT(0 == Slab.FreeMask);
+
+    /* pushed slots are reused lowest first */
+    FspPsSlabPush(&Slab, 5);
+    FspPsSlabPush(&Slab, 2);
+    ASSERT(2 == FspPsSlabPop(&Slab));
+    ASSERT(5 == FspPsSlabPop(&Slab));
+    ASSERT(FSP_PSSLAB_NO_SLOT == FspPsSlabPop(&Slab));
+
+    /* a full mask */
+    FspPsSlabInitialize(&Slab, Memory, 1, FSP_PSSLAB_SLOT_COUNT_MAX);
+    ASSERT(~(UINT32)0 == Slab.FreeMask);
+    for (UINT32 I = 0; FSP_PSSLAB_SLOT_COUNT_MAX > I; I++)
+        ASSERT(I == FspPsSlabPop(&Slab));
+    ASSERT(FSP_PSSLAB_NO_SLOT == FspPsSlabPop(&Slab));
+    FspPsSlabPush(&Slab, FSP_PSSLAB_SLOT_COUNT_MAX - 1);
+    ASSERT(FSP_PSSLAB_SLOT_COUNT_MAX - 1 == FspPsSlabPop(&Slab));
+}
+
+static void address_test(void)
+{
+    static UINT8 Reservation[6 * 16];
+    UINT8 *Memory = Reservation + 16;
+    FSP_PSSLAB Slab;
+
+    FspPsSlabInitialize(&Slab, Memory, 16, 4);
+    for (UINT32 I = 0; 4 > I; I++)
+    {
+        ASSERT(Memory + I * 16 == FspPsSlabSlotAddress(&Slab, I));
+        ASSERT(I == FspPsSlabSlotOfAddress(&Slab, Memory + I * 16));
+    }
+
+    /* not the start of a slot or outside the slab */
+    ASSERT(FSP_PSSLAB_NO_SLOT == FspPsSlabSlotOfAddress(&Slab, Memory + 1));
+    ASSERT(FSP_PSSLAB_NO_SLOT == FspPsSlabSlotOfAddress(&Slab, Memory + 17));
+    ASSERT(FSP_PSSLAB_NO_SLOT == FspPsSlabSlotOfAddress(&Slab, Memory + 4 * 16));
+    ASSERT(FSP_PSSLAB_NO_SLOT == FspPsSlabSlotOfAddress(&Slab, Memory - 16));
+    ASSERT(FSP_PSSLAB_NO_SLOT == FspPsSlabSlotOfAddress(&Slab, 0));
+}
+
+static void commit_test(void)
+{
+    static UINT8 Memory[4 * 16];
+    FSP_PSSLAB Slab;
+
+    FspPsSlabInitialize(&Slab, Memory, 16, 4);
+    for (UINT32 I = 0; 4 > I; I++)
+        ASSERT(!FspPsSlabIsCommitted(&Slab, I));
+    FspPsSlabSetCommitted(&Slab, 1);
+    FspPsSlabSetCommitted(&Slab, 3);
+    ASSERT(!FspPsSlabIsCommitted(&Slab, 0));
+    ASSERT(FspPsSlabIsCommitted(&Slab, 1));
+    ASSERT(!FspPsSlabIsCommitted(&Slab, 2));
+    ASSERT(FspPsSlabIsCommitted(&Slab, 3));
+
+    /* committing does not affect the free mask and vice versa */
+    ASSERT(0xf == Slab.FreeMask);
+    ASSERT(0 == FspPsSlabPop(&Slab));
+    ASSERT(0xa == Slab.CommitMask);
+}
+
+typedef struct
+{
+    FSP_PSSLAB *Slab;
+    volatile UINT32 *Owners;
+    UINT32 Index;
+    UINT32 Count;
+    UINT32 FallbackCount;
+    UINT32 CommitCount;
+} STRESS_THREAD;
+
+static void *stress_thread(void *Context)
+{
+    STRESS_THREAD *Thread = Context;
+    FSP_PSSLAB *Slab = Thread->Slab;
+    UINT8 Pattern = (UINT8)(Thread->Index + 1);
+    UINT32 Slot;
+    UINT8 *Buffer;
+
+    for (UINT32 I = 0; Thread->Count > I; I++)
+    {
+        /* acquire */
+        Slot = FspPsSlabPop(Slab);
+        if (FSP_PSSLAB_NO_SLOT == Slot)
+        {
+            Buffer = malloc(BUFFER_SIZE);
+            ASSERT(0 != Buffer);
+            Thread->FallbackCount++;
+        }
+        else
+        {
+            ASSERT(1 == __atomic_add_fetch(&Thread->Owners[Slot], 1, __ATOMIC_RELAXED));
+            Buffer = FspPsSlabSlotAddress(Slab, Slot);
+            if (!FspPsSlabIsCommitted(Slab, Slot))
+            {
+                ASSERT(0 == mprotect(Buffer, SLOT_SIZE, PROT_READ | PROT_WRITE));
+                FspPsSlabSetCommitted(Slab, Slot);
+                Thread->CommitCount++;
+            }
+        }
+
+        /* use */
+        memset(Buffer, Pattern, BUFFER_SIZE);
+        for (UINT32 J = 0; BUFFER_SIZE > J; J += 64)
+            ASSERT(Pattern == Buffer[J]);
+
+        /* release */
+        if (FSP_PSSLAB_NO_SLOT == Slot)
+        {
+            ASSERT(FSP_PSSLAB_NO_SLOT == FspPsSlabSlotOfAddress(Slab, Buffer));
+            free(Buffer);
+        }
+        else
+        {
+            ASSERT(Slot == FspPsSlabSlotOfAddress(Slab, Buffer));
+            ASSERT(0 == __atomic_sub_fetch(&Thread->Owners[Slot], 1, __ATOMIC_RELAXED));
+            FspPsSlabPush(Slab, Slot);
+        }
+    }
+
+    return 0;
+}
+
+static void stress_test(UINT32 ThreadCount, UINT32 SlotCount, UINT32 Count)
+{
+    FSP_PSSLAB Slab;
+    volatile UINT32 Owners[FSP_PSSLAB_SLOT_COUNT_MAX];
+    STRESS_THREAD *Threads = calloc(ThreadCount, sizeof *Threads);
+    pthread_t *Handles = calloc(ThreadCount, sizeof *Handles);
+    UINT32 FallbackCount = 0, CommitCount = 0;
+    void *Base;
+
+    ASSERT(0 != Threads && 0 != Handles);
+    Base = mmap(0, (size_t)SlotCount * SLOT_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT(MAP_FAILED != Base);
+    FspPsSlabInitialize(&Slab, Base, SLOT_SIZE, SlotCount);
+    memset((void *)Owners, 0, sizeof Owners);
+
+    for (UINT32 I = 0; ThreadCount > I; I++)
+    {
+        Threads[I].Slab = &Slab;
+        Threads[I].Owners = Owners;
+        Threads[I].Index = I;
+        Threads[I].Count = Count;
+        ASSERT(0 == pthread_create(&Handles[I], 0, stress_thread, &Threads[I]));
+    }
+    for (UINT32 I = 0; ThreadCount > I; I++)
+    {
+        ASSERT(0 == pthread_join(Handles[I], 0));
+        FallbackCount += Threads[I].FallbackCount;
+        CommitCount += Threads[I].CommitCount;
+    }
+
+    /* all slots were returned and each was committed at most once */
+    ASSERT(FspPsSlabAllMask(SlotCount) == Slab.FreeMask);
+    ASSERT(SlotCount >= CommitCount);
+    for (UINT32 I = 0; SlotCount > I; I++)
+        ASSERT(0 == Owners[I]);
+    if (ThreadCount <= SlotCount)
+        ASSERT(0 == FallbackCount);
+
+    printf("%u thread(s), %u slots: %u committed, %u of %u acquires fell back\n",
+        ThreadCount, SlotCount, CommitCount, FallbackCount, ThreadCount * Count);
+
+    ASSERT(0 == munmap(Base, (size_t)SlotCount * SLOT_SIZE));
+    free(Handles);
+    free(Threads);
+}
+
+int main(int argc, char **argv)
+{
+    UINT32 Count = 1 < argc ? (UINT32)strtoul(argv[1], 0, 0) : 200000;
+
+    pop_push_test();
+    address_test();
+    commit_test();
+    stress_test(1, 2, Count);
+    stress_test(4, 8, Count);
+    stress_test(8, 2, Count);
+    stress_test(16, FSP_PSSLAB_SLOT_COUNT_MAX, Count / 4);
+
+    printf("ok\n");
+    return 0;
+}
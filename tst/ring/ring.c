@@ -0,0 +1,642 @@
+/**
+ * @file ring.c
+ *
+ * Shared memory ring tests and two-process benchmark.
+ *
+ * @copyright 2015-2026 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this software
+ * in accordance with the commercial license agreement provided in
+ * conjunction with the software.  The terms and conditions of any such
+ * commercial license agreement shall govern, supersede, and render
+ * ineffective any application of the GPLv3 license to this software,
+ * notwithstanding of any reference thereto in the software or
+ * associated repository.
+ */
+
+/*
+ * Unit tests for shared/ku/ring.h followed by a two-process run: the parent (in
+ * the role of the FSD) produces variable size, sequence numbered requests into
+ * the request ring of a MAP_SHARED area and the child (in the role of the file
+ * system dispatcher) answers each one through the response ring. Both sides
+ * sleep on a futex only when the ring protocol says that they may. The child
+ * checks that requests arrive in order and intact; the parent checks the same of
+ * the responses and reports the throughput and the number of sleeps and wake-ups.
+ * For comparison the same exchange is then run over a socketpair, which costs at
+ * least one system call per message on each side. Requires Linux (futex).
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef void VOID;
+typedef unsigned char BOOLEAN;
+typedef uint8_t UINT8;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+
+#include <shared/ku/ring.h>
+
+#define ASSERT(e)                       \
+    ((e) ? (void)0 : (fprintf(stderr, "%s:%d: ASSERT(%s) failed\n", __FILE__, __LINE__, #e), abort()))
+
+#define DATA_SIZE                       (64 * 1024)
+
+static UINT32 SpinCount = 1000;         /* 0 on a single processor */
+
+typedef struct
+{
+    UINT64 Seq;
+    UINT32 Size;                        /* payload size including this header */
+    UINT32 Check;                       /* response: checksum of the request */
+} MESSAGE;
+
+typedef struct
+{
+    UINT64 Sleeps, Wakeups;
+} STATS;
+
+static UINT32 request_size(UINT64 Seq)
+{
+    /* 16 .. 2047 bytes, with a few large requests */
+    UINT32 X = (UINT32)(Seq * 2654435761U) >> 7;
+    return 0 == Seq % 64 ? 8 * 1024 : sizeof(MESSAGE) + X % (2048 - sizeof(MESSAGE));
+}
+
+static UINT32 response_size(UINT64 Seq)
+{
+    return sizeof(MESSAGE) + (UINT32)(Seq % 97);
+}
+
+static void message_fill(MESSAGE *Message, UINT64 Seq, UINT32 Size, UINT32 Check)
+{
+    UINT8 *P = (UINT8 *)(Message + 1), *EndP = (UINT8 *)Message + Size;
+    Message->Seq = Seq;
+    Message->Size = Size;
+    Message->Check = Check;
+    for (UINT32 I = 0; EndP > P; P++, I++)
+        *P = (UINT8)(Seq + I * 31);
+}
+
+static UINT32 message_check(const MESSAGE *Message, UINT64 Seq, UINT32 Size)
+{
+    /* returns a checksum of a well-formed message; aborts otherwise */
+    const UINT8 *P = (const UINT8 *)(Message + 1), *EndP = (const UINT8 *)Message + Size;
+    UINT32 Check = 0;
+    ASSERT(sizeof(MESSAGE) <= Size);
+    ASSERT(Seq == Message->Seq);
+    ASSERT(Size == Message->Size);
+    for (UINT32 I = 0; EndP > P; P++, I++)
+    {
+        ASSERT((UINT8)(Seq + I * 31) == *P);
+        Check = Check * 33 + *P;
+    }
+    return Check;
+}
+
+static UINT32 request_check(UINT64 Seq)
+{
+    /* the checksum that message_check computes for request Seq */
+    UINT32 Size = request_size(Seq) - sizeof(MESSAGE), Check = 0;
+    for (UINT32 I = 0; Size > I; I++)
+        Check = Check * 33 + (UINT8)(Seq + I * 31);
+    return Check;
+}
+
+static void futex_wait(volatile UINT32 *Word, UINT32 Value)
+{
+    syscall(SYS_futex, Word, FUTEX_WAIT, Value, 0, 0, 0);
+}
+
+static void futex_wake(volatile UINT32 *Word)
+{
+    syscall(SYS_futex, Word, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+}
+
+static void ring_wait(volatile UINT32 *Flags, UINT32 Bit, STATS *Stats)
+{
+    /* the peer clears Bit before it wakes us */
+    UINT32 Value;
+    Stats->Sleeps++;
+    while (0 != ((Value = __atomic_load_n(Flags, __ATOMIC_ACQUIRE)) & Bit))
+        futex_wait(Flags, Value);
+}
+
+static void ring_wake(volatile UINT32 *Flags, STATS *Stats)
+{
+    Stats->Wakeups++;
+    futex_wake(Flags);
+}
+
+static void *area_create(UINT32 *PSize)
+{
+    UINT32 Size = FspRingAreaSize(DATA_SIZE, DATA_SIZE);
+    VOID *Area;
+
+    ASSERT(0 != Size);
+    Area = aligned_alloc(FSP_RING_CACHE_LINE_SIZE, (Size + 63) & ~63);
+    ASSERT(0 != Area);
+    ASSERT(FspRingAreaInitialize(Area, Size, DATA_SIZE, DATA_SIZE));
+    *PSize = Size;
+    return Area;
+}
+
+static void layout_test(void)
+{
+    UINT8 Area[sizeof(FSP_RING_AREA) + 2 * sizeof(FSP_RING_SHARED) + 2 * 4096]
+        __attribute__((aligned(64)));
+    FSP_RING_AREA *Header = (FSP_RING_AREA *)Area;
+    FSP_RING Ring;
+
+    ASSERT(64 == sizeof(FSP_RING_AREA));
+    ASSERT(192 == sizeof(FSP_RING_SHARED));
+    ASSERT(64 == offsetof(FSP_RING_SHARED, Head));
+    ASSERT(128 == offsetof(FSP_RING_SHARED, Flags));
+
+    ASSERT(0 == FspRingAreaSize(4096, 3000));
+    ASSERT(0 == FspRingAreaSize(2048, 4096));
+    ASSERT(0 == FspRingAreaSize(FSP_RING_DATA_SIZE_MAX, FSP_RING_DATA_SIZE_MAX));
+    ASSERT(sizeof Area == FspRingAreaSize(4096, 4096));
+    ASSERT(!FspRingAreaInitialize(Area, sizeof Area - 1, 4096, 4096));
+    ASSERT(FspRingAreaInitialize(Area, sizeof Area, 4096, 4096));
+
+    ASSERT(FspRingOpen(&Ring, Area, sizeof Area, 0, 1));
+    ASSERT((UINT8 *)Ring.Shared == Area + sizeof(FSP_RING_AREA));
+    ASSERT(4096 == Ring.DataSize);
+    ASSERT(FspRingOpen(&Ring, Area, sizeof Area, 1, 0));
+    ASSERT((UINT8 *)Ring.Shared == Area + sizeof(FSP_RING_AREA) + sizeof(FSP_RING_SHARED) + 4096);
+
+    /* a header that points outside of the area is refused */
+    ASSERT(!FspRingOpen(&Ring, Area, sizeof Area - 1, 0, 1));
+    Header->ResponseDataSize = 8192;
+    ASSERT(!FspRingOpen(&Ring, Area, sizeof Area, 1, 0));
+    Header->ResponseDataSize = 4096;
+    Header->ResponseRingOffset += 64;
+    ASSERT(!FspRingOpen(&Ring, Area, sizeof Area, 1, 0));
+    Header->ResponseRingOffset -= 64;
+    Header->Version++;
+    ASSERT(!FspRingOpen(&Ring, Area, sizeof Area, 1, 0));
+    Header->Version--;
+    ASSERT(FspRingOpen(&Ring, Area, sizeof Area, 1, 0));
+}
+
+static void wrap_test(void)
+{
+    UINT32 AreaSize;
+    VOID *Area = area_create(&AreaSize);
+    FSP_RING Producer, Consumer;
+    UINT64 ProduceSeq = 0, ConsumeSeq = 0;
+    UINT32 Size, Pads = 0;
+    VOID *Data;
+
+    ASSERT(FspRingOpen(&Producer, Area, AreaSize, 0, 1));
+    ASSERT(FspRingOpen(&Consumer, Area, AreaSize, 0, 0));
+
+    /* start near the 2^32 boundary so that the positions wrap too */
+    Producer.Position = Consumer.Position = Producer.Shared->Head = Producer.Shared->Tail =
+        (UINT32)0 - 3 * DATA_SIZE + 8;
+
+    ASSERT(0 == FspRingConsumeBegin(&Consumer, &Size) && !Consumer.Broken);
+    ASSERT(0 == FspRingProduceBegin(&Producer, FspRingRecordSizeMax(&Producer) + 1));
+    ASSERT(!Producer.Broken);
+
+    while (100000 > ConsumeSeq)
+    {
+        /* fill the ring, then drain about half of it */
+        while (0 != (Data = FspRingProduceBegin(&Producer, Size = request_size(ProduceSeq))))
+        {
+            if ((Producer.Position & (DATA_SIZE - 1)) + FSP_RING_ALIGN_UP(8 + Size) > DATA_SIZE)
+                Pads++;
+            message_fill(Data, ProduceSeq++, Size, 0);
+            FspRingProduceEnd(&Producer, Size);
+        }
+        ASSERT(!Producer.Broken);
+        ASSERT(DATA_SIZE - (Producer.Position - Producer.Shared->Head) <
+            FSP_RING_ALIGN_UP(8 + request_size(ProduceSeq)) +
+            DATA_SIZE - (Producer.Position & (DATA_SIZE - 1)));
+
+        while (ProduceSeq - ConsumeSeq > ProduceSeq % 7 &&
+            0 != (Data = FspRingConsumeBegin(&Consumer, &Size)))
+        {
+            ASSERT(request_size(ConsumeSeq) == Size);
+            message_check(Data, ConsumeSeq++, Size);
+            FspRingConsumeEnd(&Consumer, Size);
+        }
+        ASSERT(!Consumer.Broken);
+    }
+
+    while (0 != (Data = FspRingConsumeBegin(&Consumer, &Size)))
+    {
+        message_check(Data, ConsumeSeq++, Size);
+        FspRingConsumeEnd(&Consumer, Size);
+    }
+    ASSERT(!Consumer.Broken);
+    ASSERT(ProduceSeq == ConsumeSeq);
+    ASSERT(Producer.Position == Consumer.Position);
+    ASSERT((UINT32)0 - 3 * DATA_SIZE + 8 > Producer.Position);
+    ASSERT(0 != Pads);
+
+    free(Area);
+}
+
+static void malformed_test(void)
+{
+    UINT32 AreaSize;
+    VOID *Area = area_create(&AreaSize);
+    FSP_RING Producer, Consumer;
+    FSP_RING_RECORD *Record;
+    UINT32 Size, Head;
+    VOID *Data;
+
+    ASSERT(FspRingOpen(&Producer, Area, AreaSize, 0, 1));
+
+#define RESET()                         \
+    (Producer.Shared->Head = Producer.Shared->Tail = 0, Producer.Position = 0,\
+        FspRingOpen(&Consumer, Area, AreaSize, 0, 0))
+#define PRODUCE(S)                      \
+    (Data = FspRingProduceBegin(&Producer, S), ASSERT(0 != Data),\
+        memset(Data, 0, S), FspRingProduceEnd(&Producer, S))
+
+    /* tail more than a data area ahead */
+    RESET();
+    Producer.Shared->Tail = DATA_SIZE + 8;
+    ASSERT(0 == FspRingConsumeBegin(&Consumer, &Size) && Consumer.Broken);
+    ASSERT(0 == FspRingConsumeBegin(&Consumer, &Size));
+
+    /* tail behind head */
+    RESET();
+    Producer.Shared->Tail = (UINT32)-8;
+    ASSERT(0 == FspRingConsumeBegin(&Consumer, &Size) && Consumer.Broken);
+
+    /* tail in the middle of a record header */
+    RESET();
+    Producer.Shared->Tail = 4;
+    ASSERT(0 == FspRingConsumeBegin(&Consumer, &Size) && Consumer.Broken);
+
+    /* record larger than what was published */
+    RESET();
+    PRODUCE(100);
+    Record = (FSP_RING_RECORD *)Producer.Shared->Data;
+    Record->Size = 200;
+    ASSERT(0 == FspRingConsumeBegin(&Consumer, &Size) && Consumer.Broken);
+
+    /* record smaller than its header */
+    RESET();
+    PRODUCE(100);
+    Record->Size = 4;
+    ASSERT(0 == FspRingConsumeBegin(&Consumer, &Size) && Consumer.Broken);
+
+    /* record of unknown kind */
+    RESET();
+    PRODUCE(100);
+    Record->Kind = 7;
+    ASSERT(0 == FspRingConsumeBegin(&Consumer, &Size) && Consumer.Broken);
+
+    /* record larger than the maximum */
+    RESET();
+    PRODUCE(FspRingRecordSizeMax(&Producer));
+    PRODUCE(FspRingRecordSizeMax(&Producer) - 8);
+    Record->Size += 8;
+    ASSERT(0 == FspRingConsumeBegin(&Consumer, &Size) && Consumer.Broken);
+
+    /* padding that does not end at the end of the data area */
+    RESET();
+    PRODUCE(100);
+    Record->Kind = FspRingRecordPadding;
+    ASSERT(0 == FspRingConsumeBegin(&Consumer, &Size) && Consumer.Broken);
+
+    /* head ahead of the producer */
+    RESET();
+    Producer.Shared->Head = DATA_SIZE * 2;
+    ASSERT(0 == FspRingProduceBegin(&Producer, 100) && Producer.Broken);
+    Producer.Broken = 0;
+
+    /* a well-formed ring is still accepted */
+    RESET();
+    PRODUCE(100);
+    ASSERT(0 != FspRingConsumeBegin(&Consumer, &Size) && 100 == Size);
+    FspRingConsumeEnd(&Consumer, Size);
+    Head = Producer.Shared->Head;
+    ASSERT(FSP_RING_ALIGN_UP(8 + 100) == Head);
+
+#undef PRODUCE
+#undef RESET
+
+    free(Area);
+}
+
+static void wait_test(void)
+{
+    UINT32 AreaSize;
+    VOID *Area = area_create(&AreaSize);
+    FSP_RING Producer, Consumer;
+    UINT32 Size;
+    VOID *Data;
+
+    ASSERT(FspRingOpen(&Producer, Area, AreaSize, 0, 1));
+    ASSERT(FspRingOpen(&Consumer, Area, AreaSize, 0, 0));
+
+    /* no waiter: no wake-up */
+    Data = FspRingProduceBegin(&Producer, 16);
+    ASSERT(!FspRingProduceEnd(&Producer, 16));
+
+    /* a consumer may not sleep on a non-empty ring */
+    ASSERT(!FspRingConsumerPrepareWait(&Consumer));
+    ASSERT(0 == Producer.Shared->Flags);
+    Data = FspRingConsumeBegin(&Consumer, &Size);
+    ASSERT(0 != Data && 16 == Size);
+    ASSERT(!FspRingConsumeEnd(&Consumer, Size));
+
+    /* a sleeping consumer is woken exactly once */
+    ASSERT(FspRingConsumerPrepareWait(&Consumer));
+    ASSERT(FspRingConsumerWaiting == Producer.Shared->Flags);
+    Data = FspRingProduceBegin(&Producer, 16);
+    ASSERT(FspRingProduceEnd(&Producer, 16));
+    ASSERT(0 == Producer.Shared->Flags);
+    Data = FspRingProduceBegin(&Producer, 16);
+    ASSERT(!FspRingProduceEnd(&Producer, 16));
+
+    /* fill the ring; a producer may not sleep while there is room */
+    ASSERT(!FspRingProducerPrepareWait(&Producer, 16));
+    while (0 != FspRingProduceBegin(&Producer, 1000))
+        FspRingProduceEnd(&Producer, 1000);
+    ASSERT(!FspRingProducerPrepareWait(&Producer, 16) || 0 == FspRingProduceBegin(&Producer, 16));
+    Producer.Shared->Flags = 0;
+    while (0 != FspRingProduceBegin(&Producer, 16))
+        FspRingProduceEnd(&Producer, 16);
+
+    /* a sleeping producer is woken exactly once */
+    ASSERT(FspRingProducerPrepareWait(&Producer, 16));
+    ASSERT(FspRingProducerWaiting == Producer.Shared->Flags);
+    Data = FspRingConsumeBegin(&Consumer, &Size);
+    ASSERT(FspRingConsumeEnd(&Consumer, Size));
+    ASSERT(0 == Producer.Shared->Flags);
+    Data = FspRingConsumeBegin(&Consumer, &Size);
+    ASSERT(!FspRingConsumeEnd(&Consumer, Size));
+
+    free(Area);
+}
+
+static void ring_child(VOID *Area, UINT32 AreaSize, UINT64 Count)
+{
+    /*
+     * The dispatcher: answer every request in order. The wake-up for a response is
+     * deferred until the request ring runs dry (or the dispatcher must wait), so
+     * that a burst of responses costs at most one wake-up.
+     */
+    FSP_RING Request, Response;
+    STATS Stats = { 0 };
+    UINT64 Seq = 0;
+    UINT32 Size, Check, Spin;
+    BOOLEAN WakeResponse = 0;
+    MESSAGE *Message;
+    VOID *Data;
+
+    ASSERT(FspRingOpen(&Request, Area, AreaSize, 0, 0));
+    ASSERT(FspRingOpen(&Response, Area, AreaSize, 1, 1));
+
+    while (Count > Seq)
+    {
+        for (Spin = 0; 0 == (Message = FspRingConsumeBegin(&Request, &Size)); Spin++)
+        {
+            ASSERT(!Request.Broken);
+            if (WakeResponse)
+            {
+                ring_wake(&Response.Shared->Flags, &Stats);
+                WakeResponse = 0;
+            }
+            if (SpinCount > Spin)
+                continue;
+            if (FspRingConsumerPrepareWait(&Request))
+                ring_wait(&Request.Shared->Flags, FspRingConsumerWaiting, &Stats);
+        }
+        ASSERT(request_size(Seq) == Size);
+        Check = message_check(Message, Seq, Size);
+        if (FspRingConsumeEnd(&Request, Size))
+            ring_wake(&Request.Shared->Flags, &Stats);
+
+        Size = response_size(Seq);
+        for (Spin = 0; 0 == (Data = FspRingProduceBegin(&Response, Size)); Spin++)
+        {
+            ASSERT(!Response.Broken);
+            if (WakeResponse)
+            {
+                ring_wake(&Response.Shared->Flags, &Stats);
+                WakeResponse = 0;
+            }
+            if (SpinCount > Spin)
+                continue;
+            if (FspRingProducerPrepareWait(&Response, Size))
+                ring_wait(&Response.Shared->Flags, FspRingProducerWaiting, &Stats);
+        }
+        message_fill(Data, Seq, Size, Check);
+        WakeResponse |= FspRingProduceEnd(&Response, Size);
+
+        Seq++;
+    }
+    if (WakeResponse)
+        ring_wake(&Response.Shared->Flags, &Stats);
+
+    printf("    child:  %llu sleeps, %llu wake-ups\n",
+        (unsigned long long)Stats.Sleeps, (unsigned long long)Stats.Wakeups);
+}
+
+static void ring_parent(VOID *Area, UINT32 AreaSize, UINT64 Count, UINT64 *PBytes)
+{
+    /*
+     * The FSD: keep the request ring full and collect the responses. A batch of
+     * requests is published with at most one wake-up, after the batch.
+     */
+    FSP_RING Request, Response;
+    STATS Stats = { 0 };
+    UINT64 SendSeq = 0, RecvSeq = 0, Bytes = 0;
+    UINT32 Size, Spin = 0;
+    BOOLEAN Progress, WakeRequest;
+    MESSAGE *Message;
+    VOID *Data;
+
+    ASSERT(FspRingOpen(&Request, Area, AreaSize, 0, 1));
+    ASSERT(FspRingOpen(&Response, Area, AreaSize, 1, 0));
+
+    while (Count > RecvSeq)
+    {
+        Progress = 0;
+
+        WakeRequest = 0;
+        while (Count > SendSeq &&
+            0 != (Data = FspRingProduceBegin(&Request, Size = request_size(SendSeq))))
+        {
+            message_fill(Data, SendSeq, Size, 0);
+            WakeRequest |= FspRingProduceEnd(&Request, Size);
+            Bytes += Size;
+            SendSeq++;
+            Progress = 1;
+        }
+        ASSERT(!Request.Broken);
+        if (WakeRequest)
+            ring_wake(&Request.Shared->Flags, &Stats);
+
+        while (0 != (Message = FspRingConsumeBegin(&Response, &Size)))
+        {
+            ASSERT(response_size(RecvSeq) == Size);
+            message_check(Message, RecvSeq, Size);
+            ASSERT(request_check(RecvSeq) == Message->Check);
+            if (FspRingConsumeEnd(&Response, Size))
+                ring_wake(&Response.Shared->Flags, &Stats);
+            Bytes += Size;
+            RecvSeq++;
+            Progress = 1;
+        }
+        ASSERT(!Response.Broken);
+
+        if (Progress)
+        {
+            Spin = 0;
+            continue;
+        }
+        if (SpinCount > Spin++)
+            continue;
+
+        /*
+         * Nothing to send (the request ring is full or all requests are out) and
+         * nothing received. A response must come, so only wait for that; the
+         * child consumes requests whenever it can produce responses.
+         */
+        if (FspRingConsumerPrepareWait(&Response))
+            ring_wait(&Response.Shared->Flags, FspRingConsumerWaiting, &Stats);
+        Spin = 0;
+    }
+
+    printf("    parent: %llu sleeps, %llu wake-ups\n",
+        (unsigned long long)Stats.Sleeps, (unsigned long long)Stats.Wakeups);
+    *PBytes = Bytes;
+}
+
+static double now(void)
+{
+    struct timespec Ts;
+    clock_gettime(CLOCK_MONOTONIC, &Ts);
+    return Ts.tv_sec + Ts.tv_nsec / 1e9;
+}
+
+static void report(const char *Name, UINT64 Count, UINT64 Bytes, double Seconds)
+{
+    printf("%-12s %8llu round trips in %.3fs: %10.0f msg/s %8.1f MB/s\n",
+        Name, (unsigned long long)Count, Seconds,
+        Count / Seconds, Bytes / Seconds / (1024 * 1024));
+}
+
+static void ring_process_test(UINT64 Count)
+{
+    UINT32 AreaSize = FspRingAreaSize(DATA_SIZE, DATA_SIZE);
+    VOID *Area;
+    UINT64 Bytes;
+    pid_t Pid;
+    int Status;
+    double Start;
+
+    Area = mmap(0, AreaSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    ASSERT(MAP_FAILED != Area);
+    ASSERT(FspRingAreaInitialize(Area, AreaSize, DATA_SIZE, DATA_SIZE));
+
+    printf("ring\n");
+    fflush(stdout);
+    Start = now();
+    Pid = fork();
+    ASSERT(-1 != Pid);
+    if (0 == Pid)
+    {
+        ring_child(Area, AreaSize, Count);
+        fflush(stdout);
+        _exit(0);
+    }
+    ring_parent(Area, AreaSize, Count, &Bytes);
+    ASSERT(Pid == waitpid(Pid, &Status, 0));
+    ASSERT(WIFEXITED(Status) && 0 == WEXITSTATUS(Status));
+    report("ring", Count, Bytes, now() - Start);
+
+    munmap(Area, AreaSize);
+}
+
+static void socket_process_test(UINT64 Count)
+{
+    /* one request in flight at a time; one send and one receive per message */
+    static UINT8 Buffer[16 * 1024];
+    MESSAGE *Message = (MESSAGE *)Buffer;
+    UINT64 Bytes = 0;
+    UINT32 Size, Check;
+    int Fd[2], Status;
+    pid_t Pid;
+    double Start;
+
+    ASSERT(0 == socketpair(AF_UNIX, SOCK_SEQPACKET, 0, Fd));
+
+    Start = now();
+    Pid = fork();
+    ASSERT(-1 != Pid);
+    if (0 == Pid)
+    {
+        close(Fd[0]);
+        for (UINT64 Seq = 0; Count > Seq; Seq++)
+        {
+            ASSERT(request_size(Seq) == recv(Fd[1], Buffer, sizeof Buffer, 0));
+            Check = message_check(Message, Seq, request_size(Seq));
+            message_fill(Message, Seq, Size = response_size(Seq), Check);
+            ASSERT(Size == send(Fd[1], Buffer, Size, 0));
+        }
+        _exit(0);
+    }
+    close(Fd[1]);
+    for (UINT64 Seq = 0; Count > Seq; Seq++)
+    {
+        message_fill(Message, Seq, Size = request_size(Seq), 0);
+        ASSERT(Size == send(Fd[0], Buffer, Size, 0));
+        Bytes += Size;
+        ASSERT(response_size(Seq) == recv(Fd[0], Buffer, sizeof Buffer, 0));
+        message_check(Message, Seq, response_size(Seq));
+        Bytes += response_size(Seq);
+    }
+    ASSERT(Pid == waitpid(Pid, &Status, 0));
+    ASSERT(WIFEXITED(Status) && 0 == WEXITSTATUS(Status));
+    report("socketpair", Count, Bytes, now() - Start);
+
+    close(Fd[0]);
+}
+
+int main(int argc, char **argv)
+{
+    UINT64 Count = 1 < argc ? strtoull(argv[1], 0, 0) : 200000;
+
+    if (1 >= sysconf(_SC_NPROCESSORS_ONLN))
+        SpinCount = 0;
+
+    layout_test();
+    wrap_test();
+    malformed_test();
+    wait_test();
+    ring_process_test(Count);
+    socket_process_test(Count / 10);
+
+    printf("ok\n");
+    return 0;
+}
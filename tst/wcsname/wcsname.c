@@ -0,0 +1,244 @@
+/**
+ * @file wcsname.c
+ *
+ * File name comparison kernel tests.
+ *
+ * @copyright 2015-2026 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this software
+ * in accordance with the commercial license agreement provided in
+ * conjunction with the software.  The terms and conditions of any such
+ * commercial license agreement shall govern, supersede, and render
+ * ineffective any application of the GPLv3 license to this software,
+ * notwithstanding of any reference thereto in the software or
+ * associated repository.
+ */
+
+/*
+ * Checks the SSE2 or NEON kernels of shared/ku/wcsname.h (whichever the compiler
+ * targets) and their scalar versions against a straightforward reference:
+ *
+ * - every pair of interesting characters in every vector lane and in the tail;
+ * - every length up to a few vectors with a mismatch at every position, with the
+ *   strings placed right before an inaccessible page to catch reads past the end;
+ * - random strings of random length.
+ *
+ * Usage: wcsname [seed]. Builds on any platform with a C11 compiler and mmap (see
+ * the Makefile).
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef uint8_t UINT8;
+typedef uint16_t WCHAR;
+typedef uint16_t UINT16;
+typedef uint64_t UINT64;
+typedef size_t SIZE_T;
+
+#include <shared/ku/wcsname.h>
+
+#define ASSERT(e)                       \
+    ((e) ? (void)0 : (fprintf(stderr, "%s:%d: ASSERT(%s) failed\n", __FILE__, __LINE__, #e), abort()))
+
+static SIZE_T cmp_span_ref(const WCHAR *s, const WCHAR *t, SIZE_T n)
+{
+    SIZE_T i;
+    for (i = 0; n > i; i++)
+        if (s[i] != t[i])
+            break;
+    return i;
+}
+
+static SIZE_T icmp_span_ref(const WCHAR *s, const WCHAR *t, SIZE_T n)
+{
+    SIZE_T i;
+    for (i = 0; n > i; i++)
+    {
+        WCHAR c = s[i], d = t[i];
+        if (0x80 <= c || 0x80 <= d)
+            break;
+        if ('a' <= c && c <= 'z')
+            c -= 'a' - 'A';
+        if ('a' <= d && d <= 'z')
+            d -= 'a' - 'A';
+        if (c != d)
+            break;
+    }
+    return i;
+}
+
+static unsigned long check_count;
+
+static void check(const WCHAR *s, const WCHAR *t, SIZE_T n)
+{
+    SIZE_T CmpSpan = cmp_span_ref(s, t, n);
+    SIZE_T IcmpSpan = icmp_span_ref(s, t, n);
+    int Cmp = n > CmpSpan ? (int)s[CmpSpan] - (int)t[CmpSpan] : 0;
+
+    ASSERT(CmpSpan == FspWcsnCmpSpanScalar(s, t, n));
+    ASSERT(CmpSpan == FspWcsnCmpSpan(s, t, n));
+    ASSERT(IcmpSpan == FspWcsnAsciiIcmpSpanScalar(s, t, n));
+    ASSERT(IcmpSpan == FspWcsnAsciiIcmpSpan(s, t, n));
+    ASSERT(Cmp == FspWcsnCmp(s, t, n));
+    check_count++;
+}
+
+static void exhaustive_test(void)
+{
+    /*
+     * Every pair of characters in every lane of a vector and in the scalar tail
+     * (every position for some lengths, a sample of the positions for others).
+     * The characters are all of ASCII plus boundary characters around the case
+     * ranges, the 0x80 ASCII boundary and characters that are negative as signed
+     * 16-bit values.
+     */
+    static const WCHAR Extra[] =
+    {
+        0x0080, 0x00c0, 0x00e0, 0x00ff, 0x0100, 0x0141, 0x0161, 0x0391, 0x03b1, 0x7fff,
+        0x8000, 0x8041, 0x8061, 0xff21, 0xff41, 0xff7f, 0xff80, 0xffdf, 0xfffe, 0xffff,
+    };
+    WCHAR Chars[128 + sizeof Extra / sizeof Extra[0]];
+    WCHAR S[24], T[24];
+    unsigned CharCount, I, J, K, N, P;
+
+    for (I = 0; 128 > I; I++)
+        Chars[I] = (WCHAR)I;
+    for (I = 0; sizeof Extra / sizeof Extra[0] > I; I++)
+        Chars[128 + I] = Extra[I];
+    CharCount = sizeof Chars / sizeof Chars[0];
+
+    for (N = 1; sizeof S / sizeof S[0] >= N; N++)
+        for (P = 0; N > P; P += 0 == N % 8 || 17 == N ? 1 : N - P > 9 ? 3 : 1)
+            for (I = 0; CharCount > I; I++)
+                for (J = 0; CharCount > J; J++)
+                {
+                    for (K = 0; N > K; K++)
+                        S[K] = T[K] = (WCHAR)('a' + K % 26);
+                    S[P] = Chars[I];
+                    T[P] = Chars[J];
+                    check(S, T, N);
+                    check(S, T, P);
+                    if (N > P + 1)
+                    {
+                        /* a later mismatch does not matter */
+                        T[N - 1] ^= 1;
+                        check(S, T, N);
+                    }
+                }
+}
+
+static void boundary_test(void)
+{
+    /*
+     * Strings that end right before an inaccessible page: a kernel that reads even
+     * one character past N faults.
+     */
+    static const WCHAR Mismatch[][2] =
+    {
+        { 'a', 'b' }, { 'a', 'A' }, { 'z', 'Z' }, { '@', '`' }, { '[', '{' },
+        { 'a', 0x00e1 }, { 0x00e1, 0x00c1 }, { 0x8000, 0x0000 }, { 0xffff, 0x7fff },
+    };
+    long PageSize = sysconf(_SC_PAGESIZE);
+    unsigned MaxLength = 4 * 8 + 7;
+    UINT8 *Pages;
+    WCHAR *S, *T;
+    unsigned I, N, P;
+
+    Pages = mmap(0, 4 * PageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT(MAP_FAILED != Pages);
+    ASSERT(0 == mprotect(Pages + 1 * PageSize, PageSize, PROT_NONE));
+    ASSERT(0 == mprotect(Pages + 3 * PageSize, PageSize, PROT_NONE));
+
+    for (N = 0; MaxLength >= N; N++)
+    {
+        S = (WCHAR *)(Pages + 1 * PageSize) - N;
+        T = (WCHAR *)(Pages + 3 * PageSize) - N;
+
+        /* equal strings, with and without case differences */
+        for (I = 0; N > I; I++)
+        {
+            S[I] = (WCHAR)('a' + I % 26);
+            T[I] = (WCHAR)(0 == I % 3 ? 'A' + I % 26 : 'a' + I % 26);
+        }
+        check(S, S, N);
+        check(S, T, N);
+
+        /* a mismatch at every position */
+        for (P = 0; N > P; P++)
+            for (I = 0; sizeof Mismatch / sizeof Mismatch[0] > I; I++)
+            {
+                WCHAR SavedS = S[P], SavedT = T[P];
+                S[P] = Mismatch[I][0];
+                T[P] = Mismatch[I][1];
+                check(S, T, N);
+                check(T, S, N);
+                S[P] = SavedS;
+                T[P] = SavedT;
+            }
+
+        /* unaligned strings: compare the tails */
+        for (I = 1; N > I && 8 > I; I++)
+            check(S + I, T + I, N - I);
+    }
+
+    ASSERT(0 == munmap(Pages, 4 * PageSize));
+}
+
+static void random_test(unsigned seed)
+{
+    static const WCHAR Alphabet[] =
+    {
+        'a', 'A', 'z', 'Z', '@', '[', '`', '{', '0', '9', '.', '_', '-', '\\', ':',
+        0x00e9, 0x00c9, 0x0100, 0x8000, 0xffff,
+    };
+    WCHAR S[300], T[300];
+    unsigned I, K, N, A = sizeof Alphabet / sizeof Alphabet[0];
+
+    srand(seed);
+
+    for (I = 0; 200000 > I; I++)
+    {
+        N = rand() % (sizeof S / sizeof S[0]);
+        for (K = 0; N > K; K++)
+        {
+            S[K] = Alphabet[rand() % A];
+            T[K] = 0 == rand() % 64 ?
+                Alphabet[rand() % A] :
+                (0 == rand() % 2 || 'a' > (S[K] | 0x20) || (S[K] | 0x20) > 'z' ? S[K] : S[K] ^ 0x20);
+        }
+        check(S, T, N);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned seed = 1 < argc ? (unsigned)strtoul(argv[1], 0, 0) : (unsigned)time(0);
+
+#if defined(FSP_WCSNAME_SSE2)
+    printf("kernels: SSE2, seed %u\n", seed);
+#elif defined(FSP_WCSNAME_NEON)
+    printf("kernels: NEON, seed %u\n", seed);
+#else
+    printf("kernels: scalar, seed %u\n", seed);
+#endif
+
+    exhaustive_test();
+    boundary_test();
+    random_test(seed);
+
+    printf("ok (%lu checks)\n", check_count);
+    return 0;
+}
@@ -413,6 +413,112 @@ static void dirbuf_presort_fill_test(void)
     }
 }
 
+static void dirbuf_large_dotest(unsigned seed, ULONG Count, ULONG Disorder)
+{
+    /*
+     * Fill Count entries; Disorder per 1000 entries get a random name, the rest are
+     * in order. Then read the directory buffer back in chunks and check its order.
+     */
+
+    PVOID DirBuffer = 0;
+    NTSTATUS Result;
+    BOOLEAN Success;
+    union
+    {
+        UINT8 B[sizeof(FSP_FSCTL_DIR_INFO) + MAX_PATH * sizeof(WCHAR)];
+        FSP_FSCTL_DIR_INFO D;
+    } DirInfoBuf;
+    FSP_FSCTL_DIR_INFO *DirInfo = &DirInfoBuf.D, *DirInfoEnd;
+    PUINT8 Buffer;
+    ULONG Length, BytesTransferred;
+    WCHAR CurrFileName[MAX_PATH], PrevFileName[MAX_PATH];
+    ULONG N;
+
+    srand(seed);
+
+    Length = 64 * 1024;
+    Buffer = malloc(Length);
+    ASSERT(0 != Buffer);
+
+    Result = STATUS_UNSUCCESSFUL;
+    Success = FspFileSystemAcquireDirectoryBuffer(&DirBuffer, FALSE, &Result);
+    ASSERT(Success);
+    ASSERT(STATUS_SUCCESS == Result);
+
+    for (ULONG I = 0; Count > I; I++)
+    {
+        memset(&DirInfoBuf, 0, sizeof DirInfoBuf);
+
+        /* random names sort after an in-order name, but never equal any other name */
+        if ((ULONG)(rand() % 1000) < Disorder)
+            StringCbPrintfW(DirInfo->FileNameBuf, MAX_PATH * sizeof(WCHAR), L"FILEFILE%016llx-%08lx",
+                (UINT64)(((ULONG)rand() << 15 | (ULONG)rand()) % Count), I);
+        else
+            StringCbPrintfW(DirInfo->FileNameBuf, MAX_PATH * sizeof(WCHAR), L"FILEFILE%016llx",
+                (UINT64)I);
+        DirInfo->Size = (UINT16)(sizeof(FSP_FSCTL_DIR_INFO) +
+            wcslen(DirInfo->FileNameBuf) * sizeof(WCHAR));
+
+        Success = FspFileSystemFillDirectoryBuffer(&DirBuffer, DirInfo, &Result);
+        ASSERT(Success);
+        ASSERT(STATUS_SUCCESS == Result);
+    }
+
+    FspFileSystemReleaseDirectoryBuffer(&DirBuffer);
+
+    N = 0;
+    PrevFileName[0] = L'\0';
+    for (;;)
+    {
+        BytesTransferred = 0;
+        FspFileSystemReadDirectoryBuffer(&DirBuffer, 0 == N ? 0 : PrevFileName,
+            Buffer, Length, &BytesTransferred);
+
+        for (
+            DirInfo = (PVOID)Buffer, DirInfoEnd = (PVOID)(Buffer + BytesTransferred);
+            DirInfoEnd > DirInfo && 0 != DirInfo->Size &&
+                (PUINT8)DirInfo + DirInfo->Size <= (PUINT8)DirInfoEnd;
+            DirInfo = (PVOID)((PUINT8)DirInfo + FSP_FSCTL_DEFAULT_ALIGN_UP(DirInfo->Size)), N++)
+        {
+            memcpy(CurrFileName, DirInfo->FileNameBuf, DirInfo->Size - sizeof *DirInfo);
+            CurrFileName[(DirInfo->Size - sizeof *DirInfo) / sizeof(WCHAR)] = L'\0';
+
+            ASSERT(wcscmp(PrevFileName, CurrFileName) < 0);
+
+            memcpy(PrevFileName, CurrFileName, sizeof CurrFileName);
+        }
+
+        if (DirInfoEnd > DirInfo && 0 == DirInfo->Size)
+            break;
+    }
+    ASSERT(N == Count);
+
+    FspFileSystemDeleteDirectoryBuffer(&DirBuffer);
+
+    free(Buffer);
+}
+
+static void dirbuf_large_fill_test(void)
+{
+    unsigned seed = (unsigned)time(0);
+
+    dirbuf_large_dotest(seed, 1000000, 1000);
+}
+
+static void dirbuf_large_presort_fill_test(void)
+{
+    unsigned seed = (unsigned)time(0);
+
+    dirbuf_large_dotest(seed, 1000000, 0);
+}
+
+static void dirbuf_large_nearsort_fill_test(void)
+{
+    unsigned seed = (unsigned)time(0);
+
+    dirbuf_large_dotest(seed, 1000000, 10);
+}
+
 static void dirbuf_boundary_dotest(PWSTR Marker, ULONG ExpectI, ULONG ExpectN, ...)
 {
     PVOID DirBuffer = 0;
@@ -501,6 +607,146 @@ static void dirbuf_boundary_test(void)
     dirbuf_boundary_dotest(L"G", 0, 0, L"B", L"D", L"F", 0);
 }
 
+static void dirbuf_cache_fill(PVOID *PDirBuffer, PWSTR Prefix, ULONG Count)
+{
+    NTSTATUS Result;
+    BOOLEAN Success;
+    union
+    {
+        UINT8 B[sizeof(FSP_FSCTL_DIR_INFO) + MAX_PATH * sizeof(WCHAR)];
+        FSP_FSCTL_DIR_INFO D;
+    } DirInfoBuf;
+    FSP_FSCTL_DIR_INFO *DirInfo = &DirInfoBuf.D;
+    ULONG I;
+
+    for (I = 0; Count > I; I++)
+    {
+        memset(&DirInfoBuf, 0, sizeof DirInfoBuf);
+        StringCbPrintfW(DirInfo->FileNameBuf, MAX_PATH * sizeof(WCHAR), L"%s%04lx", Prefix, I);
+        DirInfo->Size = (UINT16)(sizeof(FSP_FSCTL_DIR_INFO) + wcslen(DirInfo->FileNameBuf) * sizeof(WCHAR));
+        Success = FspFileSystemFillDirectoryBuffer(PDirBuffer, DirInfo, &Result);
+        ASSERT(Success);
+        ASSERT(STATUS_SUCCESS == Result);
+    }
+}
+
+static ULONG dirbuf_cache_read(PVOID *PDirBuffer, PWSTR Prefix)
+{
+    static UINT8 Buffer[64 * 1024];
+    FSP_FSCTL_DIR_INFO *DirInfo, *DirInfoEnd;
+    ULONG BytesTransferred;
+    ULONG PrefixLength = (ULONG)wcslen(Prefix);
+    ULONG N;
+
+    BytesTransferred = 0;
+    FspFileSystemReadDirectoryBuffer(PDirBuffer, 0, Buffer, sizeof Buffer, &BytesTransferred);
+
+    N = 0;
+    for (
+        DirInfo = (PVOID)Buffer, DirInfoEnd = (PVOID)(Buffer + BytesTransferred);
+        DirInfoEnd > DirInfo && 0 != DirInfo->Size;
+        DirInfo = (PVOID)((PUINT8)DirInfo + FSP_FSCTL_DEFAULT_ALIGN_UP(DirInfo->Size)), N++)
+    {
+        ASSERT(PrefixLength + 4 == (DirInfo->Size - sizeof *DirInfo) / sizeof(WCHAR));
+        ASSERT(0 == memcmp(DirInfo->FileNameBuf, Prefix, PrefixLength * sizeof(WCHAR)));
+    }
+    ASSERT(DirInfoEnd > DirInfo);
+    ASSERT(0 == DirInfo->Size);
+
+    return N;
+}
+
+static void dirbuf_cache_test(void)
+{
+    PVOID Cache = 0;
+    PVOID DirBuffer1 = 0, DirBuffer2 = 0, DirBuffer3 = 0;
+    NTSTATUS Result;
+    BOOLEAN Success;
+    ULONG I, Hits;
+
+    Result = FspFileSystemCreateDirectoryBufferCache(1024 * 1024, &Cache);
+    ASSERT(STATUS_SUCCESS == Result);
+
+    /* first handle fills and publishes */
+    Result = STATUS_UNSUCCESSFUL;
+    Success = FspFileSystemAcquireCachedDirectoryBuffer(Cache, 1, 1, &DirBuffer1, TRUE, &Result);
+    ASSERT(Success);
+    ASSERT(STATUS_SUCCESS == Result);
+    dirbuf_cache_fill(&DirBuffer1, L"A", 100);
+    FspFileSystemReleaseCachedDirectoryBuffer(Cache, 1, 1, &DirBuffer1);
+    ASSERT(100 == dirbuf_cache_read(&DirBuffer1, L"A"));
+
+    /* second handle shares the cached buffer */
+    Result = STATUS_UNSUCCESSFUL;
+    Success = FspFileSystemAcquireCachedDirectoryBuffer(Cache, 1, 1, &DirBuffer2, TRUE, &Result);
+    ASSERT(!Success);
+    ASSERT(STATUS_SUCCESS == Result);
+    ASSERT(100 == dirbuf_cache_read(&DirBuffer2, L"A"));
+
+    /* new version is a miss; existing handles keep their snapshot */
+    Result = STATUS_UNSUCCESSFUL;
+    Success = FspFileSystemAcquireCachedDirectoryBuffer(Cache, 1, 2, &DirBuffer3, TRUE, &Result);
+    ASSERT(Success);
+    ASSERT(STATUS_SUCCESS == Result);
+    dirbuf_cache_fill(&DirBuffer3, L"B", 50);
+    FspFileSystemReleaseCachedDirectoryBuffer(Cache, 1, 2, &DirBuffer3);
+    ASSERT(50 == dirbuf_cache_read(&DirBuffer3, L"B"));
+    ASSERT(100 == dirbuf_cache_read(&DirBuffer1, L"A"));
+    ASSERT(100 == dirbuf_cache_read(&DirBuffer2, L"A"));
+
+    /* refilling a handle that reads from a snapshot does not affect other handles */
+    Result = STATUS_UNSUCCESSFUL;
+    Success = FspFileSystemAcquireDirectoryBuffer(&DirBuffer2, TRUE, &Result);
+    ASSERT(Success);
+    ASSERT(STATUS_SUCCESS == Result);
+    dirbuf_cache_fill(&DirBuffer2, L"CC", 3);
+    FspFileSystemReleaseDirectoryBuffer(&DirBuffer2);
+    ASSERT(3 == dirbuf_cache_read(&DirBuffer2, L"CC"));
+    ASSERT(100 == dirbuf_cache_read(&DirBuffer1, L"A"));
+
+    /* invalidation */
+    FspFileSystemInvalidateDirectoryBufferCache(Cache, 1);
+    Result = STATUS_UNSUCCESSFUL;
+    Success = FspFileSystemAcquireCachedDirectoryBuffer(Cache, 1, 2, &DirBuffer1, TRUE, &Result);
+    ASSERT(Success);
+    ASSERT(STATUS_SUCCESS == Result);
+    dirbuf_cache_fill(&DirBuffer1, L"D", 7);
+    FspFileSystemReleaseCachedDirectoryBuffer(Cache, 1, 2, &DirBuffer1);
+    ASSERT(7 == dirbuf_cache_read(&DirBuffer1, L"D"));
+    ASSERT(50 == dirbuf_cache_read(&DirBuffer3, L"B"));
+
+    FspFileSystemDeleteDirectoryBuffer(&DirBuffer1);
+    FspFileSystemDeleteDirectoryBuffer(&DirBuffer2);
+    FspFileSystemDeleteDirectoryBuffer(&DirBuffer3);
+
+    /* memory budget: older directories are evicted */
+    for (I = 0; 200 > I; I++)
+    {
+        Success = FspFileSystemAcquireCachedDirectoryBuffer(Cache, 100 + I, 1, &DirBuffer1, TRUE, &Result);
+        ASSERT(Success);
+        ASSERT(STATUS_SUCCESS == Result);
+        dirbuf_cache_fill(&DirBuffer1, L"E", 200);
+        FspFileSystemReleaseCachedDirectoryBuffer(Cache, 100 + I, 1, &DirBuffer1);
+        FspFileSystemDeleteDirectoryBuffer(&DirBuffer1);
+    }
+    for (I = 199, Hits = 0; 200 > I; I--, Hits++)
+    {
+        Success = FspFileSystemAcquireCachedDirectoryBuffer(Cache, 100 + I, 1, &DirBuffer1, TRUE, &Result);
+        ASSERT(STATUS_SUCCESS == Result);
+        if (Success)
+        {
+            FspFileSystemReleaseCachedDirectoryBuffer(Cache, 100 + I, 1, &DirBuffer1);
+            FspFileSystemDeleteDirectoryBuffer(&DirBuffer1);
+            break;
+        }
+        ASSERT(200 == dirbuf_cache_read(&DirBuffer1, L"E"));
+        FspFileSystemDeleteDirectoryBuffer(&DirBuffer1);
+    }
+    ASSERT(0 < Hits && 200 > Hits);
+
+    FspFileSystemDeleteDirectoryBufferCache(Cache);
+}
+
 void dirbuf_tests(void)
 {
     if (OptExternal)
@@ -511,4 +757,8 @@ void dirbuf_tests(void)
     TEST(dirbuf_fill_test);
     TEST(dirbuf_presort_fill_test);
     TEST(dirbuf_boundary_test);
+    TEST(dirbuf_cache_test);
+    TEST_OPT(dirbuf_large_fill_test);
+    TEST_OPT(dirbuf_large_presort_fill_test);
+    TEST_OPT(dirbuf_large_nearsort_fill_test);
 }
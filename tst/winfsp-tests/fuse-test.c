@@ -20,8 +20,14 @@
  */
 
 #include <fuse/fuse.h>
+#include <fuse/fuse_lowlevel.h>
 #include <tlib/testsuite.h>
+#include <ctype.h>
 #include <process.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <strsafe.h>
+#include <time.h>
 
 #include "winfsp-tests.h"
 
@@ -108,11 +114,1559 @@ static void fuse_parallel_test(void)
     }
 }
 
+/*
+ * The tests below mount a FUSE file system on a free drive letter and access it
+ * through the Win32 API.
+ */
+typedef struct
+{
+    char MountPoint[3];
+    WCHAR Root[4];
+    struct fuse_chan *ch;
+    struct fuse *f;
+    HANDLE Thread;
+} FUSE_TESTS_FS;
+
+static void fuse_tests_fs_start(FUSE_TESTS_FS *Fs, const struct fuse_operations *ops, char *opts)
+{
+    char *argv[] = { "UNKNOWN", "-o", "uid=-1,gid=-1", "-o", opts, 0 };
+    struct fuse_args args = FUSE_ARGS_INIT(0 != opts ? 5 : 3, argv);
+    DWORD Drives = GetLogicalDrives();
+    int Letter;
+
+    for (Letter = 'Z'; 'D' <= Letter && 0 != (Drives & (1 << (Letter - 'A'))); Letter--)
+        ;
+    ASSERT('D' <= Letter);
+
+    memset(Fs, 0, sizeof *Fs);
+    Fs->MountPoint[0] = (char)Letter;
+    Fs->MountPoint[1] = ':';
+    Fs->Root[0] = (WCHAR)Letter;
+    Fs->Root[1] = L':';
+    Fs->Root[2] = L'\\';
+
+    Fs->ch = fuse_mount(Fs->MountPoint, &args);
+    ASSERT(0 != Fs->ch);
+
+    Fs->f = fuse_new(Fs->ch, &args, ops, sizeof *ops, 0);
+    ASSERT(0 != Fs->f);
+
+    Fs->Thread = (HANDLE)_beginthreadex(0, 0, fuse_tests_thread, Fs->f, 0, 0);
+    ASSERT(0 != Fs->Thread);
+
+    /* the file system is ready when its root directory can be queried */
+    for (ULONG I = 0; INVALID_FILE_ATTRIBUTES == GetFileAttributesW(Fs->Root); I++)
+    {
+        ASSERT(1000 > I);
+        ASSERT(WAIT_TIMEOUT == WaitForSingleObject(Fs->Thread, 10));
+    }
+}
+
+static void fuse_tests_fs_stop(FUSE_TESTS_FS *Fs)
+{
+    DWORD ExitCode;
+
+    fuse_exit(Fs->f);
+
+    WaitForSingleObject(Fs->Thread, INFINITE);
+    GetExitCodeThread(Fs->Thread, &ExitCode);
+    CloseHandle(Fs->Thread);
+
+    fuse_destroy(Fs->f);
+
+    fuse_unmount(Fs->MountPoint, Fs->ch);
+
+    ASSERT(0 == ExitCode);
+}
+
+static ULONG fuse_tests_fs_list(FUSE_TESTS_FS *Fs, PWSTR Names[], ULONG Count)
+{
+    /* list the root directory in the order returned by the file system; skips "." and ".." */
+    WCHAR Pattern[8];
+    HANDLE Handle;
+    WIN32_FIND_DATAW FindData;
+    ULONG N = 0;
+
+    StringCbPrintfW(Pattern, sizeof Pattern, L"%s*", Fs->Root);
+    Handle = FindFirstFileW(Pattern, &FindData);
+    ASSERT(INVALID_HANDLE_VALUE != Handle);
+    do
+    {
+        if (0 == wcscmp(FindData.cFileName, L".") || 0 == wcscmp(FindData.cFileName, L".."))
+            continue;
+        ASSERT(Count > N);
+        Names[N] = _wcsdup(FindData.cFileName);
+        ASSERT(0 != Names[N]);
+        N++;
+    } while (FindNextFileW(Handle, &FindData));
+    ASSERT(ERROR_NO_MORE_FILES == GetLastError());
+    FindClose(Handle);
+
+    return N;
+}
+
+static int fuse_tests_fs_wcscmp(const void *a, const void *b)
+{
+    return wcscmp(*(PWSTR *)a, *(PWSTR *)b);
+}
+
+static int fuse_tests_fs_getattr(const char *path, struct fuse_stat *stbuf)
+{
+    memset(stbuf, 0, sizeof *stbuf);
+    if (0 == strcmp(path, "/"))
+    {
+        stbuf->st_mode = 0040777;
+        stbuf->st_nlink = 2;
+    }
+    else
+    {
+        stbuf->st_mode = 0100666;
+        stbuf->st_nlink = 1;
+    }
+    return 0;
+}
+
+/*
+ * Readdir with reserved characters
+ *
+ * Every other entry starts with '*', which the FUSE layer decodes to U+F02A after
+ * the directory buffer has been filled. The decoded names sort after all others,
+ * so the buffer must be sorted (and searched for continuation markers) using the
+ * decoded names. The names are long enough that the listing takes many queries.
+ */
+#define FUSE_READDIR_RESERVED_COUNT     1000
+#define FUSE_READDIR_RESERVED_PADDING   "-padding-padding-padding-padding-padding-padding-padding-padding"
+
+static void fuse_readdir_reserved_name(char *Buffer, size_t Size, ULONG I)
+{
+    sprintf_s(Buffer, Size, "%c%04lu" FUSE_READDIR_RESERVED_PADDING, I & 1 ? '*' : 'f', I / 2);
+}
+
+static int fuse_readdir_reserved_getattr(const char *path, struct fuse_stat *stbuf)
+{
+    if (0 != strcmp(path, "/") &&
+        sizeof "/f0000" FUSE_READDIR_RESERVED_PADDING - 1 != strlen(path))
+        return -ENOENT;
+    return fuse_tests_fs_getattr(path, stbuf);
+}
+
+static int fuse_readdir_reserved_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+    fuse_off_t off, struct fuse_file_info *fi)
+{
+    char Name[256];
+
+    if (0 != strcmp(path, "/"))
+        return -ENOENT;
+
+    filler(buf, ".", 0, 0);
+    filler(buf, "..", 0, 0);
+    for (ULONG I = 0; FUSE_READDIR_RESERVED_COUNT > I; I++)
+    {
+        fuse_readdir_reserved_name(Name, sizeof Name, I);
+        filler(buf, Name, 0, 0);
+    }
+    return 0;
+}
+
+static void fuse_readdir_reserved_test(void)
+{
+    static struct fuse_operations ops;
+    FUSE_TESTS_FS Fs;
+    char Name[256];
+    PWSTR Expected[FUSE_READDIR_RESERVED_COUNT], Names[FUSE_READDIR_RESERVED_COUNT];
+    ULONG I, N;
+
+    ops.getattr = fuse_readdir_reserved_getattr;
+    ops.readdir = fuse_readdir_reserved_readdir;
+
+    for (I = 0; FUSE_READDIR_RESERVED_COUNT > I; I++)
+    {
+        fuse_readdir_reserved_name(Name, sizeof Name, I);
+        Expected[I] = malloc((strlen(Name) + 1) * sizeof(WCHAR));
+        ASSERT(0 != Expected[I]);
+        for (N = 0; '\0' != Name[N]; N++)
+            Expected[I][N] = '*' == Name[N] ? 0xf000 | '*' : Name[N];
+        Expected[I][N] = L'\0';
+    }
+    qsort(Expected, FUSE_READDIR_RESERVED_COUNT, sizeof Expected[0], fuse_tests_fs_wcscmp);
+
+    /* the decoded names sort differently than the original ones */
+    ASSERT(L'f' == Expected[0][0]);
+    ASSERT((0xf000 | '*') == Expected[FUSE_READDIR_RESERVED_COUNT - 1][0]);
+
+    fuse_tests_fs_start(&Fs, &ops, 0);
+
+    N = fuse_tests_fs_list(&Fs, Names, FUSE_READDIR_RESERVED_COUNT);
+    ASSERT(FUSE_READDIR_RESERVED_COUNT == N);
+    for (I = 0; N > I; I++)
+    {
+        ASSERT(0 == wcscmp(Expected[I], Names[I]));
+        free(Names[I]);
+    }
+
+    fuse_tests_fs_stop(&Fs);
+
+    for (I = 0; FUSE_READDIR_RESERVED_COUNT > I; I++)
+        free(Expected[I]);
+}
+
+/*
+ * Asynchronous completion
+ *
+ * Read, write and readdir call fuse_async_begin and complete from a separate thread.
+ * Completing a readdir calls getattr for its entries on that thread; getattr must see
+ * the context of the readdir caller.
+ */
+#define FUSE_ASYNC_FILE_SIZE            (64 * 1024)
+#define FUSE_ASYNC_ENTRY_COUNT          100
+
+enum
+{
+    FUSE_ASYNC_READ = 0,
+    FUSE_ASYNC_WRITE,
+    FUSE_ASYNC_READDIR,
+};
+
+static struct
+{
+    SRWLOCK Lock;
+    char Data[FUSE_ASYNC_FILE_SIZE];
+    size_t Size;
+    struct fuse_context ReaddirContext;
+    LONG AsyncCount[3], SyncCount;
+    LONG EntryGetattrCount, ContextErrorCount;
+} fuse_async_state;
+
+typedef struct
+{
+    int Kind;
+    struct fuse_async *async;
+    char *buf;
+    size_t size;
+    fuse_off_t off;
+    fuse_fill_dir_t filler;
+} FUSE_ASYNC_REQ;
+
+static int fuse_async_do_read(char *buf, size_t size, fuse_off_t off)
+{
+    size_t n = 0;
+
+    AcquireSRWLockShared(&fuse_async_state.Lock);
+    if ((size_t)off < fuse_async_state.Size)
+    {
+        n = fuse_async_state.Size - (size_t)off;
+        if (n > size)
+            n = size;
+        memcpy(buf, fuse_async_state.Data + off, n);
+    }
+    ReleaseSRWLockShared(&fuse_async_state.Lock);
+
+    return (int)n;
+}
+
+static int fuse_async_do_write(const char *buf, size_t size, fuse_off_t off)
+{
+    if (FUSE_ASYNC_FILE_SIZE < off + size)
+        return -ENOSPC;
+
+    AcquireSRWLockExclusive(&fuse_async_state.Lock);
+    memcpy(fuse_async_state.Data + off, buf, size);
+    if (fuse_async_state.Size < off + size)
+        fuse_async_state.Size = (size_t)(off + size);
+    ReleaseSRWLockExclusive(&fuse_async_state.Lock);
+
+    return (int)size;
+}
+
+static int fuse_async_do_readdir(void *buf, fuse_fill_dir_t filler)
+{
+    char Name[16];
+
+    filler(buf, ".", 0, 0);
+    filler(buf, "..", 0, 0);
+    filler(buf, "file", 0, 0);
+    for (ULONG I = 0; FUSE_ASYNC_ENTRY_COUNT > I; I++)
+    {
+        sprintf_s(Name, sizeof Name, "e%03lu", I);
+        filler(buf, Name, 0, 0);
+    }
+    return 0;
+}
+
+static unsigned __stdcall fuse_async_complete_thread(void *Data)
+{
+    FUSE_ASYNC_REQ *Req = Data;
+    int result = 0;
+
+    switch (Req->Kind)
+    {
+    case FUSE_ASYNC_READ:
+        result = fuse_async_do_read(Req->buf, Req->size, Req->off);
+        break;
+    case FUSE_ASYNC_WRITE:
+        result = fuse_async_do_write(Req->buf, Req->size, Req->off);
+        break;
+    case FUSE_ASYNC_READDIR:
+        result = fuse_async_do_readdir(Req->buf, Req->filler);
+        break;
+    }
+    fuse_async_end(Req->async, result);
+    free(Req);
+
+    return 0;
+}
+
+static int fuse_async_start(FUSE_ASYNC_REQ *Template)
+{
+    FUSE_ASYNC_REQ *Req;
+    HANDLE Thread;
+
+    Req = malloc(sizeof *Req);
+    if (0 == Req)
+        return 0;
+    memcpy(Req, Template, sizeof *Req);
+
+    Req->async = fuse_async_begin();
+    if (0 == Req->async)
+    {
+        free(Req);
+        return 0;
+    }
+    InterlockedIncrement(&fuse_async_state.AsyncCount[Req->Kind]);
+
+    Thread = (HANDLE)_beginthreadex(0, 0, fuse_async_complete_thread, Req, 0, 0);
+    if (0 != Thread)
+        CloseHandle(Thread);
+    else
+        fuse_async_complete_thread(Req);
+
+    return 1;
+}
+
+static void *fuse_async_init(struct fuse_conn_info *conn)
+{
+    conn->want |= conn->capable & FSP_FUSE_CAP_ASYNC;
+    return &fuse_async_state;
+}
+
+static int fuse_async_getattr(const char *path, struct fuse_stat *stbuf)
+{
+    struct fuse_context *context = fuse_get_context();
+    char *endp;
+    ULONG I;
+
+    if (0 == context->fuse || &fuse_async_state != context->private_data)
+        InterlockedIncrement(&fuse_async_state.ContextErrorCount);
+
+    if (0 == strcmp(path, "/"))
+        return fuse_tests_fs_getattr(path, stbuf);
+
+    if (0 == strcmp(path, "/file"))
+    {
+        fuse_tests_fs_getattr(path, stbuf);
+        AcquireSRWLockShared(&fuse_async_state.Lock);
+        stbuf->st_size = fuse_async_state.Size;
+        ReleaseSRWLockShared(&fuse_async_state.Lock);
+        return 0;
+    }
+
+    if ('/' != path[0] || 'e' != path[1] || !isdigit((unsigned char)path[2]))
+        return -ENOENT;
+    I = strtoul(path + 2, &endp, 10);
+    if ('\0' != *endp || FUSE_ASYNC_ENTRY_COUNT <= I)
+        return -ENOENT;
+
+    /* called while completing the readdir; possibly on another thread */
+    InterlockedIncrement(&fuse_async_state.EntryGetattrCount);
+    if (fuse_async_state.ReaddirContext.uid != context->uid ||
+        fuse_async_state.ReaddirContext.gid != context->gid ||
+        fuse_async_state.ReaddirContext.pid != context->pid)
+        InterlockedIncrement(&fuse_async_state.ContextErrorCount);
+
+    fuse_tests_fs_getattr(path, stbuf);
+    stbuf->st_size = I * 10;
+    return 0;
+}
+
+static int fuse_async_read(const char *path, char *buf, size_t size, fuse_off_t off,
+    struct fuse_file_info *fi)
+{
+    FUSE_ASYNC_REQ Req;
+
+    if (0 != strcmp(path, "/file"))
+        return -EISDIR;
+
+    memset(&Req, 0, sizeof Req);
+    Req.Kind = FUSE_ASYNC_READ;
+    Req.buf = buf;
+    Req.size = size;
+    Req.off = off;
+    if (fuse_async_start(&Req))
+        return 0;
+
+    InterlockedIncrement(&fuse_async_state.SyncCount);
+    return fuse_async_do_read(buf, size, off);
+}
+
+static int fuse_async_write(const char *path, const char *buf, size_t size, fuse_off_t off,
+    struct fuse_file_info *fi)
+{
+    FUSE_ASYNC_REQ Req;
+
+    if (0 != strcmp(path, "/file"))
+        return -EISDIR;
+
+    memset(&Req, 0, sizeof Req);
+    Req.Kind = FUSE_ASYNC_WRITE;
+    Req.buf = (char *)buf;
+    Req.size = size;
+    Req.off = off;
+    if (fuse_async_start(&Req))
+        return 0;
+
+    InterlockedIncrement(&fuse_async_state.SyncCount);
+    return fuse_async_do_write(buf, size, off);
+}
+
+static int fuse_async_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+    fuse_off_t off, struct fuse_file_info *fi)
+{
+    FUSE_ASYNC_REQ Req;
+
+    if (0 != strcmp(path, "/"))
+        return -ENOENT;
+
+    memcpy(&fuse_async_state.ReaddirContext, fuse_get_context(),
+        sizeof fuse_async_state.ReaddirContext);
+
+    memset(&Req, 0, sizeof Req);
+    Req.Kind = FUSE_ASYNC_READDIR;
+    Req.buf = buf;
+    Req.filler = filler;
+    if (fuse_async_start(&Req))
+        return 0;
+
+    InterlockedIncrement(&fuse_async_state.SyncCount);
+    return fuse_async_do_readdir(buf, filler);
+}
+
+static void fuse_async_test(void)
+{
+    static struct fuse_operations ops;
+    FUSE_TESTS_FS Fs;
+    WCHAR FileName[16], Pattern[8];
+    HANDLE Handle;
+    WIN32_FIND_DATAW FindData;
+    PUINT8 Buffer;
+    DWORD BytesTransferred;
+    BOOL Success;
+    ULONG I, N;
+
+    ops.init = fuse_async_init;
+    ops.getattr = fuse_async_getattr;
+    ops.read = fuse_async_read;
+    ops.write = fuse_async_write;
+    ops.readdir = fuse_async_readdir;
+    memset(&fuse_async_state, 0, sizeof fuse_async_state);
+    InitializeSRWLock(&fuse_async_state.Lock);
+
+    /* FILE_FLAG_NO_BUFFERING sends every read and write to the file system */
+    Buffer = VirtualAlloc(0, 2 * FUSE_ASYNC_FILE_SIZE, MEM_COMMIT, PAGE_READWRITE);
+    ASSERT(0 != Buffer);
+    for (I = 0; FUSE_ASYNC_FILE_SIZE > I; I++)
+        Buffer[I] = (UINT8)(I * 31 + 7);
+
+    fuse_tests_fs_start(&Fs, &ops, 0);
+
+    StringCbPrintfW(FileName, sizeof FileName, L"%sfile", Fs.Root);
+    Handle = CreateFileW(FileName, GENERIC_READ | GENERIC_WRITE, 0, 0, OPEN_EXISTING,
+        FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH, 0);
+    ASSERT(INVALID_HANDLE_VALUE != Handle);
+
+    Success = WriteFile(Handle, Buffer, FUSE_ASYNC_FILE_SIZE, &BytesTransferred, 0);
+    ASSERT(Success);
+    ASSERT(FUSE_ASYNC_FILE_SIZE == BytesTransferred);
+    ASSERT(FUSE_ASYNC_FILE_SIZE == fuse_async_state.Size);
+    ASSERT(0 == memcmp(Buffer, fuse_async_state.Data, FUSE_ASYNC_FILE_SIZE));
+
+    ASSERT(0 == SetFilePointer(Handle, 0, 0, FILE_BEGIN));
+    memset(Buffer + FUSE_ASYNC_FILE_SIZE, 0, FUSE_ASYNC_FILE_SIZE);
+    Success = ReadFile(Handle, Buffer + FUSE_ASYNC_FILE_SIZE, FUSE_ASYNC_FILE_SIZE,
+        &BytesTransferred, 0);
+    ASSERT(Success);
+    ASSERT(FUSE_ASYNC_FILE_SIZE == BytesTransferred);
+    ASSERT(0 == memcmp(Buffer, Buffer + FUSE_ASYNC_FILE_SIZE, FUSE_ASYNC_FILE_SIZE));
+
+    /* end of file */
+    Success = ReadFile(Handle, Buffer + FUSE_ASYNC_FILE_SIZE, 4096, &BytesTransferred, 0);
+    ASSERT(Success);
+    ASSERT(0 == BytesTransferred);
+
+    CloseHandle(Handle);
+
+    /* the sizes of the entries come from getattr calls made while completing the readdir */
+    StringCbPrintfW(Pattern, sizeof Pattern, L"%s*", Fs.Root);
+    Handle = FindFirstFileW(Pattern, &FindData);
+    ASSERT(INVALID_HANDLE_VALUE != Handle);
+    N = 0;
+    do
+    {
+        if (0 == wcscmp(FindData.cFileName, L".") || 0 == wcscmp(FindData.cFileName, L".."))
+            continue;
+        ASSERT(0 == FindData.nFileSizeHigh);
+        if (0 == wcscmp(FindData.cFileName, L"file"))
+            ASSERT(FUSE_ASYNC_FILE_SIZE == FindData.nFileSizeLow);
+        else
+        {
+            ASSERT(L'e' == FindData.cFileName[0]);
+            I = wcstoul(FindData.cFileName + 1, 0, 10);
+            ASSERT(FUSE_ASYNC_ENTRY_COUNT > I);
+            ASSERT(I * 10 == FindData.nFileSizeLow);
+        }
+        N++;
+    } while (FindNextFileW(Handle, &FindData));
+    ASSERT(ERROR_NO_MORE_FILES == GetLastError());
+    FindClose(Handle);
+    ASSERT(FUSE_ASYNC_ENTRY_COUNT + 1 == N);
+
+    fuse_tests_fs_stop(&Fs);
+
+    VirtualFree(Buffer, 0, MEM_RELEASE);
+
+    ASSERT(0 < fuse_async_state.AsyncCount[FUSE_ASYNC_READ]);
+    ASSERT(0 < fuse_async_state.AsyncCount[FUSE_ASYNC_WRITE]);
+    ASSERT(0 < fuse_async_state.AsyncCount[FUSE_ASYNC_READDIR]);
+    ASSERT(0 == fuse_async_state.SyncCount);
+    ASSERT(FUSE_ASYNC_ENTRY_COUNT <= fuse_async_state.EntryGetattrCount);
+    ASSERT(0 == fuse_async_state.ContextErrorCount);
+}
+
+/*
+ * Readdir getattr fixup
+ *
+ * Readdir supplies no stat data, so the entries are fixed up after the listing: with
+ * getattr_batch if the file system has it, with getattr on the ReaddirGetattrThreads pool,
+ * or with getattr one entry at a time. Either way every listed entry must have the
+ * attributes that getattr returns for it.
+ */
+#define FUSE_FIXDIR_ENTRY_COUNT         200
+
+enum
+{
+    FUSE_FIXDIR_BATCH_FULL = 0,
+    FUSE_FIXDIR_BATCH_PARTIAL,          /* every third entry fails */
+    FUSE_FIXDIR_BATCH_ERROR,            /* the whole batch fails */
+};
+
+static struct
+{
+    int BatchMode;
+    LONG BatchCount, BatchEntryCount, GetattrCount;
+    LONG ListGetattrCount;              /* getattr calls made by the listing */
+} fuse_fixdir_state;
+
+static int fuse_fixdir_index(const char *name)
+{
+    char *endp;
+    ULONG I;
+
+    if ('e' != name[0] || !isdigit((unsigned char)name[1]))
+        return -1;
+    I = strtoul(name + 1, &endp, 10);
+    if ('\0' != *endp || FUSE_FIXDIR_ENTRY_COUNT <= I)
+        return -1;
+    return (int)I;
+}
+
+static void fuse_fixdir_stat(ULONG I, struct fuse_stat *stbuf)
+{
+    fuse_tests_fs_getattr("/e", stbuf);
+    stbuf->st_size = I * 7 + 1;
+    stbuf->st_mtim.tv_sec = 1500000000 + I * 3600;
+    stbuf->st_mtim.tv_nsec = I * 100;
+    stbuf->st_atim = stbuf->st_mtim;
+    stbuf->st_ctim = stbuf->st_mtim;
+    stbuf->st_birthtim = stbuf->st_mtim;
+}
+
+static int fuse_fixdir_getattr(const char *path, struct fuse_stat *stbuf)
+{
+    int I;
+
+    if (0 == strcmp(path, "/"))
+        return fuse_tests_fs_getattr(path, stbuf);
+
+    if ('/' != path[0] || 0 > (I = fuse_fixdir_index(path + 1)))
+        return -ENOENT;
+
+    InterlockedIncrement(&fuse_fixdir_state.GetattrCount);
+    fuse_fixdir_stat(I, stbuf);
+    return 0;
+}
+
+static int fuse_fixdir_getattr_batch(const char *path, size_t count, const char *names[],
+    struct fuse_stat *stbufs[], int results[])
+{
+    int I;
+
+    InterlockedIncrement(&fuse_fixdir_state.BatchCount);
+    if (0 != strcmp(path, "/") || FUSE_FIXDIR_BATCH_ERROR == fuse_fixdir_state.BatchMode)
+        return -EIO;
+
+    for (size_t J = 0; count > J; J++)
+    {
+        InterlockedIncrement(&fuse_fixdir_state.BatchEntryCount);
+        I = fuse_fixdir_index(names[J]);
+        if (0 > I)
+            results[J] = -ENOENT;
+        else if (FUSE_FIXDIR_BATCH_PARTIAL == fuse_fixdir_state.BatchMode && 0 == I % 3)
+            results[J] = -EIO;
+        else
+        {
+            fuse_fixdir_stat(I, stbufs[J]);
+            results[J] = 0;
+        }
+    }
+    return 0;
+}
+
+static int fuse_fixdir_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+    fuse_off_t off, struct fuse_file_info *fi)
+{
+    char Name[16];
+
+    if (0 != strcmp(path, "/"))
+        return -ENOENT;
+
+    filler(buf, ".", 0, 0);
+    filler(buf, "..", 0, 0);
+    for (ULONG I = 0; FUSE_FIXDIR_ENTRY_COUNT > I; I++)
+    {
+        sprintf_s(Name, sizeof Name, "e%03lu", I);
+        filler(buf, Name, 0, 0);
+    }
+    return 0;
+}
+
+static void fuse_fixdir_check(FUSE_TESTS_FS *Fs)
+{
+    static WIN32_FIND_DATAW Entries[FUSE_FIXDIR_ENTRY_COUNT];
+    WCHAR Pattern[8], FileName[16];
+    HANDLE Handle;
+    WIN32_FIND_DATAW FindData;
+    WIN32_FILE_ATTRIBUTE_DATA AttrData;
+    struct fuse_stat stbuf;
+    UINT64 FileTime;
+    ULONG I, N = 0;
+
+    /* list the directory; the attributes must be the ones that getattr returns */
+    StringCbPrintfW(Pattern, sizeof Pattern, L"%s*", Fs->Root);
+    Handle = FindFirstFileW(Pattern, &FindData);
+    ASSERT(INVALID_HANDLE_VALUE != Handle);
+    do
+    {
+        if (0 == wcscmp(FindData.cFileName, L".") || 0 == wcscmp(FindData.cFileName, L".."))
+            continue;
+
+        ASSERT(L'e' == FindData.cFileName[0]);
+        I = wcstoul(FindData.cFileName + 1, 0, 10);
+        ASSERT(FUSE_FIXDIR_ENTRY_COUNT > I);
+        ASSERT(0 == Entries[I].cFileName[0]);
+
+        fuse_fixdir_stat(I, &stbuf);
+        FileTime = ((UINT64)stbuf.st_mtim.tv_sec + 11644473600ULL) * 10000000ULL +
+            (UINT64)stbuf.st_mtim.tv_nsec / 100;
+
+        ASSERT(0 == (FindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY));
+        ASSERT(0 == FindData.nFileSizeHigh);
+        ASSERT(stbuf.st_size == FindData.nFileSizeLow);
+        ASSERT((DWORD)FileTime == FindData.ftLastWriteTime.dwLowDateTime);
+        ASSERT((DWORD)(FileTime >> 32) == FindData.ftLastWriteTime.dwHighDateTime);
+
+        memcpy(&Entries[I], &FindData, sizeof FindData);
+        N++;
+    } while (FindNextFileW(Handle, &FindData));
+    ASSERT(ERROR_NO_MORE_FILES == GetLastError());
+    FindClose(Handle);
+    ASSERT(FUSE_FIXDIR_ENTRY_COUNT == N);
+
+    fuse_fixdir_state.ListGetattrCount = fuse_fixdir_state.GetattrCount;
+
+    /* compare with the attributes of each file queried on its own (serial getattr) */
+    for (I = 0; FUSE_FIXDIR_ENTRY_COUNT > I; I++)
+    {
+        StringCbPrintfW(FileName, sizeof FileName, L"%s%s", Fs->Root, Entries[I].cFileName);
+        ASSERT(GetFileAttributesExW(FileName, GetFileExInfoStandard, &AttrData));
+        ASSERT(Entries[I].dwFileAttributes == AttrData.dwFileAttributes);
+        ASSERT(Entries[I].nFileSizeHigh == AttrData.nFileSizeHigh);
+        ASSERT(Entries[I].nFileSizeLow == AttrData.nFileSizeLow);
+        ASSERT(0 == CompareFileTime(&Entries[I].ftCreationTime, &AttrData.ftCreationTime));
+        ASSERT(0 == CompareFileTime(&Entries[I].ftLastWriteTime, &AttrData.ftLastWriteTime));
+    }
+
+    memset(Entries, 0, sizeof Entries);
+}
+
+static void fuse_fixdir_run(const struct fuse_operations *ops, char *opts, int BatchMode)
+{
+    FUSE_TESTS_FS Fs;
+
+    memset(&fuse_fixdir_state, 0, sizeof fuse_fixdir_state);
+    fuse_fixdir_state.BatchMode = BatchMode;
+
+    fuse_tests_fs_start(&Fs, ops, opts);
+    fuse_fixdir_check(&Fs);
+    fuse_tests_fs_stop(&Fs);
+}
+
+static void fuse_getattr_batch_test(void)
+{
+    static struct fuse_operations ops;
+
+    ops.getattr = fuse_fixdir_getattr;
+    ops.readdir = fuse_fixdir_readdir;
+    ops.getattr_batch = fuse_fixdir_getattr_batch;
+
+    /* the batch answers every entry; getattr is not needed */
+    fuse_fixdir_run(&ops, 0, FUSE_FIXDIR_BATCH_FULL);
+    ASSERT(1 <= fuse_fixdir_state.BatchCount);
+    ASSERT(FUSE_FIXDIR_ENTRY_COUNT == fuse_fixdir_state.BatchEntryCount);
+    ASSERT(0 == fuse_fixdir_state.ListGetattrCount);
+
+    /* the batch fails as a whole; every entry falls back to getattr */
+    fuse_fixdir_run(&ops, 0, FUSE_FIXDIR_BATCH_ERROR);
+    ASSERT(1 == fuse_fixdir_state.BatchCount);
+    ASSERT(FUSE_FIXDIR_ENTRY_COUNT == fuse_fixdir_state.ListGetattrCount);
+}
+
+static void fuse_getattr_batch_partial_test(void)
+{
+    static struct fuse_operations ops;
+
+    ops.getattr = fuse_fixdir_getattr;
+    ops.readdir = fuse_fixdir_readdir;
+    ops.getattr_batch = fuse_fixdir_getattr_batch;
+
+    /* only the entries that failed in the batch are retried with getattr */
+    fuse_fixdir_run(&ops, 0, FUSE_FIXDIR_BATCH_PARTIAL);
+    ASSERT(1 <= fuse_fixdir_state.BatchCount);
+    ASSERT(FUSE_FIXDIR_ENTRY_COUNT == fuse_fixdir_state.BatchEntryCount);
+    ASSERT((FUSE_FIXDIR_ENTRY_COUNT + 2) / 3 == fuse_fixdir_state.ListGetattrCount);
+}
+
+static void fuse_getattr_nobatch_test(void)
+{
+    static struct fuse_operations ops;
+
+    ops.getattr = fuse_fixdir_getattr;
+    ops.readdir = fuse_fixdir_readdir;
+
+    /* no getattr_batch and no thread pool: getattr for every entry */
+    fuse_fixdir_run(&ops, "ReaddirGetattrThreads=0", 0);
+    ASSERT(0 == fuse_fixdir_state.BatchCount);
+    ASSERT(FUSE_FIXDIR_ENTRY_COUNT == fuse_fixdir_state.ListGetattrCount);
+}
+
+static void fuse_getattr_parallel_test(void)
+{
+    static struct fuse_operations ops;
+
+    ops.getattr = fuse_fixdir_getattr;
+    ops.readdir = fuse_fixdir_readdir;
+
+    /* getattr on the thread pool; each entry exactly once */
+    fuse_fixdir_run(&ops, "ReaddirGetattrThreads=4", 0);
+    ASSERT(0 == fuse_fixdir_state.BatchCount);
+    ASSERT(FUSE_FIXDIR_ENTRY_COUNT == fuse_fixdir_state.ListGetattrCount);
+}
+
+/*
+ * Hidden files
+ *
+ * A small tree file system that keeps its entries in a table. A file that is deleted or
+ * replaced while it has other handles is renamed to a hidden name; it must be unlinked
+ * when the last of its handles is cleaned up (not when its last open file is closed,
+ * which may happen much later), so that its parent directory can be removed.
+ */
+#define FUSE_TREE_ENTRY_COUNT           64
+#define FUSE_TREE_HIDDEN_PREFIX         ".fuse_hidden"
+
+static struct
+{
+    SRWLOCK Lock;
+    UINT64 NextIno;
+    struct
+    {
+        char Path[MAX_PATH];            /* empty if the entry is free */
+        int IsDirectory;
+        UINT64 Ino;
+    } Entries[FUSE_TREE_ENTRY_COUNT];
+} fuse_tree_state;
+
+static int fuse_tree_find(const char *path)
+{
+    for (int I = 0; FUSE_TREE_ENTRY_COUNT > I; I++)
+        if (0 == strcmp(fuse_tree_state.Entries[I].Path, path))
+            return I;
+    return -1;
+}
+
+static int fuse_tree_is_child(const char *path, const char *dirpath)
+{
+    /* is path a direct child of dirpath; both are absolute */
+    size_t Length = 0 == strcmp(dirpath, "/") ? 0 : strlen(dirpath);
+    return '\0' != path[0] &&
+        0 == strncmp(path, dirpath, Length) && '/' == path[Length] &&
+        '\0' != path[Length + 1] && 0 == strchr(path + Length + 1, '/');
+}
+
+static int fuse_tree_has_children(const char *path)
+{
+    for (int I = 0; FUSE_TREE_ENTRY_COUNT > I; I++)
+        if (fuse_tree_is_child(fuse_tree_state.Entries[I].Path, path))
+            return 1;
+    return 0;
+}
+
+static int fuse_tree_add(const char *path, int IsDirectory)
+{
+    const char *slash = strrchr(path, '/');
+    char parent[MAX_PATH];
+    int I;
+
+    if (0 <= fuse_tree_find(path))
+        return -EEXIST;
+    if (slash != path)
+    {
+        StringCbCopyNA(parent, sizeof parent, path, slash - path);
+        if (0 > (I = fuse_tree_find(parent)) || !fuse_tree_state.Entries[I].IsDirectory)
+            return -ENOENT;
+    }
+    if (0 > (I = fuse_tree_find("")))
+        return -ENOSPC;
+
+    StringCbCopyA(fuse_tree_state.Entries[I].Path, MAX_PATH, path);
+    fuse_tree_state.Entries[I].IsDirectory = IsDirectory;
+    fuse_tree_state.Entries[I].Ino = ++fuse_tree_state.NextIno;
+    return 0;
+}
+
+static ULONG fuse_tree_count(const char *dirpath, const char *prefix)
+{
+    /* count the children of dirpath whose names start with prefix */
+    size_t Length = strlen(dirpath), PrefixLength = strlen(prefix);
+    ULONG N = 0;
+
+    AcquireSRWLockShared(&fuse_tree_state.Lock);
+    for (int I = 0; FUSE_TREE_ENTRY_COUNT > I; I++)
+        if (fuse_tree_is_child(fuse_tree_state.Entries[I].Path, dirpath) &&
+            0 == strncmp(fuse_tree_state.Entries[I].Path + Length + 1, prefix, PrefixLength))
+            N++;
+    ReleaseSRWLockShared(&fuse_tree_state.Lock);
+
+    return N;
+}
+
+static int fuse_tree_getattr(const char *path, struct fuse_stat *stbuf)
+{
+    int I, res = 0;
+
+    if (0 == strcmp(path, "/"))
+        return fuse_tests_fs_getattr(path, stbuf);
+
+    AcquireSRWLockShared(&fuse_tree_state.Lock);
+    if (0 <= (I = fuse_tree_find(path)))
+    {
+        fuse_tests_fs_getattr(fuse_tree_state.Entries[I].IsDirectory ? "/" : path, stbuf);
+        stbuf->st_ino = fuse_tree_state.Entries[I].Ino;
+    }
+    else
+        res = -ENOENT;
+    ReleaseSRWLockShared(&fuse_tree_state.Lock);
+
+    return res;
+}
+
+static int fuse_tree_mkdir(const char *path, fuse_mode_t mode)
+{
+    int res;
+
+    AcquireSRWLockExclusive(&fuse_tree_state.Lock);
+    res = fuse_tree_add(path, 1);
+    ReleaseSRWLockExclusive(&fuse_tree_state.Lock);
+
+    return res;
+}
+
+static int fuse_tree_create(const char *path, fuse_mode_t mode, struct fuse_file_info *fi)
+{
+    int res;
+
+    AcquireSRWLockExclusive(&fuse_tree_state.Lock);
+    res = fuse_tree_add(path, 0);
+    ReleaseSRWLockExclusive(&fuse_tree_state.Lock);
+
+    return res;
+}
+
+static int fuse_tree_open(const char *path, struct fuse_file_info *fi)
+{
+    int res;
+
+    AcquireSRWLockShared(&fuse_tree_state.Lock);
+    res = 0 <= fuse_tree_find(path) ? 0 : -ENOENT;
+    ReleaseSRWLockShared(&fuse_tree_state.Lock);
+
+    return res;
+}
+
+static int fuse_tree_remove(const char *path, int IsDirectory)
+{
+    int I, res = 0;
+
+    AcquireSRWLockExclusive(&fuse_tree_state.Lock);
+    if (0 > (I = fuse_tree_find(path)))
+        res = -ENOENT;
+    else if (IsDirectory != fuse_tree_state.Entries[I].IsDirectory)
+        res = IsDirectory ? -ENOTDIR : -EISDIR;
+    else if (IsDirectory && fuse_tree_has_children(path))
+        res = -ENOTEMPTY;
+    else
+        fuse_tree_state.Entries[I].Path[0] = '\0';
+    ReleaseSRWLockExclusive(&fuse_tree_state.Lock);
+
+    return res;
+}
+
+static int fuse_tree_unlink(const char *path)
+{
+    return fuse_tree_remove(path, 0);
+}
+
+static int fuse_tree_rmdir(const char *path)
+{
+    return fuse_tree_remove(path, 1);
+}
+
+static int fuse_tree_rename(const char *oldpath, const char *newpath)
+{
+    size_t Length = strlen(oldpath);
+    char path[MAX_PATH];
+    int I, J, res = 0;
+
+    AcquireSRWLockExclusive(&fuse_tree_state.Lock);
+    if (0 > (I = fuse_tree_find(oldpath)))
+        res = -ENOENT;
+    else if (0 <= (J = fuse_tree_find(newpath)) && I != J)
+    {
+        if (fuse_tree_state.Entries[I].IsDirectory != fuse_tree_state.Entries[J].IsDirectory)
+            res = fuse_tree_state.Entries[J].IsDirectory ? -EISDIR : -ENOTDIR;
+        else if (fuse_tree_has_children(newpath))
+            res = -ENOTEMPTY;
+        else
+            fuse_tree_state.Entries[J].Path[0] = '\0';
+    }
+    if (0 == res)
+        for (J = 0; FUSE_TREE_ENTRY_COUNT > J; J++)
+            if (0 == strncmp(fuse_tree_state.Entries[J].Path, oldpath, Length) &&
+                ('\0' == fuse_tree_state.Entries[J].Path[Length] ||
+                '/' == fuse_tree_state.Entries[J].Path[Length]))
+            {
+                StringCbPrintfA(path, sizeof path, "%s%s",
+                    newpath, fuse_tree_state.Entries[J].Path + Length);
+                StringCbCopyA(fuse_tree_state.Entries[J].Path, MAX_PATH, path);
+            }
+    ReleaseSRWLockExclusive(&fuse_tree_state.Lock);
+
+    return res;
+}
+
+static int fuse_tree_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+    fuse_off_t off, struct fuse_file_info *fi)
+{
+    filler(buf, ".", 0, 0);
+    filler(buf, "..", 0, 0);
+
+    AcquireSRWLockShared(&fuse_tree_state.Lock);
+    for (int I = 0; FUSE_TREE_ENTRY_COUNT > I; I++)
+        if (fuse_tree_is_child(fuse_tree_state.Entries[I].Path, path))
+            filler(buf, strrchr(fuse_tree_state.Entries[I].Path, '/') + 1, 0, 0);
+    ReleaseSRWLockShared(&fuse_tree_state.Lock);
+
+    return 0;
+}
+
+static void fuse_tree_ops(struct fuse_operations *ops)
+{
+    memset(&fuse_tree_state, 0, sizeof fuse_tree_state);
+    InitializeSRWLock(&fuse_tree_state.Lock);
+
+    memset(ops, 0, sizeof *ops);
+    ops->getattr = fuse_tree_getattr;
+    ops->mkdir = fuse_tree_mkdir;
+    ops->unlink = fuse_tree_unlink;
+    ops->rmdir = fuse_tree_rmdir;
+    ops->rename = fuse_tree_rename;
+    ops->open = fuse_tree_open;
+    ops->readdir = fuse_tree_readdir;
+    ops->create = fuse_tree_create;
+}
+
+static void fuse_tree_path(FUSE_TESTS_FS *Fs, PWSTR FilePath, size_t Size, PWSTR Name)
+{
+    StringCbPrintfW(FilePath, Size, L"%s%s", Fs->Root, Name);
+}
+
+static void fuse_hidden_delete_test(void)
+{
+    static struct fuse_operations ops;
+    FUSE_TESTS_FS Fs;
+    WCHAR DirPath[MAX_PATH], FilePath[MAX_PATH];
+    MY_FILE_DISPOSITION_INFO_EX DispositionInfo;
+    HANDLE Handle0, Handle1;
+    BOOL Success;
+
+    fuse_tree_ops(&ops);
+    fuse_tests_fs_start(&Fs, &ops, 0);
+
+    fuse_tree_path(&Fs, DirPath, sizeof DirPath, L"dir");
+    fuse_tree_path(&Fs, FilePath, sizeof FilePath, L"dir\\file");
+
+    Success = CreateDirectoryW(DirPath, 0);
+    ASSERT(Success);
+
+    Handle0 = CreateFileW(FilePath,
+        GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0,
+        CREATE_NEW, 0, 0);
+    ASSERT(INVALID_HANDLE_VALUE != Handle0);
+
+    Handle1 = CreateFileW(FilePath,
+        DELETE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0,
+        OPEN_EXISTING, 0, 0);
+    ASSERT(INVALID_HANDLE_VALUE != Handle1);
+
+    memset(&DispositionInfo, 0, sizeof DispositionInfo);
+    DispositionInfo.Flags = 3/*FILE_DISPOSITION_DELETE | FILE_DISPOSITION_POSIX_SEMANTICS*/;
+    Success = SetFileInformationByHandle(Handle1,
+        21/*FileDispositionInfoEx*/, &DispositionInfo, sizeof DispositionInfo);
+    ASSERT(Success);
+
+    Success = CloseHandle(Handle1);
+    ASSERT(Success);
+
+    /* the file is still open, so it was hidden rather than unlinked */
+    ASSERT(0 == fuse_tree_count("/dir", "file"));
+    ASSERT(1 == fuse_tree_count("/dir", FUSE_TREE_HIDDEN_PREFIX));
+
+    /* the hidden file is unlinked at Cleanup; its open file may be closed later */
+    Success = CloseHandle(Handle0);
+    ASSERT(Success);
+    ASSERT(0 == fuse_tree_count("/dir", ""));
+
+    Success = RemoveDirectoryW(DirPath);
+    ASSERT(Success);
+
+    fuse_tests_fs_stop(&Fs);
+}
+
+static void fuse_hidden_rename_test(void)
+{
+    static struct fuse_operations ops;
+    FUSE_TESTS_FS Fs;
+    WCHAR DirPath[MAX_PATH], FilePath[MAX_PATH], NewFilePath[MAX_PATH];
+    HANDLE Handle0;
+    BOOL Success;
+
+    fuse_tree_ops(&ops);
+    fuse_tests_fs_start(&Fs, &ops, 0);
+
+    fuse_tree_path(&Fs, DirPath, sizeof DirPath, L"dir");
+    fuse_tree_path(&Fs, FilePath, sizeof FilePath, L"dir\\file");
+    fuse_tree_path(&Fs, NewFilePath, sizeof NewFilePath, L"dir\\newfile");
+
+    Success = CreateDirectoryW(DirPath, 0);
+    ASSERT(Success);
+
+    Handle0 = CreateFileW(FilePath,
+        GENERIC_READ | GENERIC_WRITE, 0, 0,
+        CREATE_NEW, 0, 0);
+    ASSERT(INVALID_HANDLE_VALUE != Handle0);
+    Success = CloseHandle(Handle0);
+    ASSERT(Success);
+
+    Handle0 = CreateFileW(NewFilePath,
+        GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0,
+        CREATE_NEW, 0, 0);
+    ASSERT(INVALID_HANDLE_VALUE != Handle0);
+
+    Success = CloseHandle(Handle0);
+    ASSERT(Success);
+
+    /* the replaced file has been cleaned up (though maybe not closed), so it is not hidden */
+    Success = MoveFileExW(FilePath, NewFilePath, MOVEFILE_REPLACE_EXISTING);
+    ASSERT(Success);
+    ASSERT(1 == fuse_tree_count("/dir", ""));
+    ASSERT(1 == fuse_tree_count("/dir", "newfile"));
+
+    Success = DeleteFileW(NewFilePath);
+    ASSERT(Success);
+
+    Success = RemoveDirectoryW(DirPath);
+    ASSERT(Success);
+
+    fuse_tests_fs_stop(&Fs);
+}
+
+static void fuse_lowlevel_direntry_test(void)
+{
+    struct fuse_stat stbuf;
+    char buf[256];
+    size_t size0, size1, size;
+
+    memset(&stbuf, 0, sizeof stbuf);
+    stbuf.st_ino = 42;
+    stbuf.st_mode = 0100644;
+
+    size0 = fuse_add_direntry(0, 0, 0, "a", &stbuf, 1);
+    ASSERT(0 != size0);
+    ASSERT(0 == size0 % 8);
+
+    size1 = fuse_add_direntry(0, 0, 0, "a-longer-name", &stbuf, 2);
+    ASSERT(size1 > size0);
+
+    /* entry does not fit: size is returned, buffer is left alone */
+    memset(buf, 0xff, sizeof buf);
+    size = fuse_add_direntry(0, buf, size0 - 1, "a", &stbuf, 1);
+    ASSERT(size0 == size);
+    ASSERT((char)0xff == buf[0]);
+
+    size = fuse_add_direntry(0, buf, sizeof buf, "a", &stbuf, 1);
+    ASSERT(size0 == size);
+    size = fuse_add_direntry(0, buf + size, sizeof buf - size, "a-longer-name", &stbuf, 2);
+    ASSERT(size1 == size);
+}
+
+/*
+ * Lowlevel session
+ *
+ * The test waits for init (called by the session loop) and for the mount instead of
+ * sleeping, and checks the replies as they reach Windows. Statfs replies come from
+ * another thread after the operation has returned. Lookups of the files "f0".."f7" are
+ * queued and answered by another thread in reverse order of arrival, so every reply
+ * must be matched with its own request.
+ */
+#define FUSE_LOWLEVEL_FILE_COUNT        8
+#define FUSE_LOWLEVEL_FILE_INO          100
+#define FUSE_LOWLEVEL_FILE_SIZE         1000
+#define FUSE_LOWLEVEL_QUERY_COUNT       10
+
+static struct
+{
+    LONG InitCount, DestroyCount;
+    LONG StatfsCount, GetattrCount, LookupCount;
+    HANDLE InitEvent, LookupEvent;
+    WCHAR Root[4];
+    SRWLOCK Lock;
+    fuse_req_t Pending[FUSE_LOWLEVEL_FILE_COUNT];
+    ULONG PendingIndex[FUSE_LOWLEVEL_FILE_COUNT];
+    ULONG PendingCount;
+    BOOLEAN Stop;
+} fuse_lowlevel_state;
+
+static void fuse_lowlevel_file_attr(ULONG I, struct fuse_stat *stbuf)
+{
+    memset(stbuf, 0, sizeof *stbuf);
+    stbuf->st_ino = FUSE_LOWLEVEL_FILE_INO + I;
+    stbuf->st_mode = 0100644;
+    stbuf->st_nlink = 1;
+    stbuf->st_size = FUSE_LOWLEVEL_FILE_SIZE + I;
+}
+
+static void fuse_lowlevel_reply_entry(fuse_req_t req, ULONG I)
+{
+    struct fuse_entry_param e;
+
+    memset(&e, 0, sizeof e);
+    e.ino = FUSE_LOWLEVEL_FILE_INO + I;
+    fuse_lowlevel_file_attr(I, &e.attr);
+    fuse_reply_entry(req, &e);
+}
+
+static unsigned __stdcall fuse_lowlevel_reply_thread(void *req)
+{
+    struct fuse_statvfs stbuf;
+
+    Sleep(10);
+    memset(&stbuf, 0, sizeof stbuf);
+    stbuf.f_bsize = 4096;
+    stbuf.f_frsize = 4096;
+    stbuf.f_blocks = 1000;
+    stbuf.f_bfree = 250;
+    stbuf.f_bavail = 250;
+    stbuf.f_namemax = 255;
+    fuse_reply_statfs(req, &stbuf);
+    return 0;
+}
+
+static unsigned __stdcall fuse_lowlevel_lookup_thread(void *Data)
+{
+    fuse_req_t Pending[FUSE_LOWLEVEL_FILE_COUNT];
+    ULONG PendingIndex[FUSE_LOWLEVEL_FILE_COUNT];
+    ULONG PendingCount;
+    BOOLEAN Stop;
+
+    do
+    {
+        /* wake up when the queue is full; reply to partial queues after a while */
+        WaitForSingleObject(fuse_lowlevel_state.LookupEvent, 100);
+
+        AcquireSRWLockExclusive(&fuse_lowlevel_state.Lock);
+        PendingCount = fuse_lowlevel_state.PendingCount;
+        memcpy(Pending, fuse_lowlevel_state.Pending, PendingCount * sizeof Pending[0]);
+        memcpy(PendingIndex, fuse_lowlevel_state.PendingIndex, PendingCount * sizeof PendingIndex[0]);
+        fuse_lowlevel_state.PendingCount = 0;
+        Stop = fuse_lowlevel_state.Stop;
+        ReleaseSRWLockExclusive(&fuse_lowlevel_state.Lock);
+
+        while (0 < PendingCount)
+        {
+            PendingCount--;
+            fuse_lowlevel_reply_entry(Pending[PendingCount], PendingIndex[PendingCount]);
+        }
+    } while (!Stop);
+
+    return 0;
+}
+
+static void fuse_lowlevel_init(void *userdata, struct fuse_conn_info *conn)
+{
+    InterlockedIncrement(&fuse_lowlevel_state.InitCount);
+    SetEvent(fuse_lowlevel_state.InitEvent);
+}
+
+static void fuse_lowlevel_destroy(void *userdata)
+{
+    InterlockedIncrement(&fuse_lowlevel_state.DestroyCount);
+}
+
+static void fuse_lowlevel_statfs(fuse_req_t req, fuse_ino_t ino)
+{
+    HANDLE Thread;
+
+    /* reply from another thread after the operation has returned */
+    InterlockedIncrement(&fuse_lowlevel_state.StatfsCount);
+    Thread = (HANDLE)_beginthreadex(0, 0, fuse_lowlevel_reply_thread, req, 0, 0);
+    if (0 != Thread)
+        CloseHandle(Thread);
+    else
+        fuse_reply_err(req, ENOMEM);
+}
+
+static void fuse_lowlevel_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    char *endp;
+    ULONG I;
+    BOOLEAN Queued = FALSE;
+
+    InterlockedIncrement(&fuse_lowlevel_state.LookupCount);
+    if (FUSE_ROOT_ID != parent || 'f' != name[0] || !isdigit((unsigned char)name[1]))
+    {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    I = strtoul(name + 1, &endp, 10);
+    if ('\0' != *endp || FUSE_LOWLEVEL_FILE_COUNT <= I)
+    {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    AcquireSRWLockExclusive(&fuse_lowlevel_state.Lock);
+    if (!fuse_lowlevel_state.Stop && FUSE_LOWLEVEL_FILE_COUNT > fuse_lowlevel_state.PendingCount)
+    {
+        fuse_lowlevel_state.Pending[fuse_lowlevel_state.PendingCount] = req;
+        fuse_lowlevel_state.PendingIndex[fuse_lowlevel_state.PendingCount] = I;
+        if (FUSE_LOWLEVEL_FILE_COUNT == ++fuse_lowlevel_state.PendingCount)
+            SetEvent(fuse_lowlevel_state.LookupEvent);
+        Queued = TRUE;
+    }
+    ReleaseSRWLockExclusive(&fuse_lowlevel_state.Lock);
+
+    if (!Queued)
+        fuse_lowlevel_reply_entry(req, I);
+}
+
+static void fuse_lowlevel_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    struct fuse_stat stbuf;
+
+    InterlockedIncrement(&fuse_lowlevel_state.GetattrCount);
+    if (FUSE_LOWLEVEL_FILE_INO <= ino && FUSE_LOWLEVEL_FILE_INO + FUSE_LOWLEVEL_FILE_COUNT > ino)
+    {
+        fuse_lowlevel_file_attr((ULONG)(ino - FUSE_LOWLEVEL_FILE_INO), &stbuf);
+        fuse_reply_attr(req, &stbuf, 1.0);
+        return;
+    }
+    if (FUSE_ROOT_ID != ino)
+    {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    memset(&stbuf, 0, sizeof stbuf);
+    stbuf.st_ino = ino;
+    stbuf.st_mode = 0040755;
+    stbuf.st_nlink = 2;
+    fuse_reply_attr(req, &stbuf, 1.0);
+}
+
+static unsigned __stdcall fuse_lowlevel_tests_thread(void *se)
+{
+    return fuse_session_loop_mt(se);
+}
+
+static unsigned __stdcall fuse_lowlevel_query_thread(void *Data)
+{
+    ULONG I = (ULONG)(UINT_PTR)Data;
+    WCHAR FileName[16];
+    WIN32_FILE_ATTRIBUTE_DATA AttrData;
+
+    StringCbPrintfW(FileName, sizeof FileName, L"%sf%lu", fuse_lowlevel_state.Root, I);
+    for (ULONG J = 0; FUSE_LOWLEVEL_QUERY_COUNT > J; J++)
+    {
+        if (!GetFileAttributesExW(FileName, GetFileExInfoStandard, &AttrData))
+            return 1;
+        if (0 != (AttrData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ||
+            0 != AttrData.nFileSizeHigh ||
+            FUSE_LOWLEVEL_FILE_SIZE + I != AttrData.nFileSizeLow)
+            return 2;
+    }
+    return 0;
+}
+
+static void fuse_lowlevel_test(void)
+{
+    static struct fuse_lowlevel_ops ops;
+    char *argv[] = { "UNKNOWN", "-o", "uid=-1,gid=-1,ThreadCount=16" };
+    struct fuse_args args = FUSE_ARGS_INIT(3, argv);
+    char MountPoint[3];
+    WCHAR FileName[16];
+    struct fuse_chan *ch;
+    struct fuse_session *se;
+    HANDLE Thread, LookupThread, QueryThread[FUSE_LOWLEVEL_FILE_COUNT], Handles[2];
+    ULARGE_INTEGER CallerFree, Total, Free;
+    DWORD Drives, FileAttributes, ExitCode;
+    int Letter;
+    ULONG I;
+
+    Drives = GetLogicalDrives();
+    for (Letter = 'Z'; 'D' <= Letter && 0 != (Drives & (1 << (Letter - 'A'))); Letter--)
+        ;
+    ASSERT('D' <= Letter);
+
+    ops.init = fuse_lowlevel_init;
+    ops.destroy = fuse_lowlevel_destroy;
+    ops.statfs = fuse_lowlevel_statfs;
+    ops.lookup = fuse_lowlevel_lookup;
+    ops.getattr = fuse_lowlevel_getattr;
+    memset(&fuse_lowlevel_state, 0, sizeof fuse_lowlevel_state);
+    InitializeSRWLock(&fuse_lowlevel_state.Lock);
+    fuse_lowlevel_state.InitEvent = CreateEventW(0, TRUE, FALSE, 0);
+    ASSERT(0 != fuse_lowlevel_state.InitEvent);
+    fuse_lowlevel_state.LookupEvent = CreateEventW(0, FALSE, FALSE, 0);
+    ASSERT(0 != fuse_lowlevel_state.LookupEvent);
+    MountPoint[0] = (char)Letter;
+    MountPoint[1] = ':';
+    MountPoint[2] = '\0';
+    fuse_lowlevel_state.Root[0] = (WCHAR)Letter;
+    fuse_lowlevel_state.Root[1] = L':';
+    fuse_lowlevel_state.Root[2] = L'\\';
+
+    ch = fuse_mount(MountPoint, &args);
+    ASSERT(0 != ch);
+
+    se = fuse_lowlevel_new(&args, &ops, sizeof ops, 0);
+    ASSERT(0 != se);
+
+    ASSERT(0 == fuse_session_add_chan(se, ch));
+
+    Thread = (HANDLE)_beginthreadex(0, 0, fuse_lowlevel_tests_thread, se, 0, 0);
+    ASSERT(0 != Thread);
+
+    /* init is called by the session loop; the file system is mounted right after */
+    Handles[0] = fuse_lowlevel_state.InitEvent;
+    Handles[1] = Thread;
+    ASSERT(WAIT_OBJECT_0 == WaitForMultipleObjects(2, Handles, FALSE, 10000));
+    ASSERT(1 == fuse_lowlevel_state.InitCount);
+    for (I = 0;
+        INVALID_FILE_ATTRIBUTES == (FileAttributes = GetFileAttributesW(fuse_lowlevel_state.Root));
+        I++)
+    {
+        ASSERT(1000 > I);
+        ASSERT(WAIT_TIMEOUT == WaitForSingleObject(Thread, 10));
+    }
+
+    /* root getattr reply */
+    ASSERT(0 != (FileAttributes & FILE_ATTRIBUTE_DIRECTORY));
+    ASSERT(1 <= fuse_lowlevel_state.GetattrCount);
+
+    /* statfs reply from another thread */
+    ASSERT(GetDiskFreeSpaceExW(fuse_lowlevel_state.Root, &CallerFree, &Total, &Free));
+    ASSERT(1000 * 4096 == Total.QuadPart);
+    ASSERT(250 * 4096 == Free.QuadPart);
+    ASSERT(1 <= fuse_lowlevel_state.StatfsCount);
+
+    /* lookup error replies */
+    StringCbPrintfW(FileName, sizeof FileName, L"%smissing", fuse_lowlevel_state.Root);
+    ASSERT(INVALID_FILE_ATTRIBUTES == GetFileAttributesW(FileName));
+    ASSERT(ERROR_FILE_NOT_FOUND == GetLastError());
+    StringCbPrintfW(FileName, sizeof FileName, L"%sf%lu",
+        fuse_lowlevel_state.Root, (ULONG)FUSE_LOWLEVEL_FILE_COUNT);
+    ASSERT(INVALID_FILE_ATTRIBUTES == GetFileAttributesW(FileName));
+    ASSERT(ERROR_FILE_NOT_FOUND == GetLastError());
+
+    /* concurrent lookups with replies in reverse order */
+    LookupThread = (HANDLE)_beginthreadex(0, 0, fuse_lowlevel_lookup_thread, 0, 0, 0);
+    ASSERT(0 != LookupThread);
+    for (I = 0; FUSE_LOWLEVEL_FILE_COUNT > I; I++)
+    {
+        QueryThread[I] = (HANDLE)_beginthreadex(0, 0, fuse_lowlevel_query_thread,
+            (PVOID)(UINT_PTR)I, 0, 0);
+        ASSERT(0 != QueryThread[I]);
+    }
+    ASSERT(WAIT_OBJECT_0 ==
+        WaitForMultipleObjects(FUSE_LOWLEVEL_FILE_COUNT, QueryThread, TRUE, 60000));
+    for (I = 0; FUSE_LOWLEVEL_FILE_COUNT > I; I++)
+    {
+        GetExitCodeThread(QueryThread[I], &ExitCode);
+        CloseHandle(QueryThread[I]);
+        ASSERT(0 == ExitCode);
+    }
+    ASSERT(FUSE_LOWLEVEL_FILE_COUNT * FUSE_LOWLEVEL_QUERY_COUNT <= fuse_lowlevel_state.LookupCount);
+
+    AcquireSRWLockExclusive(&fuse_lowlevel_state.Lock);
+    fuse_lowlevel_state.Stop = TRUE;
+    ReleaseSRWLockExclusive(&fuse_lowlevel_state.Lock);
+    SetEvent(fuse_lowlevel_state.LookupEvent);
+    WaitForSingleObject(LookupThread, INFINITE);
+    CloseHandle(LookupThread);
+
+    fuse_session_exit(se);
+
+    WaitForSingleObject(Thread, INFINITE);
+    GetExitCodeThread(Thread, &ExitCode);
+    CloseHandle(Thread);
+
+    fuse_session_remove_chan(ch);
+    fuse_session_destroy(se);
+
+    fuse_unmount(MountPoint, ch);
+
+    CloseHandle(fuse_lowlevel_state.LookupEvent);
+    CloseHandle(fuse_lowlevel_state.InitEvent);
+
+    ASSERT(0 == ExitCode);
+    ASSERT(1 == fuse_lowlevel_state.InitCount);
+    ASSERT(1 == fuse_lowlevel_state.DestroyCount);
+}
+
+static void fuse_notify_batch_bench_test(void)
+{
+    static struct fuse_operations ops;
+    static const uint32_t Actions[] =
+    {
+        FSP_FUSE_NOTIFY_TRUNCATE,
+        FSP_FUSE_NOTIFY_UTIME,
+        FSP_FUSE_NOTIFY_CHMOD,
+        FSP_FUSE_NOTIFY_UTIME | FSP_FUSE_NOTIFY_TRUNCATE,
+        0,
+    };
+    char *argv[] = { "UNKNOWN" };
+    struct fuse_args args = FUSE_ARGS_INIT(1, argv);
+    struct fuse_chan *ch;
+    struct fuse *f;
+    HANDLE Thread;
+    DWORD ExitCode;
+    struct fuse_notify_item *Items;
+    char (*Paths)[32];
+    ULONG I, PathCount = 10000, Count = 100000;
+    clock_t Clock;
+    int res;
+
+    Paths = malloc(PathCount * sizeof *Paths);
+    ASSERT(0 != Paths);
+    Items = malloc(Count * sizeof *Items);
+    ASSERT(0 != Items);
+
+    for (I = 0; PathCount > I; I++)
+        sprintf_s(Paths[I], sizeof Paths[I], "/dir%lu/file%lu", I % 100, I);
+    for (I = 0; Count > I; I++)
+    {
+        Items[I].path = Paths[I % PathCount];
+        Items[I].action = Actions[(I / PathCount) % (sizeof Actions / sizeof Actions[0])];
+    }
+
+    ch = fuse_mount("*", &args);
+    ASSERT(0 != ch);
+
+    f = fuse_new(ch, &args, &ops, sizeof ops, 0);
+    ASSERT(0 != f);
+
+    Thread = (HANDLE)_beginthreadex(0, 0, fuse_tests_thread, f, 0, 0);
+    ASSERT(0 != Thread);
+
+    Sleep(1000);
+
+    Clock = clock();
+    for (I = 0; Count > I; I++)
+    {
+        res = fuse_notify(f, Items[I].path, Items[I].action);
+        ASSERT(0 == res);
+    }
+    Clock = clock() - Clock;
+    tlib_printf("single %lums", (ULONG)(Clock * 1000 / CLOCKS_PER_SEC));
+
+    Clock = clock();
+    res = fuse_notify_batch(f, Items, Count);
+    ASSERT(0 == res);
+    Clock = clock() - Clock;
+    tlib_printf("batch %lums", (ULONG)(Clock * 1000 / CLOCKS_PER_SEC));
+
+    res = fuse_notify_batch(f, Items, 0);
+    ASSERT(0 == res);
+
+    fuse_exit(f);
+
+    WaitForSingleObject(Thread, INFINITE);
+    GetExitCodeThread(Thread, &ExitCode);
+    CloseHandle(Thread);
+
+    fuse_destroy(f);
+
+    fuse_unmount("*", ch);
+
+    ASSERT(0 == ExitCode);
+
+    free(Items);
+    free(Paths);
+}
+
 void fuse_tests(void)
 {
+    TEST(fuse_lowlevel_direntry_test);
+
     if (OptExternal)
         return;
 
     TEST_OPT(fuse_sequential_test);
     TEST_OPT(fuse_parallel_test);
+    TEST(fuse_readdir_reserved_test);
+    TEST(fuse_async_test);
+    TEST(fuse_getattr_batch_test);
+    TEST(fuse_getattr_batch_partial_test);
+    TEST(fuse_getattr_nobatch_test);
+    TEST(fuse_getattr_parallel_test);
+    TEST(fuse_hidden_delete_test);
+    TEST(fuse_hidden_rename_test);
+    TEST_OPT(fuse_lowlevel_test);
+    TEST_OPT(fuse_notify_batch_bench_test);
 }
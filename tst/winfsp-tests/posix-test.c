@@ -22,6 +22,7 @@
 #include <winfsp/winfsp.h>
 #include <tlib/testsuite.h>
 #include <sddl.h>
+#include <time.h>
 
 #include "winfsp-tests.h"
 
@@ -191,6 +192,129 @@ static void posix_map_sid_test(void)
 #undef TEST_UIDMAP_SID
 }
 
+static void posix_map_sid_cache_test(void)
+{
+    /*
+     * Change the UID map many more times than the SID cache pool could hold entries for without
+     * reclaiming it. Every generation must see its own mapping and the default mappings, both
+     * on a cache miss and on a cache hit.
+     */
+    static PWSTR SidStr[] =
+    {
+        L"S-1-5-18",
+        L"S-1-5-32-545",
+        L"S-1-5-64-10",
+        L"S-1-16-8192",
+    };
+    PSID Sid0[sizeof SidStr / sizeof SidStr[0]], Sid1;
+    UINT32 Uid0[sizeof SidStr / sizeof SidStr[0]], Uid;
+    UINT32 UidMap_Uid[1];
+    PSID UidMap_Sid[1];
+    ULONG I, J, K;
+    NTSTATUS Result;
+    BOOL Success;
+
+    for (J = 0; sizeof SidStr / sizeof SidStr[0] > J; J++)
+    {
+        Success = ConvertStringSidToSidW(SidStr[J], &Sid0[J]);
+        ASSERT(Success);
+        Result = FspPosixMapSidToUid(Sid0[J], &Uid0[J]);
+        ASSERT(NT_SUCCESS(Result));
+    }
+    Success = ConvertStringSidToSidW(L"S-1-5-21-1111111111-2222222222-3333333333-2001",
+        &UidMap_Sid[0]);
+    ASSERT(Success);
+
+    for (I = 0; 4000 > I; I++)
+    {
+        UidMap_Uid[0] = 0x200000 + I;
+        Result = FspPosixSetUidMap(UidMap_Uid, UidMap_Sid, 1);
+        ASSERT(NT_SUCCESS(Result));
+
+        for (K = 0; 2 > K; K++)
+        {
+            Result = FspPosixMapSidToUid(UidMap_Sid[0], &Uid);
+            ASSERT(NT_SUCCESS(Result));
+            ASSERT(UidMap_Uid[0] == Uid);
+
+            Result = FspPosixMapUidToSid(UidMap_Uid[0], &Sid1);
+            ASSERT(NT_SUCCESS(Result));
+            ASSERT(EqualSid(UidMap_Sid[0], Sid1));
+            FspDeleteSid(Sid1, FspPosixMapUidToSid);
+
+            for (J = 0; sizeof SidStr / sizeof SidStr[0] > J; J++)
+            {
+                Result = FspPosixMapSidToUid(Sid0[J], &Uid);
+                ASSERT(NT_SUCCESS(Result));
+                ASSERT(Uid0[J] == Uid);
+
+                Result = FspPosixMapUidToSid(Uid0[J], &Sid1);
+                ASSERT(NT_SUCCESS(Result));
+                ASSERT(EqualSid(Sid0[J], Sid1));
+                FspDeleteSid(Sid1, FspPosixMapUidToSid);
+            }
+        }
+    }
+
+    Result = FspPosixSetUidMap(0, 0, 0);
+    ASSERT(NT_SUCCESS(Result));
+
+    LocalFree(UidMap_Sid[0]);
+    for (J = 0; sizeof SidStr / sizeof SidStr[0] > J; J++)
+        LocalFree(Sid0[J]);
+}
+
+static void posix_map_sid_bench_test(void)
+{
+    static PWSTR SidStr[] =
+    {
+        L"S-1-5-18",
+        L"S-1-5-32-545",
+        L"S-1-5-64-10",
+        L"S-1-16-8192",
+        L"S-1-5-21-1111111111-2222222222-3333333333-1001",
+    };
+    PSID Sid0[sizeof SidStr / sizeof SidStr[0]], Sid1;
+    UINT32 Uid0[sizeof SidStr / sizeof SidStr[0]], Uid;
+    ULONG I, J, Count = 1000000;
+    NTSTATUS Result;
+    BOOL Success;
+    clock_t Clock;
+
+    for (J = 0; sizeof SidStr / sizeof SidStr[0] > J; J++)
+    {
+        Success = ConvertStringSidToSidW(SidStr[J], &Sid0[J]);
+        ASSERT(Success);
+        Result = FspPosixMapSidToUid(Sid0[J], &Uid0[J]);
+        ASSERT(NT_SUCCESS(Result));
+    }
+
+    Clock = clock();
+    for (I = 0; Count > I; I++)
+    {
+        J = I % (sizeof SidStr / sizeof SidStr[0]);
+        Result = FspPosixMapSidToUid(Sid0[J], &Uid);
+        ASSERT(NT_SUCCESS(Result));
+        ASSERT(Uid0[J] == Uid);
+    }
+    Clock = clock() - Clock;
+    tlib_printf("sid2uid %lums", (ULONG)(Clock * 1000 / CLOCKS_PER_SEC));
+
+    Clock = clock();
+    for (I = 0; Count > I; I++)
+    {
+        J = I % (sizeof SidStr / sizeof SidStr[0]);
+        Result = FspPosixMapUidToSid(Uid0[J], &Sid1);
+        ASSERT(NT_SUCCESS(Result));
+        FspDeleteSid(Sid1, FspPosixMapUidToSid);
+    }
+    Clock = clock() - Clock;
+    tlib_printf("uid2sid %lums", (ULONG)(Clock * 1000 / CLOCKS_PER_SEC));
+
+    for (J = 0; sizeof SidStr / sizeof SidStr[0] > J; J++)
+        LocalFree(Sid0[J]);
+}
+
 static void posix_map_sd_test(void)
 {
     struct
@@ -257,6 +381,73 @@ static void posix_map_sd_test(void)
     }
 }
 
+static void posix_map_sd_bench_test(void)
+{
+    /* perm2sd mirrors the work done by the FUSE layer for every GetSecurity request */
+    static struct
+    {
+        UINT32 Uid, Gid, Mode;
+    } map[] =
+    {
+        { 18, 544, 00644 },
+        { 18, 544, 00755 },
+        { 18, 544, 0040755 },
+        { 544, 544, 00600 },
+        { 544, 544, 0040700 },
+    };
+    PSECURITY_DESCRIPTOR SecurityDescriptor0[sizeof map / sizeof map[0]], SecurityDescriptor;
+    union
+    {
+        SECURITY_DESCRIPTOR V;
+        UINT8 B[1024];
+    } Buffer;
+    UINT32 Uid, Gid, Mode;
+    ULONG I, J, Count = 1000000, Size;
+    NTSTATUS Result;
+    clock_t Clock;
+
+    for (J = 0; sizeof map / sizeof map[0] > J; J++)
+    {
+        Result = FspPosixMapPermissionsToSecurityDescriptor(
+            map[J].Uid, map[J].Gid, map[J].Mode, &SecurityDescriptor0[J]);
+        ASSERT(NT_SUCCESS(Result));
+    }
+
+    Clock = clock();
+    for (I = 0; Count > I; I++)
+    {
+        J = I % (sizeof map / sizeof map[0]);
+        Result = FspPosixMergePermissionsToSecurityDescriptor(
+            map[J].Uid, map[J].Gid, map[J].Mode, 0, &SecurityDescriptor);
+        ASSERT(NT_SUCCESS(Result));
+        Size = GetSecurityDescriptorLength(SecurityDescriptor);
+        ASSERT(sizeof Buffer >= Size);
+        memcpy(&Buffer, SecurityDescriptor, Size);
+        FspDeleteSecurityDescriptor(SecurityDescriptor,
+            FspPosixMergePermissionsToSecurityDescriptor);
+    }
+    Clock = clock() - Clock;
+    tlib_printf("perm2sd %lums", (ULONG)(Clock * 1000 / CLOCKS_PER_SEC));
+
+    Clock = clock();
+    for (I = 0; Count > I; I++)
+    {
+        J = I % (sizeof map / sizeof map[0]);
+        Result = FspPosixMapSecurityDescriptorToPermissions(
+            SecurityDescriptor0[J], &Uid, &Gid, &Mode);
+        ASSERT(NT_SUCCESS(Result));
+        ASSERT(map[J].Uid == Uid);
+        ASSERT(map[J].Gid == Gid);
+        ASSERT((map[J].Mode & 01777) == Mode);
+    }
+    Clock = clock() - Clock;
+    tlib_printf("sd2perm %lums", (ULONG)(Clock * 1000 / CLOCKS_PER_SEC));
+
+    for (J = 0; sizeof map / sizeof map[0] > J; J++)
+        FspDeleteSecurityDescriptor(SecurityDescriptor0[J],
+            FspPosixMapPermissionsToSecurityDescriptor);
+}
+
 static void posix_merge_sd_test(void)
 {
     struct
@@ -373,13 +564,195 @@ static void posix_map_path_test(void)
     }
 }
 
+static char *posix_map_path_ref_w2p(PWSTR WindowsPath)
+{
+    /* reference implementation: previous two-pass conversion */
+    static UINT32 InvalidPathChars[4] = { 0x7fffffff, 0x2020002b, 0x00000008, 0x00000008 };
+    char *PosixPath, *p, *q;
+    int Size;
+
+    Size = WideCharToMultiByte(CP_UTF8, 0, WindowsPath, -1, 0, 0, 0, 0);
+    ASSERT(0 != Size);
+    PosixPath = malloc(Size);
+    ASSERT(0 != PosixPath);
+    Size = WideCharToMultiByte(CP_UTF8, 0, WindowsPath, -1, PosixPath, Size, 0, 0);
+    ASSERT(0 != Size);
+
+    for (p = PosixPath, q = p; *p; p++)
+    {
+        unsigned char c = *p;
+
+        if ('\\' == c)
+            *q++ = '/';
+        else if (0xef == c && 0x80 == (0xfc & p[1]) && 0x80 == (0xc0 & p[2]))
+        {
+            c = ((p[1] & 0x3) << 6) | (p[2] & 0x3f);
+            if (128 > c && (InvalidPathChars[c >> 5] & (0x80000000 >> (c & 0x1f))))
+                *q++ = c, p += 2;
+            else
+                *q++ = *p++, *q++ = *p++, *q++ = *p;
+        }
+        else
+            *q++ = c;
+    }
+    *q = '\0';
+
+    return PosixPath;
+}
+
+static PWSTR posix_map_path_ref_p2w(const char *PosixPath)
+{
+    /* reference implementation: previous two-pass conversion */
+    static UINT32 InvalidPathChars[4] = { 0x7fffffff, 0x2020002b, 0x00000008, 0x00000008 };
+    PWSTR WindowsPath, p;
+    int Size;
+
+    Size = MultiByteToWideChar(CP_UTF8, 0, PosixPath, -1, 0, 0);
+    ASSERT(0 != Size);
+    WindowsPath = malloc(Size * sizeof(WCHAR));
+    ASSERT(0 != WindowsPath);
+    Size = MultiByteToWideChar(CP_UTF8, 0, PosixPath, -1, WindowsPath, Size);
+    ASSERT(0 != Size);
+
+    for (p = WindowsPath; *p; p++)
+    {
+        WCHAR c = *p;
+
+        if (L'/' == c)
+            *p = L'\\';
+        else if (128 > c && (InvalidPathChars[c >> 5] & (0x80000000 >> (c & 0x1f))))
+            *p |= 0xf000;
+    }
+
+    return WindowsPath;
+}
+
+static void posix_map_path_fuzz_test(void)
+{
+    static const WCHAR WAlphabet[] =
+    {
+        L'a', L'Z', L'0', L'.', L' ', L'\\', L'/', L':', L'*', L'?', L'"', L'<', L'>', L'|',
+        0x01, 0x1f, 0x7f, 0x80, 0xe9, 0x7ff, 0x800, 0x3b1, 0x4e2d,
+        0xd800, 0xdbff, 0xdc00, 0xdfff, 0xf000, 0xf03a, 0xf05c, 0xf02f, 0xf07f, 0xf080, 0xfffd,
+        0xffff,
+    };
+    static const UINT8 Alphabet[] =
+    {
+        'a', 'Z', '0', '.', ' ', '\\', '/', ':', '*', '?', '"', '<', '>', '|',
+        0x01, 0x1f, 0x7f, 0x80, 0xbf, 0xc0, 0xc1, 0xc2, 0xdf, 0xe0, 0xed, 0xef, 0xf0, 0xf4,
+        0xf5, 0xff, 0x9f, 0xa0, 0x8f, 0x90,
+    };
+    /* extra element so that strings can start at an odd (unaligned) address */
+    __declspec(align(16)) WCHAR WBuf[1 + 300];
+    __declspec(align(16)) char Buf[1 + 1200];
+    PWSTR WindowsPath, RefWindowsPath;
+    char *PosixPath, *RefPosixPath;
+    ULONG I, K, N, Size;
+    NTSTATUS Result;
+
+    srand((unsigned)time(0));
+
+    for (I = 0; 100000 > I; I++)
+    {
+        PWSTR W = WBuf + rand() % 2;
+        char *P = Buf + rand() % 2;
+
+        N = rand() % 300;
+        for (K = 0; N > K; K++)
+            W[K] = 0 == rand() % 4 ?
+                WAlphabet[rand() % (sizeof WAlphabet / sizeof WAlphabet[0])] :
+                (WCHAR)(L'a' + rand() % 26);
+        W[K] = L'\0';
+
+        RefPosixPath = posix_map_path_ref_w2p(W);
+        Result = FspPosixMapWindowsToPosixPath(W, &PosixPath);
+        ASSERT(NT_SUCCESS(Result));
+        ASSERT(0 == strcmp(RefPosixPath, PosixPath));
+        Size = (ULONG)strlen(RefPosixPath);
+        Result = FspPosixMapWindowsToPosixPathBuf(W, Buf, &Size, TRUE);
+        ASSERT(STATUS_BUFFER_TOO_SMALL == Result);
+        ASSERT(strlen(RefPosixPath) + 1 == Size);
+        Result = FspPosixMapWindowsToPosixPathBuf(W, Buf, &Size, TRUE);
+        ASSERT(NT_SUCCESS(Result));
+        ASSERT(strlen(RefPosixPath) + 1 == Size);
+        ASSERT(0 == strcmp(RefPosixPath, Buf));
+        FspPosixDeletePath(PosixPath);
+        free(RefPosixPath);
+
+        N = rand() % 600;
+        for (K = 0; N > K; K++)
+            P[K] = 0 == rand() % 4 ?
+                Alphabet[rand() % (sizeof Alphabet / sizeof Alphabet[0])] :
+                (char)('a' + rand() % 26);
+        P[K] = '\0';
+
+        RefWindowsPath = posix_map_path_ref_p2w(P);
+        Result = FspPosixMapPosixToWindowsPath(P, &WindowsPath);
+        ASSERT(NT_SUCCESS(Result));
+        ASSERT(0 == wcscmp(RefWindowsPath, WindowsPath));
+        Size = (ULONG)wcslen(RefWindowsPath) * sizeof(WCHAR);
+        Result = FspPosixMapPosixToWindowsPathBuf(P, WBuf, &Size, TRUE);
+        ASSERT(STATUS_BUFFER_TOO_SMALL == Result);
+        ASSERT((wcslen(RefWindowsPath) + 1) * sizeof(WCHAR) == Size);
+        Result = FspPosixMapPosixToWindowsPathBuf(P, WBuf, &Size, TRUE);
+        ASSERT(NT_SUCCESS(Result));
+        ASSERT((wcslen(RefWindowsPath) + 1) * sizeof(WCHAR) == Size);
+        ASSERT(0 == wcscmp(RefWindowsPath, WBuf));
+        FspPosixDeletePath(WindowsPath);
+        free(RefWindowsPath);
+    }
+}
+
+static void posix_map_path_bench_test(void)
+{
+    static WCHAR WindowsPath[] = L"\\Users\\billziss\\Projects\\winfsp\\tst\\winfsp-tests\\posix-test.c";
+    char PosixPathBuf[256], *PosixPath, *RefPosixPath;
+    ULONG I, Size, Count = 1000000;
+    NTSTATUS Result;
+    clock_t Clock;
+
+    Clock = clock();
+    for (I = 0; Count > I; I++)
+    {
+        RefPosixPath = posix_map_path_ref_w2p(WindowsPath);
+        free(RefPosixPath);
+    }
+    Clock = clock() - Clock;
+    tlib_printf("two-pass %lums", (ULONG)(Clock * 1000 / CLOCKS_PER_SEC));
+
+    Clock = clock();
+    for (I = 0; Count > I; I++)
+    {
+        Result = FspPosixMapWindowsToPosixPath(WindowsPath, &PosixPath);
+        ASSERT(NT_SUCCESS(Result));
+        FspPosixDeletePath(PosixPath);
+    }
+    Clock = clock() - Clock;
+    tlib_printf("alloc %lums", (ULONG)(Clock * 1000 / CLOCKS_PER_SEC));
+
+    Clock = clock();
+    for (I = 0; Count > I; I++)
+    {
+        Size = sizeof PosixPathBuf;
+        Result = FspPosixMapWindowsToPosixPathBuf(WindowsPath, PosixPathBuf, &Size, TRUE);
+        ASSERT(NT_SUCCESS(Result));
+    }
+    Clock = clock() - Clock;
+    tlib_printf("buf %lums", (ULONG)(Clock * 1000 / CLOCKS_PER_SEC));
+}
+
 void posix_tests(void)
 {
     if (OptExternal)
         return;
 
     TEST(posix_map_sid_test);
+    TEST(posix_map_sid_cache_test);
+    TEST_OPT(posix_map_sid_bench_test);
     TEST(posix_map_sd_test);
+    TEST_OPT(posix_map_sd_bench_test);
     TEST(posix_merge_sd_test);
     TEST(posix_map_path_test);
+    TEST(posix_map_path_fuzz_test);
+    TEST_OPT(posix_map_path_bench_test);
 }
@@ -0,0 +1,186 @@
+/**
+ * @file wcsname-test.c
+ *
+ * @copyright 2015-2026 Bill Zissimopoulos
+ */
+/*
+ * This file is part of WinFsp.
+ *
+ * You can redistribute it and/or modify it under the terms of the GNU
+ * General Public License version 3 as published by the Free Software
+ * Foundation.
+ *
+ * Licensees holding a valid commercial license may use this software
+ * in accordance with the commercial license agreement provided in
+ * conjunction with the software.  The terms and conditions of any such
+ * commercial license agreement shall govern, supersede, and render
+ * ineffective any application of the GPLv3 license to this software,
+ * notwithstanding of any reference thereto in the software or
+ * associated repository.
+ */
+
+#include <winfsp/winfsp.h>
+#include <tlib/testsuite.h>
+#include <time.h>
+
+#include <shared/ku/wcsname.h>
+
+#include "winfsp-tests.h"
+
+static SIZE_T wcsname_cmp_span_ref(const WCHAR *s, const WCHAR *t, SIZE_T n)
+{
+    SIZE_T i;
+    for (i = 0; n > i; i++)
+        if (s[i] != t[i])
+            break;
+    return i;
+}
+
+static SIZE_T wcsname_icmp_span_ref(const WCHAR *s, const WCHAR *t, SIZE_T n)
+{
+    SIZE_T i;
+    for (i = 0; n > i; i++)
+    {
+        WCHAR c = s[i], d = t[i];
+        if (0x80 <= c || 0x80 <= d)
+            break;
+        if (L'a' <= c && c <= L'z')
+            c -= L'a' - L'A';
+        if (L'a' <= d && d <= L'z')
+            d -= L'a' - L'A';
+        if (c != d)
+            break;
+    }
+    return i;
+}
+
+static void wcsname_check(const WCHAR *s, const WCHAR *t, SIZE_T n)
+{
+    SIZE_T CmpSpan = wcsname_cmp_span_ref(s, t, n);
+    SIZE_T IcmpSpan = wcsname_icmp_span_ref(s, t, n);
+    int Cmp = n > CmpSpan ? (int)s[CmpSpan] - (int)t[CmpSpan] : 0;
+
+    ASSERT(CmpSpan == FspWcsnCmpSpanScalar(s, t, n));
+    ASSERT(CmpSpan == FspWcsnCmpSpan(s, t, n));
+    ASSERT(IcmpSpan == FspWcsnAsciiIcmpSpanScalar(s, t, n));
+    ASSERT(IcmpSpan == FspWcsnAsciiIcmpSpan(s, t, n));
+    ASSERT(Cmp == FspWcsnCmp(s, t, n));
+}
+
+static void wcsname_exhaustive_test(void)
+{
+    /*
+     * Check every pair of characters in every lane of a vector and in the scalar tail.
+     * The characters include all of ASCII plus boundary characters around case ranges,
+     * the 0x80 ASCII boundary and characters that become negative as signed 16-bit.
+     */
+    static const WCHAR Extra[] =
+    {
+        0x0080, 0x00c0, 0x00e0, 0x00ff, 0x0100, 0x0141, 0x0161, 0x0391, 0x03b1, 0x7fff,
+        0x8000, 0x8041, 0x8061, 0xff21, 0xff41, 0xff7f, 0xff80, 0xffdf, 0xfffe, 0xffff,
+    };
+    WCHAR Chars[128 + sizeof Extra / sizeof Extra[0]];
+    WCHAR S[40], T[40];
+    ULONG CharCount, I, J, N, P;
+
+    for (I = 0; 128 > I; I++)
+        Chars[I] = (WCHAR)I;
+    for (I = 0; sizeof Extra / sizeof Extra[0] > I; I++)
+        Chars[128 + I] = Extra[I];
+    CharCount = sizeof Chars / sizeof Chars[0];
+
+    for (N = 1; sizeof S / sizeof S[0] >= N; N++)
+        for (P = 0; N > P; P += 0 == N % 8 || 17 == N ? 1 : N - P > 9 ? 3 : 1)
+            for (I = 0; CharCount > I; I++)
+                for (J = 0; CharCount > J; J++)
+                {
+                    ULONG K;
+                    for (K = 0; N > K; K++)
+                        S[K] = T[K] = (WCHAR)(L'a' + K % 26);
+                    S[P] = Chars[I];
+                    T[P] = Chars[J];
+                    wcsname_check(S, T, N);
+                    wcsname_check(S, T, P);
+                    if (N > P + 1)
+                    {
+                        /* mismatch after the tested position must not matter if P differs */
+                        T[N - 1] ^= 1;
+                        wcsname_check(S, T, N);
+                    }
+                }
+}
+
+static void wcsname_random_test(void)
+{
+    static const WCHAR Alphabet[] = L"aAzZ@[`{09._-\\:\x00e9\x00c9\x0100\x8000\xffff";
+    WCHAR S[300], T[300];
+    ULONG I, K, N;
+
+    srand((unsigned)time(0));
+
+    for (I = 0; 100000 > I; I++)
+    {
+        N = rand() % (sizeof S / sizeof S[0]);
+        for (K = 0; N > K; K++)
+        {
+            S[K] = Alphabet[rand() % (sizeof Alphabet / sizeof Alphabet[0] - 1)];
+            T[K] = 0 == rand() % 64 ?
+                Alphabet[rand() % (sizeof Alphabet / sizeof Alphabet[0] - 1)] :
+                (0 == rand() % 2 || L'a' > (S[K] | 0x20) || (S[K] | 0x20) > L'z' ? S[K] : S[K] ^ 0x20);
+        }
+        wcsname_check(S, T, N);
+    }
+}
+
+static void wcsname_bench_test(void)
+{
+    static WCHAR Names[1024][64];
+    ULONG I, J, Count = 5000;
+    SIZE_T Sum;
+    clock_t Clock;
+
+    for (I = 0; 1024 > I; I++)
+    {
+        /* long common prefix; names differ in their last few characters */
+        for (J = 0; 63 > J; J++)
+            Names[I][J] = (WCHAR)((0 == J % 2 ? L'a' : L'A') + J % 26);
+        Names[I][58] = (WCHAR)(L'a' + I / 26 % 26);
+        Names[I][59] = (WCHAR)(L'a' + I % 26);
+        Names[I][63] = 0;
+    }
+
+    Clock = clock();
+    for (Sum = 0, J = 0; Count > J; J++)
+        for (I = 1; 1024 > I; I++)
+            Sum += FspWcsnAsciiIcmpSpanScalar(Names[I - 1], Names[I], 63);
+    Clock = clock() - Clock;
+    tlib_printf("scalar icmp %lums (%lu)", (ULONG)(Clock * 1000 / CLOCKS_PER_SEC), (ULONG)Sum);
+
+    Clock = clock();
+    for (Sum = 0, J = 0; Count > J; J++)
+        for (I = 1; 1024 > I; I++)
+            Sum += FspWcsnAsciiIcmpSpan(Names[I - 1], Names[I], 63);
+    Clock = clock() - Clock;
+    tlib_printf("vector icmp %lums (%lu)", (ULONG)(Clock * 1000 / CLOCKS_PER_SEC), (ULONG)Sum);
+
+    Clock = clock();
+    for (Sum = 0, J = 0; Count > J; J++)
+        for (I = 1; 1024 > I; I++)
+            Sum += FspWcsnCmpSpanScalar(Names[I - 1], Names[I], 63);
+    Clock = clock() - Clock;
+    tlib_printf("scalar cmp %lums (%lu)", (ULONG)(Clock * 1000 / CLOCKS_PER_SEC), (ULONG)Sum);
+
+    Clock = clock();
+    for (Sum = 0, J = 0; Count > J; J++)
+        for (I = 1; 1024 > I; I++)
+            Sum += FspWcsnCmpSpan(Names[I - 1], Names[I], 63);
+    Clock = clock() - Clock;
+    tlib_printf("vector cmp %lums (%lu)", (ULONG)(Clock * 1000 / CLOCKS_PER_SEC), (ULONG)Sum);
+}
+
+void wcsname_tests(void)
+{
+    TEST(wcsname_exhaustive_test);
+    TEST(wcsname_random_test);
+    TEST_OPT(wcsname_bench_test);
+}
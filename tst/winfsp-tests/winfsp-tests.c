@@ -226,6 +226,7 @@ int main(int argc, char *argv[])
     TESTSUITE(fuse_tests);
     TESTSUITE(posix_tests);
     TESTSUITE(uuid5_tests);
+    TESTSUITE(wcsname_tests);
     TESTSUITE(eventlog_tests);
     TESTSUITE(path_tests);
     TESTSUITE(dirbuf_tests);